@@ -10,6 +10,8 @@
 #include "ADSExplorer_i.c"
 #include "ShellFolder.h"
 #include "ContextMenuEntry.h"
+#include "ContentSearch.h"
+#include "UsageAnalyzer.h"
 
 
 CComModule _Module;
@@ -78,3 +80,42 @@ STDAPI DllUnregisterServer() {
 	// successful.
 	return hr;
 }
+
+/**
+ * Write a report of where the bytes in alternate streams are, for running
+ * from a scheduled task:
+ *   rundll32 ADSExplorer.dll,AnalyzeStreamUsage [/top:N] [/out:file] /all | root...
+ * See CUsageAnalyzer::RunCommandLine.
+ */
+extern "C" void CALLBACK AnalyzeStreamUsageW(
+	_In_ HWND      hwnd,
+	_In_ HINSTANCE hInstance,
+	_In_ LPWSTR    pszCmdLine,
+	_In_ int       nCmdShow
+) {
+	UNREFERENCED_PARAMETER(hwnd);
+	UNREFERENCED_PARAMETER(hInstance);
+	UNREFERENCED_PARAMETER(nCmdShow);
+	HRESULT hr = ADSX::CUsageAnalyzer::RunCommandLine(pszCmdLine);
+	LOG(L" ** AnalyzeStreamUsage: " << HRESULTToString(hr));
+	UNREFERENCED_PARAMETER(hr);
+}
+
+/**
+ * Write a report of which streams contain some bytes, and where:
+ *   rundll32 ADSExplorer.dll,SearchStreamContent [/text:s] [/hex:bytes] [/regex:re] [/out:file] root...
+ * See CContentSearch::RunCommandLine.
+ */
+extern "C" void CALLBACK SearchStreamContentW(
+	_In_ HWND      hwnd,
+	_In_ HINSTANCE hInstance,
+	_In_ LPWSTR    pszCmdLine,
+	_In_ int       nCmdShow
+) {
+	UNREFERENCED_PARAMETER(hwnd);
+	UNREFERENCED_PARAMETER(hInstance);
+	UNREFERENCED_PARAMETER(nCmdShow);
+	HRESULT hr = ADSX::CContentSearch::RunCommandLine(pszCmdLine);
+	LOG(L" ** SearchStreamContent: " << HRESULTToString(hr));
+	UNREFERENCED_PARAMETER(hr);
+}
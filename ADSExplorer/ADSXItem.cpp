@@ -2,19 +2,37 @@
 
 #include "ADSXItem.h"
 
+#include <new>
+
 namespace ADSX {
 
+// Bytes in an item ID before the name starts
+static constexpr SIZE_T cbItemHeader =
+	offsetof(ADSXITEMID, abID) + offsetof(CItem, szName);
+
 
 bool CItem::IsOwn(PCUIDLIST_RELATIVE pidlr) {
-	return (
+	if (
 		// Not null of course
-		pidlr != NULL &&
-		// Is of expected size
-		pidlr->mkid.cb == sizeof(ITEMIDLIST) + sizeof(CItem) - sizeof(BYTE) &&
+		pidlr == NULL ||
+		// Big enough to hold at least an empty name
+		pidlr->mkid.cb < cbItemHeader + sizeof(WCHAR) ||
 		// Is a child PIDL as are all ADSX::CItems
-		ILIsChild(pidlr) &&
+		!ILIsChild(pidlr)
+	) {
+		return false;
+	}
+	const CItem *pItem = CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr));
+	return (
 		// Pronounces shibboleth correctly
-		CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr))->SIGNATURE == 'ADSX'
+		pItem->SIGNATURE == 'ADSX' &&
+		// Is from this version of us and not some past or future one
+		pItem->bVersion == LATEST_VERSION &&
+		(pItem->fFlags & ~FLAGS_KNOWN) == 0 &&
+		// Exactly as big as its name says it is
+		pidlr->mkid.cb == cbItemHeader + (pItem->cchName + 1) * sizeof(WCHAR) &&
+		// Name ends where it says it does
+		pItem->szName[pItem->cchName] == L'\0'
 	);
 }
 
@@ -27,13 +45,66 @@ const CItem *CItem::Get(PCUITEMID_CHILD pidlc) {
 	return reinterpret_cast<const CItem *>(&pidlc->mkid.abID);
 }
 
-PADSXITEMID_CHILD CItem::NewPidl() {
-	auto adsxpidlc = static_cast<PADSXITEMID_CHILD>(
-		CoTaskMemAlloc(sizeof(ADSXITEMID_CHILD))
+PITEMID_CHILD CItem::NewPidl(
+	_In_reads_(cchName) PCWCH    pszName,
+	_In_                SIZE_T   cchName,
+	_In_                LONGLONG llFilesize,
+	_In_                BYTE     fFlags
+) {
+	const SIZE_T cbItem = cbItemHeader + (cchName + 1) * sizeof(WCHAR);
+	if (cbItem > USHRT_MAX) return NULL;
+
+	// The item, then the null terminator item
+	auto pb = static_cast<BYTE *>(CoTaskMemAlloc(cbItem + sizeof(USHORT)));
+	if (pb == NULL) return NULL;
+
+	auto adsxpidlc = reinterpret_cast<PADSXITEMID_CHILD>(pb);
+	adsxpidlc->mkid.cb = static_cast<USHORT>(cbItem);
+	CItem *pItem = new (&adsxpidlc->mkid.abID) CItem();
+	pItem->fFlags = fFlags;
+	pItem->cchName = static_cast<USHORT>(cchName);
+	pItem->uNameHash = HashName(pszName, cchName);
+	pItem->llFilesize = llFilesize;
+	CopyMemory(pItem->szName, pszName, cchName * sizeof(WCHAR));
+	pItem->szName[cchName] = L'\0';
+	*reinterpret_cast<USHORT UNALIGNED *>(pb + cbItem) = 0;
+
+	return reinterpret_cast<PITEMID_CHILD>(pb);
+}
+
+PITEMID_CHILD CItem::Clone(_In_ PCUITEMID_CHILD pidlc) {
+	ATLASSERT(IsOwn(pidlc));
+	// The item and the null terminator item after it
+	const SIZE_T cb = pidlc->mkid.cb + sizeof(USHORT);
+	auto pidlcCopy = static_cast<PITEMID_CHILD>(CoTaskMemAlloc(cb));
+	if (pidlcCopy == NULL) return NULL;
+	CopyMemory(pidlcCopy, pidlc, cb);
+	return pidlcCopy;
+}
+
+UINT32 CItem::HashName(
+	_In_reads_(cchName) PCWCH  pszName,
+	_In_                SIZE_T cchName
+) {
+	UINT32 uHash = 2166136261u;
+	for (SIZE_T i = 0; i < cchName; i++) {
+		uHash ^= pszName[i];
+		uHash *= 16777619u;
+	}
+	return uHash;
+}
+
+bool CItem::Equal(_In_ const CItem *pItem1, _In_ const CItem *pItem2) {
+	return (
+		pItem1->uNameHash == pItem2->uNameHash &&
+		pItem1->cchName == pItem2->cchName &&
+		pItem1->fFlags == pItem2->fFlags &&
+		memcmp(
+			pItem1->szName,
+			pItem2->szName,
+			pItem1->cchName * sizeof(WCHAR)
+		) == 0
 	);
-	if (adsxpidlc == NULL) return NULL;
-	new (reinterpret_cast<CItem *>(&adsxpidlc->mkid.abID)) CItem();
-	return adsxpidlc;
 }
 
 }  // namespace ADSX
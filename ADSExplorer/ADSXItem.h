@@ -4,23 +4,60 @@
 
 namespace ADSX {
 
-struct _ADSXITEMID_CHILD;
-using PADSXITEMID_CHILD = _ADSXITEMID_CHILD *;
+// Everything in an item ID is byte-packed; the shell copies them around as
+// opaque blobs and doesn't care about our alignment.
+#include <pshpack1.h>
 
 struct CItem {
+	// Bump this whenever the layout below changes. Item IDs get persisted
+	// (shortcuts, Quick Access, the shell's own caches), so old ones will come
+	// back to us; IsOwn turns away any version it doesn't know.
+	static constexpr BYTE LATEST_VERSION = 1;
+
+	// Bits for fFlags. Builds from before a flag existed turn away items
+	// with it set, so adding one doesn't need a new version.
+	enum : BYTE {
+		// Not a stream: the pseudofolder holding every stream in the tree
+		// under the folder it's in
+		FLAG_TREE = 0x01,
+		// A stream found under that pseudofolder. szName is the path of the
+		// file it's on relative to the tree's root, then a colon, then the
+		// stream's name: "sub\file.txt:stream".
+		FLAG_RELATIVE = 0x02,
+		// Not a stream: the pseudofolder holding only those children of the
+		// folder it's in that have named streams
+		FLAG_FILTER = 0x04,
+
+		FLAGS_KNOWN = FLAG_TREE | FLAG_RELATIVE | FLAG_FILTER,
+	};
+
 	// Identifying marker a la file signatures
 	UINT32 SIGNATURE = 'ADSX';
+	BYTE bVersion = LATEST_VERSION;
+	// FLAG_*; 0 for a plain stream of the file being browsed.
+	BYTE fFlags = 0;
+
+	// In characters, not counting the null terminator.
+	USHORT cchName;
+	// HashName(szName, cchName), worked out once when the item is made so
+	// comparisons can rule out most mismatches without touching the name.
+	UINT32 uNameHash;
 
 	// The actual content of the item
 	LONGLONG llFilesize;
-	PWSTR pszName;  // Allocated with CoTaskMemAlloc
+	// Null-terminated and stored right in the item ID, so the whole PIDL is
+	// one block of memory the shell can copy, persist and free on its own.
+	// Really cchName + 1 characters long; see NewPidl.
+	WCHAR szName[1];
 
 	// Static: these are functions associated with ADSX::CItems but are not
 	// kept on the objects; at runtime, it's just the above data members in a
 	// CItem struct.
 
 	// Check whether a PIDL of any type is a ADSXITEMID_CHILD, which contains a
-	// ADSX::CItem.
+	// ADSX::CItem, and that everything in it adds up: the version is one we
+	// know, cb agrees with cchName, and the name is null-terminated where
+	// cchName says.
 	// ADSX::CItems are always the last part of the PIDL (i.e. the child).
 	// FUTURE: pseudofolders may open this up to be any relative PIDL.
 	static bool IsOwn(PCUIDLIST_RELATIVE pidlr);
@@ -30,32 +67,60 @@ struct CItem {
 	static const CItem *Get(PCUITEMID_CHILD pidlc);
 
 	/**
-	 * Allocates and constructs a new child item ID holding an ADSX::CItem.
+	 * Allocates and constructs a new child item ID holding an ADSX::CItem,
+	 * in exactly one allocation.
+	 * @pre: pszName has at least cchName characters; it doesn't have to be
+	 *       null-terminated.
 	 * @post: returned pointer must be freed with CoTaskMemFree.
+	 * @post: returns NULL if out of memory or if the name is too long to fit
+	 *        in an item ID.
 	 */
-	static PADSXITEMID_CHILD NewPidl();
+	static PITEMID_CHILD NewPidl(
+		_In_reads_(cchName) PCWCH    pszName,
+		_In_                SIZE_T   cchName,
+		_In_                LONGLONG llFilesize,
+		_In_                BYTE     fFlags = 0
+	);
+
+	/**
+	 * Copy an item ID made by NewPidl. It's self-contained, so this is one
+	 * allocation and one memcpy.
+	 * @pre: IsOwn(pidlc)
+	 * @post: returned pointer must be freed with CoTaskMemFree.
+	 * @post: returns NULL if out of memory.
+	 */
+	static PITEMID_CHILD Clone(_In_ PCUITEMID_CHILD pidlc);
+
+	// FNV-1a over the UTF-16 code units of the name. Case-sensitive, to agree
+	// with how names are compared.
+	static UINT32 HashName(
+		_In_reads_(cchName) PCWCH  pszName,
+		_In_                SIZE_T cchName
+	);
+
+	// Whether two items name the same stream. Hash and length first, so
+	// different streams almost never get as far as the names.
+	static bool Equal(_In_ const CItem *pItem1, _In_ const CItem *pItem2);
 };
 
 
-// A new subclass of ITEMID_CHILD for our purposes:
+// A new kind of ITEMID_CHILD for our purposes:
 // An ITEMID_CHILD that always holds an ADSX::CItem.
-#include <pshpack1.h>
-	typedef struct _ADSXITEMID {
-		// This ITEMID has a known, fixed size!
-		// So write it down here.
-		USHORT cb = sizeof(USHORT) + sizeof(CItem);
-		// Always ADSX::CItem.
-		CItem abID;
-		// Sentinel "null" item at the end that all properly-formed
-		// ITEMIDLISTs, including children, have to have.
-		// (So something that doesn't KNOW this is a child can seek
-		// past for the next item and safely ("safely"...) find null.)
-		USHORT cbNull = 0;
-		BYTE abIDNull = NULL;
-	} ADSXITEMID;
-	typedef struct _ADSXITEMID_CHILD : ITEMID_CHILD {
-		ADSXITEMID mkid;
-	} ADSXITEMID_CHILD;
+typedef struct _ADSXITEMID {
+	// Size of this item ID in bytes, counting cb itself. Varies with the
+	// length of the name.
+	USHORT cb;
+	// Always ADSX::CItem.
+	CItem abID;
+	// After the name comes the sentinel "null" item (a USHORT 0) that all
+	// properly-formed ITEMIDLISTs, including children, have to have.
+	// (So something that doesn't KNOW this is a child can seek
+	// past for the next item and safely ("safely"...) find null.)
+} ADSXITEMID;
+typedef struct _ADSXITEMID_CHILD {
+	ADSXITEMID mkid;
+} ADSXITEMID_CHILD;
+
 #include <poppack.h>
 
 // Boilerplate for the rest of the variants to fit the Windows typedef naming scheme
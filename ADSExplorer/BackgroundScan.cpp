@@ -0,0 +1,90 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "BackgroundScan.h"
+
+#include "ModuleThread.h"
+
+// Debug log prefix for CBackgroundScan
+#define P_BS L"ADSX::CBackgroundScan(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CBackgroundScan::CBackgroundScan()
+	: m_cRef(1)
+	, m_cConsumers(0)
+	, m_bFinished(false)
+	, m_dwElapsedMs(0)
+	, m_bCancel(false)
+	, m_dwStart(0) {
+	InitializeConditionVariable(&m_cvChanged);
+}
+
+
+ULONG CBackgroundScan::AddRef() {
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CBackgroundScan::Release() {
+	const ULONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0) delete this;
+	return cRef;
+}
+
+
+void CBackgroundScan::AddConsumer() {
+	InterlockedIncrement(&m_cConsumers);
+}
+
+void CBackgroundScan::RemoveConsumer() {
+	if (InterlockedDecrement(&m_cConsumers) == 0) Cancel();
+}
+
+
+void CBackgroundScan::Cancel() {
+	LOG(P_BS << L"Cancel()");
+	m_bCancel.store(true, std::memory_order_release);
+}
+
+
+void CBackgroundScan::Wait() {
+	WaitForSingleObject(m_hThread, INFINITE);
+}
+
+
+HRESULT CBackgroundScan::StartThread() {
+	// Before the thread, so the stats never see it unset
+	m_dwStart = GetTickCount();
+	// The thread's own reference; the DLL is held by CreateModuleThread
+	AddRef();
+	HANDLE hThread = CreateModuleThread(&CBackgroundScan::ThreadProc, this);
+	if (hThread == NULL) {
+		const DWORD dwError = GetLastError();
+		Release();
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	m_hThread.Attach(hThread);
+	return S_OK;
+}
+
+
+DWORD WINAPI CBackgroundScan::ThreadProc(_In_ LPVOID pvScan) {
+	auto pScan = static_cast<CBackgroundScan *>(pvScan);
+	// Leave the foreground to Explorer's UI thread
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	pScan->Run();
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(pScan->m_cs);
+		pScan->m_bFinished = true;
+		pScan->m_dwElapsedMs = GetTickCount() - pScan->m_dwStart;
+	}
+	WakeAllConditionVariable(&pScan->m_cvChanged);
+	pScan->Release();
+	ExitModuleThread(0);
+}
+
+}  // namespace ADSX
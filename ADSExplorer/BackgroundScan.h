@@ -0,0 +1,142 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A scan run on a thread of its own, like CTreeScanner and CStreamFilter,
+ * whose results are published as they're found and read while it goes on by
+ * any number of enumerators, each from an index of its own.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+namespace ADSX {
+
+
+class CBackgroundScan {
+  public:
+	// Shared by refcount like a COM object so CComPtr can hold one,
+	// but it's not one.
+	ULONG AddRef();
+	ULONG Release();
+
+	// Everyone reading the results says so, and when the last one leaves
+	// there's nobody left to scan for, so the scan is called off.
+	void AddConsumer();
+	void RemoveConsumer();
+
+	// Stop scanning without waiting for it. What's been found stays.
+	virtual void Cancel();
+
+	// Block until the scan is over.
+	void Wait();
+
+  protected:
+	CBackgroundScan();
+	virtual ~CBackgroundScan() = default;
+
+	// Start Run on a thread of its own, which holds a reference to this
+	// until it's done.
+	HRESULT StartThread();
+
+	// The scan itself: publish what's found as it goes, and return once
+	// it's all been found or m_bCancel is set.
+	virtual void Run() = 0;
+
+	static DWORD WINAPI ThreadProc(_In_ LPVOID pvScan);
+
+	volatile LONG m_cRef;
+	volatile LONG m_cConsumers;
+
+	// Guards the results, m_bFinished and m_dwElapsedMs; m_cvChanged is
+	// signalled whenever any of them change.
+	mutable CComAutoCriticalSection m_cs;
+	CONDITION_VARIABLE m_cvChanged;
+	bool m_bFinished;
+	DWORD m_dwElapsedMs;  // only once finished
+
+	std::atomic<bool> m_bCancel;
+	DWORD m_dwStart;
+	CHandle m_hThread;
+};
+
+
+// A CBackgroundScan that finds TItems, kept in the order they were found.
+template <typename TItem>
+class CScanResults : public CBackgroundScan {
+  protected:
+	/**
+	 * Hand up to celt of the results, starting at the iFirst'th, to fnCopy
+	 * in order, waiting up to dwTimeoutMs if the scan hasn't found that many
+	 * yet. Results are only ever added to the end, so each consumer just
+	 * keeps its own index.
+	 * FnCopy is a template parameter like CEnumIDList's FnConsume:
+	 * bool fnCopy(const TItem &item)  // false if it's out of memory
+	 * Returns S_OK with at least one result copied, S_FALSE with none if the
+	 * scan is over and there are no more, HRESULT_FROM_WIN32(ERROR_TIMEOUT)
+	 * with none, or E_OUTOFMEMORY after *pcCopied of them.
+	 * @pre: fnCopy doesn't throw; it's called with m_cs held.
+	 */
+	template <typename FnCopy>
+	HRESULT Read(
+		_In_  ULONG  iFirst,
+		_In_  ULONG  celt,
+		_In_  FnCopy fnCopy,
+		_Out_ ULONG  *pcCopied,
+		_In_  DWORD  dwTimeoutMs
+	) {
+		*pcCopied = 0;
+		const DWORD dwStart = GetTickCount();
+		CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+		while (iFirst >= m_items.size() && !m_bFinished) {
+			DWORD dwWaitMs = INFINITE;
+			if (dwTimeoutMs != INFINITE) {
+				const DWORD dwElapsed = GetTickCount() - dwStart;
+				if (dwElapsed >= dwTimeoutMs) return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+				dwWaitMs = dwTimeoutMs - dwElapsed;
+			}
+			// Lets go of m_cs while it waits
+			SleepConditionVariableCS(&m_cvChanged, &m_cs.m_sec, dwWaitMs);
+		}
+		if (iFirst >= m_items.size()) return S_FALSE;
+
+		const ULONG cAvailable = static_cast<ULONG>(m_items.size() - iFirst);
+		const ULONG cCopy = min(celt, cAvailable);
+		for (ULONG i = 0; i < cCopy; i++) {
+			if (!fnCopy(m_items[iFirst + i])) return E_OUTOFMEMORY;
+			*pcCopied = i + 1;
+		}
+		return S_OK;
+	}
+
+	/**
+	 * Hand what was found over to the consumers. Doesn't throw, so it's fine
+	 * on the way out of a task whether it threw or not.
+	 * @post: false, with none of them added, if there's no memory for them.
+	 */
+	bool Publish(
+		_In_reads_(cItems) const TItem *pItems,
+		_In_               SIZE_T      cItems
+	) {
+		if (cItems == 0) return true;
+		{
+			CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+			try {
+				m_items.insert(m_items.end(), pItems, pItems + cItems);
+			} catch (const std::bad_alloc &) {
+				return false;
+			}
+		}
+		WakeAllConditionVariable(&m_cvChanged);
+		return true;
+	}
+
+	// Guarded by m_cs
+	std::vector<TItem> m_items;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,157 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A cache of fixed-size blocks in front of a slow CByteSource, like a disk
+ * image on a network share. Blocks are kept least-recently-used first out,
+ * and when reads walk forward block after block, the next few are brought in
+ * with the same read so a sequential pass costs one round trip per several
+ * blocks instead of one per block.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "ByteSource.h"
+#include "LruCache.h"
+
+namespace ADSX {
+
+
+class CBlockCache : public CByteSource {
+  public:
+	struct Stats {
+		std::uint64_t cHits;
+		std::uint64_t cMisses;
+		std::uint64_t cEvictions;
+		std::uint64_t cReads;         // reads passed on to the source
+		std::uint64_t cReadAhead;     // blocks brought in before being asked for
+	};
+
+	/**
+	 * @param cbBlock: a multiple of cbBufferAlign.
+	 * @param cBlocksMax: how many blocks to keep.
+	 * @param cReadAhead: how many blocks past the one asked for to bring in
+	 *        when reads are sequential; 0 for none.
+	 * @pre: inner outlives the cache.
+	 */
+	CBlockCache(
+		CByteSource &inner,
+		std::size_t cbBlock = 64 * 1024,
+		std::size_t cBlocksMax = 1024,
+		unsigned    cReadAhead = 8
+	)
+		: m_inner(inner)
+		, m_cbBlock(cbBlock)
+		, m_cBlocksAhead(cReadAhead)
+		, m_cbSize(inner.Size())
+		, m_blocks(cBlocksMax)
+		, m_iLastMiss(UINT64_MAX)
+		, m_cReads(0)
+		, m_cReadAhead(0) {}
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override {
+		if (ibOffset > m_cbSize || cb > m_cbSize - ibOffset) return false;
+		auto pbOut = static_cast<unsigned char *>(pb);
+		while (cb > 0) {
+			const std::uint64_t iBlock = ibOffset / m_cbBlock;
+			const std::size_t ibInBlock = static_cast<std::size_t>(ibOffset % m_cbBlock);
+			BlockPtr pBlock;
+			if (!m_blocks.Find(iBlock, &pBlock)) {
+				pBlock = Load(iBlock);
+				if (pBlock == nullptr) return false;
+			}
+			if (ibInBlock >= pBlock->size()) return false;
+			const std::size_t cbHere = (std::min)(cb, pBlock->size() - ibInBlock);
+			std::memcpy(pbOut, pBlock->data() + ibInBlock, cbHere);
+			pbOut += cbHere;
+			ibOffset += cbHere;
+			cb -= cbHere;
+		}
+		return true;
+	}
+
+	std::uint64_t Size() const override { return m_cbSize; }
+
+	// Good enough for tuning; the counters aren't read all at once.
+	Stats GetStats() const {
+		const auto cacheStats = m_blocks.GetStats();
+		return Stats{
+			cacheStats.cHits,
+			cacheStats.cMisses,
+			cacheStats.cEvictions,
+			m_cReads.load(std::memory_order_relaxed),
+			m_cReadAhead.load(std::memory_order_relaxed),
+		};
+	}
+
+  private:
+	// Shared so a block can be copied out of after it's been evicted
+	using BlockPtr = std::shared_ptr<const std::vector<unsigned char>>;
+
+	// Bring iBlock in, and the few after it if the last miss was the one
+	// before it. Two threads missing on the same block both read it; that's
+	// rare, harmless, and cheaper than holding a lock over the read.
+	BlockPtr Load(std::uint64_t iBlock) {
+		try {
+			return LoadOrThrow(iBlock);
+		} catch (const std::bad_alloc &) {
+			return nullptr;
+		}
+	}
+
+	BlockPtr LoadOrThrow(std::uint64_t iBlock) {
+		const std::uint64_t cBlocksAll = (m_cbSize + m_cbBlock - 1) / m_cbBlock;
+		const bool bSequential = m_iLastMiss.exchange(iBlock, std::memory_order_relaxed) + 1 == iBlock;
+		std::uint64_t cBlocks = 1;
+		if (bSequential) {
+			cBlocks = (std::min<std::uint64_t>)(1 + m_cBlocksAhead, cBlocksAll - iBlock);
+		}
+		const std::uint64_t ibStart = iBlock * m_cbBlock;
+		const std::size_t cb = static_cast<std::size_t>(
+			(std::min<std::uint64_t>)(cBlocks * m_cbBlock, m_cbSize - ibStart)
+		);
+
+		std::vector<unsigned char> buffer(cb);
+		m_cReads.fetch_add(1, std::memory_order_relaxed);
+		if (!m_inner.Read(ibStart, buffer.data(), cb)) return nullptr;
+
+		BlockPtr pFirst;
+		for (std::size_t ib = 0; ib < cb; ib += m_cbBlock) {
+			const std::size_t cbHere = (std::min)(m_cbBlock, cb - ib);
+			auto pBlock = std::make_shared<const std::vector<unsigned char>>(
+				buffer.begin() + ib, buffer.begin() + ib + cbHere
+			);
+			if (ib == 0) {
+				pFirst = pBlock;
+			} else {
+				m_cReadAhead.fetch_add(1, std::memory_order_relaxed);
+			}
+			m_blocks.Insert(iBlock + ib / m_cbBlock, std::move(pBlock));
+		}
+		if (cBlocks > 1) {
+			// Carry on from the last one brought in, so the next miss past it
+			// is still sequential
+			m_iLastMiss.store(iBlock + cBlocks - 1, std::memory_order_relaxed);
+		}
+		return pFirst;
+	}
+
+	CByteSource &m_inner;
+	const std::size_t m_cbBlock;
+	const unsigned m_cBlocksAhead;
+	const std::uint64_t m_cbSize;
+	CShardedLruCache<std::uint64_t, BlockPtr> m_blocks;
+	std::atomic<std::uint64_t> m_iLastMiss;
+	std::atomic<std::uint64_t> m_cReads;
+	std::atomic<std::uint64_t> m_cReadAhead;
+};
+
+}  // namespace ADSX
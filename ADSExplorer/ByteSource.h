@@ -0,0 +1,82 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Somewhere to read a volume's or a disk's bytes from by offset: the volume
+ * itself, an image file, a disk inside an image file, a partition on that
+ * disk, or a cache in front of any of them. Whatever reads raw structures
+ * reads them through one of these, so it doesn't care which.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace ADSX {
+
+
+class CByteSource {
+  public:
+	virtual ~CByteSource() = default;
+
+	/**
+	 * Read cb bytes at ibOffset.
+	 * Called from several threads at once.
+	 * @post: returns false, with *pb in any state, if any of it couldn't be
+	 *        read, including if it runs past Size().
+	 */
+	virtual bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) = 0;
+
+	// How many bytes there are to read.
+	virtual std::uint64_t Size() const = 0;
+};
+
+// Enough for unbuffered reads from any disk
+constexpr std::size_t cbBufferAlign = 4096;
+
+
+// Bytes already in memory.
+class CMemorySource : public CByteSource {
+  public:
+	CMemorySource(const void *pb, std::size_t cb)
+		: m_pb(static_cast<const unsigned char *>(pb))
+		, m_cb(cb) {}
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override {
+		if (ibOffset > m_cb || cb > m_cb - ibOffset) return false;
+		std::memcpy(pb, m_pb + ibOffset, cb);
+		return true;
+	}
+
+	std::uint64_t Size() const override { return m_cb; }
+
+  private:
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+};
+
+
+// A stretch of another source, like a partition on a disk.
+class CWindowSource : public CByteSource {
+  public:
+	// @pre: inner outlives the window.
+	CWindowSource(CByteSource &inner, std::uint64_t ibStart, std::uint64_t cb)
+		: m_inner(inner)
+		, m_ibStart(ibStart)
+		, m_cb(cb) {}
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override {
+		if (ibOffset > m_cb || cb > m_cb - ibOffset) return false;
+		return m_inner.Read(m_ibStart + ibOffset, pb, cb);
+	}
+
+	std::uint64_t Size() const override { return m_cb; }
+
+  private:
+	CByteSource &m_inner;
+	std::uint64_t m_ibStart;
+	std::uint64_t m_cb;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,367 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ContentIndex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+#include "ADSXItem.h"
+#include "IoScheduler.h"
+#include "StreamQuery.h"
+#include "TreeScanner.h"
+
+// Debug log prefix for CContentIndex
+#define P_CI L"ADSX::CContentIndex(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+// How many streams are taken from the scanner at a time
+static constexpr ULONG cBatch = 16;
+static constexpr unsigned cWorkersMax = 8;
+static constexpr DWORD cbReadChunk = 1024 * 1024;
+
+
+CContentIndex::CContentIndex()
+	: m_cRef(1)
+	, m_stats() {}
+
+CContentIndex::~CContentIndex() {
+	m_index.Attach(NULL, 0);
+	m_file.Unmap();
+}
+
+
+ULONG CContentIndex::AddRef() {
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CContentIndex::Release() {
+	const ULONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0) delete this;
+	return cRef;
+}
+
+
+HRESULT CContentIndex::Open(
+	_In_         PCWSTR         pszRoot,
+	_COM_Outptr_ CContentIndex  **ppIndex
+) {
+	if (ppIndex == NULL) return E_POINTER;
+	*ppIndex = NULL;
+	if (pszRoot == NULL) return E_POINTER;
+	if (*pszRoot == L'\0') return E_INVALIDARG;
+
+	CContentIndex *pIndex = new (std::nothrow) CContentIndex();
+	if (pIndex == NULL) return E_OUTOFMEMORY;
+	HRESULT hr = pIndex->Initialize(pszRoot);
+	if (FAILED(hr)) {
+		pIndex->Release();
+		return WrapReturn(hr);
+	}
+	*ppIndex = pIndex;
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::Initialize(_In_ PCWSTR pszRoot) {
+	LOG(P_CI << L"Initialize(" << pszRoot << L")");
+	HRESULT hr;
+	try {
+		m_sRoot = pszRoot;
+		if (m_sRoot.size() > 1 && m_sRoot.back() == L'\\' && m_sRoot[m_sRoot.size() - 2] != L':') {
+			m_sRoot.pop_back();
+		}
+
+		// One file per folder, by its path, whichever case it's given in
+		std::wstring sUpper = m_sRoot;
+		CharUpperBuffW(&sUpper[0], static_cast<DWORD>(sUpper.size()));
+		// FNV-1a over the UTF-16 code units
+		ULONGLONG ullHash = 14695981039346656037ull;
+		for (WCHAR ch : sUpper) {
+			ullHash = (ullHash ^ static_cast<BYTE>(ch)) * 1099511628211ull;
+			ullHash = (ullHash ^ static_cast<BYTE>(ch >> 8)) * 1099511628211ull;
+		}
+		WCHAR szName[32];
+		swprintf_s(szName, L"%016llX.adsxtri", ullHash);
+		hr = IndexFilePath(szName, &m_sFile);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	if (FAILED(hr)) return hr;
+
+	// Never indexed, or the file's no good: start from nothing
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	hr = MapFile();
+	if (FAILED(hr)) LOG(P_CI << L"Initialize(): starting empty: " << HRESULTToString(hr));
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::ReadDocument(
+	_In_    PCWSTR              pszPath,
+	_Inout_ Trigram::CExtractor &extractor,
+	_Inout_ Trigram::Document   *pDocument,
+	_Out_   ULONGLONG           *pcbRead
+) {
+	*pcbRead = 0;
+	pDocument->bIndexed = false;
+	pDocument->trigrams.clear();
+	HANDLE hStream = CreateFileW(
+		ExtendedLengthPath(pszPath).c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (hStream == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	defer({ CloseHandle(hStream); });
+
+	const DWORD cbBuffer = static_cast<DWORD>((std::min)(pDocument->ullSize + 1, static_cast<ULONGLONG>(cbReadChunk)));
+	std::unique_ptr<unsigned char[]> pbBuffer(new unsigned char[cbBuffer]);
+	for (;;) {
+		DWORD cbRead;
+		if (!ReadFile(hStream, pbBuffer.get(), cbBuffer, &cbRead, NULL)) {
+			const DWORD dwError = GetLastError();
+			extractor.Take();
+			return HRESULT_FROM_WIN32(dwError);
+		}
+		if (cbRead == 0) break;
+		*pcbRead += cbRead;
+		// Grew past the limit since it was listed
+		if (*pcbRead > cbIndexMax) {
+			extractor.Take();
+			return S_FALSE;
+		}
+		extractor.Add(pbBuffer.get(), cbRead);
+	}
+	pDocument->trigrams = extractor.Take();
+	pDocument->bIndexed = true;
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::Update() {
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	LOG(P_CI << L"Update()");
+	const ULONGLONG ullStart = GetTickCount64();
+
+	CComPtr<CTreeScanner> pScanner;
+	HRESULT hr = CTreeScanner::Start(m_sRoot.c_str(), &pScanner);
+	if (FAILED(hr)) return WrapReturn(hr);
+	pScanner->AddConsumer();
+	defer({ pScanner->RemoveConsumer(); });
+
+	// What's new or changed since, found while the scan goes on
+	struct ToRead {
+		std::wstring sKey;
+		std::wstring sPath;
+		ULONGLONG ullSize;
+		ULONGLONG ullStamp;
+	};
+	std::vector<ToRead> toRead;
+	ULONGLONG cRemoved = 0;
+	try {
+		std::unordered_set<std::wstring> seen;
+		Trigram::Document known;
+		ULONG iNext = 0;
+		for (;;) {
+			PITEMID_CHILD rgpidl[cBatch];
+			ULONG cFetched;
+			hr = pScanner->Get(iNext, cBatch, rgpidl, &cFetched, INFINITE);
+			if (hr != S_OK) break;
+			iNext += cFetched;
+			defer({ for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(rgpidl[i]); });
+			for (ULONG i = 0; i < cFetched; i++) {
+				ToRead stream;
+				stream.sKey = CTreeScanner::StreamKey(rgpidl[i]);
+				stream.sPath = CTreeScanner::StreamPath(m_sRoot.c_str(), stream.sKey);
+				stream.ullSize = static_cast<ULONGLONG>(CItem::Get(rgpidl[i])->llFilesize);
+				// Writing to a stream moves its file's last write time. Left
+				// at 0 if it can't be had, so the stream's read every time.
+				stream.ullStamp = 0;
+				WIN32_FILE_ATTRIBUTE_DATA data;
+				if (GetFileAttributesExW(ExtendedLengthPath(stream.sPath.c_str()).c_str(), GetFileExInfoStandard, &data)) {
+					stream.ullStamp = static_cast<ULONGLONG>(data.ftLastWriteTime.dwHighDateTime) << 32 |
+						data.ftLastWriteTime.dwLowDateTime;
+				}
+				const bool bUnchanged = (
+					m_index.FindDocument(stream.sKey, &known) &&
+					stream.ullStamp != 0 &&
+					known.ullStamp == stream.ullStamp &&
+					known.ullSize == stream.ullSize
+				);
+				seen.insert(stream.sKey);
+				if (!bUnchanged) toRead.push_back(std::move(stream));
+			}
+		}
+		if (FAILED(hr)) return WrapReturn(hr);
+
+		for (const Trigram::Name &sKey : m_index.Paths()) {
+			if (seen.count(sKey) != 0) continue;
+			m_index.RemoveDocument(sKey);
+			cRemoved++;
+		}
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	// Read them, a few at a time, each taking its turn at the disk
+	struct Share {
+		ULONGLONG cRead = 0;
+		ULONGLONG cbRead = 0;
+		HRESULT hr = S_OK;
+	};
+	const unsigned cWorkers = std::clamp(std::thread::hardware_concurrency(), 1u, cWorkersMax);
+	std::vector<Share> shares;
+	try {
+		shares.resize(cWorkers);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	std::atomic<std::size_t> iNextRead(0);
+	auto fnWork = [&](Share &share) {
+		CBackgroundMode background;
+		try {
+			Trigram::CExtractor extractor;
+			for (std::size_t i = iNextRead++; i < toRead.size(); i = iNextRead++) {
+				const ToRead &stream = toRead[i];
+				Trigram::Document document;
+				document.sPath = stream.sKey;
+				document.ullSize = stream.ullSize;
+				document.ullStamp = stream.ullStamp;
+				if (stream.ullSize <= cbIndexMax) {
+					CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(
+						stream.sPath.c_str(), IoPriority::Background
+					);
+					ULONGLONG cbRead;
+					// Couldn't be read: left unindexed, so searches read it
+					// for themselves
+					ReadDocument(stream.sPath.c_str(), extractor, &document, &cbRead);
+					share.cRead++;
+					share.cbRead += cbRead;
+				}
+				m_index.SetDocument(std::move(document));
+			}
+		} catch (const std::bad_alloc &) {
+			share.hr = E_OUTOFMEMORY;
+			iNextRead = toRead.size();
+		}
+	};
+	{
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < cWorkers && i < toRead.size(); i++) threads.emplace_back(fnWork, std::ref(shares[i]));
+		fnWork(shares[0]);
+		for (std::thread &thread : threads) thread.join();
+	}
+
+	ULONGLONG cRead = 0, cbRead = 0;
+	for (const Share &share : shares) {
+		if (FAILED(share.hr)) return share.hr;
+		cRead += share.cRead;
+		cbRead += share.cbRead;
+	}
+
+	if (m_index.ChangeCount() > 0) {
+		std::vector<unsigned char> index;
+		try {
+			index = m_index.Serialize();
+		} catch (const std::bad_alloc &) {
+			return E_OUTOFMEMORY;
+		}
+		hr = WriteIndexFile(std::move(index));
+		if (FAILED(hr)) return WrapReturn(hr);
+	}
+
+	const DWORD dwMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	{
+		CComCritSecLock<CComAutoCriticalSection> lockStats(m_csStats);
+		m_stats.dwLastUpdateMs = dwMs;
+		m_stats.cLastRead = cRead;
+		m_stats.cbLastRead = cbRead;
+		m_stats.cLastRemoved = cRemoved;
+	}
+	LOG(
+		P_CI << L"Update(): " << std::dec << cRead << L" streams, " << cbRead << L" bytes read, " <<
+		cRemoved << L" gone, " << dwMs << L" ms; index is " << m_index.FileSize() << L" bytes"
+	);
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::Candidates(
+	_In_  const std::vector<std::string>  &literals,
+	_Out_ std::vector<std::wstring>       *pPaths
+) {
+	if (pPaths == NULL) return E_POINTER;
+	pPaths->clear();
+	LARGE_INTEGER liFrequency, liStart, liEnd;
+	QueryPerformanceFrequency(&liFrequency);
+	QueryPerformanceCounter(&liStart);
+
+	std::vector<Trigram::Name> keys;
+	m_index.Candidates(literals, &keys);
+	pPaths->reserve(keys.size());
+	for (const Trigram::Name &sKey : keys) pPaths->push_back(CTreeScanner::StreamPath(m_sRoot.c_str(), sKey));
+
+	QueryPerformanceCounter(&liEnd);
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csStats);
+	m_stats.ullLastQueryUs = static_cast<ULONGLONG>(
+		(liEnd.QuadPart - liStart.QuadPart) * 1000000 / liFrequency.QuadPart
+	);
+	m_stats.cLastCandidates = keys.size();
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::WriteIndexFile(_In_ std::vector<unsigned char> index) {
+	HRESULT hr = WriteIndexTemp(m_sFile, index);
+	if (FAILED(hr)) return hr;
+	// A mapped file can't be replaced, so answer from memory meanwhile
+	m_index.Adopt(std::move(index));
+	m_file.Unmap();
+	hr = ReplaceIndexFile(m_sFile);
+	if (FAILED(hr)) return hr;
+	// If it can't be mapped, the copy in memory does just as well
+	hr = MapFile();
+	if (FAILED(hr)) LOG(P_CI << L"WriteIndexFile(): MapFile: " << HRESULTToString(hr));
+	return S_OK;
+}
+
+
+HRESULT CContentIndex::MapFile() {
+	CMappedFile file;
+	HRESULT hr = file.Map(m_sFile.c_str());
+	if (FAILED(hr)) return hr;
+	if (!m_index.Attach(file.Data(), file.Size())) {
+		LOG(P_CI << L"MapFile(): not an index file");
+		return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+	}
+	// The one mapped before goes with file
+	m_file.Swap(file);
+	return S_OK;
+}
+
+
+CContentIndex::Stats CContentIndex::GetStats() const {
+	Stats stats;
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_csStats);
+		stats = m_stats;
+	}
+	stats.cDocuments = m_index.DocumentCount();
+	stats.cbFile = m_index.FileSize();
+	return stats;
+}
+
+}  // namespace ADSX
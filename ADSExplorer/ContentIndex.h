@@ -0,0 +1,118 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The trigram index (TrigramIndex.h) of every stream under a folder, kept in a
+ * file under %LOCALAPPDATA% so searching there again (ContentSearch.h) only
+ * reads the streams that could match. Updating it walks the tree again, but
+ * only reads the streams whose size or file's last write time has changed.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+#include <vector>
+
+#include "IndexFile.h"
+#include "TrigramIndex.h"
+
+namespace ADSX {
+
+
+class CContentIndex {
+  public:
+	struct Stats {
+		DWORD dwLastUpdateMs;      // to walk the tree, read what changed and save
+		ULONGLONG cLastRead;       // streams read then
+		ULONGLONG cbLastRead;      // bytes read then
+		ULONGLONG cLastRemoved;    // streams gone since the time before
+		ULONGLONG cDocuments;      // streams in the index
+		ULONGLONG cbFile;          // the index file on disk
+		ULONGLONG ullLastQueryUs;  // for the last Candidates()
+		ULONGLONG cLastCandidates; // what it came up with
+
+		// How fast streams are indexed, in MB/s
+		double BuildRate() const {
+			return dwLastUpdateMs > 0 ? cbLastRead / 1000.0 / dwLastUpdateMs : 0;
+		}
+	};
+
+	// Bigger streams are left out, and always searched in full
+	static constexpr ULONGLONG cbIndexMax = 64 * 1024 * 1024;
+
+	/**
+	 * The index of the tree under pszRoot, as it was when it was last saved;
+	 * empty if it never has been. Update() it before relying on it.
+	 * @post: *ppIndex has a reference count of 1 for the caller to Release.
+	 */
+	static HRESULT Open(
+		_In_         PCWSTR         pszRoot,
+		_COM_Outptr_ CContentIndex  **ppIndex
+	);
+
+	// Shared by refcount like a COM object so CComPtr can hold one,
+	// but it's not one.
+	ULONG AddRef();
+	ULONG Release();
+
+	/**
+	 * Bring the index up to date with the tree and save it: read the streams
+	 * that are new or have changed, and forget the ones that are gone.
+	 * Streams are read in the background, behind anything the user is
+	 * waiting on.
+	 */
+	HRESULT Update();
+
+	/**
+	 * Full paths of the streams that might contain one of literals: all the
+	 * others certainly don't. A literal shorter than three bytes rules
+	 * nothing out.
+	 * @post: may throw std::bad_alloc.
+	 */
+	HRESULT Candidates(
+		_In_  const std::vector<std::string>  &literals,
+		_Out_ std::vector<std::wstring>       *pPaths
+	);
+
+	PCWSTR Root() const { return m_sRoot.c_str(); }
+
+	Stats GetStats() const;
+
+  protected:
+	CContentIndex();
+	~CContentIndex();
+
+	HRESULT Initialize(_In_ PCWSTR pszRoot);
+
+	/**
+	 * The trigrams of the stream at pszPath.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT ReadDocument(
+		_In_    PCWSTR              pszPath,
+		_Inout_ Trigram::CExtractor &extractor,
+		_Inout_ Trigram::Document   *pDocument,
+		_Out_   ULONGLONG           *pcbRead
+	);
+
+	// Replace the index file with index, and answer from it.
+	// @pre: m_csUpdate is held.
+	HRESULT WriteIndexFile(_In_ std::vector<unsigned char> index);
+	HRESULT MapFile();
+
+	volatile LONG m_cRef;
+	std::wstring m_sRoot;
+	std::wstring m_sFile;
+
+	CMappedFile m_file;
+	Trigram::CIndex m_index;
+
+	// One update at a time; queries don't take it
+	mutable CComAutoCriticalSection m_csUpdate;
+	// Guards m_stats
+	mutable CComAutoCriticalSection m_csStats;
+	Stats m_stats;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,417 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Finding byte strings and regular expressions in the contents of streams.
+ *
+ * Literals are looked for a vector at a time: the first and last byte of each
+ * one are compared against 32 (AVX2) or 16 (SSE2) positions at once, and only
+ * where both agree is the rest compared. A handful of literals share each
+ * load; past that, and on CPUs without either, every position is checked
+ * against a table of which literals start with its first two bytes.
+ * Streams are searched a chunk at a time, each chunk carrying the end of the
+ * one before, so nothing is missed where two chunks meet.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <regex>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define ADSX_CONTENT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		// MSVC hands out every intrinsic without being asked
+		#define ADSX_TARGET_AVX2
+	#else
+		#define ADSX_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+namespace ADSX::Content {
+
+
+// Which instructions the literal search uses
+enum class Isa {
+	Scalar,
+	Sse2,
+	Avx2,
+};
+
+inline const char *IsaName(Isa isa) {
+	switch (isa) {
+		case Isa::Avx2: return "AVX2";
+		case Isa::Sse2: return "SSE2";
+		default: return "scalar";
+	}
+}
+
+// The best this CPU (and OS) can run; asked once.
+inline Isa BestIsa() {
+#ifdef ADSX_CONTENT_X64
+	static const Isa isa = []() {
+	#ifdef _MSC_VER
+		int aiRegs[4];
+		__cpuid(aiRegs, 0);
+		if (aiRegs[0] < 7) return Isa::Sse2;
+		__cpuid(aiRegs, 1);
+		// The OS has to save the YMM registers too, or AVX2 is no use
+		const bool bOsxsave = (aiRegs[2] & (1 << 27)) != 0;
+		if (!bOsxsave || (_xgetbv(0) & 6) != 6) return Isa::Sse2;
+		__cpuidex(aiRegs, 7, 0);
+		return (aiRegs[1] & (1 << 5)) ? Isa::Avx2 : Isa::Sse2;
+	#else
+		return __builtin_cpu_supports("avx2") ? Isa::Avx2 : Isa::Sse2;
+	#endif
+	}();
+	return isa;
+#else
+	return Isa::Scalar;
+#endif
+}
+
+
+struct Match {
+	std::uint64_t ullOffset;  // from the start of the stream
+	std::uint32_t iPattern;   // in the order they were added
+
+	bool operator<(const Match &other) const {
+		return ullOffset != other.ullOffset ? ullOffset < other.ullOffset : iPattern < other.iPattern;
+	}
+	bool operator==(const Match &other) const {
+		return ullOffset == other.ullOffset && iPattern == other.iPattern;
+	}
+};
+
+
+class CMatcher {
+  public:
+	// How many literals the vector search takes at once before it's cheaper
+	// to check the table at every position; half that with SSE2
+	static constexpr std::size_t cSimdLiterals = 16;
+	// Regular expression matches longer than this can be missed where two
+	// chunks meet
+	static constexpr std::size_t cbRegexWindow = 4096;
+
+	CMatcher() : m_isa(BestIsa()) {}
+
+	/**
+	 * Look for these bytes.
+	 * @post: returns the pattern's index, as Match::iPattern will give it.
+	 * @post: may throw std::bad_alloc.
+	 */
+	std::uint32_t AddLiteral(const std::string &sBytes) {
+		const std::uint32_t iPattern = m_cPatterns++;
+		if (sBytes.empty()) return iPattern;  // matches nothing
+		const std::uint32_t iLiteral = static_cast<std::uint32_t>(m_literals.size());
+		m_literals.push_back({sBytes, iPattern});
+		m_cbMaxLiteral = (std::max)(m_cbMaxLiteral, sBytes.size());
+		const unsigned char b0 = static_cast<unsigned char>(sBytes[0]);
+		m_aStarting[b0].push_back(iLiteral);
+		if (sBytes.size() == 1) {
+			m_abSingle[b0] = true;
+		} else {
+			const unsigned uPair = b0 | static_cast<unsigned char>(sBytes[1]) << 8;
+			m_aullPairs[uPair / 64] |= 1ull << (uPair % 64);
+		}
+		return iPattern;
+	}
+
+	/**
+	 * Look for an ECMAScript regular expression, matched against bytes.
+	 * @post: returns false with *psError set if it doesn't compile.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool AddRegex(const std::string &sPattern, std::uint32_t *piPattern, std::string *psError) {
+		try {
+			m_regexes.push_back({std::regex(sPattern, std::regex::ECMAScript | std::regex::optimize), m_cPatterns});
+		} catch (const std::regex_error &e) {
+			*psError = e.what();
+			return false;
+		}
+		*piPattern = m_cPatterns++;
+		return true;
+	}
+
+	// For benchmarks and tests; anything past BestIsa() is taken as it.
+	void SetIsa(Isa isa) { m_isa = (std::min)(isa, BestIsa()); }
+	Isa GetIsa() const { return m_isa; }
+
+	std::uint32_t PatternCount() const { return m_cPatterns; }
+
+	/**
+	 * The bytes a stream has to contain one of to match anything, for an
+	 * index to rule streams out by.
+	 * @post: returns false if there's a regex, which could match anything.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool GetLiterals(std::vector<std::string> *pLiterals) const {
+		pLiterals->clear();
+		if (!m_regexes.empty()) return false;
+		for (const Literal &literal : m_literals) pLiterals->push_back(literal.sBytes);
+		return true;
+	}
+
+	// How much of a chunk's end the next one has to see again
+	std::size_t Overlap() const {
+		const std::size_t cbLiterals = m_cbMaxLiteral > 0 ? m_cbMaxLiteral - 1 : 0;
+		return m_regexes.empty() ? cbLiterals : (std::max)(cbLiterals, cbRegexWindow);
+	}
+
+	/**
+	 * Append to *pMatches, in order, every match in pb[0, cb) that ends past
+	 * ibNew (the ones that end before were found with the chunk before).
+	 * Offsets are from ullBase, where pb sits in the stream.
+	 * @post: may throw std::bad_alloc.
+	 */
+	void Find(
+		const unsigned char *pb,
+		std::size_t cb,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		const std::size_t iFirstNew = pMatches->size();
+		std::size_t ibScalar = 0;
+#ifdef ADSX_CONTENT_X64
+		if (!m_literals.empty()) {
+			if (m_isa == Isa::Avx2 && m_literals.size() <= cSimdLiterals) {
+				ibScalar = FindAvx2(pb, cb, ibNew, ullBase, pMatches);
+			} else if (m_isa >= Isa::Sse2 && m_literals.size() <= cSimdLiterals / 2) {
+				ibScalar = FindSse2(pb, cb, ibNew, ullBase, pMatches);
+			}
+		}
+#endif
+		FindScalar(pb, cb, ibScalar, ibNew, ullBase, pMatches);
+		FindRegexes(pb, cb, ibNew, ullBase, pMatches);
+		std::sort(pMatches->begin() + iFirstNew, pMatches->end());
+	}
+
+  private:
+	struct Literal {
+		std::string sBytes;
+		std::uint32_t iPattern;
+	};
+	struct Regex {
+		std::regex re;
+		std::uint32_t iPattern;
+	};
+
+	void Report(
+		const Literal &literal,
+		std::size_t ib,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		if (ib + literal.sBytes.size() > ibNew) pMatches->push_back({ullBase + ib, literal.iPattern});
+	}
+
+	// Positions ibFrom on, one at a time. Whatever the vector search left
+	// over at the end, or everything.
+	void FindScalar(
+		const unsigned char *pb,
+		std::size_t cb,
+		std::size_t ibFrom,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		if (m_literals.empty()) return;
+		for (std::size_t ib = ibFrom; ib < cb; ib++) {
+			const unsigned char b0 = pb[ib];
+			const std::vector<std::uint32_t> &starting = m_aStarting[b0];
+			if (starting.empty()) continue;
+			if (!m_abSingle[b0]) {
+				if (ib + 1 >= cb) continue;
+				const unsigned uPair = b0 | pb[ib + 1] << 8;
+				if (!(m_aullPairs[uPair / 64] & 1ull << (uPair % 64))) continue;
+			}
+			for (std::uint32_t iLiteral : starting) {
+				const Literal &literal = m_literals[iLiteral];
+				const std::size_t cbLiteral = literal.sBytes.size();
+				if (cb - ib >= cbLiteral && std::memcmp(pb + ib, literal.sBytes.data(), cbLiteral) == 0) {
+					Report(literal, ib, ibNew, ullBase, pMatches);
+				}
+			}
+		}
+	}
+
+	void FindRegexes(
+		const unsigned char *pb,
+		std::size_t cb,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		const char *pchFirst = reinterpret_cast<const char *>(pb);
+		for (const Regex &regex : m_regexes) {
+			for (std::cregex_iterator it(pchFirst, pchFirst + cb, regex.re), itEnd; it != itEnd; ++it) {
+				const std::size_t ib = static_cast<std::size_t>(it->position(0));
+				const std::size_t cbMatch = static_cast<std::size_t>(it->length(0));
+				if (cbMatch > 0 && ib + cbMatch > ibNew) pMatches->push_back({ullBase + ib, regex.iPattern});
+			}
+		}
+	}
+
+#ifdef ADSX_CONTENT_X64
+	static unsigned LowestBit(std::uint32_t u) {
+	#ifdef _MSC_VER
+		unsigned long iBit;
+		_BitScanForward(&iBit, u);
+		return iBit;
+	#else
+		return static_cast<unsigned>(__builtin_ctz(u));
+	#endif
+	}
+
+	// Both return where they stopped: the rest is too close to the end for a
+	// whole vector past every literal's last byte.
+	std::size_t FindSse2(
+		const unsigned char *pb,
+		std::size_t cb,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		const std::size_t cLiterals = m_literals.size();
+		__m128i avFirst[cSimdLiterals], avLast[cSimdLiterals];
+		for (std::size_t i = 0; i < cLiterals; i++) {
+			const std::string &sBytes = m_literals[i].sBytes;
+			avFirst[i] = _mm_set1_epi8(sBytes.front());
+			avLast[i] = _mm_set1_epi8(sBytes.back());
+		}
+		const std::size_t cbReach = m_cbMaxLiteral - 1 + 16;
+		std::size_t ib = 0;
+		for (; cb >= cbReach && ib <= cb - cbReach; ib += 16) {
+			const __m128i vBlock = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb + ib));
+			for (std::size_t i = 0; i < cLiterals; i++) {
+				const Literal &literal = m_literals[i];
+				const std::size_t cbLiteral = literal.sBytes.size();
+				const __m128i vLast = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pb + ib + cbLiteral - 1));
+				std::uint32_t uMask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(vBlock, avFirst[i]),
+					_mm_cmpeq_epi8(vLast, avLast[i])
+				)));
+				while (uMask != 0) {
+					const std::size_t ibMatch = ib + LowestBit(uMask);
+					if (std::memcmp(pb + ibMatch, literal.sBytes.data(), cbLiteral) == 0) {
+						Report(literal, ibMatch, ibNew, ullBase, pMatches);
+					}
+					uMask &= uMask - 1;
+				}
+			}
+		}
+		return ib;
+	}
+
+	ADSX_TARGET_AVX2 std::size_t FindAvx2(
+		const unsigned char *pb,
+		std::size_t cb,
+		std::size_t ibNew,
+		std::uint64_t ullBase,
+		std::vector<Match> *pMatches
+	) const {
+		const std::size_t cLiterals = m_literals.size();
+		__m256i avFirst[cSimdLiterals], avLast[cSimdLiterals];
+		for (std::size_t i = 0; i < cLiterals; i++) {
+			const std::string &sBytes = m_literals[i].sBytes;
+			avFirst[i] = _mm256_set1_epi8(sBytes.front());
+			avLast[i] = _mm256_set1_epi8(sBytes.back());
+		}
+		const std::size_t cbReach = m_cbMaxLiteral - 1 + 32;
+		std::size_t ib = 0;
+		for (; cb >= cbReach && ib <= cb - cbReach; ib += 32) {
+			const __m256i vBlock = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pb + ib));
+			for (std::size_t i = 0; i < cLiterals; i++) {
+				const Literal &literal = m_literals[i];
+				const std::size_t cbLiteral = literal.sBytes.size();
+				const __m256i vLast = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pb + ib + cbLiteral - 1));
+				std::uint32_t uMask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+					_mm256_cmpeq_epi8(vBlock, avFirst[i]),
+					_mm256_cmpeq_epi8(vLast, avLast[i])
+				)));
+				while (uMask != 0) {
+					const std::size_t ibMatch = ib + LowestBit(uMask);
+					if (std::memcmp(pb + ibMatch, literal.sBytes.data(), cbLiteral) == 0) {
+						Report(literal, ibMatch, ibNew, ullBase, pMatches);
+					}
+					uMask &= uMask - 1;
+				}
+			}
+		}
+		return ib;
+	}
+#endif
+
+	Isa m_isa;
+	std::uint32_t m_cPatterns = 0;
+	std::vector<Literal> m_literals;
+	std::vector<Regex> m_regexes;
+	std::size_t m_cbMaxLiteral = 0;
+	// Which literals start with each byte
+	std::vector<std::uint32_t> m_aStarting[256];
+	// Bytes some one-byte literal is
+	bool m_abSingle[256] = {};
+	// First two bytes of the longer literals, low byte first: a bit each
+	std::uint64_t m_aullPairs[65536 / 64] = {};
+};
+
+
+/**
+ * One stream's worth of searching, read into Room() a chunk at a time.
+ * Reusable: Reset() between streams keeps the buffer.
+ */
+class CStreamScan {
+  public:
+	static constexpr std::size_t cbChunkDefault = 1024 * 1024;
+
+	// @post: may throw std::bad_alloc.
+	explicit CStreamScan(const CMatcher &matcher, std::size_t cbChunk = cbChunkDefault)
+		: m_matcher(matcher)
+		, m_buffer(matcher.Overlap() + cbChunk)
+		, m_cbCarry(0)
+		, m_ullBase(0) {}
+
+	void Reset() {
+		m_cbCarry = 0;
+		m_ullBase = 0;
+	}
+
+	// Where the next read goes, and how much it can put there
+	unsigned char *Room() { return m_buffer.data() + m_cbCarry; }
+	std::size_t RoomSize() const { return m_buffer.size() - m_cbCarry; }
+
+	/**
+	 * cbRead bytes were put at Room(); append what they complete to
+	 * *pMatches. A long match can complete a chunk after a short one that
+	 * starts later, so sort them if the order matters.
+	 * @pre: cbRead <= RoomSize().
+	 * @post: may throw std::bad_alloc.
+	 */
+	void Advance(std::size_t cbRead, std::vector<Match> *pMatches) {
+		const std::size_t cb = m_cbCarry + cbRead;
+		m_matcher.Find(m_buffer.data(), cb, m_cbCarry, m_ullBase, pMatches);
+		const std::size_t cbCarry = (std::min)(m_matcher.Overlap(), cb);
+		std::memmove(m_buffer.data(), m_buffer.data() + cb - cbCarry, cbCarry);
+		m_ullBase += cb - cbCarry;
+		m_cbCarry = cbCarry;
+	}
+
+	// How far into the stream it's been read
+	std::uint64_t Offset() const { return m_ullBase + m_cbCarry; }
+
+  private:
+	const CMatcher &m_matcher;
+	std::vector<unsigned char> m_buffer;
+	std::size_t m_cbCarry;  // the end of the last chunk, at the front
+	std::uint64_t m_ullBase;  // where m_buffer[0] is in the stream
+};
+
+}  // namespace ADSX::Content
@@ -0,0 +1,370 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ContentSearch.h"
+
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "ContentIndex.h"
+#include "IoScheduler.h"
+#include "ReportFile.h"
+#include "StreamQuery.h"
+#include "TreeScanner.h"
+
+namespace ADSX {
+
+
+HRESULT CContentSearch::SearchStream(
+	_In_    PCWSTR                       pszStream,
+	_Inout_ Content::CStreamScan         &scan,
+	_Inout_ std::vector<Content::Match>  *pMatches,
+	_Out_   ULONGLONG                    *pcbRead
+) {
+	*pcbRead = 0;
+	scan.Reset();
+	HANDLE hStream = CreateFileW(
+		ExtendedLengthPath(pszStream).c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (hStream == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	defer({ CloseHandle(hStream); });
+
+	const std::size_t iFirst = pMatches->size();
+	for (;;) {
+		DWORD cbRead;
+		const DWORD cbWant = static_cast<DWORD>((std::min)(scan.RoomSize(), static_cast<std::size_t>(MAXDWORD)));
+		if (!ReadFile(hStream, scan.Room(), cbWant, &cbRead, NULL)) {
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		if (cbRead == 0) break;
+		*pcbRead += cbRead;
+		scan.Advance(cbRead, pMatches);
+		if (pMatches->size() - iFirst >= cMaxHitsPerStream) break;
+	}
+	std::sort(pMatches->begin() + iFirst, pMatches->end());
+	if (pMatches->size() - iFirst > cMaxHitsPerStream) pMatches->resize(iFirst + cMaxHitsPerStream);
+	return S_OK;
+}
+
+
+HRESULT CContentSearch::SearchEach(
+	_In_  const NextBatch         &fnNext,
+	_In_  const Content::CMatcher &matcher,
+	_Out_ Result                  *pResult
+) {
+	CComAutoCriticalSection csNext;
+	bool bOver = false;
+	HRESULT hrNext = S_OK;
+
+	struct Share {
+		std::vector<Hit> hits;
+		ULONGLONG cStreams = 0;
+		ULONGLONG cbRead = 0;
+		ULONG cErrors = 0;
+		HRESULT hr = S_OK;
+	};
+	const unsigned cWorkers = std::clamp(std::thread::hardware_concurrency(), 1u, cWorkersMax);
+	std::vector<Share> shares(cWorkers);
+
+	auto fnWork = [&](Share &share) {
+		// Whatever the user's looking at meanwhile goes first
+		CBackgroundMode background;
+		try {
+			Content::CStreamScan scan(matcher);
+			std::vector<Content::Match> matches;
+			std::vector<std::wstring> streams;
+			for (;;) {
+				{
+					CComCritSecLock<CComAutoCriticalSection> lock(csNext);
+					if (bOver) return;
+					const HRESULT hrBatch = fnNext(&streams);
+					if (hrBatch != S_OK) {
+						bOver = true;
+						if (FAILED(hrBatch)) hrNext = hrBatch;
+						return;
+					}
+				}
+				for (const std::wstring &sStream : streams) {
+					CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(
+						sStream.c_str(), IoPriority::Background
+					);
+					matches.clear();
+					ULONGLONG cbRead;
+					if (FAILED(SearchStream(sStream.c_str(), scan, &matches, &cbRead))) {
+						share.cErrors++;
+					} else {
+						share.cStreams++;
+					}
+					share.cbRead += cbRead;
+					for (const Content::Match &match : matches) {
+						share.hits.push_back({sStream, match.ullOffset, match.iPattern});
+					}
+				}
+			}
+		} catch (const std::bad_alloc &) {
+			share.hr = E_OUTOFMEMORY;
+			CComCritSecLock<CComAutoCriticalSection> lock(csNext);
+			bOver = true;
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < cWorkers; i++) threads.emplace_back(fnWork, std::ref(shares[i]));
+	fnWork(shares[0]);
+	for (std::thread &thread : threads) thread.join();
+
+	for (Share &share : shares) {
+		if (FAILED(share.hr)) return share.hr;
+		pResult->cStreams += share.cStreams;
+		pResult->cbRead += share.cbRead;
+		pResult->cErrors += share.cErrors;
+		pResult->hits.insert(
+			pResult->hits.end(),
+			std::make_move_iterator(share.hits.begin()),
+			std::make_move_iterator(share.hits.end())
+		);
+	}
+	std::sort(pResult->hits.begin(), pResult->hits.end(), [](const Hit &a, const Hit &b) {
+		const int iOrder = a.sStream.compare(b.sStream);
+		if (iOrder != 0) return iOrder < 0;
+		return a.ullOffset != b.ullOffset ? a.ullOffset < b.ullOffset : a.iPattern < b.iPattern;
+	});
+	return hrNext;
+}
+
+
+HRESULT CContentSearch::Search(
+	_In_  PCWSTR                  pszRoot,
+	_In_  const Content::CMatcher &matcher,
+	_Out_ Result                  *pResult
+) {
+	if (pszRoot == NULL || pResult == NULL) return E_POINTER;
+	*pResult = {};
+	LOG(L" ** Searching streams under " << pszRoot << L" with " <<
+		Content::IsaName(matcher.GetIsa()));
+	const ULONGLONG ullStart = GetTickCount64();
+
+	CComPtr<CTreeScanner> pScanner;
+	HRESULT hr = CTreeScanner::Start(pszRoot, &pScanner);
+	if (FAILED(hr)) return hr;
+	pScanner->AddConsumer();
+	defer({ pScanner->RemoveConsumer(); });
+
+	ULONG iNext = 0;
+	hr = SearchEach(
+		[&](std::vector<std::wstring> *pStreams) {
+			pStreams->clear();
+			PITEMID_CHILD rgpidl[cBatch];
+			ULONG cFetched;
+			const HRESULT hrGet = pScanner->Get(iNext, cBatch, rgpidl, &cFetched, INFINITE);
+			if (hrGet != S_OK) return hrGet;
+			iNext += cFetched;
+			defer({ for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(rgpidl[i]); });
+			for (ULONG i = 0; i < cFetched; i++) {
+				pStreams->push_back(CTreeScanner::StreamPath(pszRoot, CTreeScanner::StreamKey(rgpidl[i])));
+			}
+			return S_OK;
+		},
+		matcher,
+		pResult
+	);
+	pResult->dwMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	LOG(L" ** " << std::dec << pResult->cStreams << L" streams, " << pResult->cbRead <<
+		L" bytes, " << pResult->hits.size() << L" hits in " << pResult->dwMs << L" ms");
+	return hr;
+}
+
+
+HRESULT CContentSearch::SearchIndexed(
+	_In_  CContentIndex           *pIndex,
+	_In_  const Content::CMatcher &matcher,
+	_Out_ Result                  *pResult
+) {
+	if (pIndex == NULL || pResult == NULL) return E_POINTER;
+	*pResult = {};
+	LOG(L" ** Searching indexed streams under " << pIndex->Root() << L" with " <<
+		Content::IsaName(matcher.GetIsa()));
+	const ULONGLONG ullStart = GetTickCount64();
+
+	std::vector<std::string> literals;
+	std::vector<std::wstring> candidates;
+	if (matcher.GetLiterals(&literals)) {
+		HRESULT hr = pIndex->Candidates(literals, &candidates);
+		if (FAILED(hr)) return hr;
+	} else {
+		// Nothing a regex needs can be looked up: every stream it knows of
+		HRESULT hr = pIndex->Candidates({std::string()}, &candidates);
+		if (FAILED(hr)) return hr;
+	}
+	const ULONGLONG cDocuments = pIndex->GetStats().cDocuments;
+	pResult->cRuledOut = cDocuments > candidates.size() ? cDocuments - candidates.size() : 0;
+
+	std::size_t iNext = 0;
+	HRESULT hr = SearchEach(
+		[&](std::vector<std::wstring> *pStreams) {
+			pStreams->clear();
+			if (iNext == candidates.size()) return S_FALSE;
+			const std::size_t iEnd = (std::min)(iNext + cBatch, candidates.size());
+			for (; iNext < iEnd; iNext++) pStreams->push_back(std::move(candidates[iNext]));
+			return S_OK;
+		},
+		matcher,
+		pResult
+	);
+	pResult->dwMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	LOG(L" ** " << std::dec << pResult->cStreams << L" streams, " << pResult->cbRead <<
+		L" bytes, " << pResult->hits.size() << L" hits in " << pResult->dwMs << L" ms; " <<
+		pResult->cRuledOut << L" ruled out");
+	return hr;
+}
+
+
+static std::string ToUtf8(_In_ PCWSTR psz) {
+	const int cb = WideCharToMultiByte(CP_UTF8, 0, psz, -1, NULL, 0, NULL, NULL);
+	if (cb <= 1) return std::string();
+	std::string sUtf8(cb - 1, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, psz, -1, &sUtf8[0], cb, NULL, NULL);
+	return sUtf8;
+}
+
+
+// "00ff1A" -> the three bytes; false if it isn't pairs of hex digits.
+static bool ParseHex(_In_ PCWSTR pszHex, _Out_ std::string *psBytes) {
+	psBytes->clear();
+	const std::size_t cch = wcslen(pszHex);
+	if (cch == 0 || cch % 2 != 0) return false;
+	for (std::size_t i = 0; i < cch; i += 2) {
+		if (!iswxdigit(pszHex[i]) || !iswxdigit(pszHex[i + 1])) return false;
+		const WCHAR szByte[3] = {pszHex[i], pszHex[i + 1], L'\0'};
+		psBytes->push_back(static_cast<char>(wcstoul(szByte, NULL, 16)));
+	}
+	return true;
+}
+
+
+HRESULT CContentSearch::RunCommandLine(_In_ PCWSTR pszCommandLine) {
+	if (pszCommandLine == NULL) return E_POINTER;
+	// Given nothing, CommandLineToArgvW would hand back the program's name
+	if (*pszCommandLine == L'\0') return E_INVALIDARG;
+	int cArgs;
+	LPWSTR *ppszArgs = CommandLineToArgvW(pszCommandLine, &cArgs);
+	if (ppszArgs == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	defer({ LocalFree(ppszArgs); });
+
+	try {
+		Content::CMatcher matcher;
+		// What each pattern was on the command line, by index
+		std::vector<std::wstring> descriptions;
+		std::wstring sOut;
+		bool bIndex = false;
+		std::vector<std::wstring> roots;
+		for (int i = 0; i < cArgs; i++) {
+			PCWSTR pszArg = ppszArgs[i];
+			if (_wcsnicmp(pszArg, L"/text:", 6) == 0) {
+				PCWSTR pszText = pszArg + 6;
+				matcher.AddLiteral(ToUtf8(pszText));
+				descriptions.push_back(pszArg + 1);
+				matcher.AddLiteral(std::string(
+					reinterpret_cast<const char *>(pszText), wcslen(pszText) * sizeof(WCHAR)
+				));
+				descriptions.push_back(std::wstring(pszArg + 1) + L" (UTF-16)");
+			} else if (_wcsnicmp(pszArg, L"/hex:", 5) == 0) {
+				std::string sBytes;
+				if (!ParseHex(pszArg + 5, &sBytes)) return E_INVALIDARG;
+				matcher.AddLiteral(sBytes);
+				descriptions.push_back(pszArg + 1);
+			} else if (_wcsnicmp(pszArg, L"/regex:", 7) == 0) {
+				std::uint32_t iPattern;
+				std::string sError;
+				if (!matcher.AddRegex(ToUtf8(pszArg + 7), &iPattern, &sError)) {
+					LOG(L" ** Bad regular expression " << pszArg + 7 << L": " << sError.c_str());
+					return E_INVALIDARG;
+				}
+				descriptions.push_back(pszArg + 1);
+			} else if (_wcsnicmp(pszArg, L"/out:", 5) == 0) {
+				sOut = pszArg + 5;
+			} else if (_wcsicmp(pszArg, L"/index") == 0) {
+				bIndex = true;
+			} else {
+				roots.emplace_back(pszArg);
+			}
+		}
+		if (roots.empty() || descriptions.empty()) return E_INVALIDARG;
+
+		CHandle hOut;
+		HRESULT hr = CreateReportFile(sOut, L"StreamSearch.txt", &hOut);
+		if (FAILED(hr)) return hr;
+
+		HRESULT hrAll = S_OK;
+		for (const std::wstring &sRoot : roots) {
+			Result result;
+			std::wstring sReport;
+			WCHAR szLine[512];
+			if (bIndex) {
+				CComPtr<CContentIndex> pIndex;
+				hr = CContentIndex::Open(sRoot.c_str(), &pIndex);
+				if (SUCCEEDED(hr)) hr = pIndex->Update();
+				if (SUCCEEDED(hr)) hr = SearchIndexed(pIndex, matcher, &result);
+				if (SUCCEEDED(hr)) {
+					const CContentIndex::Stats stats = pIndex->GetStats();
+					swprintf_s(
+						szLine,
+						L"Index of %s: %llu streams, %llu bytes; updated in %lu ms, "
+						L"reading %llu streams (%llu bytes, %.1f MB/s); %llu candidates in %llu us\r\n",
+						sRoot.c_str(),
+						stats.cDocuments,
+						stats.cbFile,
+						stats.dwLastUpdateMs,
+						stats.cLastRead,
+						stats.cbLastRead,
+						stats.BuildRate(),
+						stats.cLastCandidates,
+						stats.ullLastQueryUs
+					);
+					sReport.append(szLine);
+				}
+			} else {
+				hr = Search(sRoot.c_str(), matcher, &result);
+			}
+			if (FAILED(hr)) {
+				swprintf_s(szLine, L": couldn't search, error 0x%08lX\r\n\r\n", static_cast<ULONG>(hr));
+				sReport.append(sRoot).append(szLine);
+			} else {
+				swprintf_s(
+					szLine,
+					L"Streams under %s: %llu hits in %llu streams, %llu bytes read in %lu ms, %lu unreadable, %llu ruled out\r\n",
+					sRoot.c_str(),
+					static_cast<ULONGLONG>(result.hits.size()),
+					result.cStreams,
+					result.cbRead,
+					result.dwMs,
+					result.cErrors,
+					result.cRuledOut
+				);
+				sReport.append(szLine);
+				for (const Hit &hit : result.hits) {
+					swprintf_s(szLine, L" @ 0x%llX  ", static_cast<ULONGLONG>(hit.ullOffset));
+					sReport.append(hit.sStream).append(szLine).append(descriptions[hit.iPattern]).append(L"\r\n");
+				}
+				sReport.append(L"\r\n");
+			}
+			hr = WriteUtf8(hOut, sReport);
+			if (FAILED(hr)) hrAll = hr;
+		}
+		return hrAll;
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+}
+
+}  // namespace ADSX
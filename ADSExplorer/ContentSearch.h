@@ -0,0 +1,115 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Which streams under a folder contain some bytes or match a regular
+ * expression (ContentMatch.h), and where in them. Streams are found with the
+ * tree scanner and read a megabyte at a time by a handful of threads, each
+ * taking its turn at the disk behind anything the user is waiting on. With
+ * "/index", the root's content index (ContentIndex.h) is brought up to date
+ * first, and only the streams it can't rule out are read. Run with
+ *   rundll32 ADSExplorer.dll,SearchStreamContent [/index] [/text:s] [/hex:bytes] [/regex:re] [/out:file] root...
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ContentMatch.h"
+
+namespace ADSX {
+
+class CContentIndex;
+
+
+class CContentSearch {
+  public:
+	struct Hit {
+		std::wstring sStream;  // "C:\dir\file.txt:name"
+		std::uint64_t ullOffset;
+		std::uint32_t iPattern;
+	};
+
+	struct Result {
+		std::vector<Hit> hits;  // by stream, then offset
+		ULONGLONG cStreams;     // read all the way through, or to cMaxHitsPerStream
+		ULONGLONG cbRead;
+		ULONG cErrors;          // streams that couldn't be opened or read
+		ULONGLONG cRuledOut;    // streams the index said couldn't match
+		DWORD dwMs;
+	};
+
+	// A stream with this many hits has made its point; stop reading it
+	static constexpr std::size_t cMaxHitsPerStream = 1000;
+
+	/**
+	 * Search one stream ("C:\dir\file.txt:name") from the top, adding what
+	 * it finds to *pMatches in order.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT SearchStream(
+		_In_    PCWSTR                       pszStream,
+		_Inout_ Content::CStreamScan         &scan,
+		_Inout_ std::vector<Content::Match>  *pMatches,
+		_Out_   ULONGLONG                    *pcbRead
+	);
+
+	/**
+	 * Search every stream under pszRoot, and pszRoot's own.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT Search(
+		_In_  PCWSTR                  pszRoot,
+		_In_  const Content::CMatcher &matcher,
+		_Out_ Result                  *pResult
+	);
+
+	/**
+	 * Search only the streams under pIndex's root that it can't rule out.
+	 * A regex can't be narrowed down, so with one this reads every stream
+	 * the index knows of.
+	 * @pre: pIndex is up to date.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT SearchIndexed(
+		_In_  CContentIndex           *pIndex,
+		_In_  const Content::CMatcher &matcher,
+		_Out_ Result                  *pResult
+	);
+
+	/**
+	 * What SearchStreamContent does with its command line: search every
+	 * root on it for every pattern on it, into one report file,
+	 * %LOCALAPPDATA%\ADSExplorer\StreamSearch.txt unless "/out:" says.
+	 * "/text:" looks for the text both as UTF-8 and as UTF-16. "/index"
+	 * updates each root's content index and searches with it.
+	 */
+	static HRESULT RunCommandLine(_In_ PCWSTR pszCommandLine);
+
+  protected:
+	// How many streams a thread takes from the scanner at a time
+	static constexpr ULONG cBatch = 16;
+	static constexpr unsigned cWorkersMax = 8;
+
+	/**
+	 * Fills in the next streams to search, up to cBatch of them, by full
+	 * path. S_OK with some, S_FALSE when there are no more. Called by one
+	 * thread at a time.
+	 */
+	using NextBatch = std::function<HRESULT(_Out_ std::vector<std::wstring> *pStreams)>;
+
+	/**
+	 * Search every stream fnNext hands out, from a few threads at once.
+	 * @post: fills in all of *pResult but dwMs and cRuledOut.
+	 */
+	static HRESULT SearchEach(
+		_In_  const NextBatch         &fnNext,
+		_In_  const Content::CMatcher &matcher,
+		_Out_ Result                  *pResult
+	);
+};
+
+}  // namespace ADSX
@@ -11,6 +11,7 @@
 #include "ContextMenuEntry.h"
 
 #include "debug.h"
+#include "StreamProbe.h"
 
 // Debug log prefix for ADSX::CContextMenuEntry
 #define P_CME L"ADSX::CContextMenuEntry(0x" << std::hex << this << L")::"
@@ -173,6 +174,20 @@ IFACEMETHODIMP CContextMenuEntry::QueryContextMenu(
 		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, FACILITY_NULL, 0));
 	}
 
+	// Only offer to browse streams that are there, unless the user held
+	// Shift for the extended menu.
+	if (m_pszADSPath == NULL) {
+		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, FACILITY_NULL, 0));
+	}
+	PCWSTR pszFilePath = m_pszADSPath + _countof(szPrefix) - 1;
+	if (
+		!(uFlags & CMF_EXTENDEDVERBS) &&
+		!CStreamProbe::Instance().HasNamedStreams(pszFilePath)
+	) {
+		LOG(L" ** No streams on " << pszFilePath);
+		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, FACILITY_NULL, 0));
+	}
+
 	// Use the helper function InsertMenu to add a new menu item.
 	// We specify CMF_SEPARATOR to add a separator.
 	// InsertMenuW(hmenu, i, MF_SEPARATOR | MF_BYPOSITION, 0, NULL);
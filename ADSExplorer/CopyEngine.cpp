@@ -0,0 +1,673 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "CopyEngine.h"
+
+#include <atlstr.h>
+#include <winioctl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include "IoScheduler.h"
+#include "ModuleThread.h"
+#include "StreamQuery.h"
+#include "resource.h"  // Resource IDs from the RC file
+
+namespace ADSX {
+
+
+// How often a paused copy asks whether it's been resumed
+static constexpr DWORD dwPausePollMs = 100;
+
+
+// What CopyInBackground hands its thread
+struct BackgroundCopy {
+	HWND hwndOwner;
+	std::vector<CCopyEngine::Job> jobs;
+	CCopyEngine::FnStart fnStart;
+	CCopyEngine::FnCopied fnCopied;
+};
+
+
+// The shell item for what's left of sPath once everything after the last
+// chSeparator is cut off: the file a stream is on, or the folder a file is
+// in. NULL if there's no such item, like for a virtual file's made-up name.
+static CComPtr<IShellItem> ItemForParent(
+	_In_ const std::wstring &sPath,
+	_In_ WCHAR              chSeparator
+) {
+	CComPtr<IShellItem> psi;
+	const std::size_t ich = sPath.find_last_of(chSeparator);
+	// Not the drive letter's own colon
+	if (ich == std::wstring::npos || ich < 2) return psi;
+	try {
+		const std::wstring sParent = sPath.substr(0, ich);
+		SHCreateItemFromParsingName(sParent.c_str(), NULL, IID_PPV_ARGS(&psi));
+	} catch (const std::bad_alloc &) {}
+	return psi;
+}
+
+
+static ULONGLONG RoundUp(_In_ ULONGLONG cb, _In_ ULONGLONG cbMultiple) {
+	return (cb + cbMultiple - 1) / cbMultiple * cbMultiple;
+}
+
+
+// DeviceIoControl on a handle opened for overlapped I/O, waiting for it to
+// finish. Fails with ERROR_MORE_DATA, having filled pvOut, if there's more.
+static BOOL DeviceIoControlAndWait(
+	_In_                          HANDLE hFile,
+	_In_                          DWORD  dwCode,
+	_In_reads_bytes_opt_(cbIn)    void   *pvIn,
+	_In_                          DWORD  cbIn,
+	_Out_writes_bytes_opt_(cbOut) void   *pvOut,
+	_In_                          DWORD  cbOut,
+	_Out_                         DWORD  *pcbReturned
+) {
+	*pcbReturned = 0;
+	CHandle hEvent(CreateEventW(NULL, TRUE, FALSE, NULL));
+	if (hEvent == NULL) return FALSE;
+	OVERLAPPED ov = {};
+	ov.hEvent = hEvent;
+	if (!DeviceIoControl(hFile, dwCode, pvIn, cbIn, pvOut, cbOut, NULL, &ov)) {
+		const DWORD dwError = GetLastError();
+		if (dwError != ERROR_IO_PENDING && dwError != ERROR_MORE_DATA) return FALSE;
+	}
+	return GetOverlappedResult(hFile, &ov, pcbReturned, TRUE);
+}
+
+
+// Move the end of the file; the file pointer is only borrowed for it.
+static BOOL SetEnd(_In_ HANDLE hFile, _In_ ULONGLONG cb) {
+	LARGE_INTEGER liEnd;
+	liEnd.QuadPart = static_cast<LONGLONG>(cb);
+	return SetFilePointerEx(hFile, liEnd, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+}
+
+
+// Whether the destination is a file of its own rather than a stream on one,
+// which the shell has no way to be told about
+static bool IsFileOfItsOwn(_In_ const std::wstring &sPath) {
+	return sPath.find(L':', 2) == std::wstring::npos;
+}
+
+
+// Open for overlapped I/O, unbuffered if the volume will have it.
+static HANDLE CreateFileOverlapped(
+	_In_ PCWSTR pszPath,
+	_In_ DWORD  dwAccess,
+	_In_ DWORD  dwShare,
+	_In_ DWORD  dwDisposition,
+	_In_ DWORD  dwFlags
+) {
+	dwFlags |= FILE_FLAG_OVERLAPPED;
+	HANDLE hFile = CreateFileW(
+		pszPath, dwAccess, dwShare, NULL, dwDisposition, dwFlags | FILE_FLAG_NO_BUFFERING, NULL
+	);
+	if (hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+		hFile = CreateFileW(
+			pszPath, dwAccess, dwShare, NULL, dwDisposition, dwFlags | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+		);
+	}
+	return hFile;
+}
+
+
+std::vector<CCopyEngine::Range> CCopyEngine::AllocatedRanges(
+	_In_ HANDLE    hSource,
+	_In_ ULONGLONG cbSize
+) {
+	std::vector<Range> ranges;
+	FILE_ALLOCATED_RANGE_BUFFER query;
+	query.FileOffset.QuadPart = 0;
+	query.Length.QuadPart = static_cast<LONGLONG>(cbSize);
+	FILE_ALLOCATED_RANGE_BUFFER aFound[256];
+	while (query.Length.QuadPart > 0) {
+		DWORD cbReturned;
+		const BOOL bAll = DeviceIoControlAndWait(
+			hSource, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+			aFound, sizeof(aFound), &cbReturned
+		);
+		if (!bAll && GetLastError() != ERROR_MORE_DATA) {
+			// Not a filesystem that has holes: all of it, then
+			ranges.clear();
+			ranges.push_back({0, RoundUp(cbSize, cbAlign)});
+			return ranges;
+		}
+		const DWORD cFound = cbReturned / sizeof(aFound[0]);
+		for (DWORD i = 0; i < cFound; i++) {
+			const ULONGLONG ullStart = aFound[i].FileOffset.QuadPart / cbAlign * cbAlign;
+			const ULONGLONG ullEnd = RoundUp((std::min)(
+				static_cast<ULONGLONG>(aFound[i].FileOffset.QuadPart + aFound[i].Length.QuadPart),
+				cbSize
+			), cbAlign);
+			// Rounded out, it can run into the one before
+			if (!ranges.empty() && ullStart <= ranges.back().ullOffset + ranges.back().cb) {
+				ranges.back().cb = (std::max)(ranges.back().cb, ullEnd - ranges.back().ullOffset);
+			} else {
+				ranges.push_back({ullStart, ullEnd - ullStart});
+			}
+		}
+		if (bAll || cFound == 0) break;
+		// Carry on after the last one it found
+		const LONGLONG llNext = aFound[cFound - 1].FileOffset.QuadPart + aFound[cFound - 1].Length.QuadPart;
+		query.Length.QuadPart = static_cast<LONGLONG>(cbSize) - llNext;
+		query.FileOffset.QuadPart = llNext;
+	}
+	return ranges;
+}
+
+
+HRESULT CCopyEngine::CopyOne(
+	_In_    const Job     &job,
+	_In_    BYTE          *apbBuffers[2],
+	_In_    const FnBlock &fnBlock,
+	_Inout_ Stats         *pStats
+) {
+	CHandle hSource;
+	ULONGLONG cbSize;
+	std::vector<Range> ranges;
+	if (job.pSource != NULL) {
+		// All of it, however long it turns out to be: the size of a virtual
+		// file is only what its source says it is, if it says at all
+		STATSTG stat;
+		cbSize = SUCCEEDED(job.pSource->Stat(&stat, STATFLAG_NONAME)) ?
+			(std::max)(stat.cbSize.QuadPart, job.cbSize) :
+			job.cbSize;
+		ranges.push_back({0, (std::max)(RoundUp(cbSize, cbAlign), static_cast<ULONGLONG>(cbAlign))});
+	} else {
+		hSource.Attach(CreateFileOverlapped(
+			ExtendedLengthPath(job.sSource.c_str()).c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS
+		));
+		if (hSource == INVALID_HANDLE_VALUE) {
+			hSource.Detach();
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		LARGE_INTEGER liSize;
+		if (!GetFileSizeEx(hSource, &liSize)) return HRESULT_FROM_WIN32(GetLastError());
+		cbSize = static_cast<ULONGLONG>(liSize.QuadPart);
+		ranges = AllocatedRanges(hSource, cbSize);
+	}
+
+	// Each block is no bigger than cbBlock, and within one allocated range
+	std::vector<Range> blocks;
+	ULONGLONG cbAllocated = 0;
+	for (const Range &range : ranges) {
+		const ULONGLONG ullEnd = range.ullOffset + range.cb;
+		cbAllocated += (std::min)(ullEnd, cbSize) - range.ullOffset;
+		for (ULONGLONG ullOffset = range.ullOffset; ullOffset < ullEnd; ullOffset += cbBlock) {
+			blocks.push_back({ullOffset, (std::min)(static_cast<ULONGLONG>(cbBlock), ullEnd - ullOffset)});
+		}
+	}
+	const bool bSparse = cbAllocated < cbSize;
+
+	const std::wstring sDestination = ExtendedLengthPath(job.sDestination.c_str());
+	const DWORD dwDestinationAccess = GENERIC_READ | GENERIC_WRITE;
+	CHandle hDestination(CreateFileOverlapped(
+		sDestination.c_str(), dwDestinationAccess, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL
+	));
+	if (hDestination == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND) {
+		// "sub\file.txt_name" from the tree pseudofolder
+		hDestination.Detach();
+		const std::size_t ichSlash = job.sDestination.find_last_of(L'\\');
+		if (ichSlash == std::wstring::npos) return HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+		const std::wstring sFolder = job.sDestination.substr(0, ichSlash);
+		const int iCreated = SHCreateDirectoryExW(NULL, sFolder.c_str(), NULL);
+		if (iCreated != ERROR_SUCCESS && iCreated != ERROR_ALREADY_EXISTS) return HRESULT_FROM_WIN32(iCreated);
+		hDestination.Attach(CreateFileOverlapped(
+			sDestination.c_str(), dwDestinationAccess, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL
+		));
+	}
+	if (hDestination == INVALID_HANDLE_VALUE) {
+		hDestination.Detach();
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	// Half a copy is no copy
+	bool bKeep = false;
+	defer({
+		if (!bKeep) {
+			hDestination.Close();
+			DeleteFileW(sDestination.c_str());
+		}
+	});
+
+	if (bSparse) {
+		DWORD cbReturned;
+		if (!DeviceIoControlAndWait(hDestination, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &cbReturned)) {
+			// Then the holes are written out as zeroes by the filesystem
+			LOG(L" ** Couldn't make " << job.sDestination << L" sparse: " << GetLastError());
+		}
+	}
+	// All of it at once: it has a better chance of being in one piece, and
+	// writes inside the file can be overlapped where ones that extend it
+	// can't
+	if (!SetEnd(hDestination, bSparse ? cbSize : RoundUp(cbSize, cbAlign))) {
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	struct Slot {
+		OVERLAPPED ov;
+		CHandle hEvent;
+		bool bReading;
+		bool bWriting;
+		CIoScheduler::CTicket ticket;
+	};
+	Slot aSlots[2] = {};
+	for (Slot &slot : aSlots) {
+		slot.hEvent.Attach(CreateEventW(NULL, TRUE, FALSE, NULL));
+		if (slot.hEvent == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	}
+	// Nothing may be left in flight into buffers and OVERLAPPEDs that are
+	// about to go away
+	defer({
+		for (Slot &slot : aSlots) {
+			DWORD cb;
+			if (slot.bReading) {
+				CancelIo(hSource);
+				GetOverlappedResult(hSource, &slot.ov, &cb, TRUE);
+			}
+			if (slot.bWriting) {
+				CancelIo(hDestination);
+				GetOverlappedResult(hDestination, &slot.ov, &cb, TRUE);
+			}
+		}
+	});
+
+	// Someone's watching the progress; reads take their turns at the device
+	// as foreground requests. Writes don't: the destination could be on the
+	// same device, and one thread holding two tickets at once could wait on
+	// itself.
+	CDeviceQueue *pQueue = job.pSource == NULL ?
+		&CIoScheduler::Instance().QueueFor(job.sSource.c_str()) :
+		NULL;
+	const auto Start = [](Slot &slot, ULONGLONG ullOffset) {
+		const HANDLE hEvent = slot.hEvent;
+		ZeroMemory(&slot.ov, sizeof(slot.ov));
+		slot.ov.Offset = static_cast<DWORD>(ullOffset);
+		slot.ov.OffsetHigh = static_cast<DWORD>(ullOffset >> 32);
+		slot.ov.hEvent = hEvent;
+	};
+	const auto StartRead = [&](Slot &slot, BYTE *pb, const Range &block) -> HRESULT {
+		Start(slot, block.ullOffset);
+		if (job.pSource != NULL) {
+			// Nothing to overlap it with but the write from the other slot;
+			// it's done by the time FinishRead asks
+			ULONG cbRead = 0;
+			while (cbRead < block.cb) {
+				ULONG cb = 0;
+				const HRESULT hr = job.pSource->Read(pb + cbRead, static_cast<ULONG>(block.cb) - cbRead, &cb);
+				if (FAILED(hr)) return hr;
+				if (cb == 0) break;
+				cbRead += cb;
+			}
+			slot.ov.InternalHigh = cbRead;
+			return S_OK;
+		}
+		slot.ticket = pQueue->Acquire(IoPriority::Foreground);
+		if (!ReadFile(hSource, pb, static_cast<DWORD>(block.cb), NULL, &slot.ov)) {
+			const DWORD dwError = GetLastError();
+			// The stream got shorter since it was measured: nothing to read
+			if (dwError == ERROR_HANDLE_EOF) {
+				slot.ticket.Reset();
+				slot.ov.InternalHigh = 0;
+				return S_OK;
+			}
+			if (dwError != ERROR_IO_PENDING) {
+				slot.ticket.Reset();
+				return HRESULT_FROM_WIN32(dwError);
+			}
+		}
+		slot.bReading = true;
+		return S_OK;
+	};
+	const auto FinishRead = [&](Slot &slot, DWORD *pcbRead) -> HRESULT {
+		*pcbRead = static_cast<DWORD>(slot.ov.InternalHigh);
+		if (!slot.bReading) return S_OK;
+		slot.bReading = false;
+		const BOOL bRead = GetOverlappedResult(hSource, &slot.ov, pcbRead, TRUE);
+		slot.ticket.Reset();
+		if (!bRead) {
+			*pcbRead = 0;
+			if (GetLastError() != ERROR_HANDLE_EOF) return HRESULT_FROM_WIN32(GetLastError());
+		}
+		return S_OK;
+	};
+	const auto StartWrite = [&](Slot &slot, BYTE *pb, ULONGLONG ullOffset, DWORD cbRead) -> HRESULT {
+		// Unbuffered writes are whole sectors; the end's cut back afterwards
+		const DWORD cbWrite = static_cast<DWORD>(RoundUp(cbRead, cbAlign));
+		ZeroMemory(pb + cbRead, cbWrite - cbRead);
+		Start(slot, ullOffset);
+		if (!WriteFile(hDestination, pb, cbWrite, NULL, &slot.ov) && GetLastError() != ERROR_IO_PENDING) {
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		slot.bWriting = true;
+		return S_OK;
+	};
+	const auto FinishWrite = [&](Slot &slot) -> HRESULT {
+		if (!slot.bWriting) return S_OK;
+		slot.bWriting = false;
+		DWORD cbWritten;
+		if (!GetOverlappedResult(hDestination, &slot.ov, &cbWritten, TRUE)) {
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		return S_OK;
+	};
+
+	// While block k is written out of one buffer, block k + 1 is read into
+	// the other
+	HRESULT hr = blocks.empty() ? S_OK : StartRead(aSlots[0], apbBuffers[0], blocks[0]);
+	ULONGLONG ullEnd = 0;
+	for (std::size_t k = 0; SUCCEEDED(hr) && k < blocks.size(); k++) {
+		Slot &slot = aSlots[k % 2];
+		DWORD cbRead;
+		hr = FinishRead(slot, &cbRead);
+		if (FAILED(hr)) break;
+		if (cbRead != 0) ullEnd = (std::max)(ullEnd, blocks[k].ullOffset + cbRead);
+		// A virtual file that's still going past where it said it ended
+		if (job.pSource != NULL && k + 1 == blocks.size() && cbRead == blocks[k].cb) {
+			blocks.push_back({blocks[k].ullOffset + cbRead, cbBlock});
+		}
+		if (k + 1 < blocks.size()) {
+			Slot &slotNext = aSlots[(k + 1) % 2];
+			hr = FinishWrite(slotNext);
+			if (SUCCEEDED(hr)) hr = StartRead(slotNext, apbBuffers[(k + 1) % 2], blocks[k + 1]);
+			if (FAILED(hr)) break;
+		}
+		if (cbRead != 0) hr = StartWrite(slot, apbBuffers[k % 2], blocks[k].ullOffset, cbRead);
+		if (FAILED(hr)) break;
+		pStats->cbCopied += cbRead;
+		if (!fnBlock(cbRead)) hr = E_ABORT;
+	}
+	for (Slot &slot : aSlots) {
+		const HRESULT hrWrite = FinishWrite(slot);
+		if (SUCCEEDED(hr)) hr = hrWrite;
+	}
+	if (FAILED(hr)) return hr;
+
+	// Back from the last whole sector to the stream's own end, which is
+	// where the reads ran out unless it ends in a hole
+	if (!SetEnd(hDestination, bSparse ? cbSize : ullEnd)) return HRESULT_FROM_WIN32(GetLastError());
+	pStats->cbHoles += cbSize - cbAllocated;
+	bKeep = true;
+	return S_OK;
+}
+
+
+HRESULT CCopyEngine::Copy(
+	_In_     const std::vector<Job> &jobs,
+	_In_opt_ const FnProgress       &fnProgress,
+	_Out_    Stats                  *pStats,
+	_In_opt_ const FnCopied         &fnCopied
+) {
+	if (pStats == NULL) return E_POINTER;
+	*pStats = {};
+	if (jobs.empty()) return S_OK;
+	const DWORD dwStart = GetTickCount();
+
+	ULONGLONG cbTotal = 0;
+	for (const Job &job : jobs) cbTotal += job.cbSize;
+
+	// Files are shared out between the lanes. IStreams are copied right
+	// here, in the apartment they came from, while the lanes get on with the
+	// files; then this thread only reports on the lanes.
+	std::vector<std::size_t> files;
+	std::vector<std::size_t> streams;
+	std::vector<Stats> shares;
+	std::vector<std::thread> threads;
+	try {
+		for (std::size_t iJob = 0; iJob < jobs.size(); iJob++) {
+			(jobs[iJob].pSource != NULL ? streams : files).push_back(iJob);
+		}
+		// One for each lane and one for this thread
+		shares.resize(cLanes + 1);
+		threads.reserve(cLanes);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	CHandle hChanged(CreateEventW(NULL, FALSE, FALSE, NULL));
+	if (hChanged == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	// Reset while paused; every block waits on it first
+	CHandle hGo(CreateEventW(NULL, TRUE, TRUE, NULL));
+	if (hGo == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	std::atomic<std::size_t> iNextFile(0);
+	std::atomic<std::size_t> iJobLatest(0);
+	std::atomic<ULONGLONG> cbDone(0);
+	std::atomic<bool> bStop(false);
+
+	const auto Report = [&]() {
+		if (!fnProgress || bStop) return;
+		Progress progress = fnProgress(iJobLatest, cbDone, cbTotal);
+		if (progress == Progress::Pause) {
+			// The lanes hold before their next blocks, and so does this thread
+			ResetEvent(hGo);
+			do {
+				Sleep(dwPausePollMs);
+				progress = fnProgress(iJobLatest, cbDone, cbTotal);
+			} while (progress == Progress::Pause);
+		}
+		if (progress == Progress::Stop) bStop = true;
+		SetEvent(hGo);
+	};
+
+	// One job, start to finish, into share's stats. Any thread.
+	const auto CopyJob = [&](std::size_t iJob, BYTE *apbBuffers[2], const FnBlock &fnBlock, Stats &share) {
+		const Job &job = jobs[iJob];
+		iJobLatest = iJob;
+		HRESULT hr;
+		try {
+			hr = CopyOne(job, apbBuffers, fnBlock, &share);
+		} catch (const std::bad_alloc &) {
+			hr = E_OUTOFMEMORY;
+		}
+		if (FAILED(hr)) {
+			share.cErrors++;
+			LOG(L" ** Couldn't copy " << job.sSource << L" to " << job.sDestination << L": " <<
+				HRESULTToString(hr));
+			return;
+		}
+		share.cCopied++;
+		if (IsFileOfItsOwn(job.sDestination)) {
+			SHChangeNotify(SHCNE_CREATE, SHCNF_PATHW | SHCNF_FLUSHNOWAIT, job.sDestination.c_str(), NULL);
+		}
+		if (fnCopied) fnCopied(job);
+	};
+
+	// Two blocks for each thread copying. VirtualAlloc's are page-aligned,
+	// as unbuffered I/O needs.
+	const auto WithBuffers = [](const auto &fnUse) {
+		BYTE *pbBuffers = static_cast<BYTE *>(VirtualAlloc(
+			NULL, 2 * cbBlock, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE
+		));
+		if (pbBuffers == NULL) return;
+		defer({ VirtualFree(pbBuffers, 0, MEM_RELEASE); });
+		BYTE *apbBuffers[2] = {pbBuffers, pbBuffers + cbBlock};
+		fnUse(apbBuffers);
+	};
+
+	std::atomic<unsigned> cLanesLeft(0);
+	auto fnLane = [&](Stats &share) {
+		WithBuffers([&](BYTE *apbBuffers[2]) {
+			try {
+				const FnBlock fnBlock = [&](ULONG cb) {
+					cbDone += cb;
+					SetEvent(hChanged);
+					WaitForSingleObject(hGo, INFINITE);
+					return !bStop;
+				};
+				for (std::size_t i = iNextFile++; i < files.size() && !bStop; i = iNextFile++) {
+					CopyJob(files[i], apbBuffers, fnBlock, share);
+				}
+			} catch (const std::bad_alloc &) {
+				// Whatever's left is counted as not copied below
+			}
+		});
+		cLanesLeft--;
+		SetEvent(hChanged);
+	};
+	for (unsigned i = 0; i < cLanes && i < files.size(); i++) {
+		cLanesLeft++;
+		try {
+			threads.emplace_back(fnLane, std::ref(shares[i]));
+		} catch (const std::exception &) {
+			// Fewer lanes, then; the ones going take its files
+			cLanesLeft--;
+			break;
+		}
+	}
+
+	if (!streams.empty()) {
+		WithBuffers([&](BYTE *apbBuffers[2]) {
+			try {
+				const FnBlock fnBlock = [&](ULONG cb) {
+					cbDone += cb;
+					Report();
+					return !bStop;
+				};
+				for (std::size_t iJob : streams) {
+					if (bStop) break;
+					CopyJob(iJob, apbBuffers, fnBlock, shares[cLanes]);
+				}
+			} catch (const std::bad_alloc &) {
+			}
+		});
+	}
+	while (cLanesLeft > 0) {
+		WaitForSingleObject(hChanged, INFINITE);
+		Report();
+	}
+	for (std::thread &thread : threads) thread.join();
+	Report();
+
+	for (const Stats &share : shares) {
+		pStats->cCopied += share.cCopied;
+		pStats->cbCopied += share.cbCopied;
+		pStats->cbHoles += share.cbHoles;
+	}
+	// Failed, or never got to for want of memory or being stopped
+	pStats->cErrors = static_cast<ULONG>(jobs.size()) - pStats->cCopied;
+	pStats->dwMs = GetTickCount() - dwStart;
+	LOG(L" ** Copied " << std::dec << pStats->cCopied << L" streams, " <<
+		pStats->cbCopied << L" bytes (" << pStats->cbHoles << L" in holes skipped) in " <<
+		pStats->dwMs << L" ms; " << pStats->cErrors << L" errors");
+	if (bStop) return E_ABORT;
+	return pStats->cErrors == 0 ? S_OK : S_FALSE;
+}
+
+
+HRESULT CCopyEngine::CopyInBackground(
+	_In_opt_ HWND             hwndOwner,
+	_In_     std::vector<Job> &&jobs,
+	_In_opt_ FnStart          &&fnStart,
+	_In_opt_ FnCopied         &&fnCopied
+) {
+	auto pCopy = new (std::nothrow) BackgroundCopy;
+	if (pCopy == NULL) return E_OUTOFMEMORY;
+	pCopy->hwndOwner = hwndOwner;
+	pCopy->jobs = std::move(jobs);
+	pCopy->fnStart = std::move(fnStart);
+	pCopy->fnCopied = std::move(fnCopied);
+
+	HANDLE hThread = CreateModuleThread(&CCopyEngine::ThreadProc, pCopy);
+	if (hThread == NULL) {
+		const DWORD dwError = GetLastError();
+		delete pCopy;
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	CloseHandle(hThread);
+	return S_OK;
+}
+
+
+DWORD WINAPI CCopyEngine::ThreadProc(_In_ LPVOID pvCopy) {
+	auto pCopy = static_cast<BackgroundCopy *>(pvCopy);
+	// The progress dialog wants an apartment of its own
+	const HRESULT hrInit = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+	{
+		// The same dialog Explorer's own copies show, with pause and cancel
+		CComPtr<IOperationsProgressDialog> pProgress;
+		if (
+			SUCCEEDED(hrInit) &&
+			SUCCEEDED(pProgress.CoCreateInstance(CLSID_ProgressDialog)) &&
+			SUCCEEDED(pProgress->StartProgressDialog(pCopy->hwndOwner, OPPROGDLG_DEFAULT))
+		) {
+			pProgress->SetOperation(SPACTION_COPYING);
+			pProgress->SetMode(PDM_RUN);
+		} else {
+			pProgress.Release();
+		}
+
+		const std::size_t cJobs = pCopy->jobs.size();
+		if (pCopy->fnStart) {
+			try {
+				pCopy->fnStart(&pCopy->jobs);
+			} catch (const std::bad_alloc &) {
+				pCopy->jobs.clear();
+			}
+		}
+
+		std::size_t iShown = SIZE_MAX;
+		Stats stats;
+		const HRESULT hr = Copy(
+			pCopy->jobs,
+			[&](std::size_t iJob, ULONGLONG cbDone, ULONGLONG cbTotal) {
+				if (pProgress == NULL) return Progress::Continue;
+				if (iJob != iShown) {
+					const Job &job = pCopy->jobs[iJob];
+					CComPtr<IShellItem> psiSource = ItemForParent(job.sSource, L':');
+					CComPtr<IShellItem> psiTarget = ItemForParent(job.sDestination, L'\\');
+					pProgress->UpdateLocations(psiSource, psiTarget, NULL);
+					iShown = iJob;
+				}
+				// What was listed can be less than what's there
+				const ULONGLONG cbShownTotal = (std::max)(cbDone, cbTotal);
+				pProgress->UpdateProgress(
+					cbDone, cbShownTotal,
+					cbDone, cbShownTotal,
+					iJob, pCopy->jobs.size()
+				);
+				PDOPSTATUS status = PDOPS_RUNNING;
+				if (FAILED(pProgress->GetOperationStatus(&status))) return Progress::Continue;
+				switch (status) {
+					case PDOPS_PAUSED:
+						return Progress::Pause;
+					case PDOPS_CANCELLED:
+					case PDOPS_STOPPED:
+						return Progress::Stop;
+					default:
+						return Progress::Continue;
+				}
+			},
+			&stats,
+			pCopy->fnCopied
+		);
+		if (pProgress != NULL) pProgress->StopProgressDialog();
+
+		if (hr != E_ABORT && stats.cCopied < cJobs) {
+			CStringW sMessage;
+			sMessage.Format(
+				IDS_COPYTO_FAILED,
+				static_cast<ULONGLONG>(cJobs - stats.cCopied),
+				static_cast<ULONGLONG>(cJobs)
+			);
+			const CStringW sTitle(MAKEINTRESOURCE(IDS_COPYTO_FAILED_TITLE));
+			MessageBoxW(pCopy->hwndOwner, sMessage, sTitle, MB_OK | MB_ICONWARNING);
+		}
+	}
+	// Before the apartment goes: the jobs' IStreams belong to it
+	delete pCopy;
+	if (SUCCEEDED(hrInit)) CoUninitialize();
+	ExitModuleThread(0);
+}
+
+}  // namespace ADSX
@@ -0,0 +1,125 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Copies streams out to files of their own, as fast as the disks go. Each
+ * copy is a pipeline of two big blocks: while one is being written, the next
+ * is being read, both overlapped and (where the volume allows) unbuffered, so
+ * nothing goes through the cache twice. The destination is allocated all at
+ * once up front. Ranges of a sparse stream that were never written are left
+ * as holes in a sparse destination instead of being read and written as
+ * zeroes. A few copies go at once, so the pipeline doesn't run dry between
+ * one file and the next.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ADSX {
+
+
+class CCopyEngine {
+  public:
+	struct Job {
+		std::wstring sSource;       // "C:\dir\file.txt:name"
+		std::wstring sDestination;  // "D:\out\file.txt_name"; mustn't exist yet
+		ULONGLONG cbSize;           // as listed; only for the progress total
+		// Read this instead of sSource, which is then only for showing, if
+		// it's set: a virtual file dropped on a view. It's only touched on
+		// the thread that calls Copy, whose apartment it belongs to.
+		CComPtr<IStream> pSource;
+	};
+
+	struct Stats {
+		ULONG cCopied;
+		ULONG cErrors;       // jobs that didn't make it; their destinations are deleted
+		ULONGLONG cbCopied;  // read and written
+		ULONGLONG cbHoles;   // in sparse streams, never read or written
+		DWORD dwMs;
+	};
+
+	// Each read or write is this big, but for the last one of a range
+	static constexpr ULONG cbBlock = 4 * 1024 * 1024;
+	// What unbuffered I/O needs its offsets and sizes to be multiples of,
+	// rounded up past any sector size there is
+	static constexpr ULONG cbAlign = 64 * 1024;
+	// How many files are copied at once. Two keeps one's reads going while
+	// the other's last write finishes; any more only queue at the same disk.
+	static constexpr unsigned cLanes = 2;
+
+	// What fnProgress wants done next
+	enum class Progress { Continue, Pause, Stop };
+
+	/**
+	 * Called after each block with how far along the whole lot is. Return
+	 * Pause to hold every copy before its next block, and it's asked again
+	 * every so often until it says otherwise; Stop to stop, and the jobs in
+	 * progress count as errors.
+	 */
+	using FnProgress = std::function<
+		Progress (std::size_t iJob, ULONGLONG cbDone, ULONGLONG cbTotal)
+	>;
+
+	// Called as soon as each job's destination is complete, from whichever
+	// thread copied it.
+	using FnCopied = std::function<void (const Job &job)>;
+
+	// Called first thing on CopyInBackground's thread, to finish the jobs
+	// off there: to get their pSources in its apartment, say. Any it can't
+	// finish it takes out; they count as not copied.
+	using FnStart = std::function<void (std::vector<Job> *pJobs)>;
+
+	/**
+	 * Copy each job's stream to its destination, making any folders on the
+	 * way. A job that fails doesn't stop the rest. fnProgress is only ever
+	 * called on this thread.
+	 * @post: returns S_OK if every job was copied, S_FALSE if any weren't, or
+	 *        E_ABORT if fnProgress said to stop.
+	 */
+	static HRESULT Copy(
+		_In_     const std::vector<Job> &jobs,
+		_In_opt_ const FnProgress       &fnProgress,
+		_Out_    Stats                  *pStats,
+		_In_opt_ const FnCopied         &fnCopied = nullptr
+	);
+
+	/**
+	 * Copy on a thread of its own, behind the shell's progress dialog, and
+	 * say so if any of them didn't make it.
+	 */
+	static HRESULT CopyInBackground(
+		_In_opt_ HWND             hwndOwner,
+		_In_     std::vector<Job> &&jobs,
+		_In_opt_ FnStart          &&fnStart = nullptr,
+		_In_opt_ FnCopied         &&fnCopied = nullptr
+	);
+
+  protected:
+	struct Range {
+		ULONGLONG ullOffset;
+		ULONGLONG cb;
+	};
+
+	// The parts of the stream hSource that have ever been written, aligned
+	// out to cbAlign: just [0, cbSize) unless it's sparse.
+	// @post: may throw std::bad_alloc.
+	static std::vector<Range> AllocatedRanges(_In_ HANDLE hSource, _In_ ULONGLONG cbSize);
+
+	// Called after each block with how big it was. Return false to stop.
+	using FnBlock = std::function<bool (ULONG cb)>;
+
+	static HRESULT CopyOne(
+		_In_    const Job     &job,
+		_In_    BYTE          *apbBuffers[2],
+		_In_    const FnBlock &fnBlock,
+		_Inout_ Stats         *pStats
+	);
+
+	static DWORD WINAPI ThreadProc(_In_ LPVOID pvCopy);
+};
+
+}  // namespace ADSX
@@ -0,0 +1,31 @@
+/**
+ * 2024 Nate Kean
+ *
+ * CRC-32C (Castagnoli), for checking headers that are read back from disk.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ADSX {
+
+inline std::uint32_t Crc32c(const void *pv, std::size_t cb) {
+	static const struct Table {
+		std::uint32_t a[256];
+		Table() {
+			for (std::uint32_t i = 0; i < 256; i++) {
+				std::uint32_t u = i;
+				for (int iBit = 0; iBit < 8; iBit++) u = u & 1 ? (u >> 1) ^ 0x82F63B78 : u >> 1;
+				a[i] = u;
+			}
+		}
+	} table;
+	auto pb = static_cast<const unsigned char *>(pv);
+	std::uint32_t uCrc = 0xFFFFFFFF;
+	for (std::size_t i = 0; i < cb; i++) uCrc = table.a[(uCrc ^ pb[i]) & 0xFF] ^ (uCrc >> 8);
+	return ~uCrc;
+}
+
+}  // namespace ADSX
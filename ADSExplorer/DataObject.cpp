@@ -8,78 +8,185 @@
 
 #include "DataObject.h"
 
+#include <algorithm>
+#include <new>
+
+#include "ADSXItem.h"
+#include "StreamContents.h"
+#include "TreeScanner.h"
+
 // Debug log prefix for CDataObject
 #define P_DO L"CDataObject(0x" << std::hex << this << L")::"
 
 namespace ADSX {
 
-// Helper function that creates a CFSTR_SHELLIDLIST format from given PIDLs.
-static HGLOBAL CreateShellIDList(
-	_In_ PIDLIST_ABSOLUTE pidlaParent,
-	_In_ PCUITEMID_CHILD  pidlc
+HRESULT LayOutShellIDList(
+	_In_                PCIDLIST_ABSOLUTE     pidlaParent,
+	_In_                UINT                  cidl,
+	_In_reads_(cidl)    PCUITEMID_CHILD_ARRAY aPidls,
+	_Out_               std::vector<BYTE>     *pcida
 ) {
-	// Get the combined size of the parent folder's PIDL and the other PIDL.
-	UINT cbpidl = ILGetSize(pidlaParent) + ILGetSize(pidlc);
-
-	// Find the end of the CIDA structure. This is the size of the
-	// CIDA structure itself (which includes one element of aoffset) plus the
-	// additional number of elements in aoffset.
-	UINT uCurPos = sizeof(CIDA) + sizeof(UINT);
+	if (pidlaParent == NULL || aPidls == NULL || pcida == NULL) return E_POINTER;
+	if (cidl == 0) return E_INVALIDARG;
+
+	// Sized first, so it's all the one allocation. The CIDA itself has room
+	// for one offset; there's one more per child.
+	const SIZE_T cbHeader = sizeof(CIDA) + cidl * sizeof(UINT);
+	const SIZE_T cbParent = ILGetSize(pidlaParent);
+	SIZE_T cbTotal = cbHeader + cbParent;
+	for (UINT i = 0; i < cidl; i++) {
+		if (aPidls[i] == NULL) return E_POINTER;
+		// Just the child's one item and a terminator, as CItem::Clone does
+		cbTotal += aPidls[i]->mkid.cb + sizeof(USHORT);
+	}
+	// The offsets are UINTs
+	if (cbTotal > UINT_MAX) return E_OUTOFMEMORY;
+
+	try {
+		pcida->assign(cbTotal, 0);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	BYTE *pb = pcida->data();
+	const LPIDA pida = reinterpret_cast<LPIDA>(pb);
+	pida->cidl = cidl;
+	UINT ib = static_cast<UINT>(cbHeader);
+	pida->aoffset[0] = ib;
+	CopyMemory(pb + ib, pidlaParent, cbParent);
+	ib += static_cast<UINT>(cbParent);
+	for (UINT i = 0; i < cidl; i++) {
+		pida->aoffset[i + 1] = ib;
+		// The terminator's already zeroed
+		CopyMemory(pb + ib, aPidls[i], aPidls[i]->mkid.cb);
+		ib += aPidls[i]->mkid.cb + sizeof(USHORT);
+	}
+	return S_OK;
+}
 
-	// Allocate the memory for the CIDA structure and it's variable length
-	// members.
-	const HGLOBAL hGlobal = GlobalAlloc(
-		GPTR | GMEM_SHARE,
-		(size_t) (uCurPos +	// size of the CIDA structure and the additional
-							// aoffset elements
-				 (cbpidl + 1))
-	);	// Size of the PIDLs
-	if (hGlobal == NULL) return NULL;
 
-	const LPIDA pData = static_cast<LPIDA>(GlobalLock(hGlobal));
-	if (pData == NULL) return hGlobal;
-	defer({ GlobalUnlock(hGlobal); });
+void StreamFileName(_In_ const CItem *pItem, _Out_writes_(MAX_PATH) PWSTR pszFileName) {
+	const USHORT cch = (std::min)(pItem->cchName, static_cast<USHORT>(MAX_PATH - 1));
+	for (USHORT i = 0; i < cch; i++) {
+		const WCHAR ch = pItem->szName[i];
+		pszFileName[i] = (ch < L' ' || wcschr(L"<>:\"/|?*", ch) != NULL) ? L'_' : ch;
+	}
+	pszFileName[cch] = L'\0';
+}
 
-	pData->cidl = 1;
-	pData->aoffset[0] = uCurPos;
 
-	// Add the PIDL for the parent folder.
-	cbpidl = ILGetSize(pidlaParent);
-	CopyMemory(VOID_OFFSET(pData, uCurPos), pidlaParent, cbpidl);
-	uCurPos += cbpidl;
+#pragma region CDataObject
 
-	// Get the size of the PIDL.
-	cbpidl = ILGetSize(pidlc);
+HRESULT CDataObject::Init(
+	IUnknown *pUnkOwner,
+	PCIDLIST_ABSOLUTE pidlaParent,
+	UINT cidl,
+	PCUITEMID_CHILD_ARRAY aPidls,
+	PCWSTR pszFolder
+) {
+	m_UnkOwnerPtr = pUnkOwner;
+	m_cfShellIDList = RegisterClipboardFormat(CFSTR_SHELLIDLIST);
+	m_cfFileDescriptor = RegisterClipboardFormat(CFSTR_FILEDESCRIPTORW);
+	m_cfFileContents = RegisterClipboardFormat(CFSTR_FILECONTENTS);
+	m_cfPreferredDropEffect = RegisterClipboardFormat(CFSTR_PREFERREDDROPEFFECT);
+	HRESULT hr = LayOutShellIDList(pidlaParent, cidl, aPidls, &m_cida);
+	if (FAILED(hr)) return hr;
+
+	// Nowhere to read the streams from: just the ID list, then
+	if (pszFolder == NULL) return S_OK;
+	try {
+		m_sFolder = pszFolder;
+		m_aiStreams.reserve(cidl);
+		for (UINT i = 0; i < cidl; i++) {
+			const PCUITEMID_CHILD pidlc = Child(i);
+			if (!CItem::IsOwn(pidlc)) continue;
+			// Pseudofolders aren't anything to copy
+			if (CItem::Get(pidlc)->fFlags & (CItem::FLAG_TREE | CItem::FLAG_FILTER)) continue;
+			m_aiStreams.push_back(i);
+		}
+	} catch (const std::bad_alloc &) {
+		m_aiStreams.clear();
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
 
-	// Fill out the members of the CIDA structure.
-	pData->aoffset[1] = uCurPos;
 
-	// Copy the contents of the PIDL.
-	CopyMemory(VOID_OFFSET(pData, uCurPos), pidlc, cbpidl);
+PCUITEMID_CHILD CDataObject::Child(_In_ UINT i) const {
+	const auto pida = reinterpret_cast<const CIDA *>(m_cida.data());
+	return reinterpret_cast<PCUITEMID_CHILD>(m_cida.data() + pida->aoffset[i + 1]);
+}
 
-	// Set up the position of the next PIDL.
-	uCurPos += cbpidl;
 
-	return hGlobal;
+HRESULT CDataObject::StreamPath(_In_ UINT iStream, _Out_ std::wstring *psPath) const {
+	try {
+		// In the tree pseudofolder, names are "sub\file.txt:name" under the
+		// folder; otherwise they're streams of the folder's object itself
+		*psPath = CTreeScanner::StreamPath(
+			m_sFolder.c_str(),
+			CTreeScanner::StreamKey(Child(m_aiStreams[iStream]))
+		);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
 }
 
 
-#pragma region CDataObject
+HRESULT CDataObject::CanRender(_In_ const FORMATETC *pFE) const {
+	if (pFE == NULL) return E_POINTER;
+	if (pFE->cfFormat == m_cfShellIDList) {
+		return (pFE->tymed & TYMED_HGLOBAL) ? S_OK : DV_E_TYMED;
+	}
+	if (m_aiStreams.empty()) return DV_E_FORMATETC;
+	if (pFE->cfFormat == m_cfFileDescriptor || pFE->cfFormat == m_cfPreferredDropEffect) {
+		return (pFE->tymed & TYMED_HGLOBAL) ? S_OK : DV_E_TYMED;
+	}
+	if (pFE->cfFormat == m_cfFileContents) {
+		// lindex is which file in the descriptor; -1 only says which when
+		// there's just the one
+		const bool bOne = m_aiStreams.size() == 1 && pFE->lindex == -1;
+		if (!bOne && (pFE->lindex < 0 || static_cast<SIZE_T>(pFE->lindex) >= m_aiStreams.size())) {
+			return DV_E_LINDEX;
+		}
+		return (pFE->tymed & TYMED_ISTREAM) ? S_OK : DV_E_TYMED;
+	}
+	return DV_E_FORMATETC;
+}
+
 
-CDataObject::~CDataObject() {
-	if (m_pidlc != NULL) CoTaskMemFree(m_pidlc);
-	if (m_pidlaParent != NULL) CoTaskMemFree(m_pidlaParent);
+HGLOBAL CDataObject::CreateShellIDList() const {
+	const HGLOBAL hGlobal = GlobalAlloc(GMEM_FIXED | GMEM_SHARE, m_cida.size());
+	if (hGlobal == NULL) return NULL;
+	// Laid out once in Init; every copy is the one memcpy
+	CopyMemory(hGlobal, m_cida.data(), m_cida.size());
+	return hGlobal;
 }
 
-void CDataObject::Init(
-	IUnknown *pUnkOwner,
-	PCIDLIST_ABSOLUTE pidlaParent,
-	PCUITEMID_CHILD pidlc
-) {
-	m_UnkOwnerPtr = pUnkOwner;
-	m_pidlaParent = ILCloneFull(pidlaParent);
-	m_pidlc = ILCloneChild(pidlc);
-	m_cfShellIDList = RegisterClipboardFormat(CFSTR_SHELLIDLIST);
+
+HGLOBAL CDataObject::CreateFileDescriptor() const {
+	const SIZE_T cStreams = m_aiStreams.size();
+	const HGLOBAL hGlobal = GlobalAlloc(
+		GPTR | GMEM_SHARE,
+		sizeof(FILEGROUPDESCRIPTORW) + (cStreams - 1) * sizeof(FILEDESCRIPTORW)
+	);
+	if (hGlobal == NULL) return NULL;
+	const auto pGroup = static_cast<FILEGROUPDESCRIPTORW *>(GlobalLock(hGlobal));
+	if (pGroup == NULL) return hGlobal;
+	defer({ GlobalUnlock(hGlobal); });
+
+	pGroup->cItems = static_cast<UINT>(cStreams);
+	for (SIZE_T i = 0; i < cStreams; i++) {
+		const CItem *pItem = CItem::Get(Child(m_aiStreams[i]));
+		FILEDESCRIPTORW &fd = pGroup->fgd[i];
+		// The sizes up front let the copy show its progress and check for
+		// room before it's read a byte
+		fd.dwFlags = FD_ATTRIBUTES | FD_FILESIZE | FD_PROGRESSUI | FD_UNICODE;
+		fd.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+		fd.nFileSizeHigh = static_cast<DWORD>(static_cast<ULONGLONG>(pItem->llFilesize) >> 32);
+		fd.nFileSizeLow = static_cast<DWORD>(pItem->llFilesize);
+		StreamFileName(pItem, fd.cFileName);
+	}
+	return hGlobal;
 }
 
 #pragma endregion
@@ -91,9 +198,36 @@ STDMETHODIMP CDataObject::GetData(
 	_Out_ LPSTGMEDIUM pStgMedium
 ) {
 	LOG(P_DO << L"GetData()");
-	if (pFE->cfFormat != m_cfShellIDList) return WrapReturn(E_INVALIDARG);
-
-	pStgMedium->hGlobal = CreateShellIDList(m_pidlaParent, m_pidlc);
+	if (pStgMedium == NULL) return WrapReturn(E_POINTER);
+	ZeroMemory(pStgMedium, sizeof(*pStgMedium));
+	HRESULT hr = CanRender(pFE);
+	if (FAILED(hr)) return WrapReturnFailOK(hr);
+
+	if (pFE->cfFormat == m_cfFileContents) {
+		const UINT iStream = pFE->lindex == -1 ? 0 : static_cast<UINT>(pFE->lindex);
+		std::wstring sPath;
+		hr = StreamPath(iStream, &sPath);
+		if (FAILED(hr)) return WrapReturn(hr);
+		// Nothing's opened until the drop target starts reading
+		hr = CStreamContents::Create(
+			sPath.c_str(),
+			CItem::Get(Child(m_aiStreams[iStream]))->llFilesize,
+			&pStgMedium->pstm
+		);
+		if (FAILED(hr)) return WrapReturn(hr);
+		pStgMedium->tymed = TYMED_ISTREAM;
+		return WrapReturn(S_OK);
+	}
+
+	if (pFE->cfFormat == m_cfFileDescriptor) {
+		pStgMedium->hGlobal = CreateFileDescriptor();
+	} else if (pFE->cfFormat == m_cfPreferredDropEffect) {
+		// A copy, not a move: nothing deletes the streams after a drop
+		pStgMedium->hGlobal = GlobalAlloc(GPTR | GMEM_SHARE, sizeof(DWORD));
+		if (pStgMedium->hGlobal != NULL) *static_cast<DWORD *>(pStgMedium->hGlobal) = DROPEFFECT_COPY;
+	} else {
+		pStgMedium->hGlobal = CreateShellIDList();
+	}
 	if (pStgMedium->hGlobal == NULL) return WrapReturn(E_OUTOFMEMORY);
 
 	pStgMedium->tymed = TYMED_HGLOBAL;
@@ -108,9 +242,9 @@ STDMETHODIMP CDataObject::GetDataHere(LPFORMATETC, LPSTGMEDIUM) {
 	return WrapReturnFailOK(E_NOTIMPL);
 }
 
-STDMETHODIMP CDataObject::QueryGetData(LPFORMATETC) {
+STDMETHODIMP CDataObject::QueryGetData(LPFORMATETC pFE) {
 	LOG(P_DO << L"QueryGetData()");
-	return WrapReturnFailOK(E_NOTIMPL);
+	return WrapReturnFailOK(CanRender(pFE));
 }
 
 STDMETHODIMP CDataObject::GetCanonicalFormatEtc(LPFORMATETC, LPFORMATETC) {
@@ -123,9 +257,23 @@ STDMETHODIMP CDataObject::SetData(LPFORMATETC, LPSTGMEDIUM, BOOL) {
 	return WrapReturnFailOK(E_NOTIMPL);
 }
 
-STDMETHODIMP CDataObject::EnumFormatEtc(DWORD, IEnumFORMATETC**) {
+STDMETHODIMP CDataObject::EnumFormatEtc(DWORD dwDirection, IEnumFORMATETC **ppEnum) {
 	LOG(P_DO << L"EnumFormatEtc()");
-	return WrapReturnFailOK(E_NOTIMPL);
+	if (ppEnum == NULL) return WrapReturn(E_POINTER);
+	*ppEnum = NULL;
+	if (dwDirection != DATADIR_GET) return WrapReturnFailOK(E_NOTIMPL);
+
+	// Best first: a drop target takes the first one it understands, and
+	// the virtual file is what an ordinary folder can do something with
+	const FORMATETC aFormats[] = {
+		{static_cast<CLIPFORMAT>(m_cfFileDescriptor), NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL},
+		{static_cast<CLIPFORMAT>(m_cfFileContents), NULL, DVASPECT_CONTENT, 0, TYMED_ISTREAM},
+		{static_cast<CLIPFORMAT>(m_cfPreferredDropEffect), NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL},
+		{static_cast<CLIPFORMAT>(m_cfShellIDList), NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL},
+	};
+	// Just the ID list if none of them are streams
+	const UINT iFirst = m_aiStreams.empty() ? _countof(aFormats) - 1 : 0;
+	return WrapReturn(SHCreateStdEnumFmtEtc(_countof(aFormats) - iFirst, aFormats + iFirst, ppEnum));
 }
 
 STDMETHODIMP CDataObject::DAdvise(LPFORMATETC, DWORD, IAdviseSink*, LPDWORD) {
@@ -6,20 +6,50 @@
 
 #include "pch.h"  // Precompiled header; include first
 
+#include <string>
+#include <vector>
+
 namespace ADSX {
 
+struct CItem;
+
+/**
+ * What a stream is called once it's a file of its own: its name (and the
+ * path to it, in the tree pseudofolder) with anything a file name can't have
+ * replaced. "sub\file.txt:name" -> "sub\file.txt_name"; whatever writes it
+ * makes the folders on the way.
+ */
+void StreamFileName(_In_ const CItem *pItem, _Out_writes_(MAX_PATH) PWSTR pszFileName);
+
+/**
+ * Lay out a CFSTR_SHELLIDLIST (a CIDA) of cidl children of pidlaParent:
+ * the offsets, then the parent, then each child's one item. It's sized
+ * first, so however many children there are it's the one allocation.
+ * @post: on failure *pcida is unspecified.
+ */
+HRESULT LayOutShellIDList(
+	_In_                PCIDLIST_ABSOLUTE     pidlaParent,
+	_In_                UINT                  cidl,
+	_In_reads_(cidl)    PCUITEMID_CHILD_ARRAY aPidls,
+	_Out_               std::vector<BYTE>     *pcida
+);
+
 //==============================================================================
 // Light implementation of IDataObject.
 //
 // This object is used when you double-click an item in the FileDialog.
 // Its purpose is simply to wrap the PIDL of an Item of ours into the
 // IDataObject, so that the FileDialog can pass it further to our
-// IShellFolder::BindToObject(). Because I'm only interested in FileDialog's
-// behaviour, every method returns E_NOTIMPL except GetData() (Pascal Hurni).
+// IShellFolder::BindToObject() (Pascal Hurni).
 // https://www.codeproject.com/Articles/7973/An-almost-complete-Namespace-Extension-Sample#HowItsDone_UseCasesFileDialog_ClickIcon
+//
+// A stream also goes out as a virtual file, CFSTR_FILEDESCRIPTOR and
+// CFSTR_FILECONTENTS, so it can be dragged or pasted into an ordinary folder.
+// Its contents are only read when the drop target asks for them, straight
+// from the stream (StreamContents.h).
 
 class ATL_NO_VTABLE CDataObject
-	: public CComObjectRootEx<CComSingleThreadModel>,
+	: public CComObjectRootEx<CComMultiThreadModel>,
 	  public IDataObject,
 	  public IEnumFORMATETC {
    public:
@@ -30,15 +60,18 @@ class ATL_NO_VTABLE CDataObject
 
 	//--------------------------------------------------------------------------
 
-	~CDataObject();
-
 	// Ensure the owner object is not freed before this one and populate the
-	// object with the Favorite Item pidl.
+	// object with the selected items' pidls.
 	// This member must be called before any IDataObject member (Pascal Hurni).
-	void Init(
-		IUnknown*         pUnkOwner,
-		PCIDLIST_ABSOLUTE pidlaParent,
-		PCUITEMID_CHILD   pidlc
+	// Nothing changes after this, so the rest is safe from any thread.
+	// pszFolder is the filesystem path of the folder the items are streams
+	// in; NULL if their contents can't be offered.
+	HRESULT Init(
+		IUnknown*             pUnkOwner,
+		PCIDLIST_ABSOLUTE     pidlaParent,
+		UINT                  cidl,
+		PCUITEMID_CHILD_ARRAY aPidls,
+		PCWSTR                pszFolder
 	);
 
 	//--------------------------------------------------------------------------
@@ -64,12 +97,33 @@ class ATL_NO_VTABLE CDataObject
 	STDMETHOD(Clone)(LPENUMFORMATETC*);
 
    protected:
+	// Whether GetData would render pFE, and if not, why.
+	HRESULT CanRender(_In_ const FORMATETC *pFE) const;
+
+	// The i'th selected item, as it is in m_cida
+	PCUITEMID_CHILD Child(_In_ UINT i) const;
+	// "C:\dir\file.txt:name" for the iStream'th file in the descriptor
+	HRESULT StreamPath(_In_ UINT iStream, _Out_ std::wstring *psPath) const;
+
+	HGLOBAL CreateShellIDList() const;
+	// CFSTR_FILEDESCRIPTORW with a file for each stream
+	HGLOBAL CreateFileDescriptor() const;
+
 	CComPtr<IUnknown> m_UnkOwnerPtr;
 
 	UINT m_cfShellIDList;
+	UINT m_cfFileDescriptor;
+	UINT m_cfFileContents;
+	UINT m_cfPreferredDropEffect;
+
+	// The CFSTR_SHELLIDLIST, which is also where the items are kept
+	std::vector<BYTE> m_cida;
 
-	PUITEMID_CHILD m_pidlc;
-	PIDLIST_ABSOLUTE m_pidlaParent;
+	// Where the streams are; empty if nothing said
+	std::wstring m_sFolder;
+	// Which of the items are streams, in the order they're in the file
+	// descriptor. The rest are pseudofolders.
+	std::vector<UINT> m_aiStreams;
 };
 
 }  // namespace ADSX
@@ -0,0 +1,254 @@
+/**
+ * 2024 Nate Kean
+ *
+ * How many requests one device gets at once. A spinning disk seeks itself to
+ * a standstill with more than a couple in flight, an NVMe drive wants dozens,
+ * and a network link is best kept from filling up. Background work (scans)
+ * waits behind foreground work (what the user is looking at): whoever asked
+ * for the view goes ahead of every scan request still waiting, and scans
+ * leave a slot free for them.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace ADSX {
+
+
+enum class IoPriority {
+	Foreground,  // someone's waiting on it
+	Background,  // a scan; can wait its turn
+};
+
+
+class CDeviceQueue {
+  public:
+	using Clock = std::chrono::steady_clock;
+
+	// Latency histogram buckets: under 1 << i microseconds, the last one
+	// everything slower than 2 s
+	static constexpr std::size_t cLatencyBuckets = 22;
+
+	struct PriorityStats {
+		std::uint64_t cCompleted;
+		std::uint64_t cWaiting;
+		std::uint64_t ullWaitUs;     // in the queue, all told
+		std::uint64_t ullServiceUs;  // holding a slot, all told
+		std::uint64_t ullMaxWaitUs;
+		std::uint64_t acServiceUs[cLatencyBuckets];
+
+		double AverageWaitMs() const { return cCompleted ? ullWaitUs / 1000.0 / cCompleted : 0; }
+		double AverageServiceMs() const { return cCompleted ? ullServiceUs / 1000.0 / cCompleted : 0; }
+		// Service time that fraction of requests came in under, to the
+		// histogram's precision
+		double ServicePercentileMs(double dFraction) const {
+			std::uint64_t cSeen = 0;
+			for (std::size_t i = 0; i < cLatencyBuckets; i++) {
+				cSeen += acServiceUs[i];
+				if (cSeen > 0 && cSeen >= dFraction * cCompleted) return (1ull << i) / 1000.0;
+			}
+			return 0;
+		}
+	};
+
+	struct Stats {
+		unsigned cLimit;
+		unsigned cInFlight;
+		unsigned cMaxQueueDepth;  // waiting and in flight, at the most
+		std::uint64_t cPreempted;  // times a background request was passed over for a foreground one
+		PriorityStats foreground;
+		PriorityStats background;
+	};
+
+	/**
+	 * A slot on the device, held until it's destroyed. Move-only.
+	 * A default-constructed ticket (or one whose wait was cancelled) holds
+	 * nothing.
+	 */
+	class CTicket {
+	  public:
+		CTicket() : m_pQueue(nullptr), m_priority(IoPriority::Background) {}
+		CTicket(CTicket &&other) noexcept { Steal(other); }
+		CTicket &operator=(CTicket &&other) noexcept {
+			if (this != &other) {
+				Reset();
+				Steal(other);
+			}
+			return *this;
+		}
+		CTicket(const CTicket &) = delete;
+		CTicket &operator=(const CTicket &) = delete;
+		~CTicket() { Reset(); }
+
+		explicit operator bool() const { return m_pQueue != nullptr; }
+
+		// Give the slot back now instead of at the end of the scope.
+		void Reset() {
+			if (m_pQueue == nullptr) return;
+			m_pQueue->Release(m_priority, m_tAdmitted);
+			m_pQueue = nullptr;
+		}
+
+	  private:
+		friend class CDeviceQueue;
+		CTicket(CDeviceQueue *pQueue, IoPriority priority, Clock::time_point tAdmitted)
+			: m_pQueue(pQueue)
+			, m_priority(priority)
+			, m_tAdmitted(tAdmitted) {}
+
+		void Steal(CTicket &other) {
+			m_pQueue = other.m_pQueue;
+			m_priority = other.m_priority;
+			m_tAdmitted = other.m_tAdmitted;
+			other.m_pQueue = nullptr;
+		}
+
+		CDeviceQueue *m_pQueue;
+		IoPriority m_priority;
+		Clock::time_point m_tAdmitted;
+	};
+
+	// How often a cancellable wait looks at its flag
+	static constexpr std::chrono::milliseconds msCancelPoll{50};
+
+	explicit CDeviceQueue(unsigned cLimit)
+		: m_cLimit(cLimit > 0 ? cLimit : 1)
+		, m_cInFlight(0)
+		, m_cInFlightBackground(0)
+		, m_cWaitingForeground(0)
+		, m_cWaitingBackground(0)
+		, m_cMaxQueueDepth(0)
+		, m_cPreempted(0)
+		, m_foreground()
+		, m_background() {}
+
+	/**
+	 * Wait for a slot.
+	 * @pre: the queue outlives the ticket.
+	 * @post: returns an empty ticket if *pbCancel became true first.
+	 */
+	CTicket Acquire(IoPriority priority, const std::atomic<bool> *pbCancel = nullptr) {
+		const Clock::time_point tQueued = Clock::now();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const bool bForeground = priority == IoPriority::Foreground;
+		(bForeground ? m_cWaitingForeground : m_cWaitingBackground)++;
+		NoteDepth();
+
+		while (!CanAdmit(priority)) {
+			if (pbCancel == nullptr) {
+				m_cvFree.wait(lock);
+			} else {
+				if (pbCancel->load(std::memory_order_relaxed)) {
+					(bForeground ? m_cWaitingForeground : m_cWaitingBackground)--;
+					// Whoever it was holding up can go now
+					m_cvFree.notify_all();
+					return CTicket();
+				}
+				m_cvFree.wait_for(lock, msCancelPoll);
+			}
+		}
+
+		(bForeground ? m_cWaitingForeground : m_cWaitingBackground)--;
+		m_cInFlight++;
+		if (bForeground) {
+			// Went ahead of every scan request still waiting
+			m_cPreempted += m_cWaitingBackground;
+		} else {
+			m_cInFlightBackground++;
+		}
+		const Clock::time_point tAdmitted = Clock::now();
+		const std::uint64_t ullWaitUs = Microseconds(tAdmitted - tQueued);
+		PriorityStats &stats = bForeground ? m_foreground : m_background;
+		stats.ullWaitUs += ullWaitUs;
+		if (ullWaitUs > stats.ullMaxWaitUs) stats.ullMaxWaitUs = ullWaitUs;
+		return CTicket(this, priority, tAdmitted);
+	}
+
+	// Change how many requests the device gets at once. Ones already in
+	// flight carry on.
+	void SetLimit(unsigned cLimit) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cLimit = cLimit > 0 ? cLimit : 1;
+		}
+		m_cvFree.notify_all();
+	}
+
+	Stats GetStats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Stats stats;
+		stats.cLimit = m_cLimit;
+		stats.cInFlight = m_cInFlight;
+		stats.cMaxQueueDepth = m_cMaxQueueDepth;
+		stats.cPreempted = m_cPreempted;
+		stats.foreground = m_foreground;
+		stats.foreground.cWaiting = m_cWaitingForeground;
+		stats.background = m_background;
+		stats.background.cWaiting = m_cWaitingBackground;
+		return stats;
+	}
+
+  private:
+	// @pre: m_mutex is held.
+	bool CanAdmit(IoPriority priority) const {
+		if (m_cInFlight >= m_cLimit) return false;
+		if (priority == IoPriority::Foreground) return true;
+		// Behind anyone in the foreground, and leaving them a slot so they
+		// don't have to wait for a scan request to finish first
+		const unsigned cBackgroundMax = m_cLimit > 1 ? m_cLimit - 1 : 1;
+		return m_cWaitingForeground == 0 && m_cInFlightBackground < cBackgroundMax;
+	}
+
+	void Release(IoPriority priority, Clock::time_point tAdmitted) {
+		const std::uint64_t ullServiceUs = Microseconds(Clock::now() - tAdmitted);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cInFlight--;
+			PriorityStats &stats = priority == IoPriority::Foreground ? m_foreground : m_background;
+			if (priority == IoPriority::Background) m_cInFlightBackground--;
+			stats.cCompleted++;
+			stats.ullServiceUs += ullServiceUs;
+			stats.acServiceUs[Bucket(ullServiceUs)]++;
+		}
+		// Everyone, since the next in line depends on priority
+		m_cvFree.notify_all();
+	}
+
+	// @pre: m_mutex is held.
+	void NoteDepth() {
+		const unsigned cDepth = m_cInFlight + m_cWaitingForeground + m_cWaitingBackground;
+		if (cDepth > m_cMaxQueueDepth) m_cMaxQueueDepth = cDepth;
+	}
+
+	static std::uint64_t Microseconds(Clock::duration duration) {
+		return static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(duration).count()
+		);
+	}
+
+	static std::size_t Bucket(std::uint64_t ullUs) {
+		std::size_t i = 0;
+		while (i < cLatencyBuckets - 1 && ullUs >= (1ull << i)) i++;
+		return i;
+	}
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cvFree;
+	unsigned m_cLimit;
+	unsigned m_cInFlight;
+	unsigned m_cInFlightBackground;
+	unsigned m_cWaitingForeground;
+	unsigned m_cWaitingBackground;
+	unsigned m_cMaxQueueDepth;
+	std::uint64_t m_cPreempted;
+	PriorityStats m_foreground;
+	PriorityStats m_background;
+};
+
+}  // namespace ADSX
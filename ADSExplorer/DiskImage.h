@@ -0,0 +1,693 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Read-only access to the disk inside an image file, so streams on a machine
+ * that was imaged can be looked at without mounting anything: raw images
+ * (dd and the like), fixed and dynamic VHD, and VHDX. Differencing disks,
+ * which need their parents, aren't supported, and neither are VHDX files with
+ * a log that still needs replaying, which only happens if whoever had it open
+ * didn't close it.
+ *
+ * Also finds the partitions on such a disk, MBR or GPT, to hand one to the
+ * MFT reader, and CImage puts it all together.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "BlockCache.h"
+#include "ByteSource.h"
+#include "Crc32c.h"
+
+namespace ADSX::Disk {
+
+
+template <typename T>
+inline T LoadBigEndian(const unsigned char *pb) {
+	T t = 0;
+	for (std::size_t i = 0; i < sizeof(T); i++) t = static_cast<T>(t << 8 | pb[i]);
+	return t;
+}
+
+template <typename T>
+inline T LoadLittleEndian(const unsigned char *pb) {
+	T t;
+	std::memcpy(&t, pb, sizeof(T));
+	return t;
+}
+
+
+// VHDX checksums its headers with CRC-32C
+using ADSX::Crc32c;
+
+
+// -----------------------------------------------------------------------------
+// VHD: a 512-byte footer at the end, all fields big-endian. A fixed disk is
+// the raw disk followed by the footer. A dynamic one has a copy of the footer
+// at the start, then a header pointing to a Block Allocation Table (BAT) that
+// says where in the file each block of the disk is, if anywhere; each block
+// in the file is a sector bitmap followed by the block's data.
+//   char    Cookie[8];             // "conectix"
+//   UINT64  DataOffset;            // at 0x10; the dynamic header
+//   UINT64  CurrentSize;           // at 0x30
+//   UINT32  DiskType;              // at 0x3C
+//   UINT32  Checksum;              // at 0x40
+// Dynamic header:
+//   char    Cookie[8];             // "cxsparse"
+//   UINT64  TableOffset;           // at 0x10
+//   UINT32  MaxTableEntries;       // at 0x1C
+//   UINT32  BlockSize;             // at 0x20
+namespace Vhd {
+constexpr std::size_t cbFooter = 512;
+constexpr std::size_t cbOffDataOffset = 0x10;
+constexpr std::size_t cbOffCurrentSize = 0x30;
+constexpr std::size_t cbOffDiskType = 0x3C;
+constexpr std::size_t cbOffChecksum = 0x40;
+constexpr std::uint32_t DISK_FIXED = 2;
+constexpr std::uint32_t DISK_DYNAMIC = 3;
+constexpr std::uint32_t DISK_DIFFERENCING = 4;
+
+constexpr std::size_t cbDynamicHeader = 1024;
+constexpr std::size_t cbOffTableOffset = 0x10;
+constexpr std::size_t cbOffMaxTableEntries = 0x1C;
+constexpr std::size_t cbOffBlockSize = 0x20;
+constexpr std::size_t cbOffHeaderChecksum = 0x24;
+constexpr std::uint32_t uUnallocated = 0xFFFFFFFF;
+constexpr std::size_t cbSector = 512;
+
+// One's complement of the sum of the bytes, skipping the checksum itself
+inline std::uint32_t Checksum(const unsigned char *pb, std::size_t cb, std::size_t ibChecksum) {
+	std::uint32_t uSum = 0;
+	for (std::size_t i = 0; i < cb; i++) {
+		if (i >= ibChecksum && i < ibChecksum + 4) continue;
+		uSum += pb[i];
+	}
+	return ~uSum;
+}
+}  // namespace Vhd
+
+
+class CVhdImage : public CByteSource {
+  public:
+	// @pre: file outlives the image.
+	explicit CVhdImage(CByteSource &file)
+		: m_file(file)
+		, m_cbDisk(0)
+		, m_bDynamic(false)
+		, m_cbBlock(0)
+		, m_cbBitmap(0) {}
+
+	/**
+	 * Read the footer and, if it's dynamic, the BAT.
+	 * @post: returns false if it isn't a VHD, or is a differencing one.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Open() {
+		using namespace Vhd;
+		const std::uint64_t cbFile = m_file.Size();
+		if (cbFile < cbFooter) return false;
+		unsigned char abFooter[cbFooter];
+		if (!m_file.Read(cbFile - cbFooter, abFooter, cbFooter)) return false;
+		if (std::memcmp(abFooter, "conectix", 8) != 0) return false;
+		if (LoadBigEndian<std::uint32_t>(abFooter + cbOffChecksum) != Checksum(abFooter, cbFooter, cbOffChecksum)) {
+			return false;
+		}
+		m_cbDisk = LoadBigEndian<std::uint64_t>(abFooter + cbOffCurrentSize);
+		const std::uint32_t uDiskType = LoadBigEndian<std::uint32_t>(abFooter + cbOffDiskType);
+		if (uDiskType == DISK_FIXED) {
+			m_bDynamic = false;
+			return m_cbDisk <= cbFile - cbFooter;
+		}
+		if (uDiskType != DISK_DYNAMIC) return false;
+		m_bDynamic = true;
+
+		unsigned char abHeader[cbDynamicHeader];
+		const std::uint64_t ibHeader = LoadBigEndian<std::uint64_t>(abFooter + cbOffDataOffset);
+		if (!m_file.Read(ibHeader, abHeader, cbDynamicHeader)) return false;
+		if (std::memcmp(abHeader, "cxsparse", 8) != 0) return false;
+		if (
+			LoadBigEndian<std::uint32_t>(abHeader + cbOffHeaderChecksum) !=
+			Checksum(abHeader, cbDynamicHeader, cbOffHeaderChecksum)
+		) {
+			return false;
+		}
+		m_cbBlock = LoadBigEndian<std::uint32_t>(abHeader + cbOffBlockSize);
+		if (m_cbBlock < cbSector || m_cbBlock % cbSector != 0) return false;
+		// A bit per sector, padded to whole sectors
+		m_cbBitmap = (m_cbBlock / cbSector / 8 + cbSector - 1) / cbSector * cbSector;
+
+		const std::uint32_t cEntries = LoadBigEndian<std::uint32_t>(abHeader + cbOffMaxTableEntries);
+		if (static_cast<std::uint64_t>(cEntries) * m_cbBlock < m_cbDisk) return false;
+		std::vector<unsigned char> bat(static_cast<std::size_t>(cEntries) * 4);
+		const std::uint64_t ibTable = LoadBigEndian<std::uint64_t>(abHeader + cbOffTableOffset);
+		if (!m_file.Read(ibTable, bat.data(), bat.size())) return false;
+		m_aBlockSector.resize(cEntries);
+		for (std::uint32_t i = 0; i < cEntries; i++) {
+			m_aBlockSector[i] = LoadBigEndian<std::uint32_t>(&bat[i * 4]);
+		}
+		return true;
+	}
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override {
+		if (ibOffset > m_cbDisk || cb > m_cbDisk - ibOffset) return false;
+		if (!m_bDynamic) return m_file.Read(ibOffset, pb, cb);
+
+		auto pbOut = static_cast<unsigned char *>(pb);
+		while (cb > 0) {
+			const std::uint64_t iBlock = ibOffset / m_cbBlock;
+			const std::uint64_t ibInBlock = ibOffset % m_cbBlock;
+			const std::size_t cbHere = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cb, m_cbBlock - ibInBlock)
+			);
+			const std::uint32_t uSector = m_aBlockSector[static_cast<std::size_t>(iBlock)];
+			// Never written: zeros. Sectors in an allocated block that the
+			// bitmap says were never written are zeros in the file too.
+			if (uSector == Vhd::uUnallocated) {
+				std::memset(pbOut, 0, cbHere);
+			} else {
+				const std::uint64_t ibData =
+					static_cast<std::uint64_t>(uSector) * Vhd::cbSector + m_cbBitmap + ibInBlock;
+				if (!m_file.Read(ibData, pbOut, cbHere)) return false;
+			}
+			pbOut += cbHere;
+			ibOffset += cbHere;
+			cb -= cbHere;
+		}
+		return true;
+	}
+
+	std::uint64_t Size() const override { return m_cbDisk; }
+	bool IsDynamic() const { return m_bDynamic; }
+
+  private:
+	CByteSource &m_file;
+	std::uint64_t m_cbDisk;
+	bool m_bDynamic;
+	std::uint32_t m_cbBlock;
+	std::uint32_t m_cbBitmap;
+	std::vector<std::uint32_t> m_aBlockSector;  // Vhd::uUnallocated if none
+};
+
+
+// -----------------------------------------------------------------------------
+// VHDX: all fields little-endian.
+//   at 0:       "vhdxfile"
+//   at 64 KB:   header, and at 128 KB another; the valid one with the higher
+//               SequenceNumber is current
+//   at 192 KB:  region table (and a copy at 256 KB), which says where the BAT
+//               and the metadata region are
+// Header:
+//   char    Signature[4];          // "head"
+//   UINT32  Checksum;              // at 0x04; CRC-32C of the 4 KB header
+//   UINT64  SequenceNumber;        // at 0x08
+//   GUID    LogGuid;               // at 0x30; zero unless the log needs replay
+//   UINT16  Version;               // at 0x42; 1
+// Region table header, then entries of 32 bytes:
+//   char    Signature[4];          // "regi"
+//   UINT32  Checksum;              // at 0x04; CRC-32C of the 64 KB table
+//   UINT32  EntryCount;            // at 0x08
+//   entry:  GUID Guid; UINT64 FileOffset; UINT32 Length; UINT32 Required;
+// Metadata table header, then entries of 32 bytes:
+//   char    Signature[8];          // "metadata"
+//   UINT16  EntryCount;            // at 0x0A
+//   entry:  GUID ItemId; UINT32 Offset; UINT32 Length; UINT32 Flags;
+// BAT entries are 64 bits: the state in the low 3, the offset in the file in
+// MB from bit 20. After every ChunkRatio payload blocks' entries comes one
+// for a sector bitmap block, which only differencing disks use.
+namespace Vhdx {
+constexpr std::uint64_t ibHeader1 = 64 * 1024;
+constexpr std::uint64_t ibHeader2 = 128 * 1024;
+constexpr std::uint64_t ibRegionTable = 192 * 1024;
+constexpr std::uint64_t ibRegionTable2 = 256 * 1024;
+constexpr std::size_t cbHeader = 4 * 1024;
+constexpr std::size_t cbRegionTable = 64 * 1024;
+constexpr std::size_t cbOffChecksum = 0x04;
+constexpr std::size_t cbOffSequenceNumber = 0x08;
+constexpr std::size_t cbOffLogGuid = 0x30;
+constexpr std::size_t cbOffVersion = 0x42;
+constexpr std::size_t cbOffRegionCount = 0x08;
+constexpr std::size_t cbRegionTableHeader = 16;
+constexpr std::size_t cbRegionEntry = 32;
+constexpr std::size_t cbOffMetadataCount = 0x0A;
+constexpr std::size_t cbMetadataTableHeader = 32;
+constexpr std::size_t cbMetadataEntry = 32;
+constexpr std::size_t cbMetadataTable = 64 * 1024;
+constexpr std::uint32_t METADATA_REQUIRED = 0x4;
+constexpr std::uint32_t FILE_HAS_PARENT = 0x2;
+constexpr std::uint64_t cbMB = 1024 * 1024;
+
+enum BlockState : std::uint64_t {
+	PAYLOAD_NOT_PRESENT = 0,
+	PAYLOAD_UNDEFINED = 1,
+	PAYLOAD_ZERO = 2,
+	PAYLOAD_UNMAPPED = 3,
+	PAYLOAD_FULLY_PRESENT = 6,
+	PAYLOAD_PARTIALLY_PRESENT = 7,
+};
+
+// GUIDs as they're laid out on disk: the first three fields little-endian
+struct Guid {
+	unsigned char ab[16];
+	bool operator==(const unsigned char *pb) const { return std::memcmp(ab, pb, 16) == 0; }
+};
+constexpr Guid guidBat = {{
+	0x66, 0x77, 0xC2, 0x2D, 0x23, 0xF6, 0x00, 0x42,
+	0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08,
+}};
+constexpr Guid guidMetadata = {{
+	0x06, 0xA2, 0x7C, 0x8B, 0x90, 0x47, 0x9A, 0x4B,
+	0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E,
+}};
+constexpr Guid guidFileParameters = {{
+	0x37, 0x67, 0xA1, 0xCA, 0x36, 0xFA, 0x43, 0x4D,
+	0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B,
+}};
+constexpr Guid guidVirtualDiskSize = {{
+	0x24, 0x42, 0xA5, 0x2F, 0x1B, 0xCD, 0x76, 0x48,
+	0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8,
+}};
+constexpr Guid guidLogicalSectorSize = {{
+	0x1D, 0xBF, 0x41, 0x81, 0x6F, 0xA9, 0x09, 0x47,
+	0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F,
+}};
+// Required, but only about how the disk presents itself, not where its
+// bytes are
+constexpr Guid guidPhysicalSectorSize = {{
+	0xC7, 0x48, 0xA3, 0xCD, 0x5D, 0x44, 0x71, 0x44,
+	0x9C, 0xC9, 0xE9, 0x88, 0x52, 0x51, 0xC5, 0x56,
+}};
+constexpr Guid guidPage83Data = {{
+	0xAB, 0x12, 0xCA, 0xBE, 0xE6, 0xB2, 0x23, 0x45,
+	0x93, 0xEF, 0xC3, 0x09, 0xE0, 0x00, 0xC7, 0x46,
+}};
+}  // namespace Vhdx
+
+
+class CVhdxImage : public CByteSource {
+  public:
+	// @pre: file outlives the image.
+	explicit CVhdxImage(CByteSource &file)
+		: m_file(file)
+		, m_cbDisk(0)
+		, m_cbBlock(0)
+		, m_cChunkRatio(0) {}
+
+	/**
+	 * Read the headers, region table, metadata and BAT.
+	 * @post: returns false if it isn't a VHDX, is a differencing one, has a
+	 *        log to replay, or needs something else this doesn't know about.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Open() {
+		using namespace Vhdx;
+		unsigned char abSignature[8];
+		if (!m_file.Read(0, abSignature, 8) || std::memcmp(abSignature, "vhdxfile", 8) != 0) {
+			return false;
+		}
+
+		// The current header
+		std::vector<unsigned char> header(cbHeader);
+		std::vector<unsigned char> candidate(cbHeader);
+		bool bFound = false;
+		std::uint64_t ullSequence = 0;
+		for (const std::uint64_t ib : {ibHeader1, ibHeader2}) {
+			if (!m_file.Read(ib, candidate.data(), cbHeader)) continue;
+			if (std::memcmp(candidate.data(), "head", 4) != 0) continue;
+			if (!ChecksumMatches(candidate.data(), cbHeader)) continue;
+			const auto ullCandidate = LoadLittleEndian<std::uint64_t>(&candidate[cbOffSequenceNumber]);
+			if (!bFound || ullCandidate > ullSequence) {
+				header.swap(candidate);
+				ullSequence = ullCandidate;
+				bFound = true;
+			}
+		}
+		if (!bFound) return false;
+		if (LoadLittleEndian<std::uint16_t>(&header[cbOffVersion]) != 1) return false;
+		static const unsigned char abZero[16] = {};
+		if (std::memcmp(&header[cbOffLogGuid], abZero, 16) != 0) return false;
+
+		// Where the BAT and metadata are; either copy of the table will do
+		std::vector<unsigned char> table(cbRegionTable);
+		bool bTable = false;
+		for (const std::uint64_t ib : {ibRegionTable, ibRegionTable2}) {
+			if (!m_file.Read(ib, table.data(), cbRegionTable)) continue;
+			if (std::memcmp(table.data(), "regi", 4) != 0) continue;
+			if (!ChecksumMatches(table.data(), cbRegionTable)) continue;
+			bTable = true;
+			break;
+		}
+		if (!bTable) return false;
+		const std::uint32_t cRegions = LoadLittleEndian<std::uint32_t>(&table[cbOffRegionCount]);
+		if (cRegions > (cbRegionTable - cbRegionTableHeader) / cbRegionEntry) return false;
+		std::uint64_t ibBat = 0, ibMetadata = 0;
+		std::uint32_t cbBat = 0, cbMetadata = 0;
+		for (std::uint32_t i = 0; i < cRegions; i++) {
+			const unsigned char *pbEntry = &table[cbRegionTableHeader + i * cbRegionEntry];
+			const auto ibRegion = LoadLittleEndian<std::uint64_t>(pbEntry + 16);
+			const auto cbRegion = LoadLittleEndian<std::uint32_t>(pbEntry + 24);
+			const auto bRequired = LoadLittleEndian<std::uint32_t>(pbEntry + 28) & 1;
+			if (guidBat == pbEntry) {
+				ibBat = ibRegion;
+				cbBat = cbRegion;
+			} else if (guidMetadata == pbEntry) {
+				ibMetadata = ibRegion;
+				cbMetadata = cbRegion;
+			} else if (bRequired) {
+				return false;
+			}
+		}
+		if (cbBat == 0 || cbMetadata < cbMetadataTable) return false;
+
+		if (!ReadMetadata(ibMetadata, cbMetadata)) return false;
+
+		// Payload blocks' entries, skipping the sector bitmaps'
+		const std::uint64_t cBlocks = (m_cbDisk + m_cbBlock - 1) / m_cbBlock;
+		const std::uint64_t cEntries = cBlocks + (cBlocks - 1) / m_cChunkRatio;
+		if (cEntries * 8 > cbBat) return false;
+		std::vector<unsigned char> bat(static_cast<std::size_t>(cEntries * 8));
+		if (!m_file.Read(ibBat, bat.data(), bat.size())) return false;
+		m_aBlockEntry.resize(static_cast<std::size_t>(cBlocks));
+		for (std::uint64_t i = 0; i < cBlocks; i++) {
+			const std::uint64_t iEntry = i + i / m_cChunkRatio;
+			m_aBlockEntry[static_cast<std::size_t>(i)] =
+				LoadLittleEndian<std::uint64_t>(&bat[static_cast<std::size_t>(iEntry * 8)]);
+		}
+		return true;
+	}
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override {
+		using namespace Vhdx;
+		if (ibOffset > m_cbDisk || cb > m_cbDisk - ibOffset) return false;
+		auto pbOut = static_cast<unsigned char *>(pb);
+		while (cb > 0) {
+			const std::uint64_t iBlock = ibOffset / m_cbBlock;
+			const std::uint64_t ibInBlock = ibOffset % m_cbBlock;
+			const std::size_t cbHere = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cb, m_cbBlock - ibInBlock)
+			);
+			const std::uint64_t ullEntry = m_aBlockEntry[static_cast<std::size_t>(iBlock)];
+			switch (ullEntry & 7) {
+				case PAYLOAD_NOT_PRESENT:
+				case PAYLOAD_UNDEFINED:
+				case PAYLOAD_ZERO:
+				case PAYLOAD_UNMAPPED:
+					std::memset(pbOut, 0, cbHere);
+					break;
+				case PAYLOAD_FULLY_PRESENT: {
+					const std::uint64_t ibData = (ullEntry >> 20) * cbMB + ibInBlock;
+					if (!m_file.Read(ibData, pbOut, cbHere)) return false;
+					break;
+				}
+				default:
+					// Partly present only happens in a differencing disk
+					return false;
+			}
+			pbOut += cbHere;
+			ibOffset += cbHere;
+			cb -= cbHere;
+		}
+		return true;
+	}
+
+	std::uint64_t Size() const override { return m_cbDisk; }
+
+  private:
+	static bool ChecksumMatches(unsigned char *pb, std::size_t cb) {
+		const auto uStored = LoadLittleEndian<std::uint32_t>(pb + Vhdx::cbOffChecksum);
+		std::memset(pb + Vhdx::cbOffChecksum, 0, 4);
+		const bool bMatches = Crc32c(pb, cb) == uStored;
+		std::memcpy(pb + Vhdx::cbOffChecksum, &uStored, 4);
+		return bMatches;
+	}
+
+	bool ReadMetadata(std::uint64_t ibMetadata, std::uint32_t cbMetadata) {
+		using namespace Vhdx;
+		std::vector<unsigned char> metadata(cbMetadata);
+		if (!m_file.Read(ibMetadata, metadata.data(), cbMetadata)) return false;
+		if (std::memcmp(metadata.data(), "metadata", 8) != 0) return false;
+		const std::uint16_t cItems = LoadLittleEndian<std::uint16_t>(&metadata[cbOffMetadataCount]);
+		if (cItems > (cbMetadataTable - cbMetadataTableHeader) / cbMetadataEntry) return false;
+
+		std::uint32_t cbLogicalSector = 0;
+		bool bFileParameters = false;
+		for (std::uint16_t i = 0; i < cItems; i++) {
+			const unsigned char *pbEntry = &metadata[cbMetadataTableHeader + i * cbMetadataEntry];
+			const auto ibItem = LoadLittleEndian<std::uint32_t>(pbEntry + 16);
+			const auto cbItem = LoadLittleEndian<std::uint32_t>(pbEntry + 20);
+			const auto uFlags = LoadLittleEndian<std::uint32_t>(pbEntry + 24);
+			if (ibItem > cbMetadata || cbItem > cbMetadata - ibItem) return false;
+			const unsigned char *pbItem = &metadata[ibItem];
+			if (guidFileParameters == pbEntry) {
+				if (cbItem < 8) return false;
+				m_cbBlock = LoadLittleEndian<std::uint32_t>(pbItem);
+				if (LoadLittleEndian<std::uint32_t>(pbItem + 4) & FILE_HAS_PARENT) return false;
+				bFileParameters = true;
+			} else if (guidVirtualDiskSize == pbEntry) {
+				if (cbItem < 8) return false;
+				m_cbDisk = LoadLittleEndian<std::uint64_t>(pbItem);
+			} else if (guidLogicalSectorSize == pbEntry) {
+				if (cbItem < 4) return false;
+				cbLogicalSector = LoadLittleEndian<std::uint32_t>(pbItem);
+			} else if (
+				(uFlags & METADATA_REQUIRED) &&
+				!(guidPhysicalSectorSize == pbEntry) &&
+				!(guidPage83Data == pbEntry)
+			) {
+				// Something that changes how to read the disk that we don't
+				// know how to take into account
+				return false;
+			}
+		}
+		// 1 MB to 256 MB, a power of two
+		if (!bFileParameters || m_cbBlock < cbMB || m_cbBlock > 256 * cbMB || (m_cbBlock & (m_cbBlock - 1))) {
+			return false;
+		}
+		if (cbLogicalSector != 512 && cbLogicalSector != 4096) return false;
+		if (m_cbDisk == 0) return false;
+		m_cChunkRatio = (std::uint64_t(1) << 23) * cbLogicalSector / m_cbBlock;
+		return m_cChunkRatio > 0;
+	}
+
+	CByteSource &m_file;
+	std::uint64_t m_cbDisk;
+	std::uint32_t m_cbBlock;
+	std::uint64_t m_cChunkRatio;
+	std::vector<std::uint64_t> m_aBlockEntry;  // one per payload block
+};
+
+
+// -----------------------------------------------------------------------------
+// Opening whichever kind of image a file is
+
+enum class Format {
+	Raw,
+	VhdFixed,
+	VhdDynamic,
+	Vhdx,
+	Unsupported,  // recognized, but not something this can read
+};
+
+/**
+ * Work out what kind of image file is, and open the disk in it.
+ * @post: *ppDisk is the disk, for as long as file lives, unless it returns
+ *        Unsupported; for a raw image it's file itself, wrapped.
+ * @post: may throw std::bad_alloc.
+ */
+inline Format OpenImage(CByteSource &file, std::unique_ptr<CByteSource> *ppDisk) {
+	ppDisk->reset();
+	unsigned char abSignature[8] = {};
+	if (file.Size() >= 8 && file.Read(0, abSignature, 8) && std::memcmp(abSignature, "vhdxfile", 8) == 0) {
+		auto pImage = std::make_unique<CVhdxImage>(file);
+		if (!pImage->Open()) return Format::Unsupported;
+		*ppDisk = std::move(pImage);
+		return Format::Vhdx;
+	}
+
+	unsigned char abCookie[8] = {};
+	const std::uint64_t cbFile = file.Size();
+	if (
+		cbFile >= Vhd::cbFooter &&
+		file.Read(cbFile - Vhd::cbFooter, abCookie, 8) &&
+		std::memcmp(abCookie, "conectix", 8) == 0
+	) {
+		auto pImage = std::make_unique<CVhdImage>(file);
+		if (!pImage->Open()) return Format::Unsupported;
+		const Format format = pImage->IsDynamic() ? Format::VhdDynamic : Format::VhdFixed;
+		*ppDisk = std::move(pImage);
+		return format;
+	}
+
+	*ppDisk = std::make_unique<CWindowSource>(file, 0, cbFile);
+	return Format::Raw;
+}
+
+
+// -----------------------------------------------------------------------------
+// Partitions
+
+struct Partition {
+	std::uint64_t ibStart;
+	std::uint64_t cb;
+	bool bNtfs;  // has an NTFS boot sector
+};
+
+namespace Mbr {
+constexpr std::size_t cbOffEntries = 0x1BE;
+constexpr std::size_t cbEntry = 16;
+constexpr std::size_t cEntries = 4;
+constexpr std::size_t cbOffType = 4;
+constexpr std::size_t cbOffFirstLba = 8;
+constexpr std::size_t cbOffSectorCount = 12;
+constexpr unsigned char TYPE_GPT_PROTECTIVE = 0xEE;
+constexpr unsigned char TYPE_EXTENDED = 0x05;
+constexpr unsigned char TYPE_EXTENDED_LBA = 0x0F;
+}  // namespace Mbr
+
+namespace Gpt {
+constexpr std::size_t cbOffEntriesLba = 0x48;
+constexpr std::size_t cbOffEntryCount = 0x50;
+constexpr std::size_t cbOffEntrySize = 0x54;
+constexpr std::size_t cbOffFirstLba = 0x20;
+constexpr std::size_t cbOffLastLba = 0x28;
+constexpr std::uint32_t cEntriesMax = 1024;
+}  // namespace Gpt
+
+inline bool IsNtfsBootSector(CByteSource &disk, std::uint64_t ibStart) {
+	unsigned char abOem[8];
+	return disk.Read(ibStart + 3, abOem, 8) && std::memcmp(abOem, "NTFS    ", 8) == 0;
+}
+
+/**
+ * Find the partitions on disk: GPT if there is one, or the MBR's primary
+ * partitions, or, if the disk starts with a boot sector, the whole disk as a
+ * volume of its own. Logical partitions in an extended partition aren't
+ * followed.
+ * @post: returns false, with *pPartitions empty, if there's no partition
+ *        table or volume at the start.
+ * @post: may throw std::bad_alloc.
+ */
+inline bool FindPartitions(CByteSource &disk, std::vector<Partition> *pPartitions) {
+	pPartitions->clear();
+	if (IsNtfsBootSector(disk, 0)) {
+		pPartitions->push_back(Partition{0, disk.Size(), true});
+		return true;
+	}
+
+	unsigned char abMbr[512];
+	if (disk.Size() < sizeof(abMbr) || !disk.Read(0, abMbr, sizeof(abMbr))) return false;
+	if (abMbr[510] != 0x55 || abMbr[511] != 0xAA) return false;
+
+	bool bGpt = false;
+	for (std::size_t i = 0; i < Mbr::cEntries; i++) {
+		if (abMbr[Mbr::cbOffEntries + i * Mbr::cbEntry + Mbr::cbOffType] == Mbr::TYPE_GPT_PROTECTIVE) {
+			bGpt = true;
+		}
+	}
+
+	if (bGpt) {
+		// The header is at LBA 1, whatever size the disk's sectors are
+		for (const std::uint32_t cbSector : {512u, 4096u}) {
+			unsigned char abHeader[92];
+			if (!disk.Read(cbSector, abHeader, sizeof(abHeader))) continue;
+			if (std::memcmp(abHeader, "EFI PART", 8) != 0) continue;
+			const auto ullEntriesLba = LoadLittleEndian<std::uint64_t>(abHeader + Gpt::cbOffEntriesLba);
+			const auto cEntries = LoadLittleEndian<std::uint32_t>(abHeader + Gpt::cbOffEntryCount);
+			const auto cbEntry = LoadLittleEndian<std::uint32_t>(abHeader + Gpt::cbOffEntrySize);
+			if (cEntries > Gpt::cEntriesMax || cbEntry < 128 || cbEntry > 4096) return false;
+			std::vector<unsigned char> entries(static_cast<std::size_t>(cEntries) * cbEntry);
+			if (!disk.Read(ullEntriesLba * cbSector, entries.data(), entries.size())) return false;
+			static const unsigned char abUnused[16] = {};
+			for (std::uint32_t i = 0; i < cEntries; i++) {
+				const unsigned char *pbEntry = &entries[static_cast<std::size_t>(i) * cbEntry];
+				if (std::memcmp(pbEntry, abUnused, 16) == 0) continue;
+				const auto ullFirst = LoadLittleEndian<std::uint64_t>(pbEntry + Gpt::cbOffFirstLba);
+				const auto ullLast = LoadLittleEndian<std::uint64_t>(pbEntry + Gpt::cbOffLastLba);
+				if (ullLast < ullFirst) continue;
+				const std::uint64_t ibStart = ullFirst * cbSector;
+				const std::uint64_t cb = (ullLast - ullFirst + 1) * cbSector;
+				if (ibStart > disk.Size() || cb > disk.Size() - ibStart) continue;
+				pPartitions->push_back(Partition{ibStart, cb, IsNtfsBootSector(disk, ibStart)});
+			}
+			return true;
+		}
+		return false;
+	}
+
+	for (std::size_t i = 0; i < Mbr::cEntries; i++) {
+		const unsigned char *pbEntry = abMbr + Mbr::cbOffEntries + i * Mbr::cbEntry;
+		const unsigned char bType = pbEntry[Mbr::cbOffType];
+		if (bType == 0 || bType == Mbr::TYPE_EXTENDED || bType == Mbr::TYPE_EXTENDED_LBA) continue;
+		const std::uint64_t ibStart = std::uint64_t(LoadLittleEndian<std::uint32_t>(pbEntry + Mbr::cbOffFirstLba)) * 512;
+		const std::uint64_t cb = std::uint64_t(LoadLittleEndian<std::uint32_t>(pbEntry + Mbr::cbOffSectorCount)) * 512;
+		if (cb == 0 || ibStart > disk.Size() || cb > disk.Size() - ibStart) continue;
+		pPartitions->push_back(Partition{ibStart, cb, IsNtfsBootSector(disk, ibStart)});
+	}
+	return true;
+}
+
+
+/**
+ * An image file opened all the way down to the NTFS volumes on the disk in
+ * it, with a block cache in front of the disk so the small scattered reads
+ * of walking the MFT and reading streams don't each go to the file.
+ */
+class CImage {
+  public:
+	static constexpr std::size_t cbCacheBlock = 64 * 1024;
+
+	// @pre: file outlives the image.
+	explicit CImage(CByteSource &file, std::size_t cbCache = 64 * 1024 * 1024)
+		: m_file(file)
+		, m_cbCache(cbCache)
+		, m_format(Format::Unsupported) {}
+
+	/**
+	 * @post: returns false if the image is in a format this can't read, or
+	 *        has no partition table or volume on it. A disk with partitions
+	 *        but none of them NTFS opens with no volumes.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Open() {
+		m_volumes.clear();
+		m_pCache.reset();
+		m_format = OpenImage(m_file, &m_pDisk);
+		if (m_format == Format::Unsupported) return false;
+		m_pCache = std::make_unique<CBlockCache>(
+			*m_pDisk, cbCacheBlock, (std::max<std::size_t>)(16, m_cbCache / cbCacheBlock)
+		);
+
+		std::vector<Partition> partitions;
+		if (!FindPartitions(*m_pCache, &partitions)) return false;
+		for (const Partition &partition : partitions) {
+			if (!partition.bNtfs) continue;
+			m_volumes.push_back(std::make_unique<CWindowSource>(*m_pCache, partition.ibStart, partition.cb));
+		}
+		return true;
+	}
+
+	Format GetFormat() const { return m_format; }
+
+	// The disk's NTFS volumes, in partition table order, to give to a
+	// CMftReader or a CScanner
+	std::size_t VolumeCount() const { return m_volumes.size(); }
+	CByteSource &Volume(std::size_t i) { return *m_volumes[i]; }
+
+	CBlockCache::Stats GetCacheStats() const { return m_pCache->GetStats(); }
+
+  private:
+	CByteSource &m_file;
+	const std::size_t m_cbCache;
+	Format m_format;
+	std::unique_ptr<CByteSource> m_pDisk;
+	std::unique_ptr<CBlockCache> m_pCache;
+	std::vector<std::unique_ptr<CWindowSource>> m_volumes;
+};
+
+}  // namespace ADSX::Disk
@@ -0,0 +1,332 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "DropTarget.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+#include "ADSXItem.h"
+#include "StreamQuery.h"
+#include "TreeScanner.h"
+
+// Debug log prefix for ADSX::CDropTarget
+#define P_DT L"ADSX::CDropTarget(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+std::vector<std::wstring> NameNewStreams(
+	_In_ PCWSTR                          pszFile,
+	_In_ const std::vector<std::wstring> &names
+) {
+	std::vector<std::wstring> streams;
+	streams.reserve(names.size());
+	const auto IsTaken = [&](const std::wstring &sStream) {
+		for (const std::wstring &sEarlier : streams) {
+			if (_wcsicmp(sEarlier.c_str(), sStream.c_str()) == 0) return true;
+		}
+		const std::wstring sPath = CTreeScanner::StreamPath(pszFile, L':' + sStream);
+		return GetFileAttributesW(ExtendedLengthPath(sPath.c_str()).c_str()) != INVALID_FILE_ATTRIBUTES;
+	};
+	for (const std::wstring &sName : names) {
+		// npos + 1 is the whole of it
+		std::wstring sBase = sName.substr(sName.find_last_of(L'\\') + 1);
+		std::replace(sBase.begin(), sBase.end(), L':', L'_');
+		std::replace(sBase.begin(), sBase.end(), L'/', L'_');
+		if (sBase.empty()) sBase = L"Stream";
+		// "name.txt" -> "name (2).txt"; ".name" is all name
+		const std::size_t ichDot = sBase.find_last_of(L'.');
+		const std::size_t ichExtension = ichDot == std::wstring::npos || ichDot == 0 ?
+			sBase.size() :
+			ichDot;
+		std::wstring sStream = sBase;
+		for (ULONG n = 2; IsTaken(sStream); n++) {
+			sStream = sBase.substr(0, ichExtension) + L" (" + std::to_wstring(n) + L")" +
+				sBase.substr(ichExtension);
+		}
+		streams.push_back(std::move(sStream));
+	}
+	return streams;
+}
+
+
+HRESULT CDropTarget::Init(
+	_In_     IUnknown *pUnkOwner,
+	_In_opt_ HWND     hwndOwner,
+	_In_     PCWSTR   pszFile,
+	_In_     PCWSTR   pszItemPrefix,
+	_In_opt_ FnAdd    &&fnAdd
+) {
+	m_UnkOwnerPtr = pUnkOwner;
+	m_hwndOwner = hwndOwner;
+	m_bCanTake = false;
+	m_cfFileDescriptor = RegisterClipboardFormat(CFSTR_FILEDESCRIPTORW);
+	m_cfFileContents = RegisterClipboardFormat(CFSTR_FILECONTENTS);
+	if (pszFile == NULL || pszItemPrefix == NULL) return E_POINTER;
+	try {
+		m_sFile = pszFile;
+		m_sItemPrefix = pszItemPrefix;
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	m_fnAdd = std::move(fnAdd);
+	return S_OK;
+}
+
+
+bool CDropTarget::CanTake(_In_ IDataObject *pdo) const {
+	FORMATETC fe = {CF_HDROP, NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL};
+	if (pdo->QueryGetData(&fe) == S_OK) return true;
+	// Not everything answers for CFSTR_FILECONTENTS without an lindex, so
+	// the descriptor has to do
+	fe.cfFormat = static_cast<CLIPFORMAT>(m_cfFileDescriptor);
+	return pdo->QueryGetData(&fe) == S_OK;
+}
+
+
+HRESULT CDropTarget::Collect(
+	_In_  IDataObject                   *pdo,
+	_Out_ std::vector<std::wstring>     *pNames,
+	_Out_ std::vector<CCopyEngine::Job> *pJobs,
+	_Out_ std::vector<LONG>             *paiContents
+) const {
+	// Files go first: the lanes can read those without the source's help
+	FORMATETC fe = {CF_HDROP, NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL};
+	STGMEDIUM medium;
+	if (SUCCEEDED(pdo->GetData(&fe, &medium))) {
+		defer({ ReleaseStgMedium(&medium); });
+		const HDROP hDrop = static_cast<HDROP>(medium.hGlobal);
+		const UINT cFiles = DragQueryFileW(hDrop, 0xFFFFFFFF, NULL, 0);
+		for (UINT i = 0; i < cFiles; i++) {
+			std::wstring sPath(DragQueryFileW(hDrop, i, NULL, 0), L'\0');
+			if (sPath.empty()) continue;
+			DragQueryFileW(hDrop, i, &sPath[0], static_cast<UINT>(sPath.size() + 1));
+			// A folder has nothing to put in a stream
+			WIN32_FILE_ATTRIBUTE_DATA data;
+			if (
+				!GetFileAttributesExW(ExtendedLengthPath(sPath.c_str()).c_str(), GetFileExInfoStandard, &data) ||
+				(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			) {
+				LOG(L" ** Not taking " << sPath);
+				continue;
+			}
+			const ULONGLONG cbSize = static_cast<ULONGLONG>(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+			pNames->push_back(sPath);
+			pJobs->push_back({sPath, std::wstring(), cbSize});
+			paiContents->push_back(-1);
+		}
+		return S_OK;
+	}
+
+	fe.cfFormat = static_cast<CLIPFORMAT>(m_cfFileDescriptor);
+	HRESULT hr = pdo->GetData(&fe, &medium);
+	if (FAILED(hr)) return hr;
+	defer({ ReleaseStgMedium(&medium); });
+	const auto pfgd = static_cast<const FILEGROUPDESCRIPTORW *>(GlobalLock(medium.hGlobal));
+	if (pfgd == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	defer({ GlobalUnlock(medium.hGlobal); });
+	// No more of them than the block holds, whatever cItems says
+	const SIZE_T cbGlobal = GlobalSize(medium.hGlobal);
+	if (cbGlobal < offsetof(FILEGROUPDESCRIPTORW, fgd)) return DV_E_FORMATETC;
+	const UINT cItems = static_cast<UINT>((std::min)(
+		static_cast<SIZE_T>(pfgd->cItems),
+		(cbGlobal - offsetof(FILEGROUPDESCRIPTORW, fgd)) / sizeof(FILEDESCRIPTORW)
+	));
+	for (UINT i = 0; i < cItems; i++) {
+		const FILEDESCRIPTORW &fd = pfgd->fgd[i];
+		if ((fd.dwFlags & FD_ATTRIBUTES) && (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) continue;
+		// What the source says, if it says; only for the progress
+		const ULONGLONG cbSize = (fd.dwFlags & FD_FILESIZE) ?
+			static_cast<ULONGLONG>(fd.nFileSizeHigh) << 32 | fd.nFileSizeLow :
+			0;
+		const std::wstring sName(fd.cFileName, wcsnlen(fd.cFileName, _countof(fd.cFileName)));
+		pNames->push_back(sName);
+		pJobs->push_back({sName, std::wstring(), cbSize});
+		paiContents->push_back(static_cast<LONG>(i));
+	}
+	return S_OK;
+}
+
+
+#pragma region IDropTarget
+
+IFACEMETHODIMP CDropTarget::DragEnter(
+	_In_    IDataObject *pdo,
+	_In_    DWORD       grfKeyState,
+	_In_    POINTL      pt,
+	_Inout_ DWORD       *pdwEffect
+) {
+	LOG(P_DT << L"DragEnter()");
+	UNREFERENCED_PARAMETER(grfKeyState);
+	UNREFERENCED_PARAMETER(pt);
+	if (pdwEffect == NULL) return WrapReturn(E_POINTER);
+	m_bCanTake = pdo != NULL && CanTake(pdo);
+	// Only ever a copy; whatever it came from stays where it is
+	*pdwEffect = m_bCanTake && (*pdwEffect & DROPEFFECT_COPY) ? DROPEFFECT_COPY : DROPEFFECT_NONE;
+	return WrapReturn(S_OK);
+}
+
+
+IFACEMETHODIMP CDropTarget::DragOver(
+	_In_    DWORD  grfKeyState,
+	_In_    POINTL pt,
+	_Inout_ DWORD  *pdwEffect
+) {
+	// Not logging this one: it comes with every move of the mouse
+	UNREFERENCED_PARAMETER(grfKeyState);
+	UNREFERENCED_PARAMETER(pt);
+	if (pdwEffect == NULL) return E_POINTER;
+	*pdwEffect = m_bCanTake && (*pdwEffect & DROPEFFECT_COPY) ? DROPEFFECT_COPY : DROPEFFECT_NONE;
+	return S_OK;
+}
+
+
+IFACEMETHODIMP CDropTarget::DragLeave() {
+	LOG(P_DT << L"DragLeave()");
+	m_bCanTake = false;
+	return WrapReturn(S_OK);
+}
+
+
+IFACEMETHODIMP CDropTarget::Drop(
+	_In_    IDataObject *pdo,
+	_In_    DWORD       grfKeyState,
+	_In_    POINTL      pt,
+	_Inout_ DWORD       *pdwEffect
+) {
+	LOG(P_DT << L"Drop()");
+	UNREFERENCED_PARAMETER(grfKeyState);
+	UNREFERENCED_PARAMETER(pt);
+	if (pdo == NULL || pdwEffect == NULL) return WrapReturn(E_POINTER);
+	const DWORD dwAllowed = *pdwEffect;
+	*pdwEffect = DROPEFFECT_NONE;
+	m_bCanTake = false;
+	if (!(dwAllowed & DROPEFFECT_COPY) || !CanTake(pdo)) return WrapReturn(S_OK);
+
+	HRESULT hr;
+	std::vector<CCopyEngine::Job> jobs;
+	std::vector<LONG> aiContents;
+	CCopyEngine::FnStart fnStart;
+	CCopyEngine::FnCopied fnCopied;
+	// Holds a reference on pdo until it's unmarshaled on the copying thread;
+	// if that thread never gets to it, it has to be let go of here
+	CComPtr<IStream> pMarshaled;
+	try {
+		std::vector<std::wstring> names;
+		hr = Collect(pdo, &names, &jobs, &aiContents);
+		if (FAILED(hr)) return WrapReturn(hr);
+		if (jobs.empty()) return WrapReturn(S_OK);
+		const std::vector<std::wstring> streams = NameNewStreams(m_sFile.c_str(), names);
+		for (std::size_t i = 0; i < jobs.size(); i++) {
+			jobs[i].sDestination = CTreeScanner::StreamPath(m_sFile.c_str(), L':' + streams[i]);
+		}
+
+		// Virtual files are read on the copying thread, so the data object
+		// goes there too. Its contents are only asked for there, once the
+		// progress dialog's up: some sources take their time making them.
+		const bool bVirtual = std::any_of(aiContents.begin(), aiContents.end(), [](LONG i) {
+			return i >= 0;
+		});
+		if (bVirtual) {
+			hr = CoMarshalInterThreadInterfaceInStream(IID_IDataObject, pdo, &pMarshaled);
+			if (FAILED(hr)) return WrapReturn(hr);
+			fnStart = [
+				pMarshaled,
+				aiContents,
+				cfFileContents = static_cast<CLIPFORMAT>(m_cfFileContents)
+			](std::vector<CCopyEngine::Job> *pJobs) mutable {
+				CComPtr<IDataObject> pdoHere;
+				// It can only be unmarshaled the once
+				const HRESULT hrHere = CoGetInterfaceAndReleaseStream(
+					pMarshaled.Detach(), IID_PPV_ARGS(&pdoHere)
+				);
+				std::vector<CCopyEngine::Job> ready;
+				ready.reserve(pJobs->size());
+				for (std::size_t i = 0; i < pJobs->size(); i++) {
+					CCopyEngine::Job &job = (*pJobs)[i];
+					if (aiContents[i] < 0) {
+						ready.push_back(std::move(job));
+						continue;
+					}
+					if (FAILED(hrHere)) continue;
+					FORMATETC fe = {
+						cfFileContents, NULL, DVASPECT_CONTENT, aiContents[i], TYMED_ISTREAM | TYMED_HGLOBAL
+					};
+					STGMEDIUM medium;
+					if (FAILED(pdoHere->GetData(&fe, &medium))) {
+						LOG(L" ** No contents for " << job.sSource);
+						continue;
+					}
+					defer({ ReleaseStgMedium(&medium); });
+					if (medium.tymed == TYMED_ISTREAM) {
+						job.pSource = medium.pstm;
+						// Some hand it over wherever they left off
+						const LARGE_INTEGER liStart = {};
+						job.pSource->Seek(liStart, STREAM_SEEK_SET, NULL);
+					} else if (medium.tymed == TYMED_HGLOBAL) {
+						const BYTE *pb = static_cast<const BYTE *>(GlobalLock(medium.hGlobal));
+						if (pb == NULL) continue;
+						// The block can be bigger than what's in it
+						SIZE_T cb = GlobalSize(medium.hGlobal);
+						if (job.cbSize != 0) cb = static_cast<SIZE_T>((std::min)(static_cast<ULONGLONG>(cb), job.cbSize));
+						job.pSource.Attach(SHCreateMemStream(pb, static_cast<UINT>(cb)));
+						GlobalUnlock(medium.hGlobal);
+					}
+					if (job.pSource != NULL) ready.push_back(std::move(job));
+				}
+				*pJobs = std::move(ready);
+			};
+		}
+
+		if (m_fnAdd) {
+			fnCopied = [
+				pUnkOwner = m_UnkOwnerPtr,
+				fnAdd = m_fnAdd,
+				sItemPrefix = m_sItemPrefix
+			](const CCopyEngine::Job &job) {
+				try {
+					const std::wstring sName =
+						sItemPrefix + job.sDestination.substr(job.sDestination.find_last_of(L':') + 1);
+					WIN32_FILE_ATTRIBUTE_DATA data;
+					const LONGLONG llSize = GetFileAttributesExW(
+						ExtendedLengthPath(job.sDestination.c_str()).c_str(), GetFileExInfoStandard, &data
+					) ?
+						static_cast<LONGLONG>(static_cast<ULONGLONG>(data.nFileSizeHigh) << 32 | data.nFileSizeLow) :
+						static_cast<LONGLONG>(job.cbSize);
+					PITEMID_CHILD pidlc = CItem::NewPidl(
+						sName.c_str(),
+						sName.size(),
+						llSize,
+						static_cast<BYTE>(sItemPrefix.empty() ? 0 : CItem::FLAG_RELATIVE)
+					);
+					if (pidlc == NULL) return;
+					defer({ CoTaskMemFree(pidlc); });
+					fnAdd(pidlc);
+				} catch (const std::bad_alloc &) {
+					// It'll be there the next time the view's refreshed
+				}
+			};
+		}
+	} catch (const std::bad_alloc &) {
+		if (pMarshaled != NULL) CoReleaseMarshalData(pMarshaled);
+		return WrapReturn(E_OUTOFMEMORY);
+	}
+
+	hr = CCopyEngine::CopyInBackground(m_hwndOwner, std::move(jobs), std::move(fnStart), std::move(fnCopied));
+	if (FAILED(hr)) {
+		// The stream's still at the start, as marshaling left it
+		if (pMarshaled != NULL) CoReleaseMarshalData(pMarshaled);
+		return WrapReturn(hr);
+	}
+	*pdwEffect = DROPEFFECT_COPY;
+	return WrapReturn(S_OK);
+}
+
+#pragma endregion
+
+}  // namespace ADSX
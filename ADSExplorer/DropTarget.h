@@ -0,0 +1,110 @@
+/**
+ * 2024 Nate Kean
+ *
+ * What a view takes drops with. Files dropped on it, and virtual files like
+ * the ones another view's streams are dragged out as, are written into new
+ * streams on the file being viewed, by the copy engine (CopyEngine.h) on a
+ * thread of its own. Each one is added to the view as soon as it's there.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "CopyEngine.h"
+
+namespace ADSX {
+
+/**
+ * Name a new stream on the object at pszFile for each of names (paths of
+ * files, or of virtual files), after what comes after its last backslash,
+ * with anything a stream name can't have replaced. A name that's taken, by a
+ * stream already there or by an earlier one of names, gets " (2)", " (3)",
+ * ... before its extension.
+ * @post: may throw std::bad_alloc.
+ */
+std::vector<std::wstring> NameNewStreams(
+	_In_ PCWSTR                          pszFile,
+	_In_ const std::vector<std::wstring> &names
+);
+
+
+class ATL_NO_VTABLE CDropTarget
+	: public CComObjectRootEx<CComSingleThreadModel>,
+	  public IDropTarget {
+  public:
+	// Put an item for a new stream into the view the drop was on. Called
+	// from whichever thread wrote it.
+	using FnAdd = std::function<void (PCUITEMID_CHILD pidlc)>;
+
+	BEGIN_COM_MAP(CDropTarget)
+		COM_INTERFACE_ENTRY(IDropTarget)
+	END_COM_MAP()
+
+	/**
+	 * Hold on to the owner (the folder) until the last of a drop is written.
+	 * Streams are made on the file or folder at pszFile, and their items are
+	 * named pszItemPrefix and then the stream's name: "" in the file's own
+	 * view, "sub\file.txt:" in the tree pseudofolder.
+	 */
+	HRESULT Init(
+		_In_     IUnknown *pUnkOwner,
+		_In_opt_ HWND     hwndOwner,
+		_In_     PCWSTR   pszFile,
+		_In_     PCWSTR   pszItemPrefix,
+		_In_opt_ FnAdd    &&fnAdd
+	);
+
+	//--------------------------------------------------------------------------
+	// IDropTarget
+	IFACEMETHOD(DragEnter)(
+		_In_    IDataObject *pdo,
+		_In_    DWORD       grfKeyState,
+		_In_    POINTL      pt,
+		_Inout_ DWORD       *pdwEffect
+	);
+	IFACEMETHOD(DragOver)(
+		_In_    DWORD  grfKeyState,
+		_In_    POINTL pt,
+		_Inout_ DWORD  *pdwEffect
+	);
+	IFACEMETHOD(DragLeave)();
+	IFACEMETHOD(Drop)(
+		_In_    IDataObject *pdo,
+		_In_    DWORD       grfKeyState,
+		_In_    POINTL      pt,
+		_Inout_ DWORD       *pdwEffect
+	);
+
+  protected:
+	// Whether there's anything in pdo that can be made into streams
+	bool CanTake(_In_ IDataObject *pdo) const;
+
+	// What's dropped, as names for NameNewStreams and jobs for the copy
+	// engine with everything but the destinations. aiContents has the
+	// CFSTR_FILECONTENTS index of each job that's a virtual file, or -1.
+	// @post: may throw std::bad_alloc.
+	HRESULT Collect(
+		_In_  IDataObject                   *pdo,
+		_Out_ std::vector<std::wstring>     *pNames,
+		_Out_ std::vector<CCopyEngine::Job> *pJobs,
+		_Out_ std::vector<LONG>             *paiContents
+	) const;
+
+	CComPtr<IUnknown> m_UnkOwnerPtr;
+	HWND m_hwndOwner;
+	std::wstring m_sFile;
+	std::wstring m_sItemPrefix;
+	FnAdd m_fnAdd;
+	UINT m_cfFileDescriptor;
+	UINT m_cfFileContents;
+	// Whether what's being dragged over can be taken; worked out once, when
+	// it comes in
+	bool m_bCanTake;
+};
+
+}  // namespace ADSX
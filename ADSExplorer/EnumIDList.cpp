@@ -7,6 +7,8 @@
 #include "EnumIDList.h"
 
 #include "ADSXItem.h"
+#include "StreamCache.h"
+#include "Volume.h"
 
 // Debug log prefix for CEnumIDList
 #define P_EIDL L"ADSX::CEnumIDList(0x" << std::hex << this << L")::"
@@ -15,82 +17,79 @@ namespace ADSX {
 
 
 /**
- * Convert a WIN32_FIND_STREAM_DATA to a PIDL and add it to the output array.
+ * Convert a stream from the snapshot to a PIDL and add it to the output array.
  * pushin p
+ * The name goes straight from the snapshot's arena into the new item ID;
+ * that's the one and only allocation per item.
  * @post: ppelt array cursor is advanced by one element
  * @post: Elements should be freed with CoTaskMemFree
  * @post: nActual is incremented
  */
-static bool PushPidl(
-	_In_    const WIN32_FIND_STREAM_DATA &fsd,
+static inline bool PushPidl(
+	_In_    const CStreamSnapshot &snapshot,
+	_In_    ULONG                 iStream,
 	// POINTER! to the destination array cursor because we're going to
 	// modify it (advance it).
 	// Fun Fact: This is a pointer to an array of pointers to ITEMID_CHILDren.
 	// A real triple pointer. How awful is that? :)
-	_Inout_ PITEMID_CHILD                **ppelt,
-	_Inout_ ULONG                        *nActual
+	_Inout_ PITEMID_CHILD         **ppelt,
+	_Inout_ ULONG                 *nActual
 ) {
-	std::wstring sName(fsd.cStreamName);
-	// All ADSes follow this name pattern AFAIK, but if they don't,
-	// 1: we shouldn't modify its name as we are going to with all the others
-	// 2: I want to know about it
-	ATLASSERT(sName.starts_with(L":") && sName.ends_with(L":$DATA"));
-	if (sName.starts_with(L":") && sName.ends_with(L":$DATA")) {
-		sName = sName.substr(
-			_countof(L":") - 1,
-			(sName.length() - 1) - (_countof(L":$DATA") - 1)
-		);
-	}
-
- 	// Skip the main stream. We're too hipster
-	if (sName.empty()) return true;
-
 	LOG(
-		L" ** Stream: " << sName <<
-		L" (" << fsd.StreamSize.QuadPart << L" bytes)"
+		L" ** Stream: " << snapshot.Name(iStream) <<
+		L" (" << snapshot.Size(iStream) << L" bytes)"
 	);
 
-	// Fill in the item
-	PADSXITEMID_CHILD adsxpidlc = ADSX::CItem::NewPidl();
-	if (adsxpidlc == NULL) {
+	PITEMID_CHILD pidlc = CItem::NewPidl(
+		snapshot.Name(iStream),
+		snapshot.NameLength(iStream),
+		snapshot.Size(iStream)
+	);
+	if (pidlc == NULL) {
 		SetLastError(ERROR_OUTOFMEMORY);
 		return false;
 	}
-	auto Item = CItem::Get(adsxpidlc);
-	Item->llFilesize = fsd.StreamSize.QuadPart;
-	Item->pszName = static_cast<PWSTR>(
-		CoTaskMemAlloc(sName.length() + sizeof(WCHAR))
-	);
-	sName.copy(Item->pszName, sName.length());
 
 	// Put that PIDL into the output array
-	**ppelt = adsxpidlc;
+	**ppelt = pidlc;
 
 	// Advance the enumerator
-	*ppelt += sizeof(PADSXITEMID_CHILD);
+	++*ppelt;
 	++*nActual;
 	return true;
 }
 
-/**
- * Find one or more items with NextInternal and discard them.
- */
-static bool NoOp(const WIN32_FIND_STREAM_DATA &, PITEMID_CHILD **, ULONG *) {
-	return true;
-}
+
+volatile LONG64 CEnumIDList::m_cDeadlineHits = 0;
+volatile LONG64 CEnumIDList::m_cCancellations = 0;
 
 
 CEnumIDList::CEnumIDList()
 	: m_pszPath(NULL)
-	, m_hFinder(NULL)
-	, m_nTotalFetched(0) {
+	, m_iCursor(0)
+	, m_bFillBatches(false)
+	, m_bHasDeadline(false)
+	, m_dwDeadline(0)
+	, m_bTimedOut(false)
+	, m_apidlcLead()
+	, m_cLead(0)
+	, m_iLead(0) {
 	LOG(P_EIDL << L"CEnumIDList()");
 }
 
 CEnumIDList::~CEnumIDList() {
 	LOG(P_EIDL << L"~CEnumIDList()");
-	if (m_hFinder != NULL) FindClose(m_hFinder);
+	// The view lets go of the enumerator when the user navigates away, so
+	// this is where a slow listing gets called off. Don't wait on it; it
+	// cleans up after itself.
+	if (m_pProducer != NULL) {
+		if (!m_pProducer->IsFinished()) {
+			InterlockedIncrement64(&m_cCancellations);
+		}
+		m_pProducer->Cancel();
+	}
 	if (m_pszPath != NULL) SysFreeString(m_pszPath);
+	for (ULONG i = 0; i < m_cLead; i++) CoTaskMemFree(m_apidlcLead[i]);
 }
 
 HRESULT CEnumIDList::Init(_In_ IUnknown *punkOwner, _In_ LPCWSTR pszPath) {
@@ -101,6 +100,86 @@ HRESULT CEnumIDList::Init(_In_ IUnknown *punkOwner, _In_ LPCWSTR pszPath) {
 	return WrapReturn(S_OK);
 }
 
+HRESULT CEnumIDList::Init(
+	_In_ IUnknown        *punkOwner,
+	_In_ PCWSTR          pszPath,
+	_In_ CStreamSnapshot *pSnapshot
+) {
+	HRESULT hr = Init(punkOwner, pszPath);
+	if (FAILED(hr)) return hr;
+	m_pSnapshot = pSnapshot;
+	return S_OK;
+}
+
+
+HRESULT CEnumIDList::StartAsync(_In_ bool bFillBatches, _In_ DWORD dwTimeoutMs) {
+	LOG(P_EIDL << L"StartAsync(bFillBatches=" << bFillBatches <<
+		L", dwTimeoutMs=" << std::dec << dwTimeoutMs << L")");
+	ATLASSERT(m_pSnapshot == NULL && m_pProducer == NULL && m_iCursor == 0);
+	m_bFillBatches = bFillBatches;
+	m_bHasDeadline = dwTimeoutMs != INFINITE;
+	m_dwDeadline = GetTickCount() + dwTimeoutMs;
+	HRESULT hr = CEnumProducer::Start(m_pszPath, &m_pProducer);
+	return WrapReturn(hr);
+}
+
+
+HRESULT CEnumIDList::AddLeadingItem(_In_ PCUITEMID_CHILD pidlc) {
+	ATLASSERT(m_iLead == 0 && m_iCursor == 0);
+	if (m_cLead == cLeadMax) return WrapReturn(E_UNEXPECTED);
+	m_apidlcLead[m_cLead] = CItem::Clone(pidlc);
+	if (m_apidlcLead[m_cLead] == NULL) return WrapReturn(E_OUTOFMEMORY);
+	m_cLead++;
+	return WrapReturn(S_OK);
+}
+
+
+CEnumIDList::Stats CEnumIDList::GetStats() {
+	return Stats{
+		static_cast<ULONGLONG>(m_cDeadlineHits),
+		static_cast<ULONGLONG>(m_cCancellations),
+	};
+}
+
+
+DWORD CEnumIDList::RemainingMs() const {
+	if (!m_bHasDeadline) return INFINITE;
+	// Signed, so it comes out right across the tick count wrapping around
+	const LONG lRemaining = static_cast<LONG>(m_dwDeadline - GetTickCount());
+	return lRemaining > 0 ? static_cast<DWORD>(lRemaining) : 0;
+}
+
+
+void CEnumIDList::OnDeadline() {
+	LOG(P_EIDL << L"OnDeadline(): gave up on " << m_pszPath);
+	InterlockedIncrement64(&m_cDeadlineHits);
+	m_pProducer->Cancel();
+	m_pProducer.Release();
+	m_bTimedOut = true;
+	CVolumeCache::Instance().MarkSlow(m_pszPath);
+}
+
+
+HRESULT CEnumIDList::EnsureSnapshot() {
+	if (m_pSnapshot != NULL) return S_OK;
+	if (m_bTimedOut) return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+	if (m_pProducer != NULL) {
+		// m_iCursor already counts what came out of the producer
+		HRESULT hr = m_pProducer->Stop(&m_pSnapshot, RemainingMs());
+		if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) {
+			OnDeadline();
+			return hr;
+		}
+		m_pProducer.Release();
+		if (FAILED(hr)) LOG(L" ** Error: " << HRESULTToString(hr));
+		return hr;
+	}
+	// Hopes and Streams
+	HRESULT hr = CStreamCache::Instance().GetListing(m_pszPath, &m_pSnapshot);
+	if (FAILED(hr)) LOG(L" ** Error: " << HRESULTToString(hr));
+	return hr;
+}
+
 
 /**
  * Find one or more items with NextInternal and push them to the
@@ -112,92 +191,111 @@ STDMETHODIMP CEnumIDList::Next(
 	_Out_ ULONG *pceltFetched
 ) {
 	LOG(P_EIDL << L"Next(celt=" << celt << L")");
-	return NextInternal(&PushPidl, celt, rgelt, pceltFetched);
-}
-
-
-HRESULT CEnumIDList::NextInternal(
-	_In_     FnConsume     fnConsume,     // callback on item found
-	_In_     ULONG         celt,          // number of pidls requested
-	_Outptr_ PITEMID_CHILD *rgelt,        // array of pidls
-	_Out_    ULONG         *pceltFetched  // actual number of pidls fetched
-) {
 	if (rgelt == NULL || (celt != 1 && pceltFetched == NULL)) {
 		LOG(L" ** Bad argument(s)");
 		return WrapReturn(E_POINTER);
 	}
 	if (celt == 0) {
 		LOG(L" ** 0 requested :/ vacuous success");
-		*pceltFetched = 0;
+		if (pceltFetched != NULL) *pceltFetched = 0;
 		return WrapReturn(S_OK);
 	}
 
-	static WIN32_FIND_STREAM_DATA fsd;
-	ULONG nActual = 0;
-	bool bPushPidlSuccess;
+	ObjectLock lock(this);
+	ULONG nLead = 0;
+	while (m_iLead < m_cLead && nLead < celt) {
+		rgelt[nLead] = CItem::Clone(m_apidlcLead[m_iLead]);
+		if (rgelt[nLead] == NULL) break;
+		m_iLead++;
+		nLead++;
+	}
+	ULONG nStreams = 0;
+	HRESULT hr = m_iLead < m_cLead && nLead < celt ? E_OUTOFMEMORY : S_OK;
+	if (SUCCEEDED(hr) && celt > nLead) {
+		hr = NextStreams(celt - nLead, rgelt + nLead, &nStreams);
+	}
+	if (FAILED(hr)) {
+		// Take them back, so they go out with whatever works next time
+		for (ULONG i = 0; i < nLead; i++) CoTaskMemFree(rgelt[i]);
+		m_iLead -= nLead;
+		nLead = 0;
+	}
+	if (pceltFetched != NULL) *pceltFetched = nLead + nStreams;
+	return WrapReturn(hr);
+}
 
-	// Initialize the finder if it hasn't been already with a call to
-	// FindFirstStream instead of FindNextStream.
-	// Call the callback on this first item.
-	// Hopes and Streams
-	if (m_hFinder == NULL) {
-		m_hFinder = FindFirstStreamW(m_pszPath, FindStreamInfoStandard, &fsd, 0);
-		if (m_hFinder == INVALID_HANDLE_VALUE) {
-			m_hFinder = NULL;
-			switch (GetLastError()) {
-				case ERROR_SUCCESS:
-					LOG(
-						L" ** FindFirstStreamW returned INVALID_HANDLE_VALUE "
-						L"but GetLastError() == ERROR_SUCCESS"
-					);
-					return WrapReturn(E_FAIL);
-				case ERROR_HANDLE_EOF:
-					LOG(L" ** No streams found");
-					*pceltFetched = 0;
-					return WrapReturn(S_FALSE);
-				default:
-					LOG(L" ** Error: " << GetLastError());
-					return HRESULT_FROM_WIN32(GetLastError());
-			}
-		}
-		if (GetLastError() == ERROR_HANDLE_EOF) {
-			LOG(L" ** No streams found");
-			*pceltFetched = 0;
-			return WrapReturn(S_FALSE);
-		}
-		bPushPidlSuccess = fnConsume(fsd, &rgelt, &nActual);
-		if (!bPushPidlSuccess) {
-			LOG(L" ** Error: " << GetLastError());
-			return HRESULT_FROM_WIN32(GetLastError());
+
+HRESULT CEnumIDList::NextStreams(
+	_In_     ULONG         celt,
+	_Outptr_ PITEMID_CHILD *rgelt,
+	_Out_    ULONG         *pceltFetched
+) {
+	if (m_bTimedOut) {
+		// Already handed back everything we're going to get
+		*pceltFetched = 0;
+		return S_FALSE;
+	}
+	if (m_pProducer != NULL) {
+		ULONG nActual = 0;
+		HRESULT hr;
+		do {
+			ULONG nPopped = 0;
+			hr = m_pProducer->Pop(
+				celt - nActual, rgelt + nActual, &nPopped, RemainingMs()
+			);
+			nActual += nPopped;
+		} while (m_bFillBatches && hr == S_OK && nActual < celt);
+		m_iCursor += nActual;
+		if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) {
+			// Better a partial list than a window that won't respond
+			OnDeadline();
+			hr = S_FALSE;
+		} else if (nActual > 0) {
+			// Anything that went wrong after these comes out of the next call.
+			// Only a caller that asked for async takes a short batch as
+			// anything but the end.
+			hr = m_bFillBatches && nActual < celt ? S_FALSE : S_OK;
 		}
+		*pceltFetched = nActual;
+		return hr;
 	}
 
-	// The main loop body that the rest of the calls to Next will skip to.
+	// A lambda has a type of its own, so NextInternal gets instantiated
+	// specifically for PushPidl and there's no indirect call per stream.
+	auto fnPushPidl = [](
+		const CStreamSnapshot &snapshot,
+		ULONG                 iStream,
+		PITEMID_CHILD         **ppelt,
+		ULONG                 *nActual
+	) {
+		return PushPidl(snapshot, iStream, ppelt, nActual);
+	};
+	return NextInternal(fnPushPidl, celt, rgelt, pceltFetched);
+}
+
+
+template <typename FnConsume>
+HRESULT CEnumIDList::NextInternal(
+	_In_     FnConsume     fnConsume,     // callback on item found
+	_In_     ULONG         celt,          // number of pidls requested
+	_Outptr_ PITEMID_CHILD *rgelt,        // array of pidls
+	_Out_    ULONG         *pceltFetched  // actual number of pidls fetched
+) {
+	HRESULT hr = EnsureSnapshot();
+	if (FAILED(hr)) return hr;
+
 	// Each loop calls the callback on another stream.
-	bool bFindStreamStopped = false;
-	while (!bFindStreamStopped && nActual < celt) {
-		bFindStreamStopped = !FindNextStreamW(m_hFinder, &fsd);
-		if (bFindStreamStopped) {
-			if (GetLastError() == ERROR_HANDLE_EOF) {
-				// Do nothing and let the loop end
-			} else {
-				// Stream has stopped unexpectedly
-				LOG(L" ** Error: " << GetLastError());
-				return HRESULT_FROM_WIN32(GetLastError());
-			}
-		} else {
-			// Consume stream
-			bPushPidlSuccess = fnConsume(fsd, &rgelt, &nActual);
-			if (!bPushPidlSuccess) {
-				LOG(L" ** Error: " << GetLastError());
-				return HRESULT_FROM_WIN32(GetLastError());
-			}
+	ULONG nActual = 0;
+	while (nActual < celt && m_iCursor < m_pSnapshot->Count()) {
+		if (!fnConsume(*m_pSnapshot, m_iCursor, &rgelt, &nActual)) {
+			LOG(L" ** Error: " << GetLastError());
+			return HRESULT_FROM_WIN32(GetLastError());
 		}
+		++m_iCursor;
 	}
 	if (pceltFetched != NULL) {  // Bookkeeping
 		*pceltFetched = nActual;
 	}
-	m_nTotalFetched += nActual;
 	if (nActual < celt) {
 		LOG(L" ** Ran out");
 		return WrapReturn(S_FALSE);
@@ -208,21 +306,35 @@ HRESULT CEnumIDList::NextInternal(
 
 STDMETHODIMP CEnumIDList::Reset() {
 	LOG(P_EIDL << L"Reset()");
-	if (m_hFinder != NULL) {
-		m_nTotalFetched = 0;
-		const BOOL success = FindClose(m_hFinder);
-		m_hFinder = NULL;
-		if (!success) return HRESULT_FROM_WIN32(GetLastError());
+	ObjectLock lock(this);
+	if (m_pProducer != NULL) {
+		// Rewinding means going back over items already handed out, so
+		// finish with the producer and walk the snapshot instead.
+		HRESULT hr = EnsureSnapshot();
+		if (FAILED(hr)) return hr;
 	}
+	// Keep the snapshot. Explorer makes a new enumerator when it refreshes.
+	m_iCursor = 0;
+	m_iLead = 0;
 	return WrapReturn(S_OK);
 }
 
 
 STDMETHODIMP CEnumIDList::Skip(_In_ ULONG celt) {
 	LOG(P_EIDL << L"Skip(celt=" << celt << L")");
-	ULONG pceltFetchedFake = 0;
-	PITEMID_CHILD *rgeltFake = NULL;
-	return NextInternal(&NoOp, celt, rgeltFake, &pceltFetchedFake);
+	ObjectLock lock(this);
+	const ULONG nLead = min(celt, m_cLead - m_iLead);
+	m_iLead += nLead;
+	celt -= nLead;
+	HRESULT hr = EnsureSnapshot();
+	if (FAILED(hr)) return hr;
+	const ULONG cRemaining = m_pSnapshot->Count() - m_iCursor;
+	if (celt > cRemaining) {
+		m_iCursor = m_pSnapshot->Count();
+		return WrapReturn(S_FALSE);
+	}
+	m_iCursor += celt;
+	return WrapReturn(S_OK);
 }
 
 
@@ -231,14 +343,27 @@ STDMETHODIMP CEnumIDList::Clone(_COM_Outptr_ IEnumIDList **ppEnum) {
 	if (ppEnum == NULL) return WrapReturn(E_POINTER);
 	*ppEnum = NULL;
 
+	ObjectLock lock(this);
+	// Take the snapshot now so the clone sees exactly the same streams
+	HRESULT hr = EnsureSnapshot();
+	if (FAILED(hr)) return hr;
+
 	CComObject<CEnumIDList> *pEnumNew;
-	HRESULT hr = CComObject<CEnumIDList>::CreateInstance(&pEnumNew);
+	hr = CComObject<CEnumIDList>::CreateInstance(&pEnumNew);
+	if (FAILED(hr)) return hr;
+	pEnumNew->AddRef();
+	defer({ pEnumNew->Release(); });
+	hr = pEnumNew->Init(m_punkOwner, m_pszPath);
 	if (FAILED(hr)) return hr;
-	pEnumNew->Init(m_punkOwner, m_pszPath);
 
-	// Unfortunately I don't see any more an efficient way to do this with
-	// the Find Stream API :(
-	pEnumNew->Skip(m_nTotalFetched);
+	for (ULONG i = 0; i < m_cLead; i++) {
+		hr = pEnumNew->AddLeadingItem(m_apidlcLead[i]);
+		if (FAILED(hr)) return hr;
+	}
+	pEnumNew->m_iLead = m_iLead;
+	// Share the snapshot and pick up where this one is
+	pEnumNew->m_pSnapshot = m_pSnapshot;
+	pEnumNew->m_iCursor = m_iCursor;
 
 	hr = pEnumNew->QueryInterface(IID_PPV_ARGS(ppEnum));
 	if (FAILED(hr)) return hr;
@@ -9,14 +9,15 @@
 
 #include "pch.h"
 
-#include <functional>
+#include "EnumProducer.h"
+#include "StreamSnapshot.h"
 
 namespace ADSX {
 
 
 class ATL_NO_VTABLE CEnumIDList
 	: public IEnumIDList,
-	  public CComObjectRootEx<CComSingleThreadModel> {
+	  public CComObjectRootEx<CComMultiThreadModel> {
 
   public:
 	BEGIN_COM_MAP(CEnumIDList)
@@ -50,14 +51,70 @@ class ATL_NO_VTABLE CEnumIDList
 		_COM_Outptr_ IEnumIDList**
 	);
 
+	/**
+	 * Start from a snapshot someone else already took instead of asking the
+	 * filesystem.
+	 * @post: pSnapshot is AddRef'd.
+	 */
+	HRESULT Init(
+		_In_ IUnknown        *pUnkOwner,
+		_In_ PCWSTR          pszPath,
+		_In_ CStreamSnapshot *pSnapshot
+	);
+
+	/**
+	 * Take the snapshot and make the items on a background thread from here
+	 * on. Skip, Reset and Clone wait for the snapshot and carry on without
+	 * the thread.
+	 * If bFillBatches is false (the caller passed SHCONTF_ENABLE_ASYNC), Next
+	 * hands back whatever is ready, only waiting if nothing is yet, and may
+	 * return S_OK with fewer items than asked for. Otherwise Next waits for
+	 * as many as were asked for, like it would without the thread.
+	 * Either way, nothing waits past dwTimeoutMs from now (INFINITE for no
+	 * limit): the producer is cancelled, Next returns S_FALSE with what it
+	 * has, and the volume is remembered as slow.
+	 * @pre: called right after Init, before anything else.
+	 */
+	HRESULT StartAsync(_In_ bool bFillBatches, _In_ DWORD dwTimeoutMs);
+
+	// The most items AddLeadingItem takes
+	static constexpr ULONG cLeadMax = 2;
+
+	/**
+	 * Hand out a copy of pidlc before any of the streams, after any leading
+	 * items added before it, like the pseudofolders in a folder's view.
+	 * Reset and Clone keep them.
+	 * @pre: called right after Init, before Next or Skip, fewer than
+	 *       cLeadMax times.
+	 * @post: pidlc is copied and ownership remains with caller.
+	 */
+	HRESULT AddLeadingItem(_In_ PCUITEMID_CHILD pidlc);
+
+	struct Stats {
+		// Enumerations that ran out of time and returned what they had
+		ULONGLONG cDeadlineHits;
+		// Enumerations released before the producer was done
+		ULONGLONG cCancellations;
+	};
+
+	// Totals for every enumerator in the process.
+	static Stats GetStats();
+
   protected:
-	using FnConsume = std::function<
-		bool (
-			_In_     const WIN32_FIND_STREAM_DATA &fsd,
-			_Outptr_ PITEMID_CHILD                **ppelt,
-			_Out_    ULONG                        *nActual
-		)
-	>;
+	/**
+	 * Walk the snapshot from the cursor, handing each stream to fnConsume
+	 * until celt of them have been consumed or the snapshot runs out.
+	 * FnConsume is a template parameter rather than a std::function so the
+	 * call is resolved (and inlined) at compile time.
+	 * bool fnConsume(
+	 *     const CStreamSnapshot &snapshot,
+	 *     ULONG                 iStream,
+	 *     PITEMID_CHILD         **ppelt,
+	 *     ULONG                 *nActual
+	 * )
+	 * @pre: Next has already checked the arguments and that celt > 0.
+	 */
+	template <typename FnConsume>
 	HRESULT NextInternal(
 		_In_     FnConsume     fnConsume,
 		_In_     ULONG         celt,
@@ -65,13 +122,53 @@ class ATL_NO_VTABLE CEnumIDList
 		_Out_    ULONG         *pceltFetched
 	);
 
+	// Next for just the streams, after the leading item.
+	// @pre: the object lock is held; celt > 0.
+	HRESULT NextStreams(
+		_In_     ULONG         celt,
+		_Outptr_ PITEMID_CHILD *rgelt,
+		_Out_    ULONG         *pceltFetched
+	);
+
+	// Take the snapshot if it hasn't been taken yet, or wait for the producer
+	// to take it and stop it.
+	// @pre: the object lock is held.
+	HRESULT EnsureSnapshot();
+
+	// How long until the deadline: INFINITE if there isn't one, 0 if it's
+	// passed.
+	DWORD RemainingMs() const;
+
+	// Give up on the producer and remember the volume kept us waiting.
+	// @pre: the object lock is held.
+	void OnDeadline();
+
 	// A sentinel COM object to represent the lifetime of the owner object.
 	// This exists to prevent the owner object from being freed before this one.
 	CComPtr<IUnknown> m_punkOwner;
 
 	PWSTR m_pszPath;  // path on which to find streams
-	HANDLE m_hFinder;
-	ULONG m_nTotalFetched;  // just to bring a clone up to speed
+	// The whole stream list, taken on the first call to Next/Skip/Clone and
+	// shared with any clones. Skip, Reset and Clone only move m_iCursor.
+	CComPtr<CStreamSnapshot> m_pSnapshot;
+	// The cursor and everything below it are guarded by the object lock,
+	// since Explorer may call Next and Skip from different threads.
+	ULONG m_iCursor;  // index of the next stream in the snapshot to return
+	// Only while enumerating asynchronously; m_pSnapshot is NULL until it's
+	// stopped.
+	CComPtr<CEnumProducer> m_pProducer;
+	bool m_bFillBatches;
+	bool m_bHasDeadline;
+	DWORD m_dwDeadline;  // GetTickCount() value; only if m_bHasDeadline
+	// Once set, there's no snapshot and never will be
+	bool m_bTimedOut;
+	// Owned
+	PITEMID_CHILD m_apidlcLead[cLeadMax];
+	ULONG m_cLead;
+	ULONG m_iLead;  // index of the next leading item to return
+
+	static volatile LONG64 m_cDeadlineHits;
+	static volatile LONG64 m_cCancellations;
 };
 
 }  // namespace ADSX
@@ -0,0 +1,217 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "EnumProducer.h"
+
+#include <new>
+
+#include "ADSXItem.h"
+#include "ModuleThread.h"
+#include "StreamCache.h"
+
+// Debug log prefix for CEnumProducer
+#define P_EP L"ADSX::CEnumProducer(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+// Don't wake the consumer for every single item, just often enough that the
+// view keeps moving.
+static constexpr ULONG cItemsPerWake = 32;
+
+
+CEnumProducer::CEnumProducer()
+	: m_cRef(1)
+	, m_pszPath(NULL)
+	, m_hrResult(S_OK)
+	, m_bFinished(false)
+	, m_bCancel(false) {}
+
+CEnumProducer::~CEnumProducer() {
+	// Nobody's left on either side of the queue, so whatever is still in it
+	// is ours to free.
+	PITEMID_CHILD pidlc;
+	while (m_queue.TryPop(&pidlc)) CoTaskMemFree(pidlc);
+	if (m_pszPath != NULL) SysFreeString(m_pszPath);
+}
+
+
+ULONG CEnumProducer::AddRef() {
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CEnumProducer::Release() {
+	const ULONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0) delete this;
+	return cRef;
+}
+
+
+HRESULT CEnumProducer::Start(
+	_In_         PCWSTR        pszPath,
+	_COM_Outptr_ CEnumProducer **ppProducer
+) {
+	if (ppProducer == NULL) return E_POINTER;
+	*ppProducer = NULL;
+
+	auto pProducer = new (std::nothrow) CEnumProducer();
+	if (pProducer == NULL) return E_OUTOFMEMORY;
+	defer({ if (pProducer != NULL) pProducer->Release(); });
+
+	pProducer->m_pszPath = SysAllocString(pszPath);
+	if (pProducer->m_pszPath == NULL) return E_OUTOFMEMORY;
+	pProducer->m_hItemsReady.Attach(CreateEventW(NULL, FALSE, FALSE, NULL));
+	pProducer->m_hSpaceFreed.Attach(CreateEventW(NULL, FALSE, FALSE, NULL));
+	pProducer->m_hFinished.Attach(CreateEventW(NULL, TRUE, FALSE, NULL));
+	if (
+		pProducer->m_hItemsReady == NULL ||
+		pProducer->m_hSpaceFreed == NULL ||
+		pProducer->m_hFinished == NULL
+	) {
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	// The thread's own reference; the DLL is held by CreateModuleThread
+	pProducer->AddRef();
+	HANDLE hThread = CreateModuleThread(&CEnumProducer::ThreadProc, pProducer);
+	if (hThread == NULL) {
+		const DWORD dwError = GetLastError();
+		pProducer->Release();
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	pProducer->m_hThread.Attach(hThread);
+
+	*ppProducer = pProducer;
+	pProducer = NULL;
+	return S_OK;
+}
+
+
+DWORD WINAPI CEnumProducer::ThreadProc(_In_ LPVOID pvProducer) {
+	auto pProducer = static_cast<CEnumProducer *>(pvProducer);
+	pProducer->Produce();
+	pProducer->Release();
+	ExitModuleThread(0);
+}
+
+
+void CEnumProducer::Produce() {
+	LOG(P_EP << L"Produce(" << m_pszPath << L")");
+	// Leave the foreground to Explorer's UI thread
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+	HRESULT hr = CStreamCache::Instance().GetListing(m_pszPath, &m_pSnapshot);
+	if (SUCCEEDED(hr)) {
+		const CStreamSnapshot &snapshot = *m_pSnapshot;
+		for (ULONG i = 0; i < snapshot.Count(); i++) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(
+				snapshot.Name(i),
+				snapshot.NameLength(i),
+				snapshot.Size(i)
+			);
+			if (pidlc == NULL) {
+				hr = E_OUTOFMEMORY;
+				break;
+			}
+			if (!Push(pidlc)) {
+				LOG(P_EP << L"Produce(): cancelled after " << i << L" items");
+				break;
+			}
+			if (i % cItemsPerWake == 0) SetEvent(m_hItemsReady);
+		}
+	} else {
+		LOG(P_EP << L"Produce(): " << HRESULTToString(hr));
+	}
+
+	m_hrResult = hr;
+	m_bFinished.store(true, std::memory_order_release);
+	SetEvent(m_hItemsReady);
+	SetEvent(m_hFinished);
+}
+
+
+bool CEnumProducer::Push(_In_ PITEMID_CHILD pidlc) {
+	while (!m_queue.TryPush(pidlc)) {
+		if (m_bCancel.load(std::memory_order_acquire)) {
+			CoTaskMemFree(pidlc);
+			return false;
+		}
+		// Full. Make sure the consumer knows, then wait for it to take some.
+		SetEvent(m_hItemsReady);
+		WaitForSingleObject(m_hSpaceFreed, INFINITE);
+	}
+	return !m_bCancel.load(std::memory_order_acquire);
+}
+
+
+HRESULT CEnumProducer::Pop(
+	_In_                                 ULONG         celt,
+	_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+	_Out_                                ULONG         *pceltFetched,
+	_In_                                 DWORD         dwTimeoutMs
+) {
+	const DWORD dwStart = GetTickCount();
+	ULONG nActual = 0;
+	for (;;) {
+		// Check before popping: if it's finished now, then everything it
+		// ever pushed is already visible.
+		const bool bFinished = m_bFinished.load(std::memory_order_acquire);
+		while (nActual < celt && m_queue.TryPop(&rgelt[nActual])) ++nActual;
+		if (nActual > 0) {
+			SetEvent(m_hSpaceFreed);
+			*pceltFetched = nActual;
+			return S_OK;
+		}
+		if (bFinished) {
+			*pceltFetched = 0;
+			return FAILED(m_hrResult) ? m_hrResult : S_FALSE;
+		}
+		DWORD dwWaitMs = INFINITE;
+		if (dwTimeoutMs != INFINITE) {
+			const DWORD dwElapsed = GetTickCount() - dwStart;
+			dwWaitMs = dwElapsed < dwTimeoutMs ? dwTimeoutMs - dwElapsed : 0;
+		}
+		if (WaitForSingleObject(m_hItemsReady, dwWaitMs) == WAIT_TIMEOUT) {
+			*pceltFetched = 0;
+			return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+		}
+	}
+}
+
+
+void CEnumProducer::Cancel() {
+	m_bCancel.store(true, std::memory_order_release);
+	SetEvent(m_hSpaceFreed);
+	if (!IsFinished()) {
+		// Does nothing if the thread isn't in the middle of any I/O. If it's
+		// between calls right now, it'll see m_bCancel before it gets far.
+		CancelSynchronousIo(m_hThread);
+	}
+}
+
+
+HRESULT CEnumProducer::Stop(
+	_COM_Outptr_result_maybenull_ CStreamSnapshot **ppSnapshot,
+	_In_                          DWORD           dwTimeoutMs
+) {
+	*ppSnapshot = NULL;
+	// Let it finish the snapshot; only the items after that are wasted work
+	m_bCancel.store(true, std::memory_order_release);
+	SetEvent(m_hSpaceFreed);
+	if (WaitForSingleObject(m_hFinished, dwTimeoutMs) == WAIT_TIMEOUT) {
+		Cancel();
+		return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+	}
+	PITEMID_CHILD pidlc;
+	while (m_queue.TryPop(&pidlc)) CoTaskMemFree(pidlc);
+	if (m_pSnapshot == NULL) return m_hrResult;
+	*ppSnapshot = m_pSnapshot;
+	(*ppSnapshot)->AddRef();
+	// Running out of memory making items doesn't matter anymore; the caller
+	// is going to make its own from the snapshot.
+	return S_OK;
+}
+
+}  // namespace ADSX
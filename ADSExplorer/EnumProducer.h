@@ -0,0 +1,109 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The background half of an asynchronous CEnumIDList: takes the stream
+ * snapshot and makes the item IDs on a thread of its own, handing them over
+ * as they're ready.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <atomic>
+
+#include "SpscQueue.h"
+#include "StreamSnapshot.h"
+
+namespace ADSX {
+
+
+class CEnumProducer {
+  public:
+	// How many finished item IDs can be waiting before the producer waits
+	static constexpr SIZE_T cQueued = 256;
+
+	/**
+	 * Start producing the items for the streams of the object at pszPath.
+	 * @post: *ppProducer has a reference count of 1 for the caller to Release.
+	 *        The thread holds its own reference until it's done.
+	 */
+	static HRESULT Start(
+		_In_         PCWSTR        pszPath,
+		_COM_Outptr_ CEnumProducer **ppProducer
+	);
+
+	// Shared by refcount like a COM object so CComPtr can hold one,
+	// but it's not one.
+	ULONG AddRef();
+	ULONG Release();
+
+	/**
+	 * Take up to celt of the items that are ready, waiting up to dwTimeoutMs
+	 * only if there aren't any yet.
+	 * Returns S_OK with at least one item, S_FALSE with none if the producer
+	 * is done and everything has been taken, HRESULT_FROM_WIN32(ERROR_TIMEOUT)
+	 * with none if nothing came in time, or whatever stopped the producer.
+	 * @pre: only ever called from one thread at a time (it's the consumer).
+	 * @post: rgelt[0..*pceltFetched) are the caller's to CoTaskMemFree.
+	 */
+	HRESULT Pop(
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched,
+		_In_                                 DWORD         dwTimeoutMs
+	);
+
+	/**
+	 * Have the producer quit making items, wait for the snapshot and throw
+	 * away whatever was waiting in the queue. Items come out in snapshot
+	 * order, so the caller can carry on from the snapshot at however many it
+	 * took with Pop.
+	 * If the snapshot isn't in within dwTimeoutMs, the producer is cancelled
+	 * and this gives up with HRESULT_FROM_WIN32(ERROR_TIMEOUT).
+	 * @post: *ppSnapshot has a reference for the caller to Release, or is NULL
+	 *        if the snapshot couldn't be taken.
+	 */
+	HRESULT Stop(
+		_COM_Outptr_result_maybenull_ CStreamSnapshot **ppSnapshot,
+		_In_                          DWORD           dwTimeoutMs
+	);
+
+	/**
+	 * Tell the producer to quit without waiting for it. I/O it's stuck in
+	 * (a server that isn't answering) is cancelled too.
+	 */
+	void Cancel();
+
+	// Whether the producer has quit, for whatever reason.
+	bool IsFinished() const {
+		return m_bFinished.load(std::memory_order_acquire);
+	}
+
+  protected:
+	CEnumProducer();
+	~CEnumProducer();
+
+	static DWORD WINAPI ThreadProc(_In_ LPVOID pvProducer);
+	void Produce();
+	// @post: false if cancelled first; pidlc is freed in that case.
+	bool Push(_In_ PITEMID_CHILD pidlc);
+
+	volatile LONG m_cRef;
+	PWSTR m_pszPath;
+
+	CSpscQueue<PITEMID_CHILD, cQueued> m_queue;
+
+	// Written by the producer before m_bFinished; read by the consumer after.
+	CComPtr<CStreamSnapshot> m_pSnapshot;
+	HRESULT m_hrResult;
+
+	std::atomic<bool> m_bFinished;
+	std::atomic<bool> m_bCancel;
+	CHandle m_hItemsReady;  // auto-reset; producer -> consumer
+	CHandle m_hSpaceFreed;  // auto-reset; consumer -> producer
+	CHandle m_hFinished;    // manual-reset; set along with m_bFinished
+	CHandle m_hThread;      // to cancel its I/O
+};
+
+}  // namespace ADSX
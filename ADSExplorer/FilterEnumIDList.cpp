@@ -0,0 +1,94 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "FilterEnumIDList.h"
+
+#include <string>
+#include <vector>
+
+// Debug log prefix for CFilterEnumIDList
+#define P_FEIDL L"ADSX::CFilterEnumIDList(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CFilterEnumIDList::CFilterEnumIDList() {
+	LOG(P_FEIDL << L"CFilterEnumIDList()");
+}
+
+CFilterEnumIDList::~CFilterEnumIDList() {
+	LOG(P_FEIDL << L"~CFilterEnumIDList()");
+}
+
+HRESULT CFilterEnumIDList::Init(
+	_In_ IUnknown      *punkOwner,
+	_In_ IShellFolder  *psf,
+	_In_ CStreamFilter *pFilter,
+	_In_ bool          bFillBatches,
+	_In_ DWORD         dwTimeoutMs
+) {
+	LOG(P_FEIDL << L"Init()");
+	m_psf = psf;
+	m_pFilter = pFilter;
+	InitScan(punkOwner, pFilter, bFillBatches, dwTimeoutMs);
+	return WrapReturn(S_OK);
+}
+
+
+HRESULT CFilterEnumIDList::Fetch(
+	_In_                                 ULONG         iFirst,
+	_In_                                 ULONG         celt,
+	_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+	_Out_                                ULONG         *pceltFetched,
+	_Out_                                ULONG         *pcUsed,
+	_In_                                 DWORD         dwTimeoutMs
+) {
+	*pceltFetched = 0;
+	*pcUsed = 0;
+	std::vector<std::wstring> names;
+	HRESULT hr = m_pFilter->Get(iFirst, celt, &names, dwTimeoutMs);
+	*pcUsed = static_cast<ULONG>(names.size());
+	ULONG nActual = 0;
+	for (std::wstring &sName : names) {
+		// The inner folder's own ID for it, so the view treats it like it
+		// would in the folder itself
+		PIDLIST_RELATIVE pidlr = NULL;
+		HRESULT hrParse = m_psf->ParseDisplayName(
+			NULL, NULL, &sName[0], NULL, &pidlr, NULL
+		);
+		if (FAILED(hrParse)) {
+			// Gone since it was probed; leave it out
+			LOG(P_FEIDL << L"Fetch(): " << sName << L": " <<
+				HRESULTToString(hrParse));
+			continue;
+		}
+		if (!ILIsChild(pidlr)) {
+			CoTaskMemFree(pidlr);
+			continue;
+		}
+		rgelt[nActual++] = static_cast<PITEMID_CHILD>(pidlr);
+	}
+	*pceltFetched = nActual;
+	return hr;
+}
+
+
+HRESULT CFilterEnumIDList::CreateClone(_COM_Outptr_ CScanEnumIDList **ppClone) {
+	*ppClone = NULL;
+	CComObject<CFilterEnumIDList> *pEnumNew;
+	HRESULT hr = CComObject<CFilterEnumIDList>::CreateInstance(&pEnumNew);
+	if (FAILED(hr)) return hr;
+	pEnumNew->AddRef();
+	hr = pEnumNew->Init(m_punkOwner, m_psf, m_pFilter, m_bFillBatches, INFINITE);
+	if (FAILED(hr)) {
+		pEnumNew->Release();
+		return hr;
+	}
+	*ppClone = pEnumNew;
+	return S_OK;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,55 @@
+/**
+ * 2024 Nate Kean
+ *
+ * An enumerator over the children of a folder that a CStreamFilter finds to
+ * have streams, for the pseudofolder that lists only those.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ScanEnumIDList.h"
+#include "StreamFilter.h"
+
+namespace ADSX {
+
+
+class ATL_NO_VTABLE CFilterEnumIDList : public CScanEnumIDList {
+  public:
+	CFilterEnumIDList();
+	virtual ~CFilterEnumIDList();
+
+	/**
+	 * Enumerate what pFilter finds, as it finds it, as psf's own items, so
+	 * everything else about them can be left to psf. See
+	 * CScanEnumIDList::InitScan about bFillBatches and dwTimeoutMs.
+	 * @pre: pFilter is filtering the folder psf is bound to.
+	 * @post: pFilter is AddRef'd, and counts this as one of its consumers.
+	 */
+	HRESULT Init(
+		_In_ IUnknown      *pUnkOwner,
+		_In_ IShellFolder  *psf,
+		_In_ CStreamFilter *pFilter,
+		_In_ bool          bFillBatches,
+		_In_ DWORD         dwTimeoutMs
+	);
+
+  protected:
+	// psf's items for the names the filter found. Names of children that
+	// have gone since they were probed are used up without making items.
+	HRESULT Fetch(
+		_In_                                 ULONG         iFirst,
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched,
+		_Out_                                ULONG         *pcUsed,
+		_In_                                 DWORD         dwTimeoutMs
+	) override;
+	HRESULT CreateClone(_COM_Outptr_ CScanEnumIDList **ppClone) override;
+
+	CComPtr<IShellFolder> m_psf;
+	CComPtr<CStreamFilter> m_pFilter;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,140 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "IndexFile.h"
+
+#include <utility>
+
+namespace ADSX {
+
+
+HRESULT IndexFilePath(_In_ PCWSTR pszName, _Out_ std::wstring *psPath) {
+	PWSTR pszLocalAppData;
+	HRESULT hr = SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &pszLocalAppData);
+	if (FAILED(hr)) return hr;
+	defer({ CoTaskMemFree(pszLocalAppData); });
+	const std::wstring sDirectory = std::wstring(pszLocalAppData) + L"\\ADSExplorer\\Index";
+	const int iCreated = SHCreateDirectoryExW(NULL, sDirectory.c_str(), NULL);
+	if (iCreated != ERROR_SUCCESS && iCreated != ERROR_ALREADY_EXISTS) {
+		return HRESULT_FROM_WIN32(iCreated);
+	}
+	*psPath = sDirectory + L'\\' + pszName;
+	return S_OK;
+}
+
+
+HRESULT WriteIndexTemp(_In_ const std::wstring &sPath, _In_ const std::vector<unsigned char> &bytes) {
+	std::wstring sTemp;
+	try {
+		sTemp = sPath + L".tmp";
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	CHandle hTemp(CreateFileW(
+		sTemp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NOT_CONTENT_INDEXED, NULL
+	));
+	if (hTemp == INVALID_HANDLE_VALUE) {
+		hTemp.Detach();
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	SIZE_T ib = 0;
+	while (ib < bytes.size()) {
+		const DWORD cbWrite = static_cast<DWORD>(min(bytes.size() - ib, static_cast<SIZE_T>(64 * 1024 * 1024)));
+		DWORD cbWritten;
+		if (!::WriteFile(hTemp, &bytes[ib], cbWrite, &cbWritten, NULL)) {
+			const DWORD dwError = GetLastError();
+			LOG(L" ** Couldn't write " << sTemp << L": " << dwError);
+			hTemp.Close();
+			DeleteFileW(sTemp.c_str());
+			return HRESULT_FROM_WIN32(dwError);
+		}
+		ib += cbWritten;
+	}
+	if (!FlushFileBuffers(hTemp)) LOG(L" ** Couldn't flush " << sTemp << L": " << GetLastError());
+	return S_OK;
+}
+
+
+HRESULT ReplaceIndexFile(_In_ const std::wstring &sPath) {
+	std::wstring sTemp;
+	try {
+		sTemp = sPath + L".tmp";
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	if (!MoveFileExW(sTemp.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		const DWORD dwError = GetLastError();
+		LOG(L" ** Couldn't move " << sTemp << L" into place: " << dwError);
+		DeleteFileW(sTemp.c_str());
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	return S_OK;
+}
+
+
+CMappedFile::CMappedFile()
+	: m_hFile(INVALID_HANDLE_VALUE)
+	, m_hMapping(NULL)
+	, m_pvView(NULL)
+	, m_cb(0) {}
+
+CMappedFile::~CMappedFile() {
+	Unmap();
+}
+
+
+HRESULT CMappedFile::Map(_In_ PCWSTR pszPath) {
+	HANDLE hFile = CreateFileW(
+		pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL
+	);
+	if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	LARGE_INTEGER liSize;
+	if (!GetFileSizeEx(hFile, &liSize) || liSize.QuadPart == 0) {
+		CloseHandle(hFile);
+		return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+	}
+	HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL) {
+		const DWORD dwError = GetLastError();
+		CloseHandle(hFile);
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	const void *pvView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (pvView == NULL) {
+		const DWORD dwError = GetLastError();
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	m_hFile = hFile;
+	m_hMapping = hMapping;
+	m_pvView = pvView;
+	m_cb = static_cast<SIZE_T>(liSize.QuadPart);
+	return S_OK;
+}
+
+
+void CMappedFile::Unmap() {
+	if (m_pvView != NULL) UnmapViewOfFile(m_pvView);
+	if (m_hMapping != NULL) CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+	m_pvView = NULL;
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_cb = 0;
+}
+
+
+void CMappedFile::Swap(_Inout_ CMappedFile &other) {
+	std::swap(m_hFile, other.m_hFile);
+	std::swap(m_hMapping, other.m_hMapping);
+	std::swap(m_pvView, other.m_pvView);
+	std::swap(m_cb, other.m_cb);
+}
+
+}  // namespace ADSX
@@ -0,0 +1,60 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The files the indexes (StreamIndex.h, TrigramIndex.h) are kept in, under
+ * %LOCALAPPDATA%\ADSExplorer\Index. Each is answered from straight out of a
+ * read-only mapping, and replaced whole, so a crash partway through writing
+ * one leaves the old one as it was.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+#include <vector>
+
+namespace ADSX {
+
+/**
+ * Where the index file called pszName goes, making the folder if it isn't
+ * there yet.
+ * @post: may throw std::bad_alloc.
+ */
+HRESULT IndexFilePath(_In_ PCWSTR pszName, _Out_ std::wstring *psPath);
+
+/**
+ * Write bytes to sPath + ".tmp" and flush it, ready to be moved over sPath
+ * with ReplaceIndexFile once nothing has sPath mapped.
+ * @post: on failure there's no temporary file left behind.
+ */
+HRESULT WriteIndexTemp(_In_ const std::wstring &sPath, _In_ const std::vector<unsigned char> &bytes);
+
+// Move what WriteIndexTemp wrote over sPath.
+HRESULT ReplaceIndexFile(_In_ const std::wstring &sPath);
+
+
+// A whole file mapped to read. Queries only touch the pages they need.
+class CMappedFile {
+  public:
+	CMappedFile();
+	~CMappedFile();
+	CMappedFile(const CMappedFile &) = delete;
+	CMappedFile &operator=(const CMappedFile &) = delete;
+
+	// @pre: nothing is mapped yet.
+	HRESULT Map(_In_ PCWSTR pszPath);
+	void Unmap();
+	void Swap(_Inout_ CMappedFile &other);
+
+	const void *Data() const { return m_pvView; }
+	SIZE_T Size() const { return m_cb; }
+
+  protected:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const void *m_pvView;
+	SIZE_T m_cb;
+};
+
+}  // namespace ADSX
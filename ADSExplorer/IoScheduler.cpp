@@ -0,0 +1,194 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "IoScheduler.h"
+
+#include <Shlwapi.h>  // PathIsUNCW, PathStripToRootW
+#include <winioctl.h>
+
+#include <string>
+
+#include "Settings.h"
+#include "Volume.h"
+
+namespace ADSX {
+
+
+CIoScheduler &CIoScheduler::Instance() {
+	// Thread-safe on first use ("magic statics")
+	static CIoScheduler scheduler;
+	return scheduler;
+}
+
+
+CIoScheduler::CTicket CIoScheduler::Acquire(
+	_In_     PCWSTR                  pszPath,
+	_In_     IoPriority              priority,
+	_In_opt_ const std::atomic<bool> *pbCancel
+) {
+	return QueueFor(pszPath).Acquire(priority, pbCancel);
+}
+
+
+// "C:\" or "\\server\share\" from a full path, without any I/O. Asked on
+// every request, so unlike CVolumeCache this doesn't look for volumes
+// mounted in folders; those take turns with the drive they're under.
+// @post: empty if pszPath isn't a path of either kind.
+static std::wstring DriveOrShareOf(_In_ PCWSTR pszPath) {
+	std::wstring sRoot = WithoutExtendedPrefix(pszPath);
+	if (sRoot.empty()) return sRoot;
+	// Works on the copy; stops at "C:\" or "\\server\share"
+	if (!PathStripToRootW(&sRoot[0])) return std::wstring();
+	sRoot.resize(wcslen(sRoot.c_str()));
+	if (sRoot.back() != L'\\') sRoot += L'\\';
+	return sRoot;
+}
+
+
+CDeviceQueue &CIoScheduler::QueueFor(_In_ PCWSTR pszPath) {
+	return QueueOf(DriveOrShareOf(pszPath));
+}
+
+
+CDeviceQueue &CIoScheduler::QueueOf(_In_ const std::wstring &sRoot) {
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+		auto it = m_volumes.find(sRoot);
+		if (it != m_volumes.end()) return *it->second;
+	}
+
+	// Two threads asking about a new volume at once both ask it, which is
+	// harmless; the first one in wins.
+	std::wstring sDevice;
+	const DeviceKind kind = Identify(sRoot, &sDevice);
+
+	CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+	auto itVolume = m_volumes.find(sRoot);
+	if (itVolume != m_volumes.end()) return *itVolume->second;
+	auto itDevice = m_devices.find(sDevice);
+	if (itDevice == m_devices.end()) {
+		Device device;
+		device.kind = kind;
+		device.pQueue.reset(new CDeviceQueue(LimitFor(kind)));
+		itDevice = m_devices.emplace(sDevice, std::move(device)).first;
+		LOG(L" ** I/O device " << sDevice << L" (" << static_cast<int>(kind) << L"): " <<
+			LimitFor(kind) << L" at once");
+	}
+	CDeviceQueue *pQueue = itDevice->second.pQueue.get();
+	m_volumes.emplace(sRoot, pQueue);
+	return *pQueue;
+}
+
+
+CIoScheduler::DeviceKind CIoScheduler::Identify(
+	_In_  const std::wstring &sRoot,
+	_Out_ std::wstring       *psDevice
+) {
+	*psDevice = sRoot;
+	if (sRoot.empty()) return DeviceKind::Unknown;
+
+	// Everything on one server shares its link
+	if (PathIsUNCW(sRoot.c_str())) {
+		const SIZE_T ichShare = sRoot.find(L'\\', 2);
+		*psDevice = sRoot.substr(0, ichShare);
+		return DeviceKind::Remote;
+	}
+	if (GetDriveTypeW(sRoot.c_str()) == DRIVE_REMOTE) return DeviceKind::Remote;
+	if (sRoot.size() < 2 || sRoot[1] != L':') return DeviceKind::Unknown;
+
+	// No access needed for these; just the handle
+	const WCHAR szVolume[] = {L'\\', L'\\', L'.', L'\\', sRoot[0], L':', L'\0'};
+	CHandle hVolume(CreateFileW(
+		szVolume, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, 0, NULL
+	));
+	if (hVolume == INVALID_HANDLE_VALUE) {
+		hVolume.Detach();
+		return DeviceKind::Unknown;
+	}
+
+	// Volumes on the same disk take turns with each other too. One that
+	// spans disks doesn't have a number, and gets a queue of its own.
+	STORAGE_DEVICE_NUMBER number;
+	DWORD cbReturned;
+	if (DeviceIoControl(
+		hVolume, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0,
+		&number, sizeof(number), &cbReturned, NULL
+	)) {
+		*psDevice = L"PhysicalDrive" + std::to_wstring(number.DeviceNumber);
+	}
+
+	STORAGE_PROPERTY_QUERY query = {};
+	query.PropertyId = StorageDeviceSeekPenaltyProperty;
+	query.QueryType = PropertyStandardQuery;
+	DEVICE_SEEK_PENALTY_DESCRIPTOR seekPenalty = {};
+	if (!DeviceIoControl(
+		hVolume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+		&seekPenalty, sizeof(seekPenalty), &cbReturned, NULL
+	)) {
+		return DeviceKind::Unknown;
+	}
+	if (seekPenalty.IncursSeekPenalty) return DeviceKind::Rotational;
+
+	query.PropertyId = StorageAdapterProperty;
+	STORAGE_ADAPTER_DESCRIPTOR adapter = {};
+	if (
+		DeviceIoControl(
+			hVolume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+			&adapter, sizeof(adapter), &cbReturned, NULL
+		) &&
+		adapter.BusType == BusTypeNvme
+	) {
+		return DeviceKind::Nvme;
+	}
+	return DeviceKind::SolidState;
+}
+
+
+unsigned CIoScheduler::LimitFor(_In_ DeviceKind kind) {
+	const CSettings &settings = CSettings::Get();
+	switch (kind) {
+		case DeviceKind::Rotational: return settings.cIoLimitRotational;
+		case DeviceKind::SolidState: return settings.cIoLimitSolidState;
+		case DeviceKind::Nvme: return settings.cIoLimitNvme;
+		case DeviceKind::Remote: return settings.cIoLimitRemote;
+		default: return settings.cIoLimitUnknown;
+	}
+}
+
+
+std::vector<CIoScheduler::DeviceStats> CIoScheduler::GetStats() const {
+	std::vector<DeviceStats> stats;
+	CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+	for (const auto &entry : m_devices) {
+		stats.push_back(DeviceStats{entry.first, entry.second.kind, entry.second.pQueue->GetStats()});
+	}
+	return stats;
+}
+
+
+void CIoScheduler::LogStats() const {
+#ifdef _DEBUG
+	for (const DeviceStats &device : GetStats()) {
+		const CDeviceQueue::Stats &stats = device.stats;
+		LOG(L" ** I/O " << device.sDevice << std::dec <<
+			L": " << stats.cInFlight << L"/" << stats.cLimit << L" in flight, " <<
+			stats.foreground.cWaiting << L"+" << stats.background.cWaiting << L" waiting, " <<
+			L"deepest " << stats.cMaxQueueDepth << L"; " <<
+			L"foreground " << stats.foreground.cCompleted << L" done, " <<
+			stats.foreground.AverageWaitMs() << L" ms wait, " <<
+			stats.foreground.AverageServiceMs() << L" ms service (p99 " <<
+			stats.foreground.ServicePercentileMs(0.99) << L"); " <<
+			L"background " << stats.background.cCompleted << L" done, " <<
+			stats.background.AverageWaitMs() << L" ms wait, " <<
+			stats.background.AverageServiceMs() << L" ms service (p99 " <<
+			stats.background.ServicePercentileMs(0.99) << L"), " <<
+			stats.cPreempted << L" passed over");
+	}
+#endif
+}
+
+}  // namespace ADSX
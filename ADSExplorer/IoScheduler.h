@@ -0,0 +1,110 @@
+/**
+ * 2024 Nate Kean
+ *
+ * One CDeviceQueue per physical disk or file server, for everything this
+ * process asks of the filesystem about streams: scans in the background,
+ * views in the foreground. What kind of device a volume is on (spinning,
+ * solid state, NVMe, network) decides how many requests it gets at once.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DeviceQueue.h"
+
+namespace ADSX {
+
+
+class CIoScheduler {
+  public:
+	enum class DeviceKind { Unknown, Rotational, SolidState, Nvme, Remote };
+
+	struct DeviceStats {
+		std::wstring sDevice;  // "PhysicalDrive0", "\\server", or a volume root
+		DeviceKind kind;
+		CDeviceQueue::Stats stats;
+	};
+
+	using CTicket = CDeviceQueue::CTicket;
+
+	// The one for this process
+	static CIoScheduler &Instance();
+
+	/**
+	 * Wait for a turn at the device the object at pszPath is on. Hold the
+	 * ticket for as long as the request is in flight.
+	 * The first request for a volume finds out what it's on, which costs a
+	 * couple of IOCTLs; after that it's a lookup.
+	 * @post: returns an empty ticket if *pbCancel became true first.
+	 * @post: may throw std::bad_alloc.
+	 */
+	CTicket Acquire(
+		_In_     PCWSTR                  pszPath,
+		_In_     IoPriority              priority,
+		_In_opt_ const std::atomic<bool> *pbCancel = NULL
+	);
+
+	/**
+	 * The queue Acquire would wait in for pszPath, for something that's
+	 * going to ask for a lot of turns at the same object. Queues last as long
+	 * as the process.
+	 * @post: may throw std::bad_alloc.
+	 */
+	CDeviceQueue &QueueFor(_In_ PCWSTR pszPath);
+
+	// Every device that's been asked about, with its queue's numbers.
+	std::vector<DeviceStats> GetStats() const;
+
+	// Write GetStats() to the debug log.
+	void LogStats() const;
+
+  protected:
+	CIoScheduler() {}
+
+	struct Device {
+		DeviceKind kind;
+		std::unique_ptr<CDeviceQueue> pQueue;
+	};
+
+	// The device the volume at sRoot is on, asking it the first time.
+	// @post: may throw std::bad_alloc.
+	CDeviceQueue &QueueOf(_In_ const std::wstring &sRoot);
+
+	// What sRoot is on, and a name for it that's the same for every volume
+	// on it. Doesn't take m_cs; this is I/O.
+	static DeviceKind Identify(_In_ const std::wstring &sRoot, _Out_ std::wstring *psDevice);
+
+	static unsigned LimitFor(_In_ DeviceKind kind);
+
+	mutable CComAutoCriticalSection m_cs;
+	std::map<std::wstring, CDeviceQueue *> m_volumes;  // by root
+	std::map<std::wstring, Device> m_devices;          // by device name
+};
+
+
+/**
+ * Lowers the calling thread's I/O (and CPU) priority for as long as it's in
+ * scope, so a scan only gets the disk when nobody else wants it. Does nothing
+ * if the thread is already in background mode.
+ */
+class CBackgroundMode {
+  public:
+	CBackgroundMode()
+		: m_bEntered(SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) != FALSE) {}
+	~CBackgroundMode() {
+		if (m_bEntered) SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+	}
+	CBackgroundMode(const CBackgroundMode &) = delete;
+	CBackgroundMode &operator=(const CBackgroundMode &) = delete;
+
+  private:
+	const bool m_bEntered;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,162 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A thread-safe least-recently-used cache split into shards, each with its
+ * own lock, so threads looking up different keys rarely wait on each other.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace ADSX {
+
+
+template <
+	typename K,
+	typename V,
+	std::size_t cShards = 16,
+	typename Hash = std::hash<K>
+>
+class CShardedLruCache {
+	static_assert(cShards > 0, "need at least one shard");
+
+  public:
+	struct Stats {
+		std::uint64_t cHits;
+		std::uint64_t cMisses;
+		std::uint64_t cEvictions;
+	};
+
+	// @pre: cMaxEntries >= cShards; each shard holds an equal share.
+	explicit CShardedLruCache(std::size_t cMaxEntries)
+		: m_cMaxPerShard(cMaxEntries / cShards > 0 ? cMaxEntries / cShards : 1)
+		, m_cHits(0)
+		, m_cMisses(0)
+		, m_cEvictions(0) {}
+
+	CShardedLruCache(const CShardedLruCache &) = delete;
+	CShardedLruCache &operator=(const CShardedLruCache &) = delete;
+
+	/**
+	 * Copy out the value for key and mark it most recently used.
+	 * @post: returns false, and leaves *pValue alone, if key isn't cached.
+	 */
+	bool Find(const K &key, V *pValue) {
+		Shard &shard = ShardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.index.find(key);
+		if (it == shard.index.end()) {
+			m_cMisses.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		// Move to the front without reallocating the node
+		shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+		*pValue = it->second->second;
+		m_cHits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Add or replace the value for key, evicting the least recently used
+	// entry in its shard if the shard is full.
+	void Insert(const K &key, V value) {
+		Shard &shard = ShardOf(key);
+		// Whatever gets pushed out is destroyed after the lock is let go;
+		// V's destructor may be arbitrarily expensive.
+		std::list<std::pair<K, V>> evicted;
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.index.find(key);
+			if (it != shard.index.end()) {
+				it->second->second = std::move(value);
+				shard.entries.splice(
+					shard.entries.begin(), shard.entries, it->second
+				);
+				return;
+			}
+			if (shard.entries.size() >= m_cMaxPerShard) {
+				auto itOldest = std::prev(shard.entries.end());
+				shard.index.erase(itOldest->first);
+				evicted.splice(evicted.begin(), shard.entries, itOldest);
+				m_cEvictions.fetch_add(1, std::memory_order_relaxed);
+			}
+			shard.entries.emplace_front(key, std::move(value));
+			shard.index.emplace(key, shard.entries.begin());
+		}
+	}
+
+	// @post: returns whether there was anything to remove.
+	bool Erase(const K &key) {
+		Shard &shard = ShardOf(key);
+		std::list<std::pair<K, V>> erased;
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.index.find(key);
+			if (it == shard.index.end()) return false;
+			erased.splice(erased.begin(), shard.entries, it->second);
+			shard.index.erase(it);
+		}
+		return true;
+	}
+
+	void Clear() {
+		for (Shard &shard : m_aShards) {
+			std::list<std::pair<K, V>> cleared;
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.index.clear();
+			cleared.swap(shard.entries);
+		}
+	}
+
+	std::size_t Size() const {
+		std::size_t cEntries = 0;
+		for (const Shard &shard : m_aShards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			cEntries += shard.entries.size();
+		}
+		return cEntries;
+	}
+
+	// Good enough for tuning; the counters aren't read all at once.
+	Stats GetStats() const {
+		return Stats{
+			m_cHits.load(std::memory_order_relaxed),
+			m_cMisses.load(std::memory_order_relaxed),
+			m_cEvictions.load(std::memory_order_relaxed),
+		};
+	}
+
+  private:
+	struct Shard {
+		mutable std::mutex mutex;
+		// Most recently used first
+		std::list<std::pair<K, V>> entries;
+		std::unordered_map<
+			K,
+			typename std::list<std::pair<K, V>>::iterator,
+			Hash
+		> index;
+	};
+
+	Shard &ShardOf(const K &key) {
+		// Mix the high bits in so keys that only differ up there still spread
+		// out across the shards.
+		const std::size_t uHash = Hash()(key);
+		return m_aShards[((uHash >> 16) ^ uHash) % cShards];
+	}
+
+	const std::size_t m_cMaxPerShard;
+	Shard m_aShards[cShards];
+	std::atomic<std::uint64_t> m_cHits;
+	std::atomic<std::uint64_t> m_cMisses;
+	std::atomic<std::uint64_t> m_cEvictions;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,638 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Platform-neutral decoding of the on-disk structures of an NTFS volume: the
+ * boot sector, Master File Table (MFT) records and their update sequence
+ * fixups, attributes, FILE_NAME values, attribute lists and data runs.
+ *
+ * Everything here reads raw bytes somebody else fetched, from a volume handle
+ * or an image file, and every field is bounds-checked against the buffer it
+ * came in, since a damaged volume is exactly when someone goes looking.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "StreamInfo.h"
+
+namespace ADSX::Mft {
+
+using StreamInfo::NameChar;
+using StreamInfo::NameView;
+
+// Update sequence fixups protect every 512 bytes of a record whatever the
+// volume's sector size is.
+constexpr std::size_t cbFixupStride = 512;
+
+// Records every volume has in the same place
+constexpr std::uint64_t ullRecordMft = 0;
+constexpr std::uint64_t ullRecordRoot = 5;
+// The first record that isn't reserved for the filesystem's own use
+constexpr std::uint64_t ullRecordFirstUser = 16;
+
+// A file reference is a record number in the low 48 bits and the record's
+// sequence number in the high 16, so a reference to a record that's since
+// been freed and reused can be told apart.
+constexpr std::uint64_t RecordOf(std::uint64_t ullReference) {
+	return ullReference & 0x0000FFFFFFFFFFFFull;
+}
+constexpr std::uint16_t SequenceOf(std::uint64_t ullReference) {
+	return static_cast<std::uint16_t>(ullReference >> 48);
+}
+
+enum AttributeType : std::uint32_t {
+	ATTR_STANDARD_INFORMATION = 0x10,
+	ATTR_ATTRIBUTE_LIST = 0x20,
+	ATTR_FILE_NAME = 0x30,
+	ATTR_DATA = 0x80,
+	ATTR_END = 0xFFFFFFFF,
+};
+
+// FILE_NAME namespaces. A file with a long name that isn't a valid 8.3 name
+// has a Win32 one and a DOS one; otherwise one that's both.
+enum Namespace : std::uint8_t {
+	NS_POSIX = 0,
+	NS_WIN32 = 1,
+	NS_DOS = 2,
+	NS_WIN32_AND_DOS = 3,
+};
+
+
+enum class ReadResult {
+	Ok,         // *pOut was filled in
+	End,        // No more
+	Malformed,  // The bytes don't hold what they should; stop reading
+};
+
+
+template <typename T>
+inline T Load(const unsigned char *pb) {
+	T t;
+	std::memcpy(&t, pb, sizeof(T));
+	return t;
+}
+
+
+// -----------------------------------------------------------------------------
+// Boot sector
+//   char    OemId[8];              // at 3: "NTFS    "
+//   UINT16  BytesPerSector;        // at 0x0B
+//   UINT8   SectorsPerCluster;     // at 0x0D; over 0x80 means 2^(256 - n)
+//   UINT64  TotalSectors;          // at 0x28
+//   UINT64  MftLcn;                // at 0x30
+//   UINT64  MftMirrLcn;            // at 0x38
+//   INT8    ClustersPerRecord;     // at 0x40; negative means 2^-n bytes
+//   UINT64  SerialNumber;          // at 0x48
+constexpr std::size_t cbBootSector = 512;
+constexpr std::size_t cbOffOemId = 3;
+constexpr std::size_t cbOffBytesPerSector = 0x0B;
+constexpr std::size_t cbOffSectorsPerCluster = 0x0D;
+constexpr std::size_t cbOffTotalSectors = 0x28;
+constexpr std::size_t cbOffMftLcn = 0x30;
+constexpr std::size_t cbOffClustersPerRecord = 0x40;
+constexpr std::size_t cbOffSerialNumber = 0x48;
+
+struct Geometry {
+	std::uint32_t cbSector;
+	std::uint32_t cbCluster;
+	std::uint32_t cbRecord;
+	std::uint64_t ullTotalSectors;
+	std::uint64_t ullMftLcn;
+	std::uint64_t ullSerialNumber;
+
+	std::uint64_t VolumeSize() const { return ullTotalSectors * cbSector; }
+};
+
+inline bool IsPowerOfTwo(std::uint64_t ull) {
+	return ull != 0 && (ull & (ull - 1)) == 0;
+}
+
+/**
+ * Read the volume's layout out of its boot sector.
+ * @post: returns false if it isn't NTFS, or has sizes no NTFS would.
+ */
+inline bool ParseBootSector(const void *pBuffer, std::size_t cbBuffer, Geometry *pGeometry) {
+	if (pBuffer == nullptr || cbBuffer < cbBootSector) return false;
+	auto pb = static_cast<const unsigned char *>(pBuffer);
+	if (std::memcmp(pb + cbOffOemId, "NTFS    ", 8) != 0) return false;
+
+	const auto cbSector = Load<std::uint16_t>(pb + cbOffBytesPerSector);
+	if (!IsPowerOfTwo(cbSector) || cbSector < 256 || cbSector > 4096) return false;
+
+	const std::uint8_t bSectorsPerCluster = pb[cbOffSectorsPerCluster];
+	std::uint64_t cbCluster;
+	if (bSectorsPerCluster > 0x80) {
+		const unsigned uShift = 256 - bSectorsPerCluster;
+		if (uShift > 12) return false;
+		cbCluster = static_cast<std::uint64_t>(cbSector) << uShift;
+	} else {
+		cbCluster = static_cast<std::uint64_t>(cbSector) * bSectorsPerCluster;
+	}
+	// Up to the 2 MB clusters newer Windows allows
+	if (!IsPowerOfTwo(cbCluster) || cbCluster > 2 * 1024 * 1024) return false;
+
+	const auto cClustersPerRecord = static_cast<std::int8_t>(pb[cbOffClustersPerRecord]);
+	std::uint64_t cbRecord;
+	if (cClustersPerRecord < 0) {
+		if (cClustersPerRecord < -31) return false;
+		cbRecord = std::uint64_t(1) << -cClustersPerRecord;
+	} else {
+		cbRecord = cClustersPerRecord * cbCluster;
+	}
+	if (!IsPowerOfTwo(cbRecord) || cbRecord < 512 || cbRecord > 64 * 1024) return false;
+
+	pGeometry->cbSector = cbSector;
+	pGeometry->cbCluster = static_cast<std::uint32_t>(cbCluster);
+	pGeometry->cbRecord = static_cast<std::uint32_t>(cbRecord);
+	pGeometry->ullTotalSectors = Load<std::uint64_t>(pb + cbOffTotalSectors);
+	pGeometry->ullMftLcn = Load<std::uint64_t>(pb + cbOffMftLcn);
+	pGeometry->ullSerialNumber = Load<std::uint64_t>(pb + cbOffSerialNumber);
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// File record header
+//   char    Magic[4];              // "FILE"; "BAAD" if chkdsk found it torn
+//   UINT16  UsaOffset;             // at 0x04
+//   UINT16  UsaCount;              // at 0x06; 1 + one per 512 bytes
+//   UINT64  Lsn;                   // at 0x08
+//   UINT16  SequenceNumber;        // at 0x10
+//   UINT16  LinkCount;             // at 0x12
+//   UINT16  FirstAttributeOffset;  // at 0x14
+//   UINT16  Flags;                 // at 0x16
+//   UINT32  BytesInUse;            // at 0x18
+//   UINT32  BytesAllocated;        // at 0x1C
+//   UINT64  BaseRecord;            // at 0x20; 0 unless this is an extension
+//   UINT16  NextAttributeId;       // at 0x28
+//   UINT32  RecordNumber;          // at 0x2C (XP and later)
+constexpr std::size_t cbOffUsaOffset = 0x04;
+constexpr std::size_t cbOffUsaCount = 0x06;
+constexpr std::size_t cbOffSequenceNumber = 0x10;
+constexpr std::size_t cbOffFirstAttribute = 0x14;
+constexpr std::size_t cbOffRecordFlags = 0x16;
+constexpr std::size_t cbOffBytesInUse = 0x18;
+constexpr std::size_t cbOffBaseRecord = 0x20;
+constexpr std::size_t cbRecordHeader = 0x30;
+
+constexpr std::uint16_t RECORD_IN_USE = 0x0001;
+constexpr std::uint16_t RECORD_DIRECTORY = 0x0002;
+
+enum class FixupResult {
+	Ok,
+	Empty,  // never written; not a record at all
+	Torn,   // a sector didn't make it to the disk with the rest
+	Malformed,
+};
+
+/**
+ * Undo the update sequence: the last two bytes of every 512 were swapped
+ * for the update sequence number when the record was written, so a record
+ * only partly written can be caught, and the real bytes kept in the array.
+ * @post: on Ok, pBuffer[0..cbRecord) is the record as it was meant to be.
+ *        Otherwise it may be partly fixed up and shouldn't be used.
+ */
+inline FixupResult ApplyFixups(void *pBuffer, std::size_t cbRecord) {
+	auto pb = static_cast<unsigned char *>(pBuffer);
+	if (cbRecord < cbRecordHeader || cbRecord % cbFixupStride != 0) {
+		return FixupResult::Malformed;
+	}
+	if (std::memcmp(pb, "FILE", 4) != 0) {
+		static const unsigned char abZero[4] = {};
+		if (std::memcmp(pb, abZero, 4) == 0) return FixupResult::Empty;
+		if (std::memcmp(pb, "BAAD", 4) == 0) return FixupResult::Torn;
+		return FixupResult::Malformed;
+	}
+	const auto ibUsa = Load<std::uint16_t>(pb + cbOffUsaOffset);
+	const auto cUsa = Load<std::uint16_t>(pb + cbOffUsaCount);
+	if (cUsa != 1 + cbRecord / cbFixupStride) return FixupResult::Malformed;
+	if (ibUsa % 2 != 0 || ibUsa < cbOffBaseRecord) return FixupResult::Malformed;
+	if (ibUsa + cUsa * std::size_t(2) > cbFixupStride - 2) return FixupResult::Malformed;
+
+	const unsigned char *pbUsn = pb + ibUsa;
+	for (std::size_t i = 1; i < cUsa; i++) {
+		unsigned char *pbTail = pb + i * cbFixupStride - 2;
+		if (pbTail[0] != pbUsn[0] || pbTail[1] != pbUsn[1]) return FixupResult::Torn;
+		pbTail[0] = pbUsn[2 * i];
+		pbTail[1] = pbUsn[2 * i + 1];
+	}
+	return FixupResult::Ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// Attribute header
+//   UINT32  Type;                  // at 0x00
+//   UINT32  Length;                // at 0x04; whole attribute, 8-aligned
+//   UINT8   NonResident;           // at 0x08
+//   UINT8   NameLength;            // at 0x09; in characters
+//   UINT16  NameOffset;            // at 0x0A
+//   UINT16  Flags;                 // at 0x0C
+//   UINT16  AttributeId;           // at 0x0E
+// then, resident:
+//   UINT32  ValueLength;           // at 0x10
+//   UINT16  ValueOffset;           // at 0x14
+// or non-resident:
+//   UINT64  LowestVcn;             // at 0x10
+//   UINT64  HighestVcn;            // at 0x18
+//   UINT16  RunsOffset;            // at 0x20
+//   UINT64  AllocatedSize;         // at 0x28
+//   UINT64  DataSize;              // at 0x30
+//   UINT64  InitializedSize;       // at 0x38; past this it reads as zeros
+constexpr std::size_t cbOffAttrType = 0x00;
+constexpr std::size_t cbOffAttrLength = 0x04;
+constexpr std::size_t cbOffAttrNonResident = 0x08;
+constexpr std::size_t cbOffAttrNameLength = 0x09;
+constexpr std::size_t cbOffAttrNameOffset = 0x0A;
+constexpr std::size_t cbOffAttrFlags = 0x0C;
+constexpr std::size_t cbOffAttrId = 0x0E;
+constexpr std::size_t cbOffValueLength = 0x10;
+constexpr std::size_t cbOffValueOffset = 0x14;
+constexpr std::size_t cbResidentHeader = 0x18;
+constexpr std::size_t cbOffLowestVcn = 0x10;
+constexpr std::size_t cbOffHighestVcn = 0x18;
+constexpr std::size_t cbOffRunsOffset = 0x20;
+constexpr std::size_t cbOffAllocatedSize = 0x28;
+constexpr std::size_t cbOffDataSize = 0x30;
+constexpr std::size_t cbOffInitializedSize = 0x38;
+constexpr std::size_t cbNonResidentHeader = 0x40;
+
+constexpr std::uint16_t ATTR_FLAG_COMPRESSION_MASK = 0x00FF;
+constexpr std::uint16_t ATTR_FLAG_ENCRYPTED = 0x4000;
+constexpr std::uint16_t ATTR_FLAG_SPARSE = 0x8000;
+
+struct Attribute {
+	std::uint32_t uType;
+	std::uint16_t uId;
+	std::uint16_t uFlags;
+	bool bNonResident;
+	NameView svName;  // empty for the unnamed one; points into the record
+
+	// Resident only: the value, in the record
+	const unsigned char *pbValue;
+	std::size_t cbValue;
+
+	// Non-resident only: which part of the value this extent maps, how big
+	// the whole value is (only meaningful on the extent at VCN 0), and the
+	// runs, in the record
+	std::uint64_t ullLowestVcn;
+	std::uint64_t ullHighestVcn;
+	std::uint64_t ullAllocatedSize;
+	std::uint64_t ullDataSize;
+	std::uint64_t ullInitializedSize;
+	const unsigned char *pbRuns;
+	std::size_t cbRuns;
+
+	// The value's size, wherever it lives
+	std::uint64_t Size() const { return bNonResident ? ullDataSize : cbValue; }
+};
+
+
+/**
+ * A view of one fixed-up file record.
+ * @pre: the buffer outlives the record and everything read out of it.
+ */
+class CRecord {
+  public:
+	CRecord(const void *pBuffer, std::size_t cbRecord)
+		: m_pb(static_cast<const unsigned char *>(pBuffer))
+		, m_cb(cbRecord) {}
+
+	std::uint16_t Flags() const { return Load<std::uint16_t>(m_pb + cbOffRecordFlags); }
+	bool InUse() const { return Flags() & RECORD_IN_USE; }
+	bool IsDirectory() const { return Flags() & RECORD_DIRECTORY; }
+	std::uint16_t Sequence() const { return Load<std::uint16_t>(m_pb + cbOffSequenceNumber); }
+	// The record this one holds overflow attributes for, or 0 if it's a
+	// base record itself
+	std::uint64_t BaseReference() const { return Load<std::uint64_t>(m_pb + cbOffBaseRecord); }
+
+	/**
+	 * Walks the record's attributes in order.
+	 */
+	class CAttributeReader {
+	  public:
+		ReadResult Next(Attribute *pAttribute) {
+			if (m_bDone) return ReadResult::End;
+			if (m_ibCursor > m_cbInUse || m_cbInUse - m_ibCursor < 8) return Fail();
+			const unsigned char *pbAttr = m_pb + m_ibCursor;
+			const auto uType = Load<std::uint32_t>(pbAttr + cbOffAttrType);
+			if (uType == ATTR_END) {
+				m_bDone = true;
+				return ReadResult::End;
+			}
+			const auto cbAttr = Load<std::uint32_t>(pbAttr + cbOffAttrLength);
+			if (cbAttr < cbResidentHeader || cbAttr % 8 != 0) return Fail();
+			if (cbAttr > m_cbInUse - m_ibCursor) return Fail();
+
+			pAttribute->uType = uType;
+			pAttribute->uId = Load<std::uint16_t>(pbAttr + cbOffAttrId);
+			pAttribute->uFlags = Load<std::uint16_t>(pbAttr + cbOffAttrFlags);
+			pAttribute->bNonResident = pbAttr[cbOffAttrNonResident] != 0;
+
+			const std::size_t cchName = pbAttr[cbOffAttrNameLength];
+			const auto ibName = Load<std::uint16_t>(pbAttr + cbOffAttrNameOffset);
+			if (cchName == 0) {
+				pAttribute->svName = NameView();
+			} else {
+				if (ibName % alignof(NameChar) != 0) return Fail();
+				if (ibName > cbAttr || cchName * sizeof(NameChar) > cbAttr - ibName) {
+					return Fail();
+				}
+				pAttribute->svName = NameView(
+					reinterpret_cast<const NameChar *>(pbAttr + ibName), cchName
+				);
+			}
+
+			pAttribute->pbValue = nullptr;
+			pAttribute->cbValue = 0;
+			pAttribute->ullLowestVcn = 0;
+			pAttribute->ullHighestVcn = 0;
+			pAttribute->ullAllocatedSize = 0;
+			pAttribute->ullDataSize = 0;
+			pAttribute->ullInitializedSize = 0;
+			pAttribute->pbRuns = nullptr;
+			pAttribute->cbRuns = 0;
+			if (pAttribute->bNonResident) {
+				if (cbAttr < cbNonResidentHeader) return Fail();
+				const auto ibRuns = Load<std::uint16_t>(pbAttr + cbOffRunsOffset);
+				if (ibRuns > cbAttr) return Fail();
+				pAttribute->ullLowestVcn = Load<std::uint64_t>(pbAttr + cbOffLowestVcn);
+				pAttribute->ullHighestVcn = Load<std::uint64_t>(pbAttr + cbOffHighestVcn);
+				pAttribute->ullAllocatedSize = Load<std::uint64_t>(pbAttr + cbOffAllocatedSize);
+				pAttribute->ullDataSize = Load<std::uint64_t>(pbAttr + cbOffDataSize);
+				pAttribute->ullInitializedSize = Load<std::uint64_t>(pbAttr + cbOffInitializedSize);
+				pAttribute->pbRuns = pbAttr + ibRuns;
+				pAttribute->cbRuns = cbAttr - ibRuns;
+			} else {
+				const auto cbValue = Load<std::uint32_t>(pbAttr + cbOffValueLength);
+				const auto ibValue = Load<std::uint16_t>(pbAttr + cbOffValueOffset);
+				if (ibValue > cbAttr || cbValue > cbAttr - ibValue) return Fail();
+				pAttribute->pbValue = pbAttr + ibValue;
+				pAttribute->cbValue = cbValue;
+			}
+
+			m_ibCursor += cbAttr;
+			return ReadResult::Ok;
+		}
+
+	  private:
+		friend class CRecord;
+		CAttributeReader(const unsigned char *pb, std::size_t cbInUse, std::size_t ibFirst)
+			: m_pb(pb)
+			, m_cbInUse(cbInUse)
+			, m_ibCursor(ibFirst)
+			, m_bDone(false) {}
+
+		ReadResult Fail() {
+			m_bDone = true;
+			return ReadResult::Malformed;
+		}
+
+		const unsigned char *m_pb;
+		std::size_t m_cbInUse;
+		std::size_t m_ibCursor;
+		bool m_bDone;
+	};
+
+	CAttributeReader Attributes() const {
+		const auto ibFirst = Load<std::uint16_t>(m_pb + cbOffFirstAttribute);
+		std::size_t cbInUse = Load<std::uint32_t>(m_pb + cbOffBytesInUse);
+		if (cbInUse > m_cb) cbInUse = m_cb;
+		// An attribute has to start 8-aligned past the header; anything
+		// else makes the reader fail straight away
+		const std::size_t ibStart = ibFirst % 8 == 0 && ibFirst >= cbRecordHeader ?
+			ibFirst :
+			cbInUse + 1;
+		return CAttributeReader(m_pb, cbInUse, ibStart);
+	}
+
+  private:
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+};
+
+
+// -----------------------------------------------------------------------------
+// FILE_NAME value
+//   UINT64  ParentReference;       // at 0x00
+//   UINT64  Times[4];              // at 0x08
+//   UINT64  AllocatedSize;         // at 0x28
+//   UINT64  DataSize;              // at 0x30
+//   UINT32  Flags;                 // at 0x38
+//   UINT32  Reparse;               // at 0x3C
+//   UINT8   NameLength;            // at 0x40; in characters
+//   UINT8   Namespace;             // at 0x41
+//   WCHAR   Name[];                // at 0x42
+constexpr std::size_t cbOffParentReference = 0x00;
+constexpr std::size_t cbOffFileNameLength = 0x40;
+constexpr std::size_t cbOffFileNameNamespace = 0x41;
+constexpr std::size_t cbOffFileName = 0x42;
+
+struct FileName {
+	std::uint64_t ullParentReference;
+	std::uint8_t uNamespace;
+	NameView svName;  // points into the record
+};
+
+/**
+ * @post: returns false if the value is too short for the name it claims.
+ */
+inline bool DecodeFileName(const Attribute &attribute, FileName *pFileName) {
+	if (attribute.uType != ATTR_FILE_NAME || attribute.bNonResident) return false;
+	const unsigned char *pb = attribute.pbValue;
+	if (attribute.cbValue < cbOffFileName) return false;
+	const std::size_t cchName = pb[cbOffFileNameLength];
+	if (cchName * sizeof(NameChar) > attribute.cbValue - cbOffFileName) return false;
+	// 0x42 past an 8-aligned attribute value is always 2-aligned
+	if (reinterpret_cast<std::uintptr_t>(pb + cbOffFileName) % alignof(NameChar) != 0) {
+		return false;
+	}
+	pFileName->ullParentReference = Load<std::uint64_t>(pb + cbOffParentReference);
+	pFileName->uNamespace = pb[cbOffFileNameNamespace];
+	pFileName->svName = NameView(
+		reinterpret_cast<const NameChar *>(pb + cbOffFileName), cchName
+	);
+	return true;
+}
+
+// Which of a file's names to show: Win32 (long) names over POSIX ones over
+// DOS 8.3 ones. Higher is better.
+inline int NamespaceRank(std::uint8_t uNamespace) {
+	switch (uNamespace) {
+		case NS_WIN32:
+		case NS_WIN32_AND_DOS:
+			return 3;
+		case NS_POSIX:
+			return 2;
+		case NS_DOS:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Attribute list entry, when a file's attributes don't fit in one record
+//   UINT32  Type;                  // at 0x00
+//   UINT16  Length;                // at 0x04; 8-aligned
+//   UINT8   NameLength;            // at 0x06; in characters
+//   UINT8   NameOffset;            // at 0x07
+//   UINT64  LowestVcn;             // at 0x08
+//   UINT64  Reference;             // at 0x10; the record the attribute is in
+//   UINT16  AttributeId;           // at 0x18
+constexpr std::size_t cbOffListType = 0x00;
+constexpr std::size_t cbOffListLength = 0x04;
+constexpr std::size_t cbOffListNameLength = 0x06;
+constexpr std::size_t cbOffListNameOffset = 0x07;
+constexpr std::size_t cbOffListLowestVcn = 0x08;
+constexpr std::size_t cbOffListReference = 0x10;
+constexpr std::size_t cbOffListId = 0x18;
+constexpr std::size_t cbListEntryHeader = 0x1A;
+
+struct ListEntry {
+	std::uint32_t uType;
+	std::uint16_t uId;
+	NameView svName;  // points into the list
+	std::uint64_t ullLowestVcn;
+	std::uint64_t ullReference;
+};
+
+/**
+ * Walks an ATTRIBUTE_LIST value: where each of a file's attributes (or each
+ * extent of a big one) ended up.
+ * @pre: the buffer outlives the reader and every ListEntry it produced.
+ */
+class CAttributeListReader {
+  public:
+	CAttributeListReader(const void *pBuffer, std::size_t cbBuffer)
+		: m_pb(static_cast<const unsigned char *>(pBuffer))
+		, m_cb(pBuffer != nullptr ? cbBuffer : 0)
+		, m_ibCursor(0)
+		, m_bDone(m_cb == 0) {}
+
+	ReadResult Next(ListEntry *pEntry) {
+		if (m_bDone) return ReadResult::End;
+		// Lists are read in whole clusters; what's past the end is slack
+		if (m_cb - m_ibCursor < cbListEntryHeader) {
+			m_bDone = true;
+			return ReadResult::End;
+		}
+		const unsigned char *pbEntry = m_pb + m_ibCursor;
+		const auto cbEntry = Load<std::uint16_t>(pbEntry + cbOffListLength);
+		if (cbEntry == 0) {
+			m_bDone = true;
+			return ReadResult::End;
+		}
+		if (cbEntry < cbListEntryHeader || cbEntry % 8 != 0) return Fail();
+		if (cbEntry > m_cb - m_ibCursor) return Fail();
+
+		const std::size_t cchName = pbEntry[cbOffListNameLength];
+		const std::size_t ibName = pbEntry[cbOffListNameOffset];
+		if (cchName == 0) {
+			pEntry->svName = NameView();
+		} else {
+			if (ibName % alignof(NameChar) != 0) return Fail();
+			if (ibName > cbEntry || cchName * sizeof(NameChar) > cbEntry - ibName) {
+				return Fail();
+			}
+			pEntry->svName = NameView(
+				reinterpret_cast<const NameChar *>(pbEntry + ibName), cchName
+			);
+		}
+		pEntry->uType = Load<std::uint32_t>(pbEntry + cbOffListType);
+		pEntry->uId = Load<std::uint16_t>(pbEntry + cbOffListId);
+		pEntry->ullLowestVcn = Load<std::uint64_t>(pbEntry + cbOffListLowestVcn);
+		pEntry->ullReference = Load<std::uint64_t>(pbEntry + cbOffListReference);
+		m_ibCursor += cbEntry;
+		return ReadResult::Ok;
+	}
+
+  private:
+	ReadResult Fail() {
+		m_bDone = true;
+		return ReadResult::Malformed;
+	}
+
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+	std::size_t m_ibCursor;
+	bool m_bDone;
+};
+
+
+// -----------------------------------------------------------------------------
+// Data runs ("mapping pairs"): where on the volume a non-resident value's
+// clusters are. Each run is a header byte, whose low nibble is how many bytes
+// the run's length takes and high nibble how many its start does, then the
+// length, then the start as a signed offset from the previous run's. A start
+// of no bytes is a hole. A 0 header ends the list.
+
+struct Run {
+	std::uint64_t ullVcn;     // first cluster of the value this run holds
+	std::uint64_t ullLcn;     // where it is on the volume; unused if sparse
+	std::uint64_t cClusters;
+	bool bSparse;
+};
+
+/**
+ * Decode the runs of one extent, which starts at ullLowestVcn, appending
+ * them to *pRuns.
+ * @post: returns false, having appended whatever decoded cleanly, if the
+ *        runs are cut off or point off the start of the volume.
+ */
+inline bool DecodeRuns(
+	const unsigned char *pb,
+	std::size_t         cb,
+	std::uint64_t       ullLowestVcn,
+	std::vector<Run>    *pRuns
+) {
+	std::size_t ib = 0;
+	std::uint64_t ullVcn = ullLowestVcn;
+	std::int64_t llLcn = 0;
+	while (ib < cb) {
+		const unsigned char bHeader = pb[ib++];
+		if (bHeader == 0) return true;
+		const std::size_t cbLength = bHeader & 0x0F;
+		const std::size_t cbOffset = bHeader >> 4;
+		if (cbLength == 0 || cbLength > 8 || cbOffset > 8) return false;
+		if (cbLength + cbOffset > cb - ib) return false;
+
+		std::uint64_t cClusters = 0;
+		for (std::size_t i = 0; i < cbLength; i++) {
+			cClusters |= static_cast<std::uint64_t>(pb[ib + i]) << (8 * i);
+		}
+		ib += cbLength;
+		if (cClusters == 0) return false;
+
+		Run run;
+		run.ullVcn = ullVcn;
+		run.cClusters = cClusters;
+		run.bSparse = cbOffset == 0;
+		run.ullLcn = 0;
+		if (!run.bSparse) {
+			std::uint64_t ullDelta = 0;
+			for (std::size_t i = 0; i < cbOffset; i++) {
+				ullDelta |= static_cast<std::uint64_t>(pb[ib + i]) << (8 * i);
+			}
+			// Sign-extend from however many bytes it took
+			if (cbOffset < 8 && (pb[ib + cbOffset - 1] & 0x80)) {
+				ullDelta |= ~std::uint64_t(0) << (8 * cbOffset);
+			}
+			llLcn += static_cast<std::int64_t>(ullDelta);
+			if (llLcn < 0) return false;
+			run.ullLcn = static_cast<std::uint64_t>(llLcn);
+		}
+		ib += cbOffset;
+		pRuns->push_back(run);
+		ullVcn += cClusters;
+	}
+	// Ran off the end without the terminator
+	return false;
+}
+
+}  // namespace ADSX::Mft
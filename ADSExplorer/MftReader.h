@@ -0,0 +1,355 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Finds an NTFS volume's Master File Table and reads records, attribute
+ * values and named streams' contents out of it, all through a CByteSource,
+ * so it works the same on a live volume, an image file, or a partition on a
+ * disk image.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "ByteSource.h"
+#include "Mft.h"
+
+namespace ADSX::Mft {
+
+
+class CAlignedBuffer {
+  public:
+	explicit CAlignedBuffer(std::size_t cb)
+		: m_pb(static_cast<unsigned char *>(
+			::operator new(cb, std::align_val_t(cbBufferAlign))
+		)) {}
+	~CAlignedBuffer() { ::operator delete(m_pb, std::align_val_t(cbBufferAlign)); }
+	CAlignedBuffer(const CAlignedBuffer &) = delete;
+	CAlignedBuffer &operator=(const CAlignedBuffer &) = delete;
+	unsigned char *Get() const { return m_pb; }
+
+  private:
+	unsigned char *m_pb;
+};
+
+
+// Where a named stream's contents are, once found.
+struct StreamData {
+	std::uint64_t ullSize;
+	std::uint64_t ullInitializedSize;  // past this, it reads as zeros
+	bool bResident;
+	std::vector<unsigned char> value;  // resident only
+	std::vector<Run> runs;             // non-resident only; in VCN order
+};
+
+
+class CMftReader {
+  public:
+	// Lists and resident values are small; anything claiming to be bigger
+	// than this is garbage
+	static constexpr std::uint64_t cbValueMax = 16 * 1024 * 1024;
+
+	// @pre: source outlives the reader.
+	explicit CMftReader(CByteSource &source)
+		: m_source(source)
+		, m_geometry()
+		, m_cRecords(0) {}
+
+	/**
+	 * Read the boot sector, and find every piece of the MFT: the unnamed
+	 * data attribute of record 0, which on a big or old volume is spread
+	 * over several records that record 0's attribute list points to.
+	 * @post: returns false if the volume isn't NTFS or its MFT couldn't be
+	 *        found.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Open() {
+		m_mftRuns.clear();
+		m_cRecords = 0;
+		{
+			CAlignedBuffer buffer(cbBufferAlign);
+			const std::size_t cbBoot = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cbBufferAlign, m_source.Size())
+			);
+			if (cbBoot < cbBootSector || !m_source.Read(0, buffer.Get(), cbBoot)) return false;
+			if (!ParseBootSector(buffer.Get(), cbBoot, &m_geometry)) return false;
+		}
+
+		const std::size_t cbRecord = m_geometry.cbRecord;
+		CAlignedBuffer record(cbRecord);
+		if (!m_source.Read(m_geometry.ullMftLcn * m_geometry.cbCluster, record.Get(), cbRecord)) {
+			return false;
+		}
+		if (ApplyFixups(record.Get(), cbRecord) != FixupResult::Ok) return false;
+
+		std::uint64_t ullMftSize = 0;
+		std::vector<unsigned char> list;
+		bool bHasList = false;
+		CRecord::CAttributeReader reader = CRecord(record.Get(), cbRecord).Attributes();
+		Attribute attribute;
+		while (reader.Next(&attribute) == ReadResult::Ok) {
+			if (attribute.uType == ATTR_DATA && attribute.svName.empty()) {
+				if (!attribute.bNonResident) return false;
+				if (attribute.ullLowestVcn == 0) ullMftSize = attribute.ullDataSize;
+				if (!DecodeRuns(attribute.pbRuns, attribute.cbRuns, attribute.ullLowestVcn, &m_mftRuns)) {
+					return false;
+				}
+			} else if (attribute.uType == ATTR_ATTRIBUTE_LIST) {
+				bHasList = true;
+				if (!ReadValue(attribute, &list)) return false;
+			}
+		}
+		if (m_mftRuns.empty() || ullMftSize == 0) return false;
+
+		if (bHasList) {
+			// The rest of the pieces. The list is in VCN order, so each
+			// record it points to is in a piece already found.
+			CAttributeListReader listReader(list.data(), list.size());
+			ListEntry entry;
+			while (listReader.Next(&entry) == ReadResult::Ok) {
+				if (entry.uType != ATTR_DATA || !entry.svName.empty()) continue;
+				const std::uint64_t ullRecord = RecordOf(entry.ullReference);
+				if (ullRecord == ullRecordMft) continue;
+				if (!ReadMft(ullRecord * cbRecord, record.Get(), cbRecord)) return false;
+				if (ApplyFixups(record.Get(), cbRecord) != FixupResult::Ok) return false;
+				CRecord::CAttributeReader extensionReader =
+					CRecord(record.Get(), cbRecord).Attributes();
+				while (extensionReader.Next(&attribute) == ReadResult::Ok) {
+					if (
+						attribute.uType == ATTR_DATA &&
+						attribute.svName.empty() &&
+						attribute.bNonResident &&
+						attribute.ullLowestVcn == entry.ullLowestVcn
+					) {
+						if (!DecodeRuns(attribute.pbRuns, attribute.cbRuns, attribute.ullLowestVcn, &m_mftRuns)) {
+							return false;
+						}
+						break;
+					}
+				}
+			}
+			SortRuns(&m_mftRuns);
+		}
+
+		m_cRecords = ullMftSize / cbRecord;
+		return m_cRecords > ullRecordRoot;
+	}
+
+	const Geometry &GetGeometry() const { return m_geometry; }
+	std::uint64_t RecordCount() const { return m_cRecords; }
+
+	/**
+	 * Read cb bytes at ibMft from the start of the MFT, across however many
+	 * of its pieces that takes.
+	 * @pre: Open succeeded.
+	 */
+	bool ReadMft(std::uint64_t ibMft, unsigned char *pb, std::size_t cb) {
+		return ReadRuns(m_mftRuns, ibMft, pb, cb);
+	}
+
+	/**
+	 * Read record ullRecord into pb, which holds GetGeometry().cbRecord
+	 * bytes, and undo its fixups.
+	 * @post: returns false if it couldn't be read, or isn't a whole record.
+	 */
+	bool ReadRecord(std::uint64_t ullRecord, unsigned char *pb) {
+		const std::size_t cbRecord = m_geometry.cbRecord;
+		if (ullRecord >= m_cRecords) return false;
+		if (!ReadMft(ullRecord * cbRecord, pb, cbRecord)) return false;
+		return ApplyFixups(pb, cbRecord) == FixupResult::Ok;
+	}
+
+	/**
+	 * The whole value of an attribute that fits in one extent, wherever it
+	 * is. For attribute lists; stream contents go through OpenStream.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool ReadValue(const Attribute &attribute, std::vector<unsigned char> *pValue) {
+		if (!attribute.bNonResident) {
+			pValue->assign(attribute.pbValue, attribute.pbValue + attribute.cbValue);
+			return true;
+		}
+		if (attribute.ullDataSize > cbValueMax) return false;
+		std::vector<Run> runs;
+		if (!DecodeRuns(attribute.pbRuns, attribute.cbRuns, attribute.ullLowestVcn, &runs)) {
+			return false;
+		}
+		pValue->resize(static_cast<std::size_t>(attribute.ullDataSize));
+		return ReadRuns(runs, 0, pValue->data(), pValue->size());
+	}
+
+	/**
+	 * Find where the contents of file ullRecord's stream svName are,
+	 * gathering its extents from every record its attribute list says
+	 * they're in.
+	 * @post: returns false if the file or the stream isn't there, or the
+	 *        stream is compressed or encrypted, which would take decoding
+	 *        this doesn't do.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool OpenStream(std::uint64_t ullRecord, NameView svName, StreamData *pData) {
+		const std::size_t cbRecord = m_geometry.cbRecord;
+		*pData = StreamData();
+		CAlignedBuffer record(cbRecord);
+		if (!ReadRecord(ullRecord, record.Get())) return false;
+		const CRecord base(record.Get(), cbRecord);
+		if (!base.InUse() || base.BaseReference() != 0) return false;
+
+		bool bFound = false;
+		std::vector<unsigned char> list;
+		bool bHasList = false;
+		if (!GatherExtents(base, svName, pData, &bFound, &list, &bHasList)) return false;
+
+		if (bHasList) {
+			// Collect the records first; the buffer gets reused for each
+			std::vector<std::uint64_t> extensions;
+			CAttributeListReader listReader(list.data(), list.size());
+			ListEntry entry;
+			while (listReader.Next(&entry) == ReadResult::Ok) {
+				if (entry.uType != ATTR_DATA || entry.svName != svName) continue;
+				const std::uint64_t ullExtension = RecordOf(entry.ullReference);
+				if (ullExtension == ullRecord) continue;
+				if (std::find(extensions.begin(), extensions.end(), ullExtension) == extensions.end()) {
+					extensions.push_back(ullExtension);
+				}
+			}
+			for (const std::uint64_t ullExtension : extensions) {
+				if (!ReadRecord(ullExtension, record.Get())) return false;
+				const CRecord extension(record.Get(), cbRecord);
+				// Still this file's?
+				if (RecordOf(extension.BaseReference()) != ullRecord) return false;
+				if (!GatherExtents(extension, svName, pData, &bFound, nullptr, nullptr)) {
+					return false;
+				}
+			}
+		}
+		if (!bFound) return false;
+		if (!pData->bResident) SortRuns(&pData->runs);
+		return true;
+	}
+
+	/**
+	 * Read up to cb bytes at ibOffset into the stream OpenStream found.
+	 * @post: *pcbRead is how many there were, which is fewer than cb only
+	 *        at the end of the stream.
+	 */
+	bool ReadStream(
+		const StreamData &data,
+		std::uint64_t    ibOffset,
+		void             *pb,
+		std::size_t      cb,
+		std::size_t      *pcbRead
+	) {
+		*pcbRead = 0;
+		if (ibOffset >= data.ullSize) return true;
+		cb = static_cast<std::size_t>((std::min<std::uint64_t>)(cb, data.ullSize - ibOffset));
+		auto pbOut = static_cast<unsigned char *>(pb);
+		if (data.bResident) {
+			std::memcpy(pbOut, data.value.data() + ibOffset, cb);
+			*pcbRead = cb;
+			return true;
+		}
+
+		// What was allocated but never written is zeros, whatever's on the
+		// disk there
+		std::size_t cbWritten = 0;
+		if (ibOffset < data.ullInitializedSize) {
+			cbWritten = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cb, data.ullInitializedSize - ibOffset)
+			);
+			if (!ReadRuns(data.runs, ibOffset, pbOut, cbWritten)) return false;
+		}
+		std::memset(pbOut + cbWritten, 0, cb - cbWritten);
+		*pcbRead = cb;
+		return true;
+	}
+
+  private:
+	static void SortRuns(std::vector<Run> *pRuns) {
+		std::sort(pRuns->begin(), pRuns->end(), [](const Run &a, const Run &b) {
+			return a.ullVcn < b.ullVcn;
+		});
+	}
+
+	// Add what record holds of stream svName to *pData. From the base
+	// record, also hand back its attribute list, if it has one.
+	bool GatherExtents(
+		const CRecord              &record,
+		NameView                   svName,
+		StreamData                 *pData,
+		bool                       *pbFound,
+		std::vector<unsigned char> *pList,
+		bool                       *pbHasList
+	) {
+		CRecord::CAttributeReader reader = record.Attributes();
+		Attribute attribute;
+		ReadResult result;
+		while ((result = reader.Next(&attribute)) == ReadResult::Ok) {
+			if (attribute.uType == ATTR_ATTRIBUTE_LIST && pList != nullptr) {
+				*pbHasList = true;
+				if (!ReadValue(attribute, pList)) return false;
+				continue;
+			}
+			if (attribute.uType != ATTR_DATA || attribute.svName != svName) continue;
+			if (attribute.uFlags & (ATTR_FLAG_COMPRESSION_MASK | ATTR_FLAG_ENCRYPTED)) return false;
+			if (!attribute.bNonResident) {
+				if (*pbFound) return false;  // resident values come whole
+				pData->bResident = true;
+				pData->ullSize = pData->ullInitializedSize = attribute.cbValue;
+				pData->value.assign(attribute.pbValue, attribute.pbValue + attribute.cbValue);
+			} else {
+				if (pData->bResident) return false;
+				// Only the first extent knows the sizes
+				if (attribute.ullLowestVcn == 0) {
+					pData->ullSize = attribute.ullDataSize;
+					pData->ullInitializedSize = (std::min)(attribute.ullInitializedSize, attribute.ullDataSize);
+				}
+				if (!DecodeRuns(attribute.pbRuns, attribute.cbRuns, attribute.ullLowestVcn, &pData->runs)) {
+					return false;
+				}
+			}
+			*pbFound = true;
+		}
+		return result != ReadResult::Malformed;
+	}
+
+	// Read cb bytes at ibValue into a value laid out by runs.
+	bool ReadRuns(const std::vector<Run> &runs, std::uint64_t ibValue, unsigned char *pb, std::size_t cb) {
+		const std::uint64_t cbCluster = m_geometry.cbCluster;
+		while (cb > 0) {
+			const std::uint64_t ullVcn = ibValue / cbCluster;
+			auto it = std::upper_bound(
+				runs.begin(), runs.end(), ullVcn,
+				[](std::uint64_t ullVcn, const Run &run) { return ullVcn < run.ullVcn; }
+			);
+			if (it == runs.begin()) return false;
+			const Run &run = *--it;
+			if (ullVcn >= run.ullVcn + run.cClusters) return false;
+			const std::uint64_t ibInRun = ibValue - run.ullVcn * cbCluster;
+			const std::size_t cbHere = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cb, run.cClusters * cbCluster - ibInRun)
+			);
+			if (run.bSparse) {
+				std::memset(pb, 0, cbHere);
+			} else if (!m_source.Read(run.ullLcn * cbCluster + ibInRun, pb, cbHere)) {
+				return false;
+			}
+			ibValue += cbHere;
+			pb += cbHere;
+			cb -= cbHere;
+		}
+		return true;
+	}
+
+	CByteSource &m_source;
+	Geometry m_geometry;
+	std::vector<Run> m_mftRuns;
+	std::uint64_t m_cRecords;
+};
+
+}  // namespace ADSX::Mft
@@ -0,0 +1,434 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Finds every named data stream on an NTFS volume by reading its Master File
+ * Table straight off the volume (or out of an image of one) instead of
+ * walking the directory tree and asking about every file. The MFT is read in
+ * big sequential chunks, and the chunks are decoded in parallel.
+ *
+ * Where the bytes come from is up to a CByteSource.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ByteSource.h"
+#include "Mft.h"
+#include "MftReader.h"
+#include "WorkStealingPool.h"
+
+namespace ADSX::Mft {
+
+
+// Paths and names as they are on the volume
+using Name = std::basic_string<NameChar>;
+
+struct FoundStream {
+	std::uint64_t ullRecord;  // the file it's on
+	Name sPath;               // "dir\file" from the volume's root; "" is the root
+	Name sName;               // the stream's name
+	std::uint64_t ullSize;
+	bool bDirectory;          // it's on a directory, not a file
+};
+
+// A file with streams, or a directory on the way down to one
+struct FoundFile {
+	std::uint64_t ullRecord;
+	std::uint64_t ullParent;  // record number; the root's is itself
+	Name sName;
+	bool bDirectory;
+};
+
+struct ScanStats {
+	std::uint64_t cRecords;     // record slots in the MFT
+	std::uint64_t cInUse;
+	std::uint64_t cExtensions;  // records holding overflow attributes
+	std::uint64_t cBad;         // torn or garbled records, skipped
+	std::uint64_t cReadErrors;  // chunks that couldn't be read
+	std::uint64_t cStreams;     // named data streams found
+	std::uint64_t cOrphans;     // found on files whose path couldn't be traced
+};
+
+
+class CScanner {
+  public:
+	// Big enough that a spinning disk reads it at full speed, small enough to
+	// go round the workers evenly
+	static constexpr std::size_t cbChunk = 1024 * 1024;
+	// Directories nested deeper than this are taken to be a loop
+	static constexpr std::size_t cDepthMax = 1024;
+
+	// cWorkers 0 means one per core.
+	explicit CScanner(CByteSource &source, unsigned cWorkers = 0)
+		: m_reader(source)
+		, m_cWorkers(cWorkers != 0 ? cWorkers : (std::max)(1u, std::thread::hardware_concurrency()))
+		, m_geometry()
+		, m_cRecords(0)
+		, m_stats()
+		, m_bCancel(false) {}
+
+	/**
+	 * Read the whole MFT and find every named data stream on the volume.
+	 * @post: returns false if the volume isn't NTFS or its MFT couldn't be
+	 *        found, or if it was cancelled. Records that can't be read or
+	 *        decoded are counted in GetStats() and skipped.
+	 * @post: *pFound is sorted by record, then stream name.
+	 * @post: if pFiles isn't null, *pFiles has every file in *pFound and
+	 *        every directory above them but the root, sorted by record. This
+	 *        is what it takes to make their paths again later.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Scan(std::vector<FoundStream> *pFound, std::vector<FoundFile> *pFiles = nullptr) {
+		pFound->clear();
+		if (pFiles != nullptr) pFiles->clear();
+		m_stats = ScanStats();
+		if (!m_reader.Open()) return false;
+		m_geometry = m_reader.GetGeometry();
+		m_cRecords = m_reader.RecordCount();
+		m_stats.cRecords = m_cRecords;
+
+		m_aSequence.assign(m_cRecords, 0);
+		m_aFlags.assign(m_cRecords, 0);
+		m_outputs.assign(m_cWorkers, Output());
+		DecodeAll();
+		if (m_bCancel.load(std::memory_order_relaxed)) return false;
+
+		Merge(pFound, pFiles);
+		m_outputs.clear();
+		return true;
+	}
+
+	// Stop as soon as the chunks being decoded are done. Thread-safe.
+	void Cancel() {
+		m_bCancel.store(true, std::memory_order_relaxed);
+		CPool *pPool = m_pPool.load(std::memory_order_acquire);
+		if (pPool != nullptr) pPool->Cancel();
+	}
+
+	const Geometry &GetGeometry() const { return m_geometry; }
+	const ScanStats &GetStats() const { return m_stats; }
+
+  private:
+	// A run of consecutive records for one worker to decode
+	struct Chunk {
+		std::uint64_t ullFirst = 0;
+		std::size_t cRecords = 0;
+	};
+	using CPool = CWorkStealingPool<Chunk>;
+
+	// Found while decoding, before anyone knows whether the record it's
+	// for is still the one it claims to be
+	struct NameFound {
+		std::uint64_t ullRecord;
+		std::uint16_t uSequence;
+		std::uint64_t ullParentReference;
+		int iRank;
+		Name sName;
+	};
+	struct StreamFound {
+		std::uint64_t ullRecord;
+		std::uint16_t uSequence;
+		Name sName;
+		std::uint64_t ullSize;
+	};
+	// One per worker, so decoding takes no locks
+	struct Output {
+		std::vector<NameFound> names;
+		std::vector<StreamFound> streams;
+		std::uint64_t cInUse = 0;
+		std::uint64_t cExtensions = 0;
+		std::uint64_t cBad = 0;
+		std::uint64_t cReadErrors = 0;
+	};
+
+	void DecodeAll() {
+		const std::size_t cRecordsPerChunk = (std::max<std::size_t>)(1, cbChunk / m_geometry.cbRecord);
+		std::vector<Chunk> chunks;
+		chunks.reserve(static_cast<std::size_t>(m_cRecords / cRecordsPerChunk + 1));
+		for (std::uint64_t ull = 0; ull < m_cRecords; ull += cRecordsPerChunk) {
+			Chunk chunk;
+			chunk.ullFirst = ull;
+			chunk.cRecords = static_cast<std::size_t>(
+				(std::min<std::uint64_t>)(cRecordsPerChunk, m_cRecords - ull)
+			);
+			chunks.push_back(chunk);
+		}
+
+		std::vector<std::unique_ptr<CAlignedBuffer>> buffers;
+		for (unsigned i = 0; i < m_cWorkers; i++) {
+			buffers.emplace_back(new CAlignedBuffer(cRecordsPerChunk * m_geometry.cbRecord));
+		}
+
+		CPool pool(m_cWorkers);
+		m_pPool.store(&pool, std::memory_order_release);
+		if (m_bCancel.load(std::memory_order_relaxed)) pool.Cancel();
+		pool.Run(std::move(chunks), [&](CPool::CContext &context, Chunk chunk) {
+			const std::size_t iWorker = context.WorkerIndex();
+			DecodeChunk(chunk, buffers[iWorker]->Get(), &m_outputs[iWorker]);
+		});
+		m_pPool.store(nullptr, std::memory_order_release);
+
+		for (const Output &output : m_outputs) {
+			m_stats.cInUse += output.cInUse;
+			m_stats.cExtensions += output.cExtensions;
+			m_stats.cBad += output.cBad;
+			m_stats.cReadErrors += output.cReadErrors;
+		}
+	}
+
+	void DecodeChunk(const Chunk &chunk, unsigned char *pbChunk, Output *pOutput) {
+		const std::size_t cbRecord = m_geometry.cbRecord;
+		if (!m_reader.ReadMft(chunk.ullFirst * cbRecord, pbChunk, chunk.cRecords * cbRecord)) {
+			pOutput->cReadErrors++;
+			return;
+		}
+		for (std::size_t i = 0; i < chunk.cRecords; i++) {
+			DecodeRecord(chunk.ullFirst + i, pbChunk + i * cbRecord, pOutput);
+		}
+	}
+
+	void DecodeRecord(std::uint64_t ullRecord, unsigned char *pb, Output *pOutput) {
+		const std::size_t cbRecord = m_geometry.cbRecord;
+		switch (ApplyFixups(pb, cbRecord)) {
+			case FixupResult::Ok:
+				break;
+			case FixupResult::Empty:
+				return;
+			default:
+				pOutput->cBad++;
+				return;
+		}
+		const CRecord record(pb, cbRecord);
+		// Every worker writes only its own records' slots
+		m_aSequence[ullRecord] = record.Sequence();
+		if (!record.InUse()) return;
+		m_aFlags[ullRecord] = static_cast<std::uint8_t>(record.Flags());
+		pOutput->cInUse++;
+
+		// Attributes in an extension record belong to its base record, if
+		// that's still the file that overflowed into it; Merge checks.
+		const std::uint64_t ullBaseReference = record.BaseReference();
+		const bool bExtension = ullBaseReference != 0;
+		const std::uint64_t ullBase = bExtension ? RecordOf(ullBaseReference) : ullRecord;
+		const std::uint16_t uBaseSequence =
+			bExtension ? SequenceOf(ullBaseReference) : record.Sequence();
+		if (bExtension) pOutput->cExtensions++;
+		if (ullBase >= m_cRecords) {
+			pOutput->cBad++;
+			return;
+		}
+
+		FileName best = {};
+		int iBestRank = 0;
+		bool bHasList = false;
+		bool bHasNamedData = false;
+		CRecord::CAttributeReader reader = record.Attributes();
+		Attribute attribute;
+		ReadResult result;
+		while ((result = reader.Next(&attribute)) == ReadResult::Ok) {
+			switch (attribute.uType) {
+				case ATTR_FILE_NAME: {
+					FileName fileName;
+					if (!DecodeFileName(attribute, &fileName)) break;
+					const int iRank = NamespaceRank(fileName.uNamespace);
+					if (iRank > iBestRank) {
+						best = fileName;
+						iBestRank = iRank;
+					}
+					break;
+				}
+				case ATTR_ATTRIBUTE_LIST:
+					bHasList = true;
+					break;
+				case ATTR_DATA:
+					// A big value is split over records; only the first piece
+					// knows the size
+					if (
+						attribute.svName.empty() ||
+						(attribute.bNonResident && attribute.ullLowestVcn != 0)
+					) {
+						break;
+					}
+					bHasNamedData = true;
+					pOutput->streams.push_back(StreamFound{
+						ullBase, uBaseSequence, Name(attribute.svName), attribute.Size()
+					});
+					break;
+			}
+		}
+		if (result == ReadResult::Malformed) pOutput->cBad++;
+
+		// Names are only needed to make paths: of directories, and of files
+		// that have (or might have, elsewhere) named streams. Leaving the
+		// rest out keeps a volume of millions of files in reasonable memory.
+		if (
+			iBestRank > 0 &&
+			(record.IsDirectory() || bHasNamedData || bHasList || bExtension)
+		) {
+			pOutput->names.push_back(NameFound{
+				ullBase, uBaseSequence, best.ullParentReference, iBestRank, Name(best.svName)
+			});
+		}
+	}
+
+	void Merge(std::vector<FoundStream> *pFound, std::vector<FoundFile> *pFiles) {
+		// Each record's best name, if it's still the record the name was
+		// found for
+		m_names.clear();
+		m_aiName.assign(m_cRecords, UINT32_MAX);
+		for (Output &output : m_outputs) {
+			for (NameFound &name : output.names) {
+				if (!IsLive(name.ullRecord, name.uSequence)) continue;
+				std::uint32_t &iName = m_aiName[name.ullRecord];
+				if (iName != UINT32_MAX && m_names[iName].iRank >= name.iRank) continue;
+				if (iName == UINT32_MAX) {
+					iName = static_cast<std::uint32_t>(m_names.size());
+					m_names.push_back(std::move(name));
+				} else {
+					m_names[iName] = std::move(name);
+				}
+			}
+			output.names.clear();
+			output.names.shrink_to_fit();
+		}
+
+		m_paths.clear();
+		for (Output &output : m_outputs) {
+			for (StreamFound &stream : output.streams) {
+				if (!IsLive(stream.ullRecord, stream.uSequence)) continue;
+				FoundStream found;
+				found.ullRecord = stream.ullRecord;
+				found.sName = std::move(stream.sName);
+				found.ullSize = stream.ullSize;
+				found.bDirectory = m_aFlags[stream.ullRecord] & RECORD_DIRECTORY;
+				if (!PathOf(stream.ullRecord, &found.sPath)) m_stats.cOrphans++;
+				pFound->push_back(std::move(found));
+			}
+			output.streams.clear();
+			output.streams.shrink_to_fit();
+		}
+		m_stats.cStreams = pFound->size();
+		std::sort(pFound->begin(), pFound->end(), [](const FoundStream &a, const FoundStream &b) {
+			return a.ullRecord != b.ullRecord ? a.ullRecord < b.ullRecord : a.sName < b.sName;
+		});
+		if (pFiles != nullptr) CollectFiles(*pFound, pFiles);
+		m_paths.clear();
+		m_names.clear();
+		m_aiName.clear();
+	}
+
+	// The files streams were found on, and the directories above them, up
+	// to where their chains end.
+	void CollectFiles(const std::vector<FoundStream> &found, std::vector<FoundFile> *pFiles) {
+		std::vector<bool> abDone(static_cast<std::size_t>(m_cRecords), false);
+		abDone[ullRecordRoot] = true;
+		for (const FoundStream &stream : found) {
+			std::uint64_t ullCurrent = stream.ullRecord;
+			for (std::size_t cDepth = 0; cDepth < cDepthMax && !abDone[ullCurrent]; cDepth++) {
+				abDone[ullCurrent] = true;
+				const std::uint32_t iName = m_aiName[ullCurrent];
+				if (iName == UINT32_MAX) break;
+				const std::uint64_t ullParent = RecordOf(m_names[iName].ullParentReference);
+				pFiles->push_back(FoundFile{
+					ullCurrent, ullParent, m_names[iName].sName,
+					(m_aFlags[ullCurrent] & RECORD_DIRECTORY) != 0
+				});
+				if (ullParent >= m_cRecords) break;
+				ullCurrent = ullParent;
+			}
+		}
+		std::sort(pFiles->begin(), pFiles->end(), [](const FoundFile &a, const FoundFile &b) {
+			return a.ullRecord < b.ullRecord;
+		});
+	}
+
+	// Whether ullRecord is in use and still has the sequence number a
+	// reference to it was made with.
+	bool IsLive(std::uint64_t ullRecord, std::uint16_t uSequence) const {
+		return (
+			ullRecord < m_cRecords &&
+			(m_aFlags[ullRecord] & RECORD_IN_USE) &&
+			m_aSequence[ullRecord] == uSequence
+		);
+	}
+
+	/**
+	 * The path of ullRecord from the root, following parent references up.
+	 * @post: returns false, with the path from as far up as it could get
+	 *        under "?", if the chain is broken or loops.
+	 */
+	bool PathOf(std::uint64_t ullRecord, Name *psPath) {
+		std::vector<std::uint64_t> chain;
+		Name sPrefix;
+		bool bRooted = false;
+		std::uint64_t ullCurrent = ullRecord;
+		while (chain.size() < cDepthMax) {
+			if (ullCurrent == ullRecordRoot) {
+				bRooted = true;
+				break;
+			}
+			auto it = m_paths.find(ullCurrent);
+			if (it != m_paths.end()) {
+				sPrefix = it->second.first;
+				bRooted = it->second.second;
+				break;
+			}
+			const std::uint32_t iName = m_aiName[ullCurrent];
+			if (iName == UINT32_MAX) break;
+			chain.push_back(ullCurrent);
+			const std::uint64_t ullParentReference = m_names[iName].ullParentReference;
+			const std::uint64_t ullParent = RecordOf(ullParentReference);
+			if (
+				!IsLive(ullParent, SequenceOf(ullParentReference)) ||
+				!(m_aFlags[ullParent] & RECORD_DIRECTORY)
+			) {
+				break;
+			}
+			ullCurrent = ullParent;
+		}
+		if (!bRooted && sPrefix.empty()) sPrefix = Name(1, NameChar('?'));
+
+		// Back down, remembering the directories on the way for the next
+		// file in them
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+			if (!sPrefix.empty()) sPrefix += NameChar('\\');
+			sPrefix += m_names[m_aiName[*it]].sName;
+			if (m_aFlags[*it] & RECORD_DIRECTORY) {
+				m_paths.emplace(*it, std::make_pair(sPrefix, bRooted));
+			}
+		}
+		*psPath = std::move(sPrefix);
+		return bRooted;
+	}
+
+	CMftReader m_reader;
+	const unsigned m_cWorkers;
+	Geometry m_geometry;
+	std::uint64_t m_cRecords;
+	ScanStats m_stats;
+	std::atomic<bool> m_bCancel;
+	std::atomic<CPool *> m_pPool{nullptr};
+
+	// Indexed by record number
+	std::vector<std::uint16_t> m_aSequence;
+	std::vector<std::uint8_t> m_aFlags;
+	std::vector<std::uint32_t> m_aiName;  // into m_names
+
+	std::vector<Output> m_outputs;
+	std::vector<NameFound> m_names;
+	// Directories' paths, and whether they made it to the root
+	std::unordered_map<std::uint64_t, std::pair<Name, bool>> m_paths;
+};
+
+}  // namespace ADSX::Mft
@@ -0,0 +1,161 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "MftVolume.h"
+
+#include <winioctl.h>
+
+#include <string>
+
+// Debug log prefix for CVolumeSource
+#define P_VS L"ADSX::CVolumeSource(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CVolumeSource::CVolumeSource()
+	: m_cbAlign(1)
+	, m_cbSize(0) {}
+
+
+HRESULT CVolumeSource::Open(_In_ PCWSTR pszPath) {
+	if (pszPath == NULL) return E_POINTER;
+	LOG(P_VS << L"Open(" << pszPath << L")");
+
+	// "C:" or "C:\" is the volume; anything else an image of one
+	const bool bVolume = (
+		iswalpha(pszPath[0]) && pszPath[1] == L':' &&
+		(pszPath[2] == L'\0' || (pszPath[2] == L'\\' && pszPath[3] == L'\0'))
+	);
+	std::wstring sPath;
+	try {
+		sPath = bVolume ? std::wstring(L"\\\\.\\") + pszPath[0] + L':' : pszPath;
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	// Overlapped so the scanner's workers can each have a read in flight;
+	// everyone else is left to go on using the volume as usual.
+	HANDLE hVolume = CreateFileW(
+		sPath.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_OVERLAPPED | (bVolume ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN),
+		NULL
+	);
+	if (hVolume == INVALID_HANDLE_VALUE) {
+		const DWORD dwError = GetLastError();
+		LOG(P_VS << L"Open(): " << dwError);
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	m_hVolume.Close();
+	m_hVolume.Attach(hVolume);
+
+	m_cbAlign = 1;
+	if (bVolume) {
+		// 4K-native disks have 4 KB logical sectors; the boot sector says
+		// what the filesystem thinks, but it's the disk that's checking
+		const WCHAR szRoot[] = {pszPath[0], L':', L'\\', L'\0'};
+		DWORD dwSectorsPerCluster, cbSector, cFree, cTotal;
+		if (!GetDiskFreeSpaceW(szRoot, &dwSectorsPerCluster, &cbSector, &cFree, &cTotal)) {
+			cbSector = cbBufferAlign;
+		}
+		m_cbAlign = cbSector;
+
+		// The handle's overlapped, so even this has to be
+		GET_LENGTH_INFORMATION length;
+		DWORD cbReturned = 0;
+		OVERLAPPED overlapped = {};
+		CHandle hEvent(CreateEventW(NULL, TRUE, FALSE, NULL));
+		if (hEvent == NULL) return HRESULT_FROM_WIN32(GetLastError());
+		overlapped.hEvent = hEvent;
+		BOOL bOk = DeviceIoControl(
+			m_hVolume, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0,
+			&length, sizeof(length), NULL, &overlapped
+		);
+		if (!bOk && GetLastError() == ERROR_IO_PENDING) {
+			bOk = GetOverlappedResult(m_hVolume, &overlapped, &cbReturned, TRUE);
+		}
+		if (!bOk) {
+			const DWORD dwError = GetLastError();
+			LOG(P_VS << L"Open(): IOCTL_DISK_GET_LENGTH_INFO: " << dwError);
+			return HRESULT_FROM_WIN32(dwError);
+		}
+		m_cbSize = length.Length.QuadPart;
+	} else {
+		LARGE_INTEGER liSize;
+		if (!GetFileSizeEx(m_hVolume, &liSize)) return HRESULT_FROM_WIN32(GetLastError());
+		m_cbSize = liSize.QuadPart;
+	}
+	return S_OK;
+}
+
+
+std::uint64_t CVolumeSource::Size() const {
+	return m_cbSize;
+}
+
+
+bool CVolumeSource::Read(std::uint64_t ibOffset, void *pb, std::size_t cb) {
+	if (m_hVolume == NULL) return false;
+	if (ibOffset > m_cbSize || cb > m_cbSize - ibOffset) return false;
+	const bool bAligned = (
+		ibOffset % m_cbAlign == 0 &&
+		cb % m_cbAlign == 0 &&
+		reinterpret_cast<ULONG_PTR>(pb) % m_cbAlign == 0
+	);
+	if (bAligned) return ReadAligned(ibOffset, pb, cb);
+
+	// Round out to whole sectors, read those, and copy out the middle
+	const std::uint64_t ibStart = ibOffset - ibOffset % m_cbAlign;
+	const std::uint64_t ibEnd = (ibOffset + cb + m_cbAlign - 1) / m_cbAlign * m_cbAlign;
+	const std::size_t cbBounce = static_cast<std::size_t>(ibEnd - ibStart);
+	auto pbBounce = static_cast<BYTE *>(_aligned_malloc(cbBounce, m_cbAlign));
+	if (pbBounce == NULL) return false;
+	defer({ _aligned_free(pbBounce); });
+	if (!ReadAligned(ibStart, pbBounce, cbBounce)) return false;
+	memcpy(pb, pbBounce + (ibOffset - ibStart), cb);
+	return true;
+}
+
+
+bool CVolumeSource::ReadAligned(std::uint64_t ibOffset, void *pb, std::size_t cb) {
+	auto pbOut = static_cast<BYTE *>(pb);
+	while (cb > 0) {
+		// ReadFile takes a DWORD; stay well under it and on a sector boundary
+		const DWORD cbRead = static_cast<DWORD>(min(cb, static_cast<std::size_t>(64 * 1024 * 1024)));
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(ibOffset);
+		overlapped.OffsetHigh = static_cast<DWORD>(ibOffset >> 32);
+		CHandle hEvent(CreateEventW(NULL, TRUE, FALSE, NULL));
+		if (hEvent == NULL) return false;
+		overlapped.hEvent = hEvent;
+
+		DWORD cbDone = 0;
+		if (
+			!ReadFile(m_hVolume, pbOut, cbRead, NULL, &overlapped) &&
+			GetLastError() != ERROR_IO_PENDING
+		) {
+			LOG(P_VS << L"ReadAligned(): " << GetLastError());
+			return false;
+		}
+		if (!GetOverlappedResult(m_hVolume, &overlapped, &cbDone, TRUE)) {
+			LOG(P_VS << L"ReadAligned(): " << GetLastError());
+			return false;
+		}
+		// Past the end of an image file, or a volume that shrank
+		if (cbDone != cbRead) return false;
+
+		pbOut += cbRead;
+		ibOffset += cbRead;
+		cb -= cbRead;
+	}
+	return true;
+}
+
+}  // namespace ADSX
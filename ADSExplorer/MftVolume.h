@@ -0,0 +1,43 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Where raw reads get their bytes on Windows: a volume itself, opened raw,
+ * or an image file, read as it is. Finding the volumes in an image (VHD,
+ * VHDX, partitions) is Disk::CImage's job, stacked on top of this.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ByteSource.h"
+
+namespace ADSX {
+
+
+class CVolumeSource : public CByteSource {
+  public:
+	CVolumeSource();
+
+	/**
+	 * Open pszPath for reading: "C:" or "C:\" for that volume itself, which
+	 * takes an administrator, or the path of an image file, whose bytes
+	 * come back untranslated.
+	 * @post: on success, Read can be called from any thread.
+	 */
+	HRESULT Open(_In_ PCWSTR pszPath);
+
+	bool Read(std::uint64_t ibOffset, void *pb, std::size_t cb) override;
+	std::uint64_t Size() const override;
+
+  protected:
+	// Volumes only take reads of whole sectors into sector-aligned buffers.
+	// Anything else goes through a buffer of our own.
+	bool ReadAligned(std::uint64_t ibOffset, void *pb, std::size_t cb);
+
+	CHandle m_hVolume;
+	DWORD m_cbAlign;  // 1 for an image file
+	std::uint64_t m_cbSize;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,44 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ModuleThread.h"
+
+namespace ADSX {
+
+
+HANDLE CreateModuleThread(
+	_In_ LPTHREAD_START_ROUTINE pfnStart,
+	_In_opt_ LPVOID pvParam
+) {
+	// _Module's lock only keeps DllCanUnloadNow from saying yes; the loader
+	// reference is what keeps the code mapped until the thread is gone.
+	HMODULE hModule;
+	if (!GetModuleHandleExW(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+		reinterpret_cast<LPCWSTR>(&CreateModuleThread),
+		&hModule
+	)) {
+		return NULL;
+	}
+	_Module.Lock();
+	HANDLE hThread = CreateThread(NULL, 0, pfnStart, pvParam, 0, NULL);
+	if (hThread == NULL) {
+		const DWORD dwError = GetLastError();
+		_Module.Unlock();
+		FreeLibrary(hModule);
+		SetLastError(dwError);
+	}
+	return hThread;
+}
+
+
+void ExitModuleThread(_In_ DWORD dwExitCode) {
+	_Module.Unlock();
+	FreeLibraryAndExitThread(_Module.GetModuleInstance(), dwExitCode);
+}
+
+
+}  // namespace ADSX
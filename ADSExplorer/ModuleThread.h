@@ -0,0 +1,36 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Threads that outlive the calls that start them. Each holds a lock on the
+ * module for DllCanUnloadNow and a loader reference on the DLL itself, which
+ * it gives up with FreeLibraryAndExitThread as its very last act, so the DLL
+ * can't be unloaded while the thread is still returning through its code.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+namespace ADSX {
+
+
+/**
+ * Start pfnStart(pvParam) on a thread of its own, which must end with
+ * ExitModuleThread instead of returning.
+ * @post: NULL with the last error set on failure, and nothing is held.
+ */
+_Success_(return != NULL)
+HANDLE CreateModuleThread(
+	_In_ LPTHREAD_START_ROUTINE pfnStart,
+	_In_opt_ LPVOID pvParam
+);
+
+/**
+ * Give up what CreateModuleThread took and end the calling thread. Doesn't
+ * return, so nothing with a destructor can still be alive in the thread
+ * procedure when it's called.
+ */
+DECLSPEC_NORETURN void ExitModuleThread(_In_ DWORD dwExitCode);
+
+
+}  // namespace ADSX
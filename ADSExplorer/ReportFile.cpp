@@ -0,0 +1,54 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ReportFile.h"
+
+namespace ADSX {
+
+
+HRESULT CreateReportFile(
+	_In_  const std::wstring &sPath,
+	_In_  PCWSTR             pszDefaultName,
+	_Out_ CHandle            *phFile
+) {
+	std::wstring sOut = sPath;
+	if (sOut.empty()) {
+		PWSTR pszLocalAppData;
+		HRESULT hr = SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &pszLocalAppData);
+		if (FAILED(hr)) return hr;
+		defer({ CoTaskMemFree(pszLocalAppData); });
+		const std::wstring sDirectory = std::wstring(pszLocalAppData) + L"\\ADSExplorer";
+		const int iCreated = SHCreateDirectoryExW(NULL, sDirectory.c_str(), NULL);
+		if (iCreated != ERROR_SUCCESS && iCreated != ERROR_ALREADY_EXISTS) {
+			return HRESULT_FROM_WIN32(iCreated);
+		}
+		sOut = sDirectory + L'\\' + pszDefaultName;
+	}
+	HANDLE hFile = CreateFileW(
+		sOut.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL
+	);
+	if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	phFile->Attach(hFile);
+	return S_OK;
+}
+
+
+HRESULT WriteUtf8(_In_ HANDLE hFile, _In_ const std::wstring &sText) {
+	if (sText.empty()) return S_OK;
+	const int cch = static_cast<int>(sText.size());
+	const int cb = WideCharToMultiByte(CP_UTF8, 0, sText.data(), cch, NULL, 0, NULL, NULL);
+	if (cb == 0) return HRESULT_FROM_WIN32(GetLastError());
+	std::string sUtf8(cb, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, sText.data(), cch, &sUtf8[0], cb, NULL, NULL);
+	DWORD cbWritten;
+	if (!WriteFile(hFile, sUtf8.data(), cb, &cbWritten, NULL)) {
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	return S_OK;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,33 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Text reports for the rundll32 entry points, written as UTF-8 to
+ * %LOCALAPPDATA%\ADSExplorer unless the command line says where.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+
+namespace ADSX {
+
+/**
+ * Create (or empty) the report file sPath, or pszDefaultName in
+ * %LOCALAPPDATA%\ADSExplorer if sPath is empty.
+ * @post: may throw std::bad_alloc.
+ */
+HRESULT CreateReportFile(
+	_In_  const std::wstring &sPath,
+	_In_  PCWSTR             pszDefaultName,
+	_Out_ CHandle            *phFile
+);
+
+/**
+ * Append sText to the file as UTF-8.
+ * @post: may throw std::bad_alloc.
+ */
+HRESULT WriteUtf8(_In_ HANDLE hFile, _In_ const std::wstring &sText);
+
+}  // namespace ADSX
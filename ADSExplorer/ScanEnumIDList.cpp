@@ -0,0 +1,178 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ScanEnumIDList.h"
+
+// Debug log prefix for CScanEnumIDList
+#define P_SEIDL L"ADSX::CScanEnumIDList(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CScanEnumIDList::CScanEnumIDList()
+	: m_bFillBatches(false)
+	, m_bHasDeadline(false)
+	, m_dwDeadline(0)
+	, m_iCursor(0)
+	, m_cResets(0)
+	, m_bTimedOut(false) {}
+
+CScanEnumIDList::~CScanEnumIDList() {
+	// The view lets go when the user navigates away; if this was the last
+	// one looking, the scan stops.
+	if (m_pScan != NULL) m_pScan->RemoveConsumer();
+}
+
+
+void CScanEnumIDList::InitScan(
+	_In_ IUnknown        *punkOwner,
+	_In_ CBackgroundScan *pScan,
+	_In_ bool            bFillBatches,
+	_In_ DWORD           dwTimeoutMs
+) {
+	LOG(P_SEIDL << L"InitScan(bFillBatches=" << bFillBatches <<
+		L", dwTimeoutMs=" << std::dec << dwTimeoutMs << L")");
+	m_punkOwner = punkOwner;
+	m_pScan = pScan;
+	m_pScan->AddConsumer();
+	m_bFillBatches = bFillBatches;
+	m_bHasDeadline = bFillBatches && dwTimeoutMs != INFINITE;
+	m_dwDeadline = GetTickCount() + dwTimeoutMs;
+}
+
+
+DWORD CScanEnumIDList::RemainingMs() const {
+	if (!m_bHasDeadline) return INFINITE;
+	// Signed, so it comes out right across the tick count wrapping around
+	const LONG lRemaining = static_cast<LONG>(m_dwDeadline - GetTickCount());
+	return lRemaining > 0 ? static_cast<DWORD>(lRemaining) : 0;
+}
+
+
+HRESULT CScanEnumIDList::FetchBounded(
+	_In_                                 ULONG         celt,
+	_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+	_Out_                                ULONG         *pceltFetched
+) {
+	*pceltFetched = 0;
+	ULONG iFirst;
+	ULONG cResets;
+	{
+		ObjectLock lock(this);
+		if (m_bTimedOut) return S_FALSE;
+		iFirst = m_iCursor;
+		cResets = m_cResets;
+	}
+	ULONG cUsed = 0;
+	HRESULT hr = Fetch(iFirst, celt, rgelt, pceltFetched, &cUsed, RemainingMs());
+	ObjectLock lock(this);
+	if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) {
+		// Better part of the list than a window that won't respond. The scan
+		// goes on for any clones; it stops once the last of us is released.
+		LOG(P_SEIDL << L"FetchBounded(): out of time at " << std::dec << iFirst);
+		m_bTimedOut = true;
+		hr = S_FALSE;
+	}
+	// Reset while this waited: the caller still gets what it was waiting
+	// for, and the next Next starts from the top
+	if (m_cResets == cResets) m_iCursor = iFirst + cUsed;
+	return hr;
+}
+
+
+STDMETHODIMP CScanEnumIDList::Next(
+	_In_ ULONG celt,
+	_Outptr_ PITEMID_CHILD *rgelt,
+	_Out_ ULONG *pceltFetched
+) {
+	LOG(P_SEIDL << L"Next(celt=" << celt << L")");
+	if (rgelt == NULL || (celt != 1 && pceltFetched == NULL)) {
+		return WrapReturn(E_POINTER);
+	}
+	ULONG nActual = 0;
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csFetch);
+	HRESULT hr = NextLocked(celt, rgelt, &nActual);
+	if (pceltFetched != NULL) *pceltFetched = nActual;
+	return WrapReturn(hr);
+}
+
+
+HRESULT CScanEnumIDList::NextLocked(
+	_In_     ULONG         celt,
+	_Outptr_ PITEMID_CHILD *rgelt,
+	_Out_    ULONG         *pceltFetched
+) {
+	ULONG nActual = 0;
+	HRESULT hr = S_OK;
+	while (nActual < celt) {
+		ULONG nGot = 0;
+		hr = FetchBounded(celt - nActual, rgelt + nActual, &nGot);
+		nActual += nGot;
+		// Even without filling batches, don't pass off a batch of results
+		// that all came to nothing as the end
+		if (hr != S_OK || (!m_bFillBatches && nActual > 0)) break;
+	}
+	*pceltFetched = nActual;
+	if (FAILED(hr) && nActual == 0) return hr;
+	// Only a caller that asked for async takes a short batch as anything but
+	// the end.
+	if (nActual == 0 || (m_bFillBatches && nActual < celt)) return S_FALSE;
+	return S_OK;
+}
+
+
+STDMETHODIMP CScanEnumIDList::Skip(_In_ ULONG celt) {
+	LOG(P_SEIDL << L"Skip(celt=" << celt << L")");
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csFetch);
+	// The results might not have been found yet, so go through them like
+	// Next would, just without keeping the items.
+	PITEMID_CHILD apidlc[64];
+	while (celt > 0) {
+		ULONG nGot = 0;
+		const ULONG cBatch = min(celt, static_cast<ULONG>(_countof(apidlc)));
+		HRESULT hr = FetchBounded(cBatch, apidlc, &nGot);
+		for (ULONG i = 0; i < nGot; i++) CoTaskMemFree(apidlc[i]);
+		celt -= nGot;
+		if (FAILED(hr)) return WrapReturn(hr);
+		if (hr == S_FALSE) return WrapReturn(S_FALSE);
+	}
+	return WrapReturn(S_OK);
+}
+
+
+STDMETHODIMP CScanEnumIDList::Reset() {
+	LOG(P_SEIDL << L"Reset()");
+	ObjectLock lock(this);
+	// Everything found is kept, so this doesn't scan again
+	m_iCursor = 0;
+	m_cResets++;
+	return WrapReturn(S_OK);
+}
+
+
+STDMETHODIMP CScanEnumIDList::Clone(_COM_Outptr_ IEnumIDList **ppEnum) {
+	LOG(P_SEIDL << L"Clone()");
+	if (ppEnum == NULL) return WrapReturn(E_POINTER);
+	*ppEnum = NULL;
+
+	CScanEnumIDList *pEnumNew;
+	HRESULT hr = CreateClone(&pEnumNew);
+	if (FAILED(hr)) return WrapReturn(hr);
+	defer({ pEnumNew->Release(); });
+	{
+		ObjectLock lock(this);
+		// Same deadline as this one, not a fresh one
+		pEnumNew->m_bHasDeadline = m_bHasDeadline;
+		pEnumNew->m_dwDeadline = m_dwDeadline;
+		pEnumNew->m_iCursor = m_iCursor;
+		pEnumNew->m_bTimedOut = m_bTimedOut;
+	}
+
+	hr = pEnumNew->QueryInterface(IID_PPV_ARGS(ppEnum));
+	return WrapReturn(hr);
+}
+
+}  // namespace ADSX
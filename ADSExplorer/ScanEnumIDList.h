@@ -0,0 +1,125 @@
+/**
+ * 2024 Nate Kean
+ *
+ * An enumerator over what a CBackgroundScan finds, as it finds it, like
+ * CTreeEnumIDList and CFilterEnumIDList. Subclasses say how the scan's
+ * results become items.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "BackgroundScan.h"
+
+namespace ADSX {
+
+
+class ATL_NO_VTABLE CScanEnumIDList
+	: public IEnumIDList,
+	  public CComObjectRootEx<CComMultiThreadModel> {
+
+  public:
+	BEGIN_COM_MAP(CScanEnumIDList)
+		COM_INTERFACE_ENTRY(IEnumIDList)
+	END_COM_MAP()
+
+	// -------------------------------------------------------------------------
+	// IEnumIDList
+	STDMETHOD(Next)(
+		_In_     ULONG,
+		_Outptr_ PITEMID_CHILD*,
+		_Out_    ULONG*
+	);
+	STDMETHOD(Skip)(
+		_In_ ULONG
+	);
+	STDMETHOD(Reset)(
+		void
+	);
+	STDMETHOD(Clone)(
+		_COM_Outptr_ IEnumIDList**
+	);
+
+  protected:
+	CScanEnumIDList();
+	virtual ~CScanEnumIDList();
+
+	/**
+	 * For the subclass's Init.
+	 * If bFillBatches is false (the caller passed SHCONTF_ENABLE_ASYNC), Next
+	 * hands back whatever is ready and may return S_OK with fewer items than
+	 * asked for. Otherwise it waits for as many as were asked for, but not
+	 * past dwTimeoutMs from now (INFINITE for no limit): then Next and Skip
+	 * return S_FALSE with what they have, like CEnumIDList.
+	 * The async caller waits on a thread of its own, and a scan can go a long
+	 * while between results, so it gets no limit.
+	 * @post: pScan is AddRef'd, and counts this as one of its consumers.
+	 */
+	void InitScan(
+		_In_ IUnknown        *punkOwner,
+		_In_ CBackgroundScan *pScan,
+		_In_ bool            bFillBatches,
+		_In_ DWORD           dwTimeoutMs
+	);
+
+	/**
+	 * Make items of up to celt of the scan's results, starting at the
+	 * iFirst'th, waiting up to dwTimeoutMs for them like CScanResults::Read
+	 * and returning what it does. *pcUsed is how many results that took,
+	 * which is more than *pceltFetched if some of them didn't make items.
+	 * @post: rgelt[0..*pceltFetched) are the caller's to CoTaskMemFree.
+	 */
+	virtual HRESULT Fetch(
+		_In_                                 ULONG         iFirst,
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched,
+		_Out_                                ULONG         *pcUsed,
+		_In_                                 DWORD         dwTimeoutMs
+	) = 0;
+
+	/**
+	 * A new enumerator of the same kind over the same scan, for Clone to
+	 * bring up to where this one is.
+	 * @post: *ppClone has a reference count of 1 for the caller to Release.
+	 */
+	virtual HRESULT CreateClone(_COM_Outptr_ CScanEnumIDList **ppClone) = 0;
+
+	// Next, with m_csFetch already held.
+	HRESULT NextLocked(
+		_In_     ULONG         celt,
+		_Outptr_ PITEMID_CHILD *rgelt,
+		_Out_    ULONG         *pceltFetched
+	);
+
+	// Fetch from the cursor without waiting past the deadline, which turns
+	// into S_FALSE with what was there. Waits without the object lock, so
+	// Reset and Clone don't wait on the scan.
+	// @pre: m_csFetch is held, and the object lock isn't.
+	HRESULT FetchBounded(
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched
+	);
+
+	// How long until the deadline: INFINITE if there isn't one, 0 if it's
+	// passed.
+	DWORD RemainingMs() const;
+
+	// A sentinel COM object to represent the lifetime of the owner object.
+	CComPtr<IUnknown> m_punkOwner;
+	CComPtr<CBackgroundScan> m_pScan;
+	bool m_bFillBatches;
+	bool m_bHasDeadline;
+	DWORD m_dwDeadline;  // GetTickCount() value; only if m_bHasDeadline
+	// One Next or Skip at a time, each waiting on the scan if it has to
+	CComAutoCriticalSection m_csFetch;
+	// Guarded by the object lock
+	ULONG m_iCursor;  // index of the next of the scan's results to use
+	ULONG m_cResets;  // so a fetch can tell it was Reset while it waited
+	// Once set, everything this is going to hand back has been
+	bool m_bTimedOut;
+};
+
+}  // namespace ADSX
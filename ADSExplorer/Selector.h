@@ -0,0 +1,821 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A small query language for picking out streams, compiled to a flat list of
+ * instructions so it can run on every stream inside the enumeration and scan
+ * loops, before any item ID is made for one that doesn't match.
+ *
+ *   name:*.txt            stream name glob (* and ?, no case)
+ *   name=Zone.Identifier  stream name, exactly but for case
+ *   name~"^[0-9a-f]+$"    stream name regex (ECMAScript, no case)
+ *   path:C:\Users\*       the same three on the path of the file it's on
+ *   size>4k  size<=1mb  size=0  size!=26  size:1k..64k
+ *   type:zip              what the first bytes say it is (see ContentTypes)
+ *   not x, !x, -x         x and y (or just x y), x or y, (x)
+ *   Zone.Identifier       a bare word or "quoted string" is a name glob
+ *
+ * Values with spaces or closing parentheses go in double quotes; \" is a
+ * quote inside them, and any other backslash is left as it is (\\ too, but
+ * it doesn't escape a quote after it, so a regex can end in one).
+ *
+ * The operands of each "and" and "or" are reordered cheapest first, since
+ * they can't have side effects: sizes, then names (whose hash is worked out
+ * once and compared against every name=), then paths, regexes, and content
+ * last, as it takes reading the stream. Three or more name= under one "or"
+ * become a single lookup in a sorted table of hashes. Globs that are only a
+ * prefix, a suffix or an infix become plain comparisons.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <regex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "StreamInfo.h"
+
+namespace ADSX::Selector {
+
+using StreamInfo::NameChar;
+using StreamInfo::NameView;
+using Name = std::basic_string<NameChar>;
+
+
+enum class ContentType : std::uint8_t {
+	Empty,
+	Text,          // ASCII or UTF-8 without control characters
+	Utf16,         // has a UTF-16 byte order mark
+	ZoneTransfer,  // "[ZoneTransfer]", as in Zone.Identifier
+	PropertySet,   // an OLE property set, as in SummaryInformation
+	Ole,           // a compound file
+	Zip,
+	Pdf,
+	Png,
+	Jpeg,
+	Gif,
+	Executable,    // "MZ"
+	Binary,        // anything else
+};
+
+struct ContentTypeName {
+	const char *pszName;
+	ContentType type;
+};
+
+inline constexpr ContentTypeName ContentTypes[] = {
+	{"empty", ContentType::Empty},
+	{"text", ContentType::Text},
+	{"utf16", ContentType::Utf16},
+	{"zone", ContentType::ZoneTransfer},
+	{"propset", ContentType::PropertySet},
+	{"ole", ContentType::Ole},
+	{"zip", ContentType::Zip},
+	{"pdf", ContentType::Pdf},
+	{"png", ContentType::Png},
+	{"jpeg", ContentType::Jpeg},
+	{"gif", ContentType::Gif},
+	{"exe", ContentType::Executable},
+	{"binary", ContentType::Binary},
+};
+
+// How much of a stream Sniff wants to see
+inline constexpr std::size_t cbSniff = 512;
+
+// What the first bytes of a stream say it is.
+inline ContentType Sniff(const unsigned char *pb, std::size_t cb) {
+	auto fnStartsWith = [&](const char *psz, std::size_t cch) {
+		return cb >= cch && std::equal(pb, pb + cch, reinterpret_cast<const unsigned char *>(psz));
+	};
+	if (cb == 0) return ContentType::Empty;
+	const unsigned char abUtf8Bom[] = {0xEF, 0xBB, 0xBF};
+	const std::size_t ibText = cb >= 3 && std::equal(pb, pb + 3, abUtf8Bom) ? 3 : 0;
+	if (
+		cb - ibText >= 14 &&
+		std::equal(pb + ibText, pb + ibText + 14, reinterpret_cast<const unsigned char *>("[ZoneTransfer]"))
+	) {
+		return ContentType::ZoneTransfer;
+	}
+	if (fnStartsWith("\xFE\xFF\x00\x00", 4)) return ContentType::PropertySet;
+	if (fnStartsWith("\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", 8)) return ContentType::Ole;
+	if (fnStartsWith("PK\x03\x04", 4)) return ContentType::Zip;
+	if (fnStartsWith("%PDF", 4)) return ContentType::Pdf;
+	if (fnStartsWith("\x89PNG", 4)) return ContentType::Png;
+	if (fnStartsWith("\xFF\xD8\xFF", 3)) return ContentType::Jpeg;
+	if (fnStartsWith("GIF8", 4)) return ContentType::Gif;
+	if (fnStartsWith("MZ", 2)) return ContentType::Executable;
+	if (fnStartsWith("\xFF\xFE", 2) || fnStartsWith("\xFE\xFF", 2)) return ContentType::Utf16;
+	for (std::size_t i = ibText; i < cb; i++) {
+		if (pb[i] < 0x20 && pb[i] != '\t' && pb[i] != '\r' && pb[i] != '\n') return ContentType::Binary;
+	}
+	return ContentType::Text;
+}
+
+
+// One stream, as the program sees it
+struct Candidate {
+	NameView svName;  // undecorated: "Zone.Identifier"
+	std::uint64_t ullSize;
+	NameView svPath;  // of the file or directory it's on
+	// Reads up to cb bytes from the start of the stream into pb and returns
+	// how many it got, for type:. Left null, no stream matches a type.
+	std::size_t (*pfnRead)(void *pvContext, unsigned char *pb, std::size_t cb) = nullptr;
+	void *pvContext = nullptr;
+};
+
+struct Error {
+	std::string sMessage;
+	std::size_t ich;  // where in the query it went wrong
+};
+
+
+inline NameChar FoldChar(NameChar ch) {
+	return ch >= 'A' && ch <= 'Z' ? static_cast<NameChar>(ch - 'A' + 'a') : ch;
+}
+
+// FNV-1a over the case-folded name
+inline std::uint32_t HashFolded(NameView sv) {
+	std::uint32_t uHash = 2166136261u;
+	for (NameChar ch : sv) {
+		uHash ^= FoldChar(ch);
+		uHash *= 16777619u;
+	}
+	return uHash;
+}
+
+// @pre: svFolded is folded already.
+inline bool EqualFolded(NameView sv, NameView svFolded) {
+	if (sv.size() != svFolded.size()) return false;
+	for (std::size_t i = 0; i < sv.size(); i++) {
+		if (FoldChar(sv[i]) != svFolded[i]) return false;
+	}
+	return true;
+}
+
+// * is any run of characters, backslashes included; ? any one.
+// @pre: svPattern is folded already.
+inline bool GlobFolded(NameView sv, NameView svPattern) {
+	std::size_t i = 0, iPattern = 0;
+	// Where the last * was, and how much of sv it's taken so far
+	std::size_t iStar = NameView::npos, iStarMatch = 0;
+	while (i < sv.size()) {
+		if (iPattern < svPattern.size() && svPattern[iPattern] == '*') {
+			iStar = iPattern++;
+			iStarMatch = i;
+		} else if (
+			iPattern < svPattern.size() &&
+			(svPattern[iPattern] == '?' || svPattern[iPattern] == FoldChar(sv[i]))
+		) {
+			i++;
+			iPattern++;
+		} else if (iStar != NameView::npos) {
+			// Let the last * take one more and try again from there
+			iPattern = iStar + 1;
+			i = ++iStarMatch;
+		} else {
+			return false;
+		}
+	}
+	while (iPattern < svPattern.size() && svPattern[iPattern] == '*') iPattern++;
+	return iPattern == svPattern.size();
+}
+
+
+class CProgram {
+  public:
+	enum class Op : std::uint8_t {
+		SizeIn,       // ullA <= size <= ullB
+		Equal,        // field equals operand uArg; for names, ullA is its hash
+		NameIn,       // the name is one of table uArg
+		Prefix,       // field starts with operand uArg
+		Suffix,
+		Contains,
+		Glob,
+		Regex,        // field matches regex uArg
+		Type,         // content type is ullA
+		Not,
+		JumpIfFalse,  // to instruction uArg
+		JumpIfTrue,
+	};
+
+	enum Field : std::uint8_t { FIELD_NAME, FIELD_PATH };
+
+	struct Instruction {
+		Op op;
+		std::uint8_t uField;
+		std::uint32_t uArg;
+		std::uint64_t ullA;
+		std::uint64_t ullB;
+	};
+
+	/**
+	 * Compile svQuery. An empty query matches everything.
+	 * @post: returns false, with *pError saying why and where, if it's not
+	 *        a query.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static bool Compile(NameView svQuery, CProgram *pProgram, Error *pError);
+
+	bool Matches(const Candidate &candidate) const {
+		bool bResult = true;
+		bool bHashed = false;
+		std::uint32_t uNameHash = 0;
+		int iType = -1;  // not sniffed yet
+		const std::size_t cInstructions = m_code.size();
+		for (std::size_t iPc = 0; iPc < cInstructions; iPc++) {
+			const Instruction &instruction = m_code[iPc];
+			const NameView svField = instruction.uField == FIELD_NAME ? candidate.svName : candidate.svPath;
+			switch (instruction.op) {
+				case Op::SizeIn:
+					bResult = candidate.ullSize >= instruction.ullA && candidate.ullSize <= instruction.ullB;
+					break;
+				case Op::Equal: {
+					const Name &sOperand = m_operands[instruction.uArg];
+					if (svField.size() != sOperand.size()) {
+						bResult = false;
+						break;
+					}
+					if (instruction.uField == FIELD_NAME) {
+						if (!bHashed) {
+							uNameHash = HashFolded(svField);
+							bHashed = true;
+						}
+						if (uNameHash != instruction.ullA) {
+							bResult = false;
+							break;
+						}
+					}
+					bResult = EqualFolded(svField, sOperand);
+					break;
+				}
+				case Op::NameIn: {
+					if (!bHashed) {
+						uNameHash = HashFolded(candidate.svName);
+						bHashed = true;
+					}
+					const std::vector<HashedOperand> &table = m_tables[instruction.uArg];
+					auto it = std::lower_bound(
+						table.begin(), table.end(), HashedOperand{uNameHash, 0},
+						[](const HashedOperand &a, const HashedOperand &b) { return a.uHash < b.uHash; }
+					);
+					bResult = false;
+					for (; it != table.end() && it->uHash == uNameHash; ++it) {
+						if (EqualFolded(candidate.svName, m_operands[it->iOperand])) {
+							bResult = true;
+							break;
+						}
+					}
+					break;
+				}
+				case Op::Prefix: {
+					const Name &sOperand = m_operands[instruction.uArg];
+					bResult = svField.size() >= sOperand.size() &&
+						EqualFolded(svField.substr(0, sOperand.size()), sOperand);
+					break;
+				}
+				case Op::Suffix: {
+					const Name &sOperand = m_operands[instruction.uArg];
+					bResult = svField.size() >= sOperand.size() &&
+						EqualFolded(svField.substr(svField.size() - sOperand.size()), sOperand);
+					break;
+				}
+				case Op::Contains:
+					bResult = ContainsFolded(svField, m_operands[instruction.uArg]);
+					break;
+				case Op::Glob:
+					bResult = GlobFolded(svField, m_operands[instruction.uArg]);
+					break;
+				case Op::Regex:
+					bResult = RegexSearch(svField, m_regexes[instruction.uArg]);
+					break;
+				case Op::Type:
+					if (iType < 0) iType = SniffCandidate(candidate);
+					bResult = iType == static_cast<int>(instruction.ullA);
+					break;
+				case Op::Not:
+					bResult = !bResult;
+					break;
+				case Op::JumpIfFalse:
+					if (!bResult) iPc = instruction.uArg - 1;
+					break;
+				case Op::JumpIfTrue:
+					if (bResult) iPc = instruction.uArg - 1;
+					break;
+			}
+		}
+		return bResult;
+	}
+
+	// Whether Matches looks at svPath, so callers can skip making one
+	bool UsesPath() const { return m_bUsesPath; }
+	// Whether it might read the stream
+	bool UsesContent() const { return m_bUsesContent; }
+
+	const std::vector<Instruction> &Code() const { return m_code; }
+
+  private:
+	struct HashedOperand {
+		std::uint32_t uHash;
+		std::uint32_t iOperand;
+	};
+
+	// What the parser builds, before it's ordered and flattened
+	struct Node {
+		enum class Kind { Test, Not, And, Or } kind = Kind::Test;
+		Instruction test = {};
+		std::vector<Node> children;
+		unsigned uCost = 0;
+	};
+
+	class CParser;
+
+	// Most of a regex's cost is std::regex itself; wchar_t is the only
+	// 16-bit-capable character type it's guaranteed to handle
+	using Regex = std::basic_regex<wchar_t>;
+
+	static bool RegexSearch(NameView sv, const Regex &regex) {
+		if constexpr (std::is_same_v<NameChar, wchar_t>) {
+			return std::regex_search(sv.data(), sv.data() + sv.size(), regex);
+		} else {
+			const std::wstring s(sv.begin(), sv.end());
+			return std::regex_search(s, regex);
+		}
+	}
+
+	// @pre: svFolded is folded already.
+	static bool ContainsFolded(NameView sv, NameView svFolded) {
+		if (svFolded.size() > sv.size()) return false;
+		for (std::size_t i = 0; i + svFolded.size() <= sv.size(); i++) {
+			if (EqualFolded(sv.substr(i, svFolded.size()), svFolded)) return true;
+		}
+		return false;
+	}
+
+	static int SniffCandidate(const Candidate &candidate) {
+		if (candidate.pfnRead == nullptr) return -2;  // matches no type
+		unsigned char ab[cbSniff];
+		const std::size_t cb = candidate.pfnRead(candidate.pvContext, ab, sizeof(ab));
+		return static_cast<int>(Sniff(ab, (std::min)(cb, sizeof(ab))));
+	}
+
+	// Cheapest first under every "and" and "or", and runs of name= under an
+	// "or" into one table
+	void Optimize(Node &node);
+	void Emit(const Node &node);
+
+	std::vector<Instruction> m_code;
+	std::vector<Name> m_operands;  // folded
+	std::vector<Regex> m_regexes;
+	std::vector<std::vector<HashedOperand>> m_tables;  // sorted by hash
+	bool m_bUsesPath = false;
+	bool m_bUsesContent = false;
+};
+
+
+class CProgram::CParser {
+  public:
+	CParser(NameView svQuery, CProgram &program) : m_sv(svQuery), m_ich(0), m_program(program) {}
+
+	bool Parse(Node *pRoot, Error *pError) {
+		SkipSpace();
+		if (m_ich == m_sv.size()) {
+			pRoot->kind = Node::Kind::And;  // of nothing: true
+			pRoot->uCost = 0;
+			return true;
+		}
+		if (!ParseOr(pRoot)) {
+			*pError = Error{m_sError, m_ich};
+			return false;
+		}
+		SkipSpace();
+		if (m_ich != m_sv.size()) {
+			*pError = Error{m_ich < m_sv.size() && m_sv[m_ich] == ')' ? "Unmatched )" : "Expected and/or", m_ich};
+			return false;
+		}
+		return true;
+	}
+
+  private:
+	bool Fail(const char *pszError) {
+		m_sError = pszError;
+		return false;
+	}
+
+	void SkipSpace() {
+		while (m_ich < m_sv.size() && (m_sv[m_ich] == ' ' || m_sv[m_ich] == '\t')) m_ich++;
+	}
+
+	bool AtEnd() {
+		SkipSpace();
+		return m_ich == m_sv.size();
+	}
+
+	static bool IsWordChar(NameChar ch) {
+		return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+	}
+
+	// The keyword and whatever space follows, if it's there as a word of
+	// its own
+	bool Keyword(const char *pszKeyword) {
+		SkipSpace();
+		std::size_t ich = m_ich;
+		for (const char *pch = pszKeyword; *pch != '\0'; pch++, ich++) {
+			if (ich == m_sv.size() || FoldChar(m_sv[ich]) != static_cast<NameChar>(*pch)) return false;
+		}
+		if (ich < m_sv.size() && m_sv[ich] != ' ' && m_sv[ich] != '\t' && m_sv[ich] != '(') return false;
+		m_ich = ich;
+		return true;
+	}
+
+	bool Symbol(char ch) {
+		SkipSpace();
+		if (m_ich == m_sv.size() || m_sv[m_ich] != static_cast<NameChar>(ch)) return false;
+		m_ich++;
+		return true;
+	}
+
+	bool ParseOr(Node *pNode) {
+		Node first;
+		if (!ParseAnd(&first)) return false;
+		if (!(Keyword("or") || Symbol('|'))) {
+			*pNode = std::move(first);
+			return true;
+		}
+		pNode->kind = Node::Kind::Or;
+		pNode->children.push_back(std::move(first));
+		do {
+			Node next;
+			if (!ParseAnd(&next)) return false;
+			pNode->children.push_back(std::move(next));
+		} while (Keyword("or") || Symbol('|'));
+		return true;
+	}
+
+	bool ParseAnd(Node *pNode) {
+		Node first;
+		if (!ParseUnary(&first)) return false;
+		pNode->kind = Node::Kind::And;
+		pNode->children.push_back(std::move(first));
+		for (;;) {
+			if (AtEnd() || m_sv[m_ich] == ')' || m_sv[m_ich] == '|') break;
+			{
+				// Peek: "or" ends this "and"
+				const std::size_t ich = m_ich;
+				if (Keyword("or")) {
+					m_ich = ich;
+					break;
+				}
+			}
+			if (!Keyword("and")) Symbol('&');
+			Node next;
+			if (!ParseUnary(&next)) return false;
+			pNode->children.push_back(std::move(next));
+		}
+		if (pNode->children.size() == 1) {
+			Node only = std::move(pNode->children[0]);
+			*pNode = std::move(only);
+		}
+		return true;
+	}
+
+	bool ParseUnary(Node *pNode) {
+		if (Keyword("not") || Symbol('!') || Symbol('-')) {
+			Node operand;
+			if (!ParseUnary(&operand)) return false;
+			pNode->kind = Node::Kind::Not;
+			pNode->children.push_back(std::move(operand));
+			return true;
+		}
+		if (Symbol('(')) {
+			if (!ParseOr(pNode)) return false;
+			if (!Symbol(')')) return Fail("Expected )");
+			return true;
+		}
+		if (AtEnd()) return Fail("Expected a test");
+		return ParseTest(pNode);
+	}
+
+	// A value runs to the next space or ), or is quoted.
+	bool ReadValue(Name *psValue) {
+		psValue->clear();
+		if (m_ich < m_sv.size() && m_sv[m_ich] == '"') {
+			m_ich++;
+			for (;;) {
+				if (m_ich == m_sv.size()) return Fail("Unterminated quote");
+				const NameChar ch = m_sv[m_ich++];
+				if (ch == '"') break;
+				if (ch == '\\' && m_ich < m_sv.size() && m_sv[m_ich] == '"') {
+					*psValue += m_sv[m_ich++];
+				} else if (ch == '\\' && m_ich < m_sv.size() && m_sv[m_ich] == '\\') {
+					// Both kept, but the second doesn't escape what's next
+					*psValue += ch;
+					*psValue += m_sv[m_ich++];
+				} else {
+					*psValue += ch;
+				}
+			}
+			return true;
+		}
+		while (
+			m_ich < m_sv.size() &&
+			m_sv[m_ich] != ' ' && m_sv[m_ich] != '\t' && m_sv[m_ich] != ')'
+		) {
+			*psValue += m_sv[m_ich++];
+		}
+		if (psValue->empty()) return Fail("Expected a value");
+		return true;
+	}
+
+	bool ParseTest(Node *pNode) {
+		pNode->kind = Node::Kind::Test;
+		const std::size_t ichStart = m_ich;
+		std::size_t ich = m_ich;
+		while (ich < m_sv.size() && IsWordChar(m_sv[ich])) ich++;
+		Name sField;
+		for (std::size_t i = m_ich; i < ich; i++) sField += FoldChar(m_sv[i]);
+		// "size > 4k" too
+		while (ich < m_sv.size() && ich > m_ich && (m_sv[ich] == ' ' || m_sv[ich] == '\t')) ich++;
+		const NameChar chOp = ich < m_sv.size() ? m_sv[ich] : NameChar(0);
+		const bool bOp = chOp == ':' || chOp == '=' || chOp == '~' || chOp == '<' || chOp == '>' || chOp == '!';
+
+		auto fnIs = [&](const char *psz) {
+			return sField.size() == std::char_traits<char>::length(psz) &&
+				std::equal(sField.begin(), sField.end(), psz);
+		};
+		if (bOp && fnIs("size")) {
+			m_ich = ich;
+			return ParseSize(pNode);
+		}
+		if (bOp && fnIs("type")) {
+			m_ich = ich;
+			if (!Symbol(':')) return Fail("Expected type:");
+			Name sType;
+			if (!ReadValue(&sType)) return false;
+			for (const ContentTypeName &name : ContentTypes) {
+				if (EqualFolded(sType, Name(name.pszName, name.pszName + std::char_traits<char>::length(name.pszName)))) {
+					pNode->test = Instruction{Op::Type, FIELD_NAME, 0, static_cast<std::uint64_t>(name.type), 0};
+					pNode->uCost = 1000;
+					m_program.m_bUsesContent = true;
+					return true;
+				}
+			}
+			return Fail("Unknown type; try text, zone, propset, ole, zip, pdf, png, jpeg, gif, exe, utf16, empty or binary");
+		}
+		std::uint8_t uField = FIELD_NAME;
+		if (bOp && (fnIs("name") || fnIs("path"))) {
+			uField = fnIs("name") ? FIELD_NAME : FIELD_PATH;
+			m_ich = ich;
+		} else {
+			// A bare name glob
+			m_ich = ichStart;
+			Name sValue;
+			if (!ReadValue(&sValue)) return false;
+			return MakeStringTest(pNode, FIELD_NAME, ':', sValue);
+		}
+		const NameChar ch = m_sv[m_ich++];
+		if (ch != ':' && ch != '=' && ch != '~') {
+			m_ich--;
+			return Fail("Expected :, = or ~");
+		}
+		Name sValue;
+		if (!ReadValue(&sValue)) return false;
+		return MakeStringTest(pNode, uField, static_cast<char>(ch), sValue);
+	}
+
+	bool MakeStringTest(Node *pNode, std::uint8_t uField, char chOp, const Name &sValue) {
+		const unsigned uPathCost = uField == FIELD_PATH ? 2 : 0;
+		if (uField == FIELD_PATH) m_program.m_bUsesPath = true;
+		if (chOp == '~') {
+			try {
+				m_program.m_regexes.emplace_back(
+					std::wstring(sValue.begin(), sValue.end()),
+					std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize
+				);
+			} catch (const std::regex_error &) {
+				return Fail("Not a regex");
+			}
+			pNode->test = Instruction{
+				Op::Regex, uField, static_cast<std::uint32_t>(m_program.m_regexes.size() - 1), 0, 0
+			};
+			pNode->uCost = 40 + uPathCost;
+			return true;
+		}
+
+		Name sFolded;
+		for (NameChar ch : sValue) sFolded += FoldChar(ch);
+		Op op = Op::Equal;
+		if (chOp == ':') {
+			// The common shapes of glob get a comparison of their own
+			const std::size_t cStars = std::count(sFolded.begin(), sFolded.end(), NameChar('*'));
+			const bool bQuestion = sFolded.find('?') != Name::npos;
+			const bool bLeading = !sFolded.empty() && sFolded.front() == '*';
+			const bool bTrailing = sFolded.size() > 1 && sFolded.back() == '*';
+			if (bQuestion || cStars > 2 || (cStars > 0 && !bLeading && !bTrailing) || (cStars == 2 && !(bLeading && bTrailing))) {
+				op = Op::Glob;
+			} else if (cStars == 2) {
+				op = Op::Contains;
+				sFolded = sFolded.substr(1, sFolded.size() - 2);
+			} else if (bLeading) {
+				op = Op::Suffix;
+				sFolded.erase(0, 1);
+			} else if (bTrailing) {
+				op = Op::Prefix;
+				sFolded.pop_back();
+			}
+		}
+		static const unsigned auCost[] = {0, 2, 3, 3, 3, 5, 6};
+		pNode->uCost = auCost[static_cast<int>(op)] + uPathCost;
+		m_program.m_operands.push_back(sFolded);
+		pNode->test = Instruction{
+			op, uField, static_cast<std::uint32_t>(m_program.m_operands.size() - 1),
+			op == Op::Equal ? HashFolded(sFolded) : 0, 0
+		};
+		return true;
+	}
+
+	// size<n, size<=n, size>n, size>=n, size=n, size!=n, size:lo..hi
+	bool ParseSize(Node *pNode) {
+		constexpr std::uint64_t ullMax = (std::numeric_limits<std::uint64_t>::max)();
+		std::uint64_t ullLow = 0, ullHigh = ullMax;
+		bool bNot = false;
+		if (Symbol(':')) {
+			if (!ReadSize(&ullLow)) return false;
+			if (!(Symbol('.') && Symbol('.'))) return Fail("Expected ..");
+			if (!ReadSize(&ullHigh)) return false;
+		} else if (Symbol('<')) {
+			const bool bEqual = Symbol('=');
+			if (!ReadSize(&ullHigh)) return false;
+			if (!bEqual) {
+				if (ullHigh == 0) return Fail("Nothing is smaller than 0");
+				ullHigh--;
+			}
+		} else if (Symbol('>')) {
+			const bool bEqual = Symbol('=');
+			if (!ReadSize(&ullLow)) return false;
+			if (!bEqual) {
+				if (ullLow == ullMax) return Fail("Too big");
+				ullLow++;
+			}
+		} else if (Symbol('=')) {
+			if (!ReadSize(&ullLow)) return false;
+			ullHigh = ullLow;
+		} else if (Symbol('!') && Symbol('=')) {
+			if (!ReadSize(&ullLow)) return false;
+			ullHigh = ullLow;
+			bNot = true;
+		} else {
+			return Fail("Expected <, <=, >, >=, =, != or :");
+		}
+		Node test;
+		test.kind = Node::Kind::Test;
+		test.test = Instruction{Op::SizeIn, FIELD_NAME, 0, ullLow, ullHigh};
+		test.uCost = 1;
+		if (!bNot) {
+			*pNode = std::move(test);
+		} else {
+			pNode->kind = Node::Kind::Not;
+			pNode->children.push_back(std::move(test));
+		}
+		return true;
+	}
+
+	// A number, then maybe b, k, kb, m, mb, g, gb, t or tb (powers of 1024)
+	bool ReadSize(std::uint64_t *pull) {
+		SkipSpace();
+		const std::size_t ichStart = m_ich;
+		std::uint64_t ull = 0;
+		while (m_ich < m_sv.size() && m_sv[m_ich] >= '0' && m_sv[m_ich] <= '9') {
+			const unsigned uDigit = static_cast<unsigned>(m_sv[m_ich] - '0');
+			if (ull > ((std::numeric_limits<std::uint64_t>::max)() - uDigit) / 10) return Fail("Too big");
+			ull = ull * 10 + uDigit;
+			m_ich++;
+		}
+		if (m_ich == ichStart) return Fail("Expected a size");
+		unsigned uShift = 0;
+		if (m_ich < m_sv.size()) {
+			switch (FoldChar(m_sv[m_ich])) {
+				case 'k': uShift = 10; break;
+				case 'm': uShift = 20; break;
+				case 'g': uShift = 30; break;
+				case 't': uShift = 40; break;
+				default: break;
+			}
+			if (uShift != 0) m_ich++;
+			if (m_ich < m_sv.size() && FoldChar(m_sv[m_ich]) == 'b') m_ich++;
+		}
+		if (uShift != 0 && ull > ((std::numeric_limits<std::uint64_t>::max)() >> uShift)) return Fail("Too big");
+		*pull = ull << uShift;
+		return true;
+	}
+
+	NameView m_sv;
+	std::size_t m_ich;
+	CProgram &m_program;
+	const char *m_sError = "";
+};
+
+
+inline bool CProgram::Compile(NameView svQuery, CProgram *pProgram, Error *pError) {
+	*pProgram = CProgram();
+	Node root;
+	CParser parser(svQuery, *pProgram);
+	if (!parser.Parse(&root, pError)) return false;
+	pProgram->Optimize(root);
+	pProgram->Emit(root);
+	return true;
+}
+
+
+inline void CProgram::Optimize(Node &node) {
+	for (Node &child : node.children) Optimize(child);
+	if (node.kind == Node::Kind::Test) return;
+	if (node.kind == Node::Kind::Not) {
+		node.uCost = node.children[0].uCost;
+		return;
+	}
+
+	// "a and (b and c)" is "a and b and c"
+	std::vector<Node> children;
+	for (Node &child : node.children) {
+		if (child.kind == node.kind) {
+			for (Node &grandchild : child.children) children.push_back(std::move(grandchild));
+		} else {
+			children.push_back(std::move(child));
+		}
+	}
+
+	if (node.kind == Node::Kind::Or) {
+		std::vector<std::uint32_t> aiNames;
+		for (const Node &child : children) {
+			if (child.kind == Node::Kind::Test && child.test.op == Op::Equal && child.test.uField == FIELD_NAME) {
+				aiNames.push_back(child.test.uArg);
+			}
+		}
+		if (aiNames.size() >= 3) {
+			std::vector<HashedOperand> table;
+			for (std::uint32_t iOperand : aiNames) table.push_back(HashedOperand{HashFolded(m_operands[iOperand]), iOperand});
+			std::sort(table.begin(), table.end(), [](const HashedOperand &a, const HashedOperand &b) {
+				return a.uHash < b.uHash;
+			});
+			m_tables.push_back(std::move(table));
+			children.erase(
+				std::remove_if(children.begin(), children.end(), [](const Node &child) {
+					return child.kind == Node::Kind::Test && child.test.op == Op::Equal && child.test.uField == FIELD_NAME;
+				}),
+				children.end()
+			);
+			Node lookup;
+			lookup.kind = Node::Kind::Test;
+			lookup.test = Instruction{Op::NameIn, FIELD_NAME, static_cast<std::uint32_t>(m_tables.size() - 1), 0, 0};
+			lookup.uCost = 2;
+			children.push_back(std::move(lookup));
+		}
+	}
+
+	std::stable_sort(children.begin(), children.end(), [](const Node &a, const Node &b) {
+		return a.uCost < b.uCost;
+	});
+	node.uCost = 0;
+	for (const Node &child : children) node.uCost += child.uCost;
+	node.children = std::move(children);
+	if (node.children.size() == 1) {
+		Node only = std::move(node.children[0]);
+		node = std::move(only);
+	}
+}
+
+
+inline void CProgram::Emit(const Node &node) {
+	switch (node.kind) {
+		case Node::Kind::Test:
+			m_code.push_back(node.test);
+			return;
+		case Node::Kind::Not:
+			Emit(node.children[0]);
+			m_code.push_back(Instruction{Op::Not, 0, 0, 0, 0});
+			return;
+		case Node::Kind::And:
+		case Node::Kind::Or: {
+			// Short-circuit: the first operand to settle it jumps to the end
+			// with the answer
+			const Op opJump = node.kind == Node::Kind::And ? Op::JumpIfFalse : Op::JumpIfTrue;
+			std::vector<std::size_t> aiJumps;
+			for (std::size_t i = 0; i < node.children.size(); i++) {
+				Emit(node.children[i]);
+				if (i + 1 < node.children.size()) {
+					aiJumps.push_back(m_code.size());
+					m_code.push_back(Instruction{opJump, 0, 0, 0, 0});
+				}
+			}
+			for (std::size_t iJump : aiJumps) m_code[iJump].uArg = static_cast<std::uint32_t>(m_code.size());
+			return;
+		}
+	}
+}
+
+}  // namespace ADSX::Selector
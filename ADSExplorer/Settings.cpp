@@ -0,0 +1,79 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "Settings.h"
+
+namespace ADSX {
+
+static constexpr WCHAR szSettingsKey[] = L"Software\\ADS Explorer";
+
+
+// Read a DWORD value, falling back to dwDefault if it's missing or isn't a
+// DWORD.
+static DWORD ReadDword(_In_ PCWSTR pszValue, _In_ DWORD dwDefault) {
+	DWORD dwValue;
+	DWORD cbValue = sizeof(dwValue);
+	const LSTATUS status = RegGetValueW(
+		HKEY_CURRENT_USER,
+		szSettingsKey,
+		pszValue,
+		RRF_RT_REG_DWORD,
+		NULL,
+		&dwValue,
+		&cbValue
+	);
+	if (status != ERROR_SUCCESS) return dwDefault;
+	LOG(L" ** Setting " << pszValue << L" = " << dwValue);
+	return dwValue;
+}
+
+
+// Compile a query value, or return null if it's missing, empty or wrong.
+static std::shared_ptr<const Selector::CProgram> ReadQuery(_In_ PCWSTR pszValue) {
+	WCHAR szQuery[1024];
+	DWORD cbQuery = sizeof(szQuery);
+	const LSTATUS status = RegGetValueW(
+		HKEY_CURRENT_USER,
+		szSettingsKey,
+		pszValue,
+		RRF_RT_REG_SZ,
+		NULL,
+		szQuery,
+		&cbQuery
+	);
+	if (status != ERROR_SUCCESS || szQuery[0] == L'\0') return nullptr;
+	LOG(L" ** Setting " << pszValue << L" = " << szQuery);
+	try {
+		auto pProgram = std::make_shared<Selector::CProgram>();
+		Selector::Error error;
+		if (!Selector::CProgram::Compile(szQuery, pProgram.get(), &error)) {
+			LOG(L" ** " << pszValue << L" doesn't compile at " << error.ich << L": " << error.sMessage.c_str());
+			return nullptr;
+		}
+		return pProgram;
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+
+CSettings::CSettings()
+	: dwEnumTimeoutMs(ReadDword(L"EnumerationTimeoutMs", 5000))
+	, cIoLimitRotational(ReadDword(L"IoLimitRotational", 2))
+	, cIoLimitSolidState(ReadDword(L"IoLimitSolidState", 8))
+	, cIoLimitNvme(ReadDword(L"IoLimitNvme", 32))
+	, cIoLimitRemote(ReadDword(L"IoLimitRemote", 4))
+	, cIoLimitUnknown(ReadDword(L"IoLimitUnknown", 4))
+	, pStreamQuery(ReadQuery(L"StreamQuery")) {}
+
+
+const CSettings &CSettings::Get() {
+	// Thread-safe on first use ("magic statics")
+	static const CSettings settings;
+	return settings;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,51 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Knobs read from HKCU\Software\ADS Explorer. Read once per process; nothing
+ * here is worth watching the registry for.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <memory>
+
+#include "Selector.h"
+
+namespace ADSX {
+
+
+struct CSettings {
+	// Longest an enumeration waits on the filesystem before handing back
+	// whatever it has. 0 waits forever. Only enumerations that wait on a
+	// thread of their own (async ones, and those on slow volumes) have one.
+	// "EnumerationTimeoutMs", default 5 seconds
+	DWORD dwEnumTimeoutMs;
+
+	// How many requests each kind of device gets at once from us, scans and
+	// all. Volumes on the same disk, and shares on the same server, share.
+	// "IoLimitRotational", default 2
+	DWORD cIoLimitRotational;
+	// "IoLimitSolidState", default 8
+	DWORD cIoLimitSolidState;
+	// "IoLimitNvme", default 32
+	DWORD cIoLimitNvme;
+	// "IoLimitRemote", default 4
+	DWORD cIoLimitRemote;
+	// Whatever couldn't be told apart: "IoLimitUnknown", default 4
+	DWORD cIoLimitUnknown;
+
+	// Only streams matching this are listed, in folders and scans alike
+	// (see Selector.h for the language). Null if there's no "StreamQuery",
+	// or it didn't compile.
+	std::shared_ptr<const Selector::CProgram> pStreamQuery;
+
+	// The settings for this process
+	static const CSettings &Get();
+
+  protected:
+	CSettings();
+};
+
+}  // namespace ADSX
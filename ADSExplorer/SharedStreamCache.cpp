@@ -0,0 +1,261 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "SharedStreamCache.h"
+
+#include <AclAPI.h>
+#include <sddl.h>
+
+#include <new>
+#include <vector>
+
+namespace ADSX {
+
+// Local\ so it's per session: everything on one desktop shares it, and other
+// users' sessions never see it. The version is in the name so a DLL with a
+// different layout gets its own table instead of fighting over this one.
+#define ADSX_SHARED_CACHE_NAME L"Local\\ADSExplorer.StreamCache.v2"
+static_assert(SharedTable::uLayoutVersion == 2, "Update the section name too");
+
+// How long to wait before trying to map the section again after a failure
+static constexpr DWORD dwAttachRetryMs = 5000;
+
+
+// pInfo gets cls of this process's token.
+static bool QueryToken(_In_ TOKEN_INFORMATION_CLASS cls, _Out_ std::vector<BYTE> *pInfo) {
+	HANDLE hToken;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken)) return false;
+	defer({ CloseHandle(hToken); });
+	DWORD cb = 0;
+	GetTokenInformation(hToken, cls, NULL, 0, &cb);
+	if (cb == 0) return false;
+	try {
+		pInfo->resize(cb);
+	} catch (const std::bad_alloc &) {
+		return false;
+	}
+	return GetTokenInformation(hToken, cls, pInfo->data(), cb, &cb) != FALSE;
+}
+
+static DWORD IntegrityRid(_In_ PSID pLabel) {
+	return *GetSidSubAuthority(pLabel, *GetSidSubAuthorityCount(pLabel) - 1);
+}
+
+
+/**
+ * The section's security: owned by this user and only open to it, and
+ * labeled with this process's integrity level so nothing below it can write
+ * to it or read it. A sandboxed process running as the same user can't
+ * forge listings for Explorer to show, then.
+ * @post: *ppSD is to be LocalFree'd.
+ */
+static bool MakeSectionSecurity(
+	_In_  PSID                 pUser,
+	_In_  PSID                 pLabel,
+	_Out_ PSECURITY_DESCRIPTOR *ppSD
+) {
+	*ppSD = NULL;
+	PWSTR pszUser = NULL, pszLabel = NULL;
+	defer({ LocalFree(pszUser); LocalFree(pszLabel); });
+	if (!ConvertSidToStringSidW(pUser, &pszUser) || !ConvertSidToStringSidW(pLabel, &pszLabel)) {
+		return false;
+	}
+	std::wstring sSddl;
+	try {
+		sSddl = std::wstring(L"O:") + pszUser +
+			L"D:P(A;;GA;;;" + pszUser + L")" +
+			L"S:(ML;;NWNR;;;" + pszLabel + L")";
+	} catch (const std::bad_alloc &) {
+		return false;
+	}
+	return ConvertStringSecurityDescriptorToSecurityDescriptorW(
+		sSddl.c_str(), SDDL_REVISION_1, ppSD, NULL
+	) != FALSE;
+}
+
+
+/**
+ * Whether a section someone else made first is one this process would have
+ * made: owned by this user, and at no lower an integrity level than this
+ * process with writes from below it shut out. Anything at the same level as
+ * the same user could as well have been this process.
+ */
+static bool IsSectionTrusted(_In_ HANDLE hSection, _In_ PSID pUser, _In_ PSID pLabel) {
+	PSID pOwner = NULL;
+	PACL pSacl = NULL;
+	PSECURITY_DESCRIPTOR pSD = NULL;
+	if (GetSecurityInfo(
+		hSection, SE_KERNEL_OBJECT, OWNER_SECURITY_INFORMATION | LABEL_SECURITY_INFORMATION,
+		&pOwner, NULL, NULL, &pSacl, &pSD
+	) != ERROR_SUCCESS) {
+		return false;
+	}
+	defer({ LocalFree(pSD); });
+	if (pOwner == NULL || !EqualSid(pOwner, pUser)) return false;
+
+	// No label is the default: medium, no writes up
+	DWORD dwRid = SECURITY_MANDATORY_MEDIUM_RID;
+	DWORD dwPolicy = SYSTEM_MANDATORY_LABEL_NO_WRITE_UP;
+	for (DWORD i = 0; pSacl != NULL && i < pSacl->AceCount; i++) {
+		PACE_HEADER pAce;
+		if (!GetAce(pSacl, i, reinterpret_cast<LPVOID *>(&pAce))) return false;
+		if (pAce->AceType != SYSTEM_MANDATORY_LABEL_ACE_TYPE) continue;
+		const auto pLabelAce = reinterpret_cast<SYSTEM_MANDATORY_LABEL_ACE *>(pAce);
+		dwRid = IntegrityRid(reinterpret_cast<PSID>(&pLabelAce->SidStart));
+		dwPolicy = pLabelAce->Mask;
+	}
+	return dwRid >= IntegrityRid(pLabel) && (dwPolicy & SYSTEM_MANDATORY_LABEL_NO_WRITE_UP);
+}
+
+
+CSharedStreamCache &CSharedStreamCache::Instance() {
+	// Thread-safe on first use ("magic statics")
+	static CSharedStreamCache cache;
+	return cache;
+}
+
+
+CSharedStreamCache::CSharedStreamCache()
+	: m_hSection(NULL)
+	, m_pvView(NULL)
+	, m_dwLastAttempt(0)
+	, m_bAttached(FALSE) {
+	InitializeCriticalSection(&m_csAttach);
+}
+
+CSharedStreamCache::~CSharedStreamCache() {
+	if (m_pvView != NULL) UnmapViewOfFile(m_pvView);
+	if (m_hSection != NULL) CloseHandle(m_hSection);
+	DeleteCriticalSection(&m_csAttach);
+}
+
+
+bool CSharedStreamCache::EnsureAttached() {
+	if (m_bAttached) return true;
+
+	EnterCriticalSection(&m_csAttach);
+	defer({ LeaveCriticalSection(&m_csAttach); });
+	if (m_bAttached) return true;
+	const DWORD dwNow = GetTickCount();
+	if (m_dwLastAttempt != 0 && dwNow - m_dwLastAttempt < dwAttachRetryMs) {
+		return false;
+	}
+	m_dwLastAttempt = dwNow;
+
+	if (m_pvView == NULL) {
+		std::vector<BYTE> user, label;
+		if (!QueryToken(TokenUser, &user) || !QueryToken(TokenIntegrityLevel, &label)) {
+			LOG(L" ** Couldn't query token for shared stream cache: " << GetLastError());
+			return false;
+		}
+		const PSID pUser = reinterpret_cast<TOKEN_USER *>(user.data())->User.Sid;
+		const PSID pLabel = reinterpret_cast<TOKEN_MANDATORY_LABEL *>(label.data())->Label.Sid;
+		PSECURITY_DESCRIPTOR pSD;
+		if (!MakeSectionSecurity(pUser, pLabel, &pSD)) {
+			LOG(L" ** Couldn't make shared stream cache's security: " << GetLastError());
+			return false;
+		}
+		defer({ LocalFree(pSD); });
+		SECURITY_ATTRIBUTES sa = {sizeof(sa), pSD, FALSE};
+
+		const ULONGLONG cbTable = SharedTable::CTable::RequiredSize();
+		// Backed by the page file and zero-filled, which is what Attach
+		// takes to mean "set me up".
+		m_hSection = CreateFileMappingW(
+			INVALID_HANDLE_VALUE,
+			&sa,
+			PAGE_READWRITE,
+			static_cast<DWORD>(cbTable >> 32),
+			static_cast<DWORD>(cbTable),
+			ADSX_SHARED_CACHE_NAME
+		);
+		if (m_hSection == NULL) {
+			LOG(L" ** Couldn't create shared stream cache: " << GetLastError());
+			return false;
+		}
+		// Then the security above was never applied; whoever got there first
+		// had better be someone we'd believe
+		if (GetLastError() == ERROR_ALREADY_EXISTS && !IsSectionTrusted(m_hSection, pUser, pLabel)) {
+			LOG(L" ** Shared stream cache was made by someone else; going without");
+			CloseHandle(m_hSection);
+			m_hSection = NULL;
+			return false;
+		}
+		m_pvView = MapViewOfFile(m_hSection, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		if (m_pvView == NULL) {
+			LOG(L" ** Couldn't map shared stream cache: " << GetLastError());
+			CloseHandle(m_hSection);
+			m_hSection = NULL;
+			return false;
+		}
+	}
+
+	// Views are allocation-granularity aligned, way past the 64 bytes needed
+	MEMORY_BASIC_INFORMATION Info;
+	if (
+		VirtualQuery(m_pvView, &Info, sizeof(Info)) == 0 ||
+		!m_table.Attach(m_pvView, Info.RegionSize)
+	) {
+		LOG(L" ** Shared stream cache isn't usable (yet)");
+		return false;
+	}
+	InterlockedExchange(&m_bAttached, TRUE);
+	return true;
+}
+
+
+HRESULT CSharedStreamCache::Find(
+	_In_                          const SharedTable::Key       &key,
+	_In_                          const SharedTable::Validator &validator,
+	_COM_Outptr_result_maybenull_ CStreamSnapshot              **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+	if (!EnsureAttached()) return S_FALSE;
+
+	// Copy it out first; the slot can be rewritten at any moment
+	CHeapPtr<BYTE> pbData;
+	if (!pbData.AllocateBytes(SharedTable::cbPayloadMax)) return E_OUTOFMEMORY;
+	SIZE_T cbData;
+	if (!m_table.Find(key, validator, pbData, SharedTable::cbPayloadMax, &cbData)) {
+		return S_FALSE;
+	}
+	// Any of this user's processes could have written it, so it goes through
+	// the same checks as what the kernel gives us.
+	HRESULT hr = CStreamSnapshot::Create(
+		StreamInfo::CReader(static_cast<const BYTE *>(pbData), cbData),
+		ppSnapshot
+	);
+	if (FAILED(hr)) {
+		LOG(L" ** Garbage in shared stream cache: " << HRESULTToString(hr));
+		return S_FALSE;
+	}
+	LOG(L" ** Shared stream cache hit");
+	return S_OK;
+}
+
+
+void CSharedStreamCache::Store(
+	_In_ const SharedTable::Key       &key,
+	_In_ const SharedTable::Validator &validator,
+	_In_ const CStreamSnapshot        &snapshot
+) {
+	if (!EnsureAttached()) return;
+
+	CHeapPtr<BYTE> pbData;
+	if (!pbData.AllocateBytes(SharedTable::cbPayloadMax)) return;
+	StreamInfo::CWriter writer(pbData, SharedTable::cbPayloadMax);
+	for (ULONG i = 0; i < snapshot.Count(); i++) {
+		const StreamInfo::NameView svName(snapshot.Name(i), snapshot.NameLength(i));
+		if (!writer.AppendData(svName, snapshot.Size(i), snapshot.Size(i))) {
+			// Too big to share
+			return;
+		}
+	}
+	m_table.Store(key, validator, pbData, writer.Size());
+}
+
+}  // namespace ADSX
@@ -0,0 +1,62 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The stream listings this process shares with every other process in the
+ * session that has us loaded, through a named section holding a
+ * SharedTable::CTable. Only this user's processes at this process's
+ * integrity level or above can write to it; one made by anything else is
+ * left alone.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "SharedTable.h"
+#include "StreamSnapshot.h"
+
+namespace ADSX {
+
+
+class CSharedStreamCache {
+  public:
+	// The one for this process. Maps the section on first use.
+	static CSharedStreamCache &Instance();
+
+	/**
+	 * Get the listing another process (or this one) published for key, if it
+	 * was taken when the file looked like validator says.
+	 * @post: *ppSnapshot has a reference for the caller to Release, or is NULL
+	 *        with S_FALSE returned on a miss.
+	 */
+	HRESULT Find(
+		_In_                          const SharedTable::Key       &key,
+		_In_                          const SharedTable::Validator &validator,
+		_COM_Outptr_result_maybenull_ CStreamSnapshot              **ppSnapshot
+	);
+
+	// Publish a listing. Best effort; ones too big for a slot aren't shared.
+	void Store(
+		_In_ const SharedTable::Key       &key,
+		_In_ const SharedTable::Validator &validator,
+		_In_ const CStreamSnapshot        &snapshot
+	);
+
+  protected:
+	CSharedStreamCache();
+	~CSharedStreamCache();
+
+	// Map the section if that hasn't worked yet. Retries are rate limited so
+	// a table that's unusable (another version) doesn't cost every lookup.
+	bool EnsureAttached();
+
+	CRITICAL_SECTION m_csAttach;
+	HANDLE m_hSection;
+	void *m_pvView;
+	DWORD m_dwLastAttempt;
+	SharedTable::CTable m_table;
+	// Set once m_table is attached; checked without m_csAttach
+	volatile LONG m_bAttached;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,303 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A fixed-size hash table of stream listings laid out in a block of memory
+ * that several processes map at once, so a file browsed in Explorer is
+ * already known to every file dialog in the session.
+ *
+ * No locks: every slot is a seqlock. Writers claim a slot by making its
+ * sequence number odd and publish by making it even again; readers copy a
+ * slot out and only believe the copy if the sequence number didn't move
+ * meanwhile. Whoever loses a race just misses the cache.
+ *
+ * A writer can die holding a slot (its process is killed, say). The slot
+ * says when it was claimed, and once it's been odd for ullClaimTimeoutNs the
+ * next writer that wants it takes it over. A writer that was only stalled
+ * that long finds out when it goes to publish and gives up, but whatever it
+ * was still copying can land in the entry that replaced its own. That's one
+ * more reason nothing read out of the table is trusted.
+ *
+ * Any process in the session can write to the table, so nothing read out of
+ * it is trusted: sizes are bounds-checked and the payload goes through
+ * StreamInfo::CReader like anything from the kernel does.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace ADSX::SharedTable {
+
+// 'ADSM' in memory order
+constexpr std::uint32_t uMagic = 0x4D534441;
+// Bump on any change to the structs below. A process that finds a table laid
+// out by another version leaves it alone and goes without.
+constexpr std::uint32_t uLayoutVersion = 2;
+
+constexpr std::size_t cSlots = 1024;
+static_assert((cSlots & (cSlots - 1)) == 0, "cSlots must be a power of two");
+// How far from its home slot an entry can end up
+constexpr std::size_t cProbes = 8;
+constexpr std::size_t cbSlot = 4096;
+// How long a slot can be being written before its writer is given up for
+// dead. Copying one in takes microseconds.
+constexpr std::uint64_t ullClaimTimeoutNs = 5'000'000'000;
+
+
+struct Key {
+	std::uint64_t ullVolumeSerial;
+	std::uint8_t abFileId[16];
+
+	bool operator==(const Key &other) const {
+		return (
+			ullVolumeSerial == other.ullVolumeSerial &&
+			std::memcmp(abFileId, other.abFileId, sizeof(abFileId)) == 0
+		);
+	}
+};
+
+// What the file looked like when the listing was taken
+struct Validator {
+	std::int64_t llLastWriteTime;
+	std::int64_t llChangeTime;
+
+	bool operator==(const Validator &other) const {
+		return (
+			llLastWriteTime == other.llLastWriteTime &&
+			llChangeTime == other.llChangeTime
+		);
+	}
+};
+
+
+// The atomics live in memory other processes map too, so they had better not
+// be a lock hidden somewhere in this process.
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+struct Header {
+	std::uint32_t uMagic;
+	std::uint32_t uLayoutVersion;
+	std::uint32_t cSlots;
+	std::uint32_t cbSlot;
+	// 0: fresh zeroed memory, 1: being set up, 2: ready. Setting up is only
+	// writing the constants above, so one left at 1 by a process that died
+	// at it is finished by the next to attach.
+	std::atomic<std::uint32_t> uState;
+	std::uint32_t uReserved;
+	// Handed out to slots as they're written, to find the oldest to replace
+	std::atomic<std::uint64_t> ullClock;
+	std::uint8_t abPad[32];
+};
+static_assert(sizeof(Header) == 64);
+
+struct Slot {
+	// 0: never written; odd: being written; even: holds an entry
+	std::atomic<std::uint32_t> uSeq;
+	std::uint32_t cbData;
+	std::uint64_t ullStamp;
+	Key key;
+	Validator validator;
+	// When the last writer set out to claim it, in steady_clock nanoseconds,
+	// which are the same in every process on the machine
+	std::atomic<std::uint64_t> ullClaimedAt;
+	// A FILE_STREAM_INFORMATION chain, cbData bytes long
+	alignas(8) std::uint8_t abData[cbSlot - 64];
+};
+static_assert(sizeof(Slot) == cbSlot);
+
+constexpr std::size_t cbPayloadMax = sizeof(Slot::abData);
+
+
+/**
+ * A view of a table in memory someone else provides (and maps, and unmaps).
+ */
+class CTable {
+  public:
+	CTable() : m_pHeader(nullptr), m_aSlots(nullptr) {}
+
+	static constexpr std::size_t RequiredSize() {
+		return sizeof(Header) + cSlots * sizeof(Slot);
+	}
+
+	/**
+	 * Start using the table in pv, setting it up first if the memory is
+	 * fresh (all zeroes).
+	 * @pre: pv is 64-byte aligned, at least RequiredSize() bytes.
+	 * @post: returns false if the table is laid out by another version.
+	 */
+	bool Attach(void *pv, std::size_t cb) {
+		if (pv == nullptr || cb < RequiredSize()) return false;
+		auto pHeader = static_cast<Header *>(pv);
+		std::uint32_t uState = 0;
+		pHeader->uState.compare_exchange_strong(uState, 1, std::memory_order_acq_rel);
+		if (uState != 2) {
+			// Fresh, or left half set up; or being set up right now, and then
+			// both write the same values
+			pHeader->uMagic = uMagic;
+			pHeader->uLayoutVersion = uLayoutVersion;
+			pHeader->cSlots = static_cast<std::uint32_t>(cSlots);
+			pHeader->cbSlot = static_cast<std::uint32_t>(cbSlot);
+			pHeader->uState.store(2, std::memory_order_release);
+		}
+		if (
+			pHeader->uMagic != uMagic ||
+			pHeader->uLayoutVersion != uLayoutVersion ||
+			pHeader->cSlots != cSlots ||
+			pHeader->cbSlot != cbSlot
+		) {
+			return false;
+		}
+		m_pHeader = pHeader;
+		m_aSlots = reinterpret_cast<Slot *>(static_cast<std::uint8_t *>(pv) + sizeof(Header));
+		return true;
+	}
+
+	bool IsAttached() const { return m_pHeader != nullptr; }
+
+	/**
+	 * Copy out the listing for key if there is one taken when the file looked
+	 * like validator says.
+	 * @pre: cbOut >= cbPayloadMax
+	 * @post: on success, pbOut[0..*pcbData) holds the listing. It's only as
+	 *        trustworthy as whoever wrote it.
+	 */
+	bool Find(
+		const Key       &key,
+		const Validator &validator,
+		void            *pbOut,
+		std::size_t     cbOut,
+		std::size_t     *pcbData
+	) const {
+		if (!IsAttached() || cbOut < cbPayloadMax) return false;
+		const std::size_t iHome = Hash(key);
+		for (std::size_t iProbe = 0; iProbe < cProbes; iProbe++) {
+			const Slot &slot = m_aSlots[(iHome + iProbe) & (cSlots - 1)];
+			const std::uint32_t uSeq1 = slot.uSeq.load(std::memory_order_acquire);
+			if (uSeq1 == 0 || uSeq1 % 2 != 0) continue;
+
+			Key keyRead;
+			Validator validatorRead;
+			std::memcpy(&keyRead, &slot.key, sizeof(keyRead));
+			std::memcpy(&validatorRead, &slot.validator, sizeof(validatorRead));
+			const std::uint32_t cbData = slot.cbData;
+			if (!(keyRead == key)) continue;
+			if (cbData > cbPayloadMax) continue;
+			std::memcpy(pbOut, slot.abData, cbData);
+
+			// Nothing copied above counts unless nobody wrote in the meantime
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.uSeq.load(std::memory_order_relaxed) != uSeq1) continue;
+
+			if (!(validatorRead == validator)) return false;
+			*pcbData = cbData;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Publish the listing for key, replacing whatever the key had before or
+	 * else the oldest entry near its home slot. A slot whose writer died
+	 * holding it is as good as empty.
+	 * @post: returns false if it didn't fit or lost a race for the slot.
+	 */
+	bool Store(
+		const Key       &key,
+		const Validator &validator,
+		const void      *pbData,
+		std::size_t     cbData
+	) {
+		if (!IsAttached() || cbData > cbPayloadMax) return false;
+
+		// Pick a slot. Nothing's held yet, so these reads are only hints.
+		const std::size_t iHome = Hash(key);
+		const std::uint64_t ullNow = Now();
+		Slot *pTarget = nullptr;
+		std::uint64_t ullOldest = UINT64_MAX;
+		for (std::size_t iProbe = 0; iProbe < cProbes; iProbe++) {
+			Slot &slot = m_aSlots[(iHome + iProbe) & (cSlots - 1)];
+			const std::uint32_t uSeq = slot.uSeq.load(std::memory_order_relaxed);
+			if (uSeq == 0 || (uSeq % 2 != 0 && IsAbandoned(slot, ullNow))) {
+				// Nothing worth keeping; use it unless the key turns up later
+				if (ullOldest != 0) {
+					pTarget = &slot;
+					ullOldest = 0;
+				}
+				continue;
+			}
+			if (uSeq % 2 != 0) continue;
+			Key keyRead;
+			std::memcpy(&keyRead, &slot.key, sizeof(keyRead));
+			if (keyRead == key) {
+				pTarget = &slot;
+				break;
+			}
+			if (slot.ullStamp < ullOldest) {
+				pTarget = &slot;
+				ullOldest = slot.ullStamp;
+			}
+		}
+		if (pTarget == nullptr) return false;
+
+		// Claim it, or take it over from a writer that's gone. Either way the
+		// number stays odd and isn't what it was, so a stalled writer's
+		// publish below fails.
+		std::uint32_t uSeq = pTarget->uSeq.load(std::memory_order_relaxed);
+		if (uSeq % 2 != 0 && !IsAbandoned(*pTarget, ullNow)) return false;
+		// Said first, so a live writer's slot never looks abandoned
+		pTarget->ullClaimedAt.store(ullNow, std::memory_order_relaxed);
+		const std::uint32_t uClaimed = uSeq + (uSeq % 2 != 0 ? 2 : 1);
+		if (!pTarget->uSeq.compare_exchange_strong(
+			uSeq, uClaimed, std::memory_order_acquire, std::memory_order_relaxed
+		)) {
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+
+		pTarget->cbData = static_cast<std::uint32_t>(cbData);
+		pTarget->ullStamp =
+			m_pHeader->ullClock.fetch_add(1, std::memory_order_relaxed) + 1;
+		std::memcpy(&pTarget->key, &key, sizeof(key));
+		std::memcpy(&pTarget->validator, &validator, sizeof(validator));
+		std::memcpy(pTarget->abData, pbData, cbData);
+
+		// Publish, unless it was taken over meanwhile
+		std::uint32_t uExpected = uClaimed;
+		return pTarget->uSeq.compare_exchange_strong(
+			uExpected, uClaimed + 1, std::memory_order_release, std::memory_order_relaxed
+		);
+	}
+
+  private:
+	static std::uint64_t Now() {
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count());
+	}
+
+	// Whether slot, which is odd, has been for so long its writer must be dead
+	static bool IsAbandoned(const Slot &slot, std::uint64_t ullNow) {
+		const std::uint64_t ullClaimedAt = slot.ullClaimedAt.load(std::memory_order_relaxed);
+		return ullNow > ullClaimedAt && ullNow - ullClaimedAt > ullClaimTimeoutNs;
+	}
+
+	static std::size_t Hash(const Key &key) {
+		// FNV-1a over the whole key
+		std::uint64_t ullHash = 14695981039346656037ull;
+		auto pb = reinterpret_cast<const std::uint8_t *>(&key);
+		for (std::size_t i = 0; i < sizeof(key); i++) {
+			ullHash = (ullHash ^ pb[i]) * 1099511628211ull;
+		}
+		return static_cast<std::size_t>(ullHash ^ (ullHash >> 32));
+	}
+
+	Header *m_pHeader;
+	Slot *m_aSlots;
+};
+
+}  // namespace ADSX::SharedTable
@@ -10,18 +10,53 @@
 #include "ShellFolder.h"
 
 #include <atlstr.h>
+#include <algorithm>
 #include <sstream>
 
 #include "EnumIDList.h"
 #include "ADSXItem.h"
 #include "DataObject.h"
+#include "DropTarget.h"
+#include "Settings.h"
 #include "ShellView.h"
+#include "StreamCache.h"
+#include "StreamContents.h"
+#include "StreamMenu.h"
+#include "FilterEnumIDList.h"
+#include "TreeEnumIDList.h"
+#include "TreeScanner.h"
+#include "Volume.h"
 
 // Debug log prefix for ADSX::CShellFolder
 #define P_RSF L"ADSX::CShellFolder(0x" << std::hex << this << L")::"
 
 namespace ADSX {
 
+// What the pseudofolders are called in a folder's view
+static constexpr WCHAR szTreeName[] = L"(All streams in subfolders)";
+static constexpr WCHAR szFilterName[] = L"(Files with streams)";
+// And what they're called for parsing, as in "C:\dir\::AllStreams". No file
+// can have a ':' in its name, so a real child of the folder is never taken
+// for one of them or the other way around.
+static constexpr WCHAR szTreeParsingName[] = L"::AllStreams";
+static constexpr WCHAR szFilterParsingName[] = L"::FilesWithStreams";
+
+// The way into a pseudofolder; fFlag is FLAG_TREE or FLAG_FILTER.
+// @post: returned pointer must be freed with CoTaskMemFree; NULL if out of
+//        memory.
+static PITEMID_CHILD NewPseudofolderPidl(_In_ BYTE fFlag) {
+	return fFlag == ADSX::CItem::FLAG_TREE ?
+		ADSX::CItem::NewPidl(szTreeName, _countof(szTreeName) - 1, 0, fFlag) :
+		ADSX::CItem::NewPidl(szFilterName, _countof(szFilterName) - 1, 0, fFlag);
+}
+
+// What pItem is called for parsing, relative to its folder
+static PCWSTR ParsingNameOf(_In_ const ADSX::CItem *pItem) {
+	if (pItem->fFlags & ADSX::CItem::FLAG_TREE) return szTreeParsingName;
+	if (pItem->fFlags & ADSX::CItem::FLAG_FILTER) return szFilterParsingName;
+	return pItem->szName;
+}
+
 /**
  * STRRET maker
  *
@@ -44,7 +79,13 @@ bool SetReturnString(_In_ PCWSTR pszSource, _Out_ STRRET *strret) {
 
 CShellFolder::CShellFolder()
 	: m_pidlaRoot(NULL)
-	, m_pidla(NULL) {
+	, m_pidla(NULL)
+	, m_bIsDirectory(false)
+	, m_bTree(false)
+	, m_bFilter(false)
+	, m_bHasBindDeadline(false)
+	, m_dwBindDeadline(0)
+	, m_Slowness(Slowness::Unknown) {
 	// LOG(P_RSF << L"CONSTRUCTOR");
 }
 
@@ -75,14 +116,42 @@ HRESULT CShellFolder::BindToObjectInitialize(
 	m_pidlaRoot = ILCloneFull(pidlaRoot);
 	if (m_pidlaRoot == NULL) return WrapReturn(E_OUTOFMEMORY);
 
+	// If the caller is on a clock, our enumeration is too
+	if (pbc != NULL) {
+		BIND_OPTS BindOpts = {sizeof(BindOpts)};
+		if (SUCCEEDED(pbc->GetBindOptions(&BindOpts)) && BindOpts.dwTickCountDeadline != 0) {
+			m_bHasBindDeadline = true;
+			m_dwBindDeadline = BindOpts.dwTickCountDeadline;
+		}
+	}
+
+	// The pseudofolders from a directory's view are the same directory,
+	// just enumerated all the way down, or only in part.
+	if (ADSX::CItem::IsOwn(pidlrNext)) {
+		const BYTE fFlags =
+			ADSX::CItem::Get(static_cast<PCUITEMID_CHILD>(pidlrNext))->fFlags;
+		if (fFlags & (ADSX::CItem::FLAG_TREE | ADSX::CItem::FLAG_FILTER)) {
+			m_psf = psfParent;
+			m_pidla = ILCloneFull(pidlaParent);
+			if (m_pidla == NULL) return WrapReturn(E_OUTOFMEMORY);
+			m_bTree = fFlags & ADSX::CItem::FLAG_TREE;
+			m_bFilter = fFlags & ADSX::CItem::FLAG_FILTER;
+			LOG(L" ** " << (m_bTree ? L"Tree" : L"Filter") << L" of: " <<
+				PidlToString(m_pidla));
+			return WrapReturn(S_OK);
+		}
+	}
+
 	// Is pidlrNext another folder to browse into, or have we arrived at a file?
 	bool bNextIsFolder = false;
 	if (ILIsChild(pidlrNext)) {
 		auto pidlcNext = static_cast<PCUITEMID_CHILD>(pidlrNext);
-		SFGAOF rgfTest = SFGAO_FOLDER;
+		SFGAOF rgfTest = SFGAO_FOLDER | SFGAO_STREAM;
 		hr = psfParent->GetAttributesOf(1, &pidlcNext, &rgfTest);
 		if (FAILED(hr)) return WrapReturnFailOK(hr);
 		bNextIsFolder = rgfTest & SFGAO_FOLDER;
+		// Zips and the like are folders to the shell but files to us
+		m_bIsDirectory = bNextIsFolder && !(rgfTest & SFGAO_STREAM);
 	}
 
 	if (bNextIsFolder) {
@@ -117,6 +186,105 @@ HRESULT CShellFolder::BindToObjectInitialize(
 	LOG(L" ** New instance's PIDL: " << PidlToString(m_pidla));
 	return WrapReturn(S_OK);
 }
+
+
+bool CShellFolder::IsOnSlowVolume() {
+	ObjectLock lock(this);
+	if (m_Slowness == Slowness::Unknown) {
+		PWSTR pszPath = NULL;
+		if (m_pidla == NULL || FAILED(SHGetNameFromIDList(
+			m_pidla,
+			SIGDN_DESKTOPABSOLUTEPARSING,
+			&pszPath
+		))) {
+			return false;
+		}
+		defer({ CoTaskMemFree(pszPath); });
+		m_Slowness = CVolumeCache::Instance().IsSlow(pszPath) ?
+			Slowness::Slow :
+			Slowness::NotSlow;
+	}
+	return m_Slowness == Slowness::Slow;
+}
+
+
+DWORD CShellFolder::EnumTimeoutMs() const {
+	const DWORD dwSetting = CSettings::Get().dwEnumTimeoutMs;
+	DWORD dwTimeoutMs = dwSetting != 0 ? dwSetting : INFINITE;
+	if (m_bHasBindDeadline) {
+		// Signed, so it comes out right across the tick count wrapping around.
+		// A deadline that's already passed is stale, not a reason to give up
+		// before starting.
+		const LONG lRemaining = static_cast<LONG>(m_dwBindDeadline - GetTickCount());
+		if (lRemaining > 0 && static_cast<DWORD>(lRemaining) < dwTimeoutMs) {
+			dwTimeoutMs = static_cast<DWORD>(lRemaining);
+		}
+	}
+	return dwTimeoutMs;
+}
+
+
+HRESULT CShellFolder::CreateDropTarget(
+	_In_opt_     HWND            hwndOwner,
+	_In_opt_     PCUITEMID_CHILD pidlc,
+	_COM_Outptr_ void            **ppDropTarget
+) {
+	*ppDropTarget = NULL;
+	// The filter pseudofolder's items are files, which their own folder
+	// takes drops for. The tree pseudofolder is every file under it; which
+	// one is only known from a stream dropped on.
+	if (m_pidla == NULL || m_bFilter || (m_bTree && pidlc == NULL)) return E_NOINTERFACE;
+	PWSTR pszFolder;
+	HRESULT hr = SHGetNameFromIDList(m_pidla, SIGDN_DESKTOPABSOLUTEPARSING, &pszFolder);
+	if (FAILED(hr)) return hr;
+	defer({ CoTaskMemFree(pszFolder); });
+
+	// In the tree: "sub\file.txt:name" is on sub\file.txt, and the items
+	// for streams beside it are "sub\file.txt:" and their names
+	std::wstring sFile;
+	std::wstring sItemPrefix;
+	CDropTarget::FnAdd fnAdd;
+	try {
+		sFile = pszFolder;
+		if (pidlc != NULL && (CItem::Get(pidlc)->fFlags & CItem::FLAG_RELATIVE)) {
+			const std::wstring sKey = CTreeScanner::StreamKey(pidlc);
+			const std::size_t ichColon = sKey.find_last_of(L':');
+			if (ichColon == std::wstring::npos) return E_INVALIDARG;
+			sFile = CTreeScanner::StreamPath(pszFolder, sKey.substr(0, ichColon));
+			sItemPrefix = sKey.substr(0, ichColon + 1);
+		}
+		if (hwndOwner != NULL) {
+			fnAdd = [this, hwndOwner](PCUITEMID_CHILD pidlcNew) { AddToView(hwndOwner, pidlcNew); };
+		}
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	CComObject<CDropTarget> *pDropTarget;
+	hr = CComObject<CDropTarget>::CreateInstance(&pDropTarget);
+	if (FAILED(hr)) return hr;
+	pDropTarget->AddRef();
+	// It holds on to this folder until the last of a drop is in, so fnAdd's
+	// this stays good
+	hr = pDropTarget->Init(
+		this->GetUnknown(), hwndOwner, sFile.c_str(), sItemPrefix.c_str(), std::move(fnAdd)
+	);
+	if (SUCCEEDED(hr)) hr = pDropTarget->QueryInterface(IID_IDropTarget, ppDropTarget);
+	pDropTarget->Release();
+	return hr;
+}
+
+
+void CShellFolder::AddToView(_In_ HWND hwndOwner, _In_ PCUITEMID_CHILD pidlc) {
+	{
+		ObjectLock lock(this);
+		// Gone, or gone on to some other folder by now
+		if (std::find(m_ahwndViews.begin(), m_ahwndViews.end(), hwndOwner) == m_ahwndViews.end()) return;
+	}
+	// Sent, not under the lock: the view's thread could be waiting on it.
+	// The view makes its own copy of the item.
+	SHShellFolderView_Message(hwndOwner, SFVM_ADDOBJECT, reinterpret_cast<LPARAM>(pidlc));
+}
 #pragma endregion
 
 
@@ -279,16 +447,34 @@ STDMETHODIMP CShellFolder::CompareIDs(
 	auto pItem1 = ADSX::CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr1));
 	auto pItem2 = ADSX::CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr2));
 
+	// Same stream: no need to look any further
+	if (ADSX::CItem::Equal(pItem1, pItem2)) {
+		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, 0, 0));
+	}
+
 	USHORT Result = 0;  // see note below (MAKE_HRESULT)
 
+	if (lParam & SHCIDS_CANONICALONLY) {
+		// The caller only wants to know whether they're the same item, and
+		// any consistent order will do for the rest. The hashes are right
+		// there and almost always differ.
+		if (pItem1->uNameHash != pItem2->uNameHash) {
+			Result = pItem1->uNameHash < pItem2->uNameHash ? -1 : 1;
+		} else {
+			Result = wcscmp(pItem1->szName, pItem2->szName) < 0 ? -1 : 1;
+		}
+		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, 0, Result));
+	}
+
 	switch (lParam & SHCIDS_COLUMNMASK) {
-		case DetailsColumn::Name:
-			Result = wcscmp(pItem1->pszName, pItem2->pszName);
+		case DetailsColumn::Name: {
+			const int iCmp = wcscmp(pItem1->szName, pItem2->szName);
+			Result = iCmp < 0 ? -1 : iCmp > 0 ? 1 : 0;
 			break;
+		}
 		case DetailsColumn::Filesize:
-			Result = static_cast<USHORT>(pItem1->llFilesize - pItem2->llFilesize);
-			if (Result < 0) Result = -1;
-			else if (Result > 0) Result = 1;
+			if (pItem1->llFilesize < pItem2->llFilesize) Result = -1;
+			else if (pItem1->llFilesize > pItem2->llFilesize) Result = 1;
 			break;
 		default:
 			return WrapReturn(E_INVALIDARG);
@@ -327,8 +513,20 @@ STDMETHODIMP CShellFolder::CreateViewObject(
 		pViewObject->AddRef();
 		defer({ pViewObject->Release(); });
 
-		// Tie the view object's lifetime with the current IShellFolder.
-		pViewObject->Init(this->GetUnknown());
+		// Tie the view object's lifetime with the current IShellFolder, and
+		// keep track of which windows this folder's views are in while they
+		// are.
+		try {
+			ObjectLock lock(this);
+			m_ahwndViews.push_back(hwndOwner);
+		} catch (const std::bad_alloc &) {
+			return WrapReturn(E_OUTOFMEMORY);
+		}
+		pViewObject->Init(this->GetUnknown(), [this, hwndOwner]() {
+			ObjectLock lock(this);
+			const auto it = std::find(m_ahwndViews.begin(), m_ahwndViews.end(), hwndOwner);
+			if (it != m_ahwndViews.end()) m_ahwndViews.erase(it);
+		});
 
 		// Create the view
 		hr = pViewObject->Create(
@@ -341,6 +539,12 @@ STDMETHODIMP CShellFolder::CreateViewObject(
 		return WrapReturn(hr);
 	}
 
+	// Drops on the view's background: new streams on what it's the view of
+	if (riid == IID_IDropTarget) {
+		LOG(P_RSF << L"CreateViewObject(riid=[" << IIDToString(riid) << L"])");
+		return WrapReturnFailOK(CreateDropTarget(hwndOwner, NULL, ppViewObject));
+	}
+
 	return E_NOINTERFACE;
 	// return WrapReturnFailOK(E_NOINTERFACE);
 }
@@ -401,6 +605,63 @@ STDMETHODIMP CShellFolder::EnumObjects(
 	if (FAILED(hr)) return WrapReturn(hr);
 	defer({ CoTaskMemFree(pszPath); });
 
+#ifdef _DEBUG
+	{
+		const auto Stats = ADSX::CStreamCache::Instance().GetStats();
+		LOG(L" ** Stream cache: " << std::dec <<
+			Stats.cHits << L" hits, " << Stats.cMisses << L" misses, " <<
+			Stats.cStale << L" stale, " << Stats.cEvictions << L" evictions, " <<
+			Stats.cSharedHits << L" from other processes");
+		const auto EnumStats = ADSX::CEnumIDList::GetStats();
+		LOG(L" ** Enumerations: " << std::dec <<
+			EnumStats.cDeadlineHits << L" out of time, " <<
+			EnumStats.cCancellations << L" cancelled");
+	}
+#endif
+
+	if (m_bTree) {
+		// Every stream under here, as the scan finds them
+		CComPtr<ADSX::CTreeScanner> pScanner;
+		hr = ADSX::CTreeScanner::Start(pszPath, &pScanner);
+		if (FAILED(hr)) return WrapReturn(hr);
+		CComObject<ADSX::CTreeEnumIDList> *pTreeEnum;
+		hr = CComObject<ADSX::CTreeEnumIDList>::CreateInstance(&pTreeEnum);
+		if (FAILED(hr)) return WrapReturn(hr);
+		pTreeEnum->AddRef();
+		defer({ pTreeEnum->Release(); });
+		hr = pTreeEnum->Init(
+			this->GetUnknown(),
+			pScanner,
+			!(dwFlags & SHCONTF_ENABLE_ASYNC),
+			EnumTimeoutMs()
+		);
+		if (FAILED(hr)) return WrapReturn(hr);
+		hr = pTreeEnum->QueryInterface(IID_PPV_ARGS(ppEnumIDList));
+		return WrapReturn(hr);
+	}
+
+	if (m_bFilter) {
+		// The children with streams, as they're found
+		CComPtr<ADSX::CStreamFilter> pFilter;
+		hr = ADSX::CStreamFilter::Start(pszPath, &pFilter);
+		if (FAILED(hr)) return WrapReturn(hr);
+		CComObject<ADSX::CFilterEnumIDList> *pFilterEnum;
+		hr = CComObject<ADSX::CFilterEnumIDList>::CreateInstance(&pFilterEnum);
+		if (FAILED(hr)) return WrapReturn(hr);
+		pFilterEnum->AddRef();
+		defer({ pFilterEnum->Release(); });
+		hr = pFilterEnum->Init(
+			this->GetUnknown(),
+			m_psf,
+			pFilter,
+			!(dwFlags & SHCONTF_ENABLE_ASYNC),
+			EnumTimeoutMs()
+		);
+		if (FAILED(hr)) return WrapReturn(hr);
+		hr = pFilterEnum->QueryInterface(IID_PPV_ARGS(ppEnumIDList));
+		return WrapReturn(hr);
+	}
+
 	// Create an enumerator over this file system object's
 	// alternate data streams.
 	CComObject<ADSX::CEnumIDList> *pEnum;
@@ -410,6 +671,29 @@ STDMETHODIMP CShellFolder::EnumObjects(
 	defer({ pEnum->Release(); });
 	hr = pEnum->Init(this->GetUnknown(), pszPath);
 	if (FAILED(hr)) return WrapReturn(hr);
+	if (m_bIsDirectory) {
+		// The ways into the pseudofolders, first in the list
+		PITEMID_CHILD pidlcTree = NewPseudofolderPidl(ADSX::CItem::FLAG_TREE);
+		if (pidlcTree == NULL) return WrapReturn(E_OUTOFMEMORY);
+		defer({ CoTaskMemFree(pidlcTree); });
+		hr = pEnum->AddLeadingItem(pidlcTree);
+		if (FAILED(hr)) return WrapReturn(hr);
+		PITEMID_CHILD pidlcFilter = NewPseudofolderPidl(ADSX::CItem::FLAG_FILTER);
+		if (pidlcFilter == NULL) return WrapReturn(E_OUTOFMEMORY);
+		defer({ CoTaskMemFree(pidlcFilter); });
+		hr = pEnum->AddLeadingItem(pidlcFilter);
+		if (FAILED(hr)) return WrapReturn(hr);
+	}
+	// Get the I/O off of the caller's thread when that's worth a thread: so
+	// the view can fill in as items come if it asked for async, and so a
+	// server that isn't answering can't hold the caller past the deadline.
+	// A local volume is left to answer on the caller's thread. Not worth
+	// failing over; Next still works without it.
+	const bool bAsync = (dwFlags & SHCONTF_ENABLE_ASYNC) != 0;
+	if (bAsync || IsOnSlowVolume()) {
+		hr = pEnum->StartAsync(!bAsync, EnumTimeoutMs());
+		if (FAILED(hr)) LOG(L" ** Enumerating synchronously: " << HRESULTToString(hr));
+	}
 
 	// Return an IEnumIDList interface to the caller.
 	hr = pEnum->QueryInterface(IID_PPV_ARGS(ppEnumIDList));
@@ -417,6 +701,44 @@ STDMETHODIMP CShellFolder::EnumObjects(
 }
 
 
+// Every attribute one item could have. fSlow is SFGAO_ISSLOW if the folder
+// is on a slow volume.
+static SFGAOF AttributesOf(_In_ PCUITEMID_CHILD pidlc, _In_ SFGAOF fSlow) {
+	if (ILIsEmpty(pidlc)) {
+		// Root folder: [Desktop\ADS Explorer] or [ADS Explorer]
+		// Not a real filesystem object -> not accessible from ADS Explorer
+		return SFGAO_HASSUBFOLDER |
+		       SFGAO_FOLDER |
+		       SFGAO_FILESYSTEM |
+		       SFGAO_FILESYSANCESTOR |
+		       SFGAO_NONENUMERATED;
+	}
+	if (!ADSX::CItem::IsOwn(pidlc)) {
+		// Files and folders
+		// FS objects along the way to and including the requested file/folder
+		return SFGAO_HASSUBFOLDER |
+		       SFGAO_FOLDER |
+		       SFGAO_FILESYSTEM |
+		       SFGAO_FILESYSANCESTOR |
+		       fSlow;
+	}
+	if (ADSX::CItem::Get(pidlc)->fFlags & (ADSX::CItem::FLAG_TREE | ADSX::CItem::FLAG_FILTER)) {
+		// A pseudofolder
+		return SFGAO_FOLDER | SFGAO_BROWSABLE | fSlow;
+	}
+	// ADSes
+	// The ADSX::CItems wrapped in PIDLs that were returned from EnumObjects
+	// for this file/folder.
+	return SFGAO_FILESYSTEM |
+	       SFGAO_CANCOPY |
+	       SFGAO_CANMOVE |
+	       SFGAO_CANRENAME |
+	       SFGAO_CANDELETE |
+	       SFGAO_DROPTARGET |
+	       fSlow;
+}
+
+
 /**
  * Return whether the items represented by the given PIDLs have the attributes
  * requested.
@@ -435,40 +757,17 @@ STDMETHODIMP CShellFolder::GetAttributesOf(
 		L"pfAttribs=[" << SFGAOFToString(pfAttribs) << L"]"
 	L")");
 
-	if (cidl < 1) return WrapReturn(E_INVALIDARG);  // TODO(nate-kean): support more than one item
-	if (aPidls == NULL) return WrapReturn(E_POINTER);
+	if (cidl < 1) return WrapReturn(E_INVALIDARG);
+	if (aPidls == NULL || pfAttribs == NULL) return WrapReturn(E_POINTER);
 
-	if (cidl == 0 || ILIsEmpty(aPidls[0])) {
-		// Root folder: [Desktop\ADS Explorer] or [ADS Explorer]
-		// Not a real filesystem object -> not accessible from ADS Explorer
-		LOG(L" ** Root folder");
-		*pfAttribs &= SFGAO_HASSUBFOLDER |
-		              SFGAO_FOLDER |
-		              SFGAO_FILESYSTEM |
-		              SFGAO_FILESYSANCESTOR |
-		              SFGAO_NONENUMERATED;
-	} else if (!ADSX::CItem::IsOwn(aPidls[0])) {
-		// Files and folders
-		// FS objects along the way to and including the requested file/folder
-		LOG(L" ** FS Object");
-		// HRESULT hr = m_psf->GetAttributesOf(cidl, aPidls, pfAttribs);
-		// if (FAILED(hr)) return WrapReturn(hr);
-		// *pfAttribs &= SFGAO_BROWSABLE;
-		*pfAttribs &= SFGAO_HASSUBFOLDER |
-		              SFGAO_FOLDER |
-		              SFGAO_FILESYSTEM |
-		              SFGAO_FILESYSANCESTOR;
-	} else {
-		// ADSes
-		// The ADSX::CItems wrapped in PIDLs that were returned from EnumObjects
-		// for this file/folder.
-		LOG(L" ** ADS");
-		*pfAttribs &= SFGAO_FILESYSTEM |
-		              SFGAO_CANCOPY |
-		              SFGAO_CANMOVE |
-		              SFGAO_CANRENAME |
-		              SFGAO_CANDELETE;
+	// What's true of all of them. Whether the volume's slow is the same for
+	// every item, so it's asked once rather than for each.
+	const SFGAOF fSlow = IsOnSlowVolume() ? SFGAO_ISSLOW : 0;
+	SFGAOF fAll = ~static_cast<SFGAOF>(0);
+	for (UINT i = 0; i < cidl && (fAll & *pfAttribs) != 0; i++) {
+		fAll &= AttributesOf(aPidls[i], fSlow);
 	}
+	*pfAttribs &= fAll;
 
 	LOG(L" ** Result: " << SFGAOFToString(pfAttribs));
 	return WrapReturn(S_OK);
@@ -492,6 +791,9 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 	);
 	UNREFERENCED_PARAMETER(hwndOwner);
 
+	if (cidl < 1) return WrapReturn(E_INVALIDARG);
+	if (aPidls == NULL) return WrapReturn(E_POINTER);
+
 	// If it's not one of the boys then just act natural
 	if (!ADSX::CItem::IsOwn(aPidls[0])) {
 		LOG(L" ** Proxying to inner ShellFolder");
@@ -499,17 +801,23 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 			hwndOwner, cidl, aPidls, riid, rgfReserved, ppUIObject);
 	}
 
-	// Only one item at a time
-	// TODO(nate-kean): It was a design decision for Hurni's NSE to support
-	// only one item at a time. I should consider supporting multiple.
-	if (cidl != 1) return WrapReturn(E_INVALIDARG);
-
 	HRESULT hr;
 
 	if (ppUIObject == NULL) return WrapReturn(E_POINTER);
 	*ppUIObject = NULL;
 
-	if (cidl == 0) return WrapReturn(E_INVALIDARG);
+	// Where the streams are, so their contents can be offered and copied.
+	// Without it there's still the PIDL. Icons and the like don't need it.
+	PWSTR pszFolder = NULL;
+	const bool bNeedsFolder = riid == IID_IDataObject || riid == IID_IContextMenu;
+	if (bNeedsFolder && m_pidla != NULL && FAILED(SHGetNameFromIDList(
+		m_pidla,
+		SIGDN_DESKTOPABSOLUTEPARSING,
+		&pszFolder
+	))) {
+		pszFolder = NULL;
+	}
+	defer({ CoTaskMemFree(pszFolder); });
 
 	// We must be in the FileDialog; it wants aPidls wrapped in an IDataObject
 	// (just to call IDataObject::GetData() and nothing else).
@@ -526,10 +834,10 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 		pDataObject->AddRef();
 
 		// Tie its lifetime with this object (the IShellFolder object)
-		// and embed the PIDL in the data
-		pDataObject->Init(this->GetUnknown(), m_pidlaRoot, aPidls[0]);
+		// and embed the PIDLs in the data, however many are selected
+		hr = pDataObject->Init(this->GetUnknown(), m_pidlaRoot, cidl, aPidls, pszFolder);
 		// Return the requested interface to the caller
-		hr = pDataObject->QueryInterface(riid, ppUIObject);
+		if (SUCCEEDED(hr)) hr = pDataObject->QueryInterface(riid, ppUIObject);
 		pDataObject->Release();
 		return WrapReturn(hr);
 	}
@@ -542,7 +850,16 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 	// Our objects are not real/normal filesystem objects, so we have to
 	// implement these interfaces ourselves.
 	else if (riid == IID_IContextMenu) {
-		return WrapReturnFailOK(E_NOINTERFACE);
+		// Copying the streams out
+		if (pszFolder == NULL) return WrapReturnFailOK(E_NOINTERFACE);
+		CComObject<ADSX::CStreamMenu> *pMenu;
+		hr = CComObject<ADSX::CStreamMenu>::CreateInstance(&pMenu);
+		if (FAILED(hr)) return WrapReturn(hr);
+		pMenu->AddRef();
+		hr = pMenu->Init(this->GetUnknown(), pszFolder, cidl, aPidls);
+		if (SUCCEEDED(hr)) hr = pMenu->QueryInterface(riid, ppUIObject);
+		pMenu->Release();
+		return WrapReturn(hr);
 	}
 
 	else if (riid == IID_IContextMenu2) {
@@ -550,7 +867,11 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 	}
 	
 	else if (riid == IID_IDropTarget) {
-		return WrapReturnFailOK(E_NOINTERFACE);
+		// Dropped on a stream: new streams beside it
+		if (cidl != 1 || (ADSX::CItem::Get(aPidls[0])->fFlags & (ADSX::CItem::FLAG_TREE | ADSX::CItem::FLAG_FILTER))) {
+			return WrapReturnFailOK(E_NOINTERFACE);
+		}
+		return WrapReturnFailOK(CreateDropTarget(hwndOwner, aPidls[0], ppUIObject));
 	}
 
 	else if (riid == IID_IExtractIcon) {
@@ -565,15 +886,57 @@ STDMETHODIMP CShellFolder::GetUIObjectOf(
 }
 
 
+/**
+ * Open a stream's contents for reading, for whoever wants them through the
+ * namespace (previewers, "open with"). Nothing is read until they are.
+ */
 STDMETHODIMP CShellFolder::BindToStorage(
-	_In_         PCUIDLIST_RELATIVE,
-	_In_         IBindCtx *,
-	_In_         REFIID,
-	_COM_Outptr_ void **ppStorage
+	_In_         PCUIDLIST_RELATIVE pidlr,
+	_In_         IBindCtx           *pbc,
+	_In_         REFIID             riid,
+	_COM_Outptr_ void               **ppStorage
 ) {
-	LOG(P_RSF << L"BindToStorage()");
-	if (ppStorage != NULL) *ppStorage = NULL;
-	return WrapReturnFailOK(E_NOTIMPL);
+	LOG(P_RSF << L"BindToStorage("
+		L"pidlr=[" << PidlToString(pidlr) << L"], "
+		L"riid=[" << IIDToString(riid) << L"])"
+	);
+	if (ppStorage == NULL) return WrapReturn(E_POINTER);
+	*ppStorage = NULL;
+	if (pidlr == NULL) return WrapReturn(E_POINTER);
+
+	// If it's not one of the boys then just act natural
+	if (!ADSX::CItem::IsOwn(pidlr)) {
+		if (m_psf == NULL) return WrapReturn(E_UNEXPECTED);
+		return m_psf->BindToStorage(pidlr, pbc, riid, ppStorage);
+	}
+	// Nothing's under a stream, and a pseudofolder isn't anything to read
+	const auto pidlc = static_cast<PCUITEMID_CHILD>(pidlr);
+	if (!ILIsChild(pidlr) ||
+	    (ADSX::CItem::Get(pidlc)->fFlags & (ADSX::CItem::FLAG_TREE | ADSX::CItem::FLAG_FILTER))) {
+		return WrapReturn(E_INVALIDARG);
+	}
+	// Just the bytes; a stream has no IStorage
+	if (riid != IID_IStream && riid != IID_ISequentialStream) {
+		return WrapReturnFailOK(E_NOINTERFACE);
+	}
+
+	PWSTR pszFolder = NULL;
+	if (m_pidla == NULL) return WrapReturn(E_UNEXPECTED);
+	HRESULT hr = SHGetNameFromIDList(m_pidla, SIGDN_DESKTOPABSOLUTEPARSING, &pszFolder);
+	if (FAILED(hr)) return WrapReturn(hr);
+	defer({ CoTaskMemFree(pszFolder); });
+	std::wstring sPath;
+	try {
+		sPath = ADSX::CTreeScanner::StreamPath(pszFolder, ADSX::CTreeScanner::StreamKey(pidlc));
+	} catch (const std::bad_alloc &) {
+		return WrapReturn(E_OUTOFMEMORY);
+	}
+
+	CComPtr<IStream> pStream;
+	hr = ADSX::CStreamContents::Create(sPath.c_str(), ADSX::CItem::Get(pidlc)->llFilesize, &pStream);
+	if (FAILED(hr)) return WrapReturn(hr);
+	hr = pStream->QueryInterface(riid, ppStorage);
+	return WrapReturn(hr);
 }
 
 
@@ -647,8 +1010,15 @@ STDMETHODIMP CShellFolder::GetDisplayNameOf(
 			);
 			if (FAILED(hr)) return WrapReturn(hr);
 			defer({ CoTaskMemFree(pszPath); });
+			// Streams found in the tree have the rest of their path in their
+			// name, "sub\file.txt:stream"; the pseudofolders are another level
+			const bool bInTree = pItem->fFlags & (
+				ADSX::CItem::FLAG_RELATIVE |
+				ADSX::CItem::FLAG_TREE |
+				ADSX::CItem::FLAG_FILTER
+			);
 			std::wostringstream ossPath;
-			ossPath << pszPath << L":" << pItem->pszName;
+			ossPath << pszPath << (bInTree ? L"\\" : L":") << ParsingNameOf(pItem);
 			return WrapReturn(
 				SetReturnString(ossPath.str().c_str(), pName) ? S_OK : E_FAIL
 			);
@@ -658,13 +1028,17 @@ STDMETHODIMP CShellFolder::GetDisplayNameOf(
 			return WrapReturn(E_FAIL);  // TODO(nate-kean)
 			// return E_FAIL;
 
-		case SHGDN_INFOLDER:
 		case SHGDN_INFOLDER | SHGDN_FORPARSING:
+			return WrapReturn(
+				SetReturnString(ParsingNameOf(pItem), pName) ? S_OK : E_FAIL
+			);
+
+		case SHGDN_INFOLDER:
 		default:
 			return WrapReturn(
-				SetReturnString(pItem->pszName, pName) ? S_OK : E_FAIL
+				SetReturnString(pItem->szName, pName) ? S_OK : E_FAIL
 			);
-			// return SetReturnString(Item->pszName, *pName) ? S_OK : E_FAIL;
+			// return SetReturnString(Item->szName, *pName) ? S_OK : E_FAIL;
 	}
 }
 
@@ -685,8 +1059,31 @@ STDMETHODIMP CShellFolder::ParseDisplayName(
 	if (pchEaten != NULL) {
 		*pchEaten = 0;
 	}
+	if (pszDisplayName == NULL || ppidlr == NULL) return WrapReturn(E_POINTER);
+	*ppidlr = NULL;
 
 	HRESULT hr;
+	// The pseudofolders, which the folder underneath knows nothing of
+	if (m_bIsDirectory && !m_bTree && !m_bFilter) {
+		BYTE fPseudo = 0;
+		if (_wcsicmp(pszDisplayName, szTreeParsingName) == 0) {
+			fPseudo = ADSX::CItem::FLAG_TREE;
+		} else if (_wcsicmp(pszDisplayName, szFilterParsingName) == 0) {
+			fPseudo = ADSX::CItem::FLAG_FILTER;
+		}
+		if (fPseudo != 0) {
+			PITEMID_CHILD pidlc = NewPseudofolderPidl(fPseudo);
+			if (pidlc == NULL) return WrapReturn(E_OUTOFMEMORY);
+			if (pfAttributes != NULL) {
+				*pfAttributes &= AttributesOf(pidlc, IsOnSlowVolume() ? SFGAO_ISSLOW : 0);
+			}
+			if (pchEaten != NULL) *pchEaten = static_cast<ULONG>(wcslen(pszDisplayName));
+			*ppidlr = pidlc;
+			LOG(L" ** Pseudofolder: [" << PidlToString(*ppidlr) << L"]");
+			return WrapReturn(S_OK);
+		}
+	}
+
 	hr = m_psf->ParseDisplayName(
 		hwnd,
 		pbc,
@@ -761,11 +1158,17 @@ STDMETHODIMP CShellFolder::GetDetailsOf(
 	if (!ADSX::CItem::IsOwn(pidlc)) {
 		// Lazy load this because this doesn't happen for every shellfolder
 		// instance (e.g., during browsing's "drill down" phase)
-		if (m_psd == NULL) {
-			hr = m_psf->BindToObject(pidlc, NULL, IID_PPV_ARGS(&m_psd));
-			if (FAILED(hr)) return WrapReturnFailOK(hr);
+		CComPtr<IShellDetails> psd;
+		{
+			ObjectLock lock(this);
+			if (m_psd == NULL) {
+				hr = m_psf->BindToObject(pidlc, NULL, IID_PPV_ARGS(&m_psd));
+				if (FAILED(hr)) return WrapReturnFailOK(hr);
+			}
+			psd = m_psd;
 		}
-		return WrapReturnFailOK(m_psd->GetDetailsOf(pidlc, uColumn, pDetails));
+		// Don't hold the lock over a call out to somebody else's object
+		return WrapReturnFailOK(psd->GetDetailsOf(pidlc, uColumn, pDetails));
 	}
 
 	if (uColumn >= DetailsColumn::MAX) return WrapReturnFailOK(E_FAIL);
@@ -775,17 +1178,23 @@ STDMETHODIMP CShellFolder::GetDetailsOf(
 	switch (uColumn) {
 		case DetailsColumn::Name:
 			pDetails->fmt = LVCFMT_LEFT;
-			ATLASSERT(wcslen(Item->pszName) <= INT_MAX);
-			pDetails->cxChar = static_cast<int>(wcslen(Item->pszName));
+			pDetails->cxChar = Item->cchName;
 			return WrapReturn(
 				SetReturnString(
-					Item->pszName,
+					Item->szName,
 					&pDetails->str
 				) ? S_OK : E_OUTOFMEMORY
 			);
 
 		case DetailsColumn::Filesize:
 			pDetails->fmt = LVCFMT_RIGHT;
+			if (Item->fFlags & (ADSX::CItem::FLAG_TREE | ADSX::CItem::FLAG_FILTER)) {
+				// Not a stream; nothing to measure
+				pDetails->cxChar = 0;
+				return WrapReturn(
+					SetReturnString(L"", &pDetails->str) ? S_OK : E_OUTOFMEMORY
+				);
+			}
 			constexpr UINT8 uLongLongStrLenMax =
 				_countof("-9,223,372,036,854,775,808");
 			WCHAR pszSize[uLongLongStrLenMax] = {0};
@@ -11,6 +11,8 @@
 
 #include "resource.h"  // main symbols
 
+#include <vector>
+
 
 namespace ADSX {
 
@@ -28,7 +30,7 @@ enum DetailsColumn {
 
 
 class ATL_NO_VTABLE CShellFolder
-	: public CComObjectRootEx<CComSingleThreadModel>,
+	: public CComObjectRootEx<CComMultiThreadModel>,
 	  public CComCoClass<CShellFolder, &CLSID_ADSExplorerShellFolder>,
 	  public IShellFolder2,
 	  public IPersistFolder2,
@@ -183,6 +185,25 @@ class ATL_NO_VTABLE CShellFolder
 		_In_     REFIID
 	);
 
+	// Whether m_pidla is on a volume we should tell the shell is slow.
+	bool IsOnSlowVolume();
+
+	// How long an enumeration may wait on the filesystem: the configured
+	// time, cut short by the deadline of whoever bound to this folder.
+	DWORD EnumTimeoutMs() const;
+
+	// A drop target that makes new streams on the object this folder is the
+	// view of, or, given a stream, on the one that stream is on.
+	HRESULT CreateDropTarget(
+		_In_opt_     HWND            hwndOwner,
+		_In_opt_     PCUITEMID_CHILD pidlc,
+		_COM_Outptr_ void            **ppDropTarget
+	);
+
+	// Put pidlc into the view in hwndOwner, if that's still one of this
+	// folder's. Any thread.
+	void AddToView(_In_ HWND hwndOwner, _In_ PCUITEMID_CHILD pidlc);
+
 	PIDLIST_ABSOLUTE m_pidlaRoot;  // Always [Desktop\ADS Explorer]
 
 	// Our inner model of where we are in the filesystem as Windows drills from
@@ -190,9 +211,29 @@ class ATL_NO_VTABLE CShellFolder
 	// of.
 	// Ends up needed in both PIDL and IShellFolder form throughout the
 	// implementation.
+	// Set up before anyone else gets a hold of this instance (Initialize, or
+	// BindToObject on a brand new one) and only read after, so any thread can
+	// read these without a lock.
 	PIDLIST_ABSOLUTE m_pidla;
 	CComPtr<IShellFolder> m_psf;
+	// m_pidla is a real directory, so its view offers the tree pseudofolder
+	bool m_bIsDirectory;
+	// This is the tree pseudofolder: every stream under m_pidla, which is
+	// the directory it was found in
+	bool m_bTree;
+	// This is the filter pseudofolder: the children of m_pidla that have
+	// named streams, as m_psf's own items
+	bool m_bFilter;
+	// BIND_OPTS::dwTickCountDeadline of the bind that made this folder, if
+	// it had one. Same rules as m_pidla.
+	bool m_bHasBindDeadline;
+	DWORD m_dwBindDeadline;
+	// Loaded on first use; guarded by the object lock.
 	CComPtr<IShellDetails> m_psd;
+	enum class Slowness { Unknown, Slow, NotSlow } m_Slowness;
+	// The windows this folder's views are open in, so new items only go to
+	// a view that's still there. Guarded by the object lock.
+	std::vector<HWND> m_ahwndViews;
 };
 
 }  // namespace ADSX
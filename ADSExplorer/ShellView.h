@@ -7,6 +7,7 @@
 #include "pch.h"  // Precompiled header; include first
 #include "debug.h"
 
+#include <functional>
 #include <iomanip>
 
 // Debug log prefix for CADSXShellView
@@ -107,11 +108,15 @@ class CADSXShellView : public CShellFolderViewImpl {
 
 	~CADSXShellView() {
 		// LOG(P_RSV << L"~CADSXShellView()");
+		if (m_fnClosed) m_fnClosed();
 	}
 
 	// If called, the passed object will be held (AddRef()'d) until the View
-	// gets deleted.
-	void Init(IUnknown *pUnkOwner = NULL) { m_UnkOwnerPtr = pUnkOwner; }
+	// gets deleted, and fnClosed is called when it does.
+	void Init(IUnknown *pUnkOwner = NULL, std::function<void ()> &&fnClosed = nullptr) {
+		m_UnkOwnerPtr = pUnkOwner;
+		m_fnClosed = std::move(fnClosed);
+	}
 
 	// The message map
 	BEGIN_MSG_MAP(CADSXShellView)
@@ -198,4 +203,5 @@ class CADSXShellView : public CShellFolderViewImpl {
 
    protected:
 	CComPtr<IUnknown> m_UnkOwnerPtr;
+	std::function<void ()> m_fnClosed;
 };
@@ -0,0 +1,66 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A fixed-size, lock-free queue for handing things from exactly one producer
+ * thread to exactly one consumer thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace ADSX {
+
+
+template <typename T, std::size_t N>
+class CSpscQueue {
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+  public:
+	CSpscQueue() : m_iHead(0), m_iTail(0) {}
+
+	CSpscQueue(const CSpscQueue &) = delete;
+	CSpscQueue &operator=(const CSpscQueue &) = delete;
+
+	// Producer side only.
+	// @post: returns false, and leaves item alone, if the queue is full.
+	bool TryPush(const T &item) {
+		const std::size_t iTail = m_iTail.load(std::memory_order_relaxed);
+		if (iTail - m_iHead.load(std::memory_order_acquire) == N) return false;
+		m_aItems[iTail & (N - 1)] = item;
+		// Publishes the item along with the new tail
+		m_iTail.store(iTail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side only.
+	// @post: returns false if the queue is empty.
+	bool TryPop(T *pItem) {
+		const std::size_t iHead = m_iHead.load(std::memory_order_relaxed);
+		if (iHead == m_iTail.load(std::memory_order_acquire)) return false;
+		*pItem = m_aItems[iHead & (N - 1)];
+		// Hands the slot back to the producer
+		m_iHead.store(iHead + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Only a hint when the other side is still running.
+	bool Empty() const {
+		return (
+			m_iHead.load(std::memory_order_acquire) ==
+			m_iTail.load(std::memory_order_acquire)
+		);
+	}
+
+	static constexpr std::size_t Capacity() { return N; }
+
+  private:
+	// Each index on its own cache line so the two threads don't keep stealing
+	// it from each other.
+	alignas(64) std::atomic<std::size_t> m_iHead;  // next slot to pop
+	alignas(64) std::atomic<std::size_t> m_iTail;  // next slot to push
+	alignas(64) T m_aItems[N];
+};
+
+}  // namespace ADSX
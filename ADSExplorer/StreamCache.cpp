@@ -0,0 +1,191 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamCache.h"
+
+#include "IoScheduler.h"
+#include "Settings.h"
+#include "SharedStreamCache.h"
+#include "StreamQuery.h"
+
+namespace ADSX {
+
+
+CStreamCache &CStreamCache::Instance() {
+	// Thread-safe on first use ("magic statics")
+	static CStreamCache cache;
+	return cache;
+}
+
+
+CStreamCache::CStreamCache()
+	: m_lru(cMaxEntries)
+	, m_cStale(0)
+	, m_cSharedHits(0) {}
+
+
+SIZE_T CStreamCache::KeyHash::operator()(const Key &key) const {
+	// FNV-1a over the whole key
+	ULONGLONG ullHash = 14695981039346656037ull;
+	auto pb = reinterpret_cast<const BYTE *>(&key.ullVolumeSerial);
+	for (SIZE_T i = 0; i < sizeof(key.ullVolumeSerial); i++) {
+		ullHash = (ullHash ^ pb[i]) * 1099511628211ull;
+	}
+	for (SIZE_T i = 0; i < sizeof(key.FileId.Identifier); i++) {
+		ullHash = (ullHash ^ key.FileId.Identifier[i]) * 1099511628211ull;
+	}
+	return static_cast<SIZE_T>(ullHash);
+}
+
+
+HRESULT CStreamCache::Identify(
+	_In_  HANDLE        hFile,
+	_Out_ Key           *pKey,
+	_Out_ LARGE_INTEGER *pliLastWriteTime,
+	_Out_ LARGE_INTEGER *pliChangeTime
+) {
+	ZeroMemory(pKey, sizeof(*pKey));
+
+	FILE_ID_INFO IdInfo;
+	if (GetFileInformationByHandleEx(hFile, FileIdInfo, &IdInfo, sizeof(IdInfo))) {
+		pKey->ullVolumeSerial = IdInfo.VolumeSerialNumber;
+		pKey->FileId = IdInfo.FileId;
+	} else {
+		// Older systems and some filesystems only have the 64-bit kind
+		BY_HANDLE_FILE_INFORMATION Info;
+		if (!GetFileInformationByHandle(hFile, &Info)) {
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		pKey->ullVolumeSerial = Info.dwVolumeSerialNumber;
+		const ULONGLONG ullIndex =
+			static_cast<ULONGLONG>(Info.nFileIndexHigh) << 32 | Info.nFileIndexLow;
+		CopyMemory(pKey->FileId.Identifier, &ullIndex, sizeof(ullIndex));
+	}
+
+	FILE_BASIC_INFO BasicInfo;
+	if (!GetFileInformationByHandleEx(hFile, FileBasicInfo, &BasicInfo, sizeof(BasicInfo))) {
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	*pliLastWriteTime = BasicInfo.LastWriteTime;
+	*pliChangeTime = BasicInfo.ChangeTime;
+	return S_OK;
+}
+
+
+HRESULT CStreamCache::GetSnapshot(
+	_In_         PCWSTR          pszPath,
+	_COM_Outptr_ CStreamSnapshot **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+
+	// Someone's waiting on this; it goes ahead of any scan of the same disk
+	CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(pszPath, IoPriority::Foreground);
+	HANDLE hFile = OpenForStreamQuery(pszPath);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		LOG(L" ** Couldn't open " << pszPath << L": " << GetLastError());
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	defer({ CloseHandle(hFile); });
+
+	// Read the times before the streams, so if the file changes in between
+	// the entry only looks older than it is and gets refreshed next time
+	Key key;
+	Entry entry;
+	HRESULT hr = Identify(hFile, &key, &entry.liLastWriteTime, &entry.liChangeTime);
+	if (FAILED(hr)) {
+		// Can't tell one file from another; just don't cache it
+		LOG(L" ** Not caching " << pszPath << L": " << HRESULTToString(hr));
+		return CStreamSnapshot::Create(hFile, ppSnapshot);
+	}
+
+	Entry cached;
+	if (m_lru.Find(key, &cached)) {
+		if (
+			cached.liLastWriteTime.QuadPart == entry.liLastWriteTime.QuadPart &&
+			cached.liChangeTime.QuadPart == entry.liChangeTime.QuadPart
+		) {
+			LOG(L" ** Stream cache hit");
+			*ppSnapshot = cached.pSnapshot.Detach();
+			return S_OK;
+		}
+		LOG(L" ** Stream cache entry is stale");
+		InterlockedIncrement64(&m_cStale);
+	}
+
+	// Some other process might have looked at it recently
+	SharedTable::Key SharedKey;
+	SharedKey.ullVolumeSerial = key.ullVolumeSerial;
+	static_assert(sizeof(SharedKey.abFileId) == sizeof(key.FileId));
+	CopyMemory(SharedKey.abFileId, &key.FileId, sizeof(SharedKey.abFileId));
+	const SharedTable::Validator SharedValidator = {
+		entry.liLastWriteTime.QuadPart,
+		entry.liChangeTime.QuadPart,
+	};
+	CSharedStreamCache &SharedCache = CSharedStreamCache::Instance();
+	hr = SharedCache.Find(SharedKey, SharedValidator, &entry.pSnapshot);
+	if (hr == S_OK) {
+		InterlockedIncrement64(&m_cSharedHits);
+	} else {
+		hr = CStreamSnapshot::Create(hFile, &entry.pSnapshot);
+		if (FAILED(hr)) return hr;
+		SharedCache.Store(SharedKey, SharedValidator, *entry.pSnapshot);
+	}
+	*ppSnapshot = entry.pSnapshot;
+	(*ppSnapshot)->AddRef();
+	m_lru.Insert(key, entry);
+	return S_OK;
+}
+
+
+HRESULT CStreamCache::GetListing(
+	_In_         PCWSTR          pszPath,
+	_COM_Outptr_ CStreamSnapshot **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+	CComPtr<CStreamSnapshot> pAll;
+	HRESULT hr = GetSnapshot(pszPath, &pAll);
+	if (FAILED(hr)) return hr;
+	const Selector::CProgram *pQuery = CSettings::Get().pStreamQuery.get();
+	if (pQuery == NULL) {
+		*ppSnapshot = pAll.Detach();
+		return S_OK;
+	}
+	if (pQuery->UsesContent()) {
+		// type: opens the streams themselves, still for someone who's waiting
+		CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(pszPath, IoPriority::Foreground);
+		return CStreamSnapshot::Select(pAll, *pQuery, pszPath, ppSnapshot);
+	}
+	return CStreamSnapshot::Select(pAll, *pQuery, pszPath, ppSnapshot);
+}
+
+
+void CStreamCache::Invalidate(_In_ PCWSTR pszPath) {
+	HANDLE hFile = OpenForStreamQuery(pszPath);
+	if (hFile == INVALID_HANDLE_VALUE) return;
+	defer({ CloseHandle(hFile); });
+	Key key;
+	LARGE_INTEGER liLastWriteTime, liChangeTime;
+	if (FAILED(Identify(hFile, &key, &liLastWriteTime, &liChangeTime))) return;
+	m_lru.Erase(key);
+}
+
+
+CStreamCache::Stats CStreamCache::GetStats() const {
+	const auto lruStats = m_lru.GetStats();
+	const auto cStale = static_cast<ULONGLONG>(m_cStale);
+	// Stale entries were found, so the LRU counts them as hits
+	return Stats{
+		lruStats.cHits - cStale,
+		lruStats.cMisses,
+		cStale,
+		lruStats.cEvictions,
+		static_cast<ULONGLONG>(m_cSharedHits),
+	};
+}
+
+}  // namespace ADSX
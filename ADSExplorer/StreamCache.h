@@ -0,0 +1,103 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Process-wide cache of stream snapshots, so going back and forth between the
+ * same few files, or refreshing one, doesn't go to the disk every time.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "LruCache.h"
+#include "StreamSnapshot.h"
+
+namespace ADSX {
+
+
+class CStreamCache {
+  public:
+	// Snapshots are small, but some files do have thousands of streams
+	static constexpr SIZE_T cMaxEntries = 1024;
+
+	struct Stats {
+		ULONGLONG cHits;
+		ULONGLONG cMisses;  // wasn't cached at all
+		ULONGLONG cStale;   // was cached, but the file has changed since
+		ULONGLONG cEvictions;
+		// Misses and stale entries that another process had already listed
+		ULONGLONG cSharedHits;
+	};
+
+	// The one for this process
+	static CStreamCache &Instance();
+
+	// A file system object, the same whichever path it's reached through
+	struct Key {
+		ULONGLONG ullVolumeSerial;
+		FILE_ID_128 FileId;
+
+		bool operator==(const Key &other) const {
+			return (
+				ullVolumeSerial == other.ullVolumeSerial &&
+				memcmp(&FileId, &other.FileId, sizeof(FileId)) == 0
+			);
+		}
+	};
+
+	struct KeyHash {
+		SIZE_T operator()(const Key &key) const;
+	};
+
+	// Identify the file behind hFile and when it was last changed.
+	static HRESULT Identify(
+		_In_  HANDLE        hFile,
+		_Out_ Key           *pKey,
+		_Out_ LARGE_INTEGER *pliLastWriteTime,
+		_Out_ LARGE_INTEGER *pliChangeTime
+	);
+
+	/**
+	 * Get the streams of the object at pszPath, from the cache if the file
+	 * hasn't been touched since they were cached, then from the listings
+	 * shared between processes, otherwise from the disk.
+	 * Files are identified by volume and file ID, so different paths to the
+	 * same file (hard links, mapped drives) share one entry.
+	 * @post: *ppSnapshot has a reference for the caller to Release.
+	 */
+	HRESULT GetSnapshot(
+		_In_         PCWSTR          pszPath,
+		_COM_Outptr_ CStreamSnapshot **ppSnapshot
+	);
+
+	/**
+	 * The streams a folder lists: GetSnapshot's, narrowed down to the
+	 * StreamQuery setting if there is one. Only the whole list is cached.
+	 * @post: *ppSnapshot has a reference for the caller to Release.
+	 */
+	HRESULT GetListing(
+		_In_         PCWSTR          pszPath,
+		_COM_Outptr_ CStreamSnapshot **ppSnapshot
+	);
+
+	// Forget whatever was cached for the object at pszPath.
+	void Invalidate(_In_ PCWSTR pszPath);
+
+	Stats GetStats() const;
+
+  protected:
+	CStreamCache();
+
+	struct Entry {
+		// Adding, removing or writing to a stream bumps one or the other
+		LARGE_INTEGER liLastWriteTime;
+		LARGE_INTEGER liChangeTime;
+		CComPtr<CStreamSnapshot> pSnapshot;
+	};
+
+	CShardedLruCache<Key, Entry, 16, KeyHash> m_lru;
+	volatile LONG64 m_cStale;
+	volatile LONG64 m_cSharedHits;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,423 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamContents.h"
+
+#include <algorithm>
+#include <new>
+
+#include "IoScheduler.h"
+#include "StreamQuery.h"
+
+// Debug log prefix for CStreamContents
+#define P_SC L"ADSX::CStreamContents(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CStreamContents::CStreamContents()
+	: m_cbSize(0)
+	, m_pQueue(NULL)
+	, m_pbView(NULL)
+	, m_ullBufferStart(0)
+	, m_cbBuffer(0)
+	, m_ullPosition(0) {}
+
+CStreamContents::~CStreamContents() {
+	if (m_pbView != NULL) UnmapViewOfFile(m_pbView);
+}
+
+
+// A page of the view that can't be read in (the volume went away, say) is
+// an exception, not an error code. Nothing here needs unwinding, so it can
+// be caught. Only ever around our own memcpy: unwinding through someone
+// else's code, like another stream's Write or an RPC proxy, isn't safe.
+static HRESULT CopyFromView(_Out_writes_bytes_(cb) void *pvTo, _In_reads_bytes_(cb) const BYTE *pbFrom, _In_ SIZE_T cb) {
+	__try {
+		memcpy(pvTo, pbFrom, cb);
+	} __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+		return STG_E_READFAULT;
+	}
+	return S_OK;
+}
+
+
+
+HRESULT CStreamContents::Create(
+	_In_         PCWSTR    pszStream,
+	_In_         ULONGLONG cbSize,
+	_COM_Outptr_ IStream   **ppStream
+) {
+	if (ppStream == NULL) return E_POINTER;
+	*ppStream = NULL;
+	if (pszStream == NULL) return E_POINTER;
+
+	CComObject<CStreamContents> *pContents;
+	HRESULT hr = CComObject<CStreamContents>::CreateInstance(&pContents);
+	if (FAILED(hr)) return hr;
+	pContents->AddRef();
+	defer({ pContents->Release(); });
+	try {
+		pContents->m_sStream = pszStream;
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	pContents->m_cbSize = cbSize;
+	return pContents->QueryInterface(IID_PPV_ARGS(ppStream));
+}
+
+
+HRESULT CStreamContents::EnsureOpen() {
+	if (m_hStream != NULL) return S_OK;
+	LOG(P_SC << L"EnsureOpen(): " << m_sStream);
+	HANDLE hStream;
+	try {
+		hStream = CreateFileW(
+			ExtendedLengthPath(m_sStream.c_str()).c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL,
+			OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN,
+			NULL
+		);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	if (hStream == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	m_hStream.Attach(hStream);
+
+	LARGE_INTEGER liSize;
+	if (GetFileSizeEx(m_hStream, &liSize)) m_cbSize = liSize.QuadPart;
+	try {
+		m_pQueue = &CIoScheduler::Instance().QueueFor(m_sStream.c_str());
+	} catch (const std::bad_alloc &) {
+		m_hStream.Close();
+		return E_OUTOFMEMORY;
+	}
+
+	// An empty stream can't be mapped, and there's nothing to read anyway
+	if (m_cbSize != 0 && m_cbSize <= cbMapMax) {
+		HANDLE hMapping = CreateFileMappingW(m_hStream, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping != NULL) {
+			m_hMapping.Attach(hMapping);
+			m_pbView = static_cast<const BYTE *>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+		}
+		if (m_pbView == NULL) {
+			LOG(P_SC << L"EnsureOpen(): not mapped: " << GetLastError());
+			if (m_hMapping != NULL) m_hMapping.Close();
+		}
+	}
+	if (m_pbView != NULL) return S_OK;
+
+	// Sought somewhere before it was opened
+	LARGE_INTEGER liPosition;
+	liPosition.QuadPart = static_cast<LONGLONG>(m_ullBufferStart + m_cbBuffer);
+	if (liPosition.QuadPart != 0 && !SetFilePointerEx(m_hStream, liPosition, NULL, FILE_BEGIN)) {
+		const DWORD dwError = GetLastError();
+		m_hStream.Close();
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	return S_OK;
+}
+
+
+HRESULT CStreamContents::ReadAtFilePointer(
+	_Out_writes_bytes_to_(cb, *pcbRead) BYTE  *pb,
+	_In_                                ULONG cb,
+	_Out_                               ULONG *pcbRead
+) {
+	*pcbRead = 0;
+	// Someone's waiting on the other end of the copy
+	const CIoScheduler::CTicket ticket = m_pQueue->Acquire(IoPriority::Foreground);
+	DWORD cbRead;
+	if (!ReadFile(m_hStream, pb, cb, &cbRead, NULL)) {
+		const DWORD dwError = GetLastError();
+		LOG(P_SC << L"Read(): " << dwError);
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	*pcbRead = cbRead;
+	return S_OK;
+}
+
+
+#pragma region ISequentialStream
+
+STDMETHODIMP CStreamContents::Read(
+	_Out_writes_bytes_to_(cb, *pcbRead) void  *pv,
+	_In_                                ULONG cb,
+	_Out_opt_                           ULONG *pcbRead
+) {
+	if (pcbRead != NULL) *pcbRead = 0;
+	if (pv == NULL) return STG_E_INVALIDPOINTER;
+	ObjectLock lock(this);
+	HRESULT hr = EnsureOpen();
+	if (FAILED(hr)) return WrapReturn(hr);
+
+	if (m_pbView != NULL) {
+		// Anywhere in it is a copy away; only the pages touched are read in
+		if (m_ullPosition >= m_cbSize) return S_FALSE;
+		const ULONG cbCopy = static_cast<ULONG>((std::min)(static_cast<ULONGLONG>(cb), m_cbSize - m_ullPosition));
+		{
+			const CIoScheduler::CTicket ticket = m_pQueue->Acquire(IoPriority::Foreground);
+			hr = CopyFromView(pv, m_pbView + m_ullPosition, cbCopy);
+		}
+		if (FAILED(hr)) return WrapReturn(hr);
+		m_ullPosition += cbCopy;
+		if (pcbRead != NULL) *pcbRead = cbCopy;
+		return cbCopy < cb ? S_FALSE : S_OK;
+	}
+
+	BYTE *pb = static_cast<BYTE *>(pv);
+	ULONG cbDone = 0;
+	while (cbDone < cb) {
+		// What's left of the buffer first
+		const ULONGLONG ullBufferEnd = m_ullBufferStart + m_cbBuffer;
+		if (m_ullPosition < ullBufferEnd) {
+			const ULONG cbCopy = static_cast<ULONG>((std::min)(
+				static_cast<ULONGLONG>(cb - cbDone), ullBufferEnd - m_ullPosition
+			));
+			memcpy(pb + cbDone, m_pbBuffer + (m_ullPosition - m_ullBufferStart), cbCopy);
+			cbDone += cbCopy;
+			m_ullPosition += cbCopy;
+			continue;
+		}
+
+		// Used up, so the file pointer is at m_ullPosition
+		ULONG cbRead;
+		const ULONG cbWant = cb - cbDone;
+		if (cbWant >= cbChunk) {
+			hr = ReadAtFilePointer(pb + cbDone, cbWant, &cbRead);
+			if (FAILED(hr)) break;
+			cbDone += cbRead;
+			m_ullPosition += cbRead;
+			m_ullBufferStart = m_ullPosition;
+			m_cbBuffer = 0;
+		} else {
+			if (m_pbBuffer == NULL && !m_pbBuffer.AllocateBytes(cbChunk)) {
+				hr = E_OUTOFMEMORY;
+				break;
+			}
+			hr = ReadAtFilePointer(m_pbBuffer, cbChunk, &cbRead);
+			if (FAILED(hr)) break;
+			m_ullBufferStart = m_ullPosition;
+			m_cbBuffer = cbRead;
+		}
+		if (cbRead == 0) break;  // the end
+	}
+	if (pcbRead != NULL) *pcbRead = cbDone;
+	// Whatever did get read still counts
+	if (FAILED(hr) && cbDone == 0) return WrapReturn(hr);
+	return cbDone < cb ? S_FALSE : S_OK;
+}
+
+STDMETHODIMP CStreamContents::Write(
+	_In_reads_bytes_(cb) const void *,
+	_In_                 ULONG,
+	_Out_opt_            ULONG      *pcbWritten
+) {
+	if (pcbWritten != NULL) *pcbWritten = 0;
+	return WrapReturnFailOK(STG_E_ACCESSDENIED);
+}
+
+#pragma endregion
+
+
+#pragma region IStream
+
+STDMETHODIMP CStreamContents::Seek(
+	_In_      LARGE_INTEGER  dlibMove,
+	_In_      DWORD          dwOrigin,
+	_Out_opt_ ULARGE_INTEGER *plibNewPosition
+) {
+	ObjectLock lock(this);
+	LONGLONG llBase;
+	switch (dwOrigin) {
+		case STREAM_SEEK_SET:
+			llBase = 0;
+			break;
+		case STREAM_SEEK_CUR:
+			llBase = static_cast<LONGLONG>(m_ullPosition);
+			break;
+		case STREAM_SEEK_END: {
+			// Only opened to find out how big it really is
+			HRESULT hr = EnsureOpen();
+			if (FAILED(hr)) return WrapReturn(hr);
+			llBase = static_cast<LONGLONG>(m_cbSize);
+			break;
+		}
+		default:
+			return WrapReturn(STG_E_INVALIDFUNCTION);
+	}
+	const LONGLONG llNew = llBase + dlibMove.QuadPart;
+	if (llNew < 0) return WrapReturn(STG_E_INVALIDFUNCTION);
+	const ULONGLONG ullNew = static_cast<ULONGLONG>(llNew);
+
+	// Anywhere in the buffer is just a different place to copy from
+	if (ullNew < m_ullBufferStart || ullNew > m_ullBufferStart + m_cbBuffer) {
+		// A view has no file pointer to move
+		if (m_hStream != NULL && m_pbView == NULL) {
+			LARGE_INTEGER liNew;
+			liNew.QuadPart = llNew;
+			if (!SetFilePointerEx(m_hStream, liNew, NULL, FILE_BEGIN)) {
+				return WrapReturn(HRESULT_FROM_WIN32(GetLastError()));
+			}
+		}
+		m_ullBufferStart = ullNew;
+		m_cbBuffer = 0;
+	}
+	m_ullPosition = ullNew;
+	if (plibNewPosition != NULL) plibNewPosition->QuadPart = ullNew;
+	return S_OK;
+}
+
+STDMETHODIMP CStreamContents::SetSize(_In_ ULARGE_INTEGER) {
+	return WrapReturnFailOK(STG_E_ACCESSDENIED);
+}
+
+STDMETHODIMP CStreamContents::CopyTo(
+	_In_      IStream        *pstm,
+	_In_      ULARGE_INTEGER cb,
+	_Out_opt_ ULARGE_INTEGER *pcbRead,
+	_Out_opt_ ULARGE_INTEGER *pcbWritten
+) {
+	if (pcbRead != NULL) pcbRead->QuadPart = 0;
+	if (pcbWritten != NULL) pcbWritten->QuadPart = 0;
+	if (pstm == NULL) return WrapReturn(STG_E_INVALIDPOINTER);
+
+	{
+		ObjectLock lock(this);
+		HRESULT hr = EnsureOpen();
+		if (FAILED(hr)) return WrapReturn(hr);
+		if (m_pbView != NULL) {
+			// Out of the view through a chunk-sized bounce buffer, so a page
+			// that can't be read in is caught in CopyFromView and not in
+			// pstm's Write. A chunk at a time so the device isn't held for
+			// the whole thing.
+			CHeapPtr<BYTE> pbBounce;
+			if (!pbBounce.AllocateBytes(cbChunk)) return WrapReturn(E_OUTOFMEMORY);
+			const ULONGLONG ullEnd = m_ullPosition + (std::min)(cb.QuadPart, m_cbSize - (std::min)(m_ullPosition, m_cbSize));
+			ULONGLONG cbWritten = 0;
+			while (m_ullPosition < ullEnd) {
+				const ULONG cbPiece = static_cast<ULONG>((std::min)(ullEnd - m_ullPosition, static_cast<ULONGLONG>(cbChunk)));
+				{
+					const CIoScheduler::CTicket ticket = m_pQueue->Acquire(IoPriority::Foreground);
+					hr = CopyFromView(pbBounce, m_pbView + m_ullPosition, cbPiece);
+				}
+				if (FAILED(hr)) break;
+				ULONG cbPieceWritten = 0;
+				hr = pstm->Write(pbBounce, cbPiece, &cbPieceWritten);
+				cbPieceWritten = (std::min)(cbPieceWritten, cbPiece);
+				// Only what made it counts as read, so the rest is still
+				// there to copy
+				m_ullPosition += cbPieceWritten;
+				if (pcbRead != NULL) pcbRead->QuadPart += cbPieceWritten;
+				cbWritten += cbPieceWritten;
+				if (FAILED(hr)) break;
+				if (cbPieceWritten < cbPiece) {
+					hr = STG_E_MEDIUMFULL;
+					break;
+				}
+			}
+			if (pcbWritten != NULL) pcbWritten->QuadPart = cbWritten;
+			return WrapReturn(hr);
+		}
+	}
+
+	// Straight through one chunk of memory, however much there is
+	CHeapPtr<BYTE> pbChunk;
+	if (!pbChunk.AllocateBytes(cbChunk)) return WrapReturn(E_OUTOFMEMORY);
+	ULONGLONG cbRead = 0, cbWritten = 0;
+	HRESULT hr = S_OK;
+	while (cbRead < cb.QuadPart) {
+		const ULONG cbWant = static_cast<ULONG>((std::min)(cb.QuadPart - cbRead, static_cast<ULONGLONG>(cbChunk)));
+		ULONG cbChunkRead;
+		hr = Read(pbChunk, cbWant, &cbChunkRead);
+		if (FAILED(hr)) break;
+		cbRead += cbChunkRead;
+		if (cbChunkRead == 0) {
+			hr = S_OK;
+			break;
+		}
+		ULONG cbChunkWritten = 0;
+		hr = pstm->Write(pbChunk, cbChunkRead, &cbChunkWritten);
+		cbChunkWritten = (std::min)(cbChunkWritten, cbChunkRead);
+		cbWritten += cbChunkWritten;
+		if (cbChunkWritten < cbChunkRead) {
+			// Put back what didn't make it, like the view does
+			LARGE_INTEGER liBack;
+			liBack.QuadPart = -static_cast<LONGLONG>(cbChunkRead - cbChunkWritten);
+			Seek(liBack, STREAM_SEEK_CUR, NULL);
+			cbRead -= cbChunkRead - cbChunkWritten;
+			if (SUCCEEDED(hr)) hr = STG_E_MEDIUMFULL;
+		}
+		if (FAILED(hr)) break;
+		if (cbChunkRead < cbWant) {
+			hr = S_OK;
+			break;
+		}
+	}
+	if (pcbRead != NULL) pcbRead->QuadPart = cbRead;
+	if (pcbWritten != NULL) pcbWritten->QuadPart = cbWritten;
+	return WrapReturn(hr);
+}
+
+STDMETHODIMP CStreamContents::Commit(_In_ DWORD) {
+	// Nothing's ever written
+	return S_OK;
+}
+
+STDMETHODIMP CStreamContents::Revert() {
+	return S_OK;
+}
+
+STDMETHODIMP CStreamContents::LockRegion(_In_ ULARGE_INTEGER, _In_ ULARGE_INTEGER, _In_ DWORD) {
+	return WrapReturnFailOK(STG_E_INVALIDFUNCTION);
+}
+
+STDMETHODIMP CStreamContents::UnlockRegion(_In_ ULARGE_INTEGER, _In_ ULARGE_INTEGER, _In_ DWORD) {
+	return WrapReturnFailOK(STG_E_INVALIDFUNCTION);
+}
+
+STDMETHODIMP CStreamContents::Stat(_Out_ STATSTG *pStatstg, _In_ DWORD grfStatFlag) {
+	if (pStatstg == NULL) return WrapReturn(STG_E_INVALIDPOINTER);
+	ZeroMemory(pStatstg, sizeof(*pStatstg));
+	ObjectLock lock(this);
+	if (!(grfStatFlag & STATFLAG_NONAME)) {
+		// Just the stream's name: "file.txt:name" -> "name"
+		const std::size_t ichColon = m_sStream.rfind(L':');
+		PCWSTR pszName = m_sStream.c_str() + (ichColon == std::wstring::npos ? 0 : ichColon + 1);
+		HRESULT hr = SHStrDupW(pszName, &pStatstg->pwcsName);
+		if (FAILED(hr)) return WrapReturn(hr);
+	}
+	pStatstg->type = STGTY_STREAM;
+	pStatstg->cbSize.QuadPart = m_cbSize;
+	pStatstg->grfMode = STGM_READ | STGM_SHARE_DENY_NONE;
+	pStatstg->clsid = CLSID_NULL;
+	if (m_hStream != NULL) {
+		GetFileTime(m_hStream, &pStatstg->ctime, &pStatstg->atime, &pStatstg->mtime);
+	}
+	return S_OK;
+}
+
+STDMETHODIMP CStreamContents::Clone(_COM_Outptr_ IStream **ppStream) {
+	if (ppStream == NULL) return WrapReturn(E_POINTER);
+	*ppStream = NULL;
+	ObjectLock lock(this);
+	CComPtr<IStream> pClone;
+	HRESULT hr = Create(m_sStream.c_str(), m_cbSize, &pClone);
+	if (FAILED(hr)) return WrapReturn(hr);
+	LARGE_INTEGER liPosition;
+	liPosition.QuadPart = static_cast<LONGLONG>(m_ullPosition);
+	hr = pClone->Seek(liPosition, STREAM_SEEK_SET, NULL);
+	if (FAILED(hr)) return WrapReturn(hr);
+	*ppStream = pClone.Detach();
+	return S_OK;
+}
+
+#pragma endregion
+
+}  // namespace ADSX
@@ -0,0 +1,121 @@
+/**
+ * 2024 Nate Kean
+ *
+ * An IStream over one alternate data stream, for handing its contents to
+ * whoever asks (a drop target reading CFSTR_FILECONTENTS, a previewer that
+ * got it from BindToStorage) without copying them anywhere first. Nothing is
+ * opened until the first read. Then the stream is mapped, so a read anywhere
+ * in it is a copy out of the view and CopyTo writes straight from it. One
+ * that won't map (it's empty, or on a filesystem that can't) is read a
+ * megabyte at a time through one buffer instead.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+
+#include "DeviceQueue.h"
+
+namespace ADSX {
+
+
+class ATL_NO_VTABLE CStreamContents
+	: public IStream,
+	  public CComObjectRootEx<CComMultiThreadModel> {
+
+  public:
+	BEGIN_COM_MAP(CStreamContents)
+		COM_INTERFACE_ENTRY(IStream)
+		COM_INTERFACE_ENTRY(ISequentialStream)
+	END_COM_MAP()
+
+	// Reads smaller than this are served out of the buffer; bigger ones go
+	// straight to the caller's memory.
+	static constexpr ULONG cbChunk = 1024 * 1024;
+	// Bigger than this isn't mapped; a 32-bit process hasn't the room.
+#ifdef _WIN64
+	static constexpr ULONGLONG cbMapMax = 1ULL << 40;
+#else
+	static constexpr ULONGLONG cbMapMax = 256 * 1024 * 1024;
+#endif
+
+	CStreamContents();
+	virtual ~CStreamContents();
+
+	/**
+	 * An unopened stream over pszStream ("C:\dir\file.txt:name"), which is
+	 * cbSize bytes as far as anyone knows before it's opened.
+	 * @post: *ppStream has a reference count of 1 for the caller to Release.
+	 */
+	static HRESULT Create(
+		_In_         PCWSTR    pszStream,
+		_In_         ULONGLONG cbSize,
+		_COM_Outptr_ IStream   **ppStream
+	);
+
+	// -------------------------------------------------------------------------
+	// ISequentialStream
+	STDMETHOD(Read)(
+		_Out_writes_bytes_to_(cb, *pcbRead) void  *pv,
+		_In_                                ULONG cb,
+		_Out_opt_                           ULONG *pcbRead
+	);
+	STDMETHOD(Write)(
+		_In_reads_bytes_(cb) const void *pv,
+		_In_                 ULONG      cb,
+		_Out_opt_            ULONG      *pcbWritten
+	);
+
+	// -------------------------------------------------------------------------
+	// IStream
+	STDMETHOD(Seek)(
+		_In_      LARGE_INTEGER  dlibMove,
+		_In_      DWORD          dwOrigin,
+		_Out_opt_ ULARGE_INTEGER *plibNewPosition
+	);
+	STDMETHOD(SetSize)(_In_ ULARGE_INTEGER);
+	STDMETHOD(CopyTo)(
+		_In_      IStream        *pstm,
+		_In_      ULARGE_INTEGER cb,
+		_Out_opt_ ULARGE_INTEGER *pcbRead,
+		_Out_opt_ ULARGE_INTEGER *pcbWritten
+	);
+	STDMETHOD(Commit)(_In_ DWORD);
+	STDMETHOD(Revert)();
+	STDMETHOD(LockRegion)(_In_ ULARGE_INTEGER, _In_ ULARGE_INTEGER, _In_ DWORD);
+	STDMETHOD(UnlockRegion)(_In_ ULARGE_INTEGER, _In_ ULARGE_INTEGER, _In_ DWORD);
+	STDMETHOD(Stat)(_Out_ STATSTG *pStatstg, _In_ DWORD grfStatFlag);
+	STDMETHOD(Clone)(_COM_Outptr_ IStream **ppStream);
+
+  protected:
+	// Open the stream, at whatever position it's been sought to, and map it
+	// if it will.
+	// @pre: the object lock is held.
+	HRESULT EnsureOpen();
+
+	// One ReadFile, taking a turn at the device for it.
+	// @pre: the object lock is held and the stream is open.
+	HRESULT ReadAtFilePointer(_Out_writes_bytes_to_(cb, *pcbRead) BYTE *pb, _In_ ULONG cb, _Out_ ULONG *pcbRead);
+
+	std::wstring m_sStream;
+	ULONGLONG m_cbSize;     // as listed, until it's opened; then as it is
+	CHandle m_hStream;      // null until the first read
+	CDeviceQueue *m_pQueue; // where its turns at the device come from, once open
+
+	// The whole stream, m_cbSize bytes; null if it isn't mapped, and then
+	// reads go through the buffer
+	CHandle m_hMapping;
+	const BYTE *m_pbView;
+
+	// What's in the buffer is the stream's bytes from m_ullBufferStart, and
+	// the file pointer is just past them. Allocated on the first small read.
+	CHeapPtr<BYTE> m_pbBuffer;
+	ULONGLONG m_ullBufferStart;
+	ULONG m_cbBuffer;
+	// Where the next Read starts
+	ULONGLONG m_ullPosition;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,228 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamFilter.h"
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+#include "IoScheduler.h"
+#include "StreamProbe.h"
+#include "StreamQuery.h"
+#include "Volume.h"
+
+// Debug log prefix for CStreamFilter
+#define P_SF L"ADSX::CStreamFilter(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+// Each probe is an open, a small query and a close, mostly spent waiting on
+// the filesystem. A few at a time hide that; many more only queue up on the
+// disk, or on the server, behind the user's own work.
+static constexpr unsigned cWorkersMin = 2;
+static constexpr unsigned cWorkersMax = 8;
+
+
+CStreamFilter::CStreamFilter()
+	: m_cListed(0)
+	, m_cProbed(0)
+	, m_cErrors(0) {}
+
+
+HRESULT CStreamFilter::Start(
+	_In_         PCWSTR        pszFolder,
+	_COM_Outptr_ CStreamFilter **ppFilter
+) {
+	if (ppFilter == NULL) return E_POINTER;
+	*ppFilter = NULL;
+
+	auto pFilter = new (std::nothrow) CStreamFilter();
+	if (pFilter == NULL) return E_OUTOFMEMORY;
+	defer({ if (pFilter != NULL) pFilter->Release(); });
+
+	try {
+		pFilter->m_sFolder = ExtendedLengthPath(pszFolder);
+		if (pFilter->m_sFolder.back() != L'\\') pFilter->m_sFolder += L'\\';
+
+		const unsigned cWorkers = std::clamp(
+			std::thread::hardware_concurrency(), cWorkersMin, cWorkersMax
+		);
+		pFilter->m_pPool.reset(new CPool(cWorkers));
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = pFilter->StartThread();
+	if (FAILED(hr)) return hr;
+
+	*ppFilter = pFilter;
+	pFilter = NULL;
+	return S_OK;
+}
+
+
+void CStreamFilter::Run() {
+	LOG(P_SF << L"Run(" << m_sFolder << L")");
+
+	// Nothing will match on FAT and the like; don't open every file to find
+	// that out. (See CTreeScanner::Run about the volume.)
+	const std::wstring sVolume = CVolumeCache::VolumePathOf(m_sFolder.c_str());
+	if (CVolumeCache::Instance().VolumeSupportsNamedStreams(sVolume)) {
+		// Listing is the first task; the probes it queues up get stolen by
+		// the other workers while it reads on, so the first matches turn up
+		// before the folder has even been read to the end.
+		m_pPool->Run(
+			std::vector<std::wstring>{std::wstring()},
+			[this](CPool::CContext &context, std::wstring sName) {
+				try {
+					if (sName.empty()) {
+						List(context);
+					} else {
+						Probe(sName);
+					}
+				} catch (const std::bad_alloc &) {
+					InterlockedIncrement64(&m_cErrors);
+				}
+			}
+		);
+	}
+
+#ifdef _DEBUG
+	const Stats stats = GetStats();
+	LOG(P_SF << L"Run(): " << std::dec <<
+		stats.cMatches << L" of " << stats.cListed << L" children have streams, " <<
+		stats.cErrors << L" errors; " <<
+		stats.dwElapsedMs << L" ms = " <<
+		static_cast<ULONGLONG>(stats.ProbesPerSecond()) << L" probes/s" <<
+		(m_bCancel.load() ? L" (cancelled)" : L""));
+#endif
+}
+
+
+void CStreamFilter::List(_In_ CPool::CContext &context) {
+	HANDLE hFolder = CreateFileW(
+		m_sFolder.c_str(),
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS,
+		NULL
+	);
+	if (hFolder == INVALID_HANDLE_VALUE) {
+		LOG(P_SF << L"List(): couldn't open: " << GetLastError());
+		InterlockedIncrement64(&m_cErrors);
+		return;
+	}
+	defer({ CloseHandle(hFolder); });
+
+	// FindNextFileW hands these over one at a time from a buffer of its own;
+	// asking directly takes as many as fit in one round trip and skips the
+	// copying into WIN32_FIND_DATA.
+	CHeapPtr<BYTE> pbListing;
+	if (!pbListing.Allocate(cbListing)) throw std::bad_alloc();
+	FILE_INFO_BY_HANDLE_CLASS InfoClass = FileFullDirectoryRestartInfo;
+	while (!context.IsCancelled()) {
+		if (!GetFileInformationByHandleEx(hFolder, InfoClass, pbListing, cbListing)) {
+			if (GetLastError() != ERROR_NO_MORE_FILES) {
+				LOG(P_SF << L"List(): " << GetLastError());
+				InterlockedIncrement64(&m_cErrors);
+			}
+			return;
+		}
+		InfoClass = FileFullDirectoryInfo;
+
+		LONG64 cListed = 0;
+		for (auto pInfo = reinterpret_cast<const FILE_FULL_DIR_INFO *>(pbListing.m_pData);;) {
+			const std::wstring sName(
+				pInfo->FileName,
+				pInfo->FileNameLength / sizeof(WCHAR)
+			);
+			if (sName != L"." && sName != L"..") {
+				context.Push(sName);
+				cListed++;
+			}
+			if (pInfo->NextEntryOffset == 0) break;
+			pInfo = reinterpret_cast<const FILE_FULL_DIR_INFO *>(
+				reinterpret_cast<const BYTE *>(pInfo) + pInfo->NextEntryOffset
+			);
+		}
+		InterlockedAdd64(&m_cListed, cListed);
+	}
+}
+
+
+void CStreamFilter::Probe(_In_ const std::wstring &sName) {
+	const std::wstring sPath = m_sFolder + sName;
+	// Behind whatever the user opens meanwhile, like a scan
+	CBackgroundMode background;
+	CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(
+		sPath.c_str(), IoPriority::Background, &m_bCancel
+	);
+	if (!ticket) return;
+	HANDLE hFile = OpenForStreamQuery(sPath.c_str());
+	if (hFile == INVALID_HANDLE_VALUE) {
+		// Left out: there's nothing to browse in a file that can't be opened
+		InterlockedIncrement64(&m_cErrors);
+		return;
+	}
+	defer({ CloseHandle(hFile); });
+	InterlockedIncrement64(&m_cProbed);
+	if (!CStreamProbe::Instance().HasNamedStreams(hFile)) return;
+	if (!Publish(&sName, 1)) InterlockedIncrement64(&m_cErrors);
+}
+
+
+HRESULT CStreamFilter::Get(
+	_In_    ULONG                     iFirst,
+	_In_    ULONG                     celt,
+	_Inout_ std::vector<std::wstring> *pNames,
+	_In_    DWORD                     dwTimeoutMs
+) {
+	const std::size_t cBefore = pNames->size();
+	ULONG cCopied;
+	HRESULT hr = Read(
+		iFirst,
+		celt,
+		[pNames](const std::wstring &sName) {
+			try {
+				pNames->push_back(sName);
+			} catch (const std::bad_alloc &) {
+				return false;
+			}
+			return true;
+		},
+		&cCopied,
+		dwTimeoutMs
+	);
+	if (hr == E_OUTOFMEMORY) pNames->resize(cBefore);
+	return hr;
+}
+
+
+void CStreamFilter::Cancel() {
+	LOG(P_SF << L"Cancel()");
+	CScanResults::Cancel();
+	m_pPool->Cancel();
+}
+
+
+CStreamFilter::Stats CStreamFilter::GetStats() const {
+	Stats stats;
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+		stats.bFinished = m_bFinished;
+		stats.dwElapsedMs = m_bFinished ? m_dwElapsedMs : GetTickCount() - m_dwStart;
+		stats.cMatches = m_items.size();
+	}
+	stats.cListed = static_cast<ULONGLONG>(m_cListed);
+	stats.cProbed = static_cast<ULONGLONG>(m_cProbed);
+	stats.cErrors = static_cast<ULONGLONG>(m_cErrors);
+	return stats;
+}
+
+}  // namespace ADSX
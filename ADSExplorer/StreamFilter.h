@@ -0,0 +1,95 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Finds which children of a folder have named streams, for the pseudofolder
+ * that lists only those. The folder is read a big buffer at a time and every
+ * child is probed on a small pool of threads, and matches are published as
+ * they're found so the view fills in while the rest are checked.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BackgroundScan.h"
+#include "WorkStealingPool.h"
+
+namespace ADSX {
+
+
+class CStreamFilter : public CScanResults<std::wstring> {
+  public:
+	// Enough to bring the folder in a few hundred entries a round trip
+	static constexpr DWORD cbListing = 64 * 1024;
+
+	struct Stats {
+		ULONGLONG cListed;   // children found in the folder
+		ULONGLONG cProbed;   // children asked about their streams
+		ULONGLONG cMatches;  // children with named streams
+		ULONGLONG cErrors;   // children that couldn't be opened
+		DWORD dwElapsedMs;   // so far, or in all if finished
+		bool bFinished;
+
+		double ProbesPerSecond() const {
+			return dwElapsedMs > 0 ? cProbed * 1000.0 / dwElapsedMs : 0;
+		}
+	};
+
+	/**
+	 * Start filtering the children of the folder at pszFolder.
+	 * @post: *ppFilter has a reference count of 1 for the caller to Release.
+	 *        The filter holds its own reference until it's done.
+	 */
+	static HRESULT Start(
+		_In_         PCWSTR        pszFolder,
+		_COM_Outptr_ CStreamFilter **ppFilter
+	);
+
+	/**
+	 * Copy out the names of up to celt of the children found to have
+	 * streams, starting at the iFirst'th, waiting up to dwTimeoutMs if it
+	 * hasn't found that many yet, like CScanResults::Read.
+	 * @post: names are appended to *pNames; none are if it fails.
+	 */
+	HRESULT Get(
+		_In_    ULONG                     iFirst,
+		_In_    ULONG                     celt,
+		_Inout_ std::vector<std::wstring> *pNames,
+		_In_    DWORD                     dwTimeoutMs
+	);
+
+	// Stops the workers too
+	void Cancel() override;
+
+	Stats GetStats() const;
+
+  protected:
+	CStreamFilter();
+	~CStreamFilter() = default;
+
+	// A task is the name of a child to probe, or "" to list the folder
+	using CPool = CWorkStealingPool<std::wstring>;
+
+	void Run() override;
+
+	// Read the folder's entries and queue each one up to be probed.
+	void List(_In_ CPool::CContext &context);
+
+	// Publish sName if the child by that name has named streams.
+	void Probe(_In_ const std::wstring &sName);
+
+	// With the \\?\ prefix and a trailing backslash
+	std::wstring m_sFolder;
+
+	std::unique_ptr<CPool> m_pPool;
+
+	volatile LONG64 m_cListed;
+	volatile LONG64 m_cProbed;
+	volatile LONG64 m_cErrors;
+};
+
+}  // namespace ADSX
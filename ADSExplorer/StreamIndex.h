@@ -0,0 +1,726 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A volume's named streams, kept in a file laid out so it can be mapped into
+ * memory and asked questions straight away, without reading or parsing it
+ * first: which files have a stream called this, what streams a file has, and
+ * the path to a file. Changes since the file was written (from the change
+ * journal) are kept alongside it in memory until it's written out again.
+ *
+ * The file holds every file with named streams and every directory above one,
+ * so paths can be made without the volume, but nothing else.
+ *
+ * Opening and mapping the file is up to whoever owns it.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Crc32c.h"
+#include "Mft.h"
+#include "UsnJournal.h"
+
+namespace ADSX::Index {
+
+using Mft::Load;
+using Mft::NameChar;
+using Mft::NameView;
+using Name = std::basic_string<NameChar>;
+
+struct File {
+	std::uint64_t ullRecord;
+	std::uint64_t ullParent;  // record number
+	Name sName;
+	bool bDirectory;
+};
+
+struct Stream {
+	std::uint64_t ullRecord;  // the file it's on
+	Name sName;
+	std::uint64_t ullSize;
+};
+
+// What the index was made from, to tell whether it still fits the volume
+struct Metadata {
+	std::uint64_t ullVolumeSerial = 0;
+	std::uint64_t ullJournalId = 0;
+	std::int64_t llNextUsn = 0;  // the first change the index hasn't seen
+};
+
+
+// -----------------------------------------------------------------------------
+// File layout, all little-endian, every section 8-byte aligned:
+//   Header
+//   FileEntry   files[cFiles];      // by record
+//   StreamEntry streams[cStreams];  // by record, then name
+//   UINT32      byName[cStreams];   // indices into streams, by name, then record
+//   NameChar    strings[];          // names, not null-terminated
+//
+// Header:
+//   char    Magic[8];
+//   UINT32  Version;
+//   UINT32  Checksum;         // CRC-32C of the header with this zeroed
+//   UINT64  VolumeSerial;
+//   UINT64  JournalId;
+//   INT64   NextUsn;
+//   UINT64  FileCount;
+//   UINT64  StreamCount;
+//   UINT64  FilesOffset;      // all offsets in bytes from the start
+//   UINT64  StreamsOffset;
+//   UINT64  ByNameOffset;
+//   UINT64  StringsOffset;
+//   UINT64  StringsLength;    // in characters
+//   UINT64  TotalLength;      // the whole file
+constexpr unsigned char abMagic[8] = {'A', 'D', 'S', 'X', 'I', 'D', 'X', 0};
+constexpr std::uint32_t uVersion = 1;
+constexpr std::size_t cbOffMagic = 0;
+constexpr std::size_t cbOffVersion = 8;
+constexpr std::size_t cbOffChecksum = 12;
+constexpr std::size_t cbOffVolumeSerial = 16;
+constexpr std::size_t cbOffJournalId = 24;
+constexpr std::size_t cbOffNextUsn = 32;
+constexpr std::size_t cbOffFileCount = 40;
+constexpr std::size_t cbOffStreamCount = 48;
+constexpr std::size_t cbOffFilesOffset = 56;
+constexpr std::size_t cbOffStreamsOffset = 64;
+constexpr std::size_t cbOffByNameOffset = 72;
+constexpr std::size_t cbOffStringsOffset = 80;
+constexpr std::size_t cbOffStringsLength = 88;
+constexpr std::size_t cbOffTotalLength = 96;
+constexpr std::size_t cbHeader = 128;  // with room to grow
+
+// FileEntry:
+//   UINT64  Record;
+//   UINT64  Parent;
+//   UINT32  NameOffset;       // in characters into strings
+//   UINT16  NameLength;       // in characters
+//   UINT16  Flags;
+constexpr std::size_t cbOffFileRecord = 0;
+constexpr std::size_t cbOffFileParent = 8;
+constexpr std::size_t cbOffFileName = 16;
+constexpr std::size_t cbOffFileNameLength = 20;
+constexpr std::size_t cbOffFileFlags = 22;
+constexpr std::size_t cbFileEntry = 24;
+constexpr std::uint16_t FILE_ENTRY_DIRECTORY = 0x0001;
+
+// StreamEntry:
+//   UINT64  Record;
+//   UINT64  Size;
+//   UINT32  NameOffset;
+//   UINT16  NameLength;
+//   UINT16  Reserved;
+constexpr std::size_t cbOffStreamRecord = 0;
+constexpr std::size_t cbOffStreamSize = 8;
+constexpr std::size_t cbOffStreamName = 16;
+constexpr std::size_t cbOffStreamNameLength = 20;
+constexpr std::size_t cbStreamEntry = 24;
+
+constexpr std::size_t cbSectionAlign = 8;
+
+// Directories nested deeper than this are taken to be a loop
+constexpr std::size_t cDepthMax = 1024;
+
+
+// Stream names compare case-insensitively on NTFS. The volume's upcase table
+// isn't at hand, so only ASCII is folded, which covers the names anyone
+// searches for.
+inline NameChar FoldChar(NameChar ch) {
+	return ch >= 'a' && ch <= 'z' ? static_cast<NameChar>(ch - 'a' + 'A') : ch;
+}
+
+inline int CompareFolded(NameView svA, NameView svB) {
+	const std::size_t cch = (std::min)(svA.size(), svB.size());
+	for (std::size_t i = 0; i < cch; i++) {
+		const NameChar chA = FoldChar(svA[i]);
+		const NameChar chB = FoldChar(svB[i]);
+		if (chA != chB) return chA < chB ? -1 : 1;
+	}
+	return svA.size() == svB.size() ? 0 : svA.size() < svB.size() ? -1 : 1;
+}
+
+
+/**
+ * The sections of an index file, checked enough to be read without running
+ * off the end of it. Entries are decoded as they're asked for.
+ * @pre: the bytes outlive the view and don't move.
+ */
+class CView {
+  public:
+	struct FileRef {
+		std::uint64_t ullRecord;
+		std::uint64_t ullParent;
+		NameView svName;
+		bool bDirectory;
+	};
+	struct StreamRef {
+		std::uint64_t ullRecord;
+		NameView svName;
+		std::uint64_t ullSize;
+	};
+
+	CView() { Clear(); }
+
+	/**
+	 * @post: returns false, leaving the view empty, if pv isn't an index file
+	 *        of this version or doesn't hang together.
+	 */
+	bool Attach(const void *pv, std::size_t cb) {
+		Clear();
+		auto pb = static_cast<const unsigned char *>(pv);
+		if (pb == nullptr || cb < cbHeader) return false;
+		if (std::memcmp(pb + cbOffMagic, abMagic, sizeof(abMagic)) != 0) return false;
+		if (Load<std::uint32_t>(pb + cbOffVersion) != uVersion) return false;
+		unsigned char abHeader[cbHeader];
+		std::memcpy(abHeader, pb, cbHeader);
+		std::memset(abHeader + cbOffChecksum, 0, sizeof(std::uint32_t));
+		if (Crc32c(abHeader, cbHeader) != Load<std::uint32_t>(pb + cbOffChecksum)) return false;
+		if (Load<std::uint64_t>(pb + cbOffTotalLength) != cb) return false;
+
+		const auto cFiles = Load<std::uint64_t>(pb + cbOffFileCount);
+		const auto cStreams = Load<std::uint64_t>(pb + cbOffStreamCount);
+		const auto cchStrings = Load<std::uint64_t>(pb + cbOffStringsLength);
+		if (
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffFilesOffset), cFiles, cbFileEntry) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffStreamsOffset), cStreams, cbStreamEntry) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffByNameOffset), cStreams, sizeof(std::uint32_t)) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffStringsOffset), cchStrings, sizeof(NameChar))
+		) {
+			return false;
+		}
+
+		m_pb = pb;
+		m_cb = cb;
+		m_metadata.ullVolumeSerial = Load<std::uint64_t>(pb + cbOffVolumeSerial);
+		m_metadata.ullJournalId = Load<std::uint64_t>(pb + cbOffJournalId);
+		m_metadata.llNextUsn = Load<std::int64_t>(pb + cbOffNextUsn);
+		m_cFiles = static_cast<std::size_t>(cFiles);
+		m_cStreams = static_cast<std::size_t>(cStreams);
+		m_pbFiles = pb + Load<std::uint64_t>(pb + cbOffFilesOffset);
+		m_pbStreams = pb + Load<std::uint64_t>(pb + cbOffStreamsOffset);
+		m_pbByName = pb + Load<std::uint64_t>(pb + cbOffByNameOffset);
+		m_pchStrings = reinterpret_cast<const NameChar *>(pb + Load<std::uint64_t>(pb + cbOffStringsOffset));
+		m_cchStrings = static_cast<std::size_t>(cchStrings);
+		return true;
+	}
+
+	void Clear() {
+		m_pb = nullptr;
+		m_cb = 0;
+		m_metadata = Metadata();
+		m_cFiles = 0;
+		m_cStreams = 0;
+		m_pbFiles = nullptr;
+		m_pbStreams = nullptr;
+		m_pbByName = nullptr;
+		m_pchStrings = nullptr;
+		m_cchStrings = 0;
+	}
+
+	bool IsAttached() const { return m_pb != nullptr; }
+	std::size_t Size() const { return m_cb; }
+	const Metadata &GetMetadata() const { return m_metadata; }
+	std::size_t FileCount() const { return m_cFiles; }
+	std::size_t StreamCount() const { return m_cStreams; }
+
+	FileRef FileAt(std::size_t i) const {
+		const unsigned char *pb = m_pbFiles + i * cbFileEntry;
+		return FileRef{
+			Load<std::uint64_t>(pb + cbOffFileRecord),
+			Load<std::uint64_t>(pb + cbOffFileParent),
+			NameAt(pb + cbOffFileName, pb + cbOffFileNameLength),
+			(Load<std::uint16_t>(pb + cbOffFileFlags) & FILE_ENTRY_DIRECTORY) != 0,
+		};
+	}
+
+	StreamRef StreamAt(std::size_t i) const {
+		const unsigned char *pb = m_pbStreams + i * cbStreamEntry;
+		return StreamRef{
+			Load<std::uint64_t>(pb + cbOffStreamRecord),
+			NameAt(pb + cbOffStreamName, pb + cbOffStreamNameLength),
+			Load<std::uint64_t>(pb + cbOffStreamSize),
+		};
+	}
+
+	// Record number of files[i] or streams[i], without decoding the rest
+	std::uint64_t FileRecordAt(std::size_t i) const {
+		return Load<std::uint64_t>(m_pbFiles + i * cbFileEntry + cbOffFileRecord);
+	}
+	std::uint64_t StreamRecordAt(std::size_t i) const {
+		return Load<std::uint64_t>(m_pbStreams + i * cbStreamEntry + cbOffStreamRecord);
+	}
+
+	// @post: returns m_cStreams for a bad index, which nothing is at.
+	std::size_t ByNameAt(std::size_t i) const {
+		const auto iStream = Load<std::uint32_t>(m_pbByName + i * sizeof(std::uint32_t));
+		return iStream < m_cStreams ? iStream : m_cStreams;
+	}
+
+	// @post: returns false if ullRecord isn't in the file.
+	bool FindFile(std::uint64_t ullRecord, FileRef *pFile) const {
+		std::size_t iLow = 0;
+		std::size_t iHigh = m_cFiles;
+		while (iLow < iHigh) {
+			const std::size_t iMid = iLow + (iHigh - iLow) / 2;
+			if (FileRecordAt(iMid) < ullRecord) {
+				iLow = iMid + 1;
+			} else {
+				iHigh = iMid;
+			}
+		}
+		if (iLow == m_cFiles || FileRecordAt(iLow) != ullRecord) return false;
+		*pFile = FileAt(iLow);
+		return true;
+	}
+
+	// The streams on ullRecord are streams[*piFirst, *piEnd).
+	void StreamsOf(std::uint64_t ullRecord, std::size_t *piFirst, std::size_t *piEnd) const {
+		std::size_t iLow = 0;
+		std::size_t iHigh = m_cStreams;
+		while (iLow < iHigh) {
+			const std::size_t iMid = iLow + (iHigh - iLow) / 2;
+			if (StreamRecordAt(iMid) < ullRecord) {
+				iLow = iMid + 1;
+			} else {
+				iHigh = iMid;
+			}
+		}
+		std::size_t iEnd = iLow;
+		while (iEnd < m_cStreams && StreamRecordAt(iEnd) == ullRecord) iEnd++;
+		*piFirst = iLow;
+		*piEnd = iEnd;
+	}
+
+	// The streams called svName are byName[*piFirst, *piEnd).
+	void StreamsNamed(NameView svName, std::size_t *piFirst, std::size_t *piEnd) const {
+		*piFirst = Bound(svName, false);
+		*piEnd = Bound(svName, true);
+	}
+
+  private:
+	static bool SectionFits(std::size_t cb, std::uint64_t ib, std::uint64_t c, std::size_t cbEach) {
+		return (
+			ib >= cbHeader && ib % cbSectionAlign == 0 && ib <= cb &&
+			c <= (cb - ib) / cbEach
+		);
+	}
+
+	NameView NameAt(const unsigned char *pbOffset, const unsigned char *pbLength) const {
+		const std::size_t ich = Load<std::uint32_t>(pbOffset);
+		const std::size_t cch = Load<std::uint16_t>(pbLength);
+		if (ich > m_cchStrings || cch > m_cchStrings - ich) return NameView();
+		return NameView(m_pchStrings + ich, cch);
+	}
+
+	// First entry of byName whose name is not less than (or, if bUpper,
+	// greater than) svName
+	std::size_t Bound(NameView svName, bool bUpper) const {
+		std::size_t iLow = 0;
+		std::size_t iHigh = m_cStreams;
+		while (iLow < iHigh) {
+			const std::size_t iMid = iLow + (iHigh - iLow) / 2;
+			const std::size_t iStream = ByNameAt(iMid);
+			const NameView svMid = iStream < m_cStreams ? StreamAt(iStream).svName : NameView();
+			const int iCompare = CompareFolded(svMid, svName);
+			if (iCompare < 0 || (bUpper && iCompare == 0)) {
+				iLow = iMid + 1;
+			} else {
+				iHigh = iMid;
+			}
+		}
+		return iLow;
+	}
+
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+	Metadata m_metadata;
+	std::size_t m_cFiles;
+	std::size_t m_cStreams;
+	const unsigned char *m_pbFiles;
+	const unsigned char *m_pbStreams;
+	const unsigned char *m_pbByName;
+	const NameChar *m_pchStrings;
+	std::size_t m_cchStrings;
+};
+
+
+/**
+ * An index file and what's changed since it was written. Queries and changes
+ * may come from any number of threads at once.
+ */
+class CIndex {
+  public:
+	/**
+	 * Lay out an index file.
+	 * Files are given once each; streams on files that aren't in files are
+	 * kept but will have no path. Names too long for the format are left out.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static std::vector<unsigned char> Build(
+		const Metadata &metadata, std::vector<File> files, std::vector<Stream> streams
+	) {
+		auto tooLong = [](const Name &sName) { return sName.size() > UINT16_MAX; };
+		files.erase(std::remove_if(files.begin(), files.end(), [&](const File &file) {
+			return tooLong(file.sName);
+		}), files.end());
+		streams.erase(std::remove_if(streams.begin(), streams.end(), [&](const Stream &stream) {
+			return tooLong(stream.sName);
+		}), streams.end());
+		std::sort(files.begin(), files.end(), [](const File &a, const File &b) {
+			return a.ullRecord < b.ullRecord;
+		});
+		files.erase(std::unique(files.begin(), files.end(), [](const File &a, const File &b) {
+			return a.ullRecord == b.ullRecord;
+		}), files.end());
+		std::sort(streams.begin(), streams.end(), [](const Stream &a, const Stream &b) {
+			return a.ullRecord != b.ullRecord ? a.ullRecord < b.ullRecord : a.sName < b.sName;
+		});
+
+		// The same few stream names are on thousands of files
+		std::vector<NameChar> strings;
+		std::unordered_map<Name, std::uint32_t> pooled;
+		auto intern = [&](const Name &sName) {
+			auto it = pooled.find(sName);
+			if (it != pooled.end()) return it->second;
+			const auto ich = static_cast<std::uint32_t>(strings.size());
+			strings.insert(strings.end(), sName.begin(), sName.end());
+			pooled.emplace(sName, ich);
+			return ich;
+		};
+
+		std::vector<std::uint32_t> byName(streams.size());
+		for (std::size_t i = 0; i < byName.size(); i++) byName[i] = static_cast<std::uint32_t>(i);
+		std::sort(byName.begin(), byName.end(), [&](std::uint32_t a, std::uint32_t b) {
+			const int iCompare = CompareFolded(streams[a].sName, streams[b].sName);
+			return iCompare != 0 ? iCompare < 0 : a < b;
+		});
+
+		auto align = [](std::size_t cb) { return (cb + cbSectionAlign - 1) / cbSectionAlign * cbSectionAlign; };
+		const std::size_t ibFiles = cbHeader;
+		const std::size_t ibStreams = align(ibFiles + files.size() * cbFileEntry);
+		const std::size_t ibByName = align(ibStreams + streams.size() * cbStreamEntry);
+		const std::size_t ibStrings = align(ibByName + byName.size() * sizeof(std::uint32_t));
+
+		std::vector<unsigned char> out(ibStrings);
+		auto store = [&](std::size_t ib, auto value) { std::memcpy(&out[ib], &value, sizeof(value)); };
+		for (std::size_t i = 0; i < files.size(); i++) {
+			const std::size_t ib = ibFiles + i * cbFileEntry;
+			store(ib + cbOffFileRecord, files[i].ullRecord);
+			store(ib + cbOffFileParent, files[i].ullParent);
+			store(ib + cbOffFileName, intern(files[i].sName));
+			store(ib + cbOffFileNameLength, static_cast<std::uint16_t>(files[i].sName.size()));
+			store(ib + cbOffFileFlags, files[i].bDirectory ? FILE_ENTRY_DIRECTORY : std::uint16_t(0));
+		}
+		for (std::size_t i = 0; i < streams.size(); i++) {
+			const std::size_t ib = ibStreams + i * cbStreamEntry;
+			store(ib + cbOffStreamRecord, streams[i].ullRecord);
+			store(ib + cbOffStreamSize, streams[i].ullSize);
+			store(ib + cbOffStreamName, intern(streams[i].sName));
+			store(ib + cbOffStreamNameLength, static_cast<std::uint16_t>(streams[i].sName.size()));
+		}
+		if (!byName.empty()) {
+			std::memcpy(&out[ibByName], byName.data(), byName.size() * sizeof(std::uint32_t));
+		}
+		const std::size_t cbStrings = strings.size() * sizeof(NameChar);
+		out.resize(ibStrings + align(cbStrings));
+		if (cbStrings != 0) std::memcpy(&out[ibStrings], strings.data(), cbStrings);
+
+		std::memcpy(&out[cbOffMagic], abMagic, sizeof(abMagic));
+		store(cbOffVersion, uVersion);
+		store(cbOffVolumeSerial, metadata.ullVolumeSerial);
+		store(cbOffJournalId, metadata.ullJournalId);
+		store(cbOffNextUsn, metadata.llNextUsn);
+		store(cbOffFileCount, static_cast<std::uint64_t>(files.size()));
+		store(cbOffStreamCount, static_cast<std::uint64_t>(streams.size()));
+		store(cbOffFilesOffset, static_cast<std::uint64_t>(ibFiles));
+		store(cbOffStreamsOffset, static_cast<std::uint64_t>(ibStreams));
+		store(cbOffByNameOffset, static_cast<std::uint64_t>(ibByName));
+		store(cbOffStringsOffset, static_cast<std::uint64_t>(ibStrings));
+		store(cbOffStringsLength, static_cast<std::uint64_t>(strings.size()));
+		store(cbOffTotalLength, static_cast<std::uint64_t>(out.size()));
+		store(cbOffChecksum, Crc32c(out.data(), cbHeader));
+		return out;
+	}
+
+	/**
+	 * Answer from an index file, forgetting any changes made before.
+	 * @pre: the bytes outlive the index, or the next Attach() or Adopt().
+	 * @post: returns false, leaving the index empty, if they aren't an index.
+	 */
+	bool Attach(const void *pv, std::size_t cb) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_owned.clear();
+		return AttachLocked(pv, cb);
+	}
+
+	// Attach() to bytes the index keeps hold of itself.
+	bool Adopt(std::vector<unsigned char> bytes) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_owned = std::move(bytes);
+		return AttachLocked(m_owned.data(), m_owned.size());
+	}
+
+	Metadata GetMetadata() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		return m_metadata;
+	}
+
+	void SetNextUsn(std::int64_t llNextUsn) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_metadata.llNextUsn = llNextUsn;
+	}
+
+	// @post: returns false if ullRecord has no streams and isn't above a file
+	//        that does.
+	bool FindFile(std::uint64_t ullRecord, File *pFile) const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		return FindFileLocked(ullRecord, pFile);
+	}
+
+	bool HasStreams(std::uint64_t ullRecord) const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		auto it = m_streams.find(ullRecord);
+		if (it != m_streams.end()) return !it->second.empty();
+		std::size_t iFirst, iEnd;
+		m_base.StreamsOf(ullRecord, &iFirst, &iEnd);
+		return iFirst != iEnd;
+	}
+
+	// @post: *pStreams is sorted by name.
+	void StreamsOf(std::uint64_t ullRecord, std::vector<Stream> *pStreams) const {
+		pStreams->clear();
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		auto it = m_streams.find(ullRecord);
+		if (it != m_streams.end()) {
+			*pStreams = it->second;
+			return;
+		}
+		std::size_t iFirst, iEnd;
+		m_base.StreamsOf(ullRecord, &iFirst, &iEnd);
+		for (std::size_t i = iFirst; i < iEnd; i++) pStreams->push_back(Copy(m_base.StreamAt(i)));
+	}
+
+	/**
+	 * Every stream called svName, whatever its case.
+	 * @post: *pStreams is sorted by record.
+	 */
+	void FindByName(NameView svName, std::vector<Stream> *pStreams) const {
+		pStreams->clear();
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::size_t iFirst, iEnd;
+		m_base.StreamsNamed(svName, &iFirst, &iEnd);
+		for (std::size_t i = iFirst; i < iEnd; i++) {
+			const std::size_t iStream = m_base.ByNameAt(i);
+			if (iStream == m_base.StreamCount()) continue;
+			const CView::StreamRef stream = m_base.StreamAt(iStream);
+			if (m_streams.count(stream.ullRecord) == 0) pStreams->push_back(Copy(stream));
+		}
+		for (const auto &entry : m_streams) {
+			for (const Stream &stream : entry.second) {
+				if (CompareFolded(stream.sName, svName) == 0) pStreams->push_back(stream);
+			}
+		}
+		std::sort(pStreams->begin(), pStreams->end(), [](const Stream &a, const Stream &b) {
+			return a.ullRecord < b.ullRecord;
+		});
+	}
+
+	/**
+	 * The path of ullRecord from the volume's root, like "dir\file".
+	 * @post: returns false if the chain of parents is broken or loops.
+	 */
+	bool PathOf(std::uint64_t ullRecord, Name *psPath) const {
+		psPath->clear();
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::vector<Name> names;
+		std::uint64_t ullCurrent = ullRecord;
+		while (ullCurrent != Mft::ullRecordRoot) {
+			File file;
+			if (names.size() == cDepthMax || !FindFileLocked(ullCurrent, &file)) return false;
+			names.push_back(std::move(file.sName));
+			ullCurrent = file.ullParent;
+		}
+		for (auto it = names.rbegin(); it != names.rend(); ++it) {
+			if (!psPath->empty()) *psPath += NameChar('\\');
+			*psPath += *it;
+		}
+		return true;
+	}
+
+	// Learn (or correct) where a file is and what it's called.
+	void SetFile(File file) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		const std::uint64_t ullRecord = file.ullRecord;
+		m_files[ullRecord] = FileChange{true, std::move(file)};
+	}
+
+	// Forget a file and its streams, as when it's deleted.
+	void RemoveFile(std::uint64_t ullRecord) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_files[ullRecord] = FileChange{false, File()};
+		m_streams[ullRecord].clear();
+	}
+
+	// Replace what's known about a file's streams. None is fine.
+	void SetStreams(std::uint64_t ullRecord, std::vector<Stream> streams) {
+		for (Stream &stream : streams) stream.ullRecord = ullRecord;
+		std::sort(streams.begin(), streams.end(), [](const Stream &a, const Stream &b) {
+			return a.sName < b.sName;
+		});
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_streams[ullRecord] = std::move(streams);
+	}
+
+	// How many files have changed since the index file was written
+	std::size_t ChangeCount() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::unordered_set<std::uint64_t> records;
+		for (const auto &entry : m_files) records.insert(entry.first);
+		for (const auto &entry : m_streams) records.insert(entry.first);
+		return records.size();
+	}
+
+	// Size of the index file answered from
+	std::size_t FileSize() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		return m_base.Size();
+	}
+
+	/**
+	 * Lay out an index file with every change in it, leaving out directories
+	 * that no longer lead to a stream.
+	 * @post: may throw std::bad_alloc.
+	 */
+	std::vector<unsigned char> Serialize() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::vector<Stream> streams;
+		for (std::size_t i = 0; i < m_base.StreamCount(); i++) {
+			const CView::StreamRef stream = m_base.StreamAt(i);
+			if (m_streams.count(stream.ullRecord) == 0) streams.push_back(Copy(stream));
+		}
+		for (const auto &entry : m_streams) {
+			streams.insert(streams.end(), entry.second.begin(), entry.second.end());
+		}
+
+		std::vector<File> files;
+		std::unordered_set<std::uint64_t> done;
+		done.insert(Mft::ullRecordRoot);
+		for (const Stream &stream : streams) {
+			std::uint64_t ullCurrent = stream.ullRecord;
+			for (std::size_t cDepth = 0; cDepth < cDepthMax && done.insert(ullCurrent).second; cDepth++) {
+				File file;
+				if (!FindFileLocked(ullCurrent, &file)) break;
+				ullCurrent = file.ullParent;
+				files.push_back(std::move(file));
+			}
+		}
+		return Build(m_metadata, std::move(files), std::move(streams));
+	}
+
+  private:
+	struct FileChange {
+		bool bPresent;
+		File file;
+	};
+
+	static File Copy(const CView::FileRef &file) {
+		return File{file.ullRecord, file.ullParent, Name(file.svName), file.bDirectory};
+	}
+	static Stream Copy(const CView::StreamRef &stream) {
+		return Stream{stream.ullRecord, Name(stream.svName), stream.ullSize};
+	}
+
+	bool AttachLocked(const void *pv, std::size_t cb) {
+		m_files.clear();
+		m_streams.clear();
+		const bool bAttached = m_base.Attach(pv, cb);
+		m_metadata = m_base.GetMetadata();
+		return bAttached;
+	}
+
+	bool FindFileLocked(std::uint64_t ullRecord, File *pFile) const {
+		auto it = m_files.find(ullRecord);
+		if (it != m_files.end()) {
+			if (!it->second.bPresent) return false;
+			*pFile = it->second.file;
+			return true;
+		}
+		CView::FileRef file;
+		if (!m_base.FindFile(ullRecord, &file)) return false;
+		*pFile = Copy(file);
+		return true;
+	}
+
+	mutable std::shared_mutex m_lock;
+	CView m_base;
+	std::vector<unsigned char> m_owned;  // what m_base is on, if it's not mapped
+	Metadata m_metadata;
+	// Changes since m_base was written, by record. A file with an entry in
+	// m_streams has exactly those streams, whatever m_base says.
+	std::unordered_map<std::uint64_t, FileChange> m_files;
+	std::unordered_map<std::uint64_t, std::vector<Stream>> m_streams;
+};
+
+/**
+ * Bring an index up to date with what the change journal says happened.
+ * What exactly changed about a file's streams isn't in the journal, so files
+ * whose streams changed are asked about again, by file reference, with:
+ *   bool queryStreams(std::uint64_t ullReference, std::vector<Stream> *pStreams)
+ * which returns false if the file isn't there any more. Directories the index
+ * hasn't needed before, on the way up from a file that's just got streams,
+ * are asked about with:
+ *   bool queryFile(std::uint64_t ullReference, File *pFile, std::uint64_t *pullParentReference)
+ * Both are called without any lock held.
+ */
+template <typename QueryStreams, typename QueryFile>
+void ApplyChanges(
+	CIndex &index, const Usn::CChangeSet &changes,
+	QueryStreams queryStreams, QueryFile queryFile
+) {
+	std::vector<Stream> streams;
+	for (const auto &entry : changes.Changes()) {
+		const std::uint64_t ullRecord = entry.first;
+		const Usn::Change &change = entry.second;
+		if (change.bRemoved) index.RemoveFile(ullRecord);
+		if (!change.bNamed) continue;
+
+		File known;
+		const bool bKnown = !change.bRemoved && index.FindFile(ullRecord, &known);
+		File file{
+			ullRecord, Mft::RecordOf(change.ullParentReference), change.sName, change.bDirectory
+		};
+		// A rename or move of something the index has, which might be a
+		// directory whose files' paths go through it
+		if (bKnown) index.SetFile(file);
+		if (!change.bStreams) continue;
+
+		if (!queryStreams(change.ullReference, &streams)) streams.clear();
+		const bool bHasStreams = !streams.empty();
+		index.SetStreams(ullRecord, std::move(streams));
+		streams = std::vector<Stream>();
+		if (!bHasStreams || bKnown) continue;
+
+		index.SetFile(file);
+		std::uint64_t ullParentReference = change.ullParentReference;
+		for (std::size_t cDepth = 0; cDepth < cDepthMax; cDepth++) {
+			const std::uint64_t ullParent = Mft::RecordOf(ullParentReference);
+			File parent;
+			if (ullParent == Mft::ullRecordRoot || index.FindFile(ullParent, &parent)) break;
+			if (!queryFile(ullParentReference, &parent, &ullParentReference)) break;
+			parent.ullRecord = ullParent;
+			index.SetFile(std::move(parent));
+		}
+	}
+}
+
+}  // namespace ADSX::Index
@@ -0,0 +1,272 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Platform-neutral reader and writer for the FILE_STREAM_INFORMATION chain
+ * that the kernel hands back for a FileStreamInformation query (or
+ * FILE_STREAM_INFO from GetFileInformationByHandleEx, which is the same
+ * thing).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <string_view>
+
+namespace ADSX::StreamInfo {
+
+// Stream names are always UTF-16. WCHAR is wchar_t on Windows, but wchar_t is
+// 32 bits nearly everywhere else.
+#ifdef _WIN32
+	using NameChar = wchar_t;
+#else
+	using NameChar = char16_t;
+#endif
+static_assert(sizeof(NameChar) == 2, "Stream names are UTF-16");
+using NameView = std::basic_string_view<NameChar>;
+
+
+// Byte layout of one FILE_STREAM_INFORMATION entry:
+//   ULONG         NextEntryOffset;       // 0, or bytes to the next entry
+//   ULONG         StreamNameLength;      // in bytes, not characters
+//   LARGE_INTEGER StreamSize;
+//   LARGE_INTEGER StreamAllocationSize;
+//   WCHAR         StreamName[1];         // not null-terminated
+constexpr std::size_t cbOffNextEntryOffset = 0;
+constexpr std::size_t cbOffStreamNameLength = 4;
+constexpr std::size_t cbOffStreamSize = 8;
+constexpr std::size_t cbOffStreamAllocationSize = 16;
+constexpr std::size_t cbOffStreamName = 24;
+constexpr std::size_t cbEntryHeader = cbOffStreamName;
+// The kernel always aligns entries to 8 bytes.
+constexpr std::size_t cbEntryAlign = 8;
+
+
+struct Entry {
+	NameView svName;  // Raw, e.g. L":Zone.Identifier:$DATA"; points into buffer
+	std::int64_t llSize;
+	std::int64_t llAllocationSize;
+};
+
+
+// The type suffix every named data stream's raw name ends with.
+inline constexpr NameChar aDataSuffix[] = {':', '$', 'D', 'A', 'T', 'A'};
+inline constexpr NameView svDataSuffix(aDataSuffix, std::size(aDataSuffix));
+
+/**
+ * Strip the decoration off a raw stream name: ":name:$DATA" -> "name".
+ * The unnamed main stream ("::$DATA") comes out empty.
+ * All ADSes follow this name pattern AFAIK, but if one doesn't we shouldn't
+ * touch its name, so it's returned as is.
+ * @post: the result is a view into the same characters as svRaw.
+ */
+inline NameView TrimName(NameView svRaw) {
+	if (
+		svRaw.size() < 1 + svDataSuffix.size() ||
+		svRaw.front() != ':' ||
+		svRaw.substr(svRaw.size() - svDataSuffix.size()) != svDataSuffix
+	) {
+		return svRaw;
+	}
+	return svRaw.substr(1, svRaw.size() - 1 - svDataSuffix.size());
+}
+
+
+enum class ReadResult {
+	Ok,         // *pEntry was filled in
+	End,        // No more entries
+	Malformed,  // Buffer doesn't hold a well-formed chain; stop reading
+};
+
+
+/**
+ * Walks a FILE_STREAM_INFORMATION chain entry by entry without copying.
+ * Every field is bounds-checked against the buffer, so it's safe to point at
+ * a buffer that was only partially filled (ERROR_MORE_DATA) or at garbage.
+ * @pre: the buffer outlives the reader and every Entry it produced.
+ */
+class CReader {
+  public:
+	CReader() : m_pb(nullptr), m_cb(0), m_ibCursor(0), m_bDone(true) {}
+
+	CReader(const void *pBuffer, std::size_t cbBuffer)
+		: m_pb(static_cast<const unsigned char *>(pBuffer))
+		, m_cb(pBuffer != nullptr ? cbBuffer : 0)
+		, m_ibCursor(0)
+		, m_bDone(m_cb == 0) {}
+
+	ReadResult Next(Entry *pEntry) {
+		if (m_bDone) return ReadResult::End;
+
+		// Is there room for a whole header here?
+		if (m_cb < cbEntryHeader || m_ibCursor > m_cb - cbEntryHeader) {
+			return Fail();
+		}
+		const unsigned char *pbEntry = m_pb + m_ibCursor;
+		const auto cbNext = Load<std::uint32_t>(pbEntry + cbOffNextEntryOffset);
+		const auto cbName = Load<std::uint32_t>(pbEntry + cbOffStreamNameLength);
+
+		// The name has to be whole UTF-16 code units and inside the buffer
+		if (cbName % sizeof(NameChar) != 0) return Fail();
+		if (cbName > m_cb - m_ibCursor - cbEntryHeader) return Fail();
+		const unsigned char *pbName = pbEntry + cbOffStreamName;
+		if (reinterpret_cast<std::uintptr_t>(pbName) % alignof(NameChar) != 0) {
+			return Fail();
+		}
+
+		// An entry can't point back into itself, and the next one can't
+		// overlap this one's name.
+		if (cbNext != 0) {
+			if (cbNext < cbEntryHeader + cbName) return Fail();
+			if (cbNext % cbEntryAlign != 0) return Fail();
+			if (cbNext > m_cb - m_ibCursor) return Fail();
+		}
+
+		pEntry->svName = NameView(
+			reinterpret_cast<const NameChar *>(pbName),
+			cbName / sizeof(NameChar)
+		);
+		pEntry->llSize = Load<std::int64_t>(pbEntry + cbOffStreamSize);
+		pEntry->llAllocationSize =
+			Load<std::int64_t>(pbEntry + cbOffStreamAllocationSize);
+
+		if (cbNext == 0) {
+			m_bDone = true;
+		} else {
+			m_ibCursor += cbNext;
+		}
+		return ReadResult::Ok;
+	}
+
+	// Whether reading stopped because the chain was broken.
+	bool IsMalformed() const { return m_bMalformed; }
+
+  private:
+	template <typename T>
+	static T Load(const unsigned char *pb) {
+		T t;
+		std::memcpy(&t, pb, sizeof(T));
+		return t;
+	}
+
+	ReadResult Fail() {
+		m_bDone = true;
+		m_bMalformed = true;
+		return ReadResult::Malformed;
+	}
+
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+	std::size_t m_ibCursor;
+	bool m_bDone;
+	bool m_bMalformed = false;
+};
+
+
+/**
+ * Whether the chain names any stream but the unnamed main one, stopping at
+ * the first that does.
+ * A broken chain counts as yes: the caller is deciding whether it's worth
+ * looking closer, and a closer look will sort it out.
+ */
+inline bool HasNamedStream(CReader reader) {
+	Entry entry;
+	ReadResult result;
+	while ((result = reader.Next(&entry)) == ReadResult::Ok) {
+		if (!TrimName(entry.svName).empty()) return true;
+	}
+	return result == ReadResult::Malformed;
+}
+
+
+/**
+ * Lays out a FILE_STREAM_INFORMATION chain the same way the kernel does, for
+ * when a stream list has to go somewhere CReader will read it back from.
+ */
+class CWriter {
+  public:
+	CWriter(void *pBuffer, std::size_t cbBuffer)
+		: m_pb(static_cast<unsigned char *>(pBuffer))
+		, m_cb(pBuffer != nullptr ? cbBuffer : 0)
+		, m_cbUsed(0)
+		, m_ibLast(0)
+		, m_bEmpty(true) {}
+
+	/**
+	 * Add an entry with the stream's name as is.
+	 * @post: returns false, and leaves the buffer as it was, if it won't fit.
+	 */
+	bool Append(NameView svRawName, std::int64_t llSize, std::int64_t llAllocationSize) {
+		return AppendParts(NameView(), svRawName, NameView(), llSize, llAllocationSize);
+	}
+
+	// Add an entry for a named data stream, decorating its bare name the way
+	// TrimName undoes: "name" -> ":name:$DATA".
+	bool AppendData(NameView svName, std::int64_t llSize, std::int64_t llAllocationSize) {
+		static constexpr NameChar aColon[] = {':'};
+		return AppendParts(
+			NameView(aColon, 1), svName, svDataSuffix, llSize, llAllocationSize
+		);
+	}
+
+	// Bytes from the start of the buffer to the end of the last entry.
+	std::size_t Size() const { return m_cbUsed; }
+
+  private:
+	bool AppendParts(
+		NameView     svPrefix,
+		NameView     svName,
+		NameView     svSuffix,
+		std::int64_t llSize,
+		std::int64_t llAllocationSize
+	) {
+		const std::size_t ibEntry = m_bEmpty ?
+			0 :
+			(m_cbUsed + cbEntryAlign - 1) & ~(cbEntryAlign - 1);
+		const std::size_t cchName = svPrefix.size() + svName.size() + svSuffix.size();
+		const std::size_t cbName = cchName * sizeof(NameChar);
+		if (cbName > UINT32_MAX) return false;
+		if (ibEntry > m_cb || cbEntryHeader + cbName > m_cb - ibEntry) return false;
+		if (!m_bEmpty && ibEntry - m_ibLast > UINT32_MAX) return false;
+
+		unsigned char *pbEntry = m_pb + ibEntry;
+		Store<std::uint32_t>(pbEntry + cbOffNextEntryOffset, 0);
+		Store<std::uint32_t>(pbEntry + cbOffStreamNameLength, static_cast<std::uint32_t>(cbName));
+		Store<std::int64_t>(pbEntry + cbOffStreamSize, llSize);
+		Store<std::int64_t>(pbEntry + cbOffStreamAllocationSize, llAllocationSize);
+		unsigned char *pbName = pbEntry + cbOffStreamName;
+		for (NameView svPart : {svPrefix, svName, svSuffix}) {
+			if (svPart.empty()) continue;
+			std::memcpy(pbName, svPart.data(), svPart.size() * sizeof(NameChar));
+			pbName += svPart.size() * sizeof(NameChar);
+		}
+
+		// Link the previous entry up to this one
+		if (!m_bEmpty) {
+			Store<std::uint32_t>(
+				m_pb + m_ibLast + cbOffNextEntryOffset,
+				static_cast<std::uint32_t>(ibEntry - m_ibLast)
+			);
+		}
+		m_ibLast = ibEntry;
+		m_cbUsed = ibEntry + cbEntryHeader + cbName;
+		m_bEmpty = false;
+		return true;
+	}
+
+	template <typename T>
+	static void Store(unsigned char *pb, T t) {
+		std::memcpy(pb, &t, sizeof(T));
+	}
+
+	unsigned char *m_pb;
+	std::size_t m_cb;
+	std::size_t m_cbUsed;
+	std::size_t m_ibLast;  // where the last entry starts
+	bool m_bEmpty;
+};
+
+}  // namespace ADSX::StreamInfo
@@ -0,0 +1,142 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamMenu.h"
+
+#include <atlstr.h>
+#include <new>
+
+#include "ADSXItem.h"
+#include "DataObject.h"
+#include "TreeScanner.h"
+#include "resource.h"  // Resource IDs from the RC file
+
+// Debug log prefix for ADSX::CStreamMenu
+#define P_SM L"ADSX::CStreamMenu(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+static constexpr char szCopyToVerbA[] = "copyto";
+static constexpr WCHAR szCopyToVerb[] = L"copyto";
+
+
+HRESULT CStreamMenu::Init(
+	_In_             IUnknown              *pUnkOwner,
+	_In_             PCWSTR                pszFolder,
+	_In_             UINT                  cidl,
+	_In_reads_(cidl) PCUITEMID_CHILD_ARRAY aPidls
+) {
+	m_UnkOwnerPtr = pUnkOwner;
+	if (pszFolder == NULL || aPidls == NULL) return E_POINTER;
+	try {
+		m_jobs.reserve(cidl);
+		for (UINT i = 0; i < cidl; i++) {
+			if (!CItem::IsOwn(aPidls[i])) continue;
+			const CItem *pItem = CItem::Get(aPidls[i]);
+			if (pItem->fFlags & (CItem::FLAG_TREE | CItem::FLAG_FILTER)) continue;
+			WCHAR szFileName[MAX_PATH];
+			StreamFileName(pItem, szFileName);
+			m_jobs.push_back({
+				CTreeScanner::StreamPath(pszFolder, CTreeScanner::StreamKey(aPidls[i])),
+				szFileName,
+				static_cast<ULONGLONG>(pItem->llFilesize)
+			});
+		}
+	} catch (const std::bad_alloc &) {
+		m_jobs.clear();
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+#pragma region IContextMenu
+
+IFACEMETHODIMP CStreamMenu::QueryContextMenu(
+	_In_ HMENU hmenu,
+	_In_ UINT  iMenu,
+	_In_ UINT  idCmdFirst,
+	_In_ UINT  idCmdLast,
+	_In_ UINT  uFlags
+) {
+	LOG(P_SM << L"QueryContextMenu()");
+	if ((uFlags & CMF_DEFAULTONLY) || m_jobs.empty() || idCmdFirst + IDM_COPYTO > idCmdLast) {
+		return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, FACILITY_NULL, 0));
+	}
+	CStringW sText;
+	if (!sText.LoadString(IDS_COPYTO_MENU)) return WrapReturn(E_FAIL);
+	if (!InsertMenuW(hmenu, iMenu, MF_STRING | MF_BYPOSITION, idCmdFirst + IDM_COPYTO, sText)) {
+		return WrapReturn(HRESULT_FROM_WIN32(GetLastError()));
+	}
+	return WrapReturn(MAKE_HRESULT(SEVERITY_SUCCESS, FACILITY_NULL, IDM_COUNT));
+}
+
+
+IFACEMETHODIMP CStreamMenu::InvokeCommand(_In_ CMINVOKECOMMANDINFO *pcmici) {
+	LOG(P_SM << L"InvokeCommand()");
+	if (pcmici == NULL) return WrapReturn(E_POINTER);
+	const bool bCopyTo = IS_INTRESOURCE(pcmici->lpVerb) ?
+		LOWORD(pcmici->lpVerb) == IDM_COPYTO :
+		lstrcmpiA(pcmici->lpVerb, szCopyToVerbA) == 0;
+	if (!bCopyTo) return WrapReturnFailOK(E_INVALIDARG);
+
+	const CStringW sTitle(MAKEINTRESOURCE(IDS_COPYTO_TITLE));
+	BROWSEINFOW bi = {};
+	bi.hwndOwner = pcmici->hwnd;
+	bi.lpszTitle = sTitle;
+	bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+	PIDLIST_ABSOLUTE pidlaFolder = SHBrowseForFolderW(&bi);
+	// Cancelled
+	if (pidlaFolder == NULL) return WrapReturn(S_OK);
+	defer({ CoTaskMemFree(pidlaFolder); });
+	WCHAR szFolder[MAX_PATH];
+	if (!SHGetPathFromIDListW(pidlaFolder, szFolder)) return WrapReturn(E_INVALIDARG);
+
+	std::vector<CCopyEngine::Job> jobs;
+	try {
+		jobs = m_jobs;
+		for (CCopyEngine::Job &job : jobs) {
+			std::wstring sDestination = szFolder;
+			if (sDestination.back() != L'\\') sDestination += L'\\';
+			job.sDestination = sDestination + job.sDestination;
+		}
+	} catch (const std::bad_alloc &) {
+		return WrapReturn(E_OUTOFMEMORY);
+	}
+	// It could be a while; the window shouldn't hang on it
+	return WrapReturn(CCopyEngine::CopyInBackground(pcmici->hwnd, std::move(jobs)));
+}
+
+
+IFACEMETHODIMP CStreamMenu::GetCommandString(
+	_In_                 UINT_PTR idCmd,
+	_In_                 UINT     uFlags,
+	_In_                 UINT     *puReserved,
+	_Out_writes_(cchMax) LPSTR    pszName,
+	_In_                 UINT     cchMax
+) {
+	UNREFERENCED_PARAMETER(puReserved);
+	LOG(P_SM << L"GetCommandString()");
+	if (idCmd != IDM_COPYTO) return WrapReturnFailOK(E_INVALIDARG);
+	switch (uFlags) {
+		case GCS_VERBW:
+			lstrcpynW(reinterpret_cast<PWSTR>(pszName), szCopyToVerb, cchMax);
+			return WrapReturn(S_OK);
+		case GCS_HELPTEXTW: {
+			const CStringW sHelp(MAKEINTRESOURCE(IDS_COPYTO_HELP));
+			lstrcpynW(reinterpret_cast<PWSTR>(pszName), sHelp, cchMax);
+			return WrapReturn(S_OK);
+		}
+		case GCS_VALIDATEW:
+			return WrapReturn(S_OK);
+	}
+	return WrapReturnFailOK(E_INVALIDARG);
+}
+
+#pragma endregion
+
+}  // namespace ADSX
@@ -0,0 +1,71 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The context menu for streams in the view. Its one command copies the
+ * selected streams out to files in a folder the user picks, with the copy
+ * engine (CopyEngine.h) behind the shell's progress dialog.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <vector>
+
+#include "CopyEngine.h"
+
+namespace ADSX {
+
+
+class ATL_NO_VTABLE CStreamMenu
+	: public CComObjectRootEx<CComSingleThreadModel>,
+	  public IContextMenu {
+  public:
+	BEGIN_COM_MAP(CStreamMenu)
+		COM_INTERFACE_ENTRY(IContextMenu)
+	END_COM_MAP()
+
+	/**
+	 * Hold on to the owner (the folder) and note which of the items are
+	 * streams, in the folder at pszFolder. Pseudofolders are left out; with
+	 * none left, the menu is empty.
+	 */
+	HRESULT Init(
+		_In_             IUnknown              *pUnkOwner,
+		_In_             PCWSTR                pszFolder,
+		_In_             UINT                  cidl,
+		_In_reads_(cidl) PCUITEMID_CHILD_ARRAY aPidls
+	);
+
+	//--------------------------------------------------------------------------
+	// IContextMenu
+	IFACEMETHOD(QueryContextMenu)(
+		_In_ HMENU hmenu,
+		_In_ UINT  iMenu,
+		_In_ UINT  idCmdFirst,
+		_In_ UINT  idCmdLast,
+		_In_ UINT  uFlags
+	);
+	IFACEMETHOD(InvokeCommand)(_In_ CMINVOKECOMMANDINFO *pcmici);
+	IFACEMETHOD(GetCommandString)(
+		_In_                 UINT_PTR idCmd,
+		_In_                 UINT     uFlags,
+		_In_                 UINT     *puReserved,
+		_Out_writes_(cchMax) LPSTR    pszName,
+		_In_                 UINT     cchMax
+	);
+
+  protected:
+	// Offsets from idCmdFirst
+	enum : UINT {
+		IDM_COPYTO,
+		IDM_COUNT,
+	};
+
+	CComPtr<IUnknown> m_UnkOwnerPtr;
+	// Destinations are the file names; the folder goes in front once it's
+	// picked.
+	std::vector<CCopyEngine::Job> m_jobs;
+};
+
+}  // namespace ADSX
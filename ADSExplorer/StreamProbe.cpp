@@ -0,0 +1,91 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamProbe.h"
+
+#include <string>
+
+#include "IoScheduler.h"
+#include "StreamInfo.h"
+#include "StreamQuery.h"
+#include "Volume.h"
+
+namespace ADSX {
+
+
+CStreamProbe &CStreamProbe::Instance() {
+	// Thread-safe on first use ("magic statics")
+	static CStreamProbe probe;
+	return probe;
+}
+
+
+CStreamProbe::CStreamProbe() : m_lru(cMaxEntries) {}
+
+
+bool CStreamProbe::Query(_In_ HANDLE hFile) {
+	// The kernel aligns entries to 8 bytes, and so must the buffer be
+	alignas(8) BYTE abBuffer[cbQuery];
+	if (GetFileInformationByHandleEx(hFile, FileStreamInfo, abBuffer, sizeof(abBuffer))) {
+		return StreamInfo::HasNamedStream(
+			StreamInfo::CReader(abBuffer, sizeof(abBuffer))
+		);
+	}
+	switch (GetLastError()) {
+		case ERROR_HANDLE_EOF:
+			// No streams at all, not even the main one. Folders do this.
+		case ERROR_INVALID_PARAMETER:
+			// The filesystem doesn't know what a stream is
+			return false;
+		case ERROR_MORE_DATA:
+		case ERROR_INSUFFICIENT_BUFFER:
+			// More than the main stream, or one name too long to fit
+			return true;
+		default:
+			LOG(L" ** Stream probe error: " << GetLastError());
+			return true;
+	}
+}
+
+
+bool CStreamProbe::HasNamedStreams(_In_ PCWSTR pszPath) {
+	CVolumeCache &VolumeCache = CVolumeCache::Instance();
+	const std::wstring sVolume = CVolumeCache::VolumePathOf(pszPath);
+	if (!VolumeCache.VolumeSupportsNamedStreams(sVolume)) return false;
+	// Not worth holding up a menu over a server that might take its time
+	if (VolumeCache.VolumeIsSlow(sVolume)) return true;
+
+	CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(pszPath, IoPriority::Foreground);
+	HANDLE hFile = OpenForStreamQuery(pszPath);
+	if (hFile == INVALID_HANDLE_VALUE) return true;
+	defer({ CloseHandle(hFile); });
+	return HasNamedStreams(hFile);
+}
+
+
+bool CStreamProbe::HasNamedStreams(_In_ HANDLE hFile) {
+	CStreamCache::Key key;
+	Entry entry;
+	const bool bIdentified = SUCCEEDED(CStreamCache::Identify(
+		hFile, &key, &entry.liLastWriteTime, &entry.liChangeTime
+	));
+	if (bIdentified) {
+		Entry cached;
+		if (
+			m_lru.Find(key, &cached) &&
+			cached.liLastWriteTime.QuadPart == entry.liLastWriteTime.QuadPart &&
+			cached.liChangeTime.QuadPart == entry.liChangeTime.QuadPart
+		) {
+			return cached.bHasNamedStreams;
+		}
+	}
+
+	entry.bHasNamedStreams = Query(hFile);
+	if (bIdentified) m_lru.Insert(key, entry);
+	return entry.bHasNamedStreams;
+}
+
+}  // namespace ADSX
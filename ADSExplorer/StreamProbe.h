@@ -0,0 +1,57 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A cheap yes/no on whether a file system object has any alternate data
+ * streams, for deciding whether to offer to browse them. Right-click menus
+ * are built while the user waits, so this costs at most one small query per
+ * file, and nothing for files it's already seen unchanged.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "LruCache.h"
+#include "StreamCache.h"
+
+namespace ADSX {
+
+
+class CStreamProbe {
+  public:
+	// Each entry is tiny; remember plenty of them
+	static constexpr SIZE_T cMaxEntries = 4096;
+	// Room for the main stream and a named one or two. Anything that doesn't
+	// fit has to be named anyway, since there's only one main stream.
+	static constexpr DWORD cbQuery = 512;
+
+	// The one for this process
+	static CStreamProbe &Instance();
+
+	/**
+	 * Whether the object at pszPath has at least one named stream.
+	 * Errs on the side of yes: if it can't tell (no access, a volume that
+	 * might not answer quickly), browsing is how to find out.
+	 */
+	bool HasNamedStreams(_In_ PCWSTR pszPath);
+
+	// Same, on an already opened handle, for callers that have looked at the
+	// volume themselves and want an answer even if it's slow.
+	bool HasNamedStreams(_In_ HANDLE hFile);
+
+  protected:
+	CStreamProbe();
+
+	struct Entry {
+		LARGE_INTEGER liLastWriteTime;
+		LARGE_INTEGER liChangeTime;
+		bool bHasNamedStreams;
+	};
+
+	// Ask the filesystem, stopping at the first named stream.
+	static bool Query(_In_ HANDLE hFile);
+
+	CShardedLruCache<CStreamCache::Key, Entry, 16, CStreamCache::KeyHash> m_lru;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,137 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamQuery.h"
+
+#include <algorithm>
+#include <new>
+
+namespace ADSX {
+
+
+HANDLE OpenForStreamQuery(_In_ PCWSTR pszPath) {
+	return CreateFileW(
+		pszPath,
+		// Asking about streams only needs the metadata
+		FILE_READ_ATTRIBUTES,
+		// Don't get in the way of whoever else has it open
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		// Required to open a folder at all
+		FILE_FLAG_BACKUP_SEMANTICS,
+		NULL
+	);
+}
+
+
+std::wstring ExtendedLengthPath(_In_ PCWSTR pszPath) {
+	const std::wstring sPath(pszPath);
+	if (sPath.compare(0, 4, L"\\\\?\\") == 0) return sPath;
+	if (sPath.compare(0, 2, L"\\\\") == 0) return L"\\\\?\\UNC\\" + sPath.substr(2);
+	return L"\\\\?\\" + sPath;
+}
+
+
+std::size_t ReadStreamStart(
+	_In_                            void          *pvStream,
+	_Out_writes_bytes_to_(cb, return) unsigned char *pb,
+	_In_                            std::size_t   cb
+) {
+	const StreamToRead *pStream = static_cast<const StreamToRead *>(pvStream);
+	std::wstring sStreamPath;
+	try {
+		sStreamPath = std::wstring(pStream->pszPath) + L':' + pStream->pszName;
+	} catch (const std::bad_alloc &) {
+		return 0;
+	}
+	HANDLE hStream = CreateFileW(
+		sStreamPath.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (hStream == INVALID_HANDLE_VALUE) {
+		LOG(L" ** Couldn't open " << sStreamPath << L" to look at: " << GetLastError());
+		return 0;
+	}
+	defer({ CloseHandle(hStream); });
+	DWORD cbRead;
+	const DWORD cbWant = static_cast<DWORD>((std::min)(cb, static_cast<std::size_t>(MAXDWORD)));
+	if (!ReadFile(hStream, pb, cbWant, &cbRead, NULL)) return 0;
+	return cbRead;
+}
+
+
+CStreamInfoBuffer::CStreamInfoBuffer() : m_cbAlloc(0), m_cbUsed(0) {}
+
+
+HRESULT CStreamInfoBuffer::Query(_In_ PCWSTR pszPath) {
+	m_cbUsed = 0;
+	HANDLE hFile = OpenForStreamQuery(pszPath);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		LOG(L" ** Couldn't open " << pszPath << L": " << GetLastError());
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	defer({ CloseHandle(hFile); });
+	return Query(hFile);
+}
+
+
+HRESULT CStreamInfoBuffer::Query(_In_ HANDLE hFile) {
+	m_cbUsed = 0;
+	if (m_cbAlloc == 0) {
+		if (!m_pb.AllocateBytes(cbInitial)) return E_OUTOFMEMORY;
+		m_cbAlloc = cbInitial;
+	}
+
+	for (;;) {
+		if (GetFileInformationByHandleEx(hFile, FileStreamInfo, m_pb, m_cbAlloc)) {
+			// The chain marks its own end, so the whole buffer is fair game
+			m_cbUsed = m_cbAlloc;
+			return S_OK;
+		}
+
+		const DWORD dwError = GetLastError();
+		switch (dwError) {
+			case ERROR_HANDLE_EOF:
+				// No streams at all, not even the main one. Folders do this.
+				LOG(L" ** No streams found");
+				return S_OK;
+			case ERROR_INVALID_PARAMETER:
+				// The filesystem doesn't know what a stream is (FAT, exFAT...)
+				LOG(L" ** Filesystem doesn't support streams");
+				return S_OK;
+			case ERROR_MORE_DATA:
+			case ERROR_INSUFFICIENT_BUFFER: {
+				// Didn't fit. Nothing in the buffer is worth keeping since
+				// we're going to ask again from the top, so don't bother
+				// copying it over with a realloc.
+				if (m_cbAlloc >= cbMax) return HRESULT_FROM_WIN32(dwError);
+				const DWORD cbGrown = min(m_cbAlloc * 2, cbMax);
+				LOG(L" ** Growing stream info buffer to " << cbGrown << L" bytes");
+				m_pb.Free();
+				m_cbAlloc = 0;
+				if (!m_pb.AllocateBytes(cbGrown)) return E_OUTOFMEMORY;
+				m_cbAlloc = cbGrown;
+				break;
+			}
+			default:
+				LOG(L" ** Error: " << dwError);
+				return HRESULT_FROM_WIN32(dwError);
+		}
+	}
+}
+
+
+StreamInfo::CReader CStreamInfoBuffer::Reader() const {
+	return StreamInfo::CReader(static_cast<const BYTE *>(m_pb), m_cbUsed);
+}
+
+}  // namespace ADSX
@@ -0,0 +1,88 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Pulls a file system object's whole list of streams out of the filesystem
+ * in one query instead of one FindNextStreamW round trip per stream.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+
+#include "StreamInfo.h"
+
+namespace ADSX {
+
+/**
+ * Open a file system object with just enough access to ask about its streams.
+ * Works on folders too.
+ * @post: returns INVALID_HANDLE_VALUE on failure with GetLastError() set.
+ * @post: the handle must be closed with CloseHandle.
+ */
+HANDLE OpenForStreamQuery(_In_ PCWSTR pszPath);
+
+/**
+ * pszPath with the \\?\ prefix, so walking deep trees under it isn't held
+ * to MAX_PATH: C:\dir -> \\?\C:\dir, \\server\share -> \\?\UNC\server\share.
+ * Anything already prefixed is left alone.
+ * @post: may throw std::bad_alloc.
+ */
+std::wstring ExtendedLengthPath(_In_ PCWSTR pszPath);
+
+// Which stream ReadStreamStart reads: pszName on the object at pszPath
+struct StreamToRead {
+	PCWSTR pszPath;
+	PCWSTR pszName;  // undecorated: "Zone.Identifier"
+};
+
+/**
+ * Read up to cb bytes from the start of the stream a StreamToRead points at;
+ * a Selector::Candidate's pfnRead, for queries that look at content.
+ * @post: returns how many bytes were read, 0 if the stream couldn't be opened.
+ */
+std::size_t ReadStreamStart(
+	_In_                            void          *pvStream,
+	_Out_writes_bytes_to_(cb, return) unsigned char *pb,
+	_In_                            std::size_t   cb
+);
+
+
+/**
+ * Owns the buffer a FILE_STREAM_INFO chain is read into.
+ * The buffer is reused (and only ever grows) across queries, so Reset() on an
+ * enumerator doesn't cost another allocation.
+ */
+class CStreamInfoBuffer {
+  public:
+	CStreamInfoBuffer();
+
+	// Start big enough that nearly every file fits on the first try; on an SMB
+	// share every retry is another network round trip.
+	static constexpr DWORD cbInitial = 64 * 1024;
+	// Nothing real has this many streams. Stop before a broken filesystem
+	// driver makes us eat all the memory in Explorer.
+	static constexpr DWORD cbMax = 64 * 1024 * 1024;
+
+	/**
+	 * Read the stream list of the object at pszPath.
+	 * An object that has no streams at all, or that lives on a filesystem
+	 * without streams, succeeds with an empty list.
+	 */
+	HRESULT Query(_In_ PCWSTR pszPath);
+
+	// Same, on an already opened handle.
+	HRESULT Query(_In_ HANDLE hFile);
+
+	// Read the entries of the last successful query.
+	// @pre: the buffer isn't queried again while the reader is in use.
+	StreamInfo::CReader Reader() const;
+
+  protected:
+	CHeapPtr<BYTE> m_pb;
+	DWORD m_cbAlloc;
+	DWORD m_cbUsed;  // 0 if the last query failed or found nothing
+};
+
+}  // namespace ADSX
@@ -0,0 +1,205 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "StreamSnapshot.h"
+
+#include <new>
+#include <vector>
+
+#include "StreamQuery.h"
+
+namespace ADSX {
+
+
+CStreamSnapshot::CStreamSnapshot()
+	: m_cRef(1)
+	, m_cStreams(0)
+	, m_pbArena(NULL)
+	, m_allSize(NULL)
+	, m_aichName(NULL)
+	, m_pszNames(NULL) {}
+
+CStreamSnapshot::~CStreamSnapshot() {
+	delete[] m_pbArena;
+}
+
+
+ULONG CStreamSnapshot::AddRef() {
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CStreamSnapshot::Release() {
+	const ULONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0) delete this;
+	return cRef;
+}
+
+
+CStreamSnapshot *CStreamSnapshot::Allocate(_In_ ULONG cStreams, _In_ SIZE_T cchNames) {
+	auto pSnapshot = new (std::nothrow) CStreamSnapshot();
+	if (pSnapshot == NULL) return NULL;
+	const SIZE_T cbSizes = cStreams * sizeof(LONGLONG);
+	const SIZE_T cbOffsets = (cStreams + 1) * sizeof(ULONG);
+	const SIZE_T cbNames = cchNames * sizeof(WCHAR);
+	pSnapshot->m_pbArena =
+		new (std::nothrow) BYTE[cbSizes + cbOffsets + cbNames];
+	if (pSnapshot->m_pbArena == NULL) {
+		pSnapshot->Release();
+		return NULL;
+	}
+	pSnapshot->m_cStreams = cStreams;
+	pSnapshot->m_allSize = reinterpret_cast<LONGLONG *>(pSnapshot->m_pbArena);
+	pSnapshot->m_aichName =
+		reinterpret_cast<ULONG *>(pSnapshot->m_pbArena + cbSizes);
+	pSnapshot->m_pszNames =
+		reinterpret_cast<PWSTR>(pSnapshot->m_pbArena + cbSizes + cbOffsets);
+	return pSnapshot;
+}
+
+
+HRESULT CStreamSnapshot::Create(
+	_In_         PCWSTR           pszPath,
+	_COM_Outptr_ CStreamSnapshot  **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+	CStreamInfoBuffer Buffer;
+	HRESULT hr = Buffer.Query(pszPath);
+	if (FAILED(hr)) return hr;
+	return Create(Buffer.Reader(), ppSnapshot);
+}
+
+
+HRESULT CStreamSnapshot::Create(
+	_In_         HANDLE           hFile,
+	_COM_Outptr_ CStreamSnapshot  **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+	CStreamInfoBuffer Buffer;
+	HRESULT hr = Buffer.Query(hFile);
+	if (FAILED(hr)) return hr;
+	return Create(Buffer.Reader(), ppSnapshot);
+}
+
+
+HRESULT CStreamSnapshot::Create(
+	_In_         const StreamInfo::CReader &reader,
+	_COM_Outptr_ CStreamSnapshot           **ppSnapshot
+) {
+	if (ppSnapshot == NULL) return E_POINTER;
+	*ppSnapshot = NULL;
+
+	// First pass: count up how big the arena has to be so it only takes the
+	// one allocation.
+	StreamInfo::CReader counter = reader;
+	StreamInfo::Entry entry;
+	StreamInfo::ReadResult result;
+	ULONG cStreams = 0;
+	SIZE_T cchNames = 0;
+	while ((result = counter.Next(&entry)) == StreamInfo::ReadResult::Ok) {
+		const StreamInfo::NameView svName = StreamInfo::TrimName(entry.svName);
+		// Skip the main stream. We're too hipster
+		if (svName.empty()) continue;
+		++cStreams;
+		cchNames += svName.size() + 1;
+	}
+	if (result == StreamInfo::ReadResult::Malformed) {
+		// Filesystem driver gave us something we can't make sense of
+		LOG(L" ** Malformed stream information");
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	// The stream info buffer tops out way below this, but the offsets are
+	// ULONGs so make sure.
+	if (cchNames >= MAXULONG) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+	CStreamSnapshot *pSnapshot = Allocate(cStreams, cchNames);
+	if (pSnapshot == NULL) return E_OUTOFMEMORY;
+
+	// Second pass: fill it in.
+	StreamInfo::CReader filler = reader;
+	ULONG i = 0;
+	ULONG ichName = 0;
+	while (filler.Next(&entry) == StreamInfo::ReadResult::Ok) {
+		const StreamInfo::NameView svName = StreamInfo::TrimName(entry.svName);
+		if (svName.empty()) continue;
+		pSnapshot->m_allSize[i] = entry.llSize;
+		pSnapshot->m_aichName[i] = ichName;
+		CopyMemory(
+			pSnapshot->m_pszNames + ichName,
+			svName.data(),
+			svName.size() * sizeof(WCHAR)
+		);
+		ichName += static_cast<ULONG>(svName.size());
+		pSnapshot->m_pszNames[ichName++] = L'\0';
+		++i;
+	}
+	ATLASSERT(i == cStreams && ichName == cchNames);
+	// One past the end so NameLength works on the last one too
+	pSnapshot->m_aichName[cStreams] = ichName;
+
+	LOG(L" ** Snapshot of " << cStreams << L" streams");
+	*ppSnapshot = pSnapshot;
+	return S_OK;
+}
+
+
+HRESULT CStreamSnapshot::Select(
+	_In_         CStreamSnapshot          *pAll,
+	_In_         const Selector::CProgram &program,
+	_In_         PCWSTR                   pszPath,
+	_COM_Outptr_ CStreamSnapshot          **ppSelected
+) {
+	if (ppSelected == NULL) return E_POINTER;
+	*ppSelected = NULL;
+	if (pAll == NULL || pszPath == NULL) return E_POINTER;
+
+	// Decide on each stream once; the second pass only copies
+	std::vector<ULONG> selected;
+	SIZE_T cchNames = 0;
+	try {
+		selected.reserve(pAll->Count());
+		for (ULONG i = 0; i < pAll->Count(); i++) {
+			StreamToRead stream = {pszPath, pAll->Name(i)};
+			Selector::Candidate candidate;
+			candidate.svName = std::wstring_view(pAll->Name(i), pAll->NameLength(i));
+			candidate.ullSize = static_cast<std::uint64_t>(pAll->Size(i));
+			candidate.svPath = pszPath;
+			candidate.pfnRead = ReadStreamStart;
+			candidate.pvContext = &stream;
+			if (!program.Matches(candidate)) continue;
+			selected.push_back(i);
+			cchNames += pAll->NameLength(i) + 1;
+		}
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	if (selected.size() == pAll->Count()) {
+		pAll->AddRef();
+		*ppSelected = pAll;
+		return S_OK;
+	}
+
+	const ULONG cStreams = static_cast<ULONG>(selected.size());
+	CStreamSnapshot *pSnapshot = Allocate(cStreams, cchNames);
+	if (pSnapshot == NULL) return E_OUTOFMEMORY;
+	ULONG ichName = 0;
+	for (ULONG i = 0; i < cStreams; i++) {
+		const ULONG iAll = selected[i];
+		const ULONG cchName = pAll->NameLength(iAll) + 1;
+		pSnapshot->m_allSize[i] = pAll->Size(iAll);
+		pSnapshot->m_aichName[i] = ichName;
+		CopyMemory(pSnapshot->m_pszNames + ichName, pAll->Name(iAll), cchName * sizeof(WCHAR));
+		ichName += cchName;
+	}
+	pSnapshot->m_aichName[cStreams] = ichName;
+
+	LOG(L" ** Selected " << cStreams << L" of " << pAll->Count() << L" streams");
+	*ppSelected = pSnapshot;
+	return S_OK;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,96 @@
+/**
+ * 2024 Nate Kean
+ *
+ * An immutable, compact copy of a file system object's list of alternate data
+ * streams, taken once and shared by every enumerator that walks it.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "Selector.h"
+#include "StreamInfo.h"
+
+namespace ADSX {
+
+
+class CStreamSnapshot {
+  public:
+	/**
+	 * Ask the filesystem for the streams of the object at pszPath and keep a
+	 * copy of them.
+	 * @post: *ppSnapshot has a reference count of 1 for the caller to Release.
+	 */
+	static HRESULT Create(
+		_In_         PCWSTR           pszPath,
+		_COM_Outptr_ CStreamSnapshot  **ppSnapshot
+	);
+
+	// Same, on an already opened handle.
+	static HRESULT Create(
+		_In_         HANDLE           hFile,
+		_COM_Outptr_ CStreamSnapshot  **ppSnapshot
+	);
+
+	/**
+	 * Copy the named streams out of a FILE_STREAM_INFO chain.
+	 * The main stream is left out, and names are stored without the
+	 * ":name:$DATA" decoration.
+	 * @post: *ppSnapshot has a reference count of 1 for the caller to Release.
+	 */
+	static HRESULT Create(
+		_In_         const StreamInfo::CReader &reader,
+		_COM_Outptr_ CStreamSnapshot           **ppSnapshot
+	);
+
+	/**
+	 * The streams of pAll, on the object at pszPath, that the program
+	 * matches, each looked at once. pAll itself if they all do.
+	 * @post: *ppSelected has a reference count of 1 for the caller to Release.
+	 */
+	static HRESULT Select(
+		_In_         CStreamSnapshot          *pAll,
+		_In_         const Selector::CProgram &program,
+		_In_         PCWSTR                   pszPath,
+		_COM_Outptr_ CStreamSnapshot          **ppSelected
+	);
+
+	// Shared by refcount like a COM object so CComPtr can hold one,
+	// but it's not one.
+	ULONG AddRef();
+	ULONG Release();
+
+	ULONG Count() const { return m_cStreams; }
+
+	// @pre: i < Count()
+	// @post: null-terminated, and lives as long as the snapshot does.
+	PCWSTR Name(_In_ ULONG i) const { return m_pszNames + m_aichName[i]; }
+	// In characters, not including the null terminator.
+	ULONG NameLength(_In_ ULONG i) const {
+		return m_aichName[i + 1] - m_aichName[i] - 1;
+	}
+	LONGLONG Size(_In_ ULONG i) const { return m_allSize[i]; }
+
+  protected:
+	CStreamSnapshot();
+	~CStreamSnapshot();
+
+	// A snapshot with room for cStreams streams and cchNames characters of
+	// names, terminators included, laid out as below.
+	static CStreamSnapshot *Allocate(_In_ ULONG cStreams, _In_ SIZE_T cchNames);
+
+	volatile LONG m_cRef;
+	ULONG m_cStreams;
+
+	// All of the below point into this one allocation:
+	//   LONGLONG m_allSize[m_cStreams];       (flat, for sorting and sizing)
+	//   ULONG    m_aichName[m_cStreams + 1];  (where each name starts)
+	//   WCHAR    m_pszNames[];                (every name back to back)
+	BYTE *m_pbArena;
+	LONGLONG *m_allSize;
+	ULONG *m_aichName;
+	PWSTR m_pszNames;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,365 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Where a volume's alternate stream bytes are: the biggest files, directory
+ * subtrees, stream names (every Zone.Identifier together) and file
+ * extensions, by bytes in named streams.
+ *
+ * Streams are sorted by path so every directory's are together, then split
+ * between threads at file boundaries. Each thread walks its share keeping only
+ * the directories it's in at the moment, and hands each one it leaves to a
+ * bounded top-K heap; so do files. Only directories that straddle two shares
+ * are kept until the end, to be added up, and there are at most a path's
+ * depth of those per share. Stream names and extensions are added up in
+ * full, since there are few of them.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "MftScanner.h"
+#include "StreamInfo.h"
+
+namespace ADSX::Usage {
+
+using Mft::NameChar;
+using Mft::Name;
+
+struct Totals {
+	std::uint64_t cFiles = 0;  // objects with named streams; directories count
+	std::uint64_t cStreams = 0;
+	std::uint64_t ullBytes = 0;
+
+	Totals &operator+=(const Totals &other) {
+		cFiles += other.cFiles;
+		cStreams += other.cStreams;
+		ullBytes += other.ullBytes;
+		return *this;
+	}
+};
+
+struct Ranked {
+	Name sKey;  // a path from the root, a stream name or an extension
+	Totals totals;
+};
+
+// Biggest first; then most streams; then by key, so the order never depends
+// on which thread got there first
+inline bool RanksAbove(const Ranked &a, const Ranked &b) {
+	if (a.totals.ullBytes != b.totals.ullBytes) return a.totals.ullBytes > b.totals.ullBytes;
+	if (a.totals.cStreams != b.totals.cStreams) return a.totals.cStreams > b.totals.cStreams;
+	return a.sKey < b.sKey;
+}
+
+
+/**
+ * The cTop highest ranked of everything it's offered, in O(cTop) memory:
+ * a heap with the lowest ranked of them on top, to be pushed out by anything
+ * that beats it.
+ */
+class CTopK {
+  public:
+	explicit CTopK(std::size_t cTop) : m_cTop(cTop) { m_heap.reserve(cTop); }
+
+	void Offer(Ranked &&item) {
+		if (m_cTop == 0) return;
+		if (m_heap.size() < m_cTop) {
+			m_heap.push_back(std::move(item));
+			std::push_heap(m_heap.begin(), m_heap.end(), RanksAbove);
+			return;
+		}
+		if (!RanksAbove(item, m_heap.front())) return;
+		std::pop_heap(m_heap.begin(), m_heap.end(), RanksAbove);
+		m_heap.back() = std::move(item);
+		std::push_heap(m_heap.begin(), m_heap.end(), RanksAbove);
+	}
+
+	void Merge(CTopK &&other) {
+		for (Ranked &item : other.m_heap) Offer(std::move(item));
+		other.m_heap.clear();
+	}
+
+	// Highest first. Leaves this empty.
+	std::vector<Ranked> Take() {
+		std::sort(m_heap.begin(), m_heap.end(), RanksAbove);
+		return std::move(m_heap);
+	}
+
+  private:
+	std::size_t m_cTop;
+	std::vector<Ranked> m_heap;
+};
+
+
+struct Report {
+	Totals total;
+	std::vector<Ranked> files;
+	std::vector<Ranked> subtrees;   // what's under a directory, all told, its own streams included
+	std::vector<Ranked> names;      // keyed by the name as first seen; compared without case
+	std::vector<Ranked> extensions; // "" for files without one; directories don't count
+};
+
+
+// Directories come before the paths in them, and everything in a directory
+// comes before the next path that isn't in it ("a", "a\b", "a b"), so one
+// directory's streams are all together.
+inline bool PathBefore(const Name &sA, const Name &sB) {
+	const std::size_t cch = (std::min)(sA.size(), sB.size());
+	for (std::size_t i = 0; i < cch; i++) {
+		if (sA[i] == sB[i]) continue;
+		if (sA[i] == '\\') return true;
+		if (sB[i] == '\\') return false;
+		return sA[i] < sB[i];
+	}
+	return sA.size() < sB.size();
+}
+
+
+/**
+ * Adds up one thread's share of the streams.
+ * @pre: Add is called in PathBefore order, every stream of a file together.
+ */
+class CTally {
+  public:
+	explicit CTally(std::size_t cTop)
+		: m_cTop(cTop)
+		, m_files(cTop)
+		, m_subtrees(cTop)
+		, m_bStarted(false) {}
+
+	/**
+	 * The streams of one file or directory. sPath is from the root, "" being
+	 * the root itself.
+	 * @pre: pStreams[0..cStreams) all have that path.
+	 */
+	void AddFile(const Mft::FoundStream *pStreams, std::size_t cStreams) {
+		const Name &sPath = pStreams[0].sPath;
+		const bool bDirectory = pStreams[0].bDirectory;
+		Totals totals;
+		totals.cFiles = 1;
+		for (std::size_t i = 0; i < cStreams; i++) {
+			totals.cStreams++;
+			totals.ullBytes += pStreams[i].ullSize;
+			Totals stream;
+			stream.cFiles = 1;
+			stream.cStreams = 1;
+			stream.ullBytes = pStreams[i].ullSize;
+			AddFolded(m_names, pStreams[i].sName, stream);
+		}
+		m_total += totals;
+		if (!bDirectory) AddFolded(m_extensions, ExtensionOf(sPath), totals);
+
+		EnterDirectoriesOf(sPath, bDirectory);
+		m_bStarted = true;
+		for (OpenDirectory &directory : m_open) directory.totals += totals;
+		if (!sPath.empty()) m_files.Offer(Ranked{sPath, totals});
+	}
+
+	/**
+	 * Finish: every directory still open straddles the end of the share.
+	 * @post: call once, after the last AddFile.
+	 */
+	void Finish() {
+		for (OpenDirectory &directory : m_open) m_straddling[directory.sPath] += directory.totals;
+		m_open.clear();
+	}
+
+	// Fold other's share into this one's.
+	void Merge(CTally &&other) {
+		m_total += other.m_total;
+		m_files.Merge(std::move(other.m_files));
+		m_subtrees.Merge(std::move(other.m_subtrees));
+		for (auto &entry : other.m_straddling) m_straddling[entry.first] += entry.second;
+		for (auto &entry : other.m_names) Fold(m_names, entry.first, entry.second);
+		for (auto &entry : other.m_extensions) Fold(m_extensions, entry.first, entry.second);
+	}
+
+	// @post: leaves this empty.
+	Report Take() {
+		for (auto &entry : m_straddling) m_subtrees.Offer(Ranked{entry.first, entry.second});
+		m_straddling.clear();
+		Report report;
+		report.total = m_total;
+		report.files = m_files.Take();
+		report.subtrees = m_subtrees.Take();
+		report.names = Rank(m_names);
+		report.extensions = Rank(m_extensions);
+		return report;
+	}
+
+  private:
+	struct OpenDirectory {
+		Name sPath;
+		Totals totals;
+		bool bStraddles;  // was open before this share's first file
+	};
+
+	// By the name with its case folded
+	using Folded = std::unordered_map<Name, Ranked>;
+
+	// Leave the directories the last file was in that this one isn't, and
+	// enter the ones it is. The root isn't one; its total is m_total.
+	void EnterDirectoriesOf(const Name &sPath, bool bDirectory) {
+		std::size_t cDepth = 0;
+		std::size_t ich = 0;
+		for (;;) {
+			const std::size_t ichEnd = sPath.find('\\', ich);
+			if (ichEnd == Name::npos && !(bDirectory && !sPath.empty())) break;
+			const std::size_t cch = ichEnd == Name::npos ? sPath.size() : ichEnd;
+			if (cDepth < m_open.size() && !SameDirectory(m_open[cDepth].sPath, sPath, cch)) {
+				while (m_open.size() > cDepth) Leave();
+			}
+			if (cDepth == m_open.size()) {
+				m_open.push_back(OpenDirectory{sPath.substr(0, cch), Totals(), !m_bStarted});
+			}
+			cDepth++;
+			if (ichEnd == Name::npos) break;
+			ich = ichEnd + 1;
+		}
+		while (m_open.size() > cDepth) Leave();
+	}
+
+	static bool SameDirectory(const Name &sOpen, const Name &sPath, std::size_t cch) {
+		return sOpen.size() == cch && sPath.compare(0, cch, sOpen) == 0;
+	}
+
+	void Leave() {
+		OpenDirectory &directory = m_open.back();
+		// The share before may have more of it
+		if (directory.bStraddles) {
+			m_straddling[directory.sPath] += directory.totals;
+		} else {
+			m_subtrees.Offer(Ranked{std::move(directory.sPath), directory.totals});
+		}
+		m_open.pop_back();
+	}
+
+	static Name ExtensionOf(const Name &sPath) {
+		const std::size_t ichName = sPath.rfind('\\');
+		const std::size_t ichDot = sPath.rfind('.');
+		if (ichDot == Name::npos || (ichName != Name::npos && ichDot < ichName)) return Name();
+		return sPath.substr(ichDot + 1);
+	}
+
+	void AddFolded(Folded &map, const Name &sKey, const Totals &totals) {
+		// Into the same buffer every time; nearly every key is one already seen
+		m_sFolded.assign(sKey);
+		for (NameChar &ch : m_sFolded) ch = ch >= 'A' && ch <= 'Z' ? static_cast<NameChar>(ch - 'A' + 'a') : ch;
+		auto it = map.find(m_sFolded);
+		if (it == map.end()) it = map.emplace(m_sFolded, Ranked{sKey, Totals()}).first;
+		it->second.totals += totals;
+	}
+
+	static void Fold(Folded &map, const Name &sFolded, const Ranked &ranked) {
+		auto it = map.find(sFolded);
+		if (it == map.end()) {
+			map.emplace(sFolded, ranked);
+		} else {
+			it->second.totals += ranked.totals;
+		}
+	}
+
+	std::vector<Ranked> Rank(Folded &map) const {
+		CTopK top(m_cTop);
+		for (auto &entry : map) top.Offer(std::move(entry.second));
+		map.clear();
+		return top.Take();
+	}
+
+	std::size_t m_cTop;
+	Totals m_total;
+	CTopK m_files;
+	CTopK m_subtrees;
+	std::vector<OpenDirectory> m_open;  // root first
+	std::unordered_map<Name, Totals> m_straddling;
+	Folded m_names;
+	Folded m_extensions;
+	Name m_sFolded;
+	bool m_bStarted;
+};
+
+
+/**
+ * Rank streams found on a volume, cTop of each kind, on cWorkers threads
+ * (0 for one per core).
+ * @post: streams is sorted by PathBefore.
+ * @post: may throw std::bad_alloc.
+ */
+inline Report Analyze(std::vector<Mft::FoundStream> &streams, std::size_t cTop, unsigned cWorkers = 0) {
+	if (cWorkers == 0) cWorkers = (std::max)(1u, std::thread::hardware_concurrency());
+	// Not worth a thread for fewer than this
+	const std::size_t cMinShare = 4096;
+	cWorkers = static_cast<unsigned>((std::min)(
+		static_cast<std::size_t>(cWorkers), (std::max)(std::size_t(1), streams.size() / cMinShare)
+	));
+	auto fnBefore = [](const Mft::FoundStream &a, const Mft::FoundStream &b) {
+		return PathBefore(a.sPath, b.sPath);
+	};
+
+	// Sort a share each, then merge them pairwise
+	std::vector<std::size_t> aiBound(cWorkers + 1);
+	for (unsigned i = 0; i <= cWorkers; i++) aiBound[i] = streams.size() * i / cWorkers;
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < cWorkers; i++) {
+		threads.emplace_back([&, i]() {
+			std::sort(streams.begin() + aiBound[i], streams.begin() + aiBound[i + 1], fnBefore);
+		});
+	}
+	std::sort(streams.begin() + aiBound[0], streams.begin() + aiBound[1], fnBefore);
+	for (std::thread &thread : threads) thread.join();
+	threads.clear();
+	for (std::size_t cWidth = 1; cWidth < cWorkers; cWidth *= 2) {
+		for (std::size_t i = 0; i + cWidth < cWorkers; i += 2 * cWidth) {
+			threads.emplace_back([&, i, cWidth]() {
+				std::inplace_merge(
+					streams.begin() + aiBound[i],
+					streams.begin() + aiBound[i + cWidth],
+					streams.begin() + aiBound[(std::min)(i + 2 * cWidth, std::size_t(cWorkers))],
+					fnBefore
+				);
+			});
+		}
+		for (std::thread &thread : threads) thread.join();
+		threads.clear();
+	}
+
+	// Then share them out again, each file's streams together
+	for (unsigned i = 1; i < cWorkers; i++) {
+		std::size_t iBound = (std::max)(aiBound[i], aiBound[i - 1]);
+		while (
+			iBound > 0 && iBound < streams.size() &&
+			streams[iBound].sPath == streams[iBound - 1].sPath
+		) {
+			iBound++;
+		}
+		aiBound[i] = iBound;
+	}
+	std::vector<CTally> tallies(cWorkers, CTally(cTop));
+	auto fnTally = [&](unsigned iWorker) {
+		CTally &tally = tallies[iWorker];
+		std::size_t i = aiBound[iWorker];
+		while (i < aiBound[iWorker + 1]) {
+			std::size_t iEnd = i + 1;
+			while (iEnd < aiBound[iWorker + 1] && streams[iEnd].sPath == streams[i].sPath) iEnd++;
+			tally.AddFile(&streams[i], iEnd - i);
+			i = iEnd;
+		}
+		tally.Finish();
+	};
+	for (unsigned i = 1; i < cWorkers; i++) threads.emplace_back(fnTally, i);
+	fnTally(0);
+	for (std::thread &thread : threads) thread.join();
+
+	for (unsigned i = 1; i < cWorkers; i++) tallies[0].Merge(std::move(tallies[i]));
+	return tallies[0].Take();
+}
+
+}  // namespace ADSX::Usage
@@ -0,0 +1,65 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "TreeEnumIDList.h"
+
+// Debug log prefix for CTreeEnumIDList
+#define P_TEIDL L"ADSX::CTreeEnumIDList(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+
+CTreeEnumIDList::CTreeEnumIDList() {
+	LOG(P_TEIDL << L"CTreeEnumIDList()");
+}
+
+CTreeEnumIDList::~CTreeEnumIDList() {
+	LOG(P_TEIDL << L"~CTreeEnumIDList()");
+}
+
+HRESULT CTreeEnumIDList::Init(
+	_In_ IUnknown     *punkOwner,
+	_In_ CTreeScanner *pScanner,
+	_In_ bool         bFillBatches,
+	_In_ DWORD        dwTimeoutMs
+) {
+	LOG(P_TEIDL << L"Init()");
+	m_pScanner = pScanner;
+	InitScan(punkOwner, pScanner, bFillBatches, dwTimeoutMs);
+	return WrapReturn(S_OK);
+}
+
+
+HRESULT CTreeEnumIDList::Fetch(
+	_In_                                 ULONG         iFirst,
+	_In_                                 ULONG         celt,
+	_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+	_Out_                                ULONG         *pceltFetched,
+	_Out_                                ULONG         *pcUsed,
+	_In_                                 DWORD         dwTimeoutMs
+) {
+	HRESULT hr = m_pScanner->Get(iFirst, celt, rgelt, pceltFetched, dwTimeoutMs);
+	*pcUsed = *pceltFetched;
+	return hr;
+}
+
+
+HRESULT CTreeEnumIDList::CreateClone(_COM_Outptr_ CScanEnumIDList **ppClone) {
+	*ppClone = NULL;
+	CComObject<CTreeEnumIDList> *pEnumNew;
+	HRESULT hr = CComObject<CTreeEnumIDList>::CreateInstance(&pEnumNew);
+	if (FAILED(hr)) return hr;
+	pEnumNew->AddRef();
+	hr = pEnumNew->Init(m_punkOwner, m_pScanner, m_bFillBatches, INFINITE);
+	if (FAILED(hr)) {
+		pEnumNew->Release();
+		return hr;
+	}
+	*ppClone = pEnumNew;
+	return S_OK;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,50 @@
+/**
+ * 2024 Nate Kean
+ *
+ * An enumerator over the streams a CTreeScanner finds, for the pseudofolder
+ * of every stream under a folder.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "ScanEnumIDList.h"
+#include "TreeScanner.h"
+
+namespace ADSX {
+
+
+class ATL_NO_VTABLE CTreeEnumIDList : public CScanEnumIDList {
+  public:
+	CTreeEnumIDList();
+	virtual ~CTreeEnumIDList();
+
+	/**
+	 * Enumerate what pScanner finds, as it finds it. See
+	 * CScanEnumIDList::InitScan about bFillBatches and dwTimeoutMs.
+	 * @post: pScanner is AddRef'd, and counts this as one of its consumers.
+	 */
+	HRESULT Init(
+		_In_ IUnknown     *pUnkOwner,
+		_In_ CTreeScanner *pScanner,
+		_In_ bool         bFillBatches,
+		_In_ DWORD        dwTimeoutMs
+	);
+
+  protected:
+	// The scanner's items are items already
+	HRESULT Fetch(
+		_In_                                 ULONG         iFirst,
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched,
+		_Out_                                ULONG         *pcUsed,
+		_In_                                 DWORD         dwTimeoutMs
+	) override;
+	HRESULT CreateClone(_COM_Outptr_ CScanEnumIDList **ppClone) override;
+
+	CComPtr<CTreeScanner> m_pScanner;
+};
+
+}  // namespace ADSX
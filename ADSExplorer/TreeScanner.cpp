@@ -0,0 +1,358 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "TreeScanner.h"
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+#include "ADSXItem.h"
+#include "IoScheduler.h"
+#include "Settings.h"
+#include "StreamInfo.h"
+#include "Volume.h"
+
+// Debug log prefix for CTreeScanner
+#define P_TS L"ADSX::CTreeScanner(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+// The scan is mostly waiting on the filesystem, so more threads than cores
+// still pay off, up to where they just queue up on the disk instead.
+static constexpr unsigned cWorkersMin = 4;
+static constexpr unsigned cWorkersMax = 16;
+// Publish this often within a big directory, not only at the end of it, so
+// the view doesn't sit empty.
+static constexpr SIZE_T cPublishBatch = 64;
+
+
+CTreeScanner::CTreeScanner()
+	: m_pQuery(CSettings::Get().pStreamQuery)
+	, m_cDirectories(0)
+	, m_cFiles(0)
+	, m_cStreams(0)
+	, m_cHardLinksSkipped(0)
+	, m_cErrors(0) {}
+
+CTreeScanner::~CTreeScanner() {
+	for (PITEMID_CHILD pidlc : m_items) CoTaskMemFree(pidlc);
+}
+
+
+HRESULT CTreeScanner::Start(
+	_In_         PCWSTR       pszRoot,
+	_COM_Outptr_ CTreeScanner **ppScanner,
+	_In_         bool         bQuery
+) {
+	if (ppScanner == NULL) return E_POINTER;
+	*ppScanner = NULL;
+
+	auto pScanner = new (std::nothrow) CTreeScanner();
+	if (pScanner == NULL) return E_OUTOFMEMORY;
+	defer({ if (pScanner != NULL) pScanner->Release(); });
+
+	try {
+		if (!bQuery) pScanner->m_pQuery.reset();
+		pScanner->m_sRoot = ExtendedLengthPath(pszRoot);
+		if (pScanner->m_sRoot.back() != L'\\') pScanner->m_sRoot += L'\\';
+
+		const unsigned cWorkers = std::clamp(
+			std::thread::hardware_concurrency(), cWorkersMin, cWorkersMax
+		);
+		pScanner->m_pPool.reset(new CPool(cWorkers));
+		pScanner->m_aBuffers.reset(new CStreamInfoBuffer[cWorkers]);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	HRESULT hr = pScanner->StartThread();
+	if (FAILED(hr)) return hr;
+
+	*ppScanner = pScanner;
+	pScanner = NULL;
+	return S_OK;
+}
+
+
+void CTreeScanner::Run() {
+	LOG(P_TS << L"Run(" << m_sRoot << L")");
+
+	// Nothing to find on FAT and the like; don't walk the whole tree to
+	// find that out. Asks the volume the root is really on, which for a
+	// share or a volume mounted in a folder isn't what its drive letter says.
+	const std::wstring sVolume = CVolumeCache::VolumePathOf(m_sRoot.c_str());
+	if (CVolumeCache::Instance().VolumeSupportsNamedStreams(sVolume)) {
+		m_pPool->Run(
+			std::vector<std::wstring>{std::wstring()},
+			[this](CPool::CContext &context, std::wstring sRelative) {
+				try {
+					ScanDirectory(context, sRelative);
+				} catch (const std::bad_alloc &) {
+					// Not worth taking Explorer down over; what was found so
+					// far stays
+					InterlockedIncrement64(&m_cErrors);
+				}
+			}
+		);
+	}
+
+#ifdef _DEBUG
+	const Stats stats = GetStats();
+	LOG(P_TS << L"Run(): " << std::dec <<
+		stats.cFiles << L" files in " << stats.cDirectories << L" directories, " <<
+		stats.cStreams << L" streams, " <<
+		stats.cHardLinksSkipped << L" duplicate links, " <<
+		stats.cErrors << L" errors, " <<
+		stats.cSteals << L" steals; " <<
+		stats.dwElapsedMs << L" ms = " <<
+		static_cast<ULONGLONG>(stats.FilesPerSecond()) << L" files/s" <<
+		(m_bCancel.load() ? L" (cancelled)" : L""));
+	CIoScheduler::Instance().LogStats();
+#endif
+}
+
+
+void CTreeScanner::ScanDirectory(
+	_In_ CPool::CContext     &context,
+	_In_ const std::wstring &sRelative
+) {
+	// Whatever the user's looking at meanwhile goes first
+	CBackgroundMode background;
+	CStreamInfoBuffer &buffer = m_aBuffers[context.WorkerIndex()];
+	std::vector<PITEMID_CHILD> found;
+	defer({ PublishFound(found); });
+
+	// Directories can have streams of their own
+	if (!ScanObject(sRelative, true, buffer, found)) {
+		InterlockedIncrement64(&m_cErrors);
+	}
+	InterlockedIncrement64(&m_cDirectories);
+
+	const std::wstring sPattern = m_sRoot + sRelative + (sRelative.empty() ? L"*" : L"\\*");
+	WIN32_FIND_DATAW fd;
+	HANDLE hFind = FindFirstFileExW(
+		sPattern.c_str(),
+		// Skip the 8.3 names; nobody here needs them
+		FindExInfoBasic,
+		&fd,
+		FindExSearchNameMatch,
+		NULL,
+		FIND_FIRST_EX_LARGE_FETCH
+	);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		InterlockedIncrement64(&m_cErrors);
+		return;
+	}
+	defer({ FindClose(hFind); });
+
+	LONG64 cFiles = 0;
+	LONG64 cErrors = 0;
+	do {
+		if (context.IsCancelled()) break;
+		if (
+			wcscmp(fd.cFileName, L".") == 0 ||
+			wcscmp(fd.cFileName, L"..") == 0
+		) {
+			continue;
+		}
+		std::wstring sChild = sRelative.empty() ?
+			std::wstring(fd.cFileName) :
+			sRelative + L'\\' + fd.cFileName;
+
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			// Junctions and mount points lead out of the tree, or back into
+			// it forever
+			if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+				context.Push(std::move(sChild));
+			}
+			continue;
+		}
+
+		cFiles++;
+		if (!ScanObject(sChild, false, buffer, found)) cErrors++;
+		if (found.size() >= cPublishBatch) PublishFound(found);
+	} while (FindNextFileW(hFind, &fd));
+
+	InterlockedAdd64(&m_cFiles, cFiles);
+	InterlockedAdd64(&m_cErrors, cErrors);
+}
+
+
+bool CTreeScanner::ScanObject(
+	_In_    const std::wstring         &sRelative,
+	_In_    bool                       bDirectory,
+	_Inout_ CStreamInfoBuffer          &buffer,
+	_Inout_ std::vector<PITEMID_CHILD> &found
+) {
+	const std::wstring sPath = m_sRoot + sRelative;
+	CIoScheduler::CTicket ticket = CIoScheduler::Instance().Acquire(
+		sPath.c_str(), IoPriority::Background, &m_bCancel
+	);
+	// Cancelled while waiting; not an error
+	if (!ticket) return true;
+	HANDLE hFile = OpenForStreamQuery(sPath.c_str());
+	if (hFile == INVALID_HANDLE_VALUE) return false;
+	defer({ CloseHandle(hFile); });
+
+	// Directories can't be hard linked
+	if (!bDirectory) {
+		BY_HANDLE_FILE_INFORMATION info;
+		if (
+			GetFileInformationByHandle(hFile, &info) &&
+			info.nNumberOfLinks > 1 &&
+			!IsFirstLink(info)
+		) {
+			InterlockedIncrement64(&m_cHardLinksSkipped);
+			return true;
+		}
+	}
+
+	if (FAILED(buffer.Query(hFile))) return false;
+	StreamInfo::CReader reader = buffer.Reader();
+	StreamInfo::Entry entry;
+	LONG64 cStreams = 0;
+	while (reader.Next(&entry) == StreamInfo::ReadResult::Ok) {
+		const StreamInfo::NameView svName = StreamInfo::TrimName(entry.svName);
+		if (svName.empty()) continue;  // the main stream
+		if (m_pQuery && !Selects(sPath, svName, entry.llSize)) continue;
+		PITEMID_CHILD pidlc;
+		if (sRelative.empty()) {
+			// The root's own streams are just streams
+			pidlc = CItem::NewPidl(svName.data(), svName.size(), entry.llSize);
+		} else {
+			std::wstring sName;
+			sName.reserve(sRelative.size() + 1 + svName.size());
+			sName.append(sRelative).append(1, L':').append(svName);
+			pidlc = CItem::NewPidl(
+				sName.data(), sName.size(), entry.llSize, CItem::FLAG_RELATIVE
+			);
+		}
+		// NULL if the path is too long for an item ID; leave it out
+		if (pidlc == NULL) continue;
+		found.push_back(pidlc);
+		cStreams++;
+	}
+	InterlockedAdd64(&m_cStreams, cStreams);
+	return true;
+}
+
+
+bool CTreeScanner::Selects(
+	_In_ const std::wstring     &sPath,
+	_In_ StreamInfo::NameView   svName,
+	_In_ LONGLONG               llSize
+) const {
+	Selector::Candidate candidate;
+	candidate.svName = svName;
+	candidate.ullSize = static_cast<std::uint64_t>(llSize);
+	// Queries are written against paths the way the user sees them, without
+	// the \\?\ prefix
+	std::wstring sUserPath;
+	if (m_pQuery->UsesPath()) {
+		sUserPath = WithoutExtendedPrefix(sPath.c_str());
+		candidate.svPath = sUserPath;
+	}
+	std::wstring sName;
+	StreamToRead stream;
+	if (m_pQuery->UsesContent()) {
+		sName.assign(svName.data(), svName.size());
+		stream = {sPath.c_str(), sName.c_str()};
+		candidate.pfnRead = ReadStreamStart;
+		candidate.pvContext = &stream;
+	}
+	return m_pQuery->Matches(candidate);
+}
+
+
+bool CTreeScanner::IsFirstLink(_In_ const BY_HANDLE_FILE_INFORMATION &info) {
+	const ULONGLONG ullIndex =
+		static_cast<ULONGLONG>(info.nFileIndexHigh) << 32 | info.nFileIndexLow;
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csLinks);
+	return m_seenLinks.emplace(info.dwVolumeSerialNumber, ullIndex).second;
+}
+
+
+void CTreeScanner::PublishFound(_Inout_ std::vector<PITEMID_CHILD> &found) {
+	if (!Publish(found.data(), found.size())) {
+		// Out of memory to keep them in. Drop them.
+		for (PITEMID_CHILD pidlc : found) CoTaskMemFree(pidlc);
+		InterlockedIncrement64(&m_cErrors);
+	}
+	found.clear();
+}
+
+
+HRESULT CTreeScanner::Get(
+	_In_                                 ULONG         iFirst,
+	_In_                                 ULONG         celt,
+	_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+	_Out_                                ULONG         *pceltFetched,
+	_In_                                 DWORD         dwTimeoutMs
+) {
+	ULONG cCopied = 0;
+	HRESULT hr = Read(
+		iFirst,
+		celt,
+		[&](PITEMID_CHILD pidlc) {
+			rgelt[cCopied] = CItem::Clone(pidlc);
+			return rgelt[cCopied++] != NULL;
+		},
+		pceltFetched,
+		dwTimeoutMs
+	);
+	if (hr == E_OUTOFMEMORY) {
+		for (ULONG i = 0; i < *pceltFetched; i++) CoTaskMemFree(rgelt[i]);
+		*pceltFetched = 0;
+	}
+	return hr;
+}
+
+
+void CTreeScanner::Cancel() {
+	LOG(P_TS << L"Cancel()");
+	CScanResults::Cancel();
+	m_pPool->Cancel();
+}
+
+
+CTreeScanner::Stats CTreeScanner::GetStats() const {
+	Stats stats;
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+		stats.bFinished = m_bFinished;
+		stats.dwElapsedMs = m_bFinished ? m_dwElapsedMs : GetTickCount() - m_dwStart;
+	}
+	stats.cDirectories = static_cast<ULONGLONG>(m_cDirectories);
+	stats.cFiles = static_cast<ULONGLONG>(m_cFiles);
+	stats.cStreams = static_cast<ULONGLONG>(m_cStreams);
+	stats.cHardLinksSkipped = static_cast<ULONGLONG>(m_cHardLinksSkipped);
+	stats.cErrors = static_cast<ULONGLONG>(m_cErrors);
+	stats.cSteals = m_pPool->Steals();
+	return stats;
+}
+
+
+std::wstring CTreeScanner::StreamKey(_In_ PCUITEMID_CHILD pidl) {
+	const CItem *pItem = CItem::Get(pidl);
+	std::wstring sKey;
+	if (!(pItem->fFlags & CItem::FLAG_RELATIVE)) sKey.push_back(L':');
+	return sKey.append(pItem->szName, pItem->cchName);
+}
+
+
+std::wstring CTreeScanner::StreamPath(_In_ PCWSTR pszRoot, _In_ const std::wstring &sKey) {
+	std::wstring sPath = pszRoot;
+	if (sKey.empty() || sKey[0] != L':') {
+		if (sPath.empty() || sPath.back() != L'\\') sPath.push_back(L'\\');
+	} else if (sPath.size() > 1 && sPath.back() == L'\\' && sPath[sPath.size() - 2] != L':') {
+		// "C:\dir\" + ":name"; but a drive's root keeps its backslash
+		sPath.pop_back();
+	}
+	return sPath.append(sKey);
+}
+
+}  // namespace ADSX
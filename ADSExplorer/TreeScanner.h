@@ -0,0 +1,151 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Finds every alternate data stream under a folder, for the pseudofolder
+ * that shows them all in one flat list. Directories are spread over a
+ * work-stealing pool, and items are published in batches as they're found
+ * so the view fills in while the scan goes on.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BackgroundScan.h"
+#include "Selector.h"
+#include "StreamQuery.h"
+#include "WorkStealingPool.h"
+
+namespace ADSX {
+
+
+class CTreeScanner : public CScanResults<PITEMID_CHILD> {
+  public:
+	struct Stats {
+		ULONGLONG cDirectories;
+		ULONGLONG cFiles;
+		ULONGLONG cStreams;           // named streams found
+		ULONGLONG cHardLinksSkipped;  // already seen under another name
+		ULONGLONG cErrors;            // objects that couldn't be listed
+		ULONGLONG cSteals;            // directories taken from another thread
+		DWORD dwElapsedMs;            // so far, or in all if finished
+		bool bFinished;
+
+		double FilesPerSecond() const {
+			return dwElapsedMs > 0 ? cFiles * 1000.0 / dwElapsedMs : 0;
+		}
+	};
+
+	/**
+	 * Start scanning the tree under the folder at pszRoot. With bQuery, it
+	 * only finds the streams the StreamQuery setting lets through.
+	 * @post: *ppScanner has a reference count of 1 for the caller to Release.
+	 *        The scan holds its own reference until it's done.
+	 */
+	static HRESULT Start(
+		_In_         PCWSTR       pszRoot,
+		_COM_Outptr_ CTreeScanner **ppScanner,
+		_In_         bool         bQuery = true
+	);
+
+	/**
+	 * Copy out up to celt of the items found, starting at the iFirst'th,
+	 * waiting up to dwTimeoutMs if it hasn't found that many yet, like
+	 * CScanResults::Read.
+	 * @post: rgelt[0..*pceltFetched) are the caller's to CoTaskMemFree.
+	 */
+	HRESULT Get(
+		_In_                                 ULONG         iFirst,
+		_In_                                 ULONG         celt,
+		_Out_writes_to_(celt, *pceltFetched) PITEMID_CHILD *rgelt,
+		_Out_                                ULONG         *pceltFetched,
+		_In_                                 DWORD         dwTimeoutMs
+	);
+
+	// Stops the workers too
+	void Cancel() override;
+
+	Stats GetStats() const;
+
+	/**
+	 * What an item Get() handed out calls its stream, relative to the root:
+	 * "sub\file.txt:name", or ":name" for one of the root's own.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static std::wstring StreamKey(_In_ PCUITEMID_CHILD pidl);
+
+	/**
+	 * The full path of the stream sKey names under pszRoot, to open it by:
+	 * "C:\dir\sub\file.txt:name", or "C:\dir:name".
+	 * @post: may throw std::bad_alloc.
+	 */
+	static std::wstring StreamPath(_In_ PCWSTR pszRoot, _In_ const std::wstring &sKey);
+
+  protected:
+	CTreeScanner();
+	~CTreeScanner();
+
+	// A task is the path of a directory relative to the root; "" is the root.
+	using CPool = CWorkStealingPool<std::wstring>;
+
+	void Run() override;
+
+	// Queue up a directory's subdirectories, and list the streams of it and
+	// the files in it.
+	void ScanDirectory(_In_ CPool::CContext &context, _In_ const std::wstring &sRelative);
+
+	// Make an item for each named stream of the object at sRelative.
+	// @post: returns false if the object couldn't be listed.
+	bool ScanObject(
+		_In_    const std::wstring         &sRelative,
+		_In_    bool                       bDirectory,
+		_Inout_ CStreamInfoBuffer          &buffer,
+		_Inout_ std::vector<PITEMID_CHILD> &found
+	);
+
+	// Whether the StreamQuery setting lets a stream of the object at sPath
+	// through. Asked before its item is made.
+	// @pre: m_pQuery isn't null.
+	bool Selects(
+		_In_ const std::wstring     &sPath,
+		_In_ StreamInfo::NameView   svName,
+		_In_ LONGLONG               llSize
+	) const;
+
+	// Whether this is the first time the scan has come across this file
+	// under any of its names.
+	bool IsFirstLink(_In_ const BY_HANDLE_FILE_INFORMATION &info);
+
+	// Hand what a worker found over to the consumers.
+	// @post: found is empty; the items belong to the scanner.
+	void PublishFound(_Inout_ std::vector<PITEMID_CHILD> &found);
+
+	// With the \\?\ prefix, so deep trees aren't held to MAX_PATH, and a
+	// trailing backslash.
+	std::wstring m_sRoot;
+	// Taken once so the whole scan goes by the same one; null for everything
+	std::shared_ptr<const Selector::CProgram> m_pQuery;
+
+	std::unique_ptr<CPool> m_pPool;
+	// One per worker; only ever touched by that worker
+	std::unique_ptr<CStreamInfoBuffer[]> m_aBuffers;
+
+	// Files with more than one link that have been seen: volume serial
+	// number and file index.
+	CComAutoCriticalSection m_csLinks;
+	std::set<std::pair<DWORD, ULONGLONG>> m_seenLinks;
+
+	volatile LONG64 m_cDirectories;
+	volatile LONG64 m_cFiles;
+	volatile LONG64 m_cStreams;
+	volatile LONG64 m_cHardLinksSkipped;
+	volatile LONG64 m_cErrors;
+};
+
+}  // namespace ADSX
@@ -0,0 +1,769 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Which streams contain which byte trigrams (every run of three bytes), kept
+ * in a file laid out to be mapped into memory and asked straight away, like
+ * StreamIndex.h. A search for some bytes only has to read the streams that
+ * have every trigram in them; anything shorter than three bytes, or any
+ * regular expression, can't be narrowed down and has to read them all.
+ *
+ * For each trigram the file holds the streams it's in as a list of indices,
+ * each but the first as the difference from the one before, in as few bytes
+ * as it fits in (seven bits to a byte, the top bit saying another byte
+ * follows). Streams that change are kept in memory alongside the file until
+ * it's written out again.
+ *
+ * Opening and mapping the file is up to whoever owns it.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Crc32c.h"
+#include "Mft.h"
+
+namespace ADSX::Trigram {
+
+using Mft::Load;
+using Mft::NameChar;
+using Mft::NameView;
+using Name = std::basic_string<NameChar>;
+
+// The three bytes, first in the high byte
+using Trigram = std::uint32_t;
+
+struct Document {
+	Name sPath;                      // whatever the owner names its streams by
+	std::uint64_t ullSize = 0;
+	std::uint64_t ullStamp = 0;      // the owner's, to tell when it's changed
+	bool bIndexed = false;           // false if it was too big, or unreadable
+	std::vector<Trigram> trigrams;   // sorted; empty unless bIndexed
+};
+
+
+/**
+ * Collects the distinct trigrams of some bytes, given a piece at a time.
+ * Reusable: Take() leaves it empty again. Holds a bit for every possible
+ * trigram (2 MB), so keep one per thread rather than one per stream.
+ */
+class CExtractor {
+  public:
+	// @post: may throw std::bad_alloc.
+	CExtractor() : m_aullSeen(cTrigrams / 64) {}
+
+	void Add(const unsigned char *pb, std::size_t cb) {
+		for (std::size_t i = 0; i < cb; i++) {
+			m_uWindow = (m_uWindow << 8 | pb[i]) & (cTrigrams - 1);
+			if (++m_cbSeen < 3) continue;
+			std::uint64_t &ullBits = m_aullSeen[m_uWindow / 64];
+			const std::uint64_t ullBit = 1ull << (m_uWindow % 64);
+			if (ullBits & ullBit) continue;
+			ullBits |= ullBit;
+			m_trigrams.push_back(m_uWindow);
+		}
+	}
+
+	// @post: sorted.
+	std::vector<Trigram> Take() {
+		for (Trigram trigram : m_trigrams) m_aullSeen[trigram / 64] = 0;
+		std::vector<Trigram> trigrams = std::move(m_trigrams);
+		m_trigrams = std::vector<Trigram>();
+		std::sort(trigrams.begin(), trigrams.end());
+		m_uWindow = 0;
+		m_cbSeen = 0;
+		return trigrams;
+	}
+
+  private:
+	static constexpr std::uint32_t cTrigrams = 1u << 24;
+
+	std::vector<std::uint64_t> m_aullSeen;
+	std::vector<Trigram> m_trigrams;
+	std::uint32_t m_uWindow = 0;
+	std::uint64_t m_cbSeen = 0;
+};
+
+// The distinct trigrams of sBytes, sorted; none if it's shorter than three.
+inline std::vector<Trigram> TrigramsOf(const std::string &sBytes) {
+	std::vector<Trigram> trigrams;
+	for (std::size_t i = 0; i + 3 <= sBytes.size(); i++) {
+		trigrams.push_back(
+			static_cast<Trigram>(static_cast<unsigned char>(sBytes[i])) << 16 |
+			static_cast<Trigram>(static_cast<unsigned char>(sBytes[i + 1])) << 8 |
+			static_cast<unsigned char>(sBytes[i + 2])
+		);
+	}
+	std::sort(trigrams.begin(), trigrams.end());
+	trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+	return trigrams;
+}
+
+
+inline void AppendVarint(std::vector<unsigned char> *pOut, std::uint32_t u) {
+	while (u >= 0x80) {
+		pOut->push_back(static_cast<unsigned char>(u | 0x80));
+		u >>= 7;
+	}
+	pOut->push_back(static_cast<unsigned char>(u));
+}
+
+// @post: returns false if it runs off pbEnd or doesn't fit in 32 bits.
+inline bool ReadVarint(const unsigned char **ppb, const unsigned char *pbEnd, std::uint32_t *pu) {
+	std::uint32_t u = 0;
+	for (unsigned iShift = 0; iShift < 35; iShift += 7) {
+		if (*ppb == pbEnd) return false;
+		const unsigned char b = *(*ppb)++;
+		if (iShift == 28 && b > 0x0F) return false;
+		u |= static_cast<std::uint32_t>(b & 0x7F) << iShift;
+		if (!(b & 0x80)) {
+			*pu = u;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// -----------------------------------------------------------------------------
+// File layout, all little-endian, every section 8-byte aligned:
+//   Header
+//   DocumentEntry documents[cDocuments];  // by path
+//   TrigramEntry  trigrams[cTrigrams];    // by trigram
+//   BYTE          postings[];             // each trigram's documents
+//   NameChar      strings[];              // paths, not null-terminated
+//
+// Header:
+//   char    Magic[8];
+//   UINT32  Version;
+//   UINT32  Checksum;         // CRC-32C of the header with this zeroed
+//   UINT64  DocumentCount;
+//   UINT64  TrigramCount;
+//   UINT64  DocumentsOffset;  // all offsets in bytes from the start
+//   UINT64  TrigramsOffset;
+//   UINT64  PostingsOffset;
+//   UINT64  PostingsLength;   // in bytes
+//   UINT64  StringsOffset;
+//   UINT64  StringsLength;    // in characters
+//   UINT64  IndexedBytes;     // the size of every indexed document, together
+//   UINT64  TotalLength;      // the whole file
+constexpr unsigned char abMagic[8] = {'A', 'D', 'S', 'X', 'T', 'R', 'I', 0};
+constexpr std::uint32_t uVersion = 1;
+constexpr std::size_t cbOffMagic = 0;
+constexpr std::size_t cbOffVersion = 8;
+constexpr std::size_t cbOffChecksum = 12;
+constexpr std::size_t cbOffDocumentCount = 16;
+constexpr std::size_t cbOffTrigramCount = 24;
+constexpr std::size_t cbOffDocumentsOffset = 32;
+constexpr std::size_t cbOffTrigramsOffset = 40;
+constexpr std::size_t cbOffPostingsOffset = 48;
+constexpr std::size_t cbOffPostingsLength = 56;
+constexpr std::size_t cbOffStringsOffset = 64;
+constexpr std::size_t cbOffStringsLength = 72;
+constexpr std::size_t cbOffIndexedBytes = 80;
+constexpr std::size_t cbOffTotalLength = 88;
+constexpr std::size_t cbHeader = 128;  // with room to grow
+
+// DocumentEntry:
+//   UINT64  Size;
+//   UINT64  Stamp;
+//   UINT32  PathOffset;       // in characters into strings
+//   UINT32  PathLength;       // in characters
+//   UINT32  Flags;
+//   UINT32  Reserved;
+constexpr std::size_t cbOffDocumentSize = 0;
+constexpr std::size_t cbOffDocumentStamp = 8;
+constexpr std::size_t cbOffDocumentPath = 16;
+constexpr std::size_t cbOffDocumentPathLength = 20;
+constexpr std::size_t cbOffDocumentFlags = 24;
+constexpr std::size_t cbDocumentEntry = 32;
+constexpr std::uint32_t DOCUMENT_INDEXED = 0x0001;
+
+// TrigramEntry:
+//   UINT32  Trigram;
+//   UINT32  DocumentCount;
+//   UINT64  PostingsOffset;   // in bytes into postings
+constexpr std::size_t cbOffTrigramValue = 0;
+constexpr std::size_t cbOffTrigramDocuments = 4;
+constexpr std::size_t cbOffTrigramPostings = 8;
+constexpr std::size_t cbTrigramEntry = 16;
+
+constexpr std::size_t cbSectionAlign = 8;
+
+
+/**
+ * The sections of an index file, checked enough to be read without running
+ * off the end of it. Postings are decoded as they're asked for.
+ * @pre: the bytes outlive the view and don't move.
+ */
+class CView {
+  public:
+	struct DocumentRef {
+		NameView svPath;
+		std::uint64_t ullSize;
+		std::uint64_t ullStamp;
+		bool bIndexed;
+	};
+
+	CView() { Clear(); }
+
+	/**
+	 * @post: returns false, leaving the view empty, if pv isn't an index file
+	 *        of this version or doesn't hang together.
+	 */
+	bool Attach(const void *pv, std::size_t cb) {
+		Clear();
+		auto pb = static_cast<const unsigned char *>(pv);
+		if (pb == nullptr || cb < cbHeader) return false;
+		if (std::memcmp(pb + cbOffMagic, abMagic, sizeof(abMagic)) != 0) return false;
+		if (Load<std::uint32_t>(pb + cbOffVersion) != uVersion) return false;
+		unsigned char abHeader[cbHeader];
+		std::memcpy(abHeader, pb, cbHeader);
+		std::memset(abHeader + cbOffChecksum, 0, sizeof(std::uint32_t));
+		if (Crc32c(abHeader, cbHeader) != Load<std::uint32_t>(pb + cbOffChecksum)) return false;
+		if (Load<std::uint64_t>(pb + cbOffTotalLength) != cb) return false;
+
+		const auto cDocuments = Load<std::uint64_t>(pb + cbOffDocumentCount);
+		const auto cTrigrams = Load<std::uint64_t>(pb + cbOffTrigramCount);
+		const auto cbPostings = Load<std::uint64_t>(pb + cbOffPostingsLength);
+		const auto cchStrings = Load<std::uint64_t>(pb + cbOffStringsLength);
+		if (
+			cDocuments > UINT32_MAX ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffDocumentsOffset), cDocuments, cbDocumentEntry) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffTrigramsOffset), cTrigrams, cbTrigramEntry) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffPostingsOffset), cbPostings, 1) ||
+			!SectionFits(cb, Load<std::uint64_t>(pb + cbOffStringsOffset), cchStrings, sizeof(NameChar))
+		) {
+			return false;
+		}
+
+		m_pb = pb;
+		m_cb = cb;
+		m_cDocuments = static_cast<std::size_t>(cDocuments);
+		m_cTrigrams = static_cast<std::size_t>(cTrigrams);
+		m_pbDocuments = pb + Load<std::uint64_t>(pb + cbOffDocumentsOffset);
+		m_pbTrigrams = pb + Load<std::uint64_t>(pb + cbOffTrigramsOffset);
+		m_pbPostings = pb + Load<std::uint64_t>(pb + cbOffPostingsOffset);
+		m_cbPostings = static_cast<std::size_t>(cbPostings);
+		m_pchStrings = reinterpret_cast<const NameChar *>(pb + Load<std::uint64_t>(pb + cbOffStringsOffset));
+		m_cchStrings = static_cast<std::size_t>(cchStrings);
+		m_ullIndexedBytes = Load<std::uint64_t>(pb + cbOffIndexedBytes);
+		return true;
+	}
+
+	void Clear() {
+		m_pb = nullptr;
+		m_cb = 0;
+		m_cDocuments = 0;
+		m_cTrigrams = 0;
+		m_pbDocuments = nullptr;
+		m_pbTrigrams = nullptr;
+		m_pbPostings = nullptr;
+		m_cbPostings = 0;
+		m_pchStrings = nullptr;
+		m_cchStrings = 0;
+		m_ullIndexedBytes = 0;
+	}
+
+	bool IsAttached() const { return m_pb != nullptr; }
+	std::size_t Size() const { return m_cb; }
+	std::size_t DocumentCount() const { return m_cDocuments; }
+	std::size_t TrigramCount() const { return m_cTrigrams; }
+	std::uint64_t IndexedBytes() const { return m_ullIndexedBytes; }
+
+	DocumentRef DocumentAt(std::size_t i) const {
+		const unsigned char *pb = m_pbDocuments + i * cbDocumentEntry;
+		return DocumentRef{
+			PathAt(pb),
+			Load<std::uint64_t>(pb + cbOffDocumentSize),
+			Load<std::uint64_t>(pb + cbOffDocumentStamp),
+			(Load<std::uint32_t>(pb + cbOffDocumentFlags) & DOCUMENT_INDEXED) != 0,
+		};
+	}
+
+	// @post: returns false if there's no document at svPath.
+	bool FindDocument(NameView svPath, std::size_t *piDocument) const {
+		std::size_t iLow = 0, iHigh = m_cDocuments;
+		while (iLow < iHigh) {
+			const std::size_t iMiddle = iLow + (iHigh - iLow) / 2;
+			if (PathAt(m_pbDocuments + iMiddle * cbDocumentEntry) < svPath) {
+				iLow = iMiddle + 1;
+			} else {
+				iHigh = iMiddle;
+			}
+		}
+		if (iLow == m_cDocuments || PathAt(m_pbDocuments + iLow * cbDocumentEntry) != svPath) return false;
+		*piDocument = iLow;
+		return true;
+	}
+
+	Trigram TrigramAt(std::size_t i) const {
+		return Load<std::uint32_t>(m_pbTrigrams + i * cbTrigramEntry + cbOffTrigramValue);
+	}
+
+	/**
+	 * The documents trigram is in, by index.
+	 * @post: returns false, with *pDocuments empty, if it's in none or its
+	 *        postings don't make sense.
+	 * @post: may throw std::bad_alloc.
+	 */
+	bool Postings(Trigram trigram, std::vector<std::uint32_t> *pDocuments) const {
+		pDocuments->clear();
+		std::size_t i;
+		return FindTrigram(trigram, &i) && PostingsAt(i, pDocuments);
+	}
+
+	// @post: returns false if trigram isn't in any document.
+	bool FindTrigram(Trigram trigram, std::size_t *piTrigram) const {
+		std::size_t iLow = 0, iHigh = m_cTrigrams;
+		while (iLow < iHigh) {
+			const std::size_t iMiddle = iLow + (iHigh - iLow) / 2;
+			if (TrigramAt(iMiddle) < trigram) {
+				iLow = iMiddle + 1;
+			} else {
+				iHigh = iMiddle;
+			}
+		}
+		if (iLow == m_cTrigrams || TrigramAt(iLow) != trigram) return false;
+		*piTrigram = iLow;
+		return true;
+	}
+
+	// How many documents the i'th trigram in the file is in, without
+	// decoding them
+	std::uint32_t DocumentCountAt(std::size_t i) const {
+		return Load<std::uint32_t>(m_pbTrigrams + i * cbTrigramEntry + cbOffTrigramDocuments);
+	}
+
+	// Same, for the i'th trigram in the file.
+	bool PostingsAt(std::size_t i, std::vector<std::uint32_t> *pDocuments) const {
+		pDocuments->clear();
+		const unsigned char *pbEntry = m_pbTrigrams + i * cbTrigramEntry;
+		const std::uint32_t cDocuments = Load<std::uint32_t>(pbEntry + cbOffTrigramDocuments);
+		const std::uint64_t ib = Load<std::uint64_t>(pbEntry + cbOffTrigramPostings);
+		if (ib > m_cbPostings || cDocuments > m_cDocuments) return false;
+		const unsigned char *pb = m_pbPostings + ib;
+		const unsigned char *pbEnd = m_pbPostings + m_cbPostings;
+		pDocuments->reserve(cDocuments);
+		std::uint64_t ullDocument = 0;
+		for (std::uint32_t iPosting = 0; iPosting < cDocuments; iPosting++) {
+			std::uint32_t uDelta;
+			if (!ReadVarint(&pb, pbEnd, &uDelta)) break;
+			// Strictly increasing, and in range
+			ullDocument += uDelta + (iPosting == 0 ? 0 : 1);
+			if (ullDocument >= m_cDocuments) break;
+			pDocuments->push_back(static_cast<std::uint32_t>(ullDocument));
+		}
+		if (pDocuments->size() != cDocuments) {
+			pDocuments->clear();
+			return false;
+		}
+		return true;
+	}
+
+  private:
+	static bool SectionFits(std::size_t cb, std::uint64_t ib, std::uint64_t c, std::size_t cbEach) {
+		if (ib < cbHeader || ib > cb || ib % cbSectionAlign != 0) return false;
+		return c <= (cb - ib) / cbEach;
+	}
+
+	NameView PathAt(const unsigned char *pbEntry) const {
+		const std::uint32_t ich = Load<std::uint32_t>(pbEntry + cbOffDocumentPath);
+		const std::uint32_t cch = Load<std::uint32_t>(pbEntry + cbOffDocumentPathLength);
+		// Out of range reads as no path rather than running off the end
+		if (ich > m_cchStrings || cch > m_cchStrings - ich) return NameView();
+		return NameView(m_pchStrings + ich, cch);
+	}
+
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+	std::size_t m_cDocuments;
+	std::size_t m_cTrigrams;
+	const unsigned char *m_pbDocuments;
+	const unsigned char *m_pbTrigrams;
+	const unsigned char *m_pbPostings;
+	std::size_t m_cbPostings;
+	const NameChar *m_pchStrings;
+	std::size_t m_cchStrings;
+	std::uint64_t m_ullIndexedBytes;
+};
+
+
+/**
+ * An index file and the documents that have changed since it was written.
+ * Queries and changes may come from any number of threads at once.
+ */
+class CIndex {
+  public:
+	/**
+	 * Lay out an index file of these documents. Paths are given once each.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static std::vector<unsigned char> Build(std::vector<Document> documents) {
+		std::unordered_map<Name, Document> changed;
+		for (Document &document : documents) {
+			Name sPath = document.sPath;
+			changed[std::move(sPath)] = std::move(document);
+		}
+		return Merge(CView(), changed);
+	}
+
+	/**
+	 * Answer from an index file, forgetting any changes made before.
+	 * @pre: the bytes outlive the index, or the next Attach() or Adopt().
+	 * @post: returns false, leaving the index empty, if they aren't an index.
+	 */
+	bool Attach(const void *pv, std::size_t cb) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_owned.clear();
+		return AttachLocked(pv, cb);
+	}
+
+	// Attach() to bytes the index keeps hold of itself.
+	bool Adopt(std::vector<unsigned char> bytes) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_owned = std::move(bytes);
+		return AttachLocked(m_owned.data(), m_owned.size());
+	}
+
+	/**
+	 * What's known of the document at svPath, without its trigrams.
+	 * @post: returns false if there isn't one.
+	 */
+	bool FindDocument(NameView svPath, Document *pDocument) const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		const Name sPath(svPath);
+		auto it = m_changed.find(sPath);
+		if (it != m_changed.end()) {
+			if (!it->second.bPresent) return false;
+			CopyHead(it->second.document, pDocument);
+			return true;
+		}
+		std::size_t i;
+		if (!m_base.FindDocument(svPath, &i)) return false;
+		const CView::DocumentRef document = m_base.DocumentAt(i);
+		pDocument->sPath = sPath;
+		pDocument->ullSize = document.ullSize;
+		pDocument->ullStamp = document.ullStamp;
+		pDocument->bIndexed = document.bIndexed;
+		pDocument->trigrams.clear();
+		return true;
+	}
+
+	// Every document's path, in no particular order.
+	// @post: may throw std::bad_alloc.
+	std::vector<Name> Paths() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::vector<Name> paths;
+		for (std::size_t i = 0; i < m_base.DocumentCount(); i++) {
+			const NameView svPath = m_base.DocumentAt(i).svPath;
+			if (m_changed.count(Name(svPath)) == 0) paths.emplace_back(svPath);
+		}
+		for (const auto &entry : m_changed) {
+			if (entry.second.bPresent) paths.push_back(entry.first);
+		}
+		return paths;
+	}
+
+	/**
+	 * The paths of the documents that might contain any of literals: all of
+	 * a literal's trigrams are in them, or they weren't indexed. A literal
+	 * shorter than three bytes rules nothing out.
+	 * @post: *pPaths is sorted.
+	 * @post: may throw std::bad_alloc.
+	 */
+	void Candidates(const std::vector<std::string> &literals, std::vector<Name> *pPaths) const {
+		pPaths->clear();
+		std::vector<std::vector<Trigram>> wanted;
+		for (const std::string &sLiteral : literals) {
+			wanted.push_back(TrigramsOf(sLiteral));
+			if (wanted.back().empty()) {
+				*pPaths = Paths();
+				std::sort(pPaths->begin(), pPaths->end());
+				return;
+			}
+		}
+
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		// Documents in the file: intersect each literal's postings, rarest
+		// first, then take the union over the literals
+		std::vector<std::uint32_t> matched, postings, narrowed;
+		std::vector<bool> abCandidate(m_base.DocumentCount());
+		for (const std::vector<Trigram> &trigrams : wanted) {
+			std::vector<std::pair<std::uint32_t, std::size_t>> byRarity;
+			bool bAbsent = false;
+			for (Trigram trigram : trigrams) {
+				std::size_t iTrigram;
+				if (!m_base.FindTrigram(trigram, &iTrigram)) {
+					bAbsent = true;
+					break;
+				}
+				byRarity.emplace_back(m_base.DocumentCountAt(iTrigram), iTrigram);
+			}
+			if (bAbsent) continue;
+			std::sort(byRarity.begin(), byRarity.end());
+			for (std::size_t i = 0; i < byRarity.size(); i++) {
+				if (!m_base.PostingsAt(byRarity[i].second, &postings)) postings.clear();
+				if (i == 0) {
+					matched.swap(postings);
+				} else {
+					narrowed.clear();
+					std::set_intersection(
+						matched.begin(), matched.end(), postings.begin(), postings.end(),
+						std::back_inserter(narrowed)
+					);
+					matched.swap(narrowed);
+				}
+				if (matched.empty()) break;
+			}
+			for (std::uint32_t iDocument : matched) abCandidate[iDocument] = true;
+		}
+		for (std::size_t i = 0; i < m_base.DocumentCount(); i++) {
+			const CView::DocumentRef document = m_base.DocumentAt(i);
+			if (!abCandidate[i] && document.bIndexed) continue;
+			if (m_changed.empty() || m_changed.count(Name(document.svPath)) == 0) pPaths->emplace_back(document.svPath);
+		}
+
+		// Documents changed since
+		for (const auto &entry : m_changed) {
+			const Change &change = entry.second;
+			if (!change.bPresent) continue;
+			bool bCandidate = !change.document.bIndexed;
+			for (std::size_t i = 0; !bCandidate && i < wanted.size(); i++) {
+				bCandidate = std::includes(
+					change.document.trigrams.begin(), change.document.trigrams.end(),
+					wanted[i].begin(), wanted[i].end()
+				);
+			}
+			if (bCandidate) pPaths->push_back(entry.first);
+		}
+		std::sort(pPaths->begin(), pPaths->end());
+	}
+
+	// Add a document, or replace what's known about it.
+	void SetDocument(Document document) {
+		std::sort(document.trigrams.begin(), document.trigrams.end());
+		document.trigrams.erase(std::unique(document.trigrams.begin(), document.trigrams.end()), document.trigrams.end());
+		if (!document.bIndexed) document.trigrams.clear();
+		Name sPath = document.sPath;
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_changed[std::move(sPath)] = Change{true, std::move(document)};
+	}
+
+	// Forget a document, as when its stream is deleted.
+	void RemoveDocument(NameView svPath) {
+		std::unique_lock<std::shared_mutex> lock(m_lock);
+		m_changed[Name(svPath)] = Change{false, Document()};
+	}
+
+	// How many documents have changed since the index file was written
+	std::size_t ChangeCount() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		return m_changed.size();
+	}
+
+	std::size_t DocumentCount() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::size_t cDocuments = m_base.DocumentCount();
+		for (const auto &entry : m_changed) {
+			std::size_t i;
+			const bool bInBase = m_base.FindDocument(entry.first, &i);
+			if (entry.second.bPresent && !bInBase) cDocuments++;
+			if (!entry.second.bPresent && bInBase) cDocuments--;
+		}
+		return cDocuments;
+	}
+
+	// Size of the index file answered from
+	std::size_t FileSize() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		return m_base.Size();
+	}
+
+	/**
+	 * Lay out an index file with every change in it.
+	 * @post: may throw std::bad_alloc.
+	 */
+	std::vector<unsigned char> Serialize() const {
+		std::shared_lock<std::shared_mutex> lock(m_lock);
+		std::unordered_map<Name, Document> changed;
+		std::unordered_set<Name> removed;
+		for (const auto &entry : m_changed) {
+			if (entry.second.bPresent) {
+				changed.emplace(entry.first, entry.second.document);
+			} else {
+				removed.insert(entry.first);
+			}
+		}
+		return Merge(m_base, changed, removed);
+	}
+
+  private:
+	struct Change {
+		bool bPresent;
+		Document document;
+	};
+
+	static void CopyHead(const Document &from, Document *pTo) {
+		pTo->sPath = from.sPath;
+		pTo->ullSize = from.ullSize;
+		pTo->ullStamp = from.ullStamp;
+		pTo->bIndexed = from.bIndexed;
+		pTo->trigrams.clear();
+	}
+
+	/**
+	 * The documents of base, less the ones in changed or removed, and those
+	 * in changed, laid out as a file. Postings are merged trigram by trigram
+	 * rather than going back to each document's trigrams.
+	 */
+	static std::vector<unsigned char> Merge(
+		const CView &base,
+		const std::unordered_map<Name, Document> &changed,
+		const std::unordered_set<Name> &removed = std::unordered_set<Name>()
+	) {
+		// Everything that'll be in the file, by path, and where each of
+		// base's went
+		struct Entry {
+			NameView svPath;
+			std::uint64_t ullSize;
+			std::uint64_t ullStamp;
+			bool bIndexed;
+			const Document *pChanged;  // null if it's from base
+		};
+		std::vector<Entry> entries;
+		std::vector<std::uint32_t> aiFromBase(base.DocumentCount(), UINT32_MAX);
+		std::vector<std::size_t> aiBaseOfEntry;
+		for (std::size_t i = 0; i < base.DocumentCount(); i++) {
+			const CView::DocumentRef document = base.DocumentAt(i);
+			const Name sPath(document.svPath);
+			if (changed.count(sPath) != 0 || removed.count(sPath) != 0) continue;
+			entries.push_back({document.svPath, document.ullSize, document.ullStamp, document.bIndexed, nullptr});
+		}
+		for (const auto &entry : changed) {
+			const Document &document = entry.second;
+			entries.push_back({entry.first, document.ullSize, document.ullStamp, document.bIndexed, &document});
+		}
+		std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+			return a.svPath < b.svPath;
+		});
+		// Base's documents are still in the same order among themselves
+		std::vector<std::pair<Trigram, std::uint32_t>> changedPostings;
+		{
+			std::size_t iBase = 0;
+			for (std::size_t i = 0; i < entries.size(); i++) {
+				const auto iEntry = static_cast<std::uint32_t>(i);
+				if (entries[i].pChanged != nullptr) {
+					for (Trigram trigram : entries[i].pChanged->trigrams) changedPostings.emplace_back(trigram, iEntry);
+					continue;
+				}
+				while (base.DocumentAt(iBase).svPath != entries[i].svPath) iBase++;
+				aiFromBase[iBase++] = iEntry;
+			}
+		}
+		std::sort(changedPostings.begin(), changedPostings.end());
+
+		// Postings, trigram by trigram, from base's and the changed ones'
+		std::vector<unsigned char> postingBytes;
+		std::vector<std::pair<Trigram, std::pair<std::uint32_t, std::uint64_t>>> trigramEntries;
+		std::vector<std::uint32_t> basePostings, documents;
+		std::size_t iBaseTrigram = 0, iChanged = 0;
+		while (iBaseTrigram < base.TrigramCount() || iChanged < changedPostings.size()) {
+			const Trigram trigramBase = iBaseTrigram < base.TrigramCount() ? base.TrigramAt(iBaseTrigram) : UINT32_MAX;
+			const Trigram trigramChanged = iChanged < changedPostings.size() ? changedPostings[iChanged].first : UINT32_MAX;
+			const Trigram trigram = (std::min)(trigramBase, trigramChanged);
+			documents.clear();
+			if (trigramBase == trigram) {
+				base.PostingsAt(iBaseTrigram++, &basePostings);
+				for (std::uint32_t iDocument : basePostings) {
+					if (aiFromBase[iDocument] != UINT32_MAX) documents.push_back(aiFromBase[iDocument]);
+				}
+			}
+			const std::size_t cFromBase = documents.size();
+			for (; iChanged < changedPostings.size() && changedPostings[iChanged].first == trigram; iChanged++) {
+				documents.push_back(changedPostings[iChanged].second);
+			}
+			std::inplace_merge(documents.begin(), documents.begin() + cFromBase, documents.end());
+			if (documents.empty()) continue;
+			trigramEntries.push_back({trigram, {static_cast<std::uint32_t>(documents.size()), postingBytes.size()}});
+			for (std::size_t i = 0; i < documents.size(); i++) {
+				AppendVarint(&postingBytes, i == 0 ? documents[0] : documents[i] - documents[i - 1] - 1);
+			}
+		}
+
+		// Paths one after another; they rarely repeat
+		std::vector<NameChar> strings;
+		std::uint64_t ullIndexedBytes = 0;
+		for (const Entry &entry : entries) {
+			strings.insert(strings.end(), entry.svPath.begin(), entry.svPath.end());
+			if (entry.bIndexed) ullIndexedBytes += entry.ullSize;
+		}
+
+		auto align = [](std::size_t cb) { return (cb + cbSectionAlign - 1) / cbSectionAlign * cbSectionAlign; };
+		const std::size_t ibDocuments = cbHeader;
+		const std::size_t ibTrigrams = align(ibDocuments + entries.size() * cbDocumentEntry);
+		const std::size_t ibPostings = align(ibTrigrams + trigramEntries.size() * cbTrigramEntry);
+		const std::size_t ibStrings = align(ibPostings + postingBytes.size());
+		const std::size_t cbStrings = strings.size() * sizeof(NameChar);
+
+		std::vector<unsigned char> out(ibStrings + align(cbStrings));
+		auto store = [&](std::size_t ib, auto value) { std::memcpy(&out[ib], &value, sizeof(value)); };
+		std::uint32_t ichPath = 0;
+		for (std::size_t i = 0; i < entries.size(); i++) {
+			const std::size_t ib = ibDocuments + i * cbDocumentEntry;
+			store(ib + cbOffDocumentSize, entries[i].ullSize);
+			store(ib + cbOffDocumentStamp, entries[i].ullStamp);
+			store(ib + cbOffDocumentPath, ichPath);
+			store(ib + cbOffDocumentPathLength, static_cast<std::uint32_t>(entries[i].svPath.size()));
+			store(ib + cbOffDocumentFlags, entries[i].bIndexed ? DOCUMENT_INDEXED : std::uint32_t(0));
+			ichPath += static_cast<std::uint32_t>(entries[i].svPath.size());
+		}
+		for (std::size_t i = 0; i < trigramEntries.size(); i++) {
+			const std::size_t ib = ibTrigrams + i * cbTrigramEntry;
+			store(ib + cbOffTrigramValue, trigramEntries[i].first);
+			store(ib + cbOffTrigramDocuments, trigramEntries[i].second.first);
+			store(ib + cbOffTrigramPostings, trigramEntries[i].second.second);
+		}
+		if (!postingBytes.empty()) std::memcpy(&out[ibPostings], postingBytes.data(), postingBytes.size());
+		if (cbStrings != 0) std::memcpy(&out[ibStrings], strings.data(), cbStrings);
+
+		std::memcpy(&out[cbOffMagic], abMagic, sizeof(abMagic));
+		store(cbOffVersion, uVersion);
+		store(cbOffDocumentCount, static_cast<std::uint64_t>(entries.size()));
+		store(cbOffTrigramCount, static_cast<std::uint64_t>(trigramEntries.size()));
+		store(cbOffDocumentsOffset, static_cast<std::uint64_t>(ibDocuments));
+		store(cbOffTrigramsOffset, static_cast<std::uint64_t>(ibTrigrams));
+		store(cbOffPostingsOffset, static_cast<std::uint64_t>(ibPostings));
+		store(cbOffPostingsLength, static_cast<std::uint64_t>(postingBytes.size()));
+		store(cbOffStringsOffset, static_cast<std::uint64_t>(ibStrings));
+		store(cbOffStringsLength, static_cast<std::uint64_t>(strings.size()));
+		store(cbOffIndexedBytes, ullIndexedBytes);
+		store(cbOffTotalLength, static_cast<std::uint64_t>(out.size()));
+		store(cbOffChecksum, Crc32c(out.data(), cbHeader));
+		return out;
+	}
+
+	bool AttachLocked(const void *pv, std::size_t cb) {
+		m_changed.clear();
+		return m_base.Attach(pv, cb);
+	}
+
+	mutable std::shared_mutex m_lock;
+	CView m_base;
+	std::vector<unsigned char> m_owned;  // what m_base is on, if it's not mapped
+	// Changes since m_base was written, by path
+	std::unordered_map<Name, Change> m_changed;
+};
+
+}  // namespace ADSX::Trigram
@@ -0,0 +1,266 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "UsageAnalyzer.h"
+
+#include <iterator>
+#include <new>
+#include <string>
+
+#include "ADSXItem.h"
+#include "DiskImage.h"
+#include "MftVolume.h"
+#include "ReportFile.h"
+#include "TreeScanner.h"
+
+namespace ADSX {
+
+
+// Same test as CVolumeSource::Open's
+static bool IsVolumeRoot(_In_ PCWSTR pszRoot) {
+	return (
+		iswalpha(pszRoot[0]) && pszRoot[1] == L':' &&
+		(pszRoot[2] == L'\0' || (pszRoot[2] == L'\\' && pszRoot[3] == L'\0'))
+	);
+}
+
+
+bool CUsageAnalyzer::IsMftSource(_In_ PCWSTR pszRoot) {
+	if (IsVolumeRoot(pszRoot)) return true;
+	const DWORD dwAttributes = GetFileAttributesW(pszRoot);
+	return dwAttributes != INVALID_FILE_ATTRIBUTES && !(dwAttributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+
+HRESULT CUsageAnalyzer::CollectFromMft(
+	_In_  PCWSTR                         pszRoot,
+	_Out_ std::vector<Mft::FoundStream> *pStreams
+) {
+	CVolumeSource source;
+	HRESULT hr = source.Open(pszRoot);
+	if (FAILED(hr)) return hr;
+	if (IsVolumeRoot(pszRoot)) {
+		Mft::CScanner scanner(source);
+		if (!scanner.Scan(pStreams)) return HRESULT_FROM_WIN32(ERROR_UNRECOGNIZED_VOLUME);
+		return S_OK;
+	}
+
+	// An image, of a volume or of a whole disk: VHD and VHDX get unpacked,
+	// and each NTFS partition on it scanned
+	Disk::CImage image(source);
+	if (!image.Open() || image.VolumeCount() == 0) return HRESULT_FROM_WIN32(ERROR_UNRECOGNIZED_VOLUME);
+	LOG(L" ** " << std::dec << image.VolumeCount() << L" NTFS volume(s) in the image");
+	pStreams->clear();
+	std::vector<Mft::FoundStream> found;
+	for (std::size_t i = 0; i < image.VolumeCount(); i++) {
+		Mft::CScanner scanner(image.Volume(i));
+		if (!scanner.Scan(&found)) return HRESULT_FROM_WIN32(ERROR_UNRECOGNIZED_VOLUME);
+		// With more than one, each volume's paths go under a folder of its
+		// own so they don't get counted together
+		if (image.VolumeCount() > 1) {
+			const Mft::Name sVolume = L"Volume " + std::to_wstring(i + 1);
+			for (Mft::FoundStream &stream : found) {
+				if (stream.sPath.empty()) {
+					stream.sPath = sVolume;
+				} else {
+					stream.sPath.insert(0, sVolume + L'\\');
+				}
+			}
+		}
+		pStreams->insert(
+			pStreams->end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end())
+		);
+	}
+	return S_OK;
+}
+
+
+HRESULT CUsageAnalyzer::CollectFromTree(
+	_In_  PCWSTR                         pszRoot,
+	_Out_ std::vector<Mft::FoundStream> *pStreams
+) {
+	CComPtr<CTreeScanner> pScanner;
+	// Every stream counts toward the space they take, whatever the
+	// StreamQuery setting lets the views show
+	HRESULT hr = CTreeScanner::Start(pszRoot, &pScanner, false);
+	if (FAILED(hr)) return hr;
+	pScanner->AddConsumer();
+	defer({ pScanner->RemoveConsumer(); });
+
+	PITEMID_CHILD rgpidl[256];
+	ULONG iNext = 0;
+	for (;;) {
+		ULONG cFetched;
+		hr = pScanner->Get(iNext, ARRAYSIZE(rgpidl), rgpidl, &cFetched, INFINITE);
+		if (hr != S_OK) break;
+		iNext += cFetched;
+		defer({ for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(rgpidl[i]); });
+		for (ULONG i = 0; i < cFetched; i++) {
+			const CItem *pItem = CItem::Get(rgpidl[i]);
+			const std::wstring_view svName(pItem->szName, pItem->cchName);
+			Mft::FoundStream stream;
+			stream.ullRecord = 0;
+			stream.ullSize = static_cast<std::uint64_t>(pItem->llFilesize);
+			if (pItem->fFlags & CItem::FLAG_RELATIVE) {
+				// "sub\file.txt:stream". Items don't say whether they're on a
+				// file or a directory, so a directory's own streams count as
+				// a file's.
+				const std::size_t ichColon = svName.find(L':');
+				stream.sPath = svName.substr(0, ichColon);
+				stream.sName = svName.substr(ichColon + 1);
+				stream.bDirectory = false;
+			} else {
+				// The root's own
+				stream.sName = svName;
+				stream.bDirectory = true;
+			}
+			pStreams->push_back(std::move(stream));
+		}
+	}
+	return SUCCEEDED(hr) ? S_OK : hr;
+}
+
+
+HRESULT CUsageAnalyzer::Analyze(
+	_In_  PCWSTR      pszRoot,
+	_In_  std::size_t cTop,
+	_Out_ Result      *pResult
+) {
+	if (pszRoot == NULL || pResult == NULL) return E_POINTER;
+	LOG(L" ** Analyzing stream usage under " << pszRoot);
+
+	const ULONGLONG ullStart = GetTickCount64();
+	std::vector<Mft::FoundStream> streams;
+	HRESULT hr = E_FAIL;
+	pResult->bFromMft = false;
+	if (IsMftSource(pszRoot)) {
+		hr = CollectFromMft(pszRoot, &streams);
+		pResult->bFromMft = SUCCEEDED(hr);
+		// Not an administrator, or not NTFS; looking file by file still works
+		if (FAILED(hr)) LOG(L" ** Can't read the MFT: " << HRESULTToString(hr));
+	}
+	if (!pResult->bFromMft) {
+		streams.clear();
+		hr = CollectFromTree(pszRoot, &streams);
+		if (FAILED(hr)) return hr;
+	}
+	const ULONGLONG ullScanned = GetTickCount64();
+	pResult->report = Usage::Analyze(streams, cTop);
+	pResult->dwScanMs = static_cast<DWORD>(ullScanned - ullStart);
+	pResult->dwAnalyzeMs = static_cast<DWORD>(GetTickCount64() - ullScanned);
+	LOG(L" ** " << std::dec << streams.size() << L" streams; " <<
+		pResult->dwScanMs << L" ms to find, " << pResult->dwAnalyzeMs << L" ms to rank");
+	return S_OK;
+}
+
+
+static void AppendSection(
+	_Inout_ std::wstring                     &sOut,
+	_In_    PCWSTR                           pszTitle,
+	_In_    const std::vector<Usage::Ranked> &ranked,
+	_In_    PCWSTR                           pszEmptyKey
+) {
+	sOut.append(L"\r\n").append(pszTitle).append(L"\r\n");
+	sOut.append(L"           bytes    streams      files\r\n");
+	WCHAR szLine[64];
+	for (const Usage::Ranked &item : ranked) {
+		swprintf_s(
+			szLine,
+			L"%16llu %10llu %10llu  ",
+			static_cast<ULONGLONG>(item.totals.ullBytes),
+			static_cast<ULONGLONG>(item.totals.cStreams),
+			static_cast<ULONGLONG>(item.totals.cFiles)
+		);
+		sOut.append(szLine).append(item.sKey.empty() ? pszEmptyKey : item.sKey.c_str()).append(L"\r\n");
+	}
+}
+
+
+HRESULT CUsageAnalyzer::Write(
+	_In_ HANDLE       hFile,
+	_In_ PCWSTR       pszRoot,
+	_In_ const Result &result
+) {
+	const Usage::Report &report = result.report;
+	std::wstring sOut;
+	WCHAR szLine[256];
+	swprintf_s(
+		szLine,
+		L"Streams under %s (%s): %llu bytes in %llu streams on %llu files; %lu ms to find, %lu ms to rank\r\n",
+		pszRoot,
+		result.bFromMft ? L"from the MFT" : L"file by file",
+		static_cast<ULONGLONG>(report.total.ullBytes),
+		static_cast<ULONGLONG>(report.total.cStreams),
+		static_cast<ULONGLONG>(report.total.cFiles),
+		result.dwScanMs,
+		result.dwAnalyzeMs
+	);
+	sOut.append(szLine);
+	AppendSection(sOut, L"Biggest files", report.files, L"(root)");
+	AppendSection(sOut, L"Biggest folders, all told", report.subtrees, L"(root)");
+	AppendSection(sOut, L"Biggest stream names", report.names, L"");
+	AppendSection(sOut, L"Biggest extensions", report.extensions, L"(none)");
+	sOut.append(L"\r\n\r\n");
+	return WriteUtf8(hFile, sOut);
+}
+
+
+HRESULT CUsageAnalyzer::RunCommandLine(_In_ PCWSTR pszCommandLine) {
+	if (pszCommandLine == NULL) return E_POINTER;
+	// Given nothing, CommandLineToArgvW would hand back the program's name
+	if (*pszCommandLine == L'\0') return E_INVALIDARG;
+	int cArgs;
+	LPWSTR *ppszArgs = CommandLineToArgvW(pszCommandLine, &cArgs);
+	if (ppszArgs == NULL) return HRESULT_FROM_WIN32(GetLastError());
+	defer({ LocalFree(ppszArgs); });
+
+	try {
+		std::size_t cTop = cTopDefault;
+		std::wstring sOut;
+		std::vector<std::wstring> roots;
+		for (int i = 0; i < cArgs; i++) {
+			PCWSTR pszArg = ppszArgs[i];
+			if (_wcsnicmp(pszArg, L"/top:", 5) == 0) {
+				cTop = wcstoul(pszArg + 5, NULL, 10);
+			} else if (_wcsnicmp(pszArg, L"/out:", 5) == 0) {
+				sOut = pszArg + 5;
+			} else if (_wcsicmp(pszArg, L"/all") == 0) {
+				WCHAR szDrives[128];
+				const DWORD cch = GetLogicalDriveStringsW(ARRAYSIZE(szDrives), szDrives);
+				if (cch == 0 || cch > ARRAYSIZE(szDrives)) return HRESULT_FROM_WIN32(GetLastError());
+				for (PCWSTR pszDrive = szDrives; *pszDrive != L'\0'; pszDrive += wcslen(pszDrive) + 1) {
+					if (GetDriveTypeW(pszDrive) == DRIVE_FIXED) roots.emplace_back(pszDrive);
+				}
+			} else {
+				roots.emplace_back(pszArg);
+			}
+		}
+		if (roots.empty()) return E_INVALIDARG;
+
+		CHandle hOut;
+		HRESULT hr = CreateReportFile(sOut, L"StreamUsage.txt", &hOut);
+		if (FAILED(hr)) return hr;
+
+		HRESULT hrAll = S_OK;
+		for (const std::wstring &sRoot : roots) {
+			Result result;
+			hr = Analyze(sRoot.c_str(), cTop, &result);
+			if (SUCCEEDED(hr)) {
+				hr = Write(hOut, sRoot.c_str(), result);
+			} else {
+				WCHAR szLine[64];
+				swprintf_s(szLine, L": couldn't analyze, error 0x%08lX\r\n\r\n", static_cast<ULONG>(hr));
+				hr = WriteUtf8(hOut, sRoot + szLine);
+			}
+			if (FAILED(hr)) hrAll = hr;
+		}
+		return hrAll;
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+}
+
+}  // namespace ADSX
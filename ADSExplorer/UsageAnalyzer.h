@@ -0,0 +1,74 @@
+/**
+ * 2024 Nate Kean
+ *
+ * The stream space report (StreamUsage.h) for a volume or a folder: where the
+ * bytes in alternate streams are, ranked. Reads the MFT when it can (a whole
+ * local volume, as an administrator, or every NTFS volume in a disk image),
+ * and walks the tree otherwise. Every stream is counted, whatever the
+ * StreamQuery setting shows. Run nightly with
+ *   rundll32 ADSExplorer.dll,AnalyzeStreamUsage [/top:N] [/out:file] /all | root...
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <string>
+#include <vector>
+
+#include "MftScanner.h"
+#include "StreamUsage.h"
+
+namespace ADSX {
+
+
+class CUsageAnalyzer {
+  public:
+	struct Result {
+		Usage::Report report;
+		bool bFromMft;      // read the MFT instead of walking the tree
+		DWORD dwScanMs;     // to find the streams
+		DWORD dwAnalyzeMs;  // to rank them
+	};
+
+	// How many of each kind the report lists unless it's told otherwise
+	static constexpr std::size_t cTopDefault = 25;
+
+	/**
+	 * Find every stream under pszRoot ("C:\", a folder, or a disk image:
+	 * raw, VHD or VHDX, of a volume or of a partitioned disk) and rank the
+	 * cTop biggest of each kind. With more than one NTFS volume in an
+	 * image, each one's paths start "Volume N\".
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT Analyze(
+		_In_  PCWSTR      pszRoot,
+		_In_  std::size_t cTop,
+		_Out_ Result      *pResult
+	);
+
+	/**
+	 * The report as UTF-8 text, appended to what's already in the file.
+	 * @post: may throw std::bad_alloc.
+	 */
+	static HRESULT Write(_In_ HANDLE hFile, _In_ PCWSTR pszRoot, _In_ const Result &result);
+
+	/**
+	 * What AnalyzeStreamUsage does with its command line: analyze every
+	 * root on it ("/all" for every fixed volume) into one report file,
+	 * %LOCALAPPDATA%\ADSExplorer\StreamUsage.txt unless "/out:" says.
+	 * A root that can't be analyzed gets a line saying why, and the rest
+	 * carry on.
+	 */
+	static HRESULT RunCommandLine(_In_ PCWSTR pszCommandLine);
+
+  protected:
+	// Whether the MFT scanner can be pointed at pszRoot: a volume's root or
+	// a file (taken for a disk image, which Disk::CImage opens)
+	static bool IsMftSource(_In_ PCWSTR pszRoot);
+
+	static HRESULT CollectFromMft(_In_ PCWSTR pszRoot, _Out_ std::vector<Mft::FoundStream> *pStreams);
+	static HRESULT CollectFromTree(_In_ PCWSTR pszRoot, _Out_ std::vector<Mft::FoundStream> *pStreams);
+};
+
+}  // namespace ADSX
@@ -0,0 +1,225 @@
+/**
+ * 2024 Nate Kean
+ *
+ * Platform-neutral decoding of the NTFS change journal: the USN_RECORD_V2 and
+ * V3 entries that FSCTL_READ_USN_JOURNAL hands back, and boiling a batch of
+ * them down to what changed about each file, so whatever keeps track of a
+ * volume only has to look at each file once however busy it's been.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "Mft.h"
+
+namespace ADSX::Usn {
+
+using Mft::Load;
+using Mft::NameChar;
+using Mft::NameView;
+using Mft::ReadResult;
+using Name = std::basic_string<NameChar>;
+
+// USN_REASON_* flags this cares about
+enum Reason : std::uint32_t {
+	REASON_DATA_OVERWRITE = 0x00000001,
+	REASON_DATA_EXTEND = 0x00000002,
+	REASON_DATA_TRUNCATION = 0x00000004,
+	REASON_NAMED_DATA_OVERWRITE = 0x00000010,
+	REASON_NAMED_DATA_EXTEND = 0x00000020,
+	REASON_NAMED_DATA_TRUNCATION = 0x00000040,
+	REASON_FILE_CREATE = 0x00000100,
+	REASON_FILE_DELETE = 0x00000200,
+	REASON_RENAME_OLD_NAME = 0x00001000,
+	REASON_RENAME_NEW_NAME = 0x00002000,
+	REASON_STREAM_CHANGE = 0x00200000,
+	REASON_CLOSE = 0x80000000,
+};
+// Anything that could have added, removed or resized a named stream
+constexpr std::uint32_t REASONS_NAMED_STREAMS =
+	REASON_NAMED_DATA_OVERWRITE | REASON_NAMED_DATA_EXTEND |
+	REASON_NAMED_DATA_TRUNCATION | REASON_STREAM_CHANGE;
+
+// FILE_ATTRIBUTE_DIRECTORY, which windows.h would have as a macro
+constexpr std::uint32_t uAttributeDirectory = 0x10;
+
+
+// Byte layout of a USN_RECORD_V2:
+//   DWORD         RecordLength;          // 0
+//   WORD          MajorVersion;          // 4
+//   WORD          MinorVersion;          // 6
+//   DWORDLONG     FileReferenceNumber;   // 8
+//   DWORDLONG     ParentFileReferenceNumber;  // 16
+//   USN           Usn;                   // 24
+//   LARGE_INTEGER TimeStamp;             // 32
+//   DWORD         Reason;                // 40
+//   DWORD         SourceInfo;            // 44
+//   DWORD         SecurityId;            // 48
+//   DWORD         FileAttributes;        // 52
+//   WORD          FileNameLength;        // 56, in bytes
+//   WORD          FileNameOffset;        // 58
+// V3 is the same but with 128-bit file IDs, which on NTFS are the 64-bit
+// reference zero-extended, pushing everything after them along.
+constexpr std::size_t cbOffRecordLength = 0;
+constexpr std::size_t cbOffMajorVersion = 4;
+constexpr std::size_t cbOffFileReference = 8;
+constexpr std::size_t cbOffV2ParentReference = 16;
+constexpr std::size_t cbOffV2Usn = 24;
+constexpr std::size_t cbOffV2Reason = 40;
+constexpr std::size_t cbOffV2FileAttributes = 52;
+constexpr std::size_t cbOffV2FileNameLength = 56;
+constexpr std::size_t cbOffV2FileNameOffset = 58;
+constexpr std::size_t cbV2Header = 60;
+constexpr std::size_t cbOffV3ParentReference = 24;
+constexpr std::size_t cbOffV3Usn = 40;
+constexpr std::size_t cbOffV3Reason = 56;
+constexpr std::size_t cbOffV3FileAttributes = 68;
+constexpr std::size_t cbOffV3FileNameLength = 72;
+constexpr std::size_t cbOffV3FileNameOffset = 74;
+constexpr std::size_t cbV3Header = 76;
+// Records are padded out to 8 bytes
+constexpr std::size_t cbRecordAlign = 8;
+
+
+struct Record {
+	std::uint64_t ullFileReference;
+	std::uint64_t ullParentReference;
+	std::int64_t llUsn;
+	std::uint32_t uReason;
+	std::uint32_t uAttributes;
+	NameView svName;  // the file's name, not its path; points into the buffer
+};
+
+/**
+ * Walks the records in what FSCTL_READ_USN_JOURNAL returned, after the USN to
+ * carry on from that it starts with.
+ * @pre: the buffer outlives the reader and every Record it produced.
+ */
+class CReader {
+  public:
+	CReader(const void *pBuffer, std::size_t cbBuffer)
+		: m_pb(static_cast<const unsigned char *>(pBuffer))
+		, m_cb(pBuffer != nullptr ? cbBuffer : 0)
+		, m_ibCursor(0)
+		, m_bDone(m_cb == 0) {}
+
+	ReadResult Next(Record *pRecord) {
+		if (m_bDone || m_cb - m_ibCursor < cbOffFileReference) {
+			m_bDone = true;
+			return ReadResult::End;
+		}
+		const unsigned char *pbRecord = m_pb + m_ibCursor;
+		const auto cbRecord = Load<std::uint32_t>(pbRecord + cbOffRecordLength);
+		if (cbRecord == 0) {
+			m_bDone = true;
+			return ReadResult::End;
+		}
+		if (cbRecord % cbRecordAlign != 0 || cbRecord > m_cb - m_ibCursor) return Fail();
+
+		std::size_t cbOffNameLength;
+		std::size_t cbOffNameOffset;
+		switch (Load<std::uint16_t>(pbRecord + cbOffMajorVersion)) {
+			case 2:
+				if (cbRecord < cbV2Header) return Fail();
+				pRecord->ullFileReference = Load<std::uint64_t>(pbRecord + cbOffFileReference);
+				pRecord->ullParentReference = Load<std::uint64_t>(pbRecord + cbOffV2ParentReference);
+				pRecord->llUsn = Load<std::int64_t>(pbRecord + cbOffV2Usn);
+				pRecord->uReason = Load<std::uint32_t>(pbRecord + cbOffV2Reason);
+				pRecord->uAttributes = Load<std::uint32_t>(pbRecord + cbOffV2FileAttributes);
+				cbOffNameLength = cbOffV2FileNameLength;
+				cbOffNameOffset = cbOffV2FileNameOffset;
+				break;
+			case 3:
+				if (cbRecord < cbV3Header) return Fail();
+				pRecord->ullFileReference = Load<std::uint64_t>(pbRecord + cbOffFileReference);
+				pRecord->ullParentReference = Load<std::uint64_t>(pbRecord + cbOffV3ParentReference);
+				pRecord->llUsn = Load<std::int64_t>(pbRecord + cbOffV3Usn);
+				pRecord->uReason = Load<std::uint32_t>(pbRecord + cbOffV3Reason);
+				pRecord->uAttributes = Load<std::uint32_t>(pbRecord + cbOffV3FileAttributes);
+				cbOffNameLength = cbOffV3FileNameLength;
+				cbOffNameOffset = cbOffV3FileNameOffset;
+				break;
+			default:
+				// V4 records only say which ranges changed, and come after a
+				// V3 record for the same change anyway
+				m_ibCursor += cbRecord;
+				return Next(pRecord);
+		}
+
+		const std::size_t cbName = Load<std::uint16_t>(pbRecord + cbOffNameLength);
+		const std::size_t ibName = Load<std::uint16_t>(pbRecord + cbOffNameOffset);
+		if (ibName % alignof(NameChar) != 0 || cbName % sizeof(NameChar) != 0) return Fail();
+		if (ibName > cbRecord || cbName > cbRecord - ibName) return Fail();
+		pRecord->svName = NameView(
+			reinterpret_cast<const NameChar *>(pbRecord + ibName), cbName / sizeof(NameChar)
+		);
+		m_ibCursor += cbRecord;
+		return ReadResult::Ok;
+	}
+
+  private:
+	ReadResult Fail() {
+		m_bDone = true;
+		return ReadResult::Malformed;
+	}
+
+	const unsigned char *m_pb;
+	std::size_t m_cb;
+	std::size_t m_ibCursor;
+	bool m_bDone;
+};
+
+
+// What a batch of records said about one file, all told
+struct Change {
+	bool bRemoved = false;  // whatever was known about the record is gone
+	bool bNamed = false;    // it exists now, with this name and parent
+	bool bStreams = false;  // its named streams need looking at again
+	std::uint64_t ullReference = 0;        // the file as it is now
+	std::uint64_t ullParentReference = 0;
+	Name sName;
+	bool bDirectory = false;
+};
+
+/**
+ * Collects records into one Change per MFT record, in journal order. A record
+ * number that's deleted and then reused within the batch comes out removed
+ * and then named, which is what it takes to forget the old file and learn the
+ * new one.
+ */
+class CChangeSet {
+  public:
+	using Map = std::unordered_map<std::uint64_t, Change>;
+
+	void Add(const Record &record) {
+		Change &change = m_changes[Mft::RecordOf(record.ullFileReference)];
+		if (record.uReason & REASON_FILE_DELETE) {
+			change = Change();
+			change.bRemoved = true;
+			return;
+		}
+		// Every record has the file's name and parent as of then, except
+		// the one half of a rename that has the old ones
+		if (!(record.uReason & REASON_RENAME_OLD_NAME) || (record.uReason & REASON_RENAME_NEW_NAME)) {
+			change.bNamed = true;
+			change.ullReference = record.ullFileReference;
+			change.ullParentReference = record.ullParentReference;
+			change.sName.assign(record.svName.data(), record.svName.size());
+			change.bDirectory = (record.uAttributes & uAttributeDirectory) != 0;
+		}
+		if (record.uReason & REASONS_NAMED_STREAMS) change.bStreams = true;
+	}
+
+	const Map &Changes() const { return m_changes; }
+	std::size_t Count() const { return m_changes.size(); }
+	void Clear() { m_changes.clear(); }
+
+  private:
+	Map m_changes;
+};
+
+}  // namespace ADSX::Usn
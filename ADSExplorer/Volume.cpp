@@ -0,0 +1,124 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "Volume.h"
+
+#include <Shlwapi.h>  // PathIsUNCW, PathStripToRootW
+
+namespace ADSX {
+
+
+std::wstring WithoutExtendedPrefix(_In_ PCWSTR pszPath) {
+	if (wcsncmp(pszPath, L"\\\\?\\UNC\\", 8) == 0) return std::wstring(L"\\\\") + (pszPath + 8);
+	if (wcsncmp(pszPath, L"\\\\?\\", 4) == 0) return std::wstring(pszPath + 4);
+	return std::wstring(pszPath);
+}
+
+
+CVolumeCache &CVolumeCache::Instance() {
+	// Thread-safe on first use ("magic statics")
+	static CVolumeCache cache;
+	return cache;
+}
+
+
+CVolumeCache::Volume &CVolumeCache::Lookup(_In_ const std::wstring &sRoot) {
+	auto it = m_volumes.find(sRoot);
+	if (it != m_volumes.end()) return it->second;
+	Volume volume;
+	// Mapped drives answer this from the redirector's table without going
+	// out to the server.
+	volume.bRemote = (
+		PathIsUNCW(sRoot.c_str()) ||
+		GetDriveTypeW(sRoot.c_str()) == DRIVE_REMOTE
+	);
+	volume.bTimedOut = false;
+	volume.NamedStreams = Support::Unknown;
+	LOG(L" ** Volume " << sRoot << (volume.bRemote ? L" is" : L" isn't") << L" remote");
+	return m_volumes.emplace(sRoot, volume).first->second;
+}
+
+
+bool CVolumeCache::IsSlow(_In_ PCWSTR pszPath) {
+	return VolumeIsSlow(VolumePathOf(pszPath));
+}
+
+
+bool CVolumeCache::VolumeIsSlow(_In_ const std::wstring &sRoot) {
+	if (sRoot.empty()) return false;
+	CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+	const Volume &volume = Lookup(sRoot);
+	return volume.bRemote || volume.bTimedOut;
+}
+
+
+void CVolumeCache::MarkSlow(_In_ PCWSTR pszPath) {
+	const std::wstring sRoot = VolumePathOf(pszPath);
+	if (sRoot.empty()) return;
+	CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+	Lookup(sRoot).bTimedOut = true;
+}
+
+
+std::wstring CVolumeCache::VolumePathOf(_In_ PCWSTR pszPath) {
+	// Whatever's mounted where on a share is the server's business, and
+	// asking would wait on a server that mightn't be answering
+	std::wstring sPath = WithoutExtendedPrefix(pszPath);
+	if (PathIsUNCW(sPath.c_str())) {
+		// Works on the copy; stops at "\\server\share"
+		if (!PathStripToRootW(&sPath[0])) return std::wstring();
+		sPath.resize(wcslen(sPath.c_str()));
+		if (sPath.back() != L'\\') sPath += L'\\';
+		return sPath;
+	}
+	if (sPath.size() >= 2 && iswalpha(sPath[0]) && sPath[1] == L':') {
+		// Mapped drives answer this from the redirector's table
+		const WCHAR szDrive[] = {sPath[0], L':', L'\\', L'\0'};
+		if (GetDriveTypeW(szDrive) == DRIVE_REMOTE) return std::wstring(szDrive);
+	}
+
+	// The volume's root is never longer than the path, bar a backslash
+	std::wstring sVolume(wcslen(pszPath) + 2, L'\0');
+	if (!GetVolumePathNameW(pszPath, &sVolume[0], static_cast<DWORD>(sVolume.size()))) {
+		LOG(L" ** GetVolumePathNameW(" << pszPath << L"): " << GetLastError());
+		return std::wstring();
+	}
+	sVolume = WithoutExtendedPrefix(sVolume.c_str());
+	if (!sVolume.empty() && sVolume.back() != L'\\') sVolume += L'\\';
+	return sVolume;
+}
+
+
+bool CVolumeCache::SupportsNamedStreams(_In_ PCWSTR pszPath) {
+	return VolumeSupportsNamedStreams(VolumePathOf(pszPath));
+}
+
+
+bool CVolumeCache::VolumeSupportsNamedStreams(_In_ const std::wstring &sRoot) {
+	if (sRoot.empty()) return true;
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+		const Volume &volume = Lookup(sRoot);
+		if (volume.NamedStreams != Support::Unknown) {
+			return volume.NamedStreams == Support::Yes;
+		}
+		if (volume.bRemote || volume.bTimedOut) return true;
+	}
+
+	// Not under the lock; this is I/O. Two threads asking at once both ask
+	// the volume, which is harmless.
+	DWORD dwFlags = 0;
+	const bool bSupported = !GetVolumeInformationW(
+		sRoot.c_str(), NULL, 0, NULL, NULL, &dwFlags, NULL, 0
+	) || (dwFlags & FILE_NAMED_STREAMS);
+	LOG(L" ** Volume " << sRoot << (bSupported ? L" has" : L" doesn't have") << L" streams");
+
+	CComCritSecLock<CComAutoCriticalSection> lock(m_cs);
+	Lookup(sRoot).NamedStreams = bSupported ? Support::Yes : Support::No;
+	return bSupported;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,87 @@
+/**
+ * 2024 Nate Kean
+ *
+ * What we know about the volumes file system objects live on, remembered per
+ * volume for the life of the process. A volume mounted in a folder is a
+ * volume of its own, not part of the one the folder's on.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <map>
+#include <string>
+
+namespace ADSX {
+
+
+class CVolumeCache {
+  public:
+	// The one for this process
+	static CVolumeCache &Instance();
+
+	/**
+	 * Whether the volume the object at pszPath lives on should be treated as
+	 * slow: it's on the network, or an enumeration on it has run out of time
+	 * before.
+	 * Doesn't touch anything on the network (see VolumePathOf), so it's safe
+	 * to ask about a share that isn't responding.
+	 */
+	bool IsSlow(_In_ PCWSTR pszPath);
+
+	// Remember that the volume pszPath is on kept us waiting.
+	void MarkSlow(_In_ PCWSTR pszPath);
+
+	// IsSlow for the volume whose root is sRoot, as VolumePathOf gives it,
+	// for asking about a lot of objects on the same one.
+	bool VolumeIsSlow(_In_ const std::wstring &sRoot);
+
+	/**
+	 * Whether the filesystem on the volume pszPath is on can have alternate
+	 * data streams at all (FILE_NAMED_STREAMS), so there's no need to ask
+	 * about each file on FAT or exFAT.
+	 * Asks the volume the first time only, and never asks a slow one; if it
+	 * can't tell, the answer is yes.
+	 */
+	bool SupportsNamedStreams(_In_ PCWSTR pszPath);
+
+	// SupportsNamedStreams for the volume whose root is sRoot, as
+	// VolumePathOf gives it. An empty root gets the benefit of the doubt.
+	bool VolumeSupportsNamedStreams(_In_ const std::wstring &sRoot);
+
+	/**
+	 * The root of the volume the object at pszPath is on, asking the
+	 * filesystem (GetVolumePathNameW) so that a volume mounted in a folder
+	 * comes out as that folder: "C:\", "C:\mnt\disk\" or
+	 * "\\server\share\". Takes \\?\ paths, and leaves the prefix off.
+	 * Shares and mapped drives are worked out from the path alone, without
+	 * going out to the server.
+	 * @post: empty if it can't tell.
+	 */
+	static std::wstring VolumePathOf(_In_ PCWSTR pszPath);
+
+  protected:
+	CVolumeCache() {}
+
+	enum class Support { Unknown, Yes, No };
+
+	struct Volume {
+		bool bRemote;
+		bool bTimedOut;
+		Support NamedStreams;
+	};
+
+	// @pre: m_cs is held.
+	Volume &Lookup(_In_ const std::wstring &sRoot);
+
+	CComAutoCriticalSection m_cs;
+	std::map<std::wstring, Volume> m_volumes;
+};
+
+
+// "C:\dir" from "\\?\C:\dir", and "\\server\share" from
+// "\\?\UNC\server\share", so both kinds of path find the same volume.
+std::wstring WithoutExtendedPrefix(_In_ PCWSTR pszPath);
+
+}  // namespace ADSX
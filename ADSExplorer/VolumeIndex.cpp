@@ -0,0 +1,436 @@
+/**
+ * 2024 Nate Kean
+ */
+
+#include "pch.h"  // Precompiled header; include first
+
+#include "VolumeIndex.h"
+
+#include <new>
+#include <utility>
+
+#include "MftScanner.h"
+#include "MftVolume.h"
+#include "StreamQuery.h"
+#include "UsnJournal.h"
+
+// Debug log prefix for CVolumeIndex
+#define P_VI L"ADSX::CVolumeIndex(0x" << std::hex << this << L")::"
+
+namespace ADSX {
+
+// Plenty for a busy minute of journal per call
+static constexpr DWORD cbJournalBuffer = 256 * 1024;
+
+
+CVolumeIndex::CVolumeIndex()
+	: m_cRef(1)
+	, m_chDrive(L'\0')
+	, m_ullSerial(0)
+	, m_stats() {}
+
+CVolumeIndex::~CVolumeIndex() {
+	m_index.Attach(NULL, 0);
+	m_file.Unmap();
+}
+
+
+ULONG CVolumeIndex::AddRef() {
+	return InterlockedIncrement(&m_cRef);
+}
+
+ULONG CVolumeIndex::Release() {
+	const ULONG cRef = InterlockedDecrement(&m_cRef);
+	if (cRef == 0) delete this;
+	return cRef;
+}
+
+
+HRESULT CVolumeIndex::Open(
+	_In_         WCHAR         chDrive,
+	_COM_Outptr_ CVolumeIndex  **ppIndex
+) {
+	if (ppIndex == NULL) return E_POINTER;
+	*ppIndex = NULL;
+	if (!iswalpha(chDrive)) return E_INVALIDARG;
+
+	CVolumeIndex *pIndex = new (std::nothrow) CVolumeIndex();
+	if (pIndex == NULL) return E_OUTOFMEMORY;
+	HRESULT hr = pIndex->Initialize(chDrive);
+	if (FAILED(hr)) {
+		pIndex->Release();
+		return WrapReturn(hr);
+	}
+	*ppIndex = pIndex;
+	return S_OK;
+}
+
+
+HRESULT CVolumeIndex::Initialize(_In_ WCHAR chDrive) {
+	LOG(P_VI << L"Initialize(" << chDrive << L")");
+	const ULONGLONG ullStart = GetTickCount64();
+	m_chDrive = static_cast<WCHAR>(towupper(chDrive));
+
+	const WCHAR szVolume[] = {L'\\', L'\\', L'.', L'\\', m_chDrive, L':', L'\0'};
+	HANDLE hVolume = CreateFileW(
+		szVolume,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		0,
+		NULL
+	);
+	if (hVolume == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+	m_hVolume.Attach(hVolume);
+
+	NTFS_VOLUME_DATA_BUFFER volumeData;
+	DWORD cbReturned;
+	if (!DeviceIoControl(
+		m_hVolume, FSCTL_GET_NTFS_VOLUME_DATA, NULL, 0,
+		&volumeData, sizeof(volumeData), &cbReturned, NULL
+	)) {
+		// Not NTFS
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	m_ullSerial = volumeData.VolumeSerialNumber.QuadPart;
+
+	// One file per volume, by serial number, so it follows the volume from
+	// one drive letter to another
+	WCHAR szName[32];
+	swprintf_s(szName, L"%016llX.adsxidx", m_ullSerial);
+	HRESULT hr;
+	try {
+		hr = IndexFilePath(szName, &m_sFile);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	if (FAILED(hr)) return hr;
+
+	USN_JOURNAL_DATA_V0 journal;
+	hr = QueryJournal(&journal);
+	if (FAILED(hr)) return hr;
+
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	if (SUCCEEDED(MapFile()) && !Fits(journal)) {
+		LOG(P_VI << L"Initialize(): index file is stale");
+		m_index.Attach(NULL, 0);
+		m_file.Unmap();
+	}
+	if (m_file.Data() == NULL) {
+		hr = Build();
+		if (FAILED(hr)) return hr;
+	}
+	hr = CatchUpLocked();
+	if (FAILED(hr)) return hr;
+	m_stats.dwOpenMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	LOG(P_VI << L"Initialize(): " << std::dec << m_stats.dwOpenMs << L" ms");
+	return S_OK;
+}
+
+
+HRESULT CVolumeIndex::QueryJournal(_Out_ USN_JOURNAL_DATA_V0 *pJournal) {
+	DWORD cbReturned;
+	if (!DeviceIoControl(
+		m_hVolume, FSCTL_QUERY_USN_JOURNAL, NULL, 0,
+		pJournal, sizeof(*pJournal), &cbReturned, NULL
+	)) {
+		const DWORD dwError = GetLastError();
+		LOG(P_VI << L"QueryJournal(): " << dwError);
+		return HRESULT_FROM_WIN32(dwError);
+	}
+	return S_OK;
+}
+
+
+bool CVolumeIndex::Fits(_In_ const USN_JOURNAL_DATA_V0 &journal) const {
+	const Index::Metadata metadata = m_index.GetMetadata();
+	return (
+		metadata.ullVolumeSerial == m_ullSerial &&
+		metadata.ullJournalId == journal.UsnJournalID &&
+		metadata.llNextUsn >= journal.FirstUsn &&
+		metadata.llNextUsn <= journal.NextUsn
+	);
+}
+
+
+HRESULT CVolumeIndex::Build() {
+	LOG(P_VI << L"Build()");
+	const ULONGLONG ullStart = GetTickCount64();
+
+	// Where the journal is before the scan starts, so anything that happens
+	// during it gets caught up on afterwards
+	USN_JOURNAL_DATA_V0 journal;
+	HRESULT hr = QueryJournal(&journal);
+	if (FAILED(hr)) return hr;
+
+	CVolumeSource source;
+	const WCHAR szDrive[] = {m_chDrive, L':', L'\0'};
+	hr = source.Open(szDrive);
+	if (FAILED(hr)) return hr;
+
+	std::vector<unsigned char> index;
+	try {
+		Mft::CScanner scanner(source);
+		std::vector<Mft::FoundStream> found;
+		std::vector<Mft::FoundFile> foundFiles;
+		if (!scanner.Scan(&found, &foundFiles)) return HRESULT_FROM_WIN32(ERROR_UNRECOGNIZED_VOLUME);
+
+		std::vector<Index::File> files;
+		files.reserve(foundFiles.size());
+		for (Mft::FoundFile &file : foundFiles) {
+			files.push_back(Index::File{file.ullRecord, file.ullParent, std::move(file.sName), file.bDirectory});
+		}
+		std::vector<Index::Stream> streams;
+		streams.reserve(found.size());
+		for (Mft::FoundStream &stream : found) {
+			streams.push_back(Index::Stream{stream.ullRecord, std::move(stream.sName), stream.ullSize});
+		}
+
+		Index::Metadata metadata;
+		metadata.ullVolumeSerial = m_ullSerial;
+		metadata.ullJournalId = journal.UsnJournalID;
+		metadata.llNextUsn = journal.NextUsn;
+		index = Index::CIndex::Build(metadata, std::move(files), std::move(streams));
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+
+	hr = WriteIndexFile(std::move(index));
+	m_stats.dwBuildMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	LOG(P_VI << L"Build(): " << std::dec << m_stats.dwBuildMs << L" ms, " << m_stats.cbFile << L" bytes");
+	return hr;
+}
+
+
+HRESULT CVolumeIndex::CatchUp() {
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	return WrapReturn(CatchUpLocked());
+}
+
+
+HRESULT CVolumeIndex::CatchUpLocked() {
+	const ULONGLONG ullStart = GetTickCount64();
+	USN_JOURNAL_DATA_V0 journal;
+	HRESULT hr = QueryJournal(&journal);
+	if (FAILED(hr)) return hr;
+	if (!Fits(journal)) {
+		LOG(P_VI << L"CatchUp(): journal has moved on; scanning again");
+		hr = Build();
+		if (FAILED(hr)) return hr;
+	}
+
+	CHeapPtr<BYTE> pbBuffer;
+	if (!pbBuffer.AllocateBytes(cbJournalBuffer)) return E_OUTOFMEMORY;
+	const Index::Metadata metadata = m_index.GetMetadata();
+	READ_USN_JOURNAL_DATA_V0 read = {};
+	read.StartUsn = metadata.llNextUsn;
+	read.ReasonMask = 0xFFFFFFFF;
+	read.UsnJournalID = journal.UsnJournalID;
+
+	Usn::CChangeSet changes;
+	try {
+		// Only as far as the journal had got when we started, or a busy
+		// volume could keep us here forever
+		while (read.StartUsn < journal.NextUsn) {
+			DWORD cbReturned;
+			if (!DeviceIoControl(
+				m_hVolume, FSCTL_READ_USN_JOURNAL, &read, sizeof(read),
+				pbBuffer, cbJournalBuffer, &cbReturned, NULL
+			)) {
+				const DWORD dwError = GetLastError();
+				LOG(P_VI << L"CatchUp(): FSCTL_READ_USN_JOURNAL: " << dwError);
+				if (dwError == ERROR_JOURNAL_ENTRY_DELETED) return Build();
+				return HRESULT_FROM_WIN32(dwError);
+			}
+			if (cbReturned < sizeof(USN)) break;
+			const USN usnNext = *reinterpret_cast<const USN *>(static_cast<BYTE *>(pbBuffer));
+			Usn::CReader reader(static_cast<BYTE *>(pbBuffer) + sizeof(USN), cbReturned - sizeof(USN));
+			Usn::Record record;
+			while (reader.Next(&record) == Mft::ReadResult::Ok) changes.Add(record);
+			if (usnNext <= read.StartUsn) break;
+			read.StartUsn = usnNext;
+		}
+
+		Index::ApplyChanges(
+			m_index, changes,
+			[this](std::uint64_t ullReference, std::vector<Index::Stream> *pStreams) {
+				return QueryStreams(ullReference, pStreams);
+			},
+			[this](std::uint64_t ullReference, Index::File *pFile, std::uint64_t *pullParentReference) {
+				return QueryFile(ullReference, pFile, pullParentReference);
+			}
+		);
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	m_index.SetNextUsn(read.StartUsn);
+
+	m_stats.dwLastCatchUpMs = static_cast<DWORD>(GetTickCount64() - ullStart);
+	m_stats.llLastUsnBehind = journal.NextUsn - metadata.llNextUsn;
+	m_stats.cLastChanges = changes.Count();
+	LOG(
+		P_VI << L"CatchUp(): " << std::dec << changes.Count() << L" files changed in " <<
+		m_stats.llLastUsnBehind << L" bytes of journal, " << m_stats.dwLastCatchUpMs << L" ms"
+	);
+	return S_OK;
+}
+
+
+HRESULT CVolumeIndex::Save() {
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	return WrapReturn(SaveLocked());
+}
+
+
+HRESULT CVolumeIndex::SaveLocked() {
+	// Only the USN moved; not worth rewriting the file for
+	if (m_index.ChangeCount() == 0) return S_FALSE;
+	std::vector<unsigned char> index;
+	try {
+		index = m_index.Serialize();
+	} catch (const std::bad_alloc &) {
+		return E_OUTOFMEMORY;
+	}
+	return WriteIndexFile(std::move(index));
+}
+
+
+HRESULT CVolumeIndex::WriteIndexFile(_In_ std::vector<unsigned char> index) {
+	HRESULT hr = WriteIndexTemp(m_sFile, index);
+	if (FAILED(hr)) return hr;
+	// A mapped file can't be replaced, so answer from memory meanwhile
+	m_index.Adopt(std::move(index));
+	m_file.Unmap();
+	hr = ReplaceIndexFile(m_sFile);
+	if (FAILED(hr)) return hr;
+	// If it can't be mapped, the copy in memory does just as well
+	hr = MapFile();
+	if (FAILED(hr)) LOG(P_VI << L"WriteIndexFile(): MapFile: " << HRESULTToString(hr));
+	m_stats.cbFile = m_index.FileSize();
+	return S_OK;
+}
+
+
+HRESULT CVolumeIndex::MapFile() {
+	CMappedFile file;
+	HRESULT hr = file.Map(m_sFile.c_str());
+	if (FAILED(hr)) return hr;
+	if (!m_index.Attach(file.Data(), file.Size())) {
+		LOG(P_VI << L"MapFile(): not an index file");
+		return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+	}
+	// The one mapped before goes with file
+	m_file.Swap(file);
+	m_stats.cbFile = m_file.Size();
+	return S_OK;
+}
+
+
+bool CVolumeIndex::QueryStreams(
+	_In_  ULONGLONG                       ullReference,
+	_Out_ std::vector<Index::Stream>  *pStreams
+) {
+	pStreams->clear();
+	FILE_ID_DESCRIPTOR id = {};
+	id.dwSize = sizeof(id);
+	id.Type = FileIdType;
+	id.FileId.QuadPart = ullReference;
+	CHandle hFile(OpenFileById(
+		m_hVolume, &id, FILE_READ_ATTRIBUTES,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, FILE_FLAG_BACKUP_SEMANTICS
+	));
+	if (hFile == INVALID_HANDLE_VALUE) {
+		// Deleted since, most likely
+		hFile.Detach();
+		return false;
+	}
+	CStreamInfoBuffer buffer;
+	if (FAILED(buffer.Query(hFile))) return false;
+	StreamInfo::CReader reader = buffer.Reader();
+	StreamInfo::Entry entry;
+	while (reader.Next(&entry) == StreamInfo::ReadResult::Ok) {
+		const StreamInfo::NameView svName = StreamInfo::TrimName(entry.svName);
+		if (svName.empty()) continue;
+		pStreams->push_back(Index::Stream{
+			Mft::RecordOf(ullReference), Index::Name(svName), static_cast<std::uint64_t>(entry.llSize)
+		});
+	}
+	return true;
+}
+
+
+bool CVolumeIndex::QueryFile(
+	_In_  ULONGLONG    ullReference,
+	_Out_ Index::File  *pFile,
+	_Out_ ULONGLONG    *pullParentReference
+) {
+	FILE_ID_DESCRIPTOR id = {};
+	id.dwSize = sizeof(id);
+	id.Type = FileIdType;
+	id.FileId.QuadPart = ullReference;
+	CHandle hFile(OpenFileById(
+		m_hVolume, &id, FILE_READ_ATTRIBUTES,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, FILE_FLAG_BACKUP_SEMANTICS
+	));
+	if (hFile == INVALID_HANDLE_VALUE) {
+		hFile.Detach();
+		return false;
+	}
+
+	// What the journal would say about it now: its name and parent
+	union {
+		BYTE ab[sizeof(USN_RECORD_V2) + MAX_PATH * sizeof(WCHAR)];
+		ULONGLONG ullAlign;
+	} buffer;
+	DWORD cbReturned;
+	if (!DeviceIoControl(
+		hFile, FSCTL_READ_FILE_USN_DATA, NULL, 0,
+		&buffer, sizeof(buffer), &cbReturned, NULL
+	)) {
+		return false;
+	}
+	Usn::CReader reader(buffer.ab, cbReturned);
+	Usn::Record record;
+	if (reader.Next(&record) != Mft::ReadResult::Ok) return false;
+	pFile->ullRecord = Mft::RecordOf(ullReference);
+	pFile->ullParent = Mft::RecordOf(record.ullParentReference);
+	try {
+		pFile->sName.assign(record.svName.data(), record.svName.size());
+	} catch (const std::bad_alloc &) {
+		return false;
+	}
+	pFile->bDirectory = (record.uAttributes & Usn::uAttributeDirectory) != 0;
+	*pullParentReference = record.ullParentReference;
+	return true;
+}
+
+
+HRESULT CVolumeIndex::FindByName(
+	_In_  PCWSTR                     pszName,
+	_Out_ std::vector<std::wstring>  *pPaths
+) const {
+	if (pszName == NULL || pPaths == NULL) return E_POINTER;
+	pPaths->clear();
+	std::vector<Index::Stream> streams;
+	m_index.FindByName(pszName, &streams);
+	const WCHAR szRoot[] = {m_chDrive, L':', L'\\', L'\0'};
+	Index::Name sPath;
+	for (const Index::Stream &stream : streams) {
+		if (!m_index.PathOf(stream.ullRecord, &sPath)) continue;
+		pPaths->push_back(szRoot + sPath);
+	}
+	return S_OK;
+}
+
+
+CVolumeIndex::Stats CVolumeIndex::GetStats() const {
+	CComCritSecLock<CComAutoCriticalSection> lock(m_csUpdate);
+	Stats stats = m_stats;
+	stats.cPending = m_index.ChangeCount();
+	return stats;
+}
+
+}  // namespace ADSX
@@ -0,0 +1,122 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A local NTFS volume's stream index (StreamIndex.h), kept in a file under
+ * %LOCALAPPDATA% and mapped straight in when it's opened again, and brought up
+ * to date from the volume's change journal instead of by scanning it again.
+ *
+ * Building an index reads the MFT, and reading the change journal takes a
+ * handle on the volume, so both need an administrator.
+ *
+ * Not in the project yet: nothing opens one until the folder view and search
+ * are moved over to it.
+ */
+
+#pragma once
+
+#include "pch.h"  // Precompiled header; include first
+
+#include <winioctl.h>
+
+#include <string>
+#include <vector>
+
+#include "IndexFile.h"
+#include "StreamIndex.h"
+
+namespace ADSX {
+
+
+class CVolumeIndex {
+  public:
+	struct Stats {
+		DWORD dwOpenMs;           // to map (or build) the index and catch it up
+		DWORD dwBuildMs;          // to scan the volume; 0 if it didn't need to
+		ULONGLONG cbFile;         // the index file on disk
+		DWORD dwLastCatchUpMs;    // to read and apply the journal, last time
+		LONGLONG llLastUsnBehind; // how far behind the journal it was then, in bytes of journal
+		ULONGLONG cLastChanges;   // files the journal said changed then
+		ULONGLONG cPending;       // files changed since the file was written
+	};
+
+	/**
+	 * The index of the volume chDrive is, from its file if there's one that
+	 * still fits the volume, or else by scanning the volume; either way
+	 * caught up with the change journal.
+	 * @post: *ppIndex has a reference count of 1 for the caller to Release.
+	 * @post: fails with ERROR_JOURNAL_NOT_ACTIVE if the volume has no change
+	 *        journal, since the index couldn't be kept up to date.
+	 */
+	static HRESULT Open(
+		_In_         WCHAR         chDrive,
+		_COM_Outptr_ CVolumeIndex  **ppIndex
+	);
+
+	// Shared by refcount like a COM object so CComPtr can hold one,
+	// but it's not one.
+	ULONG AddRef();
+	ULONG Release();
+
+	/**
+	 * Apply whatever the change journal has recorded since last time. If the
+	 * journal has moved on too far to say (it wrapped, or was recreated), the
+	 * volume is scanned again.
+	 */
+	HRESULT CatchUp();
+
+	// Write the index file again with the changes caught up on folded in,
+	// if there are any. They're kept in memory until then.
+	HRESULT Save();
+
+	// Query away. Record numbers are the low 48 bits of a file ID.
+	const Index::CIndex &Index() const { return m_index; }
+
+	/**
+	 * Full paths, like "C:\dir\file", of the files with a stream called
+	 * pszName. Files whose path couldn't be traced are left out.
+	 * @post: may throw std::bad_alloc.
+	 */
+	HRESULT FindByName(_In_ PCWSTR pszName, _Out_ std::vector<std::wstring> *pPaths) const;
+
+	Stats GetStats() const;
+
+  protected:
+	CVolumeIndex();
+	~CVolumeIndex();
+
+	HRESULT Initialize(_In_ WCHAR chDrive);
+
+	HRESULT QueryJournal(_Out_ USN_JOURNAL_DATA_V0 *pJournal);
+	// Whether the mapped file is of this volume and the journal still goes
+	// back far enough to catch it up
+	bool Fits(_In_ const USN_JOURNAL_DATA_V0 &journal) const;
+
+	// @pre: m_csUpdate is held.
+	HRESULT Build();
+	HRESULT CatchUpLocked();
+	HRESULT SaveLocked();
+
+	// Replace the index file with index, and answer from it.
+	// @pre: m_csUpdate is held.
+	HRESULT WriteIndexFile(_In_ std::vector<unsigned char> index);
+	HRESULT MapFile();
+
+	// Callbacks for Index::ApplyChanges, asking the volume itself
+	bool QueryStreams(_In_ ULONGLONG ullReference, _Out_ std::vector<Index::Stream> *pStreams);
+	bool QueryFile(_In_ ULONGLONG ullReference, _Out_ Index::File *pFile, _Out_ ULONGLONG *pullParentReference);
+
+	volatile LONG m_cRef;
+	WCHAR m_chDrive;
+	CHandle m_hVolume;  // for FSCTLs, and as the hint for OpenFileById
+	ULONGLONG m_ullSerial;
+	std::wstring m_sFile;
+
+	CMappedFile m_file;
+	Index::CIndex m_index;
+
+	// One catch-up or save at a time; queries don't take it
+	mutable CComAutoCriticalSection m_csUpdate;
+	Stats m_stats;
+};
+
+}  // namespace ADSX
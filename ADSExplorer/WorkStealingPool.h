@@ -0,0 +1,191 @@
+/**
+ * 2024 Nate Kean
+ *
+ * A fixed set of threads working through tasks that turn up more tasks, the
+ * way directories turn up subdirectories. Each thread keeps a deque of its
+ * own: it pushes and pops at the back, where the work it just found is still
+ * warm, and when it runs dry it steals from the front of someone else's,
+ * where the biggest untouched subtrees are. Nobody hands out work centrally,
+ * so one huge directory doesn't leave the other threads idle.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ADSX {
+
+
+// @pre: Task is default-constructible and movable.
+template <typename Task>
+class CWorkStealingPool {
+  public:
+	// Handed to the work function along with each task.
+	class CContext {
+	  public:
+		// Queue up another task, to be run by this thread unless someone
+		// steals it first.
+		void Push(Task task) { m_pool.PushLocal(m_iWorker, std::move(task)); }
+
+		// Which thread this is, 0 to WorkerCount() - 1, for keeping
+		// per-thread state without a lock.
+		std::size_t WorkerIndex() const { return m_iWorker; }
+
+		// Long tasks should check this now and then and wrap up early.
+		bool IsCancelled() const {
+			return m_pool.m_bCancel.load(std::memory_order_relaxed);
+		}
+
+	  private:
+		friend class CWorkStealingPool;
+		CContext(CWorkStealingPool &pool, std::size_t iWorker)
+			: m_pool(pool)
+			, m_iWorker(iWorker) {}
+
+		CWorkStealingPool &m_pool;
+		const std::size_t m_iWorker;
+	};
+
+	explicit CWorkStealingPool(std::size_t cWorkers)
+		: m_aQueues(cWorkers > 0 ? cWorkers : 1)
+		, m_cPending(0)
+		, m_bCancel(false)
+		, m_cSteals(0) {}
+
+	CWorkStealingPool(const CWorkStealingPool &) = delete;
+	CWorkStealingPool &operator=(const CWorkStealingPool &) = delete;
+
+	/**
+	 * Call fnWork(context, task) on every task in tasks and every task those
+	 * push, until there are none left or Cancel() is called. The calling
+	 * thread is worker 0; the rest are started here and joined before this
+	 * returns. If the system won't start them all, the ones that did start
+	 * take on the others' share.
+	 * @pre: not already running.
+	 * @post: after a Cancel(), tasks that never ran are dropped.
+	 */
+	template <typename FnWork>
+	void Run(std::vector<Task> tasks, FnWork fnWork) {
+		const std::size_t cWorkers = m_aQueues.size();
+		// Deal the first tasks out round-robin so everyone starts busy
+		m_cPending.store(tasks.size(), std::memory_order_relaxed);
+		for (std::size_t i = 0; i < tasks.size(); i++) {
+			m_aQueues[i % cWorkers].deque.push_back(std::move(tasks[i]));
+		}
+
+		std::vector<std::thread> threads;
+		threads.reserve(cWorkers - 1);
+		for (std::size_t i = 1; i < cWorkers; i++) {
+			try {
+				threads.emplace_back([this, i, &fnWork]() { WorkerLoop(i, fnWork); });
+			} catch (const std::system_error &) {
+				// Out of threads. The tasks dealt to the ones that didn't
+				// start get stolen like any others.
+				break;
+			}
+		}
+		// Whatever happens here, the threads have to be joined before they
+		// go out of scope
+		try {
+			WorkerLoop(0, fnWork);
+		} catch (...) {
+			Cancel();
+			for (std::thread &thread : threads) thread.join();
+			throw;
+		}
+		for (std::thread &thread : threads) thread.join();
+
+		for (Queue &queue : m_aQueues) queue.deque.clear();
+		m_cPending.store(0, std::memory_order_relaxed);
+	}
+
+	// Stop handing out tasks. Whatever's running finishes on its own time.
+	void Cancel() { m_bCancel.store(true, std::memory_order_release); }
+
+	std::size_t WorkerCount() const { return m_aQueues.size(); }
+
+	// How many tasks were taken from another thread's deque, for tuning.
+	std::uint64_t Steals() const {
+		return m_cSteals.load(std::memory_order_relaxed);
+	}
+
+  private:
+	// Each on its own cache line so neighbours' locks don't fight over it
+	struct alignas(64) Queue {
+		std::mutex mutex;
+		std::deque<Task> deque;
+	};
+
+	void PushLocal(std::size_t iWorker, Task task) {
+		// Counted before it can be seen, so the count can't read 0 while
+		// there's still work anywhere
+		m_cPending.fetch_add(1, std::memory_order_relaxed);
+		Queue &queue = m_aQueues[iWorker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.deque.push_back(std::move(task));
+	}
+
+	bool PopLocal(std::size_t iWorker, Task *pTask) {
+		Queue &queue = m_aQueues[iWorker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.deque.empty()) return false;
+		*pTask = std::move(queue.deque.back());
+		queue.deque.pop_back();
+		return true;
+	}
+
+	bool Steal(std::size_t iWorker, Task *pTask) {
+		const std::size_t cWorkers = m_aQueues.size();
+		for (std::size_t i = 1; i < cWorkers; i++) {
+			Queue &victim = m_aQueues[(iWorker + i) % cWorkers];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.deque.empty()) continue;
+			*pTask = std::move(victim.deque.front());
+			victim.deque.pop_front();
+			m_cSteals.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	template <typename FnWork>
+	void WorkerLoop(std::size_t iWorker, FnWork &fnWork) {
+		CContext context(*this, iWorker);
+		unsigned cIdle = 0;
+		while (!m_bCancel.load(std::memory_order_acquire)) {
+			Task task;
+			if (PopLocal(iWorker, &task) || Steal(iWorker, &task)) {
+				cIdle = 0;
+				fnWork(context, std::move(task));
+				// Anything it pushed was counted already
+				m_cPending.fetch_sub(1, std::memory_order_acq_rel);
+				continue;
+			}
+			if (m_cPending.load(std::memory_order_acquire) == 0) break;
+			// Someone's still busy and might push more. Back off from
+			// yielding to sleeping so a long task doesn't cost a core.
+			if (++cIdle < 64) {
+				std::this_thread::yield();
+			} else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	std::vector<Queue> m_aQueues;
+	// Tasks queued anywhere or still running
+	std::atomic<std::size_t> m_cPending;
+	std::atomic<bool> m_bCancel;
+	std::atomic<std::uint64_t> m_cSteals;
+};
+
+}  // namespace ADSX
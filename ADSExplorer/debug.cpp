@@ -77,7 +77,7 @@ CDebugStream::overflow(CDebugStream::Base::int_type c) {
 			}
 			if (ADSX::CItem::IsOwn(pidlr)) {
 				oss <<
-					ADSX::CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr))->pszName;
+					ADSX::CItem::Get(static_cast<PCUITEMID_CHILD>(pidlr))->szName;
 			} else {
 				WCHAR tmp[16];
 				swprintf_s(tmp, L"<unk-%02d>", pidlr->mkid.cb);
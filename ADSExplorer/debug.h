@@ -51,9 +51,24 @@ class CDebugStream
 
 // #define _DEBUG
 #ifdef _DEBUG
+	// Explorer calls us on more than one thread at a time. Keeps their lines
+	// (and the stream's formatting state) from getting mixed together.
+	// Recursive, since some of what gets logged logs too.
+	class CDebugStreamLock {
+	  public:
+		CDebugStreamLock() { Section().Lock(); }
+		~CDebugStreamLock() { Section().Unlock(); }
+	  private:
+		static CComAutoCriticalSection &Section() {
+			static CComAutoCriticalSection cs;
+			return cs;
+		}
+	};
+
 	// https://stackoverflow.com/a/3371577
 	// Usage: LOG(L"Hello" << ' ' << L"World!" << 1);
 	#define LOG(ostream_expression) do { \
+		CDebugStreamLock lockDebugStream; \
 		DEBUG_STREAM << ostream_expression << std::endl; \
 	} while(false)
 
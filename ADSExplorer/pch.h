@@ -7,6 +7,12 @@
 // pch.h : include file for standard system include files,
 // or project specific include files that are used frequently, but
 // are changed infrequently
+//
+// Headers that don't include this one (StreamInfo.h, Mft.h, DiskImage.h and
+// the like) stick to the standard library, so the parsers and data
+// structures in them can be built and unit tested without the Windows SDK.
+// They write (std::min) and (std::max) in parentheses for when Windows.h's
+// macros are around anyway.
 
 #pragma once
 
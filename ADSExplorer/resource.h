@@ -10,6 +10,11 @@
 #define IDS_COLUMN_NAME                 200
 #define IDS_COLUMN_FILESIZE             201
 #define IDS_REMOVAL_MSG                 300
+#define IDS_COPYTO_MENU                 400
+#define IDS_COPYTO_HELP                 401
+#define IDS_COPYTO_TITLE                402
+#define IDS_COPYTO_FAILED               403
+#define IDS_COPYTO_FAILED_TITLE         404
 
 // Next default values for new objects
 // 
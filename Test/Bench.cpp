@@ -0,0 +1,796 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "ContentMatch.h"
+#include "CopyEngine.h"
+#include "DiskImage.h"
+#include "EnumIDList.h"
+#include "MftScanner.h"
+#include "Selector.h"
+#include "StreamIndex.h"
+#include "StreamContents.h"
+#include "StreamSnapshot.h"
+#include "StreamUsage.h"
+#include "SyntheticDisk.h"
+#include "SyntheticMft.h"
+#include "SyntheticStreamInfo.h"
+#include "TreeScanner.h"
+#include "TrigramIndex.h"
+#include "UsnJournal.h"
+#include "defer.h"
+
+#include <filesystem>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CEnumIDList;
+using ADSX::CStreamSnapshot;
+using ADSX::CTreeScanner;
+
+
+// Microbenchmarks. They assert nothing about speed; they just report it in
+// the test output so before/after numbers end up side by side.
+
+static const ULONG cStreams = 10000;
+static const ULONG cRounds = 20;
+static const ULONG cBatch = 256;
+
+
+static double Now() {
+	static LARGE_INTEGER liFrequency = {};
+	if (liFrequency.QuadPart == 0) QueryPerformanceFrequency(&liFrequency);
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter(&liNow);
+	return static_cast<double>(liNow.QuadPart) / liFrequency.QuadPart;
+}
+
+static void Report(PCWSTR pszWhat, ULONGLONG cItems, double dSeconds) {
+	WCHAR szMessage[256];
+	swprintf_s(
+		szMessage,
+		L"%s: %llu items in %.3f s = %.0f items/s\n",
+		pszWhat,
+		cItems,
+		dSeconds,
+		cItems / dSeconds
+	);
+	Logger::WriteMessage(szMessage);
+}
+
+static void ReportRate(PCWSTR pszWhat, ULONGLONG cb, double dSeconds) {
+	WCHAR szMessage[256];
+	swprintf_s(
+		szMessage,
+		L"%s: %llu bytes in %.3f s = %.0f MB/s\n",
+		pszWhat,
+		cb,
+		dSeconds,
+		cb / dSeconds / 1e6
+	);
+	Logger::WriteMessage(szMessage);
+}
+
+static std::vector<unsigned char> MakeStreamInfo() {
+	std::vector<unsigned char> buf;
+	PushEntry(buf, L"::$DATA", 100, false);
+	for (ULONG i = 0; i < cStreams; i++) {
+		const std::wstring sName = L":stream" + std::to_wstring(i) + L":$DATA";
+		PushEntry(buf, sName, i, i == cStreams - 1);
+	}
+	return buf;
+}
+
+
+// What PushPidl/NextInternal did per stream before: a std::function call,
+// a std::wstring, a substr copy, one allocation for the PIDL and another one
+// for the name it pointed to.
+using FnLegacyConsume = std::function<
+	bool (const ADSX::StreamInfo::Entry &, PITEMID_CHILD **, ULONG *)
+>;
+
+#include <pshpack1.h>
+struct LegacyItemID {
+	USHORT cb;
+	UINT32 SIGNATURE;
+	LONGLONG llFilesize;
+	PWSTR pszName;
+	USHORT cbNull;
+};
+#include <poppack.h>
+
+static bool LegacyPushPidl(
+	const ADSX::StreamInfo::Entry &entry,
+	PITEMID_CHILD **ppelt,
+	ULONG *nActual
+) {
+	std::wstring sName(entry.svName);
+	if (sName.starts_with(L":") && sName.ends_with(L":$DATA")) {
+		sName = sName.substr(
+			_countof(L":") - 1,
+			(sName.length() - 1) - (_countof(L":$DATA") - 1)
+		);
+	}
+	if (sName.empty()) return true;
+	auto pItem = static_cast<LegacyItemID *>(CoTaskMemAlloc(sizeof(LegacyItemID)));
+	if (pItem == NULL) return false;
+	pItem->cb = sizeof(LegacyItemID) - sizeof(USHORT);
+	pItem->SIGNATURE = 'ADSX';
+	pItem->llFilesize = entry.llSize;
+	pItem->pszName = static_cast<PWSTR>(
+		CoTaskMemAlloc((sName.length() + 1) * sizeof(WCHAR))
+	);
+	if (pItem->pszName == NULL) return false;
+	wcscpy_s(pItem->pszName, sName.length() + 1, sName.c_str());
+	pItem->cbNull = 0;
+	**ppelt = reinterpret_cast<PITEMID_CHILD>(pItem);
+	++*ppelt;
+	++*nActual;
+	return true;
+}
+
+static void LegacyFree(PITEMID_CHILD pidlc) {
+	CoTaskMemFree(reinterpret_cast<LegacyItemID *>(pidlc)->pszName);
+	CoTaskMemFree(pidlc);
+}
+
+
+namespace Test {
+	TEST_CLASS(BenchEnumIDList) {
+	  public:
+		TEST_METHOD(BenchNext) {
+			const std::vector<unsigned char> buf = MakeStreamInfo();
+			PITEMID_CHILD apidl[cBatch];
+
+			// Before
+			{
+				const FnLegacyConsume fnConsume = &LegacyPushPidl;
+				ULONGLONG cItems = 0;
+				const double dStart = Now();
+				for (ULONG iRound = 0; iRound < cRounds; iRound++) {
+					ADSX::StreamInfo::CReader reader(buf.data(), buf.size());
+					ADSX::StreamInfo::Entry entry;
+					ULONG nActual = 0;
+					PITEMID_CHILD *ppelt = apidl;
+					while (reader.Next(&entry) == ADSX::StreamInfo::ReadResult::Ok) {
+						Assert::IsTrue(fnConsume(entry, &ppelt, &nActual));
+						if (nActual == cBatch) {
+							for (ULONG i = 0; i < nActual; i++) LegacyFree(apidl[i]);
+							cItems += nActual;
+							nActual = 0;
+							ppelt = apidl;
+						}
+					}
+					for (ULONG i = 0; i < nActual; i++) LegacyFree(apidl[i]);
+					cItems += nActual;
+				}
+				Report(L"Before (std::function + wstring + 2 allocs)", cItems, Now() - dStart);
+			}
+
+			// After
+			{
+				CStreamSnapshot *pSnapshot;
+				Assert::AreEqual(
+					CStreamSnapshot::Create(
+						ADSX::StreamInfo::CReader(buf.data(), buf.size()),
+						&pSnapshot
+					),
+					S_OK
+				);
+				defer({ pSnapshot->Release(); });
+				Assert::AreEqual(pSnapshot->Count(), cStreams);
+
+				CComObject<CEnumIDList> *pEnum;
+				Assert::AreEqual(CComObject<CEnumIDList>::CreateInstance(&pEnum), S_OK);
+				pEnum->AddRef();
+				defer({ pEnum->Release(); });
+				Assert::AreEqual(
+					pEnum->Init(pEnum->GetUnknown(), L"bench", pSnapshot),
+					S_OK
+				);
+
+				ULONGLONG cItems = 0;
+				const double dStart = Now();
+				for (ULONG iRound = 0; iRound < cRounds; iRound++) {
+					ULONG cFetched;
+					HRESULT hr;
+					do {
+						hr = pEnum->Next(cBatch, apidl, &cFetched);
+						for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(apidl[i]);
+						cItems += cFetched;
+					} while (hr == S_OK);
+					pEnum->Reset();
+				}
+				Report(L"After (snapshot + inline name + 1 alloc)", cItems, Now() - dStart);
+			}
+		}
+	};
+
+	TEST_CLASS(BenchTreeScanner) {
+	  public:
+		TEST_METHOD(BenchScan) {
+			// A made-up tree in %TEMP%: 4 levels of 4 subdirectories, 50 files
+			// in each directory, every fifth file with a stream
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			const std::filesystem::path root =
+				std::filesystem::path(szTemp) / L"ADSX Bench Tree";
+			std::filesystem::remove_all(root);
+			defer({ std::error_code ec; std::filesystem::remove_all(root, ec); });
+
+			std::vector<std::pair<std::filesystem::path, int>> dirs = {{root, 0}};
+			for (size_t i = 0; i < dirs.size(); i++) {
+				const std::filesystem::path dir = dirs[i].first;
+				const int iDepth = dirs[i].second;
+				std::filesystem::create_directories(dir);
+				for (int iFile = 0; iFile < 50; iFile++) {
+					std::wstring sFile = (dir / (L"file" + std::to_wstring(iFile))).wstring();
+					if (iFile % 5 == 0) sFile += L":stream";
+					HANDLE hFile = CreateFileW(
+						sFile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL
+					);
+					Assert::AreNotEqual(hFile, INVALID_HANDLE_VALUE);
+					CloseHandle(hFile);
+				}
+				if (iDepth == 4) continue;
+				for (int iDir = 0; iDir < 4; iDir++) {
+					dirs.push_back({dir / (L"dir" + std::to_wstring(iDir)), iDepth + 1});
+				}
+			}
+
+			const double dStart = Now();
+			CTreeScanner *pScanner;
+			Assert::AreEqual(CTreeScanner::Start(root.c_str(), &pScanner), S_OK);
+			defer({ pScanner->Release(); });
+			pScanner->Wait();
+			const double dElapsed = Now() - dStart;
+
+			const CTreeScanner::Stats stats = pScanner->GetStats();
+			Assert::AreEqual(stats.cErrors, 0ULL);
+			Report(L"Tree scan (files)", stats.cFiles, dElapsed);
+			WCHAR szMessage[128];
+			swprintf_s(
+				szMessage,
+				L"  %llu directories, %llu streams, %llu steals\n",
+				stats.cDirectories,
+				stats.cStreams,
+				stats.cSteals
+			);
+			Logger::WriteMessage(szMessage);
+		}
+	};
+
+	TEST_CLASS(BenchMftScanner) {
+	  public:
+		TEST_METHOD(BenchScan) {
+			// A quarter of a million records, the MFT in two pieces, every
+			// tenth file with a stream
+			const std::uint64_t cRecords = 256 * 1024;
+			CSyntheticVolume volume(cRecords, true);
+			const std::uint64_t ullDir = volume.Add(ADSX::Mft::ullRecordRoot, L"dir", true);
+			for (std::uint64_t i = ADSX::Mft::ullRecordFirstUser + 1; i < cRecords; i++) {
+				std::vector<CSyntheticVolume::Stream> streams;
+				if (i % 10 == 0) streams.push_back({L"stream", 1, false});
+				volume.Add(ullDir, L"file", false, streams);
+			}
+			const std::vector<unsigned char> image = volume.Build();
+
+			for (const unsigned cWorkers : {1u, 0u}) {
+				ADSX::CMemorySource source(image.data(), image.size());
+				ADSX::Mft::CScanner scanner(source, cWorkers);
+				std::vector<ADSX::Mft::FoundStream> found;
+				const double dStart = Now();
+				Assert::IsTrue(scanner.Scan(&found));
+				Report(
+					cWorkers == 1 ? L"MFT scan, 1 worker (records)" : L"MFT scan, all cores (records)",
+					scanner.GetStats().cRecords,
+					Now() - dStart
+				);
+				Assert::AreEqual(scanner.GetStats().cStreams, static_cast<std::uint64_t>(found.size()));
+			}
+		}
+
+		TEST_METHOD(BenchScanVhdx) {
+			// The same kind of volume, on a disk in a VHDX, read through the
+			// block cache
+			const std::uint64_t cRecords = 64 * 1024;
+			CSyntheticVolume volume(cRecords, true);
+			const std::uint64_t ullDir = volume.Add(ADSX::Mft::ullRecordRoot, L"dir", true);
+			for (std::uint64_t i = ADSX::Mft::ullRecordFirstUser + 1; i < cRecords; i++) {
+				std::vector<CSyntheticVolume::Stream> streams;
+				if (i % 10 == 0) streams.push_back({L"stream", 1, false});
+				volume.Add(ullDir, L"file", false, streams);
+			}
+			const std::vector<unsigned char> file =
+				SyntheticDisk::MakeVhdx(SyntheticDisk::MakeDisk(volume.Build(), true));
+
+			ADSX::CMemorySource source(file.data(), file.size());
+			ADSX::Disk::CImage image(source);
+			const double dStart = Now();
+			Assert::IsTrue(image.Open());
+			Assert::AreEqual(image.VolumeCount(), static_cast<std::size_t>(1));
+			ADSX::Mft::CScanner scanner(image.Volume(0));
+			std::vector<ADSX::Mft::FoundStream> found;
+			Assert::IsTrue(scanner.Scan(&found));
+			Report(L"MFT scan in a VHDX (records)", cRecords, Now() - dStart);
+
+			const ADSX::CBlockCache::Stats stats = image.GetCacheStats();
+			WCHAR szMessage[128];
+			swprintf_s(
+				szMessage,
+				L"  %llu reads from the file, %llu blocks read ahead, %llu hits\n",
+				stats.cReads,
+				stats.cReadAhead,
+				stats.cHits
+			);
+			Logger::WriteMessage(szMessage);
+		}
+	};
+
+	TEST_CLASS(BenchStreamIndex) {
+	  public:
+		TEST_METHOD(BenchBuildAndQuery) {
+			// The MFT scanner's volume, with every tenth file's stream called
+			// Zone.Identifier
+			const std::uint64_t cRecords = 256 * 1024;
+			CSyntheticVolume volume(cRecords, true);
+			const std::uint64_t ullDir = volume.Add(ADSX::Mft::ullRecordRoot, L"dir", true);
+			for (std::uint64_t i = ADSX::Mft::ullRecordFirstUser + 1; i < cRecords; i++) {
+				std::vector<CSyntheticVolume::Stream> streams;
+				if (i % 10 == 0) streams.push_back({i % 20 == 0 ? L"Zone.Identifier" : L"stream", 1, false});
+				volume.Add(ullDir, L"file", false, streams);
+			}
+			const std::vector<unsigned char> image = volume.Build();
+
+			double dStart = Now();
+			ADSX::CMemorySource source(image.data(), image.size());
+			ADSX::Mft::CScanner scanner(source);
+			std::vector<ADSX::Mft::FoundStream> found;
+			std::vector<ADSX::Mft::FoundFile> foundFiles;
+			Assert::IsTrue(scanner.Scan(&found, &foundFiles));
+			std::vector<ADSX::Index::File> files;
+			for (auto &file : foundFiles) {
+				files.push_back({file.ullRecord, file.ullParent, std::move(file.sName), file.bDirectory});
+			}
+			std::vector<ADSX::Index::Stream> streams;
+			for (auto &stream : found) streams.push_back({stream.ullRecord, std::move(stream.sName), stream.ullSize});
+			const std::vector<unsigned char> bytes =
+				ADSX::Index::CIndex::Build(ADSX::Index::Metadata(), std::move(files), std::move(streams));
+			Report(L"Index build, scan included (records)", cRecords, Now() - dStart);
+			WCHAR szMessage[128];
+			swprintf_s(
+				szMessage,
+				L"  %llu streams in %llu bytes\n",
+				static_cast<ULONGLONG>(found.size()),
+				static_cast<ULONGLONG>(bytes.size())
+			);
+			Logger::WriteMessage(szMessage);
+
+			const ULONG cOpens = 10000;
+			ADSX::Index::CIndex index;
+			dStart = Now();
+			for (ULONG i = 0; i < cOpens; i++) Assert::IsTrue(index.Attach(bytes.data(), bytes.size()));
+			Report(L"Index open (opens)", cOpens, Now() - dStart);
+
+			const ULONG cQueries = 100;
+			std::vector<ADSX::Index::Stream> results;
+			ULONGLONG cResults = 0;
+			dStart = Now();
+			for (ULONG i = 0; i < cQueries; i++) {
+				index.FindByName(L"zone.identifier", &results);
+				cResults += results.size();
+			}
+			Report(L"Index query by name (streams found)", cResults, Now() - dStart);
+
+			// A journal's worth of streams being written: a new stream on
+			// every file that had none
+			std::vector<unsigned char> journal;
+			for (std::uint64_t ullRecord = ADSX::Mft::ullRecordFirstUser + 1; ullRecord < cRecords; ullRecord++) {
+				if (ullRecord % 10 == 0) continue;
+				const std::size_t cbRecord = (ADSX::Usn::cbV2Header + 8 + 7) / 8 * 8;
+				const std::size_t ib = journal.size();
+				journal.resize(ib + cbRecord);
+				unsigned char *pb = &journal[ib];
+				const std::uint32_t cbLength = static_cast<std::uint32_t>(cbRecord);
+				const std::uint16_t uMajor = 2;
+				const std::uint32_t uReason = ADSX::Usn::REASON_STREAM_CHANGE;
+				const std::uint16_t cbName = 8;
+				const std::uint16_t ibName = static_cast<std::uint16_t>(ADSX::Usn::cbV2Header);
+				std::memcpy(pb + ADSX::Usn::cbOffRecordLength, &cbLength, sizeof(cbLength));
+				std::memcpy(pb + ADSX::Usn::cbOffMajorVersion, &uMajor, sizeof(uMajor));
+				std::memcpy(pb + ADSX::Usn::cbOffFileReference, &ullRecord, sizeof(ullRecord));
+				std::memcpy(pb + ADSX::Usn::cbOffV2ParentReference, &ullDir, sizeof(ullDir));
+				std::memcpy(pb + ADSX::Usn::cbOffV2Reason, &uReason, sizeof(uReason));
+				std::memcpy(pb + ADSX::Usn::cbOffV2FileNameLength, &cbName, sizeof(cbName));
+				std::memcpy(pb + ADSX::Usn::cbOffV2FileNameOffset, &ibName, sizeof(ibName));
+				std::memcpy(pb + ibName, L"file", cbName);
+			}
+			dStart = Now();
+			ADSX::Usn::CChangeSet changes;
+			ADSX::Usn::CReader reader(journal.data(), journal.size());
+			ADSX::Usn::Record record;
+			while (reader.Next(&record) == ADSX::Mft::ReadResult::Ok) changes.Add(record);
+			ADSX::Index::ApplyChanges(
+				index, changes,
+				[](std::uint64_t ullReference, std::vector<ADSX::Index::Stream> *pStreams) {
+					pStreams->push_back({ullReference, L"Zone.Identifier", 26});
+					return true;
+				},
+				[](std::uint64_t, ADSX::Index::File *, std::uint64_t *) { return false; }
+			);
+			Report(L"Index catch-up, volume queries stubbed out (changes)", changes.Count(), Now() - dStart);
+
+			dStart = Now();
+			const std::vector<unsigned char> compacted = index.Serialize();
+			Report(L"Index rewrite with changes (bytes)", compacted.size(), Now() - dStart);
+		}
+	};
+
+	TEST_CLASS(BenchStreamUsage) {
+	  public:
+		TEST_METHOD(BenchAnalyze) {
+			// A million streams on files four directories deep, most of them
+			// Zone.Identifier
+			std::vector<ADSX::Mft::FoundStream> streams;
+			const ULONG cFiles = 1000 * 1000;
+			streams.reserve(cFiles);
+			WCHAR szPath[64];
+			for (ULONG i = 0; i < cFiles; i++) {
+				// Scattered, the way the scanner's threads hand them over
+				const ULONG u = (i * 7919) % cFiles;
+				swprintf_s(szPath, L"d%lu\\d%lu\\d%lu\\f%lu.txt", u % 10, u / 10 % 10, u / 100 % 100, u);
+				streams.push_back({u, szPath, u % 8 ? L"Zone.Identifier" : L"big", 26ull + u % 8 * 1000, false});
+			}
+			const double dStart = Now();
+			const ADSX::Usage::Report report = ADSX::Usage::Analyze(streams, 100);
+			Report(L"Stream usage report (streams)", cFiles, Now() - dStart);
+			Assert::AreEqual(static_cast<std::uint64_t>(cFiles), report.total.cStreams);
+		}
+	};
+
+	TEST_CLASS(BenchSelector) {
+	  public:
+		TEST_METHOD(BenchMatches) {
+			// Names and sizes like a big scan's, a handful of which each
+			// query lets through
+			std::vector<std::wstring> names;
+			const ULONG cCandidates = 1000 * 1000;
+			names.reserve(cCandidates);
+			WCHAR szName[32];
+			for (ULONG i = 0; i < cCandidates; i++) {
+				if (i % 4) {
+					names.emplace_back(L"Zone.Identifier");
+				} else {
+					swprintf_s(szName, L"stream%lu.dat", i);
+					names.emplace_back(szName);
+				}
+			}
+			const PCWSTR apszQueries[] = {
+				L"Zone.Identifier",
+				L"size>1m or name:*.log",
+				L"(a or b or c or d or e) and not size<100",
+				L"name~\"^stream[0-9]+7\\.dat$\" size>10",
+			};
+			for (PCWSTR pszQuery : apszQueries) {
+				ADSX::Selector::CProgram program;
+				ADSX::Selector::Error error;
+				Assert::IsTrue(ADSX::Selector::CProgram::Compile(pszQuery, &program, &error));
+				ULONG cMatched = 0;
+				const double dStart = Now();
+				for (ULONG i = 0; i < cCandidates; i++) {
+					ADSX::Selector::Candidate candidate;
+					candidate.svName = names[i];
+					candidate.ullSize = 26ull + i % 1000 * 1000;
+					candidate.svPath = L"C:\\Users\\someone\\Downloads\\file.txt";
+					if (program.Matches(candidate)) cMatched++;
+				}
+				Report((std::wstring(L"Selector: ") + pszQuery + L" (streams)").c_str(), cCandidates, Now() - dStart);
+				Assert::IsTrue(cMatched <= cCandidates);
+			}
+		}
+	};
+
+	TEST_CLASS(BenchContentMatch) {
+	  public:
+		TEST_METHOD(BenchFind) {
+			// 256 MB of noise with a token planted every megabyte, searched
+			// the way a stream is: a chunk at a time
+			const std::size_t cb = 256 * 1024 * 1024;
+			std::vector<unsigned char> data(cb);
+			std::uint32_t uSeed = 1;
+			for (unsigned char &b : data) {
+				uSeed = uSeed * 1103515245 + 12345;
+				b = static_cast<unsigned char>(uSeed >> 16);
+			}
+			for (std::size_t ib = 0; ib + 16 < cb; ib += 1024 * 1024) std::memcpy(&data[ib], "ghp_TOKEN0123456", 16);
+
+			const ADSX::Content::Isa aIsas[] = {
+				ADSX::Content::Isa::Scalar, ADSX::Content::Isa::Sse2, ADSX::Content::Isa::Avx2,
+			};
+			for (ADSX::Content::Isa isa : aIsas) {
+				for (ULONG cLiterals : {1, 4, 16, 64}) {
+					ADSX::Content::CMatcher matcher;
+					matcher.SetIsa(isa);
+					if (matcher.GetIsa() != isa) continue;  // not on this CPU
+					matcher.AddLiteral("ghp_TOKEN0123456");
+					for (ULONG i = 1; i < cLiterals; i++) matcher.AddLiteral("AKIA" + std::to_string(i * 7919));
+					ADSX::Content::CStreamScan scan(matcher);
+					std::vector<ADSX::Content::Match> matches;
+					const double dStart = Now();
+					for (std::size_t ib = 0; ib < cb;) {
+						const std::size_t cbRead = (std::min)(scan.RoomSize(), cb - ib);
+						std::memcpy(scan.Room(), &data[ib], cbRead);
+						scan.Advance(cbRead, &matches);
+						ib += cbRead;
+					}
+					const double dSeconds = Now() - dStart;
+					WCHAR szMessage[128];
+					swprintf_s(
+						szMessage,
+						L"Content search, %hs, %lu literals: %.2f GB/s\n",
+						ADSX::Content::IsaName(isa),
+						cLiterals,
+						cb / dSeconds / 1e9
+					);
+					Logger::WriteMessage(szMessage);
+					Assert::AreEqual(std::size_t(256), matches.size());
+				}
+			}
+
+			ADSX::Content::CMatcher matcher;
+			std::uint32_t iPattern;
+			std::string sError;
+			Assert::IsTrue(matcher.AddRegex("ghp_[A-Za-z0-9]{12}", &iPattern, &sError));
+			ADSX::Content::CStreamScan scan(matcher);
+			std::vector<ADSX::Content::Match> matches;
+			const std::size_t cbRegex = 16 * 1024 * 1024;
+			const double dStart = Now();
+			for (std::size_t ib = 0; ib < cbRegex;) {
+				const std::size_t cbRead = (std::min)(scan.RoomSize(), cbRegex - ib);
+				std::memcpy(scan.Room(), &data[ib], cbRead);
+				scan.Advance(cbRead, &matches);
+				ib += cbRead;
+			}
+			Report(L"Content search, regular expression (bytes)", cbRegex, Now() - dStart);
+			Assert::AreEqual(std::size_t(16), matches.size());
+		}
+	};
+
+	TEST_CLASS(BenchTrigramIndex) {
+	  public:
+		TEST_METHOD(BenchBuildAndQuery) {
+			// 2000 streams of 32 KB of words, one with a token in it
+			const std::size_t cDocuments = 2000, cbDocument = 32 * 1024;
+			const char *apszWords[] = {
+				"stream", "zone", "identifier", "summary", "information", "the", "of",
+				"data", "alternate", "file", "explorer", "index", "content", "search",
+			};
+			std::vector<std::string> contents(cDocuments);
+			std::uint32_t uSeed = 1;
+			for (std::string &sContent : contents) {
+				while (sContent.size() < cbDocument) {
+					uSeed = uSeed * 1103515245 + 12345;
+					sContent.append(apszWords[(uSeed >> 16) % _countof(apszWords)]).append(1, ' ');
+					sContent.append(std::to_string((uSeed >> 8) % 1000)).append(1, ' ');
+				}
+			}
+			contents[1234].append("ghp_TOKEN0123456");
+
+			double dStart = Now();
+			ADSX::Trigram::CExtractor extractor;
+			std::vector<ADSX::Trigram::Document> documents(cDocuments);
+			for (std::size_t i = 0; i < cDocuments; i++) {
+				extractor.Add(reinterpret_cast<const unsigned char *>(contents[i].data()), contents[i].size());
+				documents[i].sPath = L"dir\\file" + std::to_wstring(i) + L".txt:stream";
+				documents[i].ullSize = contents[i].size();
+				documents[i].bIndexed = true;
+				documents[i].trigrams = extractor.Take();
+			}
+			const double dExtract = Now() - dStart;
+			dStart = Now();
+			const std::vector<unsigned char> bytes = ADSX::Trigram::CIndex::Build(std::move(documents));
+			const double dBuild = Now() - dStart;
+			ULONGLONG cbContent = 0;
+			for (const std::string &sContent : contents) cbContent += sContent.size();
+
+			ADSX::Trigram::CIndex index;
+			Assert::IsTrue(index.Attach(bytes.data(), bytes.size()));
+			const ULONG cQueries = 1000;
+			std::vector<ADSX::Trigram::Name> candidates;
+			dStart = Now();
+			for (ULONG i = 0; i < cQueries; i++) index.Candidates({"ghp_TOKEN0123456"}, &candidates);
+			const double dQuery = (Now() - dStart) / cQueries;
+			Assert::AreEqual(std::size_t(1), candidates.size());
+			dStart = Now();
+			for (ULONG i = 0; i < cQueries; i++) index.Candidates({"stream"}, &candidates);
+			const double dCommonQuery = (Now() - dStart) / cQueries;
+
+			WCHAR szMessage[256];
+			swprintf_s(
+				szMessage,
+				L"Trigram index: %.0f MB/s to extract, %.0f MB/s to lay out; %llu bytes for %llu bytes of streams (%.1f%%)\n",
+				cbContent / dExtract / 1e6,
+				cbContent / dBuild / 1e6,
+				static_cast<ULONGLONG>(bytes.size()),
+				cbContent,
+				bytes.size() * 100.0 / cbContent
+			);
+			Logger::WriteMessage(szMessage);
+			swprintf_s(
+				szMessage,
+				L"Trigram index query: %.1f us for a rare literal, %.1f us for a common one (%llu of %llu candidates)\n",
+				dQuery * 1e6,
+				dCommonQuery * 1e6,
+				static_cast<ULONGLONG>(candidates.size()),
+				static_cast<ULONGLONG>(cDocuments)
+			);
+			Logger::WriteMessage(szMessage);
+		}
+	};
+
+	TEST_CLASS(BenchStreamContents) {
+	  public:
+		TEST_METHOD(BenchRead) {
+			// A 64 MB stream on a file in %TEMP%, read once first so every
+			// run is reading the same warm cache
+			static const ULONG cbStream = 64 * 1024 * 1024;
+			static const ULONG cbRead = 64 * 1024;
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			const std::wstring sFile = std::wstring(szTemp) + L"ADSX Bench Contents";
+			const std::wstring sStream = sFile + L":bench";
+			defer({ DeleteFileW(sFile.c_str()); });
+			{
+				HANDLE hStream = CreateFileW(
+					sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL
+				);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				std::vector<BYTE> chunk(cbRead);
+				for (ULONG ib = 0; ib < cbStream; ib += cbRead) {
+					for (ULONG i = 0; i < cbRead; i++) chunk[i] = static_cast<BYTE>((ib + i) * 2654435761u >> 24);
+					DWORD cbWritten;
+					Assert::IsTrue(WriteFile(hStream, chunk.data(), cbRead, &cbWritten, NULL) != FALSE);
+				}
+			}
+			std::vector<BYTE> buf(cbRead);
+
+			// Before: ReadFile through a buffer of our own
+			{
+				const double dStart = Now();
+				HANDLE hStream = CreateFileW(
+					sStream.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+					FILE_FLAG_SEQUENTIAL_SCAN, NULL
+				);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				ULONGLONG cbTotal = 0;
+				DWORD cbDone;
+				while (ReadFile(hStream, buf.data(), cbRead, &cbDone, NULL) && cbDone != 0) cbTotal += cbDone;
+				Assert::AreEqual(cbTotal, static_cast<ULONGLONG>(cbStream));
+				ReportRate(L"Before (ReadFile, 64 KB at a time)", cbTotal, Now() - dStart);
+			}
+
+			// After: sequential reads out of the view
+			{
+				const double dStart = Now();
+				CComPtr<IStream> pStream;
+				Assert::AreEqual(ADSX::CStreamContents::Create(sStream.c_str(), cbStream, &pStream), S_OK);
+				ULONGLONG cbTotal = 0;
+				ULONG cbDone;
+				while (SUCCEEDED(pStream->Read(buf.data(), cbRead, &cbDone)) && cbDone != 0) cbTotal += cbDone;
+				Assert::AreEqual(cbTotal, static_cast<ULONGLONG>(cbStream));
+				ReportRate(L"After (Read, 64 KB at a time)", cbTotal, Now() - dStart);
+			}
+
+			// Random 4 KB reads, as a previewer skipping around would
+			{
+				CComPtr<IStream> pStream;
+				Assert::AreEqual(ADSX::CStreamContents::Create(sStream.c_str(), cbStream, &pStream), S_OK);
+				static const ULONG cReads = 100000;
+				UINT32 uState = 1;
+				const double dStart = Now();
+				for (ULONG i = 0; i < cReads; i++) {
+					uState = uState * 1664525u + 1013904223u;
+					LARGE_INTEGER liOffset;
+					liOffset.QuadPart = (uState % (cbStream / 4096)) * 4096LL;
+					Assert::AreEqual(pStream->Seek(liOffset, STREAM_SEEK_SET, NULL), S_OK);
+					ULONG cbDone;
+					Assert::AreEqual(pStream->Read(buf.data(), 4096, &cbDone), S_OK);
+				}
+				Report(L"After (Seek + 4 KB Read)", cReads, Now() - dStart);
+			}
+
+			// CopyTo, which hands the view straight to the other stream
+			{
+				CComPtr<IStream> pStream;
+				Assert::AreEqual(ADSX::CStreamContents::Create(sStream.c_str(), cbStream, &pStream), S_OK);
+				CComPtr<IStream> pSink;
+				pSink.Attach(SHCreateMemStream(NULL, 0));
+				Assert::IsNotNull(pSink.p);
+				ULARGE_INTEGER uliSize;
+				uliSize.QuadPart = cbStream;
+				Assert::AreEqual(pSink->SetSize(uliSize), S_OK);
+				ULARGE_INTEGER uliAll, uliRead, uliWritten;
+				uliAll.QuadPart = ~0ULL;
+				const double dStart = Now();
+				Assert::AreEqual(pStream->CopyTo(pSink, uliAll, &uliRead, &uliWritten), S_OK);
+				const double dElapsed = Now() - dStart;
+				Assert::AreEqual(uliWritten.QuadPart, static_cast<ULONGLONG>(cbStream));
+				ReportRate(L"After (CopyTo a memory stream)", uliRead.QuadPart, dElapsed);
+			}
+		}
+	};
+
+	TEST_CLASS(BenchCopyEngine) {
+	  public:
+		TEST_METHOD(BenchCopy) {
+			// A 256 MB stream copied out to a file beside it; big enough that
+			// the cache can't hide the disk
+			static const ULONG cbStream = 256 * 1024 * 1024;
+			static const ULONG cbChunk = 64 * 1024;
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			const std::wstring sFile = std::wstring(szTemp) + L"ADSX Bench Copy";
+			const std::wstring sStream = sFile + L":bench";
+			const std::wstring sCopy = sFile + L" (copy)";
+			defer({
+				DeleteFileW(sFile.c_str());
+				DeleteFileW(sCopy.c_str());
+			});
+			std::vector<BYTE> chunk(cbChunk);
+			{
+				HANDLE hStream = CreateFileW(
+					sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL
+				);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				for (ULONG ib = 0; ib < cbStream; ib += cbChunk) {
+					for (ULONG i = 0; i < cbChunk; i++) chunk[i] = static_cast<BYTE>((ib + i) * 2654435761u >> 24);
+					DWORD cbWritten;
+					Assert::IsTrue(WriteFile(hStream, chunk.data(), cbChunk, &cbWritten, NULL) != FALSE);
+				}
+			}
+
+			// Before: ReadFile and WriteFile in turn, through the cache
+			{
+				DeleteFileW(sCopy.c_str());
+				const double dStart = Now();
+				HANDLE hStream = CreateFileW(
+					sStream.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+					FILE_FLAG_SEQUENTIAL_SCAN, NULL
+				);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				HANDLE hCopy = CreateFileW(sCopy.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+				Assert::AreNotEqual(hCopy, INVALID_HANDLE_VALUE);
+				ULONGLONG cbTotal = 0;
+				DWORD cbDone, cbWritten;
+				while (ReadFile(hStream, chunk.data(), cbChunk, &cbDone, NULL) && cbDone != 0) {
+					Assert::IsTrue(WriteFile(hCopy, chunk.data(), cbDone, &cbWritten, NULL) != FALSE);
+					cbTotal += cbDone;
+				}
+				// Timed to when it's on the disk, as the engine's is
+				Assert::IsTrue(FlushFileBuffers(hCopy) != FALSE);
+				CloseHandle(hCopy);
+				Assert::AreEqual(cbTotal, static_cast<ULONGLONG>(cbStream));
+				ReportRate(L"Before (ReadFile + WriteFile, 64 KB at a time)", cbTotal, Now() - dStart);
+			}
+
+			// After: the pipelined, unbuffered copy
+			{
+				DeleteFileW(sCopy.c_str());
+				ADSX::CCopyEngine::Stats stats;
+				const double dStart = Now();
+				Assert::AreEqual(ADSX::CCopyEngine::Copy({{sStream, sCopy, cbStream}}, nullptr, &stats), S_OK);
+				const double dElapsed = Now() - dStart;
+				Assert::AreEqual(stats.cbCopied, static_cast<ULONGLONG>(cbStream));
+				ReportRate(L"After (CCopyEngine::Copy)", stats.cbCopied, dElapsed);
+			}
+		}
+	};
+}
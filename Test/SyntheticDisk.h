@@ -0,0 +1,206 @@
+#pragma once
+
+#include "DiskImage.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+// Builds disk images around a volume image: a raw disk with an MBR or GPT
+// partition table, and that disk in a fixed or dynamic VHD or in a VHDX.
+// Blocks of the disk that are all zeros are left out of the dynamic formats,
+// the way they would be on a real disk that was mostly empty.
+namespace SyntheticDisk {
+
+constexpr std::uint64_t ibPartition = 1024 * 1024;
+
+template <typename T>
+inline void StoreLittleEndian(unsigned char *pb, T t) {
+	std::memcpy(pb, &t, sizeof(T));
+}
+
+template <typename T>
+inline void StoreBigEndian(unsigned char *pb, T t) {
+	for (std::size_t i = 0; i < sizeof(T); i++) {
+		pb[i] = static_cast<unsigned char>(t >> (8 * (sizeof(T) - 1 - i)));
+	}
+}
+
+// The volume as the only partition on a disk, at 1 MB, and 1 MB spare after
+inline std::vector<unsigned char> MakeDisk(const std::vector<unsigned char> &volume, bool bGpt) {
+	const std::uint64_t cbDisk = ibPartition + volume.size() + 1024 * 1024;
+	std::vector<unsigned char> disk(static_cast<std::size_t>(cbDisk));
+	std::memcpy(&disk[ibPartition], volume.data(), volume.size());
+	const std::uint32_t ulFirstLba = static_cast<std::uint32_t>(ibPartition / 512);
+	const std::uint32_t cSectors = static_cast<std::uint32_t>(volume.size() / 512);
+
+	unsigned char *pbEntry = &disk[ADSX::Disk::Mbr::cbOffEntries];
+	if (bGpt) {
+		pbEntry[ADSX::Disk::Mbr::cbOffType] = ADSX::Disk::Mbr::TYPE_GPT_PROTECTIVE;
+		StoreLittleEndian<std::uint32_t>(pbEntry + ADSX::Disk::Mbr::cbOffFirstLba, 1);
+		StoreLittleEndian<std::uint32_t>(pbEntry + ADSX::Disk::Mbr::cbOffSectorCount, static_cast<std::uint32_t>(cbDisk / 512 - 1));
+
+		// Header at LBA 1, entries from LBA 2; one used, one not
+		unsigned char *pbHeader = &disk[512];
+		std::memcpy(pbHeader, "EFI PART", 8);
+		StoreLittleEndian<std::uint64_t>(pbHeader + ADSX::Disk::Gpt::cbOffEntriesLba, 2);
+		StoreLittleEndian<std::uint32_t>(pbHeader + ADSX::Disk::Gpt::cbOffEntryCount, 2);
+		StoreLittleEndian<std::uint32_t>(pbHeader + ADSX::Disk::Gpt::cbOffEntrySize, 128);
+		unsigned char *pbGptEntry = &disk[1024];
+		// Basic data partition
+		static const unsigned char abType[16] = {
+			0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44,
+			0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7,
+		};
+		std::memcpy(pbGptEntry, abType, 16);
+		StoreLittleEndian<std::uint64_t>(pbGptEntry + ADSX::Disk::Gpt::cbOffFirstLba, ulFirstLba);
+		StoreLittleEndian<std::uint64_t>(pbGptEntry + ADSX::Disk::Gpt::cbOffLastLba, ulFirstLba + cSectors - 1);
+	} else {
+		pbEntry[ADSX::Disk::Mbr::cbOffType] = 0x07;  // NTFS
+		StoreLittleEndian<std::uint32_t>(pbEntry + ADSX::Disk::Mbr::cbOffFirstLba, ulFirstLba);
+		StoreLittleEndian<std::uint32_t>(pbEntry + ADSX::Disk::Mbr::cbOffSectorCount, cSectors);
+	}
+	disk[510] = 0x55;
+	disk[511] = 0xAA;
+	return disk;
+}
+
+inline std::vector<unsigned char> VhdFooter(std::uint64_t cbDisk, std::uint32_t uDiskType, std::uint64_t ibHeader) {
+	using namespace ADSX::Disk::Vhd;
+	std::vector<unsigned char> footer(cbFooter);
+	std::memcpy(footer.data(), "conectix", 8);
+	StoreBigEndian<std::uint32_t>(&footer[8], 2);           // features
+	StoreBigEndian<std::uint32_t>(&footer[12], 0x00010000);  // version
+	StoreBigEndian<std::uint64_t>(&footer[cbOffDataOffset], ibHeader);
+	StoreBigEndian<std::uint64_t>(&footer[40], cbDisk);      // original size
+	StoreBigEndian<std::uint64_t>(&footer[cbOffCurrentSize], cbDisk);
+	StoreBigEndian<std::uint32_t>(&footer[cbOffDiskType], uDiskType);
+	StoreBigEndian<std::uint32_t>(&footer[cbOffChecksum], Checksum(footer.data(), cbFooter, cbOffChecksum));
+	return footer;
+}
+
+inline std::vector<unsigned char> MakeVhdFixed(const std::vector<unsigned char> &disk) {
+	using namespace ADSX::Disk::Vhd;
+	std::vector<unsigned char> file(disk);
+	const std::vector<unsigned char> footer = VhdFooter(disk.size(), DISK_FIXED, UINT64_MAX);
+	file.insert(file.end(), footer.begin(), footer.end());
+	return file;
+}
+
+inline bool IsZero(const unsigned char *pb, std::size_t cb) {
+	for (std::size_t i = 0; i < cb; i++) {
+		if (pb[i] != 0) return false;
+	}
+	return true;
+}
+
+inline std::vector<unsigned char> MakeVhdDynamic(const std::vector<unsigned char> &disk, std::uint32_t cbBlock = 512 * 1024) {
+	using namespace ADSX::Disk::Vhd;
+	const std::uint32_t cBlocks = static_cast<std::uint32_t>((disk.size() + cbBlock - 1) / cbBlock);
+	const std::size_t ibHeader = cbFooter;
+	const std::size_t ibBat = ibHeader + cbDynamicHeader;
+	const std::size_t cbBat = (cBlocks * 4 + cbSector - 1) / cbSector * cbSector;
+	const std::size_t cbBitmap = (cbBlock / cbSector / 8 + cbSector - 1) / cbSector * cbSector;
+
+	std::vector<unsigned char> file(ibBat + cbBat);
+	const std::vector<unsigned char> footer = VhdFooter(disk.size(), DISK_DYNAMIC, ibHeader);
+	std::memcpy(file.data(), footer.data(), cbFooter);
+
+	unsigned char *pbHeader = &file[ibHeader];
+	std::memcpy(pbHeader, "cxsparse", 8);
+	StoreBigEndian<std::uint64_t>(pbHeader + 8, UINT64_MAX);
+	StoreBigEndian<std::uint64_t>(pbHeader + cbOffTableOffset, ibBat);
+	StoreBigEndian<std::uint32_t>(pbHeader + 0x18, 0x00010000);
+	StoreBigEndian<std::uint32_t>(pbHeader + cbOffMaxTableEntries, cBlocks);
+	StoreBigEndian<std::uint32_t>(pbHeader + cbOffBlockSize, cbBlock);
+	StoreBigEndian<std::uint32_t>(pbHeader + cbOffHeaderChecksum, Checksum(pbHeader, cbDynamicHeader, cbOffHeaderChecksum));
+
+	for (std::uint32_t i = 0; i < cBlocks; i++) {
+		const std::size_t ib = static_cast<std::size_t>(i) * cbBlock;
+		const std::size_t cb = (std::min<std::size_t>)(cbBlock, disk.size() - ib);
+		std::uint32_t uSector = uUnallocated;
+		if (!IsZero(&disk[ib], cb)) {
+			uSector = static_cast<std::uint32_t>(file.size() / cbSector);
+			file.resize(file.size() + cbBitmap + cbBlock);
+			std::memset(&file[uSector * cbSector], 0xFF, cbBitmap);
+			std::memcpy(&file[uSector * cbSector + cbBitmap], &disk[ib], cb);
+		}
+		StoreBigEndian<std::uint32_t>(&file[ibBat + i * 4], uSector);
+	}
+	file.insert(file.end(), footer.begin(), footer.end());
+	return file;
+}
+
+inline std::vector<unsigned char> MakeVhdx(const std::vector<unsigned char> &disk, std::uint32_t cbBlock = 1024 * 1024) {
+	using namespace ADSX::Disk::Vhdx;
+	const std::uint32_t cbLogicalSector = 512;
+	const std::uint64_t cChunkRatio = (std::uint64_t(1) << 23) * cbLogicalSector / cbBlock;
+	const std::uint64_t cBlocks = (disk.size() + cbBlock - 1) / cbBlock;
+	const std::uint64_t cEntries = cBlocks + (cBlocks - 1) / cChunkRatio;
+	const std::uint64_t ibMetadata = cbMB;
+	const std::uint64_t ibBat = 2 * cbMB;
+	const std::uint64_t cbBat = (cEntries * 8 + cbMB - 1) / cbMB * cbMB;
+	std::vector<unsigned char> file(static_cast<std::size_t>(ibBat + cbBat));
+	std::memcpy(file.data(), "vhdxfile", 8);
+
+	// Both headers valid; the second is newer
+	for (int i = 0; i < 2; i++) {
+		unsigned char *pbHeader = &file[i == 0 ? ibHeader1 : ibHeader2];
+		std::memcpy(pbHeader, "head", 4);
+		StoreLittleEndian<std::uint64_t>(pbHeader + cbOffSequenceNumber, 10 + i);
+		StoreLittleEndian<std::uint16_t>(pbHeader + cbOffVersion, 1);
+		StoreLittleEndian<std::uint32_t>(pbHeader + cbOffChecksum, ADSX::Disk::Crc32c(pbHeader, cbHeader));
+	}
+
+	for (const std::uint64_t ibTable : {ibRegionTable, ibRegionTable2}) {
+		unsigned char *pbTable = &file[ibTable];
+		std::memcpy(pbTable, "regi", 4);
+		StoreLittleEndian<std::uint32_t>(pbTable + cbOffRegionCount, 2);
+		unsigned char *pbEntry = pbTable + cbRegionTableHeader;
+		std::memcpy(pbEntry, guidBat.ab, 16);
+		StoreLittleEndian<std::uint64_t>(pbEntry + 16, ibBat);
+		StoreLittleEndian<std::uint32_t>(pbEntry + 24, static_cast<std::uint32_t>(cbBat));
+		StoreLittleEndian<std::uint32_t>(pbEntry + 28, 1);
+		pbEntry += cbRegionEntry;
+		std::memcpy(pbEntry, guidMetadata.ab, 16);
+		StoreLittleEndian<std::uint64_t>(pbEntry + 16, ibMetadata);
+		StoreLittleEndian<std::uint32_t>(pbEntry + 24, static_cast<std::uint32_t>(cbMB));
+		StoreLittleEndian<std::uint32_t>(pbEntry + 28, 1);
+		StoreLittleEndian<std::uint32_t>(pbTable + cbOffChecksum, ADSX::Disk::Crc32c(pbTable, cbRegionTable));
+	}
+
+	// The items go after the table
+	unsigned char *pbMetadata = &file[ibMetadata];
+	std::memcpy(pbMetadata, "metadata", 8);
+	StoreLittleEndian<std::uint16_t>(pbMetadata + cbOffMetadataCount, 3);
+	const Guid *apGuid[] = {&guidFileParameters, &guidVirtualDiskSize, &guidLogicalSectorSize};
+	for (std::uint32_t i = 0; i < 3; i++) {
+		unsigned char *pbEntry = pbMetadata + cbMetadataTableHeader + i * cbMetadataEntry;
+		const std::uint32_t ibItem = static_cast<std::uint32_t>(cbMetadataTable + i * 8);
+		std::memcpy(pbEntry, apGuid[i]->ab, 16);
+		StoreLittleEndian<std::uint32_t>(pbEntry + 16, ibItem);
+		StoreLittleEndian<std::uint32_t>(pbEntry + 20, 8);
+		StoreLittleEndian<std::uint32_t>(pbEntry + 24, METADATA_REQUIRED);
+	}
+	StoreLittleEndian<std::uint32_t>(pbMetadata + cbMetadataTable, cbBlock);
+	StoreLittleEndian<std::uint64_t>(pbMetadata + cbMetadataTable + 8, disk.size());
+	StoreLittleEndian<std::uint32_t>(pbMetadata + cbMetadataTable + 16, cbLogicalSector);
+
+	for (std::uint64_t i = 0; i < cBlocks; i++) {
+		const std::size_t ib = static_cast<std::size_t>(i * cbBlock);
+		const std::size_t cb = (std::min<std::size_t>)(cbBlock, disk.size() - ib);
+		std::uint64_t ullEntry = PAYLOAD_NOT_PRESENT;
+		if (!IsZero(&disk[ib], cb)) {
+			const std::uint64_t ibBlock = file.size();
+			file.resize(file.size() + cbBlock);
+			std::memcpy(&file[static_cast<std::size_t>(ibBlock)], &disk[ib], cb);
+			ullEntry = PAYLOAD_FULLY_PRESENT | (ibBlock / cbMB) << 20;
+		}
+		const std::uint64_t iEntry = i + i / cChunkRatio;
+		StoreLittleEndian<std::uint64_t>(&file[static_cast<std::size_t>(ibBat + iEntry * 8)], ullEntry);
+	}
+	return file;
+}
+
+}  // namespace SyntheticDisk
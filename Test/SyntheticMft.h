@@ -0,0 +1,391 @@
+#pragma once
+
+#include "Mft.h"
+#include "MftScanner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+// Lays out a small NTFS volume image in memory, with just enough of the real
+// thing for the MFT scanner: a boot sector, an MFT (in one piece or two, the
+// second found through an attribute list), the root directory, and whatever
+// files and directories a test adds. Non-resident streams get clusters of
+// their own, in two pieces when there's more than one, holding PatternByte.
+class CSyntheticVolume {
+  public:
+	static constexpr std::uint32_t cbSector = 512;
+	static constexpr std::uint32_t cbCluster = 4096;
+	static constexpr std::uint32_t cbRecord = 1024;
+	static constexpr std::uint64_t ullMftLcn = 16;
+	static constexpr std::uint16_t uSequence = 1;
+	// Where $MFT's second data extent is described, when it has one
+	static constexpr std::uint64_t ullMftExtension = 15;
+
+	struct Stream {
+		ADSX::Mft::Name sName;
+		std::uint64_t ullSize;
+		bool bNonResident;
+	};
+
+	// What byte ib of every non-resident stream is; resident ones are 'x'
+	static unsigned char PatternByte(std::uint64_t ib) {
+		return static_cast<unsigned char>(ib * 31 + 7);
+	}
+
+	/**
+	 * @param cRecords: how many records the MFT has room for.
+	 * @param bSplitMft: put the second half of the MFT somewhere else on the
+	 *        volume, and describe it from an extension record through
+	 *        $MFT's attribute list.
+	 */
+	CSyntheticVolume(std::uint64_t cRecords, bool bSplitMft)
+		: m_cRecords(cRecords)
+		, m_bSplitMft(bSplitMft)
+		, m_ullNext(ADSX::Mft::ullRecordFirstUser)
+		, m_records(cRecords) {
+		const std::uint64_t cMftClusters = m_cRecords * cbRecord / cbCluster;
+		m_cFirstClusters = m_bSplitMft ? cMftClusters / 2 : cMftClusters;
+		m_cSecondClusters = cMftClusters - m_cFirstClusters;
+		// Leave a gap so reading the MFT as one piece would go wrong
+		m_ullSecondLcn = ullMftLcn + m_cFirstClusters + 32;
+		m_ullNextLcn = m_ullSecondLcn + m_cSecondClusters + 16;
+		// The root is its own parent
+		AddRecord(ADSX::Mft::ullRecordRoot, ADSX::Mft::ullRecordRoot, Ascii(".", 1), true, {}, false);
+	}
+
+	static ADSX::Mft::Name Ascii(const char *psz, std::size_t cch) {
+		return ADSX::Mft::Name(psz, psz + cch);
+	}
+
+	static std::uint64_t Reference(std::uint64_t ullRecord, std::uint16_t uSeq = uSequence) {
+		return static_cast<std::uint64_t>(uSeq) << 48 | ullRecord;
+	}
+
+	/**
+	 * Add a file or directory under ullParent.
+	 * @param bSpill: put its streams in an extension record, listed in an
+	 *        attribute list in the file's own record.
+	 * @return: its record number.
+	 */
+	std::uint64_t Add(
+		std::uint64_t              ullParent,
+		const ADSX::Mft::Name      &sName,
+		bool                       bDirectory,
+		const std::vector<Stream>  &streams = {},
+		bool                       bSpill = false
+	) {
+		const std::uint64_t ullRecord = m_ullNext++;
+		if (bSpill) m_ullNext++;  // the extension goes right after
+		AddRecord(ullRecord, ullParent, sName, bDirectory, streams, bSpill);
+		return ullRecord;
+	}
+
+	// An extension record claiming to belong to ullBase under an old
+	// sequence number, as if left over from a deleted file.
+	void AddStaleExtension(std::uint64_t ullBase, const std::vector<Stream> &streams) {
+		const std::uint64_t ullRecord = m_ullNext++;
+		CRecordWriter writer(ullRecord, true, false, Reference(ullBase, uSequence + 5));
+		for (const Stream &stream : streams) AddData(&writer, stream);
+		m_records[ullRecord] = writer.Finish();
+	}
+
+	// A record whose last sector never made it to the disk.
+	void AddTornRecord() {
+		const std::uint64_t ullRecord = m_ullNext++;
+		CRecordWriter writer(ullRecord, true, false, 0);
+		std::vector<unsigned char> record = writer.Finish();
+		record[cbRecord - 2] ^= 0xFF;
+		m_records[ullRecord] = std::move(record);
+	}
+
+	// A deleted file: all there, but not in use.
+	void AddDeleted(std::uint64_t ullParent, const ADSX::Mft::Name &sName, const std::vector<Stream> &streams) {
+		const std::uint64_t ullRecord = m_ullNext++;
+		CRecordWriter writer(ullRecord, false, false, 0);
+		writer.AddFileName(Reference(ullParent), sName, ADSX::Mft::NS_WIN32_AND_DOS);
+		for (const Stream &stream : streams) AddData(&writer, stream);
+		m_records[ullRecord] = writer.Finish();
+	}
+
+	std::vector<unsigned char> Build() {
+		const std::uint64_t cMftClusters = m_cFirstClusters + m_cSecondClusters;
+		const std::uint64_t cFirstClusters = m_cFirstClusters;
+		const std::uint64_t cSecondClusters = m_cSecondClusters;
+		const std::uint64_t ullSecondLcn = m_ullSecondLcn;
+		const std::uint64_t cClusters = m_ullNextLcn + 16;
+
+		// $MFT itself
+		{
+			CRecordWriter writer(ADSX::Mft::ullRecordMft, true, false, 0);
+			writer.AddFileName(Reference(ADSX::Mft::ullRecordRoot), Ascii("$MFT", 4), ADSX::Mft::NS_WIN32_AND_DOS);
+			const std::uint64_t cbMft = m_cRecords * cbRecord;
+			if (m_bSplitMft) {
+				std::vector<unsigned char> list;
+				AppendListEntry(&list, ADSX::Mft::ATTR_DATA, 0, Reference(ADSX::Mft::ullRecordMft));
+				AppendListEntry(&list, ADSX::Mft::ATTR_DATA, cFirstClusters, Reference(ullMftExtension));
+				writer.AddResident(ADSX::Mft::ATTR_ATTRIBUTE_LIST, {}, list);
+			}
+			writer.AddNonResident(
+				ADSX::Mft::ATTR_DATA, {}, 0, cFirstClusters - 1,
+				EncodeRuns({{ullMftLcn, cFirstClusters}}), cbMft
+			);
+			m_records[ADSX::Mft::ullRecordMft] = writer.Finish();
+		}
+		if (m_bSplitMft) {
+			CRecordWriter writer(ullMftExtension, true, false, Reference(ADSX::Mft::ullRecordMft));
+			writer.AddNonResident(
+				ADSX::Mft::ATTR_DATA, {}, cFirstClusters, cMftClusters - 1,
+				EncodeRuns({{ullSecondLcn, cSecondClusters}}), 0
+			);
+			m_records[ullMftExtension] = writer.Finish();
+		}
+
+		std::vector<unsigned char> image(cClusters * cbCluster);
+		unsigned char *pbBoot = image.data();
+		std::memcpy(pbBoot + ADSX::Mft::cbOffOemId, "NTFS    ", 8);
+		Store<std::uint16_t>(pbBoot + ADSX::Mft::cbOffBytesPerSector, cbSector);
+		pbBoot[ADSX::Mft::cbOffSectorsPerCluster] = cbCluster / cbSector;
+		Store<std::uint64_t>(pbBoot + ADSX::Mft::cbOffTotalSectors, cClusters * cbCluster / cbSector - 1);
+		Store<std::uint64_t>(pbBoot + ADSX::Mft::cbOffMftLcn, ullMftLcn);
+		pbBoot[ADSX::Mft::cbOffClustersPerRecord] = static_cast<unsigned char>(-10);  // 2^10
+		Store<std::uint64_t>(pbBoot + ADSX::Mft::cbOffSerialNumber, 0x1234567890ABCDEFull);
+		pbBoot[510] = 0x55;
+		pbBoot[511] = 0xAA;
+
+		for (std::uint64_t ullRecord = 0; ullRecord < m_cRecords; ullRecord++) {
+			const std::vector<unsigned char> &record = m_records[ullRecord];
+			if (record.empty()) continue;
+			const std::uint64_t ullVcn = ullRecord * cbRecord / cbCluster;
+			const std::uint64_t ullLcn = ullVcn < cFirstClusters ?
+				ullMftLcn + ullVcn :
+				ullSecondLcn + (ullVcn - cFirstClusters);
+			const std::uint64_t ib = ullLcn * cbCluster + ullRecord * cbRecord % cbCluster;
+			std::memcpy(&image[ib], record.data(), cbRecord);
+		}
+		for (const Extent &extent : m_extents) {
+			for (std::uint64_t ib = 0; ib < extent.cb; ib++) {
+				image[extent.ullLcn * cbCluster + ib] = PatternByte(extent.ibStream + ib);
+			}
+		}
+		return image;
+	}
+
+  private:
+	template <typename T>
+	static void Store(unsigned char *pb, T t) {
+		std::memcpy(pb, &t, sizeof(T));
+	}
+
+	class CRecordWriter {
+	  public:
+		CRecordWriter(std::uint64_t ullRecord, bool bInUse, bool bDirectory, std::uint64_t ullBase)
+			: m_record(cbRecord)
+			, m_ib(0x38)
+			, m_uNextId(0) {
+			unsigned char *pb = m_record.data();
+			std::memcpy(pb, "FILE", 4);
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffUsaOffset, 0x30);
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffUsaCount, 1 + cbRecord / ADSX::Mft::cbFixupStride);
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffSequenceNumber, uSequence);
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffFirstAttribute, 0x38);
+			Store<std::uint16_t>(
+				pb + ADSX::Mft::cbOffRecordFlags,
+				(bInUse ? ADSX::Mft::RECORD_IN_USE : 0) | (bDirectory ? ADSX::Mft::RECORD_DIRECTORY : 0)
+			);
+			Store<std::uint32_t>(pb + 0x1C, cbRecord);
+			Store<std::uint64_t>(pb + ADSX::Mft::cbOffBaseRecord, ullBase);
+			Store<std::uint32_t>(pb + 0x2C, static_cast<std::uint32_t>(ullRecord));
+		}
+
+		void AddFileName(std::uint64_t ullParentReference, const ADSX::Mft::Name &sName, std::uint8_t uNamespace) {
+			std::vector<unsigned char> value(ADSX::Mft::cbOffFileName + sName.size() * 2);
+			Store<std::uint64_t>(value.data() + ADSX::Mft::cbOffParentReference, ullParentReference);
+			value[ADSX::Mft::cbOffFileNameLength] = static_cast<unsigned char>(sName.size());
+			value[ADSX::Mft::cbOffFileNameNamespace] = uNamespace;
+			std::memcpy(value.data() + ADSX::Mft::cbOffFileName, sName.data(), sName.size() * 2);
+			AddResident(ADSX::Mft::ATTR_FILE_NAME, {}, value);
+		}
+
+		void AddResident(std::uint32_t uType, const ADSX::Mft::Name &sName, const std::vector<unsigned char> &value) {
+			const std::size_t ibName = ADSX::Mft::cbResidentHeader;
+			const std::size_t ibValue = Align8(ibName + sName.size() * 2);
+			const std::size_t cbAttr = Align8(ibValue + value.size());
+			unsigned char *pb = Header(uType, sName, false, cbAttr, ibName);
+			Store<std::uint32_t>(pb + ADSX::Mft::cbOffValueLength, static_cast<std::uint32_t>(value.size()));
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffValueOffset, static_cast<std::uint16_t>(ibValue));
+			if (!value.empty()) std::memcpy(pb + ibValue, value.data(), value.size());
+		}
+
+		void AddNonResident(
+			std::uint32_t                    uType,
+			const ADSX::Mft::Name            &sName,
+			std::uint64_t                    ullLowestVcn,
+			std::uint64_t                    ullHighestVcn,
+			const std::vector<unsigned char> &runs,
+			std::uint64_t                    ullDataSize
+		) {
+			const std::size_t ibName = ADSX::Mft::cbNonResidentHeader;
+			const std::size_t ibRuns = Align8(ibName + sName.size() * 2);
+			const std::size_t cbAttr = Align8(ibRuns + runs.size());
+			unsigned char *pb = Header(uType, sName, true, cbAttr, ibName);
+			Store<std::uint64_t>(pb + ADSX::Mft::cbOffLowestVcn, ullLowestVcn);
+			Store<std::uint64_t>(pb + ADSX::Mft::cbOffHighestVcn, ullHighestVcn);
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffRunsOffset, static_cast<std::uint16_t>(ibRuns));
+			Store<std::uint64_t>(pb + ADSX::Mft::cbOffAllocatedSize, (ullHighestVcn + 1 - ullLowestVcn) * cbCluster);
+			Store<std::uint64_t>(pb + ADSX::Mft::cbOffDataSize, ullDataSize);
+			Store<std::uint64_t>(pb + 0x38, ullDataSize);
+			std::memcpy(pb + ibRuns, runs.data(), runs.size());
+		}
+
+		// End the attributes and protect the sectors.
+		std::vector<unsigned char> Finish() {
+			unsigned char *pb = m_record.data();
+			Store<std::uint32_t>(pb + m_ib, ADSX::Mft::ATTR_END);
+			Store<std::uint32_t>(pb + ADSX::Mft::cbOffBytesInUse, static_cast<std::uint32_t>(m_ib + 8));
+			Store<std::uint16_t>(pb + 0x28, m_uNextId);
+			const std::uint16_t uUsn = 0x0042;
+			Store<std::uint16_t>(pb + 0x30, uUsn);
+			for (std::size_t i = 1; i <= cbRecord / ADSX::Mft::cbFixupStride; i++) {
+				unsigned char *pbTail = pb + i * ADSX::Mft::cbFixupStride - 2;
+				std::memcpy(pb + 0x30 + 2 * i, pbTail, 2);
+				Store<std::uint16_t>(pbTail, uUsn);
+			}
+			return std::move(m_record);
+		}
+
+	  private:
+		static std::size_t Align8(std::size_t cb) { return (cb + 7) & ~std::size_t(7); }
+
+		unsigned char *Header(
+			std::uint32_t         uType,
+			const ADSX::Mft::Name &sName,
+			bool                  bNonResident,
+			std::size_t           cbAttr,
+			std::size_t           ibName
+		) {
+			// Leave room for the end marker
+			if (m_ib + cbAttr + 8 > cbRecord) throw std::length_error("record full");
+			unsigned char *pb = m_record.data() + m_ib;
+			Store<std::uint32_t>(pb + ADSX::Mft::cbOffAttrType, uType);
+			Store<std::uint32_t>(pb + ADSX::Mft::cbOffAttrLength, static_cast<std::uint32_t>(cbAttr));
+			pb[ADSX::Mft::cbOffAttrNonResident] = bNonResident ? 1 : 0;
+			pb[ADSX::Mft::cbOffAttrNameLength] = static_cast<unsigned char>(sName.size());
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffAttrNameOffset, static_cast<std::uint16_t>(ibName));
+			Store<std::uint16_t>(pb + ADSX::Mft::cbOffAttrId, m_uNextId++);
+			if (!sName.empty()) std::memcpy(pb + ibName, sName.data(), sName.size() * 2);
+			m_ib += cbAttr;
+			return pb;
+		}
+
+		std::vector<unsigned char> m_record;
+		std::size_t m_ib;
+		std::uint16_t m_uNextId;
+	};
+
+	// Where a piece of a stream's contents goes
+	struct Extent {
+		std::uint64_t ullLcn;
+		std::uint64_t ibStream;
+		std::uint64_t cb;
+	};
+
+	void AddData(CRecordWriter *pWriter, const Stream &stream) {
+		if (!stream.bNonResident) {
+			pWriter->AddResident(ADSX::Mft::ATTR_DATA, stream.sName, std::vector<unsigned char>(stream.ullSize, 'x'));
+			return;
+		}
+		// In two pieces with a cluster between them, so reading it as one
+		// would go wrong
+		const std::uint64_t cClusters = (stream.ullSize + cbCluster - 1) / cbCluster;
+		const std::uint64_t cFirst = (cClusters + 1) / 2;
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> runs = {{m_ullNextLcn, cFirst}};
+		if (cClusters > cFirst) runs.push_back({m_ullNextLcn + cFirst + 1, cClusters - cFirst});
+		std::uint64_t ibStream = 0;
+		for (const auto &run : runs) {
+			const std::uint64_t cb = (std::min)(run.second * cbCluster, stream.ullSize - ibStream);
+			m_extents.push_back(Extent{run.first, ibStream, cb});
+			ibStream += cb;
+		}
+		m_ullNextLcn += cClusters + 1;
+		pWriter->AddNonResident(
+			ADSX::Mft::ATTR_DATA, stream.sName, 0, cClusters - 1, EncodeRuns(runs), stream.ullSize
+		);
+	}
+
+	static std::vector<unsigned char> EncodeRuns(const std::vector<std::pair<std::uint64_t, std::uint64_t>> &runs) {
+		std::vector<unsigned char> out;
+		std::int64_t llPrevious = 0;
+		for (const auto &run : runs) {
+			const std::int64_t llDelta = static_cast<std::int64_t>(run.first) - llPrevious;
+			llPrevious = static_cast<std::int64_t>(run.first);
+			out.push_back(0x88);
+			for (int i = 0; i < 8; i++) out.push_back(static_cast<unsigned char>(run.second >> (8 * i)));
+			for (int i = 0; i < 8; i++) out.push_back(static_cast<unsigned char>(llDelta >> (8 * i)));
+		}
+		out.push_back(0);
+		return out;
+	}
+
+	static void AppendListEntry(
+		std::vector<unsigned char> *pList,
+		std::uint32_t              uType,
+		std::uint64_t              ullLowestVcn,
+		std::uint64_t              ullReference,
+		const ADSX::Mft::Name      &sName = {}
+	) {
+		const std::size_t ib = pList->size();
+		const std::size_t cb = (ADSX::Mft::cbListEntryHeader + sName.size() * 2 + 7) & ~std::size_t(7);
+		pList->resize(ib + cb);
+		unsigned char *pb = pList->data() + ib;
+		Store<std::uint32_t>(pb + ADSX::Mft::cbOffListType, uType);
+		Store<std::uint16_t>(pb + ADSX::Mft::cbOffListLength, static_cast<std::uint16_t>(cb));
+		pb[ADSX::Mft::cbOffListNameLength] = static_cast<unsigned char>(sName.size());
+		pb[ADSX::Mft::cbOffListNameOffset] = ADSX::Mft::cbListEntryHeader;
+		Store<std::uint64_t>(pb + ADSX::Mft::cbOffListLowestVcn, ullLowestVcn);
+		Store<std::uint64_t>(pb + ADSX::Mft::cbOffListReference, ullReference);
+		if (!sName.empty()) std::memcpy(pb + ADSX::Mft::cbListEntryHeader, sName.data(), sName.size() * 2);
+	}
+
+	void AddRecord(
+		std::uint64_t             ullRecord,
+		std::uint64_t             ullParent,
+		const ADSX::Mft::Name     &sName,
+		bool                      bDirectory,
+		const std::vector<Stream> &streams,
+		bool                      bSpill
+	) {
+		CRecordWriter writer(ullRecord, true, bDirectory, 0);
+		if (bSpill) {
+			std::vector<unsigned char> list;
+			AppendListEntry(&list, ADSX::Mft::ATTR_FILE_NAME, 0, Reference(ullRecord));
+			for (const Stream &stream : streams) {
+				AppendListEntry(&list, ADSX::Mft::ATTR_DATA, 0, Reference(ullRecord + 1), stream.sName);
+			}
+			writer.AddResident(ADSX::Mft::ATTR_ATTRIBUTE_LIST, {}, list);
+		}
+		writer.AddFileName(Reference(ullParent), sName, ADSX::Mft::NS_WIN32_AND_DOS);
+		if (bSpill) {
+			CRecordWriter extension(ullRecord + 1, true, false, Reference(ullRecord));
+			for (const Stream &stream : streams) AddData(&extension, stream);
+			m_records[ullRecord + 1] = extension.Finish();
+		} else {
+			for (const Stream &stream : streams) AddData(&writer, stream);
+		}
+		m_records[ullRecord] = writer.Finish();
+	}
+
+	std::uint64_t m_cRecords;
+	bool m_bSplitMft;
+	std::uint64_t m_ullNext;
+	std::vector<std::vector<unsigned char>> m_records;
+	std::uint64_t m_cFirstClusters;
+	std::uint64_t m_cSecondClusters;
+	std::uint64_t m_ullSecondLcn;
+	std::uint64_t m_ullNextLcn;  // the next free cluster for stream contents
+	std::vector<Extent> m_extents;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "StreamInfo.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+// Append one FILE_STREAM_INFORMATION entry to a synthetic buffer, the same
+// way the kernel lays them out.
+inline void PushEntry(
+	std::vector<unsigned char>      &buf,
+	ADSX::StreamInfo::NameView      svName,
+	std::int64_t                    llSize,
+	bool                            bLast
+) {
+	using namespace ADSX::StreamInfo;
+	const std::size_t ibStart = buf.size();
+	const auto cbName = static_cast<std::uint32_t>(svName.size() * sizeof(NameChar));
+	const std::size_t cbEntry = cbEntryHeader + cbName;
+	const std::size_t cbPadded = (cbEntry + cbEntryAlign - 1) & ~(cbEntryAlign - 1);
+	const auto cbNext = static_cast<std::uint32_t>(bLast ? 0 : cbPadded);
+	const std::int64_t llAllocationSize = (llSize + 4095) & ~4095LL;
+
+	buf.resize(ibStart + (bLast ? cbEntry : cbPadded));
+	std::memcpy(&buf[ibStart + cbOffNextEntryOffset], &cbNext, sizeof(cbNext));
+	std::memcpy(&buf[ibStart + cbOffStreamNameLength], &cbName, sizeof(cbName));
+	std::memcpy(&buf[ibStart + cbOffStreamSize], &llSize, sizeof(llSize));
+	std::memcpy(
+		&buf[ibStart + cbOffStreamAllocationSize],
+		&llAllocationSize,
+		sizeof(llAllocationSize)
+	);
+	std::memcpy(&buf[ibStart + cbOffStreamName], svName.data(), cbName);
+}
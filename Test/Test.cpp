@@ -3,13 +3,25 @@
 #include <shtypes.h>
 #include <comutil.h>
 
+#include "ADSXItem.h"
 #include "EnumIDList.h"
+#include "StreamFilter.h"
+#include "StreamProbe.h"
+#include "StreamSnapshot.h"
+#include "SyntheticStreamInfo.h"
+#include "TreeScanner.h"
 #include "defer.h"
 
+#include <atomic>
+#include <algorithm>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CEnumIDList;
 
 
 static const _bstr_t bstrWorkingDir =
@@ -51,6 +63,8 @@ static void DoTest(
 
 
 namespace Test {
+	// The main stream isn't listed, so each file has one stream fewer than its
+	// name says
 	TEST_CLASS(TestCEnumIDList) {
 	  public:
 		TEST_METHOD(Test0Streams0Requested) {
@@ -67,42 +81,344 @@ namespace Test {
 		}
 
 		TEST_METHOD(Test1Stream0Requested) {
-			DoTest("1stream.txt", 1, 0, S_OK);
+			DoTest("1stream.txt", 0, 0, S_OK);
 		}
 		TEST_METHOD(Test1Stream1Requested) {
-			DoTest("1stream.txt", 1, 1, S_OK);
+			DoTest("1stream.txt", 0, 1, S_FALSE);
 		}
 		TEST_METHOD(Test1Stream2Requested) {
-			DoTest("1stream.txt", 1, 2, S_FALSE);
+			DoTest("1stream.txt", 0, 2, S_FALSE);
 		}
 		TEST_METHOD(Test1Stream3Requested) {
-			DoTest("1stream.txt", 1, 3, S_FALSE);
+			DoTest("1stream.txt", 0, 3, S_FALSE);
 		}
 
 		TEST_METHOD(Test2Streams0Requested) {
-			DoTest("2streams.txt", 2, 0, S_OK);
+			DoTest("2streams.txt", 1, 0, S_OK);
 		}
 		TEST_METHOD(Test2Streams1Requested) {
-			DoTest("2streams.txt", 2, 1, S_OK);
+			DoTest("2streams.txt", 1, 1, S_OK);
 		}
 		TEST_METHOD(Test2Streams2Requested) {
-			DoTest("2streams.txt", 2, 2, S_OK);
+			DoTest("2streams.txt", 1, 2, S_FALSE);
 		}
 		TEST_METHOD(Test2Streams3Requested) {
-			DoTest("2streams.txt", 2, 3, S_FALSE);
+			DoTest("2streams.txt", 1, 3, S_FALSE);
 		}
 
 		TEST_METHOD(Test3Streams0Requested) {
-			DoTest("3streams.txt", 3, 0, S_OK);
+			DoTest("3streams.txt", 2, 0, S_OK);
 		}
 		TEST_METHOD(Test3Streams1Requested) {
-			DoTest("3streams.txt", 3, 1, S_OK);
+			DoTest("3streams.txt", 2, 1, S_OK);
 		}
 		TEST_METHOD(Test3Streams2Requested) {
-			DoTest("3streams.txt", 3, 2, S_OK);
+			DoTest("3streams.txt", 2, 2, S_OK);
 		}
 		TEST_METHOD(Test3Streams3Requested) {
-			DoTest("3streams.txt", 3, 3, S_OK);
+			DoTest("3streams.txt", 2, 3, S_FALSE);
+		}
+
+		// 3streams.txt is the main stream plus two alternate ones
+		TEST_METHOD(TestSkipThenNext) {
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+
+			Assert::AreEqual(pEnum->Skip(1), S_OK);
+			PITEMID_CHILD pidls[2];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pEnum->Next(2, pidls, &cFetched), S_FALSE);
+			Assert::AreEqual(cFetched, 1UL);
+			CoTaskMemFree(pidls[0]);
+			Assert::AreEqual(pEnum->Skip(1), S_FALSE);
+		}
+
+		TEST_METHOD(TestResetRewinds) {
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+
+			Assert::AreEqual(pEnum->Skip(2), S_OK);
+			Assert::AreEqual(pEnum->Reset(), S_OK);
+			PITEMID_CHILD pidls[2];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pEnum->Next(2, pidls, &cFetched), S_OK);
+			Assert::AreEqual(cFetched, 2UL);
+			for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+		}
+
+		TEST_METHOD(TestClonePicksUpWhereLeftOff) {
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+
+			Assert::AreEqual(pEnum->Skip(1), S_OK);
+			CComPtr<IEnumIDList> pClone;
+			Assert::AreEqual(pEnum->Clone(&pClone), S_OK);
+			PITEMID_CHILD pidls[2];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pClone->Next(2, pidls, &cFetched), S_FALSE);
+			Assert::AreEqual(cFetched, 1UL);
+			for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+
+			// The original didn't move
+			Assert::AreEqual(pEnum->Skip(1), S_OK);
+		}
+
+		TEST_METHOD(TestAsyncGetsEverything) {
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			Assert::AreEqual(pEnum->StartAsync(false, INFINITE), S_OK);
+
+			// Items may come in more than one batch
+			PITEMID_CHILD pidls[3];
+			ULONG cTotal = 0;
+			HRESULT hr;
+			do {
+				ULONG cFetched = 0;
+				hr = pEnum->Next(3 - cTotal, pidls + cTotal, &cFetched);
+				cTotal += cFetched;
+			} while (hr == S_OK && cTotal < 3);
+			Assert::AreEqual(hr, S_FALSE);
+			Assert::AreEqual(cTotal, 2UL);
+			for (ULONG i = 0; i < cTotal; i++) CoTaskMemFree(pidls[i]);
+		}
+
+		TEST_METHOD(TestBoundedFillsBatches) {
+			// With a time limit but no SHCONTF_ENABLE_ASYNC, Next still hands
+			// back everything in one call like it would synchronously
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			// The counter is for the whole process, so only this test's own
+			// hits count
+			const ULONGLONG cHitsBefore = CEnumIDList::GetStats().cDeadlineHits;
+			Assert::AreEqual(pEnum->StartAsync(true, 60000), S_OK);
+
+			PITEMID_CHILD pidls[3];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pEnum->Next(3, pidls, &cFetched), S_FALSE);
+			Assert::AreEqual(cFetched, 2UL);
+			for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+			Assert::AreEqual(CEnumIDList::GetStats().cDeadlineHits - cHitsBefore, 0ULL);
+		}
+
+		TEST_METHOD(TestNextFromManyThreads) {
+			// Every stream comes out exactly once no matter which thread
+			// asked for it
+			const ULONG cStreams = 5000;
+			std::vector<unsigned char> buf;
+			for (ULONG i = 0; i < cStreams; i++) {
+				const std::wstring sName = L":s" + std::to_wstring(i) + L":$DATA";
+				PushEntry(buf, sName, i, i == cStreams - 1);
+			}
+			ADSX::CStreamSnapshot *pSnapshot;
+			Assert::AreEqual(
+				ADSX::CStreamSnapshot::Create(
+					ADSX::StreamInfo::CReader(buf.data(), buf.size()),
+					&pSnapshot
+				),
+				S_OK
+			);
+			defer({ pSnapshot->Release(); });
+			CComObject<CEnumIDList> *pEnum;
+			Assert::AreEqual(CComObject<CEnumIDList>::CreateInstance(&pEnum), S_OK);
+			pEnum->AddRef();
+			defer({ pEnum->Release(); });
+			Assert::AreEqual(pEnum->Init(pEnum->GetUnknown(), L"many", pSnapshot), S_OK);
+
+			std::vector<std::atomic<int>> acSeen(cStreams);
+			auto fnWorker = [&]() {
+				PITEMID_CHILD pidls[7];
+				ULONG cFetched;
+				HRESULT hr;
+				do {
+					hr = pEnum->Next(7, pidls, &cFetched);
+					for (ULONG i = 0; i < cFetched; i++) {
+						++acSeen[ADSX::CItem::Get(pidls[i])->llFilesize];
+						CoTaskMemFree(pidls[i]);
+					}
+				} while (hr == S_OK);
+			};
+			std::thread threads[4] = {
+				std::thread(fnWorker), std::thread(fnWorker),
+				std::thread(fnWorker), std::thread(fnWorker),
+			};
+			for (std::thread &thread : threads) thread.join();
+			for (ULONG i = 0; i < cStreams; i++) Assert::AreEqual(acSeen[i].load(), 1);
+		}
+
+		TEST_METHOD(TestAsyncThenReset) {
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			Assert::AreEqual(pEnum->StartAsync(false, INFINITE), S_OK);
+
+			PITEMID_CHILD pidls[2];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pEnum->Next(1, pidls, &cFetched), S_OK);
+			CoTaskMemFree(pidls[0]);
+			// Falls back to the snapshot from the start
+			Assert::AreEqual(pEnum->Reset(), S_OK);
+			Assert::AreEqual(pEnum->Next(2, pidls, &cFetched), S_OK);
+			Assert::AreEqual(cFetched, 2UL);
+			for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+		}
+	};
+
+	TEST_CLASS(TestLeadingItem) {
+	  public:
+		TEST_METHOD(TestLeadComesFirst) {
+			_bstr_t bstrPath = bstrWorkingDir + "2streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			PITEMID_CHILD pidlcLead = ADSX::CItem::NewPidl(
+				L"lead", 4, 0, ADSX::CItem::FLAG_TREE
+			);
+			Assert::IsNotNull(pidlcLead);
+			defer({ CoTaskMemFree(pidlcLead); });
+			Assert::AreEqual(pEnum->AddLeadingItem(pidlcLead), S_OK);
+
+			// Twice, to see Reset bring it back
+			for (int iRound = 0; iRound < 2; iRound++) {
+				PITEMID_CHILD pidls[4];
+				ULONG cFetched = 0;
+				Assert::AreEqual(pEnum->Next(4, pidls, &cFetched), S_FALSE);
+				Assert::AreEqual(cFetched, 3UL);
+				Assert::IsTrue(ADSX::CItem::Equal(
+					ADSX::CItem::Get(pidls[0]), ADSX::CItem::Get(pidlcLead)
+				));
+				for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+				Assert::AreEqual(pEnum->Reset(), S_OK);
+			}
+		}
+
+		TEST_METHOD(TestLeadsInOrder) {
+			_bstr_t bstrPath = bstrWorkingDir + "2streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			PITEMID_CHILD pidlcTree = ADSX::CItem::NewPidl(
+				L"tree", 4, 0, ADSX::CItem::FLAG_TREE
+			);
+			Assert::IsNotNull(pidlcTree);
+			defer({ CoTaskMemFree(pidlcTree); });
+			PITEMID_CHILD pidlcFilter = ADSX::CItem::NewPidl(
+				L"filter", 6, 0, ADSX::CItem::FLAG_FILTER
+			);
+			Assert::IsNotNull(pidlcFilter);
+			defer({ CoTaskMemFree(pidlcFilter); });
+			Assert::AreEqual(pEnum->AddLeadingItem(pidlcTree), S_OK);
+			Assert::AreEqual(pEnum->AddLeadingItem(pidlcFilter), S_OK);
+			Assert::AreEqual(pEnum->AddLeadingItem(pidlcFilter), E_UNEXPECTED);
+
+			// One at a time, so the second lead comes out of a call of its own
+			PITEMID_CHILD pidlc;
+			Assert::AreEqual(pEnum->Next(1, &pidlc, NULL), S_OK);
+			Assert::IsTrue(ADSX::CItem::Get(pidlc)->fFlags & ADSX::CItem::FLAG_TREE);
+			CoTaskMemFree(pidlc);
+			Assert::AreEqual(pEnum->Next(1, &pidlc, NULL), S_OK);
+			Assert::IsTrue(ADSX::CItem::Get(pidlc)->fFlags & ADSX::CItem::FLAG_FILTER);
+			CoTaskMemFree(pidlc);
+			Assert::AreEqual(pEnum->Next(1, &pidlc, NULL), S_OK);
+			Assert::AreEqual(ADSX::CItem::Get(pidlc)->fFlags, BYTE(0));
+			CoTaskMemFree(pidlc);
+		}
+
+		TEST_METHOD(TestSkipTakesLead) {
+			_bstr_t bstrPath = bstrWorkingDir + "2streams.txt";
+			CComObject<CEnumIDList> *pEnum = make_enumerator(bstrPath);
+			defer({ pEnum->Release(); });
+			PITEMID_CHILD pidlcLead = ADSX::CItem::NewPidl(
+				L"lead", 4, 0, ADSX::CItem::FLAG_TREE
+			);
+			Assert::IsNotNull(pidlcLead);
+			defer({ CoTaskMemFree(pidlcLead); });
+			Assert::AreEqual(pEnum->AddLeadingItem(pidlcLead), S_OK);
+
+			Assert::AreEqual(pEnum->Skip(1), S_OK);
+			PITEMID_CHILD pidls[4];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pEnum->Next(4, pidls, &cFetched), S_FALSE);
+			Assert::AreEqual(cFetched, 2UL);
+			Assert::IsFalse(ADSX::CItem::Get(pidls[0])->fFlags & ADSX::CItem::FLAG_TREE);
+			for (ULONG i = 0; i < cFetched; i++) CoTaskMemFree(pidls[i]);
+		}
+	};
+
+	TEST_CLASS(TestCTreeScanner) {
+	  public:
+		TEST_METHOD(TestFindsEveryNamedStream) {
+			ADSX::CTreeScanner *pScanner;
+			Assert::AreEqual(ADSX::CTreeScanner::Start(bstrWorkingDir, &pScanner), S_OK);
+			defer({ pScanner->Release(); });
+			pScanner->Wait();
+
+			// 2streams.txt has one, 3streams.txt has two
+			PITEMID_CHILD pidls[8];
+			ULONG cFetched = 0;
+			Assert::AreEqual(pScanner->Get(0, 8, pidls, &cFetched, 0), S_OK);
+			Assert::AreEqual(cFetched, 3UL);
+			for (ULONG i = 0; i < cFetched; i++) {
+				// Found in the folder scanned, so no folder in the name
+				auto pItem = ADSX::CItem::Get(pidls[i]);
+				Assert::IsTrue(pItem->fFlags & ADSX::CItem::FLAG_RELATIVE);
+				Assert::IsNull(wcschr(pItem->szName, L'\\'));
+				Assert::IsNotNull(wcschr(pItem->szName, L':'));
+				CoTaskMemFree(pidls[i]);
+			}
+			Assert::AreEqual(pScanner->Get(cFetched, 8, pidls, &cFetched, 0), S_FALSE);
+
+			const ADSX::CTreeScanner::Stats stats = pScanner->GetStats();
+			Assert::IsTrue(stats.bFinished);
+			Assert::AreEqual(stats.cStreams, 3ULL);
+			Assert::AreEqual(stats.cErrors, 0ULL);
+		}
+	};
+
+	TEST_CLASS(TestCStreamFilter) {
+	  public:
+		TEST_METHOD(TestFindsFilesWithStreams) {
+			ADSX::CStreamFilter *pFilter;
+			Assert::AreEqual(ADSX::CStreamFilter::Start(bstrWorkingDir, &pFilter), S_OK);
+			defer({ pFilter->Release(); });
+			pFilter->Wait();
+
+			std::vector<std::wstring> names;
+			Assert::AreEqual(pFilter->Get(0, 8, &names, 0), S_OK);
+			std::sort(names.begin(), names.end());
+			Assert::AreEqual(names.size(), size_t(2));
+			Assert::AreEqual(names[0].c_str(), L"2streams.txt");
+			Assert::AreEqual(names[1].c_str(), L"3streams.txt");
+			Assert::AreEqual(pFilter->Get(2, 8, &names, 0), S_FALSE);
+
+			// 0streams, 1stream.txt, 2streams.txt, 3streams.txt
+			const ADSX::CStreamFilter::Stats stats = pFilter->GetStats();
+			Assert::IsTrue(stats.bFinished);
+			Assert::AreEqual(stats.cListed, 4ULL);
+			Assert::AreEqual(stats.cProbed, 4ULL);
+			Assert::AreEqual(stats.cMatches, 2ULL);
+		}
+	};
+
+	TEST_CLASS(TestCStreamProbe) {
+	  public:
+		TEST_METHOD(TestFolderWithoutStreams) {
+			_bstr_t bstrPath = bstrWorkingDir + "0streams";
+			Assert::IsFalse(ADSX::CStreamProbe::Instance().HasNamedStreams(bstrPath));
+		}
+
+		TEST_METHOD(TestMainStreamOnly) {
+			_bstr_t bstrPath = bstrWorkingDir + "1stream.txt";
+			Assert::IsFalse(ADSX::CStreamProbe::Instance().HasNamedStreams(bstrPath));
+		}
+
+		TEST_METHOD(TestNamedStreams) {
+			// Twice, to get the cached answer too
+			_bstr_t bstrPath = bstrWorkingDir + "3streams.txt";
+			Assert::IsTrue(ADSX::CStreamProbe::Instance().HasNamedStreams(bstrPath));
+			Assert::IsTrue(ADSX::CStreamProbe::Instance().HasNamedStreams(bstrPath));
 		}
 	};
 }
@@ -0,0 +1,261 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "CopyEngine.h"
+#include "defer.h"
+
+#include <winioctl.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CCopyEngine;
+
+
+// Bytes that don't repeat on any block boundary
+static BYTE PatternAt(ULONGLONG ullOffset) {
+	return static_cast<BYTE>((ullOffset * 2654435761u) >> 13);
+}
+
+// Write cb bytes of the pattern at ullOffset in the stream hStream.
+static void WritePattern(HANDLE hStream, ULONGLONG ullOffset, ULONG cb) {
+	std::vector<BYTE> bytes(cb);
+	for (ULONG i = 0; i < cb; i++) bytes[i] = PatternAt(ullOffset + i);
+	LARGE_INTEGER liOffset;
+	liOffset.QuadPart = static_cast<LONGLONG>(ullOffset);
+	Assert::IsTrue(SetFilePointerEx(hStream, liOffset, NULL, FILE_BEGIN) != FALSE);
+	DWORD cbWritten;
+	Assert::IsTrue(WriteFile(hStream, bytes.data(), cb, &cbWritten, NULL) != FALSE);
+	Assert::AreEqual(cbWritten, static_cast<DWORD>(cb));
+}
+
+static std::vector<BYTE> ReadAll(const std::wstring &sPath) {
+	HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	Assert::AreNotEqual(hFile, INVALID_HANDLE_VALUE);
+	defer({ CloseHandle(hFile); });
+	LARGE_INTEGER liSize;
+	Assert::IsTrue(GetFileSizeEx(hFile, &liSize) != FALSE);
+	std::vector<BYTE> bytes(static_cast<size_t>(liSize.QuadPart));
+	DWORD cbRead = 0;
+	if (!bytes.empty()) {
+		Assert::IsTrue(ReadFile(hFile, bytes.data(), static_cast<DWORD>(bytes.size()), &cbRead, NULL) != FALSE);
+	}
+	Assert::AreEqual(static_cast<size_t>(cbRead), bytes.size());
+	return bytes;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestCopyEngine) {
+	  public:
+		TEST_METHOD_INITIALIZE(MakeFolder) {
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			m_root = std::filesystem::path(szTemp) / L"ADSX Test Copy";
+			std::filesystem::remove_all(m_root);
+			std::filesystem::create_directories(m_root);
+		}
+
+		TEST_METHOD_CLEANUP(RemoveFolder) {
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		TEST_METHOD(TestCopiesOddSizedStream) {
+			// More than one block, not a whole number of sectors
+			const ULONG cbStream = 2 * CCopyEngine::cbBlock + 12345;
+			const std::wstring sStream = (m_root / L"file.txt").wstring() + L":stream";
+			{
+				HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				WritePattern(hStream, 0, cbStream);
+			}
+
+			// Into a folder that isn't there yet, as from the tree pseudofolder
+			const std::wstring sDestination = (m_root / L"out" / L"sub" / L"file.txt_stream").wstring();
+			CCopyEngine::Stats stats;
+			ULONGLONG cbLastDone = 0;
+			Assert::AreEqual(S_OK, CCopyEngine::Copy(
+				{{sStream, sDestination, cbStream}},
+				[&](std::size_t, ULONGLONG cbDone, ULONGLONG) {
+					Assert::IsTrue(cbDone >= cbLastDone);
+					cbLastDone = cbDone;
+					return CCopyEngine::Progress::Continue;
+				},
+				&stats
+			));
+			Assert::AreEqual(1UL, stats.cCopied);
+			Assert::AreEqual(0UL, stats.cErrors);
+			Assert::AreEqual(static_cast<ULONGLONG>(cbStream), cbLastDone);
+
+			const std::vector<BYTE> copy = ReadAll(sDestination);
+			Assert::AreEqual(static_cast<size_t>(cbStream), copy.size());
+			for (ULONG i = 0; i < cbStream; i++) {
+				if (copy[i] != PatternAt(i)) Assert::Fail(L"Copy differs from the stream");
+			}
+		}
+
+		TEST_METHOD(TestKeepsHolesInSparseStream) {
+			// 64 MB, of which only a megabyte at the start and one in the
+			// middle were ever written
+			const ULONGLONG cbStream = 64ULL * 1024 * 1024;
+			const ULONGLONG ullMiddle = 40ULL * 1024 * 1024;
+			const std::wstring sStream = (m_root / L"sparse.bin").wstring() + L":stream";
+			{
+				HANDLE hStream = CreateFileW(
+					sStream.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL
+				);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				DWORD cbReturned;
+				Assert::IsTrue(DeviceIoControl(
+					hStream, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &cbReturned, NULL
+				) != FALSE);
+				LARGE_INTEGER liEnd;
+				liEnd.QuadPart = static_cast<LONGLONG>(cbStream);
+				Assert::IsTrue(SetFilePointerEx(hStream, liEnd, NULL, FILE_BEGIN) != FALSE);
+				Assert::IsTrue(SetEndOfFile(hStream) != FALSE);
+				WritePattern(hStream, 0, 1024 * 1024);
+				WritePattern(hStream, ullMiddle, 1024 * 1024);
+			}
+
+			const std::wstring sDestination = (m_root / L"sparse.bin_stream").wstring();
+			CCopyEngine::Stats stats;
+			Assert::AreEqual(S_OK, CCopyEngine::Copy({{sStream, sDestination, cbStream}}, nullptr, &stats));
+			// Not necessarily exactly: the filesystem rounds to its clusters
+			Assert::IsTrue(stats.cbHoles >= cbStream - 4ULL * 1024 * 1024);
+			Assert::IsTrue(stats.cbCopied <= 4ULL * 1024 * 1024);
+			Assert::IsTrue((GetFileAttributesW(sDestination.c_str()) & FILE_ATTRIBUTE_SPARSE_FILE) != 0);
+
+			const std::vector<BYTE> copy = ReadAll(sDestination);
+			Assert::AreEqual(static_cast<size_t>(cbStream), copy.size());
+			for (ULONGLONG i = 0; i < cbStream; i++) {
+				const bool bWritten = i < 1024 * 1024 || (i >= ullMiddle && i < ullMiddle + 1024 * 1024);
+				if (copy[i] != (bWritten ? PatternAt(i) : 0)) Assert::Fail(L"Copy differs from the stream");
+			}
+		}
+
+		TEST_METHOD(TestLeavesExistingFileAlone) {
+			const std::wstring sStream = (m_root / L"file.txt").wstring() + L":stream";
+			const std::wstring sMissing = (m_root / L"file.txt").wstring() + L":missing";
+			const std::wstring sDestination = (m_root / L"taken").wstring();
+			for (const std::wstring &sPath : {sStream, sDestination}) {
+				HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+				Assert::AreNotEqual(hFile, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hFile); });
+				WritePattern(hFile, 0, 100);
+			}
+
+			// Neither goes, and the one that failed for being there is as it was
+			CCopyEngine::Stats stats;
+			Assert::AreEqual(S_FALSE, CCopyEngine::Copy(
+				{
+					{sStream, sDestination, 100},
+					{sMissing, (m_root / L"new").wstring(), 0},
+				},
+				nullptr,
+				&stats
+			));
+			Assert::AreEqual(2UL, stats.cErrors);
+			Assert::AreEqual(static_cast<size_t>(100), ReadAll(sDestination).size());
+			Assert::IsFalse(std::filesystem::exists(m_root / L"new"));
+		}
+
+		TEST_METHOD(TestCopiesManyAtOnce) {
+			// More files than lanes, each told of as soon as it's in
+			const ULONG cFiles = 2 * CCopyEngine::cLanes + 1;
+			std::vector<CCopyEngine::Job> jobs;
+			for (ULONG i = 0; i < cFiles; i++) {
+				const std::wstring sStream = (m_root / (L"file" + std::to_wstring(i))).wstring() + L":s";
+				HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				WritePattern(hStream, 0, 1000 * (i + 1));
+				// Into streams of their own, as from a drop
+				jobs.push_back({sStream, (m_root / L"target").wstring() + L":new" + std::to_wstring(i), 1000 * (i + 1)});
+			}
+			HANDLE hTarget = CreateFileW((m_root / L"target").c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+			Assert::AreNotEqual(hTarget, INVALID_HANDLE_VALUE);
+			CloseHandle(hTarget);
+
+			volatile LONG cCopied = 0;
+			CCopyEngine::Stats stats;
+			Assert::AreEqual(S_OK, CCopyEngine::Copy(
+				jobs,
+				nullptr,
+				&stats,
+				[&](const CCopyEngine::Job &job) {
+					// From the lanes' threads, where an Assert can't go
+					std::error_code ec;
+					if (std::filesystem::exists(job.sDestination, ec)) InterlockedIncrement(&cCopied);
+				}
+			));
+			Assert::AreEqual(cFiles, stats.cCopied);
+			Assert::AreEqual(static_cast<LONG>(cFiles), static_cast<LONG>(cCopied));
+			for (ULONG i = 0; i < cFiles; i++) {
+				Assert::AreEqual(static_cast<size_t>(1000 * (i + 1)), ReadAll(jobs[i].sDestination).size());
+			}
+		}
+
+		TEST_METHOD(TestPauseHoldsEveryLane) {
+			// Enough blocks that every lane has more to do once it's resumed
+			const ULONG cFiles = 2 * CCopyEngine::cLanes;
+			const ULONG cbStream = 3 * CCopyEngine::cbBlock;
+			std::vector<CCopyEngine::Job> jobs;
+			for (ULONG i = 0; i < cFiles; i++) {
+				const std::wstring sStream = (m_root / (L"file" + std::to_wstring(i))).wstring() + L":s";
+				HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+				Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+				defer({ CloseHandle(hStream); });
+				WritePattern(hStream, 0, cbStream);
+				jobs.push_back({sStream, (m_root / (L"copy" + std::to_wstring(i))).wstring(), cbStream});
+			}
+
+			// Paused from the first report for a while. Each lane can finish
+			// the block it's on, but none starts another.
+			ULONG cPaused = 0;
+			ULONGLONG cbAtPause = 0, cbMostWhilePaused = 0;
+			CCopyEngine::Stats stats;
+			Assert::AreEqual(S_OK, CCopyEngine::Copy(
+				jobs,
+				[&](std::size_t, ULONGLONG cbDone, ULONGLONG) {
+					if (cPaused == 0) cbAtPause = cbDone;
+					if (cPaused < 10) {
+						cbMostWhilePaused = (std::max)(cbMostWhilePaused, cbDone);
+						cPaused++;
+						return CCopyEngine::Progress::Pause;
+					}
+					return CCopyEngine::Progress::Continue;
+				},
+				&stats
+			));
+			Assert::AreEqual(10UL, cPaused);
+			Assert::IsTrue(cbMostWhilePaused - cbAtPause <= static_cast<ULONGLONG>(CCopyEngine::cLanes) * CCopyEngine::cbBlock);
+			Assert::AreEqual(cFiles, stats.cCopied);
+			Assert::AreEqual(static_cast<ULONGLONG>(cFiles) * cbStream, stats.cbCopied);
+		}
+
+		TEST_METHOD(TestCopiesFromIStream) {
+			// Longer than listed, as virtual files can be
+			const ULONG cbStream = CCopyEngine::cbBlock + 777;
+			std::vector<BYTE> bytes(cbStream);
+			for (ULONG i = 0; i < cbStream; i++) bytes[i] = PatternAt(i);
+			CCopyEngine::Job job = {L"virtual.bin", (m_root / L"virtual.bin").wstring(), 10};
+			job.pSource.Attach(SHCreateMemStream(bytes.data(), cbStream));
+			Assert::IsNotNull(job.pSource.p);
+
+			CCopyEngine::Stats stats;
+			Assert::AreEqual(S_OK, CCopyEngine::Copy({job}, nullptr, &stats));
+			Assert::AreEqual(static_cast<ULONGLONG>(cbStream), stats.cbCopied);
+			Assert::IsTrue(ReadAll(job.sDestination) == bytes);
+		}
+
+	  private:
+		std::filesystem::path m_root;
+	};
+}
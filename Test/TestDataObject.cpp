@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "ADSXItem.h"
+#include "DataObject.h"
+#include "defer.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CDataObject;
+using ADSX::CItem;
+
+
+static void WriteStream(const std::wstring &sStream, const std::vector<BYTE> &bytes) {
+	HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+	defer({ CloseHandle(hStream); });
+	DWORD cbWritten;
+	Assert::IsTrue(WriteFile(hStream, bytes.data(), static_cast<DWORD>(bytes.size()), &cbWritten, NULL) != FALSE);
+	Assert::AreEqual(static_cast<DWORD>(bytes.size()), cbWritten);
+}
+
+static std::vector<BYTE> ReadToEnd(IStream *pStream) {
+	std::vector<BYTE> bytes;
+	BYTE ab[4096];
+	ULONG cbRead;
+	do {
+		Assert::IsTrue(SUCCEEDED(pStream->Read(ab, sizeof(ab), &cbRead)));
+		bytes.insert(bytes.end(), ab, ab + cbRead);
+	} while (cbRead != 0);
+	return bytes;
+}
+
+static FORMATETC FormatOf(PCWSTR pszFormat, LONG lindex, DWORD tymed) {
+	return {static_cast<CLIPFORMAT>(RegisterClipboardFormatW(pszFormat)), NULL, DVASPECT_CONTENT, lindex, tymed};
+}
+
+
+namespace Test {
+	TEST_CLASS(TestShellIDList) {
+	  public:
+		TEST_METHOD(TestLayOutManyItems) {
+			// Stands in for the folder; any ID list will do
+			PITEMID_CHILD pidlParent = CItem::NewPidl(L"file.txt", 8, 0);
+			defer({ CoTaskMemFree(pidlParent); });
+			const auto pidlaParent = reinterpret_cast<PCIDLIST_ABSOLUTE>(pidlParent);
+
+			std::vector<PITEMID_CHILD> aPidls;
+			defer({ for (PITEMID_CHILD pidlc : aPidls) CoTaskMemFree(pidlc); });
+			const PCWSTR apszNames[] = {L"a", L"Zone.Identifier", L"sub\\file.txt:name"};
+			for (UINT i = 0; i < 300; i++) {
+				const PCWSTR pszName = apszNames[i % _countof(apszNames)];
+				aPidls.push_back(CItem::NewPidl(pszName, wcslen(pszName), i));
+				Assert::IsNotNull(aPidls.back());
+			}
+
+			std::vector<BYTE> cida;
+			Assert::AreEqual(S_OK, ADSX::LayOutShellIDList(
+				pidlaParent, static_cast<UINT>(aPidls.size()), aPidls.data(), &cida
+			));
+			const auto pida = reinterpret_cast<const CIDA *>(cida.data());
+			Assert::AreEqual(static_cast<UINT>(aPidls.size()), pida->cidl);
+			Assert::IsTrue(ILIsEqual(
+				pidlaParent,
+				reinterpret_cast<PCIDLIST_ABSOLUTE>(cida.data() + pida->aoffset[0])
+			) != FALSE);
+			for (UINT i = 0; i < pida->cidl; i++) {
+				const auto pidlc = reinterpret_cast<PCUITEMID_CHILD>(cida.data() + pida->aoffset[i + 1]);
+				Assert::IsTrue(CItem::IsOwn(pidlc));
+				Assert::IsTrue(CItem::Equal(CItem::Get(aPidls[i]), CItem::Get(pidlc)));
+				Assert::IsTrue(ILIsEmpty(ILNext(pidlc)) != FALSE);
+			}
+			// Nothing after the last child's terminator
+			const auto pidlcLast = reinterpret_cast<PCUITEMID_CHILD>(cida.data() + pida->aoffset[pida->cidl]);
+			Assert::AreEqual(
+				cida.size(),
+				static_cast<size_t>(pida->aoffset[pida->cidl] + pidlcLast->mkid.cb + sizeof(USHORT))
+			);
+		}
+
+		TEST_METHOD(TestLayOutRejectsNullItem) {
+			PITEMID_CHILD pidlParent = CItem::NewPidl(L"file.txt", 8, 0);
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"a", 1, 0);
+			defer({ CoTaskMemFree(pidlParent); CoTaskMemFree(pidlc); });
+			PCUITEMID_CHILD aPidls[] = {pidlc, NULL};
+			std::vector<BYTE> cida;
+			Assert::AreEqual(E_POINTER, ADSX::LayOutShellIDList(
+				reinterpret_cast<PCIDLIST_ABSOLUTE>(pidlParent), 2, aPidls, &cida
+			));
+			Assert::AreEqual(E_INVALIDARG, ADSX::LayOutShellIDList(
+				reinterpret_cast<PCIDLIST_ABSOLUTE>(pidlParent), 0, aPidls, &cida
+			));
+		}
+	};
+	TEST_CLASS(TestVirtualFiles) {
+	  public:
+		TEST_METHOD_INITIALIZE(MakeFolder) {
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			m_root = std::filesystem::path(szTemp) / L"ADSX Test Data";
+			std::filesystem::remove_all(m_root);
+			std::filesystem::create_directories(m_root / L"sub");
+			m_sFile = (m_root / L"file.txt").wstring();
+			m_one.assign({'f', 'i', 'r', 's', 't'});
+			m_two.resize(5000);
+			for (size_t i = 0; i < m_two.size(); i++) m_two[i] = static_cast<BYTE>('a' + i % 26);
+			WriteStream(m_sFile + L":one", m_one);
+			WriteStream(m_sFile + L":two", m_two);
+			WriteStream((m_root / L"sub" / L"b.txt").wstring() + L":three", m_one);
+		}
+
+		TEST_METHOD_CLEANUP(RemoveFolder) {
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		TEST_METHOD(TestDescribesEachStream) {
+			// A pseudofolder in among them, which isn't anything to copy,
+			// and a stream listed as bigger than 4 GB that's never read
+			const LONGLONG llBig = (1LL << 32) + 3;
+			const PITEMID_CHILD aPidls[] = {
+				CItem::NewPidl(L"one", 3, 5),
+				CItem::NewPidl(L"tree", 4, 0, CItem::FLAG_TREE),
+				CItem::NewPidl(L"two", 3, 5000),
+				CItem::NewPidl(L"big", 3, llBig),
+			};
+			defer({ for (PITEMID_CHILD pidlc : aPidls) CoTaskMemFree(pidlc); });
+			CComPtr<IDataObject> pDataObject = MakeDataObject(_countof(aPidls), aPidls, m_sFile.c_str());
+
+			FORMATETC fe = FormatOf(CFSTR_FILEDESCRIPTORW, -1, TYMED_HGLOBAL);
+			Assert::AreEqual(S_OK, pDataObject->QueryGetData(&fe));
+			STGMEDIUM medium;
+			Assert::AreEqual(S_OK, pDataObject->GetData(&fe, &medium));
+			defer({ ReleaseStgMedium(&medium); });
+			Assert::AreEqual(static_cast<DWORD>(TYMED_HGLOBAL), medium.tymed);
+			const auto pGroup = static_cast<const FILEGROUPDESCRIPTORW *>(GlobalLock(medium.hGlobal));
+			Assert::IsNotNull(pGroup);
+			defer({ GlobalUnlock(medium.hGlobal); });
+
+			Assert::AreEqual(3U, pGroup->cItems);
+			const PCWSTR apszNames[] = {L"one", L"two", L"big"};
+			const LONGLONG allSizes[] = {5, 5000, llBig};
+			for (UINT i = 0; i < pGroup->cItems; i++) {
+				const FILEDESCRIPTORW &fd = pGroup->fgd[i];
+				Assert::AreEqual(apszNames[i], fd.cFileName);
+				Assert::AreEqual(
+					static_cast<DWORD>(FD_ATTRIBUTES | FD_FILESIZE | FD_PROGRESSUI | FD_UNICODE),
+					fd.dwFlags & (FD_ATTRIBUTES | FD_FILESIZE | FD_PROGRESSUI | FD_UNICODE)
+				);
+				Assert::AreEqual(static_cast<DWORD>(FILE_ATTRIBUTE_NORMAL), fd.dwFileAttributes);
+				Assert::AreEqual(
+					static_cast<ULONGLONG>(allSizes[i]),
+					(static_cast<ULONGLONG>(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow
+				);
+			}
+		}
+
+		TEST_METHOD(TestContentsByIndex) {
+			// lindex counts files in the descriptor, so it skips the pseudofolder
+			const PITEMID_CHILD aPidls[] = {
+				CItem::NewPidl(L"tree", 4, 0, CItem::FLAG_TREE),
+				CItem::NewPidl(L"one", 3, 5),
+				CItem::NewPidl(L"two", 3, 5000),
+			};
+			defer({ for (PITEMID_CHILD pidlc : aPidls) CoTaskMemFree(pidlc); });
+			CComPtr<IDataObject> pDataObject = MakeDataObject(_countof(aPidls), aPidls, m_sFile.c_str());
+
+			const std::vector<BYTE> *apContents[] = {&m_one, &m_two};
+			for (LONG lindex = 0; lindex < 2; lindex++) {
+				FORMATETC fe = FormatOf(CFSTR_FILECONTENTS, lindex, TYMED_ISTREAM);
+				Assert::AreEqual(S_OK, pDataObject->QueryGetData(&fe));
+				STGMEDIUM medium;
+				Assert::AreEqual(S_OK, pDataObject->GetData(&fe, &medium));
+				defer({ ReleaseStgMedium(&medium); });
+				Assert::AreEqual(static_cast<DWORD>(TYMED_ISTREAM), medium.tymed);
+				Assert::IsTrue(ReadToEnd(medium.pstm) == *apContents[lindex]);
+			}
+
+			// Past the last, and -1 with more than one to choose from
+			for (LONG lindex : {2L, -1L}) {
+				FORMATETC fe = FormatOf(CFSTR_FILECONTENTS, lindex, TYMED_ISTREAM);
+				Assert::AreEqual(DV_E_LINDEX, pDataObject->QueryGetData(&fe));
+				STGMEDIUM medium;
+				Assert::AreEqual(DV_E_LINDEX, pDataObject->GetData(&fe, &medium));
+			}
+			FORMATETC fe = FormatOf(CFSTR_FILECONTENTS, 0, TYMED_HGLOBAL);
+			Assert::AreEqual(DV_E_TYMED, pDataObject->QueryGetData(&fe));
+		}
+
+		TEST_METHOD(TestContentsOfTheOnlyOne) {
+			// Names in the tree pseudofolder are paths under its folder
+			const PITEMID_CHILD pidlc = CItem::NewPidl(L"sub\\b.txt:three", 15, 5, CItem::FLAG_RELATIVE);
+			defer({ CoTaskMemFree(pidlc); });
+			const std::wstring sFolder = m_root.wstring();
+			CComPtr<IDataObject> pDataObject = MakeDataObject(1, &pidlc, sFolder.c_str());
+
+			FORMATETC fe = FormatOf(CFSTR_FILEDESCRIPTORW, -1, TYMED_HGLOBAL);
+			STGMEDIUM medium;
+			Assert::AreEqual(S_OK, pDataObject->GetData(&fe, &medium));
+			{
+				defer({ ReleaseStgMedium(&medium); });
+				const auto pGroup = static_cast<const FILEGROUPDESCRIPTORW *>(GlobalLock(medium.hGlobal));
+				Assert::IsNotNull(pGroup);
+				defer({ GlobalUnlock(medium.hGlobal); });
+				Assert::AreEqual(1U, pGroup->cItems);
+				Assert::AreEqual(L"sub\\b.txt_three", pGroup->fgd[0].cFileName);
+			}
+
+			// With just the one, -1 means it
+			fe = FormatOf(CFSTR_FILECONTENTS, -1, TYMED_ISTREAM);
+			Assert::AreEqual(S_OK, pDataObject->GetData(&fe, &medium));
+			defer({ ReleaseStgMedium(&medium); });
+			Assert::IsTrue(ReadToEnd(medium.pstm) == m_one);
+		}
+
+		TEST_METHOD(TestNoFilesWithoutFolder) {
+			const PITEMID_CHILD pidlc = CItem::NewPidl(L"one", 3, 5);
+			defer({ CoTaskMemFree(pidlc); });
+			CComPtr<IDataObject> pDataObject = MakeDataObject(1, &pidlc, NULL);
+			FORMATETC fe = FormatOf(CFSTR_FILEDESCRIPTORW, -1, TYMED_HGLOBAL);
+			Assert::AreEqual(DV_E_FORMATETC, pDataObject->QueryGetData(&fe));
+			fe = FormatOf(CFSTR_FILECONTENTS, 0, TYMED_ISTREAM);
+			Assert::AreEqual(DV_E_FORMATETC, pDataObject->QueryGetData(&fe));
+			fe = FormatOf(CFSTR_SHELLIDLIST, -1, TYMED_HGLOBAL);
+			Assert::AreEqual(S_OK, pDataObject->QueryGetData(&fe));
+		}
+
+	  private:
+		std::filesystem::path m_root;
+		std::wstring m_sFile;
+		std::vector<BYTE> m_one;
+		std::vector<BYTE> m_two;
+
+		static CComPtr<IDataObject> MakeDataObject(
+			UINT cidl, const PITEMID_CHILD *aPidls, PCWSTR pszFolder
+		) {
+			for (UINT i = 0; i < cidl; i++) Assert::IsNotNull(aPidls[i]);
+			const std::vector<PCUITEMID_CHILD> aPidlcs(aPidls, aPidls + cidl);
+			// Stands in for the folder; any ID list will do
+			PITEMID_CHILD pidlParent = CItem::NewPidl(L"file.txt", 8, 0);
+			defer({ CoTaskMemFree(pidlParent); });
+			CComObject<CDataObject> *pDataObject;
+			Assert::AreEqual(S_OK, CComObject<CDataObject>::CreateInstance(&pDataObject));
+			CComPtr<IDataObject> pResult(pDataObject);
+			Assert::AreEqual(S_OK, pDataObject->Init(
+				NULL, reinterpret_cast<PCIDLIST_ABSOLUTE>(pidlParent), cidl, aPidlcs.data(), pszFolder
+			));
+			return pResult;
+		}
+	};
+}
@@ -0,0 +1,159 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "DeviceQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CDeviceQueue;
+using ADSX::IoPriority;
+
+
+// Wait (up to a few seconds) until the queue's numbers look right, so a test
+// knows a thread it started has got as far as waiting.
+static bool WaitFor(const CDeviceQueue &queue, std::function<bool(const CDeviceQueue::Stats &)> fn) {
+	for (int i = 0; i < 5000; i++) {
+		if (fn(queue.GetStats())) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestDeviceQueue) {
+	  public:
+		TEST_METHOD(TestLimitIsNeverExceeded) {
+			CDeviceQueue queue(3);
+			std::atomic<unsigned> cInFlight(0);
+			std::atomic<unsigned> cMaxInFlight(0);
+			std::vector<std::thread> threads;
+			for (unsigned iThread = 0; iThread < 8; iThread++) {
+				threads.emplace_back([&, iThread]() {
+					const IoPriority priority = iThread % 2 ? IoPriority::Background : IoPriority::Foreground;
+					for (int i = 0; i < 50; i++) {
+						CDeviceQueue::CTicket ticket = queue.Acquire(priority);
+						const unsigned c = ++cInFlight;
+						unsigned cMax = cMaxInFlight.load();
+						while (c > cMax && !cMaxInFlight.compare_exchange_weak(cMax, c)) {}
+						std::this_thread::sleep_for(std::chrono::microseconds(100));
+						cInFlight--;
+					}
+				});
+			}
+			for (std::thread &thread : threads) thread.join();
+
+			Assert::IsTrue(cMaxInFlight.load() <= 3);
+			const CDeviceQueue::Stats stats = queue.GetStats();
+			Assert::AreEqual(0u, stats.cInFlight);
+			Assert::AreEqual(200ull, static_cast<unsigned long long>(stats.foreground.cCompleted));
+			Assert::AreEqual(200ull, static_cast<unsigned long long>(stats.background.cCompleted));
+			Assert::IsTrue(stats.cMaxQueueDepth > 3);
+			std::uint64_t cHistogram = 0;
+			for (std::uint64_t c : stats.foreground.acServiceUs) cHistogram += c;
+			Assert::AreEqual(200ull, static_cast<unsigned long long>(cHistogram));
+			Assert::IsTrue(stats.foreground.AverageServiceMs() >= 0.1);
+			Assert::IsTrue(stats.foreground.ServicePercentileMs(0.5) >= 0.1);
+		}
+
+		TEST_METHOD(TestBackgroundLeavesASlot) {
+			CDeviceQueue queue(2);
+			CDeviceQueue::CTicket first = queue.Acquire(IoPriority::Background);
+			Assert::IsTrue(static_cast<bool>(first));
+
+			// A second scan request has to wait, even with a slot free...
+			std::atomic<bool> bCancel(false);
+			std::thread waiter([&]() {
+				CDeviceQueue::CTicket ticket = queue.Acquire(IoPriority::Background, &bCancel);
+				Assert::IsFalse(static_cast<bool>(ticket));
+			});
+			Assert::IsTrue(WaitFor(queue, [](const CDeviceQueue::Stats &stats) {
+				return stats.background.cWaiting == 1;
+			}));
+
+			// ...which is there for the user
+			CDeviceQueue::CTicket foreground = queue.Acquire(IoPriority::Foreground);
+			Assert::IsTrue(static_cast<bool>(foreground));
+			Assert::AreEqual(2u, queue.GetStats().cInFlight);
+
+			bCancel = true;
+			waiter.join();
+			const CDeviceQueue::Stats stats = queue.GetStats();
+			Assert::AreEqual(0ull, static_cast<unsigned long long>(stats.background.cWaiting));
+			Assert::AreEqual(2u, stats.cInFlight);
+		}
+
+		TEST_METHOD(TestOneSlotIsShared) {
+			// With only one, scans do get it when nobody else wants it
+			CDeviceQueue queue(1);
+			CDeviceQueue::CTicket ticket = queue.Acquire(IoPriority::Background);
+			Assert::IsTrue(static_cast<bool>(ticket));
+			ticket.Reset();
+			Assert::IsFalse(static_cast<bool>(ticket));
+			ticket = queue.Acquire(IoPriority::Foreground);
+			Assert::IsTrue(static_cast<bool>(ticket));
+			CDeviceQueue::CTicket moved(std::move(ticket));
+			Assert::IsFalse(static_cast<bool>(ticket));
+			Assert::IsTrue(static_cast<bool>(moved));
+			Assert::AreEqual(1u, queue.GetStats().cInFlight);
+		}
+
+		TEST_METHOD(TestForegroundGoesFirst) {
+			CDeviceQueue queue(1);
+			CDeviceQueue::CTicket held = queue.Acquire(IoPriority::Foreground);
+
+			std::mutex mutex;
+			std::vector<IoPriority> order;
+			auto run = [&](IoPriority priority) {
+				CDeviceQueue::CTicket ticket = queue.Acquire(priority);
+				std::lock_guard<std::mutex> lock(mutex);
+				order.push_back(priority);
+			};
+			// The scan asks first...
+			std::thread background(run, IoPriority::Background);
+			Assert::IsTrue(WaitFor(queue, [](const CDeviceQueue::Stats &stats) {
+				return stats.background.cWaiting == 1;
+			}));
+			// ...but the view gets in ahead of it
+			std::thread foreground(run, IoPriority::Foreground);
+			Assert::IsTrue(WaitFor(queue, [](const CDeviceQueue::Stats &stats) {
+				return stats.foreground.cWaiting == 1;
+			}));
+			held.Reset();
+			foreground.join();
+			background.join();
+
+			Assert::AreEqual(static_cast<std::size_t>(2), order.size());
+			Assert::IsTrue(order[0] == IoPriority::Foreground);
+			Assert::IsTrue(order[1] == IoPriority::Background);
+			const CDeviceQueue::Stats stats = queue.GetStats();
+			Assert::AreEqual(1ull, static_cast<unsigned long long>(stats.cPreempted));
+			Assert::AreEqual(3u, stats.cMaxQueueDepth);
+			Assert::IsTrue(stats.background.ullMaxWaitUs >= stats.foreground.ullMaxWaitUs);
+		}
+
+		TEST_METHOD(TestRaisingTheLimitLetsWaitersIn) {
+			CDeviceQueue queue(1);
+			CDeviceQueue::CTicket held = queue.Acquire(IoPriority::Foreground);
+			std::thread waiter([&]() {
+				CDeviceQueue::CTicket ticket = queue.Acquire(IoPriority::Foreground);
+				Assert::IsTrue(static_cast<bool>(ticket));
+			});
+			Assert::IsTrue(WaitFor(queue, [](const CDeviceQueue::Stats &stats) {
+				return stats.foreground.cWaiting == 1;
+			}));
+			queue.SetLimit(2);
+			waiter.join();
+			Assert::AreEqual(2u, queue.GetStats().cLimit);
+			Assert::AreEqual(1ull, static_cast<unsigned long long>(queue.GetStats().foreground.cCompleted));
+		}
+	};
+}
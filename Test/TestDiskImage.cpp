@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "BlockCache.h"
+#include "DiskImage.h"
+#include "MftReader.h"
+#include "MftScanner.h"
+#include "SyntheticDisk.h"
+#include "SyntheticMft.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Disk;
+using ADSX::CBlockCache;
+using ADSX::CMemorySource;
+using ADSX::Mft::CMftReader;
+using ADSX::Mft::CScanner;
+using ADSX::Mft::FoundStream;
+using ADSX::Mft::StreamData;
+
+
+static std::vector<unsigned char> MakeVolume() {
+	CSyntheticVolume volume(256, true);
+	const std::uint64_t ullFiles = volume.Add(ADSX::Mft::ullRecordRoot, L"Files", true);
+	volume.Add(ullFiles, L"a.txt", false, {{L"small", 5, false}, {L"big", 100000, true}});
+	volume.Add(ullFiles, L"spilled.bin", false, {{L"s1", 10, false}, {L"s2", 20000, true}}, true);
+	return volume.Build();
+}
+
+// Every stream on the image's one volume is found, and reads back as it was
+// written.
+static void CheckImage(const std::vector<unsigned char> &file, Format format) {
+	CMemorySource source(file.data(), file.size());
+	CImage image(source);
+	Assert::IsTrue(image.Open());
+	Assert::IsTrue(image.GetFormat() == format);
+	Assert::AreEqual(image.VolumeCount(), static_cast<std::size_t>(1));
+
+	CScanner scanner(image.Volume(0), 2);
+	std::vector<FoundStream> found;
+	Assert::IsTrue(scanner.Scan(&found));
+	Assert::AreEqual(found.size(), static_cast<std::size_t>(4));
+
+	CMftReader reader(image.Volume(0));
+	Assert::IsTrue(reader.Open());
+	for (const FoundStream &stream : found) {
+		StreamData data;
+		Assert::IsTrue(reader.OpenStream(stream.ullRecord, stream.sName, &data));
+		Assert::AreEqual(data.ullSize, stream.ullSize);
+
+		// Ask for more than there is
+		std::vector<unsigned char> contents(static_cast<std::size_t>(data.ullSize) + 100);
+		std::size_t cbRead;
+		Assert::IsTrue(reader.ReadStream(data, 0, contents.data(), contents.size(), &cbRead));
+		Assert::AreEqual(cbRead, static_cast<std::size_t>(data.ullSize));
+		for (std::size_t i = 0; i < cbRead; i++) {
+			const unsigned char bExpected = data.bResident ? 'x' : CSyntheticVolume::PatternByte(i);
+			if (contents[i] != bExpected) Assert::Fail(L"stream contents differ");
+		}
+	}
+}
+
+
+namespace Test {
+	TEST_CLASS(TestDiskImage) {
+	  public:
+		TEST_METHOD(TestVolumeImage) {
+			CheckImage(MakeVolume(), Format::Raw);
+		}
+
+		TEST_METHOD(TestRawMbr) {
+			CheckImage(SyntheticDisk::MakeDisk(MakeVolume(), false), Format::Raw);
+		}
+
+		TEST_METHOD(TestRawGpt) {
+			CheckImage(SyntheticDisk::MakeDisk(MakeVolume(), true), Format::Raw);
+		}
+
+		TEST_METHOD(TestVhdFixed) {
+			const auto disk = SyntheticDisk::MakeDisk(MakeVolume(), false);
+			CheckImage(SyntheticDisk::MakeVhdFixed(disk), Format::VhdFixed);
+		}
+
+		TEST_METHOD(TestVhdDynamic) {
+			const auto disk = SyntheticDisk::MakeDisk(MakeVolume(), true);
+			const auto file = SyntheticDisk::MakeVhdDynamic(disk);
+			// The empty blocks were left out
+			Assert::IsTrue(file.size() < disk.size());
+			CheckImage(file, Format::VhdDynamic);
+		}
+
+		TEST_METHOD(TestVhdx) {
+			CheckImage(SyntheticDisk::MakeVhdx(SyntheticDisk::MakeDisk(MakeVolume(), false)), Format::Vhdx);
+		}
+
+		TEST_METHOD(TestVhdBadChecksum) {
+			auto file = SyntheticDisk::MakeVhdFixed(SyntheticDisk::MakeDisk(MakeVolume(), false));
+			file[file.size() - Vhd::cbFooter + Vhd::cbOffCurrentSize + 7] ^= 1;
+			CMemorySource source(file.data(), file.size());
+			CImage image(source);
+			Assert::IsFalse(image.Open());
+			Assert::IsTrue(image.GetFormat() == Format::Unsupported);
+		}
+
+		TEST_METHOD(TestVhdxLogNeedsReplay) {
+			auto file = SyntheticDisk::MakeVhdx(SyntheticDisk::MakeDisk(MakeVolume(), false));
+			// Both headers, checksums fixed up to match
+			for (const std::uint64_t ib : {Vhdx::ibHeader1, Vhdx::ibHeader2}) {
+				unsigned char *pbHeader = &file[static_cast<std::size_t>(ib)];
+				pbHeader[Vhdx::cbOffLogGuid] = 1;
+				std::memset(pbHeader + Vhdx::cbOffChecksum, 0, 4);
+				const std::uint32_t uCrc = Crc32c(pbHeader, Vhdx::cbHeader);
+				std::memcpy(pbHeader + Vhdx::cbOffChecksum, &uCrc, 4);
+			}
+			CMemorySource source(file.data(), file.size());
+			CImage image(source);
+			Assert::IsFalse(image.Open());
+		}
+
+		TEST_METHOD(TestCrc32c) {
+			// The check value from the spec
+			Assert::AreEqual(Crc32c("123456789", 9), 0xE3069283u);
+		}
+	};
+
+	TEST_CLASS(TestBlockCache) {
+	  public:
+		TEST_METHOD(TestReadsAcrossBlocks) {
+			std::vector<unsigned char> bytes(10 * 4096 + 100);
+			for (std::size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<unsigned char>(i * 7);
+			CMemorySource source(bytes.data(), bytes.size());
+			CBlockCache cache(source, 4096, 1024, 0);
+
+			std::vector<unsigned char> out(5000);
+			Assert::IsTrue(cache.Read(4000, out.data(), out.size()));
+			Assert::IsTrue(std::memcmp(out.data(), &bytes[4000], out.size()) == 0);
+			// The short block at the end
+			Assert::IsTrue(cache.Read(bytes.size() - 50, out.data(), 50));
+			Assert::IsTrue(std::memcmp(out.data(), &bytes[bytes.size() - 50], 50) == 0);
+			Assert::IsFalse(cache.Read(bytes.size() - 50, out.data(), 51));
+
+			// Again, all from the cache
+			const auto statsBefore = cache.GetStats();
+			Assert::IsTrue(cache.Read(4000, out.data(), out.size()));
+			const auto statsAfter = cache.GetStats();
+			Assert::AreEqual(statsAfter.cReads, statsBefore.cReads);
+			Assert::AreEqual(statsAfter.cHits - statsBefore.cHits, 3ULL);
+		}
+
+		TEST_METHOD(TestReadAhead) {
+			std::vector<unsigned char> bytes(64 * 4096);
+			CMemorySource source(bytes.data(), bytes.size());
+			CBlockCache cache(source, 4096, 1024, 7);
+
+			unsigned char b;
+			for (std::uint64_t i = 0; i < 64; i++) Assert::IsTrue(cache.Read(i * 4096, &b, 1));
+			const auto stats = cache.GetStats();
+			// Starting at the start counts as sequential; 8 blocks a read
+			Assert::AreEqual(stats.cReads, 8ULL);
+			Assert::AreEqual(stats.cReadAhead, 56ULL);
+
+			// Jumping about reads one block at a time
+			CBlockCache cacheRandom(source, 4096, 1024, 7);
+			for (const std::uint64_t i : {40, 3, 17, 60}) Assert::IsTrue(cacheRandom.Read(i * 4096, &b, 1));
+			Assert::AreEqual(cacheRandom.GetStats().cReadAhead, 0ULL);
+		}
+	};
+}
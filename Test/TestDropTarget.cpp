@@ -0,0 +1,67 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "DropTarget.h"
+#include "defer.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::NameNewStreams;
+
+
+namespace Test {
+	TEST_CLASS(TestNameNewStreams) {
+	  public:
+		TEST_METHOD_INITIALIZE(MakeFile) {
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			m_sFile = (std::filesystem::path(szTemp) / L"ADSX Test Drop.txt").wstring();
+			// Already has "notes.txt"
+			const std::wstring sStream = m_sFile + L":notes.txt";
+			HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+			Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+			CloseHandle(hStream);
+		}
+
+		TEST_METHOD_CLEANUP(RemoveFile) {
+			DeleteFileW(m_sFile.c_str());
+		}
+
+		TEST_METHOD(TestKeepsFileNames) {
+			const std::vector<std::wstring> streams = NameNewStreams(
+				m_sFile.c_str(), {L"C:\\dir\\report.pdf", L"virtual\\sub\\photo.jpg"}
+			);
+			Assert::AreEqual(static_cast<size_t>(2), streams.size());
+			Assert::AreEqual(std::wstring(L"report.pdf"), streams[0]);
+			Assert::AreEqual(std::wstring(L"photo.jpg"), streams[1]);
+		}
+
+		TEST_METHOD(TestNumbersTakenNames) {
+			// One's on the file already; two more come in at once, one of
+			// them in different case
+			const std::vector<std::wstring> streams = NameNewStreams(
+				m_sFile.c_str(), {L"C:\\a\\notes.txt", L"C:\\b\\NOTES.TXT", L"C:\\c\\.profile", L"D:\\.profile"}
+			);
+			Assert::AreEqual(static_cast<size_t>(4), streams.size());
+			Assert::AreEqual(std::wstring(L"notes (2).txt"), streams[0]);
+			Assert::AreEqual(std::wstring(L"NOTES (3).TXT"), streams[1]);
+			Assert::AreEqual(std::wstring(L".profile"), streams[2]);
+			Assert::AreEqual(std::wstring(L".profile (2)"), streams[3]);
+		}
+
+		TEST_METHOD(TestReplacesWhatStreamNamesCantHave) {
+			const std::vector<std::wstring> streams = NameNewStreams(
+				m_sFile.c_str(), {L"http://example.com/a", L"dir\\"}
+			);
+			Assert::AreEqual(std::wstring(L"http___example.com_a"), streams[0]);
+			Assert::AreEqual(std::wstring(L"Stream"), streams[1]);
+		}
+
+	  private:
+		std::wstring m_sFile;
+	};
+}
@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "ADSXItem.h"
+#include "defer.h"
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CItem;
+
+
+namespace Test {
+	TEST_CLASS(TestCItem) {
+	  public:
+		TEST_METHOD(TestNewPidlRoundTrip) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"Zone.Identifier", 15, 26);
+			Assert::IsNotNull(pidlc);
+			defer({ CoTaskMemFree(pidlc); });
+
+			Assert::IsTrue(CItem::IsOwn(pidlc));
+			const CItem *pItem = CItem::Get(pidlc);
+			Assert::AreEqual(pItem->cchName, static_cast<USHORT>(15));
+			Assert::AreEqual(static_cast<PCWSTR>(pItem->szName), L"Zone.Identifier");
+			Assert::AreEqual(pItem->llFilesize, 26LL);
+			Assert::AreEqual(pItem->uNameHash, CItem::HashName(L"Zone.Identifier", 15));
+		}
+
+		TEST_METHOD(TestNameNeedNotBeTerminated) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"alternate1:$DATA", 10, 0);
+			Assert::IsNotNull(pidlc);
+			defer({ CoTaskMemFree(pidlc); });
+			Assert::AreEqual(static_cast<PCWSTR>(CItem::Get(pidlc)->szName), L"alternate1");
+		}
+
+		TEST_METHOD(TestCloneIsEqual) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"alternate1", 10, 23);
+			Assert::IsNotNull(pidlc);
+			defer({ CoTaskMemFree(pidlc); });
+			PITEMID_CHILD pidlcCopy = CItem::Clone(pidlc);
+			Assert::IsNotNull(pidlcCopy);
+			defer({ CoTaskMemFree(pidlcCopy); });
+
+			Assert::IsTrue(CItem::IsOwn(pidlcCopy));
+			Assert::IsTrue(CItem::Equal(CItem::Get(pidlc), CItem::Get(pidlcCopy)));
+		}
+
+		TEST_METHOD(TestDifferentNamesNotEqual) {
+			PITEMID_CHILD pidlc1 = CItem::NewPidl(L"alternate1", 10, 23);
+			PITEMID_CHILD pidlc2 = CItem::NewPidl(L"alternate2", 10, 23);
+			defer({ CoTaskMemFree(pidlc1); CoTaskMemFree(pidlc2); });
+			Assert::IsFalse(CItem::Equal(CItem::Get(pidlc1), CItem::Get(pidlc2)));
+		}
+
+		TEST_METHOD(TestIsOwnRejectsUnknownVersion) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"alternate1", 10, 23);
+			defer({ CoTaskMemFree(pidlc); });
+			CItem::Get(pidlc)->bVersion = CItem::LATEST_VERSION + 1;
+			Assert::IsFalse(CItem::IsOwn(pidlc));
+		}
+
+		TEST_METHOD(TestIsOwnFlags) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(
+				L"sub\\file.txt:alternate1", 23, 23, CItem::FLAG_RELATIVE
+			);
+			defer({ CoTaskMemFree(pidlc); });
+			Assert::IsTrue(CItem::IsOwn(pidlc));
+			// Flags from some future build
+			CItem::Get(pidlc)->fFlags |= 0x80;
+			Assert::IsFalse(CItem::IsOwn(pidlc));
+		}
+
+		TEST_METHOD(TestDifferentFlagsNotEqual) {
+			PITEMID_CHILD pidlc1 = CItem::NewPidl(L"alternate1", 10, 23);
+			PITEMID_CHILD pidlc2 = CItem::NewPidl(L"alternate1", 10, 23, CItem::FLAG_TREE);
+			defer({ CoTaskMemFree(pidlc1); CoTaskMemFree(pidlc2); });
+			Assert::IsFalse(CItem::Equal(CItem::Get(pidlc1), CItem::Get(pidlc2)));
+		}
+
+		TEST_METHOD(TestIsOwnRejectsWrongLength) {
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"alternate1", 10, 23);
+			defer({ CoTaskMemFree(pidlc); });
+			CItem::Get(pidlc)->cchName = 9;
+			Assert::IsFalse(CItem::IsOwn(pidlc));
+		}
+
+		TEST_METHOD(TestIsOwnRejectsForeignItem) {
+			// Shaped like ours but not signed
+			PITEMID_CHILD pidlc = CItem::NewPidl(L"alternate1", 10, 23);
+			defer({ CoTaskMemFree(pidlc); });
+			CItem::Get(pidlc)->SIGNATURE = 'ABCD';
+			Assert::IsFalse(CItem::IsOwn(pidlc));
+		}
+	};
+}
@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "LruCache.h"
+
+#include <string>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CShardedLruCache;
+
+
+namespace Test {
+	TEST_CLASS(TestLruCache) {
+	  public:
+		TEST_METHOD(TestMissThenHit) {
+			CShardedLruCache<int, std::wstring, 1> cache(4);
+			std::wstring sValue;
+			Assert::IsFalse(cache.Find(1, &sValue));
+			cache.Insert(1, L"one");
+			Assert::IsTrue(cache.Find(1, &sValue));
+			Assert::AreEqual(sValue, std::wstring(L"one"));
+
+			const auto stats = cache.GetStats();
+			Assert::AreEqual(stats.cHits, 1ULL);
+			Assert::AreEqual(stats.cMisses, 1ULL);
+		}
+
+		TEST_METHOD(TestInsertReplaces) {
+			CShardedLruCache<int, std::wstring, 1> cache(4);
+			cache.Insert(1, L"one");
+			cache.Insert(1, L"uno");
+			std::wstring sValue;
+			Assert::IsTrue(cache.Find(1, &sValue));
+			Assert::AreEqual(sValue, std::wstring(L"uno"));
+			Assert::AreEqual(cache.Size(), static_cast<size_t>(1));
+		}
+
+		TEST_METHOD(TestEvictsLeastRecentlyUsed) {
+			CShardedLruCache<int, int, 1> cache(3);
+			cache.Insert(1, 1);
+			cache.Insert(2, 2);
+			cache.Insert(3, 3);
+			int iValue;
+			// 1 is now the most recently used, so 2 goes first
+			Assert::IsTrue(cache.Find(1, &iValue));
+			cache.Insert(4, 4);
+			Assert::IsFalse(cache.Find(2, &iValue));
+			Assert::IsTrue(cache.Find(1, &iValue));
+			Assert::IsTrue(cache.Find(3, &iValue));
+			Assert::IsTrue(cache.Find(4, &iValue));
+			Assert::AreEqual(cache.GetStats().cEvictions, 1ULL);
+		}
+
+		TEST_METHOD(TestShardsStayWithinBounds) {
+			CShardedLruCache<int, int, 4> cache(16);
+			for (int i = 0; i < 1000; i++) cache.Insert(i, i);
+			Assert::IsTrue(cache.Size() <= 16);
+		}
+
+		TEST_METHOD(TestEraseAndClear) {
+			CShardedLruCache<int, int, 2> cache(8);
+			cache.Insert(1, 1);
+			cache.Insert(2, 2);
+			Assert::IsTrue(cache.Erase(1));
+			Assert::IsFalse(cache.Erase(1));
+			cache.Clear();
+			Assert::AreEqual(cache.Size(), static_cast<size_t>(0));
+		}
+	};
+}
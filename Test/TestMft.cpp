@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "Mft.h"
+#include "MftScanner.h"
+#include "SyntheticMft.h"
+
+#include <cstring>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Mft;
+using ADSX::CMemorySource;
+
+
+// A volume with a bit of everything the scanner has to get right.
+static std::vector<unsigned char> MakeVolume(bool bSplitMft) {
+	CSyntheticVolume volume(256, bSplitMft);
+	const std::uint64_t ullFiles = volume.Add(ullRecordRoot, L"Files", true, {{L"dirstream", 3, false}});
+	volume.Add(ullFiles, L"a.txt", false, {{L"one", 5, false}, {L"two", 100000, true}});
+	const std::uint64_t ullSpilled = volume.Add(
+		ullFiles, L"big.bin", false, {{L"s1", 10, false}, {L"s2", 20, false}}, true
+	);
+	volume.Add(ullFiles, L"plain.txt", false);
+	volume.AddStaleExtension(ullSpilled, {{L"ghost", 1, false}});
+	volume.AddTornRecord();
+	volume.AddDeleted(ullFiles, L"gone.txt", {{L"gone", 1, false}});
+	// Its parent was never there
+	volume.Add(200, L"orphan.txt", false, {{L"o", 1, false}});
+	return volume.Build();
+}
+
+
+namespace Test {
+	TEST_CLASS(TestMft) {
+	  public:
+		TEST_METHOD(TestBootSector) {
+			std::vector<unsigned char> image = MakeVolume(false);
+			Geometry geometry;
+			Assert::IsTrue(ParseBootSector(image.data(), image.size(), &geometry));
+			Assert::AreEqual(geometry.cbSector, CSyntheticVolume::cbSector);
+			Assert::AreEqual(geometry.cbCluster, CSyntheticVolume::cbCluster);
+			Assert::AreEqual(geometry.cbRecord, CSyntheticVolume::cbRecord);
+			Assert::AreEqual(geometry.ullMftLcn, CSyntheticVolume::ullMftLcn);
+
+			std::memcpy(&image[cbOffOemId], "EXFAT   ", 8);
+			Assert::IsFalse(ParseBootSector(image.data(), image.size(), &geometry));
+		}
+
+		TEST_METHOD(TestFixups) {
+			std::vector<unsigned char> image = MakeVolume(false);
+			const std::size_t cbRecord = CSyntheticVolume::cbRecord;
+			const std::size_t ibRoot = static_cast<std::size_t>(
+				CSyntheticVolume::ullMftLcn * CSyntheticVolume::cbCluster + ullRecordRoot * cbRecord
+			);
+			std::vector<unsigned char> record(&image[ibRoot], &image[ibRoot] + cbRecord);
+			Assert::IsTrue(ApplyFixups(record.data(), cbRecord) == FixupResult::Ok);
+			const CRecord root(record.data(), cbRecord);
+			Assert::IsTrue(root.InUse());
+			Assert::IsTrue(root.IsDirectory());
+
+			// The second sector's tail no longer matches the first's
+			record.assign(&image[ibRoot], &image[ibRoot] + cbRecord);
+			record[2 * cbFixupStride - 1] ^= 0xFF;
+			Assert::IsTrue(ApplyFixups(record.data(), cbRecord) == FixupResult::Torn);
+
+			std::vector<unsigned char> empty(cbRecord);
+			Assert::IsTrue(ApplyFixups(empty.data(), cbRecord) == FixupResult::Empty);
+		}
+
+		TEST_METHOD(TestRuns) {
+			const unsigned char abRuns[] = {
+				0x21, 0x10, 0x00, 0x01,  // 16 clusters at 0x100
+				0x11, 0x08, 0xF0,        // 8 at 16 back from there
+				0x01, 0x05,              // a hole of 5
+				0x00,
+			};
+			std::vector<Run> runs;
+			Assert::IsTrue(DecodeRuns(abRuns, sizeof(abRuns), 0, &runs));
+			Assert::AreEqual(runs.size(), static_cast<std::size_t>(3));
+			Assert::AreEqual(runs[0].ullLcn, 0x100ULL);
+			Assert::AreEqual(runs[1].ullVcn, 16ULL);
+			Assert::AreEqual(runs[1].ullLcn, 0xF0ULL);
+			Assert::IsTrue(runs[2].bSparse);
+			Assert::AreEqual(runs[2].ullVcn, 24ULL);
+
+			// Cut off in the middle of the second run
+			runs.clear();
+			Assert::IsFalse(DecodeRuns(abRuns, 5, 0, &runs));
+			Assert::AreEqual(runs.size(), static_cast<std::size_t>(1));
+
+			// Before the start of the volume
+			const unsigned char abBackwards[] = {0x11, 0x01, 0xF0, 0x00};
+			runs.clear();
+			Assert::IsFalse(DecodeRuns(abBackwards, sizeof(abBackwards), 0, &runs));
+		}
+
+		TEST_METHOD(TestScan) {
+			for (const bool bSplitMft : {false, true}) {
+				std::vector<unsigned char> image = MakeVolume(bSplitMft);
+				CMemorySource source(image.data(), image.size());
+				CScanner scanner(source, 3);
+				std::vector<FoundStream> found;
+				Assert::IsTrue(scanner.Scan(&found));
+
+				// Not the stale extension's, nor the deleted file's
+				Assert::AreEqual(found.size(), static_cast<std::size_t>(6));
+				Assert::IsTrue(found[0].sPath == L"Files");
+				Assert::IsTrue(found[0].sName == L"dirstream");
+				Assert::IsTrue(found[0].bDirectory);
+				Assert::IsTrue(found[1].sPath == L"Files\\a.txt");
+				Assert::IsTrue(found[1].sName == L"one");
+				Assert::AreEqual(found[1].ullSize, 5ULL);
+				Assert::IsTrue(found[2].sName == L"two");
+				Assert::AreEqual(found[2].ullSize, 100000ULL);
+				// Found through its attribute list
+				Assert::IsTrue(found[3].sPath == L"Files\\big.bin");
+				Assert::IsTrue(found[3].sName == L"s1");
+				Assert::IsTrue(found[4].sName == L"s2");
+				Assert::IsTrue(found[5].sPath == L"?\\orphan.txt");
+
+				const ScanStats &stats = scanner.GetStats();
+				Assert::AreEqual(stats.cRecords, 256ULL);
+				Assert::AreEqual(stats.cBad, 1ULL);
+				Assert::AreEqual(stats.cOrphans, 1ULL);
+				Assert::AreEqual(stats.cReadErrors, 0ULL);
+			}
+		}
+
+		TEST_METHOD(TestNotNtfs) {
+			std::vector<unsigned char> image(64 * 1024);
+			CMemorySource source(image.data(), image.size());
+			CScanner scanner(source);
+			std::vector<FoundStream> found;
+			Assert::IsFalse(scanner.Scan(&found));
+			Assert::IsTrue(found.empty());
+		}
+	};
+}
@@ -0,0 +1,175 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "Selector.h"
+
+#include <cstring>
+#include <string>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Selector;
+using Op = CProgram::Op;
+
+
+static CProgram MustCompile(const Name &sQuery) {
+	CProgram program;
+	Error error;
+	Assert::IsTrue(CProgram::Compile(sQuery, &program, &error));
+	return program;
+}
+
+static bool Matches(
+	const Name &sQuery,
+	const Name &sName,
+	std::uint64_t ullSize = 0,
+	const Name &sPath = L"C:\\dir\\file.txt"
+) {
+	Candidate candidate;
+	candidate.svName = sName;
+	candidate.ullSize = ullSize;
+	candidate.svPath = sPath;
+	return MustCompile(sQuery).Matches(candidate);
+}
+
+// The content pfnRead hands back, and how often it was asked
+struct Content {
+	const char *psz;
+	unsigned cReads;
+};
+
+static std::size_t ReadContent(void *pvContext, unsigned char *pb, std::size_t cb) {
+	Content *pContent = static_cast<Content *>(pvContext);
+	pContent->cReads++;
+	const std::size_t cbContent = (std::min)(cb, std::strlen(pContent->psz));
+	std::memcpy(pb, pContent->psz, cbContent);
+	return cbContent;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestSelector) {
+	  public:
+		TEST_METHOD(TestNames) {
+			Assert::IsTrue(Matches(L"", L"anything"));
+			Assert::IsTrue(Matches(L"name=Zone.Identifier", L"zone.identifier"));
+			Assert::IsFalse(Matches(L"name=Zone.Identifier", L"Zone.Identifier2"));
+			Assert::IsTrue(Matches(L"Zone.Identifier", L"ZONE.IDENTIFIER"));
+			Assert::IsTrue(Matches(L"name:*.txt", L"notes.TXT"));
+			Assert::IsFalse(Matches(L"name:*.txt", L"notes.txt.bak"));
+			Assert::IsTrue(Matches(L"name:summ*", L"SummaryInformation"));
+			Assert::IsTrue(Matches(L"name:*ary*", L"SummaryInformation"));
+			Assert::IsTrue(Matches(L"name:a?c*z", L"abcxyz"));
+			Assert::IsFalse(Matches(L"name:a?c*z", L"abcxyza"));
+			Assert::IsTrue(Matches(L"name:*", L""));
+			Assert::IsTrue(Matches(L"name~\"^[0-9a-f]{4}$\"", L"BEEF"));
+			Assert::IsFalse(Matches(L"name~\"^[0-9a-f]{4}$\"", L"BEEFS"));
+			Assert::IsTrue(Matches(L"\"has space\"", L"Has Space"));
+			Assert::IsTrue(Matches(L"name=\"say \\\"hi\\\"\"", L"say \"hi\""));
+		}
+
+		TEST_METHOD(TestSizesAndPaths) {
+			Assert::IsTrue(Matches(L"size>4k", L"s", 4097));
+			Assert::IsFalse(Matches(L"size>4k", L"s", 4096));
+			Assert::IsTrue(Matches(L"size>=4kb", L"s", 4096));
+			Assert::IsTrue(Matches(L"size<1", L"s", 0));
+			Assert::IsFalse(Matches(L"size<1", L"s", 1));
+			Assert::IsTrue(Matches(L"size<=1mb", L"s", 1024 * 1024));
+			Assert::IsTrue(Matches(L"size=26", L"s", 26));
+			Assert::IsTrue(Matches(L"size!=26", L"s", 27));
+			Assert::IsFalse(Matches(L"size!=26", L"s", 26));
+			Assert::IsTrue(Matches(L"size:1k..2k", L"s", 1500));
+			Assert::IsFalse(Matches(L"size:1k..2k", L"s", 2049));
+			Assert::IsTrue(Matches(L"size > 1g", L"s", 1ull << 31));
+			Assert::IsTrue(Matches(L"path:c:\\DIR\\*", L"s"));
+			Assert::IsFalse(Matches(L"path:c:\\other\\*", L"s"));
+			Assert::IsTrue(Matches(L"path~\"\\\\dir\\\\\"", L"s"));
+			Assert::IsTrue(MustCompile(L"path:*.txt").UsesPath());
+			Assert::IsFalse(MustCompile(L"name:*.txt size>1").UsesPath());
+		}
+
+		TEST_METHOD(TestLogic) {
+			Assert::IsTrue(Matches(L"a or b", L"b"));
+			Assert::IsFalse(Matches(L"a b", L"b"));
+			Assert::IsTrue(Matches(L"b and size<10", L"b", 5));
+			Assert::IsFalse(Matches(L"b && size<10", L"b", 50));
+			Assert::IsTrue(Matches(L"not a", L"b"));
+			Assert::IsFalse(Matches(L"-b", L"b"));
+			Assert::IsTrue(Matches(L"!(a | b) c", L"c"));
+			Assert::IsTrue(Matches(L"(a or b) and (size>1 or c)", L"a", 2));
+			Assert::IsFalse(Matches(L"(a or b) and (size>1 or c)", L"a", 1));
+			Assert::IsTrue(Matches(L"a or b or c or d", L"C"));
+			Assert::IsFalse(Matches(L"a or b or c or d", L"e"));
+			Assert::IsTrue(Matches(L"notes", L"notes"));
+			Assert::IsTrue(Matches(L"size", L"size"));
+		}
+
+		TEST_METHOD(TestCheapestFirst) {
+			// The size test goes ahead of the regex, whatever order they're
+			// written in, and the name= run becomes one lookup
+			const CProgram program = MustCompile(L"name~\"x\" and size>1 and (a or b or c or name:*.d)");
+			const auto &code = program.Code();
+			Assert::IsTrue(code[0].op == Op::SizeIn);
+			Assert::IsTrue(code[1].op == Op::JumpIfFalse);
+			Assert::IsTrue(code[2].op == Op::NameIn);
+			Assert::IsTrue(code[4].op == Op::Suffix);
+			Assert::IsTrue(code.back().op == Op::Regex);
+			for (const CProgram::Instruction &instruction : code) {
+				if (instruction.op == Op::JumpIfFalse || instruction.op == Op::JumpIfTrue) {
+					Assert::IsTrue(instruction.uArg <= code.size());
+				}
+			}
+		}
+
+		TEST_METHOD(TestContentIsReadLastAndOnce) {
+			Content content = {"[ZoneTransfer]\r\nZoneId=3\r\n", 0};
+			const CProgram program = MustCompile(L"type:zone and not type:text");
+			Candidate candidate;
+			candidate.svName = L"Zone.Identifier";
+			candidate.ullSize = 26;
+			candidate.pfnRead = ReadContent;
+			candidate.pvContext = &content;
+			Assert::IsTrue(program.Matches(candidate));
+			Assert::AreEqual(1u, content.cReads);
+
+			// Settled by the size before the stream is read
+			const CProgram sized = MustCompile(L"type:zone size>100");
+			Assert::IsFalse(sized.Matches(candidate));
+			Assert::AreEqual(1u, content.cReads);
+
+			// Nothing to read with: no type matches
+			candidate.pfnRead = nullptr;
+			Assert::IsFalse(program.Matches(candidate));
+		}
+
+		TEST_METHOD(TestSniff) {
+			auto fnSniff = [](const char *pb, std::size_t cb) {
+				return Sniff(reinterpret_cast<const unsigned char *>(pb), cb);
+			};
+			Assert::IsTrue(fnSniff("", 0) == ContentType::Empty);
+			Assert::IsTrue(fnSniff("hello\r\n", 7) == ContentType::Text);
+			Assert::IsTrue(fnSniff("\xEF\xBB\xBF[ZoneTransfer]", 17) == ContentType::ZoneTransfer);
+			Assert::IsTrue(fnSniff("\xFE\xFF\x00\x00\x05\x00", 6) == ContentType::PropertySet);
+			Assert::IsTrue(fnSniff("PK\x03\x04rest", 8) == ContentType::Zip);
+			Assert::IsTrue(fnSniff("\x89PNG\r\n\x1A\n", 8) == ContentType::Png);
+			Assert::IsTrue(fnSniff("MZ\x90\x00", 4) == ContentType::Executable);
+			Assert::IsTrue(fnSniff("\xFF\xFEh\x00", 4) == ContentType::Utf16);
+			Assert::IsTrue(fnSniff("a\x01z", 3) == ContentType::Binary);
+		}
+
+		TEST_METHOD(TestErrors) {
+			const char *apszBad[] = {
+				"(a", "a)", "size>", "size>x", "size:1..", "name~\"(\"", "\"open",
+				"type:nonsense", "size<0", "size>99999999999999999999", "name!x", "a and",
+			};
+			for (const char *pszBad : apszBad) {
+				CProgram program;
+				Error error;
+				const Name sQuery(pszBad, pszBad + std::strlen(pszBad));
+				Assert::IsFalse(CProgram::Compile(sQuery, &program, &error));
+				Assert::IsFalse(error.sMessage.empty());
+				Assert::IsTrue(error.ich <= sQuery.size());
+			}
+		}
+	};
+}
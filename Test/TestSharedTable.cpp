@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "SharedTable.h"
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::SharedTable;
+
+
+// Zeroed and aligned like a freshly mapped section
+struct Region {
+	Region() : pv(_aligned_malloc(CTable::RequiredSize(), 64)) {
+		std::memset(pv, 0, CTable::RequiredSize());
+	}
+	~Region() { _aligned_free(pv); }
+	void *pv;
+};
+
+static const Key key1 = {1, {1, 2, 3}};
+static const Key key2 = {1, {4, 5, 6}};
+static const Validator validator = {100, 200};
+
+
+namespace Test {
+	TEST_CLASS(TestSharedTable) {
+	  public:
+		TEST_METHOD(TestSecondAttachSeesFirst) {
+			Region region;
+			CTable table1, table2;
+			Assert::IsTrue(table1.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table2.Attach(region.pv, CTable::RequiredSize()));
+
+			Assert::IsTrue(table1.Store(key1, validator, "hello", 5));
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData = 0;
+			Assert::IsTrue(table2.Find(key1, validator, out.data(), out.size(), &cbData));
+			Assert::AreEqual(cbData, static_cast<size_t>(5));
+			Assert::AreEqual(std::memcmp(out.data(), "hello", 5), 0);
+		}
+
+		TEST_METHOD(TestMissOnOtherKey) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData;
+			Assert::IsFalse(table.Find(key2, validator, out.data(), out.size(), &cbData));
+		}
+
+		TEST_METHOD(TestMissWhenFileChanged) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+			const Validator validatorNewer = {101, 201};
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData;
+			Assert::IsFalse(table.Find(key1, validatorNewer, out.data(), out.size(), &cbData));
+		}
+
+		TEST_METHOD(TestStoreReplaces) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+			const Validator validatorNewer = {101, 201};
+			Assert::IsTrue(table.Store(key1, validatorNewer, "bye", 3));
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData;
+			Assert::IsTrue(table.Find(key1, validatorNewer, out.data(), out.size(), &cbData));
+			Assert::AreEqual(cbData, static_cast<size_t>(3));
+		}
+
+		TEST_METHOD(TestTooBigIsRefused) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			std::vector<unsigned char> big(cbPayloadMax + 1);
+			Assert::IsFalse(table.Store(key1, validator, big.data(), big.size()));
+		}
+
+		TEST_METHOD(TestOtherLayoutVersionIsLeftAlone) {
+			Region region;
+			CTable table1;
+			Assert::IsTrue(table1.Attach(region.pv, CTable::RequiredSize()));
+			static_cast<Header *>(region.pv)->uLayoutVersion = uLayoutVersion + 1;
+			CTable table2;
+			Assert::IsFalse(table2.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsFalse(table2.Store(key1, validator, "hello", 5));
+		}
+
+		TEST_METHOD(TestHalfWrittenSlotIsSkipped) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+			// Pretend a writer died partway through
+			auto aSlots = reinterpret_cast<Slot *>(
+				static_cast<unsigned char *>(region.pv) + sizeof(Header)
+			);
+			for (size_t i = 0; i < cSlots; i++) {
+				if (aSlots[i].key == key1) aSlots[i].uSeq.fetch_add(1);
+			}
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData;
+			Assert::IsFalse(table.Find(key1, validator, out.data(), out.size(), &cbData));
+		}
+
+		TEST_METHOD(TestAbandonedSlotIsTakenOver) {
+			Region region;
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+			// A writer that died partway through, long enough ago
+			auto aSlots = reinterpret_cast<Slot *>(
+				static_cast<unsigned char *>(region.pv) + sizeof(Header)
+			);
+			Slot *pSlot = nullptr;
+			for (size_t i = 0; i < cSlots; i++) {
+				if (aSlots[i].key == key1) pSlot = &aSlots[i];
+			}
+			Assert::IsNotNull(pSlot);
+			pSlot->uSeq.fetch_add(1);
+			pSlot->ullClaimedAt.store(0);
+
+			Assert::IsTrue(table.Store(key1, validator, "bye", 3));
+			Assert::AreEqual(pSlot->uSeq.load() % 2, 0U);
+			std::vector<unsigned char> out(cbPayloadMax);
+			size_t cbData;
+			Assert::IsTrue(table.Find(key1, validator, out.data(), out.size(), &cbData));
+			Assert::AreEqual(cbData, static_cast<size_t>(3));
+			// Into the same slot, not another near it
+			size_t cHolding = 0;
+			for (size_t i = 0; i < cSlots; i++) {
+				if (aSlots[i].key == key1) cHolding++;
+			}
+			Assert::AreEqual(cHolding, static_cast<size_t>(1));
+		}
+
+		TEST_METHOD(TestHalfSetUpTableIsFinished) {
+			Region region;
+			// A process that died setting it up
+			static_cast<Header *>(region.pv)->uState.store(1);
+			CTable table;
+			Assert::IsTrue(table.Attach(region.pv, CTable::RequiredSize()));
+			Assert::AreEqual(static_cast<Header *>(region.pv)->uState.load(), 2U);
+			Assert::IsTrue(table.Store(key1, validator, "hello", 5));
+		}
+	};
+}
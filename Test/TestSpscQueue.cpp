@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "SpscQueue.h"
+
+#include <thread>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CSpscQueue;
+
+
+namespace Test {
+	TEST_CLASS(TestSpscQueue) {
+	  public:
+		TEST_METHOD(TestEmpty) {
+			CSpscQueue<int, 4> queue;
+			int i;
+			Assert::IsTrue(queue.Empty());
+			Assert::IsFalse(queue.TryPop(&i));
+		}
+
+		TEST_METHOD(TestFullThenDrain) {
+			CSpscQueue<int, 4> queue;
+			for (int i = 0; i < 4; i++) Assert::IsTrue(queue.TryPush(i));
+			Assert::IsFalse(queue.TryPush(4));
+			for (int i = 0; i < 4; i++) {
+				int iPopped;
+				Assert::IsTrue(queue.TryPop(&iPopped));
+				Assert::AreEqual(iPopped, i);
+			}
+			Assert::IsTrue(queue.Empty());
+		}
+
+		TEST_METHOD(TestWrapsAround) {
+			CSpscQueue<int, 4> queue;
+			int iPopped;
+			for (int i = 0; i < 10; i++) {
+				Assert::IsTrue(queue.TryPush(i));
+				Assert::IsTrue(queue.TryPop(&iPopped));
+				Assert::AreEqual(iPopped, i);
+			}
+		}
+
+		TEST_METHOD(TestAcrossThreads) {
+			// Small on purpose, so both sides keep running into each other
+			static CSpscQueue<unsigned, 8> queue;
+			const unsigned cItems = 100000;
+			std::thread producer([&]() {
+				for (unsigned i = 0; i < cItems; i++) {
+					while (!queue.TryPush(i)) std::this_thread::yield();
+				}
+			});
+			for (unsigned i = 0; i < cItems; i++) {
+				unsigned uPopped;
+				while (!queue.TryPop(&uPopped)) std::this_thread::yield();
+				Assert::AreEqual(uPopped, i);
+			}
+			producer.join();
+			Assert::IsTrue(queue.Empty());
+		}
+	};
+}
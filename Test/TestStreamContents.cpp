@@ -0,0 +1,359 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "StreamContents.h"
+#include "defer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CStreamContents;
+
+
+// Bytes that don't repeat on any chunk boundary
+static BYTE PatternAt(ULONGLONG ullOffset) {
+	return static_cast<BYTE>((ullOffset * 2654435761u) >> 13);
+}
+
+// A stream at sStream holding cb bytes of the pattern.
+static void MakeStream(const std::wstring &sStream, ULONG cb) {
+	HANDLE hStream = CreateFileW(sStream.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	Assert::AreNotEqual(hStream, INVALID_HANDLE_VALUE);
+	defer({ CloseHandle(hStream); });
+	std::vector<BYTE> bytes(cb);
+	for (ULONG i = 0; i < cb; i++) bytes[i] = PatternAt(i);
+	DWORD cbWritten = 0;
+	if (cb != 0) Assert::IsTrue(WriteFile(hStream, bytes.data(), cb, &cbWritten, NULL) != FALSE);
+	Assert::AreEqual(cbWritten, static_cast<DWORD>(cb));
+}
+
+// Whether cb bytes at pb are the pattern from ullOffset.
+static bool IsPattern(const BYTE *pb, ULONGLONG ullOffset, size_t cb) {
+	for (size_t i = 0; i < cb; i++) {
+		if (pb[i] != PatternAt(ullOffset + i)) return false;
+	}
+	return true;
+}
+
+static HRESULT SeekTo(IStream *pStream, LONGLONG llMove, DWORD dwOrigin, ULONGLONG *pullNew = NULL) {
+	LARGE_INTEGER liMove;
+	liMove.QuadPart = llMove;
+	ULARGE_INTEGER uliNew = {};
+	const HRESULT hr = pStream->Seek(liMove, dwOrigin, &uliNew);
+	if (pullNew != NULL) *pullNew = uliNew.QuadPart;
+	return hr;
+}
+
+
+// A CStreamContents that isn't mapped even though it could be, so what
+// would've come out of the view comes through the buffer instead
+class CUnmappedContents : public CStreamContents {
+  public:
+	HRESULT OpenUnmapped(PCWSTR pszStream) {
+		m_sStream = pszStream;
+		ObjectLock lock(this);
+		HRESULT hr = EnsureOpen();
+		if (FAILED(hr)) return hr;
+		if (m_pbView != NULL) {
+			UnmapViewOfFile(m_pbView);
+			m_pbView = NULL;
+			m_hMapping.Close();
+		}
+		return S_OK;
+	}
+};
+
+static CComPtr<IStream> OpenUnmapped(const std::wstring &sStream) {
+	CComObject<CUnmappedContents> *pContents;
+	Assert::AreEqual(S_OK, CComObject<CUnmappedContents>::CreateInstance(&pContents));
+	CComPtr<IStream> pStream(pContents);
+	Assert::AreEqual(S_OK, pContents->OpenUnmapped(sStream.c_str()));
+	return pStream;
+}
+
+
+// Somewhere to CopyTo that keeps what it's given, and only has room for
+// cbRoom bytes of it, like a disk that fills up partway
+class ATL_NO_VTABLE CFillingStream
+	: public IStream,
+	  public CComObjectRootEx<CComMultiThreadModel> {
+  public:
+	BEGIN_COM_MAP(CFillingStream)
+		COM_INTERFACE_ENTRY(IStream)
+		COM_INTERFACE_ENTRY(ISequentialStream)
+	END_COM_MAP()
+
+	std::vector<BYTE> m_bytes;
+	size_t m_cbRoom = SIZE_MAX;
+
+	STDMETHOD(Read)(void *, ULONG, ULONG *) { return E_NOTIMPL; }
+	STDMETHOD(Write)(const void *pv, ULONG cb, ULONG *pcbWritten) {
+		const ULONG cbTaken = static_cast<ULONG>((std::min)(static_cast<size_t>(cb), m_cbRoom - m_bytes.size()));
+		const BYTE *pb = static_cast<const BYTE *>(pv);
+		m_bytes.insert(m_bytes.end(), pb, pb + cbTaken);
+		if (pcbWritten != NULL) *pcbWritten = cbTaken;
+		return S_OK;
+	}
+	STDMETHOD(Seek)(LARGE_INTEGER, DWORD, ULARGE_INTEGER *) { return E_NOTIMPL; }
+	STDMETHOD(SetSize)(ULARGE_INTEGER) { return E_NOTIMPL; }
+	STDMETHOD(CopyTo)(IStream *, ULARGE_INTEGER, ULARGE_INTEGER *, ULARGE_INTEGER *) { return E_NOTIMPL; }
+	STDMETHOD(Commit)(DWORD) { return S_OK; }
+	STDMETHOD(Revert)() { return E_NOTIMPL; }
+	STDMETHOD(LockRegion)(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) { return E_NOTIMPL; }
+	STDMETHOD(UnlockRegion)(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) { return E_NOTIMPL; }
+	STDMETHOD(Stat)(STATSTG *, DWORD) { return E_NOTIMPL; }
+	STDMETHOD(Clone)(IStream **) { return E_NOTIMPL; }
+};
+
+static CComObject<CFillingStream> *MakeFillingStream(CComPtr<IStream> &pStream, size_t cbRoom) {
+	CComObject<CFillingStream> *pFilling;
+	Assert::AreEqual(S_OK, CComObject<CFillingStream>::CreateInstance(&pFilling));
+	pStream = pFilling;
+	pFilling->m_cbRoom = cbRoom;
+	return pFilling;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestStreamContents) {
+	  public:
+		// More than a chunk either way, and not a whole number of them
+		static constexpr ULONG cbStream = 3 * CStreamContents::cbChunk + 4321;
+
+		TEST_METHOD_INITIALIZE(MakeFolder) {
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			m_root = std::filesystem::path(szTemp) / L"ADSX Test Contents";
+			std::filesystem::remove_all(m_root);
+			std::filesystem::create_directories(m_root);
+			m_sStream = (m_root / L"file.txt").wstring() + L":stream";
+			MakeStream(m_sStream, cbStream);
+		}
+
+		TEST_METHOD_CLEANUP(RemoveFolder) {
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		TEST_METHOD(TestReadsFromView) {
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			CheckReads(pStream);
+		}
+
+		TEST_METHOD(TestReadsThroughBuffer) {
+			CheckReads(OpenUnmapped(m_sStream));
+		}
+
+		TEST_METHOD(TestSeeksInView) {
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			CheckSeeks(pStream);
+		}
+
+		TEST_METHOD(TestSeeksInBuffer) {
+			CheckSeeks(OpenUnmapped(m_sStream));
+		}
+
+		TEST_METHOD(TestSeeksBeforeOpening) {
+			// Nothing's open yet, so the file pointer has to catch up on opening
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			ULONGLONG ullNew;
+			Assert::AreEqual(S_OK, SeekTo(pStream, 2 * CStreamContents::cbChunk + 5, STREAM_SEEK_SET, &ullNew));
+			Assert::AreEqual(2ULL * CStreamContents::cbChunk + 5, ullNew);
+
+			std::vector<BYTE> bytes(1000);
+			ULONG cbRead;
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::AreEqual(1000UL, cbRead);
+			Assert::IsTrue(IsPattern(bytes.data(), ullNew, cbRead));
+		}
+
+		TEST_METHOD(TestReadsEmptyStream) {
+			// Too small to map, so it's read the other way
+			const std::wstring sEmpty = (m_root / L"file.txt").wstring() + L":empty";
+			MakeStream(sEmpty, 0);
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(sEmpty.c_str(), 0, &pStream));
+			BYTE b;
+			ULONG cbRead = 1;
+			Assert::AreEqual(S_FALSE, pStream->Read(&b, 1, &cbRead));
+			Assert::AreEqual(0UL, cbRead);
+			ULONGLONG ullNew;
+			Assert::AreEqual(S_OK, SeekTo(pStream, 0, STREAM_SEEK_END, &ullNew));
+			Assert::AreEqual(0ULL, ullNew);
+		}
+
+		TEST_METHOD(TestRefusesWrites) {
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			const BYTE b = 0;
+			ULONG cbWritten = 1;
+			Assert::AreEqual(STG_E_ACCESSDENIED, pStream->Write(&b, 1, &cbWritten));
+			Assert::AreEqual(0UL, cbWritten);
+			ULARGE_INTEGER uliSize = {};
+			Assert::AreEqual(STG_E_ACCESSDENIED, pStream->SetSize(uliSize));
+		}
+
+		TEST_METHOD(TestCopiesFromView) {
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			CheckCopies(pStream);
+		}
+
+		TEST_METHOD(TestCopiesThroughBuffer) {
+			CheckCopies(OpenUnmapped(m_sStream));
+		}
+
+		TEST_METHOD(TestCopyStopsWhenFullFromView) {
+			CComPtr<IStream> pStream;
+			Assert::AreEqual(S_OK, CStreamContents::Create(m_sStream.c_str(), cbStream, &pStream));
+			CheckCopyStopsWhenFull(pStream);
+		}
+
+		TEST_METHOD(TestCopyStopsWhenFullThroughBuffer) {
+			CheckCopyStopsWhenFull(OpenUnmapped(m_sStream));
+		}
+
+	  private:
+		std::filesystem::path m_root;
+		std::wstring m_sStream;
+
+		static void CheckReads(IStream *pStream) {
+			std::vector<BYTE> bytes(cbStream);
+			ULONGLONG ullOffset = 0;
+			ULONG cbRead;
+			// Small ones, the second across nothing in particular
+			for (ULONG cb : {100UL, 12345UL}) {
+				Assert::AreEqual(S_OK, pStream->Read(bytes.data(), cb, &cbRead));
+				Assert::AreEqual(cb, cbRead);
+				Assert::IsTrue(IsPattern(bytes.data(), ullOffset, cbRead));
+				ullOffset += cbRead;
+			}
+			// One across the end of the first chunk
+			const ULONG cbAcross = CStreamContents::cbChunk - static_cast<ULONG>(ullOffset) + 500;
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), cbAcross, &cbRead));
+			Assert::AreEqual(cbAcross, cbRead);
+			Assert::IsTrue(IsPattern(bytes.data(), ullOffset, cbRead));
+			ullOffset += cbRead;
+			// Bigger than a chunk
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), CStreamContents::cbChunk + 1, &cbRead));
+			Assert::AreEqual(CStreamContents::cbChunk + 1, cbRead);
+			Assert::IsTrue(IsPattern(bytes.data(), ullOffset, cbRead));
+			ullOffset += cbRead;
+			// Asking for more than is left gets what's left
+			Assert::AreEqual(S_FALSE, pStream->Read(bytes.data(), cbStream, &cbRead));
+			Assert::AreEqual(static_cast<ULONG>(cbStream - ullOffset), cbRead);
+			Assert::IsTrue(IsPattern(bytes.data(), ullOffset, cbRead));
+			// And then there's nothing
+			Assert::AreEqual(S_FALSE, pStream->Read(bytes.data(), 1, &cbRead));
+			Assert::AreEqual(0UL, cbRead);
+		}
+
+		static void CheckSeeks(IStream *pStream) {
+			std::vector<BYTE> bytes(1000);
+			ULONG cbRead;
+			ULONGLONG ullNew;
+			// Into the middle of the second chunk
+			Assert::AreEqual(S_OK, SeekTo(pStream, CStreamContents::cbChunk + 77, STREAM_SEEK_SET, &ullNew));
+			Assert::AreEqual(CStreamContents::cbChunk + 77ULL, ullNew);
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::IsTrue(IsPattern(bytes.data(), ullNew, cbRead));
+
+			// Back over what was just read, which may well be in the buffer
+			Assert::AreEqual(S_OK, SeekTo(pStream, -500, STREAM_SEEK_CUR, &ullNew));
+			Assert::AreEqual(CStreamContents::cbChunk + 577ULL, ullNew);
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::IsTrue(IsPattern(bytes.data(), ullNew, cbRead));
+
+			// Back to the start, well out of it
+			Assert::AreEqual(S_OK, SeekTo(pStream, 0, STREAM_SEEK_SET, &ullNew));
+			Assert::AreEqual(0ULL, ullNew);
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::IsTrue(IsPattern(bytes.data(), 0, cbRead));
+
+			// The last few
+			Assert::AreEqual(S_OK, SeekTo(pStream, -10, STREAM_SEEK_END, &ullNew));
+			Assert::AreEqual(cbStream - 10ULL, ullNew);
+			Assert::AreEqual(S_FALSE, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::AreEqual(10UL, cbRead);
+			Assert::IsTrue(IsPattern(bytes.data(), ullNew, cbRead));
+
+			// Past the end is somewhere to be, with nothing to read there
+			Assert::AreEqual(S_OK, SeekTo(pStream, 100, STREAM_SEEK_END, &ullNew));
+			Assert::AreEqual(cbStream + 100ULL, ullNew);
+			cbRead = 1;
+			Assert::AreEqual(S_FALSE, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::AreEqual(0UL, cbRead);
+
+			// Before the start isn't, and the position stays put
+			Assert::AreEqual(STG_E_INVALIDFUNCTION, SeekTo(pStream, -1, STREAM_SEEK_SET));
+			Assert::AreEqual(S_OK, SeekTo(pStream, 0, STREAM_SEEK_CUR, &ullNew));
+			Assert::AreEqual(cbStream + 100ULL, ullNew);
+		}
+
+		static void CheckCopies(IStream *pStream) {
+			// From partway in, a bit at a time and then the rest
+			const ULONGLONG ullStart = 1234;
+			Assert::AreEqual(S_OK, SeekTo(pStream, ullStart, STREAM_SEEK_SET));
+			CComPtr<IStream> pCopy;
+			Assert::AreEqual(S_OK, CreateStreamOnHGlobal(NULL, TRUE, &pCopy));
+
+			ULARGE_INTEGER uliWant, uliRead, uliWritten;
+			uliWant.QuadPart = CStreamContents::cbChunk + 99;
+			Assert::AreEqual(S_OK, pStream->CopyTo(pCopy, uliWant, &uliRead, &uliWritten));
+			Assert::AreEqual(uliWant.QuadPart, uliRead.QuadPart);
+			Assert::AreEqual(uliWant.QuadPart, uliWritten.QuadPart);
+
+			uliWant.QuadPart = ULLONG_MAX;
+			Assert::AreEqual(S_OK, pStream->CopyTo(pCopy, uliWant, &uliRead, &uliWritten));
+			Assert::AreEqual(cbStream - ullStart - CStreamContents::cbChunk - 99, uliRead.QuadPart);
+			Assert::AreEqual(uliRead.QuadPart, uliWritten.QuadPart);
+
+			// Nothing left
+			Assert::AreEqual(S_OK, pStream->CopyTo(pCopy, uliWant, &uliRead, &uliWritten));
+			Assert::AreEqual(0ULL, uliRead.QuadPart);
+			Assert::AreEqual(0ULL, uliWritten.QuadPart);
+
+			STATSTG stat;
+			Assert::AreEqual(S_OK, pCopy->Stat(&stat, STATFLAG_NONAME));
+			Assert::AreEqual(cbStream - ullStart, stat.cbSize.QuadPart);
+			HGLOBAL hCopy;
+			Assert::AreEqual(S_OK, GetHGlobalFromStream(pCopy, &hCopy));
+			const BYTE *pbCopy = static_cast<const BYTE *>(GlobalLock(hCopy));
+			Assert::IsNotNull(pbCopy);
+			defer({ GlobalUnlock(hCopy); });
+			Assert::IsTrue(IsPattern(pbCopy, ullStart, static_cast<size_t>(stat.cbSize.QuadPart)));
+		}
+
+		static void CheckCopyStopsWhenFull(IStream *pStream) {
+			// Room for part of the second chunk
+			const size_t cbRoom = CStreamContents::cbChunk + 4096;
+			CComPtr<IStream> pCopy;
+			CComObject<CFillingStream> *pFilling = MakeFillingStream(pCopy, cbRoom);
+
+			ULARGE_INTEGER uliWant, uliRead, uliWritten;
+			uliWant.QuadPart = ULLONG_MAX;
+			Assert::AreEqual(STG_E_MEDIUMFULL, pStream->CopyTo(pCopy, uliWant, &uliRead, &uliWritten));
+			// Only what got written was read
+			Assert::AreEqual(static_cast<ULONGLONG>(cbRoom), uliWritten.QuadPart);
+			Assert::AreEqual(uliWritten.QuadPart, uliRead.QuadPart);
+			Assert::AreEqual(cbRoom, pFilling->m_bytes.size());
+			Assert::IsTrue(IsPattern(pFilling->m_bytes.data(), 0, cbRoom));
+
+			// So the rest is still there to read
+			ULONGLONG ullPosition;
+			Assert::AreEqual(S_OK, SeekTo(pStream, 0, STREAM_SEEK_CUR, &ullPosition));
+			Assert::AreEqual(static_cast<ULONGLONG>(cbRoom), ullPosition);
+			std::vector<BYTE> bytes(1000);
+			ULONG cbRead;
+			Assert::AreEqual(S_OK, pStream->Read(bytes.data(), 1000, &cbRead));
+			Assert::IsTrue(IsPattern(bytes.data(), cbRoom, cbRead));
+		}
+	};
+}
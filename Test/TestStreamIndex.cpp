@@ -0,0 +1,305 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "MftScanner.h"
+#include "StreamIndex.h"
+#include "SyntheticMft.h"
+#include "UsnJournal.h"
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Index;
+using ADSX::CMemorySource;
+using ADSX::Mft::ullRecordRoot;
+namespace Usn = ADSX::Usn;
+
+
+struct Scanned {
+	std::vector<unsigned char> index;
+	std::vector<ADSX::Mft::FoundStream> found;
+	std::uint64_t ullFiles;
+	std::uint64_t ullNested;
+	std::uint64_t ullPlain;
+};
+
+// An index of a volume made by scanning it, as it would be built for real.
+static Scanned ScanAndBuild() {
+	Scanned scanned;
+	CSyntheticVolume volume(256, false);
+	scanned.ullFiles = volume.Add(ullRecordRoot, L"Files", true);
+	volume.Add(scanned.ullFiles, L"a.txt", false, {{L"Zone.Identifier", 26, false}, {L"two", 100000, true}});
+	const std::uint64_t ullSub = volume.Add(scanned.ullFiles, L"Sub", true);
+	scanned.ullNested = volume.Add(ullSub, L"b.txt", false, {{L"zone.identifier", 30, false}});
+	scanned.ullPlain = volume.Add(scanned.ullFiles, L"plain.txt", false);
+	volume.Add(ullRecordRoot, L"Empty", true);
+	const std::vector<unsigned char> image = volume.Build();
+
+	CMemorySource source(image.data(), image.size());
+	ADSX::Mft::CScanner scanner(source, 2);
+	std::vector<ADSX::Mft::FoundFile> foundFiles;
+	Assert::IsTrue(scanner.Scan(&scanned.found, &foundFiles));
+	// The files with streams and the two directories above them, but not
+	// the ones without
+	Assert::AreEqual(foundFiles.size(), static_cast<std::size_t>(4));
+
+	std::vector<File> files;
+	for (const auto &file : foundFiles) {
+		files.push_back(File{file.ullRecord, file.ullParent, file.sName, file.bDirectory});
+	}
+	std::vector<Stream> streams;
+	for (const auto &stream : scanned.found) {
+		streams.push_back(Stream{stream.ullRecord, stream.sName, stream.ullSize});
+	}
+	Metadata metadata;
+	metadata.ullVolumeSerial = 0x1234;
+	metadata.ullJournalId = 77;
+	metadata.llNextUsn = 4096;
+	scanned.index = CIndex::Build(metadata, std::move(files), std::move(streams));
+	return scanned;
+}
+
+static void AppendUsnRecord(
+	std::vector<unsigned char> *pBuffer, int iVersion, std::uint64_t ullFile,
+	std::uint64_t ullParent, std::int64_t llUsn, std::uint32_t uReason,
+	std::uint32_t uAttributes, const Name &sName
+) {
+	const bool bV3 = iVersion == 3;
+	const std::size_t cbHeader = bV3 ? Usn::cbV3Header : Usn::cbV2Header;
+	const std::size_t cbName = sName.size() * sizeof(NameChar);
+	const std::size_t cbRecord = (cbHeader + cbName + 7) / 8 * 8;
+	const std::size_t ib = pBuffer->size();
+	pBuffer->resize(ib + cbRecord);
+	unsigned char *pb = &(*pBuffer)[ib];
+	auto store = [&](std::size_t ibField, auto value) { std::memcpy(pb + ibField, &value, sizeof(value)); };
+	store(Usn::cbOffRecordLength, static_cast<std::uint32_t>(cbRecord));
+	store(Usn::cbOffMajorVersion, static_cast<std::uint16_t>(iVersion));
+	store(Usn::cbOffFileReference, ullFile);
+	store(bV3 ? Usn::cbOffV3ParentReference : Usn::cbOffV2ParentReference, ullParent);
+	store(bV3 ? Usn::cbOffV3Usn : Usn::cbOffV2Usn, llUsn);
+	store(bV3 ? Usn::cbOffV3Reason : Usn::cbOffV2Reason, uReason);
+	store(bV3 ? Usn::cbOffV3FileAttributes : Usn::cbOffV2FileAttributes, uAttributes);
+	store(bV3 ? Usn::cbOffV3FileNameLength : Usn::cbOffV2FileNameLength, static_cast<std::uint16_t>(cbName));
+	store(bV3 ? Usn::cbOffV3FileNameOffset : Usn::cbOffV2FileNameOffset, static_cast<std::uint16_t>(cbHeader));
+	std::memcpy(pb + cbHeader, sName.data(), cbName);
+}
+
+static std::vector<Usn::Record> ReadAll(const std::vector<unsigned char> &buffer) {
+	Usn::CReader reader(buffer.data(), buffer.size());
+	std::vector<Usn::Record> records;
+	Usn::Record record;
+	while (reader.Next(&record) == ADSX::Mft::ReadResult::Ok) records.push_back(record);
+	return records;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestStreamIndex) {
+	  public:
+		TEST_METHOD(TestBuildAndQuery) {
+			const Scanned scanned = ScanAndBuild();
+			CIndex index;
+			Assert::IsTrue(index.Attach(scanned.index.data(), scanned.index.size()));
+			Assert::AreEqual(index.GetMetadata().ullJournalId, 77ULL);
+			Assert::IsTrue(index.GetMetadata().llNextUsn == 4096);
+
+			// Whatever the case it was asked for in
+			std::vector<Stream> streams;
+			index.FindByName(L"ZONE.IDENTIFIER", &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(2));
+			Assert::AreEqual(streams[1].ullRecord, scanned.ullNested);
+			Assert::AreEqual(streams[1].ullSize, 30ULL);
+			index.FindByName(L"Zone", &streams);
+			Assert::IsTrue(streams.empty());
+
+			// The same paths the scanner made
+			for (const auto &found : scanned.found) {
+				Name sPath;
+				Assert::IsTrue(index.PathOf(found.ullRecord, &sPath));
+				Assert::IsTrue(sPath == found.sPath);
+				Assert::IsTrue(index.HasStreams(found.ullRecord));
+			}
+			Assert::IsFalse(index.HasStreams(scanned.ullFiles));
+			File file;
+			Assert::IsTrue(index.FindFile(scanned.ullFiles, &file));
+			Assert::IsTrue(file.bDirectory);
+			Assert::IsFalse(index.FindFile(scanned.ullPlain, &file));
+		}
+
+		TEST_METHOD(TestRejectsBadFiles) {
+			const Scanned scanned = ScanAndBuild();
+			CIndex index;
+			std::vector<unsigned char> bad = scanned.index;
+			bad.pop_back();
+			Assert::IsFalse(index.Attach(bad.data(), bad.size()));
+
+			bad = scanned.index;
+			bad[cbOffFileCount] ^= 0x80;
+			Assert::IsFalse(index.Attach(bad.data(), bad.size()));
+
+			// Checksum right, but the sections run off the end
+			bad = scanned.index;
+			const std::uint64_t cHuge = 1ULL << 40;
+			std::memcpy(&bad[cbOffStreamCount], &cHuge, sizeof(cHuge));
+			std::memset(&bad[cbOffChecksum], 0, 4);
+			const std::uint32_t uCrc = ADSX::Crc32c(bad.data(), cbHeader);
+			std::memcpy(&bad[cbOffChecksum], &uCrc, 4);
+			Assert::IsFalse(index.Attach(bad.data(), bad.size()));
+
+			std::vector<Stream> streams;
+			index.FindByName(L"two", &streams);
+			Assert::IsTrue(streams.empty());
+		}
+
+		TEST_METHOD(TestChangesAndCompaction) {
+			const Scanned scanned = ScanAndBuild();
+			CIndex index;
+			Assert::IsTrue(index.Attach(scanned.index.data(), scanned.index.size()));
+
+			// Renaming a directory moves everything under it
+			index.SetFile(File{scanned.ullFiles, ullRecordRoot, L"Renamed", true});
+			Name sPath;
+			Assert::IsTrue(index.PathOf(scanned.ullNested, &sPath));
+			Assert::IsTrue(sPath == Name(L"Renamed\\Sub\\b.txt"));
+
+			// A new stream on a file the index didn't have
+			index.SetFile(File{scanned.ullPlain, scanned.ullFiles, L"plain.txt", false});
+			index.SetStreams(scanned.ullPlain, {{0, L"Zone.Identifier", 10}});
+			std::vector<Stream> streams;
+			index.FindByName(L"zone.identifier", &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(3));
+
+			// Deleting the one in Sub leaves Sub leading nowhere
+			index.RemoveFile(scanned.ullNested);
+			index.FindByName(L"zone.identifier", &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(2));
+			Assert::IsFalse(index.PathOf(scanned.ullNested, &sPath));
+			Assert::AreEqual(index.ChangeCount(), static_cast<std::size_t>(3));
+
+			index.SetNextUsn(8192);
+			std::vector<unsigned char> compacted = index.Serialize();
+			CIndex reopened;
+			Assert::IsTrue(reopened.Attach(compacted.data(), compacted.size()));
+			Assert::AreEqual(reopened.ChangeCount(), static_cast<std::size_t>(0));
+			Assert::IsTrue(reopened.GetMetadata().llNextUsn == 8192);
+			reopened.FindByName(L"Zone.Identifier", &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(2));
+			Assert::IsTrue(reopened.PathOf(scanned.ullPlain, &sPath));
+			Assert::IsTrue(sPath == Name(L"Renamed\\plain.txt"));
+			File file;
+			Assert::IsFalse(reopened.FindFile(scanned.ullNested, &file));
+			Assert::IsFalse(reopened.FindFile(scanned.ullNested - 1, &file));  // Sub
+
+			// Adopting keeps its own copy
+			Assert::IsTrue(index.Adopt(std::move(compacted)));
+			Assert::AreEqual(index.FileSize(), reopened.FileSize());
+			index.StreamsOf(scanned.ullPlain, &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(1));
+		}
+
+		TEST_METHOD(TestUsnRecords) {
+			std::vector<unsigned char> buffer;
+			AppendUsnRecord(&buffer, 2, 0x0003000000000040, 0x0001000000000005, 100, Usn::REASON_FILE_CREATE, 0, L"new.txt");
+			AppendUsnRecord(&buffer, 3, 0x0003000000000041, 0x0001000000000005, 200, Usn::REASON_CLOSE, Usn::uAttributeDirectory, L"dir");
+			const std::vector<Usn::Record> records = ReadAll(buffer);
+			Assert::AreEqual(records.size(), static_cast<std::size_t>(2));
+			Assert::AreEqual(records[0].ullFileReference, 0x0003000000000040ULL);
+			Assert::IsTrue(records[0].svName == NameView(L"new.txt"));
+			Assert::IsTrue(records[1].llUsn == 200);
+			Assert::AreEqual(records[1].uAttributes, Usn::uAttributeDirectory);
+			Assert::IsTrue(records[1].svName == NameView(L"dir"));
+
+			// A name that runs past its record
+			std::vector<unsigned char> bad = buffer;
+			const std::uint16_t cbName = 200;
+			std::memcpy(&bad[Usn::cbOffV2FileNameLength], &cbName, sizeof(cbName));
+			Usn::CReader reader(bad.data(), bad.size());
+			Usn::Record record;
+			Assert::IsTrue(reader.Next(&record) == ADSX::Mft::ReadResult::Malformed);
+		}
+
+		TEST_METHOD(TestChangeSet) {
+			std::vector<unsigned char> buffer;
+			// Renamed: the old name's half doesn't count
+			AppendUsnRecord(&buffer, 2, 0x40, 5, 1, Usn::REASON_RENAME_OLD_NAME, 0, L"old.txt");
+			AppendUsnRecord(&buffer, 2, 0x40, 0x41, 2, Usn::REASON_RENAME_NEW_NAME, 0, L"new.txt");
+			AppendUsnRecord(&buffer, 2, 0x40, 0x41, 3, Usn::REASON_NAMED_DATA_EXTEND | Usn::REASON_CLOSE, 0, L"new.txt");
+			// Deleted, and the record reused straight away
+			AppendUsnRecord(&buffer, 2, 0x0001000000000042, 5, 4, Usn::REASON_NAMED_DATA_EXTEND, 0, L"doomed");
+			AppendUsnRecord(&buffer, 2, 0x0001000000000042, 5, 5, Usn::REASON_FILE_DELETE | Usn::REASON_CLOSE, 0, L"doomed");
+			AppendUsnRecord(&buffer, 2, 0x0002000000000042, 5, 6, Usn::REASON_FILE_CREATE, 0, L"reborn");
+			// Just written to
+			AppendUsnRecord(&buffer, 2, 0x43, 5, 7, Usn::REASON_DATA_EXTEND, 0, L"log.txt");
+
+			Usn::CChangeSet changes;
+			for (const Usn::Record &record : ReadAll(buffer)) changes.Add(record);
+			Assert::AreEqual(changes.Count(), static_cast<std::size_t>(3));
+			const Usn::Change &renamed = changes.Changes().at(0x40);
+			Assert::IsTrue(renamed.bNamed && renamed.bStreams && !renamed.bRemoved);
+			Assert::AreEqual(renamed.ullParentReference, 0x41ULL);
+			Assert::IsTrue(renamed.sName == Name(L"new.txt"));
+			const Usn::Change &reborn = changes.Changes().at(0x42);
+			Assert::IsTrue(reborn.bRemoved && reborn.bNamed && !reborn.bStreams);
+			Assert::IsTrue(reborn.sName == Name(L"reborn"));
+			Assert::IsFalse(changes.Changes().at(0x43).bStreams);
+		}
+
+		TEST_METHOD(TestApplyChanges) {
+			const Scanned scanned = ScanAndBuild();
+			CIndex index;
+			Assert::IsTrue(index.Attach(scanned.index.data(), scanned.index.size()));
+
+			// What the volume says now
+			const std::uint64_t ullNewDir = 100;
+			const std::uint64_t ullNewFile = 101;
+			const std::uint64_t ullRootReference = 0x0005000000000000 | ullRecordRoot;
+			std::map<std::uint64_t, std::vector<Stream>> volumeStreams;
+			volumeStreams[ullNewFile] = {{ullNewFile, L"Zone.Identifier", 5}};
+			const std::map<std::uint64_t, File> volumeFiles = {
+				{ullNewDir, File{ullNewDir, ullRecordRoot, L"Downloads", true}},
+			};
+			int cQueries = 0;
+			auto queryStreams = [&](std::uint64_t ullReference, std::vector<Stream> *pStreams) {
+				cQueries++;
+				auto it = volumeStreams.find(ullReference);
+				if (it == volumeStreams.end()) return false;
+				*pStreams = it->second;
+				return true;
+			};
+			auto queryFile = [&](std::uint64_t ullReference, File *pFile, std::uint64_t *pullParentReference) {
+				auto it = volumeFiles.find(ullReference);
+				if (it == volumeFiles.end()) return false;
+				*pFile = it->second;
+				*pullParentReference = ullRootReference;
+				return true;
+			};
+
+			std::vector<unsigned char> buffer;
+			AppendUsnRecord(&buffer, 2, ullNewFile, ullNewDir, 1, Usn::REASON_FILE_CREATE, 0, L"setup.exe");
+			AppendUsnRecord(&buffer, 2, ullNewFile, ullNewDir, 2, Usn::REASON_STREAM_CHANGE | Usn::REASON_CLOSE, 0, L"setup.exe");
+			AppendUsnRecord(&buffer, 2, scanned.ullNested, scanned.ullFiles, 3, Usn::REASON_FILE_DELETE, 0, L"b.txt");
+			AppendUsnRecord(&buffer, 2, scanned.ullFiles, ullRecordRoot, 4, Usn::REASON_RENAME_NEW_NAME, Usn::uAttributeDirectory, L"Stuff");
+			// Nothing to do with streams, on a file the index doesn't have
+			AppendUsnRecord(&buffer, 2, scanned.ullPlain, scanned.ullFiles, 5, Usn::REASON_DATA_EXTEND, 0, L"plain.txt");
+			Usn::CChangeSet changes;
+			for (const Usn::Record &record : ReadAll(buffer)) changes.Add(record);
+			ApplyChanges(index, changes, queryStreams, queryFile);
+			Assert::AreEqual(cQueries, 1);
+
+			std::vector<Stream> streams;
+			index.FindByName(L"Zone.Identifier", &streams);
+			Assert::AreEqual(streams.size(), static_cast<std::size_t>(2));
+			Assert::AreEqual(streams[1].ullRecord, ullNewFile);
+			Name sPath;
+			Assert::IsTrue(index.PathOf(ullNewFile, &sPath));
+			Assert::IsTrue(sPath == Name(L"Downloads\\setup.exe"));
+			Assert::IsTrue(index.PathOf(streams[0].ullRecord, &sPath));
+			Assert::IsTrue(sPath == Name(L"Stuff\\a.txt"));
+			File file;
+			Assert::IsFalse(index.FindFile(scanned.ullPlain, &file));
+		}
+	};
+}
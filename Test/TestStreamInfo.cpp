@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "StreamInfo.h"
+#include "SyntheticStreamInfo.h"
+
+#include <cstring>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::StreamInfo;
+
+
+static std::size_t CountEntries(const std::vector<unsigned char> &buf, bool *pbMalformed) {
+	CReader reader(buf.data(), buf.size());
+	Entry entry;
+	std::size_t cEntries = 0;
+	while (reader.Next(&entry) == ReadResult::Ok) ++cEntries;
+	*pbMalformed = reader.IsMalformed();
+	return cEntries;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestStreamInfo) {
+	  public:
+		TEST_METHOD(TestEmptyBuffer) {
+			CReader reader(nullptr, 0);
+			Entry entry;
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::End);
+			Assert::IsFalse(reader.IsMalformed());
+		}
+
+		TEST_METHOD(TestMainStreamOnly) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 42, true);
+
+			CReader reader(buf.data(), buf.size());
+			Entry entry;
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(entry.svName == L"::$DATA");
+			Assert::AreEqual(entry.llSize, static_cast<std::int64_t>(42));
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::End);
+		}
+
+		TEST_METHOD(TestSeveralStreams) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, false);
+			PushEntry(buf, L":alternate1:$DATA", 23, false);
+			PushEntry(buf, L":Zone.Identifier:$DATA", 26, true);
+
+			CReader reader(buf.data(), buf.size());
+			Entry entry;
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(entry.svName == L":alternate1:$DATA");
+			Assert::AreEqual(entry.llSize, static_cast<std::int64_t>(23));
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(entry.svName == L":Zone.Identifier:$DATA");
+			Assert::AreEqual(entry.llAllocationSize, static_cast<std::int64_t>(4096));
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::End);
+			Assert::IsFalse(reader.IsMalformed());
+		}
+
+		TEST_METHOD(TestManyStreams) {
+			std::vector<unsigned char> buf;
+			const std::size_t cStreams = 1000;
+			for (std::size_t i = 0; i < cStreams; i++) {
+				PushEntry(buf, L":stream:$DATA", i, i == cStreams - 1);
+			}
+			bool bMalformed;
+			Assert::AreEqual(CountEntries(buf, &bMalformed), cStreams);
+			Assert::IsFalse(bMalformed);
+		}
+
+		TEST_METHOD(TestTruncatedName) {
+			// What a partially filled (ERROR_MORE_DATA) buffer can look like
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, false);
+			PushEntry(buf, L":alternate1:$DATA", 23, true);
+			buf.resize(buf.size() - 4);
+
+			bool bMalformed;
+			Assert::AreEqual(CountEntries(buf, &bMalformed), static_cast<std::size_t>(1));
+			Assert::IsTrue(bMalformed);
+		}
+
+		TEST_METHOD(TestNextEntryOffsetPastEnd) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, true);
+			const std::uint32_t cbNext = 0x1000;
+			std::memcpy(&buf[cbOffNextEntryOffset], &cbNext, sizeof(cbNext));
+
+			bool bMalformed;
+			Assert::AreEqual(CountEntries(buf, &bMalformed), static_cast<std::size_t>(0));
+			Assert::IsTrue(bMalformed);
+		}
+
+		TEST_METHOD(TestNextEntryOverlapsName) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L":alternate1:$DATA", 20, false);
+			PushEntry(buf, L":alternate2:$DATA", 20, true);
+			const std::uint32_t cbNext = static_cast<std::uint32_t>(cbEntryHeader);
+			std::memcpy(&buf[cbOffNextEntryOffset], &cbNext, sizeof(cbNext));
+
+			bool bMalformed;
+			CountEntries(buf, &bMalformed);
+			Assert::IsTrue(bMalformed);
+		}
+
+		TEST_METHOD(TestWriterRoundTrip) {
+			std::vector<unsigned char> buf(256);
+			CWriter writer(buf.data(), buf.size());
+			Assert::IsTrue(writer.Append(L"::$DATA", 20, 4096));
+			Assert::IsTrue(writer.AppendData(L"alternate1", 23, 4096));
+
+			CReader reader(buf.data(), writer.Size());
+			Entry entry;
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(entry.svName == L"::$DATA");
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::Ok);
+			Assert::IsTrue(entry.svName == L":alternate1:$DATA");
+			Assert::IsTrue(TrimName(entry.svName) == L"alternate1");
+			Assert::AreEqual(entry.llSize, static_cast<std::int64_t>(23));
+			Assert::IsTrue(reader.Next(&entry) == ReadResult::End);
+			Assert::IsFalse(reader.IsMalformed());
+		}
+
+		TEST_METHOD(TestWriterStopsWhenFull) {
+			std::vector<unsigned char> buf(64);
+			CWriter writer(buf.data(), buf.size());
+			Assert::IsTrue(writer.AppendData(L"a", 1, 1));
+			const std::size_t cbBefore = writer.Size();
+			Assert::IsFalse(writer.AppendData(L"far too long to fit", 1, 1));
+			Assert::AreEqual(writer.Size(), cbBefore);
+		}
+
+		TEST_METHOD(TestOddNameLength) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, true);
+			const std::uint32_t cbName = 3;
+			std::memcpy(&buf[cbOffStreamNameLength], &cbName, sizeof(cbName));
+
+			bool bMalformed;
+			Assert::AreEqual(CountEntries(buf, &bMalformed), static_cast<std::size_t>(0));
+			Assert::IsTrue(bMalformed);
+		}
+
+		TEST_METHOD(TestHasNamedStream) {
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, true);
+			Assert::IsFalse(HasNamedStream(CReader(buf.data(), buf.size())));
+			Assert::IsFalse(HasNamedStream(CReader(nullptr, 0)));
+
+			buf.clear();
+			PushEntry(buf, L"::$DATA", 20, false);
+			PushEntry(buf, L":alternate1:$DATA", 23, true);
+			Assert::IsTrue(HasNamedStream(CReader(buf.data(), buf.size())));
+		}
+
+		TEST_METHOD(TestHasNamedStreamMalformed) {
+			// Can't tell, so worth a closer look
+			std::vector<unsigned char> buf;
+			PushEntry(buf, L"::$DATA", 20, true);
+			const std::uint32_t cbName = 3;
+			std::memcpy(&buf[cbOffStreamNameLength], &cbName, sizeof(cbName));
+			Assert::IsTrue(HasNamedStream(CReader(buf.data(), buf.size())));
+		}
+	};
+}
@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "StreamUsage.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Usage;
+using ADSX::Mft::FoundStream;
+
+
+static FoundStream Stream(const Name &sPath, const Name &sName, std::uint64_t ullSize, bool bDirectory = false) {
+	return FoundStream{0, sPath, sName, ullSize, bDirectory};
+}
+
+// A made-up volume: directories d0..d7, each with subdirectories s0..s3 of
+// files, every one with a few streams of made-up sizes. Plus some names that
+// sort badly ("d1 x" between "d1" and "d1\...").
+static std::vector<FoundStream> MakeVolume() {
+	std::vector<FoundStream> streams;
+	unsigned uSeed = 1;
+	auto fnNext = [&]() {
+		uSeed = uSeed * 1103515245 + 12345;
+		return (uSeed >> 8) % 1000;
+	};
+	for (unsigned iDir = 0; iDir < 8; iDir++) {
+		const Name sDir = Name(L"d") + static_cast<NameChar>(L'0' + iDir);
+		streams.push_back(Stream(sDir, L"dirstream", 7, true));
+		streams.push_back(Stream(sDir + L" x.txt", L"Zone.Identifier", 26));
+		for (unsigned iSub = 0; iSub < 4; iSub++) {
+			const Name sSub = sDir + L"\\s" + static_cast<NameChar>(L'0' + iSub);
+			for (unsigned iFile = 0; iFile < 300; iFile++) {
+				Name sFile = sSub + L"\\f";
+				for (unsigned u = iFile; ; u /= 10) {
+					sFile += static_cast<NameChar>(L'0' + u % 10);
+					if (u < 10) break;
+				}
+				sFile += iFile % 3 == 0 ? L".doc" : iFile % 3 == 1 ? L".JPG" : L"";
+				streams.push_back(Stream(sFile, L"Zone.Identifier", 26));
+				if (iFile % 2) streams.push_back(Stream(sFile, L"zone.identifier:extra", fnNext()));
+				if (iFile % 5 == 0) streams.push_back(Stream(sFile, L"SummaryInformation", 1000 + fnNext()));
+			}
+		}
+	}
+	streams.push_back(Stream(L"", L"rootstream", 3, true));
+	// Not in sorted order, the way the scanner's threads hand them over
+	std::reverse(streams.begin(), streams.end());
+	std::rotate(streams.begin(), streams.begin() + streams.size() / 3, streams.end());
+	return streams;
+}
+
+// Every directory's total the slow way
+static std::map<Name, Totals> SubtreesByBruteForce(const std::vector<FoundStream> &streams) {
+	std::map<Name, std::map<Name, Totals>> filesByDirectory;
+	for (const FoundStream &stream : streams) {
+		for (std::size_t ich = 0; ich <= stream.sPath.size(); ich++) {
+			const bool bEnd = ich == stream.sPath.size();
+			if (stream.sPath.empty() || (!bEnd && stream.sPath[ich] != L'\\') || (bEnd && !stream.bDirectory)) continue;
+			Totals &totals = filesByDirectory[stream.sPath.substr(0, ich)][stream.sPath];
+			totals.cFiles = 1;
+			totals.cStreams++;
+			totals.ullBytes += stream.ullSize;
+		}
+	}
+	std::map<Name, Totals> subtrees;
+	for (const auto &directory : filesByDirectory) {
+		for (const auto &file : directory.second) subtrees[directory.first] += file.second;
+	}
+	return subtrees;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestStreamUsage) {
+	  public:
+		TEST_METHOD(TestTopKKeepsTheBiggest) {
+			CTopK top(3);
+			for (std::uint64_t i = 0; i < 100; i++) {
+				Totals totals;
+				totals.ullBytes = (i * 37) % 100;
+				top.Offer(Ranked{Name(L"k") + static_cast<NameChar>(L'0' + i % 10), totals});
+			}
+			const std::vector<Ranked> ranked = top.Take();
+			Assert::AreEqual(static_cast<std::size_t>(3), ranked.size());
+			Assert::AreEqual(99ull, static_cast<unsigned long long>(ranked[0].totals.ullBytes));
+			Assert::AreEqual(98ull, static_cast<unsigned long long>(ranked[1].totals.ullBytes));
+			Assert::AreEqual(97ull, static_cast<unsigned long long>(ranked[2].totals.ullBytes));
+		}
+
+		TEST_METHOD(TestPathOrderKeepsDirectoriesTogether) {
+			Assert::IsTrue(PathBefore(L"a", L"a\\b"));
+			Assert::IsTrue(PathBefore(L"a\\b", L"a b"));
+			Assert::IsTrue(PathBefore(L"a\\z", L"a.txt"));
+			Assert::IsFalse(PathBefore(L"a b", L"a\\b"));
+			Assert::IsFalse(PathBefore(L"a", L"a"));
+		}
+
+		TEST_METHOD(TestSameAnswerOnAnyNumberOfThreads) {
+			std::vector<FoundStream> streams = MakeVolume();
+			const std::map<Name, Totals> expected = SubtreesByBruteForce(streams);
+			Totals total;
+			for (const FoundStream &stream : streams) {
+				total.cStreams++;
+				total.ullBytes += stream.ullSize;
+			}
+
+			for (unsigned cWorkers : {1u, 2u, 3u, 8u}) {
+				std::vector<FoundStream> copy = streams;
+				// Small enough shares that directories straddle them
+				const Report report = Analyze(copy, 1000, cWorkers);
+				Assert::AreEqual(total.cStreams, report.total.cStreams);
+				Assert::AreEqual(total.ullBytes, report.total.ullBytes);
+				Assert::AreEqual(expected.size(), report.subtrees.size());
+				for (const Ranked &subtree : report.subtrees) {
+					auto it = expected.find(subtree.sKey);
+					Assert::IsTrue(it != expected.end());
+					Assert::AreEqual(it->second.cFiles, subtree.totals.cFiles);
+					Assert::AreEqual(it->second.cStreams, subtree.totals.cStreams);
+					Assert::AreEqual(it->second.ullBytes, subtree.totals.ullBytes);
+				}
+				for (std::size_t i = 1; i < report.subtrees.size(); i++) {
+					Assert::IsTrue(RanksAbove(report.subtrees[i - 1], report.subtrees[i]));
+				}
+				Assert::AreEqual(static_cast<std::size_t>(1000), report.files.size());
+				Assert::IsTrue(report.files[0].totals.ullBytes >= 1000);
+			}
+		}
+
+		TEST_METHOD(TestNamesAndExtensionsIgnoreCase) {
+			std::vector<FoundStream> streams = {
+				Stream(L"a.txt", L"Zone.Identifier", 10),
+				Stream(L"b.TXT", L"ZONE.IDENTIFIER", 20),
+				Stream(L"c", L"other", 5),
+				Stream(L"d.x\\e", L"other", 1),
+				Stream(L"d.x", L"Zone.Identifier", 2, true),
+			};
+			const Report report = Analyze(streams, 10, 1);
+			Assert::AreEqual(static_cast<std::size_t>(2), report.names.size());
+			Assert::AreEqual(32ull, static_cast<unsigned long long>(report.names[0].totals.ullBytes));
+			Assert::AreEqual(3ull, static_cast<unsigned long long>(report.names[0].totals.cFiles));
+			Assert::AreEqual(6ull, static_cast<unsigned long long>(report.names[1].totals.ullBytes));
+
+			// A directory's own streams have no extension, and the file in
+			// it has none either
+			Assert::AreEqual(static_cast<std::size_t>(2), report.extensions.size());
+			Assert::IsTrue(report.extensions[0].sKey == Name(L"txt") || report.extensions[0].sKey == Name(L"TXT"));
+			Assert::AreEqual(30ull, static_cast<unsigned long long>(report.extensions[0].totals.ullBytes));
+			Assert::IsTrue(report.extensions[1].sKey.empty());
+			Assert::AreEqual(6ull, static_cast<unsigned long long>(report.extensions[1].totals.ullBytes));
+
+			Assert::AreEqual(static_cast<std::size_t>(1), report.subtrees.size());
+			Assert::IsTrue(report.subtrees[0].sKey == Name(L"d.x"));
+			Assert::AreEqual(3ull, static_cast<unsigned long long>(report.subtrees[0].totals.ullBytes));
+			Assert::AreEqual(2ull, static_cast<unsigned long long>(report.subtrees[0].totals.cFiles));
+		}
+
+		TEST_METHOD(TestNothingFound) {
+			std::vector<FoundStream> streams;
+			const Report report = Analyze(streams, 10);
+			Assert::AreEqual(0ull, static_cast<unsigned long long>(report.total.cStreams));
+			Assert::IsTrue(report.files.empty() && report.subtrees.empty() && report.names.empty());
+		}
+	};
+}
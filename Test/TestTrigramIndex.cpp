@@ -0,0 +1,223 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "TrigramIndex.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace ADSX::Trigram;
+
+
+// A document indexed from sContent
+static Document MakeDocument(const Name &sPath, const std::string &sContent, std::uint64_t ullStamp = 1) {
+	CExtractor extractor;
+	extractor.Add(reinterpret_cast<const unsigned char *>(sContent.data()), sContent.size());
+	Document document;
+	document.sPath = sPath;
+	document.ullSize = sContent.size();
+	document.ullStamp = ullStamp;
+	document.bIndexed = true;
+	document.trigrams = extractor.Take();
+	return document;
+}
+
+// Pseudo-random bytes from a small alphabet, so most trigrams turn up somewhere
+static std::string MakeContent(std::size_t cb, std::uint32_t uSeed) {
+	std::string sContent(cb, '\0');
+	for (char &ch : sContent) {
+		uSeed = uSeed * 1103515245 + 12345;
+		ch = "abcdef\0"[(uSeed >> 16) % 7];
+	}
+	return sContent;
+}
+
+static Name PathOf(int i) {
+	const std::string s = "dir\\file" + std::to_string(i) + ":stream";
+	return Name(s.begin(), s.end());
+}
+
+static std::vector<Name> Candidates(const CIndex &index, const std::vector<std::string> &literals) {
+	std::vector<Name> paths;
+	index.Candidates(literals, &paths);
+	return paths;
+}
+
+// The documents that really contain any of literals
+static std::vector<Name> Containing(
+	const std::vector<std::pair<Name, std::string>> &contents,
+	const std::vector<std::string> &literals
+) {
+	std::vector<Name> paths;
+	for (const auto &content : contents) {
+		for (const std::string &sLiteral : literals) {
+			if (content.second.find(sLiteral) != std::string::npos) {
+				paths.push_back(content.first);
+				break;
+			}
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+	return paths;
+}
+
+
+namespace Test {
+	TEST_CLASS(TestTrigramIndex) {
+	  public:
+		TEST_METHOD(TestExtractor) {
+			CExtractor extractor;
+			// Split across calls, with a repeat
+			extractor.Add(reinterpret_cast<const unsigned char *>("abca"), 4);
+			extractor.Add(reinterpret_cast<const unsigned char *>("bc"), 2);
+			const std::vector<Trigram> trigrams = extractor.Take();
+			Assert::IsTrue(trigrams == TrigramsOf("abcabc"));
+			Assert::AreEqual(std::size_t(3), trigrams.size());  // abc, bca, cab
+			Assert::AreEqual(Trigram(0x616263), trigrams[0]);
+
+			// Nothing carries over to the next stream
+			extractor.Add(reinterpret_cast<const unsigned char *>("xy"), 2);
+			Assert::IsTrue(extractor.Take().empty());
+			Assert::IsTrue(TrigramsOf("ab").empty());
+		}
+
+		TEST_METHOD(TestVarints) {
+			std::vector<unsigned char> bytes;
+			const std::uint32_t aValues[] = {0, 1, 127, 128, 16383, 16384, UINT32_MAX};
+			for (std::uint32_t u : aValues) AppendVarint(&bytes, u);
+			Assert::AreEqual(std::size_t(1 + 1 + 1 + 2 + 2 + 3 + 5), bytes.size());
+			const unsigned char *pb = bytes.data();
+			for (std::uint32_t uExpected : aValues) {
+				std::uint32_t u;
+				Assert::IsTrue(ReadVarint(&pb, bytes.data() + bytes.size(), &u));
+				Assert::AreEqual(uExpected, u);
+			}
+			std::uint32_t u;
+			Assert::IsFalse(ReadVarint(&pb, bytes.data() + bytes.size(), &u));
+		}
+
+		TEST_METHOD(TestCandidatesAgreeWithBruteForce) {
+			std::vector<std::pair<Name, std::string>> contents;
+			std::vector<Document> documents;
+			for (int i = 0; i < 200; i++) {
+				contents.emplace_back(PathOf(i), MakeContent(50 + i * 7, i + 1));
+				documents.push_back(MakeDocument(contents.back().first, contents.back().second));
+			}
+			const std::vector<unsigned char> bytes = CIndex::Build(documents);
+			CIndex index;
+			Assert::IsTrue(index.Attach(bytes.data(), bytes.size()));
+			Assert::AreEqual(std::size_t(200), index.DocumentCount());
+
+			const std::vector<std::vector<std::string>> queries = {
+				{"abc"}, {"fedcba"}, {"aaaa"}, {std::string("a\0f", 3)}, {"abcdefabcdef"},
+				{"zzz"}, {"dead", "beef"}, {"ace", "fab", "cab"},
+			};
+			for (const std::vector<std::string> &literals : queries) {
+				const std::vector<Name> candidates = Candidates(index, literals);
+				// Never misses one; may take in a few that only have the trigrams
+				const std::vector<Name> expected = Containing(contents, literals);
+				Assert::IsTrue(std::includes(candidates.begin(), candidates.end(), expected.begin(), expected.end()));
+				for (const Name &sPath : candidates) {
+					const auto it = std::find_if(contents.begin(), contents.end(), [&](const auto &content) {
+						return content.first == sPath;
+					});
+					bool bHasTrigrams = false;
+					for (const std::string &sLiteral : literals) {
+						const std::vector<Trigram> wanted = TrigramsOf(sLiteral);
+						const std::vector<Trigram> have = TrigramsOf(it->second);
+						bHasTrigrams |= std::includes(have.begin(), have.end(), wanted.begin(), wanted.end());
+					}
+					Assert::IsTrue(bHasTrigrams);
+				}
+			}
+			Assert::IsTrue(Candidates(index, {"zzz"}).empty());
+		}
+
+		TEST_METHOD(TestShortLiteralsAndUnindexed) {
+			std::vector<Document> documents = {MakeDocument(L"a", "hello world"), MakeDocument(L"b", "goodbye")};
+			Document big;
+			big.sPath = L"c";
+			big.ullSize = 1ull << 40;
+			big.bIndexed = false;
+			documents.push_back(big);
+			CIndex index;
+			Assert::IsTrue(index.Adopt(CIndex::Build(documents)));
+
+			// Too short to narrow anything down
+			Assert::AreEqual(std::size_t(3), Candidates(index, {"o"}).size());
+			Assert::AreEqual(std::size_t(3), Candidates(index, {"hello", "lo"}).size());
+			// What wasn't read could hold anything
+			const std::vector<Name> candidates = Candidates(index, {"hello"});
+			Assert::IsTrue(candidates == std::vector<Name>{L"a", L"c"});
+			Assert::IsTrue(Candidates(index, {"xyz"}) == std::vector<Name>{L"c"});
+		}
+
+		TEST_METHOD(TestChangesOverlayAndSerialize) {
+			CIndex index;
+			Assert::IsTrue(index.Adopt(CIndex::Build({
+				MakeDocument(L"keep", "unchanged text"),
+				MakeDocument(L"edit", "old words"),
+				MakeDocument(L"gone", "old words too"),
+			})));
+			index.SetDocument(MakeDocument(L"edit", "new words", 2));
+			index.SetDocument(MakeDocument(L"added", "new stream"));
+			index.RemoveDocument(L"gone");
+			Assert::AreEqual(std::size_t(3), index.ChangeCount());
+			Assert::AreEqual(std::size_t(3), index.DocumentCount());
+
+			auto check = [](const CIndex &index) {
+				Assert::IsTrue(Candidates(index, {"old"}).empty());
+				Assert::IsTrue(Candidates(index, {"new"}) == std::vector<Name>{L"added", L"edit"});
+				Assert::IsTrue(Candidates(index, {"text"}) == std::vector<Name>{L"keep"});
+				Assert::IsTrue(Candidates(index, {"words"}) == std::vector<Name>{L"edit"});
+				Document document;
+				Assert::IsTrue(index.FindDocument(L"edit", &document));
+				Assert::AreEqual(std::uint64_t(2), document.ullStamp);
+				Assert::AreEqual(std::uint64_t(9), document.ullSize);
+				Assert::IsFalse(index.FindDocument(L"gone", &document));
+			};
+			check(index);
+
+			// Written out and read back, the changes are in the file
+			CIndex reread;
+			Assert::IsTrue(reread.Adopt(index.Serialize()));
+			Assert::AreEqual(std::size_t(0), reread.ChangeCount());
+			Assert::AreEqual(std::size_t(3), reread.DocumentCount());
+			check(reread);
+			Assert::IsTrue(index.Serialize() == reread.Serialize());
+		}
+
+		TEST_METHOD(TestRejectsDamage) {
+			const std::vector<unsigned char> bytes = CIndex::Build({MakeDocument(L"a", "some content here")});
+			CIndex index;
+			Assert::IsTrue(index.Attach(bytes.data(), bytes.size()));
+
+			// Every single-byte change to the header is noticed
+			for (std::size_t ib = 0; ib < cbHeader; ib++) {
+				std::vector<unsigned char> damaged = bytes;
+				damaged[ib] ^= 0x40;
+				Assert::IsFalse(index.Attach(damaged.data(), damaged.size()));
+				Assert::AreEqual(std::size_t(0), index.DocumentCount());
+			}
+			Assert::IsFalse(index.Attach(bytes.data(), bytes.size() - 8));
+			Assert::IsFalse(index.Attach(nullptr, 0));
+
+			// Garbled postings don't read past the end or name documents
+			// that aren't there
+			CView view;
+			std::vector<unsigned char> garbled = bytes;
+			const std::size_t ibPostings = static_cast<std::size_t>(Load<std::uint64_t>(garbled.data() + cbOffPostingsOffset));
+			garbled[ibPostings] = 0xFF;
+			Assert::IsTrue(view.Attach(garbled.data(), garbled.size()));
+			std::vector<std::uint32_t> documents;
+			for (std::size_t i = 0; i < view.TrigramCount(); i++) {
+				view.PostingsAt(i, &documents);
+				for (std::uint32_t iDocument : documents) Assert::IsTrue(iDocument < view.DocumentCount());
+			}
+		}
+	};
+}
@@ -0,0 +1,80 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "UsageAnalyzer.h"
+#include "SyntheticDisk.h"
+#include "SyntheticMft.h"
+#include "defer.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CUsageAnalyzer;
+
+
+static std::vector<unsigned char> MakeVolume() {
+	CSyntheticVolume volume(256, true);
+	const std::uint64_t ullFiles = volume.Add(ADSX::Mft::ullRecordRoot, L"Files", true);
+	volume.Add(ullFiles, L"a.txt", false, {{L"small", 5, false}, {L"big", 100000, true}});
+	volume.Add(ullFiles, L"b.bin", false, {{L"s1", 10, false}, {L"s2", 20000, true}});
+	return volume.Build();
+}
+
+static void WriteImage(const std::wstring &sPath, const std::vector<unsigned char> &bytes) {
+	HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	Assert::AreNotEqual(hFile, INVALID_HANDLE_VALUE);
+	defer({ CloseHandle(hFile); });
+	DWORD cbWritten = 0;
+	Assert::IsTrue(WriteFile(hFile, bytes.data(), static_cast<DWORD>(bytes.size()), &cbWritten, NULL) != FALSE);
+	Assert::AreEqual(cbWritten, static_cast<DWORD>(bytes.size()));
+}
+
+
+namespace Test {
+	TEST_CLASS(TestUsageAnalyzer) {
+	  public:
+		TEST_METHOD_INITIALIZE(MakeFolder) {
+			WCHAR szTemp[MAX_PATH];
+			Assert::AreNotEqual(GetTempPathW(MAX_PATH, szTemp), 0UL);
+			m_root = std::filesystem::path(szTemp) / L"ADSX Test Usage";
+			std::filesystem::remove_all(m_root);
+			std::filesystem::create_directories(m_root);
+		}
+
+		TEST_METHOD_CLEANUP(RemoveFolder) {
+			std::error_code ec;
+			std::filesystem::remove_all(m_root, ec);
+		}
+
+		// The volume inside a disk image gets its MFT read, not the image
+		// file itself taken for one
+		TEST_METHOD(TestVhdxOfPartitionedDisk) {
+			CheckImage(SyntheticDisk::MakeVhdx(SyntheticDisk::MakeDisk(MakeVolume(), true)));
+		}
+
+		TEST_METHOD(TestRawMbrDisk) {
+			CheckImage(SyntheticDisk::MakeDisk(MakeVolume(), false));
+		}
+
+		TEST_METHOD(TestVolumeImage) {
+			CheckImage(MakeVolume());
+		}
+
+	  private:
+		void CheckImage(const std::vector<unsigned char> &image) {
+			const std::wstring sImage = (m_root / L"disk.img").wstring();
+			WriteImage(sImage, image);
+			CUsageAnalyzer::Result result;
+			Assert::AreEqual(CUsageAnalyzer::Analyze(sImage.c_str(), 10, &result), S_OK);
+			Assert::IsTrue(result.bFromMft);
+			Assert::AreEqual(result.report.total.cFiles, static_cast<std::uint64_t>(2));
+			Assert::AreEqual(result.report.total.cStreams, static_cast<std::uint64_t>(4));
+			Assert::AreEqual(result.report.total.ullBytes, static_cast<std::uint64_t>(5 + 100000 + 10 + 20000));
+		}
+
+		std::filesystem::path m_root;
+	};
+}
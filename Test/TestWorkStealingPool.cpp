@@ -0,0 +1,72 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "WorkStealingPool.h"
+
+#include <atomic>
+#include <vector>
+
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using ADSX::CWorkStealingPool;
+
+
+// A task is how deep in a made-up tree it is
+struct Node {
+	unsigned uDepth;
+};
+
+// 1 + 3 + 9 + ... + 3^7
+static const unsigned uDepth = 7;
+static const unsigned uBranching = 3;
+static const unsigned cNodes = 3280;
+
+
+namespace Test {
+	TEST_CLASS(TestWorkStealingPool) {
+	  public:
+		TEST_METHOD(TestRunsEveryTaskOnce) {
+			CWorkStealingPool<Node> pool(4);
+			std::atomic<unsigned> cRun(0);
+			pool.Run({Node{0}}, [&](CWorkStealingPool<Node>::CContext &context, Node node) {
+				cRun++;
+				if (node.uDepth == uDepth) return;
+				for (unsigned i = 0; i < uBranching; i++) context.Push(Node{node.uDepth + 1});
+			});
+			Assert::AreEqual(cNodes, cRun.load());
+		}
+
+		TEST_METHOD(TestEachWorkerHasItsOwnIndex) {
+			CWorkStealingPool<Node> pool(4);
+			std::vector<unsigned> acRun(pool.WorkerCount());
+			pool.Run({Node{0}}, [&](CWorkStealingPool<Node>::CContext &context, Node node) {
+				// Nobody else touches this worker's slot, so no atomics
+				acRun[context.WorkerIndex()]++;
+				if (node.uDepth == uDepth) return;
+				for (unsigned i = 0; i < uBranching; i++) context.Push(Node{node.uDepth + 1});
+			});
+			unsigned cRun = 0;
+			for (unsigned c : acRun) cRun += c;
+			Assert::AreEqual(cNodes, cRun);
+		}
+
+		TEST_METHOD(TestCancelStopsEarly) {
+			CWorkStealingPool<Node> pool(4);
+			std::atomic<unsigned> cRun(0);
+			pool.Run({Node{0}}, [&](CWorkStealingPool<Node>::CContext &context, Node node) {
+				if (++cRun == 100) pool.Cancel();
+				if (node.uDepth == uDepth) return;
+				for (unsigned i = 0; i < uBranching; i++) context.Push(Node{node.uDepth + 1});
+			});
+			// Whatever was already running when it was called off finishes
+			Assert::IsTrue(cRun.load() < 100 + pool.WorkerCount());
+		}
+
+		TEST_METHOD(TestNothingToDo) {
+			CWorkStealingPool<Node> pool(4);
+			bool bRan = false;
+			pool.Run({}, [&](CWorkStealingPool<Node>::CContext &, Node) { bRan = true; });
+			Assert::IsFalse(bRan);
+		}
+	};
+}